@@ -80,6 +80,27 @@ uint8_t FoundROM[5][8];             // Table of ROM codes
                                     // [x][7] = CRC
 extern int numROMs;                 // Count of DS18B20 devices found
 
+#if SENSOR_STRING_CACHE == 1
+// Formatted temperature strings for each device. A new reading moves the
+// device generation one past the generation of its strings, and
+// convert_temperature() formats the strings again the next time it is
+// called for that device.
+static uint8_t DS18B20_generation[5];        // Reading generation
+static uint8_t DS18B20_string_generation[5]; // Generation of the strings
+static char DS18B20_string[5][2][7];         // Degrees C and F strings
+#define DS18B20_NEW_READING(device) \
+  DS18B20_generation[device] = (uint8_t)(DS18B20_string_generation[device] + 1)
+#endif // SENSOR_STRING_CACHE == 1
+
+#if DS18B20_NONBLOCKING == 1
+uint8_t ow_step;                    // 1-Wire transaction step
+uint8_t ow_device;                  // Device being read
+uint8_t ow_byte;                    // Byte index in ow_data
+uint8_t ow_mask;                    // Bit mask in ow_data[ow_byte]
+uint8_t ow_len;                     // Number of bytes to send or receive
+uint8_t ow_data[10];                // Bytes being sent or received
+#endif // DS18B20_NONBLOCKING == 1
+
 
 
 //---------------------------------------------------------------------------//
@@ -142,8 +163,39 @@ void get_temperature()
   //   close enough for this application.
   
   int i;
-  uint8_t j;
   uint8_t device_num;
+#if DS18B20_SCRATCH_STORE == 1
+  uint8_t scratch[DS18B20_SCRATCH_LEN];
+
+  // With DS18B20_SKIP_ROM, DS18B20_CRC_CHECK or a DS18B20_RESOLUTION below
+  // 12 bits the scratchpad of each device is read into a local buffer and
+  // stored by store_scratchpad(), which checks the CRC and clears the
+  // undefined low order bits. With DS18B20_SKIP_ROM one skip_ROM +
+  // convert_temp sequence then starts all devices converting at once.
+  for (device_num = 0; device_num <= numROMs; device_num++) {
+    if (reset_pulse()) return; // If reset_pulse returns 1 no devices are
+                               // present
+    transmit_byte(0x55); // match_ROM command
+    for (i = 0; i < 8; i++) transmit_byte(FoundROM[device_num][i]);
+    transmit_byte(0xbe); // read_scratchpad command
+    for (i = 0; i < DS18B20_SCRATCH_LEN; i++) scratch[i] = receive_byte();
+    store_scratchpad(device_num, scratch);
+#if DS18B20_SKIP_ROM == 0
+    // Start new conversion
+    reset_pulse();
+    transmit_byte(0x55); // match_ROM command
+    for (i = 0; i < 8; i++) transmit_byte(FoundROM[device_num][i]);
+    transmit_byte(0x44); // convert_temp command
+#endif // DS18B20_SKIP_ROM == 0
+  }
+#if DS18B20_SKIP_ROM == 1
+  // Start new conversion in all devices
+  if (reset_pulse()) return;
+  transmit_byte(0xcc); // skip_ROM command
+  transmit_byte(0x44); // convert_temp command
+#endif // DS18B20_SKIP_ROM == 1
+#else // DS18B20_SCRATCH_STORE == 0
+  uint8_t j;
 
   // Read current temperature from up to 5 devices
   for (device_num = 0; device_num < 5; device_num++) {
@@ -204,6 +256,9 @@ void get_temperature()
           j = (uint8_t)(j << 1);
         }
       }
+#if SENSOR_STRING_CACHE == 1
+      DS18B20_NEW_READING(device_num);
+#endif // SENSOR_STRING_CACHE == 1
       
       // Start new conversion
       reset_pulse();
@@ -214,10 +269,213 @@ void get_temperature()
       transmit_byte(0x44); // convert_temp command
     }
   }
+#endif // DS18B20_SCRATCH_STORE == 1
+}
+
+
+#if DS18B20_SCRATCH_STORE == 1
+void store_scratchpad(uint8_t device_num, uint8_t *scratch)
+{
+  // Stores the temperature bytes read from a device scratchpad in the
+  // DS18B20_scratch array. With DS18B20_CRC_CHECK the 9 scratchpad bytes
+  // are checked against the CRC and a failed read leaves the last good
+  // value in place. With a DS18B20_RESOLUTION below 12 bits the undefined
+  // low order temperature bits are cleared.
+#if DS18B20_CRC_CHECK == 1
+  if (dallas_crc8(scratch, 8) != scratch[8]) return;
+#endif // DS18B20_CRC_CHECK == 1
+  DS18B20_scratch[device_num][0] = (uint8_t)(scratch[0] & DS18B20_RESOLUTION_MASK);
+  DS18B20_scratch[device_num][1] = scratch[1];
+#if SENSOR_STRING_CACHE == 1
+  DS18B20_NEW_READING(device_num);
+#endif // SENSOR_STRING_CACHE == 1
+}
+
+
+uint8_t receive_byte(void)
+{
+  // This function receives one byte from the 1-Wire, LSbit first.
+  uint8_t j;
+  uint8_t value;
+  
+  value = 0;
+  j = 0x01;
+  while (1) {
+    if (read_bit() == 1) value |= j;
+    if (j == 0x80) break;
+    j = (uint8_t)(j << 1);
+  }
+  return value;
+}
+#endif // DS18B20_SCRATCH_STORE == 1
+
+
+#if DS18B20_RESOLUTION != 12
+void set_resolution(void)
+{
+  // Writes the DS18B20_RESOLUTION setting to the configuration register
+  // of all devices with one skip_ROM + write_scratchpad sequence. The Th
+  // and Tl alarm registers are written with their power up defaults. The
+  // setting is not copied to the DS18B20 EEPROM, so this is run after
+  // FindDevices() at each boot.
+  if (reset_pulse()) return;
+  transmit_byte(0xcc); // skip_ROM command
+  transmit_byte(0x4e); // write_scratchpad command
+  transmit_byte(0x4b); // Th register
+  transmit_byte(0x46); // Tl register
+  transmit_byte((uint8_t)(((DS18B20_RESOLUTION - 9) << 5) | 0x1f));
+}
+#endif // DS18B20_RESOLUTION != 12
+
+
+#if DS18B20_NONBLOCKING == 1
+void start_temperature(void)
+{
+  // This function starts a non-blocking read of all devices. The read
+  // performs the same 1-Wire steps as get_temperature(), but the steps are
+  // run by DS18B20_step() one bit slot per main loop pass, so the Ethernet
+  // and MQTT processing continue between the bits. A read that is already
+  // running is left to finish.
+  if (ow_step == OW_STEP_IDLE && numROMs >= 0) {
+    ow_device = 0;
+    ow_step = OW_STEP_RESET_READ;
+  }
+}
+
+
+static void ow_load_match_ROM(uint8_t command)
+{
+  // Fills ow_data with a match_ROM command, the ROM code of the current
+  // device, and the function command that follows it.
+  ow_data[0] = 0x55; // match_ROM command
+  memcpy(&ow_data[1], &FoundROM[ow_device][0], 8);
+  ow_data[9] = command;
+  ow_len = 10;
+  ow_byte = 0;
+  ow_mask = 0x01;
+}
+
+
+uint8_t DS18B20_step(void)
+{
+  // This function is called every main loop pass. It performs one step of
+  // the 1-Wire transaction started by start_temperature(). A step is a
+  // single reset pulse (about 0.8ms) or a single bit slot (about 75us).
+  // The steps for each device are:
+  //   Reset pulse
+  //   Match ROM + ROM code + read_scratchpad command (80 bit slots)
+  //   Read the first 2 bytes of the scratchpad (16 bit slots, or all 9
+  //     bytes with DS18B20_CRC_CHECK)
+  //   Reset pulse
+  //   Match ROM + ROM code + convert_temp command (80 bit slots)
+  // With DS18B20_SKIP_ROM the convert steps are run once after the last
+  // device is read, using skip_ROM + convert_temp (16 bit slots).
+  // The function returns 1 on the pass that completes the read of the last
+  // device, otherwise 0.
+  uint8_t bit;
+
+  switch (ow_step) {
+    case OW_STEP_IDLE:
+      return 0;
+
+    case OW_STEP_RESET_READ:
+    case OW_STEP_RESET_CONVERT:
+      if (reset_pulse()) {
+        // No devices are present
+        ow_step = OW_STEP_IDLE;
+        return 0;
+      }
+      if (ow_step == OW_STEP_RESET_READ) {
+        ow_load_match_ROM(0xbe); // read_scratchpad command
+        ow_step = OW_STEP_SEND_READ;
+      }
+      else {
+#if DS18B20_SKIP_ROM == 1
+        ow_data[0] = 0xcc; // skip_ROM command
+        ow_data[1] = 0x44; // convert_temp command
+        ow_len = 2;
+        ow_byte = 0;
+        ow_mask = 0x01;
+#else // DS18B20_SKIP_ROM == 0
+        ow_load_match_ROM(0x44); // convert_temp command
+#endif // DS18B20_SKIP_ROM == 1
+        ow_step = OW_STEP_SEND_CONVERT;
+      }
+      return 0;
+
+    case OW_STEP_SEND_READ:
+    case OW_STEP_SEND_CONVERT:
+      if (ow_data[ow_byte] & ow_mask) write_bit(1);
+      else write_bit(0);
+      break;
+
+    case OW_STEP_RECEIVE:
+      bit = (uint8_t)read_bit();
+      if (bit) ow_data[ow_byte] |= ow_mask;
+      else ow_data[ow_byte] &= (uint8_t)~ow_mask;
+      break;
+  }
+
+  // Advance to the next bit
+  ow_mask = (uint8_t)(ow_mask << 1);
+  if (ow_mask) return 0;
+  ow_mask = 0x01;
+  ow_byte++;
+  if (ow_byte < ow_len) return 0;
+
+  // All bytes sent or received
+  ow_byte = 0;
+  if (ow_step == OW_STEP_SEND_READ) {
+    ow_len = DS18B20_SCRATCH_LEN;
+    ow_step = OW_STEP_RECEIVE;
+  }
+  else if (ow_step == OW_STEP_RECEIVE) {
+    // Both temperature bytes are stored together so that a web page or MQTT
+    // publish never sees a half updated value.
+#if DS18B20_SCRATCH_STORE == 1
+    store_scratchpad(ow_device, ow_data);
+#else // DS18B20_SCRATCH_STORE == 0
+    DS18B20_scratch[ow_device][0] = ow_data[0];
+    DS18B20_scratch[ow_device][1] = ow_data[1];
+#if SENSOR_STRING_CACHE == 1
+    DS18B20_NEW_READING(ow_device);
+#endif // SENSOR_STRING_CACHE == 1
+#endif // DS18B20_SCRATCH_STORE == 1
+#if DS18B20_SKIP_ROM == 1
+    // Read the next device. The conversion is started in all devices
+    // after the last device is read.
+    ow_device++;
+    if (ow_device <= numROMs) ow_step = OW_STEP_RESET_READ;
+    else ow_step = OW_STEP_RESET_CONVERT;
+#else // DS18B20_SKIP_ROM == 0
+    ow_step = OW_STEP_RESET_CONVERT;
+#endif // DS18B20_SKIP_ROM == 1
+  }
+  else {
+#if DS18B20_SKIP_ROM == 1
+    // Conversion started in all devices
+    ow_step = OW_STEP_IDLE;
+    return 1;
+#else // DS18B20_SKIP_ROM == 0
+    // Conversion started. Go to the next device.
+    ow_device++;
+    if (ow_device <= numROMs) ow_step = OW_STEP_RESET_READ;
+    else {
+      ow_step = OW_STEP_IDLE;
+      return 1;
+    }
+#endif // DS18B20_SKIP_ROM == 1
+  }
+  return 0;
 }
+#endif // DS18B20_NONBLOCKING == 1
 
 
+#if SENSOR_STRING_CACHE == 1
+static void format_temperature(uint8_t device_num, uint8_t degCorF)
+#else // SENSOR_STRING_CACHE == 0
 void convert_temperature(uint8_t device_num, uint8_t degCorF)
+#endif // SENSOR_STRING_CACHE == 1
 {
   // This function will convert a temperature value stored in the
   // DS18B20_scratch array into a string in degrees C or degrees F. The
@@ -441,6 +699,30 @@ void convert_temperature(uint8_t device_num, uint8_t degCorF)
 }
 
 
+#if SENSOR_STRING_CACHE == 1
+void convert_temperature(uint8_t device_num, uint8_t degCorF)
+{
+  // Leaves the temperature string of the device in degrees C or degrees F
+  // in OctetArray. Both strings are formatted once per reading, the first
+  // time either is needed, and shared by the web pages and the MQTT
+  // publishes until the next reading.
+  if (device_num > numROMs) {
+    format_temperature(device_num, degCorF);
+    return;
+  }
+  if (DS18B20_string_generation[device_num] != DS18B20_generation[device_num]
+   || DS18B20_string[device_num][0][0] == '\0') {
+    format_temperature(device_num, 0);
+    strcpy(DS18B20_string[device_num][0], OctetArray);
+    format_temperature(device_num, 1);
+    strcpy(DS18B20_string[device_num][1], OctetArray);
+    DS18B20_string_generation[device_num] = DS18B20_generation[device_num];
+  }
+  strcpy(OctetArray, DS18B20_string[device_num][degCorF]);
+}
+#endif // SENSOR_STRING_CACHE == 1
+
+
 // IO 16 is Port C bit 6 (of 0-7)
 //   PC_DDR 1 is output, 0 is input
 //   PC_ODR
@@ -564,6 +846,9 @@ void init_DS18B20(void)
   memset(&DS18B20_scratch[0][0], 0, 10);
   memset(&FoundROM[0][0], 0, 40);
   numROMs = -1; // -1 indicates no devices. FindDevices will update this value.
+#if DS18B20_NONBLOCKING == 1
+  ow_step = OW_STEP_IDLE;
+#endif // DS18B20_NONBLOCKING == 1
 }
 
 
@@ -22,8 +22,54 @@
 #ifndef __DS18B20_H__
 #define __DS18B20_H__
 
+#if DS18B20_CRC_CHECK == 1
+// All 9 scratchpad bytes are read so the CRC can be checked
+#define DS18B20_SCRATCH_LEN	9
+#else
+#define DS18B20_SCRATCH_LEN	2
+#endif // DS18B20_CRC_CHECK == 1
+
+// Temperature LSB bits that are defined at the DS18B20_RESOLUTION setting
+#if DS18B20_RESOLUTION == 9
+#define DS18B20_RESOLUTION_MASK	0xf8
+#elif DS18B20_RESOLUTION == 10
+#define DS18B20_RESOLUTION_MASK	0xfc
+#elif DS18B20_RESOLUTION == 11
+#define DS18B20_RESOLUTION_MASK	0xfe
+#else
+#define DS18B20_RESOLUTION_MASK	0xff
+#endif // DS18B20_RESOLUTION
+
+// The scratchpad is read to a buffer and stored by store_scratchpad()
+#if DS18B20_SKIP_ROM == 1 || DS18B20_CRC_CHECK == 1 || DS18B20_RESOLUTION != 12
+#define DS18B20_SCRATCH_STORE	1
+#else
+#define DS18B20_SCRATCH_STORE	0
+#endif // DS18B20_SKIP_ROM == 1 || DS18B20_CRC_CHECK == 1 || DS18B20_RESOLUTION != 12
+
 void get_temperature(void);
+#if DS18B20_NONBLOCKING == 1
+void start_temperature(void);
+uint8_t DS18B20_step(void);
+
+// DS18B20_step() transaction steps
+#define OW_STEP_IDLE		0
+#define OW_STEP_RESET_READ	1
+#define OW_STEP_SEND_READ	2
+#define OW_STEP_RECEIVE		3
+#define OW_STEP_RESET_CONVERT	4
+#define OW_STEP_SEND_CONVERT	5
+
+extern uint8_t ow_step;
+#endif // DS18B20_NONBLOCKING == 1
 void convert_temperature(uint8_t device_num, uint8_t degCorF);
+#if DS18B20_SCRATCH_STORE == 1
+void store_scratchpad(uint8_t device_num, uint8_t *scratch);
+uint8_t receive_byte(void);
+#endif // DS18B20_SCRATCH_STORE == 1
+#if DS18B20_RESOLUTION != 12
+void set_resolution(void);
+#endif // DS18B20_RESOLUTION != 12
 int reset_pulse(void);
 uint8_t check_CRC(void);
 void transmit_byte(uint8_t transmit_value);
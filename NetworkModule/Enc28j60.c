@@ -51,9 +51,64 @@ extern uint8_t debug_bytes[10];
 
 extern uint32_t TRANSMIT_counter;      // Counts any transmit
 extern uint8_t stored_config_settings; // Config settings stored in EEPROM
+#if RX_FILTER_PROFILES == 1
+extern uint8_t stored_options2;        // Additional options stored in EEPROM
+#endif // RX_FILTER_PROFILES == 1
 extern uint8_t OctetArray[14];         // Used in emb_itoa conversions and to
                                        // transfer short strings globally
 
+#if FRAME_COPY_STATISTICS == 1
+// Frame copy timing. Times are in TIM1 ticks (10us) and are displayed on the
+// Link Error Statistics page.
+uint16_t rx_copy_time;                 // Last receive frame copy time
+uint16_t rx_copy_bytes;                // Size of that receive frame
+uint16_t tx_copy_time;                 // Last transmit frame copy time
+uint16_t tx_copy_bytes;                // Size of that transmit frame
+#endif // FRAME_COPY_STATISTICS == 1
+
+#if RX_OCCUPANCY_STATISTICS == 1
+// Receive buffer occupancy and transmit wait statistics. Displayed on the
+// Link Error Statistics page.
+uint16_t rx_occupancy;                 // Last sampled RX buffer occupancy
+uint16_t rx_occupancy_peak;            // Peak RX buffer occupancy (bytes)
+uint8_t rx_pktcnt_peak;                // Peak EPKTCNT value
+uint32_t tx_wait_time;                 // Total time (us) spent waiting for
+                                       // the transmitter
+#endif // RX_OCCUPANCY_STATISTICS == 1
+
+#if ENC28J60_FLOW_CONTROL == 1
+static uint8_t rx_flow_paused;         // 1 = EFLOCON is pausing the sender
+uint16_t rx_pause_counter;             // Counts high watermark crossings.
+                                       // Displayed on the Link Error
+                                       // Statistics page.
+#endif // ENC28J60_FLOW_CONTROL == 1
+
+#if RAM_HEADROOM_STATISTICS == 1
+extern uint16_t uip_buf_peak;          // Largest frame in the uip_buf
+#endif // RAM_HEADROOM_STATISTICS == 1
+
+#if TCP_REXMIT_FROM_TXBUF == 1
+// Copy of the identifying fields of the last TCP data segment written to the
+// ENC28J60 TX memory. Used by Enc28j60Resend() to decide whether a TCP
+// retransmission can use the frame still held in the TX memory.
+static uint8_t tx_last_valid;          // 1 = TX memory holds a TCP segment
+static uint16_t tx_last_start;         // TX memory address of the frame
+static uint16_t tx_last_len;           // TCP payload length
+static uint8_t tx_last_hdr[12];        // TCP ports, seqno and ackno
+static uint16_t tx_last_chksum;        // TCP checksum
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+#if TX_DOUBLE_BUFFER == 1
+// Transmit slot state. Frames alternate between the two TX slots so that a
+// frame can be copied to the ENC28J60 while the previous one is on the wire.
+static uint8_t tx_slot;                // Slot the next frame is written into
+static uint8_t tx_in_flight;           // 1 = a frame is being transmitted
+#endif // TX_DOUBLE_BUFFER == 1
+
+#if ARP_PENDING_SLOT == 1
+static uint16_t hold_len;              // Length of the frame in the hold slot
+#endif // ARP_PENDING_SLOT == 1
+
 
 // SPI Opcodes
 #define OPCODE_RCR			0x00	// Read Control Register
@@ -80,6 +135,11 @@ extern uint8_t OctetArray[14];         // Used in emb_itoa conversions and to
 
 // Registers in BankX: (means: available in each bank)
 #define BANKX_EIE			0x1B
+#define BANKX_EIE_RXERIE		0
+#define BANKX_EIE_TXERIE		1
+#define BANKX_EIE_TXIE			3
+#define BANKX_EIE_PKTIE			6
+#define BANKX_EIE_INTIE			7
 #define BANKX_EIR			0x1C
 #define BANKX_EIR_RXERIF		0
 #define BANKX_EIR_TXERIF		1
@@ -256,6 +316,35 @@ extern uint8_t stored_uip_ethaddr_oct[6];
 // uint8_t tsv_byte[7];
 
 
+#if FRAME_COPY_STATISTICS == 1
+static uint16_t read_TIM1(void)
+{
+  // Returns the TIM1 counter (10us per count). TIM1 is only reloaded by
+  // timer_update() in the main loop, so two reads taken within a single
+  // Enc28j60Receive() or Enc28j60Send() call give a valid elapsed time.
+  // The high byte must be read first to latch the low byte.
+  uint16_t counter;
+  counter = (uint16_t)(TIM1_CNTRH << 8);
+  counter = counter | TIM1_CNTRL;
+  return counter;
+}
+
+
+static uint16_t elapsed_TIM1(uint16_t start)
+{
+  // Returns the TIM1 ticks elapsed since "start", allowing for one TIM1
+  // auto-reload at 64000. With the FREE_RUNNING_TIMEBASE TIM1 wraps at 65536
+  // and the 16 bit difference needs no correction.
+  uint16_t now;
+  now = read_TIM1();
+#if FREE_RUNNING_TIMEBASE == 0
+  if (now < start) now = (uint16_t)(now + 64000);
+#endif // FREE_RUNNING_TIMEBASE == 0
+  return (uint16_t)(now - start);
+}
+#endif // FRAME_COPY_STATISTICS == 1
+
+
 void select(void)
 {
   // -CS low
@@ -329,6 +418,26 @@ void Enc28j60ClearMaskReg( uint8_t nRegister, uint8_t nMask)
 }
 
 
+// Writes a 16 bit value to an Enc28j60 register pair. nRegister is the low
+// byte register, the high byte register is always the next address.
+// ENC28J60_INLINE
+void Enc28j60WriteReg16(uint8_t nRegister, uint16_t nData)
+{
+  // Each WCR opcode must be terminated by -CS so the two writes can't share
+  // a single select / deselect window.
+  Enc28j60WriteReg(nRegister, (uint8_t)(nData >> 0));
+  Enc28j60WriteReg((uint8_t)(nRegister + 1), (uint8_t)(nData >> 8));
+}
+
+
+#if ENC28J60_BANK_SHADOW == 1
+// Shadow of the ECON1.BSEL1:BSEL0 bits. BANK_UNKNOWN forces the next
+// Enc28j60SwitchBank() to write both bits. The other ECON1 bits are not
+// shadowed since TXRTS and DMAST are changed by the ENC28J60 itself.
+#define BANK_UNKNOWN			0xff
+static uint8_t current_bank;
+#endif // ENC28J60_BANK_SHADOW == 1
+
 // Switches the currently selected bank
 // ENC28J60_INLINE
 void Enc28j60SwitchBank(uint8_t nBank)
@@ -336,8 +445,30 @@ void Enc28j60SwitchBank(uint8_t nBank)
   // Use built-in Bit-Set/Bit-Clear functions only while switching bank!
   // This is important since a read-modify-write cycle could alter unwanted
   // bits that got set or reset between read and write
+#if ENC28J60_BANK_SHADOW == 1
+  uint8_t nChange;
+  
+  if (current_bank == nBank) return; // Already selected
+  
+  if (current_bank == BANK_UNKNOWN) {
+    Enc28j60ClearMaskReg(BANKX_ECON1, (3<<BANKX_ECON1_BSEL0));
+    Enc28j60SetMaskReg(BANKX_ECON1, (uint8_t)(nBank << BANKX_ECON1_BSEL0));
+  }
+  else {
+    // Only clear / set the BSEL bits that change
+    nChange = (uint8_t)(current_bank ^ nBank);
+    if (current_bank & nChange) {
+      Enc28j60ClearMaskReg(BANKX_ECON1, (uint8_t)((current_bank & nChange) << BANKX_ECON1_BSEL0));
+    }
+    if (nBank & nChange) {
+      Enc28j60SetMaskReg(BANKX_ECON1, (uint8_t)((nBank & nChange) << BANKX_ECON1_BSEL0));
+    }
+  }
+  current_bank = nBank;
+#else
   Enc28j60ClearMaskReg(BANKX_ECON1, (3<<BANKX_ECON1_BSEL0));
   Enc28j60SetMaskReg(BANKX_ECON1, (uint8_t)(nBank << BANKX_ECON1_BSEL0));
+#endif // ENC28J60_BANK_SHADOW == 1
 }
 
 
@@ -373,6 +504,159 @@ void Enc28j60WritePhy( uint8_t nRegister, uint16_t nData)
 }
 
 
+#if RX_FILTER_PROFILES == 1 || MULTICAST_GROUP_SUPPORT == 1
+uint8_t Enc28j60HashPointer(const uint8_t *mac)
+{
+  // Returns the hash table filter pointer of a MAC address. The pointer is
+  // bits 28:23 of the IEEE 802.3 CRC of the destination address, calculated
+  // over the bits in the order they are sent (LSB first in each byte) and
+  // not complemented. It selects one of the 64 bits in EHT0 to EHT7 (EHT0
+  // bit 0 is pointer 0, EHT7 bit 7 is pointer 63).
+  // Datasheet example: 01-00-00-00-01-2C gives CRC 0xDA0B4575, pointer 0x34
+  // (EHT6 bit 4).
+  uint32_t crc;
+  uint8_t b;
+  uint8_t i;
+  uint8_t j;
+
+  crc = 0xffffffff;
+  for (i = 0; i < 6; i++) {
+    b = mac[i];
+    for (j = 0; j < 8; j++) {
+      if (((uint8_t)(crc >> 31) ^ b) & 0x01) crc = (crc << 1) ^ 0x04c11db7;
+      else crc <<= 1;
+      b >>= 1;
+    }
+  }
+  return (uint8_t)((crc >> 23) & 0x3f);
+}
+#endif // RX_FILTER_PROFILES == 1 || MULTICAST_GROUP_SUPPORT == 1
+
+
+#if RX_FILTER_PROFILES == 1
+// Multicast groups passed by receive filter profile 2:
+//   01-00-5E-00-00-01  224.0.0.1 All Hosts  CRC 0x7FA32D9B  pointer 63
+//   01-00-5E-00-00-FB  224.0.0.251 mDNS     CRC 0x3F7B3B21  pointer 62
+// so profile 2 sets EHT7 to 0xc0. Additional groups can be added here.
+#define MCAST_PROFILE_GROUPS	2
+static const uint8_t mcast_profile_mac[MCAST_PROFILE_GROUPS][6] = {
+  { 0x01, 0x00, 0x5e, 0x00, 0x00, 0x01 },
+  { 0x01, 0x00, 0x5e, 0x00, 0x00, 0xfb }
+};
+
+static void mcast_profile_hash(uint8_t *hash)
+{
+  // Sets the hash table bits of the receive filter profile 2 groups
+  uint8_t i;
+  uint8_t k;
+
+  for (i = 0; i < MCAST_PROFILE_GROUPS; i++) {
+    k = Enc28j60HashPointer(mcast_profile_mac[i]);
+    hash[k >> 3] |= (uint8_t)(1 << (k & 0x07));
+  }
+}
+
+void set_rx_filter_profile(uint8_t profile)
+{
+  // Programs the ENC28J60 receive filters. Must be called with BANK1
+  // selected.
+  //
+  // Profile 0: Standard. Unicast to our MAC, plus all broadcasts.
+  //   ERXFCON = 0xa1 (UCEN, CRCEN, BCEN)
+  // Profile 1: Unicast to our MAC, plus only ARP broadcasts. All other
+  //   broadcast traffic is rejected by the ENC28J60 so it never costs an
+  //   SPI transfer or a uip pass.
+  //   ERXFCON = 0xb0 (UCEN, CRCEN, PMEN)
+  // Profile 2: Same as Profile 1 plus the multicast groups in
+  //   mcast_profile_mac.
+  //   ERXFCON = 0xb4 (UCEN, CRCEN, PMEN, HTEN)
+  // ANDOR is 0 in all profiles, so a frame is accepted if ANY of the enabled
+  // filters accept it. Unicast IP traffic to our MAC is always accepted and
+  // the IP address is checked by uip.
+  //
+  // ARP pattern match: The pattern match filter computes a checksum over
+  // the bytes selected by the EPMM mask (offset EPMO from the start of the
+  // frame) and compares it to EPMCS. The selected bytes are the destination
+  // MAC (bytes 0-5, all 0xff) and the ethertype (bytes 12-13, 0x0806).
+  // The checksum is the IP style one's complement of the sum of the 16 bit
+  // words FFFF FFFF FFFF 0806 = ~0x0806 = 0xf7f9.
+  uint8_t hash[8];
+  uint8_t i;
+  
+  if (profile == 0 || profile > 2) {
+    Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xa1);
+    return;
+  }
+  
+  Enc28j60WriteReg(BANK1_EPMOL, (uint8_t)0x00);
+  Enc28j60WriteReg(BANK1_EPMOH, (uint8_t)0x00);
+  Enc28j60WriteReg(BANK1_EPMM0, (uint8_t)0x3f); // Bytes 0-5
+  Enc28j60WriteReg(BANK1_EPMM1, (uint8_t)0x30); // Bytes 12-13
+  for (i = BANK1_EPMM2; i <= BANK1_EPMM7; i++) Enc28j60WriteReg(i, (uint8_t)0x00);
+  Enc28j60WriteReg(BANK1_EPMCSL, (uint8_t)0xf9);
+  Enc28j60WriteReg(BANK1_EPMCSH, (uint8_t)0xf7);
+  
+  if (profile == 1) {
+    Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xb0);
+  }
+  else {
+    memset(hash, 0, 8);
+    mcast_profile_hash(hash);
+    for (i = 0; i < 8; i++) Enc28j60WriteReg((uint8_t)(BANK1_EHT0 + i), hash[i]);
+    Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xb4);
+  }
+}
+#endif // RX_FILTER_PROFILES == 1
+
+
+#if MULTICAST_GROUP_SUPPORT == 1
+void Enc28j60JoinGroups(void)
+{
+  // Programs the hash table filter for the multicast groups in
+  // uip_mcast_groups, plus the mcast_profile_mac groups when receive filter
+  // profile 2 is selected, and enables the filter if any bit is set. Called
+  // from Enc28j60Init() and again when the groups are changed.
+  //
+  // The hash table pointer of a group is that of its MAC address
+  // 01-00-5E-xx-xx-xx (see Enc28j60HashPointer()). Other groups that share
+  // a pointer also pass the filter; uip drops those by IP address.
+  uint8_t hash[8];
+  uint8_t mac[6];
+  uint8_t *group;
+  uint8_t any;
+  uint8_t i;
+  uint8_t k;
+
+  memset(hash, 0, 8);
+#if RX_FILTER_PROFILES == 1
+  if (((stored_options2 >> 3) & 0x03) == 2) mcast_profile_hash(hash);
+#endif // RX_FILTER_PROFILES == 1
+
+  for (i = 0; i < UIP_MCAST_GROUPS; i++) {
+    if (uip_mcast_groups[i][0] == 0) continue;
+    group = (uint8_t *)uip_mcast_groups[i];
+    mac[0] = 0x01;
+    mac[1] = 0x00;
+    mac[2] = 0x5e;
+    mac[3] = (uint8_t)(group[1] & 0x7f);
+    mac[4] = group[2];
+    mac[5] = group[3];
+    k = Enc28j60HashPointer(mac);
+    hash[k >> 3] |= (uint8_t)(1 << (k & 0x07));
+  }
+
+  any = 0;
+  Enc28j60SwitchBank(BANK1);
+  for (i = 0; i < 8; i++) {
+    Enc28j60WriteReg((uint8_t)(BANK1_EHT0 + i), hash[i]);
+    any |= hash[i];
+  }
+  if (any) Enc28j60SetMaskReg(BANK1_ERXFCON, 0x04); // HTEN
+  else Enc28j60ClearMaskReg(BANK1_ERXFCON, 0x04);
+}
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+
 void Enc28j60Init(void)
 {
   // It is assumed that the gpio_init set up the pins used for SPI bit
@@ -380,6 +664,24 @@ void Enc28j60Init(void)
 
   deselect(); // Just makes sure the -CS is not selected
 
+#if ENC28J60_BANK_SHADOW == 1
+  current_bank = BANK_UNKNOWN;
+#endif // ENC28J60_BANK_SHADOW == 1
+
+#if TCP_REXMIT_FROM_TXBUF == 1
+  tx_last_valid = 0;
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+#if TX_DOUBLE_BUFFER == 1
+  tx_slot = 0;
+  tx_in_flight = 0;
+#endif // TX_DOUBLE_BUFFER == 1
+
+#if ENC28J60_FLOW_CONTROL == 1
+  // The reset below clears EFLOCON
+  rx_flow_paused = 0;
+#endif // ENC28J60_FLOW_CONTROL == 1
+
   // Wait for the Oscillation Startup Timer. From the spec sheet:
   // The ENC28J60 contains an Oscillator Start-up Timer (OST) to ensure that
   // the oscillator and integrated PHY have stabilized before use. The OST 
@@ -398,6 +700,9 @@ void Enc28j60Init(void)
   select();
   SpiWriteByte(OPCODE_SRC); // Reset command
   deselect();
+#if ENC28J60_BANK_SHADOW == 1
+  current_bank = BANK_UNKNOWN; // The reset changed ECON1
+#endif // ENC28J60_BANK_SHADOW == 1
   
   // Errata: After sending an SPI Reset command, the PHY clock is stopped
   // but the ESTAT.CLKRDY bit is not cleared. Therefore, polling the CLKRDY
@@ -491,9 +796,19 @@ void Enc28j60Init(void)
   //           FF-FF-FF-FF-FF-FF will be accepted
   //       0 = Filter disabled
   //
+#if RX_FILTER_PROFILES == 1
+  // The receive filter profile is selected by the user with URL command /86x
+  // and is stored in stored_options2 bits 3-4. See set_rx_filter_profile().
+  set_rx_filter_profile((uint8_t)((stored_options2 >> 3) & 0x03));
+#else
   Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xa1);    // Allows packets if MAC matches
 						     // CRC check ON
 						     // FF-FF Packets accepted
+#endif // RX_FILTER_PROFILES == 1
+#if MULTICAST_GROUP_SUPPORT == 1
+  // Add the multicast groups joined to the hash table filter
+  Enc28j60JoinGroups();
+#endif // MULTICAST_GROUP_SUPPORT == 1
   // Enc28j60WriteReg(BANK1_ERXFCON, (uint8_t)0xa0);   // Allows packets if MAC matches
 						     // CRC check ON
 						     // FF-FF Packets rejected
@@ -513,7 +828,17 @@ void Enc28j60Init(void)
   Enc28j60SwitchBank(BANK2);
 
   // MAC RX Enable
+#if ENC28J60_FLOW_CONTROL == 1
+  if (stored_config_settings & 0x01) {
+    // Full duplex: TXPAUS lets the MAC send the PAUSE frames requested
+    // through EFLOCON by rx_flow_control(), RXPAUS makes it honour the
+    // PAUSE frames sent by the link partner.
+    Enc28j60WriteReg(BANK2_MACON1, (1<<BANK2_MACON1_MARXEN) | (1<<BANK2_MACON1_TXPAUS) | (1<<BANK2_MACON1_RXPAUS));
+  }
+  else Enc28j60WriteReg(BANK2_MACON1, (1<<BANK2_MACON1_MARXEN));
+#else // ENC28J60_FLOW_CONTROL == 0
   Enc28j60WriteReg(BANK2_MACON1, (1<<BANK2_MACON1_MARXEN));
+#endif // ENC28J60_FLOW_CONTROL == 1
   
   // if (stored_config_settings & 0x01) {
   //   Full duplex: Set MACON1.TXPAUS and MACON1.RXPAUS to allow flow control.
@@ -621,15 +946,194 @@ void Enc28j60Init(void)
   debug_bytes[2] = (uint8_t)(debug_bytes[2] | ((Enc28j60ReadReg(BANK3_EREVID)) & 0x07));
   update_debug_storage1(); // Only write the EEPROM if the byte changed.
 
+#if ENC28J60_INT_SUPPORT == 1
+  // Enable the -INT output for packet received, receive overflow, transmit
+  // complete and transmit error events
+  Enc28j60WriteReg(BANKX_EIE, (uint8_t)((1<<BANKX_EIE_INTIE)
+                                       | (1<<BANKX_EIE_PKTIE)
+                                       | (1<<BANKX_EIE_TXIE)
+                                       | (1<<BANKX_EIE_TXERIE)
+                                       | (1<<BANKX_EIE_RXERIE)));
+#endif // ENC28J60_INT_SUPPORT == 1
+
   // Enable Packet Reception
   Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_RXEN));
 }
 
 
+#if RX_DRAIN_SUPPORT == 1
+uint8_t Enc28j60PacketCount(void)
+{
+  // Returns the number of received packets waiting in the ENC28J60 receive
+  // buffer (EPKTCNT).
+  Enc28j60SwitchBank(BANK1);
+  return Enc28j60ReadReg(BANK1_EPKTCNT);
+}
+#endif // RX_DRAIN_SUPPORT == 1
+
+
+#if RX_PEEK_DISCARD == 1
+// Receive header peek
+// The first ENC28J60_PEEK_LEN bytes of a frame cover the Ethernet header
+// plus either the ARP target IP address or the IP header and the TCP
+// destination port. These are enough to decide if uip would discard the
+// frame anyway, in which case the rest of the frame is never copied over
+// the SPI.
+#define ENC28J60_PEEK_LEN	42
+#define ENC28J60_PEEK_MAX	8	// Max frames discarded per call
+
+extern uint16_t uip_listenports[UIP_LISTENPORTS];
+uint16_t rx_discard_counter;	// Counts frames discarded by the peek
+
+static uint8_t frame_is_ours(uint8_t* pBuffer)
+{
+  // Returns 1 if the frame header in pBuffer may be of interest to uip,
+  // 0 if uip would drop it without a response.
+  uint8_t* hostaddr;
+  uint16_t port;
+  uint8_t i;
+  
+  hostaddr = (uint8_t*)uip_hostaddr;
+  
+  // Ethertype at bytes 12 and 13
+  if (pBuffer[12] == 0x08 && pBuffer[13] == 0x06) {
+    // ARP. Keep it only if the target IP address (bytes 38 to 41) is ours.
+    for (i=0; i<4; i++) {
+      if (pBuffer[38 + i] != hostaddr[i]) return 0;
+    }
+    return 1;
+  }
+  
+  if (pBuffer[12] != 0x08 || pBuffer[13] != 0x00) return 0; // Not IPv4
+
+  // IP header. Keep anything with IP options (vhl != 0x45) or fragments
+  // so uip makes the decision for those.
+  if (pBuffer[14] != 0x45) return 1;
+  
+#if MULTICAST_GROUP_SUPPORT == 1
+  // UDP to a multicast group passed the hash table filter. uip checks that
+  // the group was joined.
+  if ((pBuffer[30] & 0xf0) == 0xe0 && pBuffer[23] == UIP_PROTO_UDP) return 1;
+#endif // MULTICAST_GROUP_SUPPORT == 1
+  
+#if DHCP_SUPPORT == 1
+  // DHCP replies are sent to the offered address before it is ours. The
+  // UDP destination port is at bytes 36 and 37.
+  if (pBuffer[23] == UIP_PROTO_UDP && pBuffer[36] == 0 && pBuffer[37] == DHCPC_CLIENT_PORT) return 1;
+#endif // DHCP_SUPPORT == 1
+  
+  // Destination IP address at bytes 30 to 33
+  for (i=0; i<4; i++) {
+    if (pBuffer[30 + i] != hostaddr[i]) return 0;
+  }
+  
+  // ICMP (ping) is always passed to uip
+  if (pBuffer[23] == UIP_PROTO_ICMP) return 1;
+  
+#if UDP_CONTROL_SUPPORT == 1
+  // UDP is only served on UDP_CONTROL_PORT, at bytes 36 and 37
+  if (pBuffer[23] == UIP_PROTO_UDP) {
+    return (uint8_t)(((pBuffer[36] << 8) | pBuffer[37]) == UDP_CONTROL_PORT);
+  }
+#endif // UDP_CONTROL_SUPPORT == 1
+  
+  if (pBuffer[23] != UIP_PROTO_TCP) return 0;
+  
+  // TCP destination port at bytes 36 and 37 (network byte order). Keep the
+  // frame if the port is a listening port or is the local port of an open
+  // connection (HTTP or MQTT).
+  port = (uint16_t)((pBuffer[36] << 8) | pBuffer[37]);
+  for (i=0; i<UIP_LISTENPORTS; i++) {
+    if (uip_listenports[i] != 0 && port == ntohs(uip_listenports[i])) return 1;
+  }
+  for (i=0; i<UIP_CONNS; i++) {
+    if (uip_conns[i].tcpstateflags != UIP_CLOSED
+     && port == ntohs(uip_conns[i].lport)) return 1;
+  }
+  return 0;
+}
+#endif // RX_PEEK_DISCARD == 1
+
+#if RX_OCCUPANCY_STATISTICS == 1 || ENC28J60_FLOW_CONTROL == 1
+static uint16_t rx_buffer_used(void)
+{
+  // Returns the receive buffer occupancy in bytes. ERXRDPT is one byte
+  // behind the oldest unread byte (see the errata workaround in
+  // Enc28j60Receive()) and ERXWRPT is where the next received byte will be
+  // written.
+  uint16_t wrpt;
+  uint16_t rdpt;
+  
+  Enc28j60SwitchBank(BANK0);
+  wrpt = ((uint16_t) Enc28j60ReadReg(BANK0_ERXWRPTL) << 0);
+  wrpt |= ((uint16_t) Enc28j60ReadReg(BANK0_ERXWRPTH) << 8);
+  rdpt = ((uint16_t) Enc28j60ReadReg(BANK0_ERXRDPTL) << 0);
+  rdpt |= ((uint16_t) Enc28j60ReadReg(BANK0_ERXRDPTH) << 8);
+  if (wrpt > rdpt) return (uint16_t)(wrpt - rdpt - 1);
+  return (uint16_t)((ENC28J60_RXEND - ENC28J60_RXSTART) - (rdpt - wrpt));
+}
+#endif // RX_OCCUPANCY_STATISTICS == 1 || ENC28J60_FLOW_CONTROL == 1
+
+
+#if ENC28J60_FLOW_CONTROL == 1
+static void rx_flow_control(uint8_t pause)
+{
+  // Pause or release the link partner through EFLOCON.FCEN.
+  // Full duplex:
+  //   FCEN = 10 sends PAUSE frames (pause time EPAUS) periodically until
+  //   FCEN is changed.
+  //   FCEN = 11 sends one PAUSE frame with a zero pause time, so the link
+  //   partner resumes at once, then flow control turns itself off.
+  // Half duplex:
+  //   FCEN = 01 turns on backpressure (the MAC jams incoming frames so the
+  //   sender backs off as after a collision).
+  //   FCEN = 00 turns it off.
+  uint8_t fcen;
+  
+  if (stored_config_settings & 0x01) fcen = (uint8_t)(pause ? 0x02 : 0x03);
+  else fcen = (uint8_t)(pause ? 0x01 : 0x00);
+  Enc28j60SwitchBank(BANK3);
+  Enc28j60WriteReg(BANK3_EFLOCON, fcen);
+  rx_flow_paused = pause;
+  if (pause) rx_pause_counter++;
+}
+#endif // ENC28J60_FLOW_CONTROL == 1
+
+
+#if ENC28J60_INT_SUPPORT == 1
+uint8_t rx_poll_due;                   // Set by the main loop periodic timer
+                                       // so that EPKTCNT is read even if
+                                       // -INT is not asserted
+#endif // ENC28J60_INT_SUPPORT == 1
+
+
 uint16_t Enc28j60Receive(uint8_t* pBuffer)
 {
   uint16_t nBytes;
   uint16_t nNextPacket;
+#if RX_PEEK_DISCARD == 1
+  uint8_t discard;
+  uint8_t discard_count;
+  
+  discard_count = 0;
+#endif // RX_PEEK_DISCARD == 1
+
+#if ENC28J60_INT_SUPPORT == 1
+  // The ENC28J60 asserts -INT while a packet is waiting (PKTIF), or on a
+  // receive overflow (RXERIF) or a transmit event (TXIF / TXERIF). If -INT
+  // is not asserted there is nothing to do, so return without any SPI
+  // traffic.
+  // The pin level is read rather than counting EXTI edges. -INT stays
+  // asserted while an event is pending, so a level read can't miss a
+  // packet that arrives before the previous one is read. The EXTI edge is
+  // only used to wake idle_wait().
+  // PKTIF is not reliable (ENC28J60 silicon errata): it can be clear while
+  // EPKTCNT is not zero, and then -INT would not show the waiting packets.
+  // So EPKTCNT is also read once per periodic timer interval (20ms) when
+  // the main loop sets rx_poll_due.
+  if (!ENC28J60_INT_ASSERTED() && rx_poll_due == 0) return 0;
+  rx_poll_due = 0;
+#endif // ENC28J60_INT_SUPPORT == 1
 
   // Check for buffer overflow - RXERIF (bit 0) of EIR register
   // If overflow increment the error counter
@@ -641,6 +1145,9 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
 
     // Increment the RXERIF counter
     debug_bytes[4]++;
+#if TRACE_RING_SUPPORT == 1
+    trace_event(TRACE_RXERIF, 0, debug_bytes[4]);
+#endif // TRACE_RING_SUPPORT == 1
     // Store result in EEPROM for display
     update_debug_storage1();
     
@@ -648,11 +1155,50 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
     Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_RXERIF));
   }
 
+#if RX_PEEK_DISCARD == 1
+  receive_next:
+  discard = 0;
+#endif // RX_PEEK_DISCARD == 1
+
   // Check for at least 1 waiting packet in the buffer
   Enc28j60SwitchBank(BANK1);
+#if RX_OCCUPANCY_STATISTICS == 1 || ENC28J60_FLOW_CONTROL == 1
+  {
+    uint8_t pktcnt;
+    uint16_t used;
+    
+    pktcnt = Enc28j60ReadReg(BANK1_EPKTCNT);
+    if (pktcnt == 0) {
+#if ENC28J60_FLOW_CONTROL == 1
+      // The buffer is empty. Normally the pause was already released while
+      // the last frames were read.
+      if (rx_flow_paused) rx_flow_control(0);
+#endif // ENC28J60_FLOW_CONTROL == 1
+      return 0;
+    }
+    
+    // Sample the receive buffer occupancy
+    used = rx_buffer_used();
+#if RX_OCCUPANCY_STATISTICS == 1
+    if (pktcnt > rx_pktcnt_peak) rx_pktcnt_peak = pktcnt;
+    rx_occupancy = used;
+    if (rx_occupancy > rx_occupancy_peak) rx_occupancy_peak = rx_occupancy;
+#endif // RX_OCCUPANCY_STATISTICS == 1
+#if ENC28J60_FLOW_CONTROL == 1
+    // Slow the sender down at the link before the ring overflows and
+    // frames are dropped (RXERIF). The watermarks are far enough apart
+    // that EFLOCON is not rewritten on every frame.
+    if (rx_flow_paused == 0) {
+      if (used > ENC28J60_FLOW_HIGH) rx_flow_control(1);
+    }
+    else if (used < ENC28J60_FLOW_LOW) rx_flow_control(0);
+#endif // ENC28J60_FLOW_CONTROL == 1
+  }
+#else
   if (Enc28j60ReadReg(BANK1_EPKTCNT) == 0) {
     return 0;
   }
+#endif // RX_OCCUPANCY_STATISTICS == 1 || ENC28J60_FLOW_CONTROL == 1
 
   select();
 
@@ -677,7 +1223,29 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
   //   any packet that exceeds MAXFRAME.
   //
   if (nBytes <= ENC28J60_MAXFRAME) {
+#if FRAME_COPY_STATISTICS == 1
+    uint16_t start;
+    start = read_TIM1();
+#endif // FRAME_COPY_STATISTICS == 1
+
+#if RX_PEEK_DISCARD == 1
+    // Copy only the headers first. If the frame is not of interest stop
+    // reading here. The rest of the frame is skipped when ERDPT is moved
+    // to the next packet below.
+    if (nBytes >= ENC28J60_PEEK_LEN) {
+      SpiReadChunk(pBuffer, ENC28J60_PEEK_LEN);
+      if (frame_is_ours(pBuffer) == 0) discard = 1;
+      else SpiReadChunk(pBuffer + ENC28J60_PEEK_LEN, (uint16_t)(nBytes - ENC28J60_PEEK_LEN));
+    }
+    else SpiReadChunk(pBuffer, nBytes);
+#else
     SpiReadChunk(pBuffer, nBytes);
+#endif // RX_PEEK_DISCARD == 1
+
+#if FRAME_COPY_STATISTICS == 1
+    rx_copy_time = elapsed_TIM1(start);
+    rx_copy_bytes = nBytes;
+#endif // FRAME_COPY_STATISTICS == 1
   }
   else {
 #if DEBUG_SUPPORT == 15
@@ -689,8 +1257,7 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
 
   Enc28j60SwitchBank(BANK0);
   // Set RX Read-Pointer and SPI Read-Pointer to next-frame-address
-  Enc28j60WriteReg(BANK0_ERDPTL , (uint8_t) (nNextPacket >> 0));
-  Enc28j60WriteReg(BANK0_ERDPTH , (uint8_t) (nNextPacket >> 8));
+  Enc28j60WriteReg16(BANK0_ERDPTL, nNextPacket);
 
   // Errata Workaround: ERXRDPT should never be programmed with an even value
   // Because the NextPacket will always point to an even value, we can subtract 1 from it
@@ -701,12 +1268,23 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
     nNextPacket = ENC28J60_RXEND;
   }
 
-  Enc28j60WriteReg(BANK0_ERXRDPTL, (uint8_t)(nNextPacket >> 0));
-  Enc28j60WriteReg(BANK0_ERXRDPTH, (uint8_t)(nNextPacket >> 8));
+  Enc28j60WriteReg16(BANK0_ERXRDPTL, nNextPacket);
 
   // And decrement PacketCounter
   Enc28j60SetMaskReg(BANKX_ECON2 , (1<<BANKX_ECON2_PKTDEC));
   
+#if RX_PEEK_DISCARD == 1
+  if (discard == 1) {
+    // The frame was dropped after the header peek. Try the next waiting
+    // frame (if any) so that a discarded frame doesn't use up a main loop
+    // pass.
+    rx_discard_counter++;
+    discard_count++;
+    if (discard_count < ENC28J60_PEEK_MAX) goto receive_next;
+    return 0;
+  }
+#endif // RX_PEEK_DISCARD == 1
+
 #if DEBUG_SUPPORT == 15
 // if (nBytes > (ENC28J60_MAXFRAME - 20)) {
 // UARTPrintf("Enc28j60Received nBytes = ");
@@ -720,12 +1298,54 @@ uint16_t Enc28j60Receive(uint8_t* pBuffer)
 }
 
 
+#if TCP_REXMIT_FROM_TXBUF == 1
+static void record_tx_frame(uint8_t* pBuffer, uint16_t nBytes, uint16_t TxStart)
+{
+  // Remember the TCP ports, sequence and acknowledge numbers, and checksum
+  // of a TCP segment with data that is being copied to the TX memory. Any
+  // other frame overwrites the TX memory so the record is invalidated.
+  // Only IPv4 frames without IP options are recorded, so the TCP header
+  // always starts at byte 34 of the frame.
+  //   bytes 12-13 ethertype        byte 14 IP version / header length
+  //   byte 23 IP protocol          bytes 34-45 TCP ports, seqno, ackno
+  //   bytes 50-51 TCP checksum     bytes 54+ TCP payload (no TCP options)
+  tx_last_valid = 0;
+  if (nBytes > (UIP_LLH_LEN + UIP_TCPIP_HLEN)
+   && pBuffer[12] == 0x08
+   && pBuffer[13] == 0x00
+   && pBuffer[14] == 0x45
+   && pBuffer[23] == UIP_PROTO_TCP
+   && pBuffer[46] == 0x50) {
+    memcpy(tx_last_hdr, &pBuffer[34], 12);
+    tx_last_chksum = (uint16_t)(((uint16_t)pBuffer[50] << 8) | pBuffer[51]);
+    tx_last_len = (uint16_t)(nBytes - (UIP_LLH_LEN + UIP_TCPIP_HLEN));
+    tx_last_start = TxStart;
+    tx_last_valid = 1;
+  }
+}
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+
 void Enc28j60Send(uint8_t* pBuffer, uint16_t nBytes)
 {
+#if TX_DOUBLE_BUFFER == 1
+  uint16_t TxStart;
+  uint16_t TxEnd;
+
+  // The frame is written into the TX slot that is NOT being transmitted, so
+  // the SPI copy overlaps with the transmission of the previous frame.
+  if (tx_slot == 0) TxStart = ENC28J60_TXSTART;
+  else TxStart = ENC28J60_TXSLOT1;
+  TxEnd = TxStart + nBytes;
+
+  Enc28j60SwitchBank(BANK0);
+  Enc28j60WriteReg16(BANK0_EWRPTL, TxStart);
+#if TCP_REXMIT_FROM_TXBUF == 1
+  record_tx_frame(pBuffer, nBytes, TxStart);
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+#else
   uint16_t TxEnd = ENC28J60_TXSTART + nBytes;
   uint8_t i;
-  uint8_t txerif_temp;
-  uint8_t late_collision;
 
   // Wait for a previously buffered frame to be sent out completely
   // 
@@ -736,13 +1356,18 @@ void Enc28j60Send(uint8_t* pBuffer, uint16_t nBytes)
   while (i--) {
     if (!(Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_TXRTS))) break;
     wait_timer(500);  // Wait 500 uS
+#if RX_OCCUPANCY_STATISTICS == 1
+    tx_wait_time += 500;
+#endif // RX_OCCUPANCY_STATISTICS == 1
   }
 
   Enc28j60SwitchBank(BANK0);
-  Enc28j60WriteReg(BANK0_EWRPTL, (uint8_t) (ENC28J60_TXSTART >> 0));
-  Enc28j60WriteReg(BANK0_EWRPTH, (uint8_t) (ENC28J60_TXSTART >> 8));
-  Enc28j60WriteReg(BANK0_ETXNDL, (uint8_t) (TxEnd >> 0));
-  Enc28j60WriteReg(BANK0_ETXNDH, (uint8_t) (TxEnd >> 8));	
+  Enc28j60WriteReg16(BANK0_EWRPTL, ENC28J60_TXSTART);
+  Enc28j60WriteReg16(BANK0_ETXNDL, TxEnd);
+#if TCP_REXMIT_FROM_TXBUF == 1
+  record_tx_frame(pBuffer, nBytes, ENC28J60_TXSTART);
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+#endif // TX_DOUBLE_BUFFER == 1
 
   select();
 
@@ -760,9 +1385,26 @@ void Enc28j60Send(uint8_t* pBuffer, uint16_t nBytes)
     // 	0 = The values in MACON3 will be used to determine how the packet
     //	will be transmitted
 
+#if FRAME_COPY_STATISTICS == 1
+  {
+    uint16_t start;
+    start = read_TIM1();
+    SpiWriteChunk(pBuffer, nBytes); // Copy data to the ENC28J60 transmit buffer
+    tx_copy_time = elapsed_TIM1(start);
+    tx_copy_bytes = nBytes;
+  }
+#else
   SpiWriteChunk(pBuffer, nBytes); // Copy data to the ENC28J60 transmit buffer
+#endif // FRAME_COPY_STATISTICS == 1
 
   deselect();
+
+#if RAM_HEADROOM_STATISTICS == 1
+  if (nBytes > uip_buf_peak) uip_buf_peak = nBytes;
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if TRACE_RING_SUPPORT == 1
+  trace_frame(TRACE_TX, pBuffer, nBytes);
+#endif // TRACE_RING_SUPPORT == 1
   
   // Errata: In Half-Duplex mode, a hardware transmission abort caused by
   // excessive collisions, a late collision or excessive deferrals, may stall
@@ -835,6 +1477,16 @@ void Enc28j60Send(uint8_t* pBuffer, uint16_t nBytes)
   //        length defined by the MAMXFL registers was made without setting
   //        the MACON3.HFRMEN bit or per packet POVERRIDE and PHUGEEN bits.
   //
+#if TX_DOUBLE_BUFFER == 1
+  // The other TX slot may still be transmitting. Complete it (including any
+  // late collision retries, which need ETXST / ETXND to still point at that
+  // slot) before pointing the ENC28J60 at the new slot.
+  if (tx_in_flight) Enc28j60SendComplete();
+  Enc28j60SwitchBank(BANK0);
+  Enc28j60WriteReg16(BANK0_ETXSTL, TxStart);
+  Enc28j60WriteReg16(BANK0_ETXNDL, TxEnd);
+#endif // TX_DOUBLE_BUFFER == 1
+
   // If there is a TXERIF error already present reset the transmit logic.
   // This should never happen as any error should have been handled the last
   // time a transmit occurred. If no error just start the transmission.
@@ -849,9 +1501,36 @@ wait_timer(10);  // Wait 10 uS
 
   // Count any transmit
   TRANSMIT_counter++;
+
+#if TX_DOUBLE_BUFFER == 1 || ENC28J60_INT_SUPPORT == 1
+  // Clear TXIF so that it reports the completion of THIS transmission.
+  // Otherwise TXIF is left set from the previous transmission.
+  Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_TXIF));
+#endif // TX_DOUBLE_BUFFER == 1 || ENC28J60_INT_SUPPORT == 1
     
   // Start transmission
   Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRTS));
+
+#if TX_DOUBLE_BUFFER == 1
+  // Don't wait for the transmission to complete. The completion (and any
+  // late collision retries) is handled by Enc28j60SendComplete() when the
+  // next frame is sent, or by Enc28j60TxPoll() from the main loop.
+  tx_in_flight = 1;
+  tx_slot ^= 1;
+#else
+  Enc28j60SendComplete();
+#endif // TX_DOUBLE_BUFFER == 1
+}
+
+
+void Enc28j60SendComplete(void)
+{
+  // Waits for the frame started by Enc28j60Send() to complete transmission
+  // and performs the late collision retries described in Enc28j60Send().
+  uint8_t i;
+  uint8_t txerif_temp;
+  uint8_t late_collision;
+
   // Wait for transmission complete
   txerif_temp = wait_for_xmit_complete();
     
@@ -913,12 +1592,228 @@ wait_timer(10);  // Wait 10 uS
     }
   }
   
+#if TX_DOUBLE_BUFFER == 1
+  tx_in_flight = 0;
+#endif // TX_DOUBLE_BUFFER == 1
+
+#if ENC28J60_INT_SUPPORT == 1
+  // The transmit event has been handled. Clear TXIF so that -INT is
+  // released.
+  Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_TXIF));
+#endif // ENC28J60_INT_SUPPORT == 1
+
   // Save debug_bytes[3] (TXERIF counter) in EEPROM for display in Link Error
   // Statistics
   update_debug_storage1();
 }
 
 
+#if TCP_REXMIT_FROM_TXBUF == 1
+uint8_t Enc28j60Resend(uint16_t lport, uint16_t rport, uint8_t* pSeqno, uint16_t len, uint8_t* pAckno)
+{
+  // Retransmit the TCP segment that is still in the ENC28J60 TX memory
+  // instead of having the application regenerate it.
+  //   lport and rport are the connection's ports in network byte order.
+  //   pSeqno points to the connection's snd_nxt sequence number.
+  //   len is the number of unacknowledged bytes in the connection.
+  //   pAckno points to the connection's current rcv_nxt.
+  // Returns 1 if the segment was retransmitted, 0 if the TX memory doesn't
+  // hold that segment (the caller must then regenerate it).
+  uint32_t sum;
+  uint8_t i;
+#if TX_DOUBLE_BUFFER == 0
+  uint8_t j;
+#endif // TX_DOUBLE_BUFFER == 0
+
+  if (tx_last_valid == 0) return 0;
+  if (tx_last_len != len) return 0;
+  if (memcmp(&tx_last_hdr[0], &lport, 2) != 0) return 0;
+  if (memcmp(&tx_last_hdr[2], &rport, 2) != 0) return 0;
+  if (memcmp(&tx_last_hdr[4], pSeqno, 4) != 0) return 0;
+
+#if TX_DOUBLE_BUFFER == 1
+  // The segment may still be in flight. It has to complete before the
+  // TX memory is modified and the transmit is restarted. ETXST / ETXND
+  // still point at the segment's slot.
+  if (tx_in_flight) Enc28j60SendComplete();
+#else
+  // Wait for the previous transmission to end (see Enc28j60Send)
+  j = 200;
+  while (j--) {
+    if (!(Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_TXRTS))) break;
+    wait_timer(500);  // Wait 500 uS
+#if RX_OCCUPANCY_STATISTICS == 1
+    tx_wait_time += 500;
+#endif // RX_OCCUPANCY_STATISTICS == 1
+  }
+#endif // TX_DOUBLE_BUFFER == 1
+
+  if (memcmp(&tx_last_hdr[8], pAckno, 4) != 0) {
+    // More data was received since the segment was sent, so the
+    // acknowledge number changed. Update the checksum incrementally
+    // (RFC 1624: HC' = ~(~HC + ~m + m')) and write the new acknowledge
+    // number and checksum into the frame in the TX memory. The frame
+    // starts one byte after the per-packet control byte.
+    sum = (uint16_t)~tx_last_chksum;
+    for (i = 0; i < 4; i += 2) {
+      sum += (uint16_t)~(((uint16_t)tx_last_hdr[8 + i] << 8) | tx_last_hdr[9 + i]);
+      sum += (uint16_t)(((uint16_t)pAckno[i] << 8) | pAckno[i + 1]);
+    }
+    while (sum >> 16) sum = (sum & 0xffff) + (sum >> 16);
+    tx_last_chksum = (uint16_t)~sum;
+    memcpy(&tx_last_hdr[8], pAckno, 4);
+
+    Enc28j60SwitchBank(BANK0);
+    Enc28j60WriteReg16(BANK0_EWRPTL, (uint16_t)(tx_last_start + 1 + 42));
+    select();
+    SpiWriteByte(OPCODE_WBM);
+    SpiWriteChunk(pAckno, 4);
+    deselect();
+    Enc28j60WriteReg16(BANK0_EWRPTL, (uint16_t)(tx_last_start + 1 + 50));
+    select();
+    SpiWriteByte(OPCODE_WBM);
+    SpiWriteByte((uint8_t)(tx_last_chksum >> 8));
+    SpiWriteByte((uint8_t)(tx_last_chksum));
+    deselect();
+  }
+
+  if (Enc28j60ReadReg(BANKX_EIR) & (1<<BANKX_EIR_TXERIF)) {
+    // Count TXERIF error
+    debug_bytes[3]++;
+    wait_timer(10);  // Wait 10 uS
+    reset_transmit_logic();
+  }
+
+  TRANSMIT_counter++;
+
+#if TX_DOUBLE_BUFFER == 1 || ENC28J60_INT_SUPPORT == 1
+  Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_TXIF));
+#endif // TX_DOUBLE_BUFFER == 1 || ENC28J60_INT_SUPPORT == 1
+
+  // Start transmission
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRTS));
+
+#if TX_DOUBLE_BUFFER == 1
+  // The segment stays in its slot, so there is no slot change here
+  tx_in_flight = 1;
+#else
+  Enc28j60SendComplete();
+#endif // TX_DOUBLE_BUFFER == 1
+
+  return 1;
+}
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+
+#if ARP_PENDING_SLOT == 1
+void Enc28j60Hold(uint8_t* pBuffer, uint16_t nBytes)
+{
+  // Copy a frame that is waiting on an ARP reply into the hold slot. The
+  // frame already has its Ethernet source address and type, only the
+  // destination address is missing. It is written with Enc28j60SendHeld()
+  // once the ARP reply arrives. A new frame replaces any frame already held.
+  Enc28j60SwitchBank(BANK0);
+  Enc28j60WriteReg16(BANK0_EWRPTL, ENC28J60_HOLDSTART);
+  select();
+  SpiWriteByte(OPCODE_WBM);
+  SpiWriteByte(0);		 // Per-packet-control-byte (see Enc28j60Send)
+  SpiWriteChunk(pBuffer, nBytes);
+  deselect();
+  hold_len = nBytes;
+}
+
+
+void Enc28j60SendHeld(uint8_t* pDestMac)
+{
+  // Write the destination MAC address into the frame in the hold slot and
+  // transmit it directly from the slot.
+  uint16_t HoldEnd;
+#if TX_DOUBLE_BUFFER == 0
+  uint8_t i;
+#endif // TX_DOUBLE_BUFFER == 0
+
+  HoldEnd = ENC28J60_HOLDSTART + hold_len;
+
+#if TX_DOUBLE_BUFFER == 1
+  // A frame in flight has to complete (including any late collision retries)
+  // before ETXST / ETXND are pointed at the hold slot.
+  if (tx_in_flight) Enc28j60SendComplete();
+#else
+  // Wait for the previous transmission to end (see Enc28j60Send)
+  i = 200;
+  while (i--) {
+    if (!(Enc28j60ReadReg(BANKX_ECON1) & (1<<BANKX_ECON1_TXRTS))) break;
+    wait_timer(500);  // Wait 500 uS
+#if RX_OCCUPANCY_STATISTICS == 1
+    tx_wait_time += 500;
+#endif // RX_OCCUPANCY_STATISTICS == 1
+  }
+#endif // TX_DOUBLE_BUFFER == 1
+
+  Enc28j60SwitchBank(BANK0);
+  Enc28j60WriteReg16(BANK0_EWRPTL, (uint16_t)(ENC28J60_HOLDSTART + 1));
+  select();
+  SpiWriteByte(OPCODE_WBM);
+  SpiWriteChunk(pDestMac, 6);
+  deselect();
+  Enc28j60WriteReg16(BANK0_ETXSTL, ENC28J60_HOLDSTART);
+  Enc28j60WriteReg16(BANK0_ETXNDL, HoldEnd);
+
+#if TCP_REXMIT_FROM_TXBUF == 1
+  // ETXST / ETXND no longer point at the last TCP segment
+  tx_last_valid = 0;
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+  if (Enc28j60ReadReg(BANKX_EIR) & (1<<BANKX_EIR_TXERIF)) {
+    // Count TXERIF error
+    debug_bytes[3]++;
+    wait_timer(10);  // Wait 10 uS
+    reset_transmit_logic();
+  }
+
+  TRANSMIT_counter++;
+
+#if TX_DOUBLE_BUFFER == 1 || ENC28J60_INT_SUPPORT == 1
+  Enc28j60ClearMaskReg(BANKX_EIR, (1<<BANKX_EIR_TXIF));
+#endif // TX_DOUBLE_BUFFER == 1 || ENC28J60_INT_SUPPORT == 1
+
+  // Start transmission
+  Enc28j60SetMaskReg(BANKX_ECON1, (1<<BANKX_ECON1_TXRTS));
+
+  // The held frame is sent to completion so that the TX pointers can be
+  // returned to the TX area for the next Enc28j60Send().
+#if TX_DOUBLE_BUFFER == 1
+  tx_in_flight = 1;
+#endif // TX_DOUBLE_BUFFER == 1
+  Enc28j60SendComplete();
+#if TX_DOUBLE_BUFFER == 0
+  // Without the double buffer Enc28j60Send() only writes ETXND
+  Enc28j60WriteReg16(BANK0_ETXSTL, ENC28J60_TXSTART);
+#endif // TX_DOUBLE_BUFFER == 0
+}
+#endif // ARP_PENDING_SLOT == 1
+
+
+#if TX_DOUBLE_BUFFER == 1
+void Enc28j60TxPoll(void)
+{
+  // Non-blocking check of the TX slot in flight. Called from the main loop.
+  // If the transmission has finished (TXIF) or failed (TXERIF) the
+  // completion processing is run now so that the next Enc28j60Send() does
+  // not need to wait.
+  if (tx_in_flight) {
+#if ENC28J60_INT_SUPPORT == 1
+    // No need to read EIR unless the ENC28J60 is signalling an event
+    if (!ENC28J60_INT_ASSERTED()) return;
+#endif // ENC28J60_INT_SUPPORT == 1
+    if (Enc28j60ReadReg(BANKX_EIR) & ((1<<BANKX_EIR_TXIF) | (1<<BANKX_EIR_TXERIF))) {
+      Enc28j60SendComplete();
+    }
+  }
+}
+#endif // TX_DOUBLE_BUFFER == 1
+
+
 void reset_transmit_logic(void)
 {
   // Set TXRST
@@ -953,6 +1848,9 @@ uint8_t wait_for_xmit_complete()
   while (!(Enc28j60ReadReg(BANKX_EIR) & (1<<BANKX_EIR_TXIF))
       && !(Enc28j60ReadReg(BANKX_EIR) & (1<<BANKX_EIR_TXERIF))) {
     wait_timer(500);  // Wait 500 uS
+#if RX_OCCUPANCY_STATISTICS == 1
+    tx_wait_time += 500;
+#endif // RX_OCCUPANCY_STATISTICS == 1
     timeout--;
     if (timeout == 0) {
       txerif_temp = 1; // If timeout set the error state
@@ -67,9 +67,41 @@
 // Errata Workaround: RX Buffer should start at 0x0000
 // Errata Workaround: RXEND should not be even!
 #define ENC28J60_RXSTART	0x0000	//6kb
+#if ENC28J60_BUFFER_SPLIT == 1
+// With ENC28J60_BUFFER_SPLIT the TX area only holds the TX slots in use (two
+// with TX_DOUBLE_BUFFER, else one) and the rest of the 8kb is the RX ring. A
+// slot holds a maximum size frame plus the control byte and status vector,
+// rounded up to 64 bytes. The RXEND workaround holds as the slots are even.
+#define ENC28J60_SLOTSIZE	((ENC28J60_MAXFRAME + 8 + 63) & 0xffc0)
+#if TX_DOUBLE_BUFFER == 1
+#define ENC28J60_TXSTART	(0x2000 - (2 * ENC28J60_SLOTSIZE))
+#define ENC28J60_TXSLOT1	(ENC28J60_TXSTART + ENC28J60_SLOTSIZE)
+#else
+#define ENC28J60_TXSTART	(0x2000 - ENC28J60_SLOTSIZE)
+#endif // TX_DOUBLE_BUFFER == 1
+#define ENC28J60_TXEND		0x1FFF
+#if ARP_PENDING_SLOT == 1
+#define ENC28J60_HOLDSTART	(ENC28J60_TXSTART - ENC28J60_SLOTSIZE)
+#define ENC28J60_RXEND		(ENC28J60_HOLDSTART - 1)
+#else
+#define ENC28J60_RXEND		(ENC28J60_TXSTART - 1)
+#endif // ARP_PENDING_SLOT == 1
+#else // ENC28J60_BUFFER_SPLIT == 0
+#if ARP_PENDING_SLOT == 1
+// With ARP_PENDING_SLOT the end of the RX area is used as a hold slot for the
+// frame waiting on an ARP reply. The slot holds a maximum size frame plus the
+// control byte and status vector.
+#define ENC28J60_RXEND		0x15BF
+#define ENC28J60_HOLDSTART	0x15C0
+#else
 #define ENC28J60_RXEND		0x17FF
+#endif // ARP_PENDING_SLOT == 1
 #define ENC28J60_TXSTART	0x1800	//2kb
 #define ENC28J60_TXEND		0x1FFF
+// With TX_DOUBLE_BUFFER the TX area is split into two 1kb slots. Each slot
+// holds a maximum size frame plus the control byte and status vector.
+#define ENC28J60_TXSLOT1	0x1C00
+#endif // ENC28J60_BUFFER_SPLIT == 1
 
 // LED configuration bits:
 // LEDA: Transmit
@@ -83,9 +115,24 @@
 // #define ENC28J60_MAXFRAME	500
 #define ENC28J60_MAXFRAME	550
 
+#if ENC28J60_FLOW_CONTROL == 1
+// RX ring occupancy (bytes) above which the link partner is paused, and
+// below which it is released again.
+#define ENC28J60_FLOW_HIGH	(((ENC28J60_RXEND - ENC28J60_RXSTART) / 4) * 3)
+#define ENC28J60_FLOW_LOW	((ENC28J60_RXEND - ENC28J60_RXSTART) / 4)
+#endif // ENC28J60_FLOW_CONTROL == 1
+
 // Use this for function inlining within the ENC28J60 module
 #define ENC28J60_INLINE		static inline __attribute__ ((always_inline))
 
+#if ENC28J60_INT_SUPPORT == 1
+// The ENC28J60 -INT output is connected to PC5. -INT is active low.
+#define ENC28J60_INT_ASSERTED()	(!(PC_IDR & 0x20))
+// Set to 1 so that the next Enc28j60Receive() reads EPKTCNT even if -INT is
+// not asserted
+extern uint8_t rx_poll_due;
+#endif // ENC28J60_INT_SUPPORT == 1
+
 // Initialize Chip (Initialize used SPI module before!)
 void Enc28j60Init(void);
 
@@ -93,9 +140,51 @@ void Enc28j60Init(void);
 // This function will never receive more than ENC28J60_MAXFRAME bytes
 uint16_t Enc28j60Receive(uint8_t* pBuffer);
 
+#if RX_DRAIN_SUPPORT == 1
+// Returns the number of received packets waiting in the ENC28J60
+uint8_t Enc28j60PacketCount(void);
+#endif // RX_DRAIN_SUPPORT == 1
+
+#if RX_FILTER_PROFILES == 1
+// Programs the ENC28J60 receive filters for the selected profile
+void set_rx_filter_profile(uint8_t profile);
+#endif // RX_FILTER_PROFILES == 1
+
+#if RX_FILTER_PROFILES == 1 || MULTICAST_GROUP_SUPPORT == 1
+// Returns the hash table filter pointer (0 to 63) of a MAC address
+uint8_t Enc28j60HashPointer(const uint8_t *mac);
+#endif // RX_FILTER_PROFILES == 1 || MULTICAST_GROUP_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+// Programs the hash table filter for the multicast groups joined
+void Enc28j60JoinGroups(void);
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
 // Copies a packet into ENC28J60's buffer and sends the ethernet frame
 void Enc28j60Send(uint8_t* pBuffer, uint16_t nBytes);
 
+// Waits for the frame started by Enc28j60Send to complete transmission
+void Enc28j60SendComplete(void);
+
+#if TCP_REXMIT_FROM_TXBUF == 1
+// Retransmits the TCP segment still held in the ENC28J60 TX memory.
+// Returns 0 if the TX memory does not hold the segment.
+uint8_t Enc28j60Resend(uint16_t lport, uint16_t rport, uint8_t* pSeqno, uint16_t len, uint8_t* pAckno);
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+#if ARP_PENDING_SLOT == 1
+// Copies a frame into the hold slot in the ENC28J60 memory
+void Enc28j60Hold(uint8_t* pBuffer, uint16_t nBytes);
+
+// Sends the frame in the hold slot to the given destination MAC address
+void Enc28j60SendHeld(uint8_t* pDestMac);
+#endif // ARP_PENDING_SLOT == 1
+
+#if TX_DOUBLE_BUFFER == 1
+// Non-blocking check for completion of the frame in flight
+void Enc28j60TxPoll(void);
+#endif // TX_DOUBLE_BUFFER == 1
+
 // Resets the transmit logic in the ENC28J60
 void reset_transmit_logic(void);
 
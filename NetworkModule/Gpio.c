@@ -33,6 +33,9 @@
 extern uint8_t stored_pin_control[16];  // STM8 per pin control settings
                                         // stored in EEPROM
 extern uint8_t stored_options1;         // Additional options stored in EEPROM
+#if OUTPUT_PORT_BATCH == 1
+extern uint8_t stored_config_settings;  // Config settings stored in EEPROM
+#endif // OUTPUT_PORT_BATCH == 1
 
 
 #if SUPPORT_174 == 0
@@ -202,10 +205,114 @@ const struct io_mapping io_map[48] = {
 #endif // SUPPORT_174 == 0
 
 
+#if PINOUT_CONST_MASKS == 1
+// The PORT:BIT pair of each of the 16 IOs (0 = IO 1) for each Pinout
+// Option, the same pairs that io_map and calc_PORT_BIT_index() give.
+// gather_io_pins() and scatter_io_pins() expand one list per Pinout Option
+// so that every port and bit is a constant in the code, and the 16 pins are
+// read or written without any table lookups. The Pinout Option is selected
+// once in gpio_init().
+#define PINOUT_OPTION1(X) \
+	X(PA, 0x08, 0) \
+	X(PA, 0x20, 1) \
+	X(PD, 0x40, 2) \
+	X(PD, 0x10, 3) \
+	X(PD, 0x04, 4) \
+	X(PE, 0x01, 5) \
+	X(PG, 0x02, 6) \
+	X(PC, 0x80, 7) \
+	X(PA, 0x10, 8) \
+	X(PD, 0x80, 9) \
+	X(PD, 0x20, 10) \
+	X(PD, 0x08, 11) \
+	X(PD, 0x01, 12) \
+	X(PE, 0x08, 13) \
+	X(PG, 0x01, 14) \
+	X(PC, 0x40, 15)
+#define PINOUT_OPTION2(X) \
+	X(PC, 0x80, 0) \
+	X(PC, 0x40, 1) \
+	X(PG, 0x02, 2) \
+	X(PG, 0x01, 3) \
+	X(PE, 0x01, 4) \
+	X(PE, 0x08, 5) \
+	X(PD, 0x04, 6) \
+	X(PD, 0x01, 7) \
+	X(PD, 0x10, 8) \
+	X(PD, 0x08, 9) \
+	X(PD, 0x40, 10) \
+	X(PD, 0x20, 11) \
+	X(PA, 0x20, 12) \
+	X(PD, 0x80, 13) \
+	X(PA, 0x08, 14) \
+	X(PA, 0x10, 15)
+#define PINOUT_OPTION3(X) \
+	X(PA, 0x10, 0) \
+	X(PD, 0x80, 1) \
+	X(PD, 0x20, 2) \
+	X(PD, 0x08, 3) \
+	X(PD, 0x01, 4) \
+	X(PE, 0x08, 5) \
+	X(PG, 0x01, 6) \
+	X(PC, 0x40, 7) \
+	X(PA, 0x08, 8) \
+	X(PA, 0x20, 9) \
+	X(PD, 0x40, 10) \
+	X(PD, 0x10, 11) \
+	X(PD, 0x04, 12) \
+	X(PE, 0x01, 13) \
+	X(PG, 0x02, 14) \
+	X(PC, 0x80, 15)
+#define PINOUT_OPTION4(X) \
+	X(PC, 0x40, 0) \
+	X(PC, 0x80, 1) \
+	X(PG, 0x01, 2) \
+	X(PG, 0x02, 3) \
+	X(PE, 0x08, 4) \
+	X(PE, 0x01, 5) \
+	X(PD, 0x01, 6) \
+	X(PD, 0x04, 7) \
+	X(PD, 0x08, 8) \
+	X(PD, 0x10, 9) \
+	X(PD, 0x20, 10) \
+	X(PD, 0x40, 11) \
+	X(PD, 0x80, 12) \
+	X(PA, 0x20, 13) \
+	X(PA, 0x10, 14) \
+	X(PA, 0x08, 15)
+
+static uint8_t pinout_select;		// Pinout Option - 1
+#endif // PINOUT_CONST_MASKS == 1
+
+
+#if INPUT_PORT_SAMPLING == 1
+static struct io_mapping input_map[16]; // io_map for the pinout option
+static uint16_t io_cnt0;		// Vertical counter bit 0 per IO pin
+static uint16_t io_cnt1;		// Vertical counter bit 1 per IO pin
+uint16_t io_debounced;			// Debounced state per IO pin
+uint16_t io_input_mask;			// IO pins that are Inputs
+uint16_t io_linked_mask;		// IO pins 1 to 8 that are Linked
+static uint16_t sample_io_pins(void);
+#endif // INPUT_PORT_SAMPLING == 1
+
+
+#if OUTPUT_PORT_BATCH == 1
+static struct io_mapping output_map[16]; // io_map for the pinout option.
+					// bit = 0 for pins that are not
+					// written.
+static uint8_t output_port_mask[ NUM_PORTS ]; // IO pins written per port
+static uint8_t output_map_config;	// stored_config_settings used to
+					// build the tables
+#endif // OUTPUT_PORT_BATCH == 1
+
+
 void gpio_init(void)
 {
   uint8_t i;
   uint8_t j;
+#if INPUT_PORT_SAMPLING == 1
+  uint16_t mask;
+#endif // INPUT_PORT_SAMPLING == 1
 
   // GPIO Definitions for 16 outputs
   //
@@ -297,6 +404,19 @@ void gpio_init(void)
   }
 #endif // SUPPORT_174 == 1
 
+#if PINOUT_CONST_MASKS == 1
+  // Select the constant pin list for the Pinout Option
+  pinout_select = 0;
+#if PINOUT_OPTION_SUPPORT == 1
+#if SUPPORT_174 == 0
+  pinout_select = (uint8_t)(io_map_offset >> 4);
+#endif // SUPPORT_174 == 0
+#if SUPPORT_174 == 1
+  pinout_select = (uint8_t)((stored_options1 & 0x07) - 1);
+#endif // SUPPORT_174 == 1
+#endif // PINOUT_OPTION_SUPPORT == 1
+#endif // PINOUT_CONST_MASKS == 1
+
 
   // To reduce the incidence of output pin "chatter" during a reboor (no power
   // loss) the ODR (Output Data Register) for each output pin is pre-written
@@ -329,6 +449,9 @@ void gpio_init(void)
     // The write_output_pins() function uses the io_map table, which is part
     // of the reasons that the io_map_offset had to be determined before
     // reaching this point in the code.
+#if OUTPUT_PORT_BATCH == 1
+    build_output_map();  // Resolve the output tables for the pinout option
+#endif // OUTPUT_PORT_BATCH == 1
     write_output_pins(); // Initializes the ODR bits
 //  }
 
@@ -476,7 +599,413 @@ void gpio_init(void)
 
     }
   }
+
+#if INPUT_EDGE_CAPTURE == 1
+  // Enable the external interrupt on every IO pin that is an Input (or a
+  // Linked Input). Disabled pins are left alone so that reserved pins such
+  // as the DS18B20 and I2C pins, which switch direction while in use, do not
+  // interrupt their bit-bang timing. Port G has no external interrupt so the
+  // Inputs on Port G (IO 7 and IO 15) remain polled.
+  for (i=0; i<16; i++) {
+#if LINKED_SUPPORT == 0
+    if ((stored_pin_control[i] & 0x03) == 0x01) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+    if (chk_iotype(stored_pin_control[i], i, 0x03) == 0x01) {
+#endif // LINKED_SUPPORT == 1
+#if PINOUT_OPTION_SUPPORT == 0
+      j = i;
+#endif // PINOUT_OPTION_SUPPORT == 0
+#if PINOUT_OPTION_SUPPORT == 1
+#if SUPPORT_174 == 0
+      j = (int8_t)(i + io_map_offset);
+#endif // SUPPORT_174 == 0
+#if SUPPORT_174 == 1
+      j = calc_PORT_BIT_index(i);
+#endif // SUPPORT_174 == 1
+#endif // PINOUT_OPTION_SUPPORT == 1
+      if (io_map[j].port != PG) io_reg[ io_map[j].port ].cr2 |= io_map[j].bit;
+    }
+  }
+
+  edge_capture_init();
+#endif // INPUT_EDGE_CAPTURE == 1
+
+#if INPUT_PORT_SAMPLING == 1
+  // Build the tables used by debounce_io_pins(). input_map[] is io_map
+  // resolved for the selected pinout option so the pinout calculation is
+  // not repeated on every pass. The masks are built from the stored pin
+  // types, the same as the DDR registers above. A pin type change always
+  // causes a reboot so they do not need to be rebuilt at runtime.
+  io_input_mask = 0;
+  io_linked_mask = 0;
+  for (i=0, mask=1; i<16; i++, mask<<=1) {
+#if PINOUT_OPTION_SUPPORT == 0
+    j = i;
+#endif // PINOUT_OPTION_SUPPORT == 0
+#if PINOUT_OPTION_SUPPORT == 1
+#if SUPPORT_174 == 0
+    j = (int8_t)(i + io_map_offset);
+#endif // SUPPORT_174 == 0
+#if SUPPORT_174 == 1
+    j = calc_PORT_BIT_index(i);
+#endif // SUPPORT_174 == 1
+#endif // PINOUT_OPTION_SUPPORT == 1
+    input_map[i].port = io_map[j].port;
+    input_map[i].bit = io_map[j].bit;
+#if LINKED_SUPPORT == 0
+    if ((stored_pin_control[i] & 0x03) == 0x01) io_input_mask |= mask;
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+    if (chk_iotype(stored_pin_control[i], i, 0x03) == 0x01) io_input_mask |= mask;
+    if (((stored_pin_control[i] & 0x03) == 0x02) && (i<8)) io_linked_mask |= mask;
+#endif // LINKED_SUPPORT == 1
+  }
+  
+  // Start the debouncer at the current pin states
+  io_debounced = sample_io_pins();
+  io_cnt0 = 0;
+  io_cnt1 = 0;
+#endif // INPUT_PORT_SAMPLING == 1
+}
+
+
+#if PINOUT_CONST_MASKS == 1
+// One statement per IO pin for the pin lists at the top of this file
+#define GATHER_PIN(port, bit, io) \
+	if (idr_##port & (bit)) sample |= (uint16_t)((uint16_t)1 << (io));
+#define SCATTER_PIN(port, bit, io) \
+	if (pin_states & (uint16_t)((uint16_t)1 << (io))) set[port] |= (bit);
+
+
+uint16_t gather_io_pins(void)
+{
+  // Reads each port IDR once and gathers the 16 IO pins into a word, bit 0
+  // = IO 1, with the constant pin list of the selected Pinout Option. With
+  // INPUT_EDGE_CAPTURE the debounced port states are used.
+  uint16_t sample;
+  uint8_t idr_PA;
+  uint8_t idr_PC;
+  uint8_t idr_PD;
+  uint8_t idr_PE;
+  uint8_t idr_PG;
+  
+  idr_PA = INPUT_IDR(PA);
+  idr_PC = INPUT_IDR(PC);
+  idr_PD = INPUT_IDR(PD);
+  idr_PE = INPUT_IDR(PE);
+  idr_PG = INPUT_IDR(PG);
+  
+  sample = 0;
+#if PINOUT_OPTION_SUPPORT == 1
+  if (pinout_select == 1) {
+    PINOUT_OPTION2(GATHER_PIN)
+  }
+  else if (pinout_select == 2) {
+    PINOUT_OPTION3(GATHER_PIN)
+  }
+#if SUPPORT_174 == 1
+  else if (pinout_select == 3) {
+    PINOUT_OPTION4(GATHER_PIN)
+  }
+#endif // SUPPORT_174 == 1
+  else
+#endif // PINOUT_OPTION_SUPPORT == 1
+  {
+    PINOUT_OPTION1(GATHER_PIN)
+  }
+  return sample;
+}
+#endif // PINOUT_CONST_MASKS == 1
+
+
+#if OUTPUT_PORT_BATCH == 1
+void build_output_map(void)
+{
+  // Builds the tables used by write_io_pins(). output_map[] is io_map
+  // resolved for the selected pinout option, with the pins that are in use
+  // by the UART, I2C or DS18B20 left out. output_port_mask[] collects the
+  // IO pins written on each port. The tables depend on the pinout option
+  // and the config settings, so they are rebuilt by write_io_pins() if the
+  // config settings change. The pinout option only changes with a reboot.
+  uint8_t i;
+  uint8_t j;
+  
+  for (i=PA; i<NUM_PORTS; i++) output_port_mask[i] = 0;
+  output_map_config = stored_config_settings;
+  
+  for (i=0; i<16; i++) {
+    output_map[i].port = PA;
+    output_map[i].bit = 0;
+#if DEBUG_SUPPORT == 15
+    // If UART support is enabled do not write Output 11
+    if (i == 10) continue; // Output 11
+#endif // DEBUG_SUPPORT == 15
+#if I2C_SUPPORT == 1
+    // If I2C support is enabled do not write Output 14 and 15
+    if (i == 13) continue; // Output 14
+    if (i == 14) continue; // Output 15
+#endif // I2C_SUPPORT == 1
+#if DS18B20_SUPPORT == 1
+    // If DS18B20 mode is enabled do not write Output 16
+    if ((i == 15) && (stored_config_settings & 0x08)) continue;
+#endif // DS18B20_SUPPORT == 1
+#if PINOUT_OPTION_SUPPORT == 0
+    j = i;
+#endif // PINOUT_OPTION_SUPPORT == 0
+#if PINOUT_OPTION_SUPPORT == 1
+#if SUPPORT_174 == 0
+    j = (int8_t)(i + io_map_offset);
+#endif // SUPPORT_174 == 0
+#if SUPPORT_174 == 1
+    j = calc_PORT_BIT_index(i);
+#endif // SUPPORT_174 == 1
+#endif // PINOUT_OPTION_SUPPORT == 1
+    output_map[i].port = io_map[j].port;
+    output_map[i].bit = io_map[j].bit;
+    output_port_mask[ io_map[j].port ] |= io_map[j].bit;
+  }
+}
+
+
+void write_io_pins(uint16_t pin_states)
+{
+  // Writes the 16 IO pins from pin_states (bit 0 = IO 1) with one write per
+  // port. The new ODR value for each port is assembled first, so all of the
+  // Outputs on a port (for instance relays in a group) switch at the same
+  // instant. ODR bits that are not IO pins (LED, ENC28J60 control) are
+  // preserved.
+  uint8_t set[ NUM_PORTS ];
+  uint16_t mask;
+  uint8_t i;
+  
+  if (output_map_config != stored_config_settings) build_output_map();
+  
+  for (i=PA; i<NUM_PORTS; i++) set[i] = 0;
+#if PINOUT_CONST_MASKS == 1
+  // The pins left out of output_map[] are still in set[] here, so set[] is
+  // masked with output_port_mask[] below.
+#if PINOUT_OPTION_SUPPORT == 1
+  if (pinout_select == 1) {
+    PINOUT_OPTION2(SCATTER_PIN)
+  }
+  else if (pinout_select == 2) {
+    PINOUT_OPTION3(SCATTER_PIN)
+  }
+#if SUPPORT_174 == 1
+  else if (pinout_select == 3) {
+    PINOUT_OPTION4(SCATTER_PIN)
+  }
+#endif // SUPPORT_174 == 1
+  else
+#endif // PINOUT_OPTION_SUPPORT == 1
+  {
+    PINOUT_OPTION1(SCATTER_PIN)
+  }
+#else // PINOUT_CONST_MASKS == 0
+  for (i=0, mask=1; i<16; i++, mask<<=1) {
+    if (pin_states & mask) set[ output_map[i].port ] |= output_map[i].bit;
+  }
+#endif // PINOUT_CONST_MASKS == 1
+  for (i=PA; i<NUM_PORTS; i++) {
+    if (output_port_mask[i]) {
+      io_reg[ i ].odr = (uint8_t)((io_reg[ i ].odr & ~output_port_mask[i]) | (set[i] & output_port_mask[i]));
+    }
+  }
+}
+#endif // OUTPUT_PORT_BATCH == 1
+
+
+#if INPUT_PORT_SAMPLING == 1
+static uint16_t sample_io_pins(void)
+{
+  // Reads each port IDR once and gathers the 16 IO pins into a word, bit 0
+  // = IO 1. With INPUT_EDGE_CAPTURE the debounced port states are used.
+#if PINOUT_CONST_MASKS == 1
+  return gather_io_pins();
+#else // PINOUT_CONST_MASKS == 0
+  uint8_t idr[ NUM_PORTS ];
+  uint16_t sample;
+  uint16_t mask;
+  uint8_t i;
+  
+  for (i=PA; i<NUM_PORTS; i++) idr[i] = INPUT_IDR(i);
+  
+  sample = 0;
+  for (i=0, mask=1; i<16; i++, mask<<=1) {
+    if (idr[ input_map[i].port ] & input_map[i].bit) sample |= mask;
+  }
+  return sample;
+#endif // PINOUT_CONST_MASKS == 1
+}
+
+
+uint16_t debounce_io_pins(void)
+{
+  // Samples the IO pins and debounces all 16 of them at once with a vertical
+  // counter. Each pin has a 2 bit counter held in bit i of io_cnt1:io_cnt0.
+  // The counter of a pin counts the consecutive samples that differ from its
+  // debounced state in io_debounced and clears whenever a sample agrees.
+  // When the count reaches INPUT_DEBOUNCE_DEPTH the debounced state flips.
+  // INPUT_DEBOUNCE_DEPTH = 2 matches the two sample debounce of the per pin
+  // code.
+  //
+  // Returns the pins that changed debounced state on this pass. All pins are
+  // debounced; read_input_pins() uses io_input_mask to select the Inputs.
+  uint16_t delta;
+  uint16_t toggle;
+  
+  delta = (uint16_t)(sample_io_pins() ^ io_debounced);
+  io_cnt1 = (uint16_t)((io_cnt1 ^ io_cnt0) & delta);
+  io_cnt0 = (uint16_t)(~io_cnt0 & delta);
+  
+#if INPUT_DEBOUNCE_DEPTH == 1
+  toggle = delta;
+#elif INPUT_DEBOUNCE_DEPTH == 2
+  toggle = (uint16_t)(io_cnt1 & ~io_cnt0);
+#elif INPUT_DEBOUNCE_DEPTH == 3
+  toggle = (uint16_t)(io_cnt1 & io_cnt0);
+#else // INPUT_DEBOUNCE_DEPTH == 4
+  toggle = (uint16_t)(delta & ~(io_cnt1 | io_cnt0));
+#endif // INPUT_DEBOUNCE_DEPTH
+  
+  io_debounced ^= toggle;
+  return toggle;
+}
+#endif // INPUT_PORT_SAMPLING == 1
+
+
+#if INPUT_EDGE_CAPTURE == 1
+// Edge capture ring. The EXTI interrupt handlers (see
+// networkmodule_vector.c) write an entry for every
+// port interrupt and advance edge_head. edge_capture_service() is called
+// from the main loop, consumes the entries and advances edge_tail. Each
+// index has a single writer so no locking is needed. EDGE_RING_SIZE must be
+// a power of 2.
+#define EDGE_RING_SIZE	8
+
+struct edge_event {
+	uint8_t port;		// port that interrupted
+	uint8_t idr;		// port IDR at the time of the interrupt
+	uint16_t time;		// ms_timestamp() at the time of the interrupt
+};
+
+static struct edge_event edge_ring[EDGE_RING_SIZE];
+static volatile uint8_t edge_head;	// Written by the interrupt handlers
+static volatile uint8_t edge_tail;	// Written by edge_capture_service()
+static volatile uint8_t edge_overflow;	// Set if an edge was dropped
+static uint8_t edge_pending;		// Ports with an edge still bouncing
+static uint8_t edge_last[NUM_PORTS];	// Port IDR at the last captured edge
+static uint8_t edge_mask[NUM_PORTS];	// Input pins with the interrupt
+					// enabled per port
+static uint16_t edge_time[NUM_PORTS];	// Time of the last edge per port
+uint8_t edge_stable_idr[NUM_PORTS];	// Debounced IDR per port
+
+
+void edge_capture_init(void)
+{
+  // Initialize the debounced port states to the current pin states and
+  // enable the Port A, C, D and E external interrupts on both edges. The
+  // per pin enables are set in gpio_init(). EXTI_CR1 and EXTI_CR2 can only
+  // be written while interrupts are disabled. Interrupts are disabled out of
+  // reset, but the FREE_RUNNING_TIMEBASE may already have enabled them, so
+  // they are disabled around the writes and enabled last.
+  uint8_t i;
+  
+  for (i=PA; i<NUM_PORTS; i++) {
+    edge_stable_idr[i] = io_reg[ i ].idr;
+    edge_last[i] = edge_stable_idr[i];
+    edge_mask[i] = (uint8_t)(io_reg[ i ].cr2 & ~io_reg[ i ].ddr);
+  }
+  edge_head = 0;
+  edge_tail = 0;
+  edge_overflow = 0;
+  edge_pending = 0;
+  
+  sim();
+  EXTI_CR1 = 0xf3; // Port A, C and D interrupt on rising and falling edges
+  EXTI_CR2 = 0x03; // Port E interrupt on rising and falling edges
+  rim();
+}
+
+
+static void edge_capture(uint8_t port)
+{
+  // Called by the EXTI interrupt handlers. The port IDR and a timestamp are
+  // added to the ring. Nothing else is done here so that the interrupt
+  // stays short. If the ring is full the edge is dropped and the overflow
+  // flag tells edge_capture_service() to resample all ports.
+  // Interrupts where none of the Input pins changed are ignored. These come
+  // from other interrupt sources on the same port (the ENC28J60 -INT pin
+  // with IDLE_WAIT_SUPPORT) or from a glitch that ended before the IDR was
+  // read.
+  uint8_t next;
+  uint8_t idr;
+  
+#if IDLE_WAIT_SUPPORT == 1
+  idle_wake_mark();
+#endif // IDLE_WAIT_SUPPORT == 1
+  idr = io_reg[ port ].idr;
+  if (((idr ^ edge_last[port]) & edge_mask[port]) == 0) return;
+  edge_last[port] = idr;
+  
+  next = (uint8_t)((edge_head + 1) & (EDGE_RING_SIZE - 1));
+  if (next == edge_tail) {
+    edge_overflow = 1;
+    return;
+  }
+  edge_ring[edge_head].port = port;
+  edge_ring[edge_head].idr = idr;
+  edge_ring[edge_head].time = ms_timestamp();
+  edge_head = next;
+}
+
+
+@interrupt void exti_porta_isr(void) { edge_capture(PA); }
+@interrupt void exti_portc_isr(void) { edge_capture(PC); }
+@interrupt void exti_portd_isr(void) { edge_capture(PD); }
+@interrupt void exti_porte_isr(void) { edge_capture(PE); }
+
+
+void edge_capture_service(void)
+{
+  // Called from the main loop before read_input_pins(). The captured edges
+  // are moved out of the ring and restart the debounce time of their port.
+  // Once a port has had no edge for INPUT_DEBOUNCE_MS its pins are read
+  // and stored in edge_stable_idr[], which read_input_pins() uses in place
+  // of the port IDR (see INPUT_IDR()). Because each edge is timestamped by
+  // the interrupt the debounce time does not depend on how often the main
+  // loop gets here.
+  uint8_t i;
+  uint16_t now;
+  
+  while (edge_tail != edge_head) {
+    i = edge_ring[edge_tail].port;
+    edge_time[i] = edge_ring[edge_tail].time;
+    edge_pending |= (uint8_t)(1 << i);
+    edge_tail = (uint8_t)((edge_tail + 1) & (EDGE_RING_SIZE - 1));
+  }
+  
+  sim();
+  now = ms_timestamp();
+  rim();
+  
+  if (edge_overflow) {
+    // Edges were dropped. Restart the debounce time on all ports.
+    edge_overflow = 0;
+    for (i=PA; i<=PE; i++) edge_time[i] = now;
+    edge_pending = 0x1f;
+  }
+  
+  for (i=PA; i<=PE; i++) {
+    if ((edge_pending & (uint8_t)(1 << i))
+     && ((uint16_t)(now - edge_time[i]) >= INPUT_DEBOUNCE_MS)) {
+      edge_stable_idr[i] = io_reg[ i ].idr;
+      edge_pending &= (uint8_t)(~(1 << i));
+    }
+  }
 }
+#endif // INPUT_EDGE_CAPTURE == 1
 
 
 #if SUPPORT_174 == 1
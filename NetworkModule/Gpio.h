@@ -63,6 +63,30 @@ extern const struct io_mapping io_map[48];
 #endif // SUPPORT_174 == 0
 
 void gpio_init(void);
+#if INPUT_EDGE_CAPTURE == 1
+// With INPUT_EDGE_CAPTURE read_input_pins() reads the debounced port states
+// kept by edge_capture_service(). Port G has no external interrupt and is
+// read directly.
+extern uint8_t edge_stable_idr[ NUM_PORTS ];
+#define INPUT_IDR(port) ((port) == PG ? io_reg[ PG ].idr : edge_stable_idr[ port ])
+void edge_capture_init(void);
+void edge_capture_service(void);
+#else // INPUT_EDGE_CAPTURE == 0
+#define INPUT_IDR(port) io_reg[ port ].idr
+#endif // INPUT_EDGE_CAPTURE == 1
+#if OUTPUT_PORT_BATCH == 1
+void build_output_map(void);
+void write_io_pins(uint16_t pin_states);
+#endif // OUTPUT_PORT_BATCH == 1
+#if INPUT_PORT_SAMPLING == 1
+extern uint16_t io_debounced;
+extern uint16_t io_input_mask;
+extern uint16_t io_linked_mask;
+uint16_t debounce_io_pins(void);
+#endif // INPUT_PORT_SAMPLING == 1
+#if PINOUT_CONST_MASKS == 1
+uint16_t gather_io_pins(void);
+#endif // PINOUT_CONST_MASKS == 1
 #if SUPPORT_174 == 1
 uint8_t calc_PORT_BIT_index(uint8_t IO_index);
 #endif // SUPPORT_174 == 1
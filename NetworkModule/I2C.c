@@ -28,6 +28,9 @@
 
 extern uint8_t OctetArray[14];  // Used in emb_itoa conversions and to
                                 // transfer short strings globally
+#if FLASH_COPY_STAGING == 1
+extern uint8_t stored_debug_bytes[10];
+#endif // FLASH_COPY_STAGING == 1
 
 uint8_t I2C_failcode;
 char * flash_ptr;
@@ -36,12 +39,153 @@ char * ram_ptr;
 uint8_t eeprom_num_write;
 uint8_t eeprom_num_read;
 uint16_t eeprom_base;
+#if FLASH_COPY_STAGING == 1
+uint8_t flash_stage_map[32]; // One bit per 128 byte Flash block. Set if the
+                             // I2C EEPROM image block differs from Flash.
+uint8_t flash_stage_block;   // Next block to be staged
+#endif // FLASH_COPY_STAGING == 1
 
 
 
 #pragma section (flash_update)
 
 #if I2C_SUPPORT == 1
+#if I2C_HW_SUPPORT == 1
+//---------------------------------------------------------------------------//
+// This code uses the STM8 I2C peripheral, which is fixed to these pins:
+//   PB4 (Pin 18) as the I2C CLK signal (SCL)
+//   PB5 (Pin 17) as the I2C DATA signal (SDA)
+// The HW-584 does not use these pins, so the I2C devices must be wired to
+// them rather than to IO 14 and IO 15. PB4 and PB5 are true open drain
+// pins, so the 4.7Kohm pull ups are still required.
+//
+// The bus runs at about 400kHz (Fast mode). The application interface is
+// the same as the bit bang driver below, so the I2C EEPROM, BME280,
+// INA226 and PCF8574 code works with either driver. The peripheral flags
+// are polled: the firmware does not use interrupts, and each wait is
+// bounded so a missing or stuck device can't hang the main loop.
+//---------------------------------------------------------------------------//
+
+uint8_t I2C_wait_flag(uint8_t flag)
+{
+  // Wait for a flag in I2C_SR1 to be set. Returns 0 if the flag was set,
+  // or 1 if the slave responded with NACK or the flag did not set within
+  // about 1ms.
+  uint16_t i;
+  
+  for (i = 0; i < 2000; i++) {
+    if (I2C_SR1 & flag) return 0;
+    if (I2C_SR2 & I2C_SR2_AF) {
+      I2C_SR2 &= (uint8_t)~I2C_SR2_AF; // Clear Acknowledge Failure
+      return 1;
+    }
+  }
+  return 1;
+}
+
+
+uint8_t I2C_send_byte(uint8_t I2C_transmit_data)
+{
+  // Transmit one byte and wait for the slave ACK. Returns 1 on NACK. The
+  // wait is for Byte Transfer Finished so that a following START or STOP
+  // is not generated until the byte is on the bus.
+  I2C_DR = I2C_transmit_data;
+  return I2C_wait_flag(I2C_SR1_BTF);
+}
+
+
+uint8_t I2C_control(uint8_t control_byte)
+{
+  // The Control Byte addresses a device and provides the Read/Write bit to
+  // the device. If a transfer is already in progress (a write of the byte
+  // address) the START is sent as a repeated START.
+  
+  I2C_failcode = 0;
+  
+  // ACK every received byte until I2C_read_byte() is told it is reading
+  // the last byte.
+  I2C_CR2 |= I2C_CR2_ACK;
+  I2C_CR2 |= I2C_CR2_START;
+  if (I2C_wait_flag(I2C_SR1_SB)) {
+    I2C_failcode = I2C_FAIL_NACK_CONTROL_BYTE;
+    return I2C_failcode;
+  }
+  
+  // Output Device Control Byte. Bits 7 to 1 are address information, bit 0
+  // is the Read/Write bit. Reading SR1 (above) then writing DR clears SB.
+  I2C_DR = control_byte;
+  if (I2C_wait_flag(I2C_SR1_ADDR)) {
+    I2C_failcode = I2C_FAIL_NACK_CONTROL_BYTE;
+    I2C_stop();
+    return I2C_failcode;
+  }
+  
+  // Reading SR3 after SR1 clears ADDR. For a read the peripheral starts
+  // receiving the first byte at this point.
+  (void)I2C_SR3;
+  
+  return I2C_failcode;
+}
+
+
+void I2C_byte_address(uint16_t byte_address, uint8_t addr_size)
+{
+  // Send address to the I2C device where a byte read or write is to occur.
+  // The address can be 1 or 2 bytes as defined by addr_size.
+  if (addr_size == 2) {
+    // Output Byte Address bit 15 to 8
+    if (I2C_send_byte((uint8_t)(byte_address >> 8))) I2C_failcode = I2C_FAIL_NACK_BYTE_ADDRESS1;
+  }
+  
+  // Output Byte Address bit 7 to 0
+  if (I2C_send_byte((uint8_t)(byte_address))) I2C_failcode = I2C_FAIL_NACK_BYTE_ADDRESS2;
+}
+
+
+uint8_t I2C_read_byte(uint8_t I2C_last_flag)
+{
+  // In this application we only do sequential reads. Each byte read is
+  // followed by an ACK except for the last byte, which is followed by NACK
+  // then a STOP condition. The peripheral receives the next byte while the
+  // caller handles the current one, so for the last byte ACK is turned off
+  // and the STOP is requested before waiting for the byte.
+  uint8_t I2C_data_field;
+  
+  if (I2C_last_flag) {
+    I2C_CR2 &= (uint8_t)~I2C_CR2_ACK;
+    I2C_CR2 |= I2C_CR2_STOP;
+  }
+  
+  I2C_data_field = 0;
+  if (I2C_wait_flag(I2C_SR1_RXNE) == 0) I2C_data_field = I2C_DR;
+  
+  if (I2C_last_flag) I2C_stop();
+  
+  return I2C_data_field;
+}
+
+
+void I2C_stop(void)
+{
+  // Stop Condition
+  // If the STOP was not already requested by I2C_read_byte() request it
+  // now, then wait for the peripheral to leave Master mode (about 3us at
+  // 400kHz).
+  uint16_t i;
+  
+  if (I2C_SR3 & I2C_SR3_MSL) {
+    I2C_CR2 |= I2C_CR2_STOP;
+    for (i = 0; i < 2000; i++) {
+      if ((I2C_SR3 & I2C_SR3_MSL) == 0) break;
+    }
+  }
+  
+  // If the caller was late in reading the last byte the slave may have sent
+  // one more before the STOP. Discard it.
+  if (I2C_SR1 & I2C_SR1_RXNE) (void)I2C_DR;
+}
+
+#else // I2C_HW_SUPPORT == 0
 
 //---------------------------------------------------------------------------//
 // This code uses:
@@ -281,6 +425,7 @@ void I2C_stop(void)
   SCL_high(); // Float SCL high, then wait 5us
   SDA_high(); // Fload SDA high, then wait 5us
 }
+#endif // I2C_HW_SUPPORT == 1
 
 #endif // I2C_SUPPORT == 1
 
@@ -291,6 +436,11 @@ void eeprom_copy_to_flash(void)
 {
   uint16_t eeprom_index;
   uint16_t blocks;
+#if FLASH_COPY_STAGING == 1
+  uint8_t stage_mask;
+  uint16_t copy_time;
+  uint8_t *pEeprom;
+#endif // FLASH_COPY_STAGING == 1
 
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("eeprom_copy_to_flash\r\n");
@@ -370,6 +520,16 @@ void eeprom_copy_to_flash(void)
   
   ram_ptr = &uip_buf[0]; // Set ram_ptr to the start of the uip_buf
   eeprom_index = eeprom_base;
+#if FLASH_COPY_STAGING == 1
+  // The main loop has already compared the image with Flash (see
+  // eeprom_stage_block()) while networking continued. Only the blocks marked
+  // in flash_stage_map are programmed. The time spent in this function is
+  // measured with TIM2 (976.5625 Hz, 1.024ms per count) so it can be
+  // reported. The high byte of the counter must be read first.
+  copy_time = (uint16_t)(TIM2_CNTRH << 8);
+  copy_time |= TIM2_CNTRL;
+  stage_mask = 0x01;
+#endif // FLASH_COPY_STAGING == 1
 			      
   // The Flash must be unlocked to allow any writes to it. The unlock occurs
   // by the routine that calls this function. Note that when Flash is written
@@ -382,6 +542,17 @@ void eeprom_copy_to_flash(void)
   //  Blocks 253-255 (3 blocks) are reserved for user data storage and are
   //    only written when the user makes GUI input changes.
   
+#if I2C_EEPROM_FAST_COPY == 1
+  // The whole image (main code area plus the flash_update segment) is
+  // contiguous in the I2C EEPROM, so it is read as one sequential read with
+  // a single addressing sequence. The read is simply paused while each block
+  // is programmed: the I2C master owns SCL, and the EEPROM waits for as long
+  // as SCL is held low.
+  I2C_control(eeprom_num_write);     // Write control byte to establish address
+  I2C_byte_address(eeprom_index, 2); // Byte address of first byte
+  I2C_control(eeprom_num_read);      // Read control byte
+#endif // I2C_EEPROM_FAST_COPY == 1
+
   blocks = 0;
   while (blocks < 249 ) {
     // In this application the main code area is always 249 blocks of 128
@@ -389,28 +560,49 @@ void eeprom_copy_to_flash(void)
     // Note: This routine is only run to replace the code in Flash.
     
     ram_ptr = &uip_buf[0]; // Set ram_ptr to the start of the uip_buf
+#if I2C_EEPROM_FAST_COPY == 0
     // Enable sequential read from the I2C  EEPROM.
     // Read addressing sequence: Send Write Control byte, send Byte address,
     // send Read Control Byte
     I2C_control(eeprom_num_write);     // Write control byte to establish address
     I2C_byte_address(eeprom_index, 2); // Byte address of first byte
     I2C_control(eeprom_num_read);      // Read control byte
+#endif // I2C_EEPROM_FAST_COPY == 0
     
     // Copy 128 bytes from I2C EEPROM to RAM
     {
       uint8_t i;
+#if I2C_EEPROM_FAST_COPY == 1
+      // The sequential read continues into the next block
+      for (i=0; i<128; i++) {
+        *ram_ptr = I2C_read_byte(0);
+	ram_ptr++;
+      }
+#else // I2C_EEPROM_FAST_COPY == 0
       for (i=0; i<127; i++) {
         *ram_ptr = I2C_read_byte(0);
 	ram_ptr++;
       }
+#endif // I2C_EEPROM_FAST_COPY == 1
     }
+#if I2C_EEPROM_FAST_COPY == 0
     *ram_ptr = I2C_read_byte(1); // Final read with I2C_last_flag set
+#endif // I2C_EEPROM_FAST_COPY == 0
 
     // Copy data from RAM to Flash
     ram_ptr = &uip_buf[0]; // Reset the ram_ptr to the start of the uip_buf
+#if FLASH_COPY_STAGING == 1
+    // A block that already matches Flash is not programmed. The EEPROM read
+    // above still runs so that the sequential read stays in step.
+    if (flash_stage_map[(uint8_t)(blocks >> 3)] & stage_mask) copy_ram_to_flash();
+    else flash_ptr += 128;
+    stage_mask = (uint8_t)(stage_mask << 1);
+    if (stage_mask == 0) stage_mask = 0x01;
+#else // FLASH_COPY_STAGING == 0
     copy_ram_to_flash(); // As part of the copy the flash_ptr will be
                          // incremented to the start of the next 64 byte
                          // block.
+#endif // FLASH_COPY_STAGING == 1
     eeprom_index += 128; // Increment the eeprom_index to the start of the
                          // next block.
     blocks++;
@@ -437,12 +629,14 @@ void eeprom_copy_to_flash(void)
   // STM8.
   ram_ptr = &uip_buf[0]; // Set ram_ptr to the start of the uip_buf
   
+#if I2C_EEPROM_FAST_COPY == 0
   // Enable sequential read from the I2C EEPROM.
   // Read addressing sequence: Send Write Control byte, send Byte address,
   // send Read Control Byte
   I2C_control(eeprom_num_write);     // Write control byte to establish address
   I2C_byte_address(eeprom_index, 2); // Byte address of first byte
   I2C_control(eeprom_num_read);      // Read control byte
+#endif // I2C_EEPROM_FAST_COPY == 0
   
   {
     uint16_t j;
@@ -469,12 +663,45 @@ void eeprom_copy_to_flash(void)
   // Prevent the IWDG hardware watchdog from firing.
   IWDG_KR = 0xaa;
   
+#if FLASH_COPY_STAGING == 1
+  // Save the time spent in this function in milliseconds (count x 1.024,
+  // done as count + count/64 + count/128, about 0.1% low) to
+  // stored_debug_bytes[0] and [1], high byte first, where it is
+  // shown in the Statistics page. This must be done before the flash_update
+  // segment is replaced, and by direct register and pointer access as the
+  // EEPROM library functions may already be overwritten. The four block
+  // flash_update segment write that follows (if needed) adds about 24ms.
+  {
+    uint16_t now;
+    now = (uint16_t)(TIM2_CNTRH << 8);
+    now |= TIM2_CNTRL;
+    copy_time = (uint16_t)(now - copy_time);
+  }
+  copy_time = (uint16_t)(copy_time + (copy_time >> 6) + (copy_time >> 7));
+  pEeprom = (uint8_t *)&stored_debug_bytes[0];
+  while (!(FLASH_IAPSR & 0x08)) {  // Unlock the EEPROM (see unlock_eeprom())
+    FLASH_DUKR = 0xAE;
+    FLASH_DUKR = 0x56;
+  }
+  pEeprom[0] = (uint8_t)(copy_time >> 8);
+  while ((FLASH_IAPSR & (FLASH_IAPSR_EOP | FLASH_IAPSR_WR_PG_DIS)) == 0) ;
+  pEeprom[1] = (uint8_t)copy_time;
+  while ((FLASH_IAPSR & (FLASH_IAPSR_EOP | FLASH_IAPSR_WR_PG_DIS)) == 0) ;
+  FLASH_IAPSR &= (uint8_t)(~0x08);  // Lock the EEPROM
+
+  // Blocks 249 to 252 (bits 1 to 4 of the last map byte) are the
+  // flash_update segment. It is only written if one of them changed.
+  if (flash_stage_map[31] & 0x1e) {
+#endif // FLASH_COPY_STAGING == 1
   // Copy 512 bytes of data from RAM to Flash
   ram_ptr = &uip_buf[0]; // Set ram_ptr to the start of the uip_buf
   copy_ram_to_flash(); // Each call to copy_ram_to_flash updates the pointers
   copy_ram_to_flash(); // so the next call writes the next contiguous 128 byte
   copy_ram_to_flash(); // block.
   copy_ram_to_flash(); //
+#if FLASH_COPY_STAGING == 1
+  }
+#endif // FLASH_COPY_STAGING == 1
   
   // Lock the Flash
   FLASH_IAPSR &= (uint8_t)(~0x02);
@@ -556,14 +783,83 @@ void I2C_write_byte(uint8_t I2C_write_data)
   // eeprom_copy_to_flash() function is called. This helps make the flash
   // update segment smaller.
   
+#if I2C_HW_SUPPORT == 1
+  if (I2C_send_byte(I2C_write_data)) I2C_failcode = I2C_FAIL_NACK_WRITE_BYTE;
+#else // I2C_HW_SUPPORT == 0
   // Write Data bit 7 to 0
   I2C_transmit_byte(I2C_write_data);
   
   // Read NACK/ACK from slave
   if (Read_Slave_NACKACK()) I2C_failcode = I2C_FAIL_NACK_WRITE_BYTE;
+#endif // I2C_HW_SUPPORT == 1
+}
+
+
+#if I2C_EEPROM_FAST_COPY == 1 || SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+void eeprom_write_wait(uint8_t control_write)
+{
+  // Wait for the I2C EEPROM internal write cycle started by I2C_stop() to
+  // complete. The EEPROM does not ACK its Control Byte until the write
+  // cycle is done (ACK polling), which is typically well under the 5ms
+  // maximum write time. The polling gives up after about 10ms.
+  uint8_t i;
+  
+  for (i=0; i<100; i++) {
+    if (I2C_control(control_write) == 0) break;
+    I2C_stop();
+    wait_timer(100); // Wait 100us
+  }
+  I2C_stop();
 }
+#endif // I2C_EEPROM_FAST_COPY == 1 || SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
 
 
+#if I2C_HW_SUPPORT == 1
+void I2C_reset(void)
+{
+  // Reset the I2C bus and the I2C peripheral to place them in a known
+  // state, then configure the peripheral for 400kHz Fast mode.
+  //
+  // This function is not included in the flash_update segment because it
+  // is never called again once the eeprom_copy_to_flash function is called.
+  //
+  // While the peripheral is disabled PB4 and PB5 are GPIO. SCL is clocked
+  // 10 times (with SDA floating) so that a slave left in the middle of a
+  // transfer releases SDA.
+  int i;
+  int nop_cnt;
+
+  I2C_CR1 = 0;                    // Disable the peripheral
+  PB_ODR &= (uint8_t)~0x30;       // SCL and SDA ODR to 0
+  PB_DDR &= (uint8_t)~0x30;       // Float SCL and SDA high
+  for (i=0; i<10; i++) {
+    PB_DDR |= (uint8_t)0x10;      // Drive SCL low
+    for (nop_cnt=0; nop_cnt<10; nop_cnt++) nop(); // Wait 5us
+    PB_DDR &= (uint8_t)~0x10;     // Float SCL high
+    for (nop_cnt=0; nop_cnt<10; nop_cnt++) nop(); // Wait 5us
+  }
+
+  // Enable the I2C clock (it is disabled in clock_init())
+  CLK_PCKENR1 |= CLK_PCKENR1_I2C;
+  
+  // A software reset clears a BUSY flag left over from a bus glitch
+  I2C_CR2 = I2C_CR2_SWRST;
+  I2C_CR2 = 0;
+  
+  // Configure the peripheral:
+  //   FREQR:  16MHz peripheral clock
+  //   CCR:    Fast mode, Duty 2:1 (Tlow = 2 x Thigh). SCL period is
+  //           3 x CCR / 16MHz, so CCR = 14 gives about 381kHz.
+  //   TRISER: 300ns maximum rise time x 16MHz + 1
+  I2C_FREQR = 16;
+  I2C_CCRL = 14;
+  I2C_CCRH = I2C_CCRH_FS;
+  I2C_TRISER = 5;
+  I2C_CR1 = I2C_CR1_PE;
+  I2C_CR2 = I2C_CR2_ACK;
+}
+
+#else // I2C_HW_SUPPORT == 0
 void I2C_reset(void)
 {
   // Reset the I2C bus to place it in a known state.
@@ -606,6 +902,54 @@ void I2C_reset(void)
   SCL_high();
   SDA_high(); // Stop condition
 }
+#endif // I2C_HW_SUPPORT == 1
 
 #endif // I2C_SUPPORT == 1
 
+
+#if FLASH_COPY_STAGING == 1
+uint8_t eeprom_stage_block(void)
+{
+  // Stages one 128 byte block of a Flash update from the I2C EEPROM. The
+  // block of the image at eeprom_base is compared with the same block in
+  // Flash and is marked in flash_stage_map if the two differ. The main loop
+  // calls this once per pass while a copy request is waiting, so the compare
+  // of all 253 blocks (the main program and the flash_update segment) runs
+  // while networking continues. eeprom_copy_to_flash() then only programs
+  // the marked blocks.
+  //
+  // eeprom_num_write, eeprom_num_read and eeprom_base must be set and
+  // flash_stage_block must be zero before the first call.
+  //
+  // Returns 0 while blocks remain, 1 when staging is complete, or 2 if the
+  // I2C EEPROM did not respond.
+  uint8_t i;
+  uint8_t differ;
+  uint16_t offset;
+  char *flash_block;
+  
+  if (flash_stage_block == 0) memset(flash_stage_map, 0, sizeof(flash_stage_map));
+  
+  offset = (uint16_t)((uint16_t)flash_stage_block << 7);
+  flash_block = (char *)(FLASH_START_PROGRAM_MEMORY + offset);
+  
+  I2C_control(eeprom_num_write);
+  I2C_byte_address((uint16_t)(eeprom_base + offset), 2);
+  if (I2C_control(eeprom_num_read)) {
+    I2C_stop();
+    return 2;
+  }
+  
+  differ = 0;
+  for (i=0; i<127; i++) {
+    if ((char)I2C_read_byte(0) != flash_block[i]) differ = 1;
+  }
+  if ((char)I2C_read_byte(1) != flash_block[127]) differ = 1;
+  
+  if (differ) flash_stage_map[flash_stage_block >> 3] |= (uint8_t)(1 << (flash_stage_block & 0x07));
+  
+  flash_stage_block++;
+  if (flash_stage_block == 253) return 1;
+  return 0;
+}
+#endif // FLASH_COPY_STAGING == 1
@@ -43,6 +43,11 @@
 #define I2C_EEPROM2_BASE		0x0000 // Base address of EEPROM2 region
 #define I2C_EEPROM3_BASE		0x8000 // Base address of EEPROM3 region
 
+// CRC32 of the Flash image last copied to EEPROM0 (IMAGE_BACKUP_TASK). It
+// is kept past the end of the image, where the Flash user reserve would be.
+// The user reserve is never copied to EEPROM0.
+#define I2C_EEPROM0_IMAGE_CRC		0x7e80
+
 
 #define I2C_COPY_EEPROM0_REQUEST	1
 #define I2C_COPY_EEPROM0_WAIT		2
@@ -54,6 +59,10 @@ uint8_t I2C_control(uint8_t control_byte);
 void I2C_byte_address(uint16_t byte_address, uint8_t addr_size);
 void I2C_write_byte(uint8_t I2C_write_data);
 uint8_t I2C_read_byte(uint8_t I2C_last_flag);
+#if I2C_HW_SUPPORT == 1
+uint8_t I2C_wait_flag(uint8_t flag);
+uint8_t I2C_send_byte(uint8_t I2C_transmit_data);
+#else // I2C_HW_SUPPORT == 0
 void SCL_pulse(void);
 void SCL_high(void);
 void SCL_low(void);
@@ -61,9 +70,16 @@ void SDA_high(void);
 void SDA_low(void);
 void I2C_transmit_byte(uint8_t I2C_transmit_data);
 uint8_t Read_Slave_NACKACK(void);
+#endif // I2C_HW_SUPPORT == 1
 void I2C_stop(void);
 void I2C_reset(void);
+#if I2C_EEPROM_FAST_COPY == 1 || SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+void eeprom_write_wait(uint8_t control_write);
+#endif // I2C_EEPROM_FAST_COPY == 1 || SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
 void eeprom_copy_to_flash(void);
 void copy_ram_to_flash(void);
+#if FLASH_COPY_STAGING == 1
+uint8_t eeprom_stage_block(void);
+#endif // FLASH_COPY_STAGING == 1
 
 #endif /* __I2C_H__ */
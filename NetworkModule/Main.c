@@ -88,6 +88,16 @@ uint8_t stack_limit2;
 // EEPROM Variables:
 
 // >>> Add new variables HERE <<<
+// 125 bytes used below
+@eeprom uint8_t stored_mcast_group[8];     // Byte 118-125 Multicast groups
+                                           // joined, 0.0.0.0 = unused
+// 117 bytes used below
+@eeprom uint8_t stored_telemetry_interval; // Byte 117 UDP telemetry interval
+                                           // in seconds, 0 = off
+@eeprom uint16_t stored_telemetry_port;    // Byte 115-116 UDP telemetry
+                                           // collector port (network order)
+@eeprom uint8_t stored_telemetry_addr[4];  // Byte 111-114 UDP telemetry
+                                           // collector IP address
 // 110 bytes used below
 @eeprom int16_t stored_altitude;           // Byte 109-110
 					   // User entered altitude used for
@@ -117,14 +127,22 @@ uint8_t stack_limit2;
 					   //        1 = Full, 0 = Half
 @eeprom uint8_t stored_prior_config;       // Copy of stored_config_settings
                                            // prior to reboot
-@eeprom uint8_t stored_unused6;            // Byte 80 unused
-@eeprom uint8_t stored_unused5;            // Byte 79 unused
+@eeprom uint16_t stored_discovery_hash;    // Byte 79-80 Hash of the
+                                           // settings sent in the last
+					   // Home Assistant Auto Discovery
+					   // (MQTT_DISCOVERY_HASH). Was
+					   // unused.
 @eeprom uint8_t stored_options2;           // Byte 78 Additional Options
                                            // Bit 7: not used
 					   // Bit 6: not used
-					   // Bit 5: not used
-					   // Bit 4: not used
-					   // Bit 3: not used
+					   // Bit 5: DHCP (see URL command /87)
+					   //   0 = Static addresses
+					   //   1 = DHCP
+					   // Bits 3-4: ENC28J60 Receive Filter
+					   //   Profile (see URL command /86)
+					   //   00 = Standard
+					   //   01 = ARP broadcasts only
+					   //   10 = ARP + multicast groups
 					   // Bits 0-2: INA226 Shunt Resistor Options
 					   //   See Manual
 					   //   000 = 0.002 ohm
@@ -216,6 +234,16 @@ uint8_t Sensor_IDX[6][8] @FLASH_START_SENSOR_IDX;
 // is still defined for all builds.
 uint16_t IO_TIMER[16] @FLASH_START_IO_TIMERS;
 char IO_NAME[16][16] @FLASH_START_IO_NAMES;
+#if DHCP_SUPPORT == 1
+// Define the Flash address for the last DHCP lease: address, netmask,
+// router and server, 4 bytes each (network order). A 0.0.0.0 address
+// means there is no lease.
+uint8_t dhcp_lease[16] @FLASH_START_DHCP_LEASE;
+#endif // DHCP_SUPPORT == 1
+#if RULE_ENGINE_SUPPORT == 1
+// Define the Flash address for the rule table (see rule_service()).
+uint8_t rule_table[NUM_RULES][4] @FLASH_START_RULES;
+#endif // RULE_ENGINE_SUPPORT == 1
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD
 // Define RAM for IO Timers
 #if PCF8574_SUPPORT == 0
@@ -286,6 +314,28 @@ uint32_t Invert_word;                   // Invert state of pins in single 32 bit
                                         // word
 #endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
 
+#if BUILD_SUPPORT == MQTT_BUILD && MQTT_PUBLISH_ROUND_ROBIN == 1
+#if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+uint16_t pin_change_latch;              // Pins that changed since their last
+                                        // MQTT Publish
+uint16_t pin_last_seen;                 // ON_OFF_word at the last
+                                        // publish_outbound() call
+#endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+#if PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+uint32_t pin_change_latch;              // Pins that changed since their last
+                                        // MQTT Publish
+uint32_t pin_last_seen;                 // ON_OFF_word at the last
+                                        // publish_outbound() call
+#endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+uint8_t pin_change_tick[sizeof(pin_control)]; // publish_tick when the pin
+                                        // change was latched
+uint8_t publish_tick;                   // Counts publish_outbound() calls
+                                        // (50ms)
+uint8_t publish_rr;                     // Pin the next scan starts at
+uint16_t publish_delay_max;             // Longest pin change to Publish
+                                        // delay (ms)
+#endif // BUILD_SUPPORT == MQTT_BUILD && MQTT_PUBLISH_ROUND_ROBIN == 1
+
 
 
 
@@ -299,10 +349,63 @@ uint8_t magic_number_missing_flag;      // Indicates a missing Magic Number
 uint8_t reboot_request;                 // Signals the need for a reboot
 uint8_t user_reboot_request;            // Signals a user request for a reboot
 uint8_t restart_request;                // Signals the need for a restart
+#if HOT_APPLY_CONFIG == 1
+uint8_t hot_apply;                      // Settings to be applied without a
+                                        // restart
+#define HOT_APPLY_HOST	0x01            // IP Address changed
+#define HOT_APPLY_ROUTE	0x02            // Gateway or Netmask changed
+#define HOT_APPLY_PORT	0x04            // HTTP Port changed
+#define HOT_APPLY_MQTT	0x08            // MQTT Server, Port, Username,
+                                        // Password or Device Name changed
+#endif // HOT_APPLY_CONFIG == 1
 uint8_t mqtt_close_tcp;                 // Signals the need to close the MQTT TCP
                                         // connection
 uint8_t parse_complete;                 // Signals the completion of POST parsing
 uint8_t mqtt_parse_complete;            // Signals the completion of MQTT parsing
+#if RUNTIME_DIRTY_FLAGS == 1
+uint8_t runtime_dirty;                  // Work pending for
+                                        // check_runtime_changes()
+#define RUNTIME_CONFIG	0x01            // Pending settings are complete
+#define RUNTIME_TIMERS	0x02            // A pin_timer may have expired
+#endif // RUNTIME_DIRTY_FLAGS == 1
+#if EEPROM_WRITE_CACHE == 1
+extern uint16_t ms_counter;           // Free running ms counter
+// Write-back cache for the STM8 data EEPROM. Each entry holds one 4 byte
+// EEPROM word so that all of the changed bytes in the word are written with
+// a single word programming cycle.
+#define EEPROM_CACHE_WORDS	4
+static uint8_t *ee_cache_addr[EEPROM_CACHE_WORDS]; // Word aligned EEPROM
+                                      // address, NULL = entry not in use
+static uint8_t ee_cache_data[EEPROM_CACHE_WORDS][4];
+static uint8_t ee_cache_dirty[EEPROM_CACHE_WORDS]; // Bytes in the word that
+                                      // were written through the cache
+static uint8_t ee_cache_used;         // Number of entries in use
+static uint16_t ee_cache_stamp;       // ms_counter at the last cached write
+uint16_t eeprom_word_writes;          // Wear counter: EEPROM programming
+                                      // cycles since boot
+uint16_t eeprom_coalesced;            // Byte writes that were merged into an
+                                      // already pending word
+#endif // EEPROM_WRITE_CACHE == 1
+#if DEFERRED_SENSOR_INIT == 1
+extern uint16_t ms_counter;           // Free running ms counter
+#define SENSOR_INIT_INTERVAL	50     // ms between deferred sensor init
+                                      // stages
+uint8_t sensor_init_stage;            // Next sensor_init() stage to run,
+                                      // SENSOR_INIT_DONE when complete
+uint16_t sensor_init_ms;              // ms_counter when the last stage ran
+uint16_t boot_arp_time;               // Boot to first ARP reply (ms)
+#if BUILD_SUPPORT == MQTT_BUILD
+uint16_t boot_mqtt_time;              // Boot to first MQTT startup
+                                      // complete (ms)
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // DEFERRED_SENSOR_INIT == 1
+#if IMAGE_BACKUP_TASK == 1
+uint8_t image_backup_state;           // Next image_backup_step() step,
+                                      // IMAGE_BACKUP_DONE when complete
+uint16_t image_backup_index;          // Offset of the next 128 bytes of
+                                      // Flash to sum or copy
+uint32_t image_backup_crc;            // CRC32 of the Flash image
+#endif // IMAGE_BACKUP_TASK == 1
 
 
 
@@ -379,6 +482,21 @@ uint16_t linked_edge;		// Used for indicating Input pin edge
 #endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
 #endif // LINKED_SUPPORT == 1
 
+#if LINKED_PIN_MASKS == 1
+// Pin type masks compiled from the pin_control bytes by build_linked_masks()
+// so that read_input_pins() doesn't need to check each pin type on every pass.
+// The bit positions match the ON_OFF_word.
+#if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+uint16_t input_pin_mask;	// Input pins including Linked pins 1 to 8
+uint16_t linked_src_mask;	// Linked pins 1 to 8
+#endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+#if PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+uint32_t input_pin_mask;	// Input pins including Linked pins 1 to 8
+				// and 17 to 20
+uint32_t linked_src_mask;	// Linked pins 1 to 8 and 17 to 20
+#endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+#endif // LINKED_PIN_MASKS == 1
+
 
 
 
@@ -417,13 +535,86 @@ struct uip_conn *mqtt_conn;           // mqtt_conn points to the connection
 				      // structure table while setting up MQTT
 				      // operations.
 uint8_t mqtt_restart_step;            // Step tracker for restarting MQTT
+#if MQTT_ZERO_COPY == 1
+uint8_t mqtt_publish_due;             // Set each 50ms to run publish_outbound()
+                                      // in the next MQTT connection poll
+#endif // MQTT_ZERO_COPY == 1
 
 static const unsigned char devicetype[] = "NetworkModule/"; // Used in
                                       // building topic and client id names
+#if MQTT_TOPIC_PREFIX == 1
+uint8_t topic_prefix[34];             // "NetworkModule/" plus the device
+                                      // name, built once at MQTT start
+uint8_t topic_prefix_len;             // strlen of topic_prefix
+static const char * const topic_suffix[] = {
+  "/input/",
+  "/output/",
+  "/state",
+  "/state24",
+  "/state-chg",
+  "/state-chg24",
+  "/temp/",
+  "/temp/BME280-0",
+  "/pres/BME280-1",
+  "/hum/BME280-2",
+  "/availability",
+  "/history" };                       // Device topic suffixes, indexed by
+                                      // the TOPIC_SUFFIX_ defines in main.h
+#endif // MQTT_TOPIC_PREFIX == 1
+#if MQTT_FAST_RECONNECT == 1 && HOME_ASSISTANT_SUPPORT == 1
+static const char * const subscribe_suffix[] = {
+  "/output/+/set",
+  "/state-req",
+  "/state-req24" };                   // Device topics subscribed to with one
+                                      // SUBSCRIBE packet
+#endif // MQTT_FAST_RECONNECT == 1 && HOME_ASSISTANT_SUPPORT == 1
+#if MQTT_PUBLISH_DISPATCH == 1
+static const struct inbound_topic {
+  const char *suffix;                 // Topic after "NetworkModule/
+                                      // DeviceName/". '+' marks a pin digit.
+  uint8_t len;                        // strlen of suffix
+  uint8_t command;                    // INBOUND_ command code
+} inbound_topic[] = {
+  { "state-req",       9, INBOUND_STATE_REQ },
+  { "state-req24",    11, INBOUND_STATE_REQ24 },
+  { "output/++/set",  13, INBOUND_OUTPUT_PIN },
+  { "output/all/set", 14, INBOUND_OUTPUT_ALL } };
+                                      // Inbound PUBLISH topics looked up by
+                                      // publish_callback(). Each length is
+                                      // unique so the length selects the
+                                      // one entry to compare.
+uint16_t inbound_time;                // Last PUBLISH handling time (10us)
+uint16_t inbound_time_max;            // Longest PUBLISH handling time (10us)
+#endif // MQTT_PUBLISH_DISPATCH == 1
 uint8_t auto_discovery;               // Used in the Auto Discovery state machine
 uint8_t auto_discovery_step;          // Used in the Auto Discovery state machine
 uint8_t pin_ptr;                      // Used in the Auto Discovery state machine
 uint8_t sensor_number;                // Used in the Auto Discovery state machine
+#if MQTT_DISCOVERY_HASH == 1
+uint8_t discovery_request;            // Set when the Home Assistant birth
+                                      // message asks for Auto Discovery
+#endif // MQTT_DISCOVERY_HASH == 1
+#if MQTT_HA_STATUS_RESYNC == 1
+uint32_t resync_time;                 // second_counter value at which the
+                                      // birth message resync is run
+#endif // MQTT_HA_STATUS_RESYNC == 1
+#if MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
+uint8_t resync_full;                  // Set when the next MQTT connect must
+                                      // republish all pin states
+#endif // MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
+#if MQTT_DISCOVERY_BATCH == 1
+extern uint16_t ms_counter;           // Free running ms counter
+uint16_t discovery_start;             // ms_counter when Auto Discovery started
+uint16_t discovery_time;              // Time to send the Auto Discovery
+                                      // messages (ms)
+#endif // MQTT_DISCOVERY_BATCH == 1
+#if MQTT_FAST_RECONNECT == 1
+extern uint16_t ms_counter;           // Free running ms counter
+uint16_t reconnect_start;             // ms_counter when the MQTT connect
+                                      // sequence started
+uint16_t reconnect_time;              // Time from TCP connect to MQTT
+                                      // startup complete (ms)
+#endif // MQTT_FAST_RECONNECT == 1
 
 #if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
 uint16_t MQTT_transmit;               // Used to force a publish_pinstate
@@ -466,6 +657,168 @@ uint8_t MQTT_not_OK_counter;     // Counts MQTT != OK events in the
 uint8_t MQTT_broker_dis_counter; // Counts broker disconnect events in
                                  // the mqtt_sanity_check() function
 
+#if RX_DRAIN_SUPPORT == 1
+uint8_t rx_drain_max;            // Deepest receive drain seen (number of
+                                 // packets processed in one main loop pass)
+uint16_t rx_drain_limit_counter; // Counts receive drains that stopped at
+                                 // RX_DRAIN_MAX_PACKETS with more packets
+				 // still waiting in the ENC28J60
+#endif // RX_DRAIN_SUPPORT == 1
+
+#if PERIODIC_WORK_FLAGS == 1
+uint8_t periodic_sweep_ctr;      // Counts periodic_service() passes between
+                                 // full sweeps of the connection table
+#endif // PERIODIC_WORK_FLAGS == 1
+
+#if LOOP_PROFILER == 1
+// Main loop phase profiler. Times are in 10us units. See
+// loop_profile_mark().
+struct loop_profile {
+  uint16_t min;                     // Shortest time seen for the phase
+  uint16_t max;                     // Longest time seen for the phase
+  uint16_t bucket[PROFILE_BUCKETS]; // Histogram of the phase times
+};
+struct loop_profile profile[PROFILE_PHASES];
+uint16_t profile_acc[PROFILE_PHASES]; // Phase times in this loop pass
+uint8_t profile_ran;                  // Phases run in this loop pass
+uint16_t profile_last;                // Timestamp of the last mark
+uint32_t profile_report_ctr;          // Time of the last UART report
+#endif // LOOP_PROFILER == 1
+
+#if RAM_HEADROOM_STATISTICS == 1
+uint16_t uip_buf_peak;                // Largest frame received into or
+                                      // sent from the uip_buf
+#endif // RAM_HEADROOM_STATISTICS == 1
+
+#if PUBLISH_LATENCY_STATS == 1
+// Input change to MQTT PUBLISH latency. One input change is timed at a time.
+// Times are in ms. See latency_detect().
+extern uint16_t ms_counter;           // Free running ms counter
+struct latency_stage latency[LATENCY_STAGES];
+uint8_t latency_state;                // LATENCY_IDLE, _DETECTED or _QUEUED
+uint32_t latency_mask;                // Pin being timed
+uint16_t latency_detected;            // ms_counter when the change was
+                                      // debounced
+uint16_t latency_queued_at;           // ms_counter when the PUBLISH was
+                                      // queued
+#endif // PUBLISH_LATENCY_STATS == 1
+
+#if INPUT_PASS_STATISTICS == 1
+uint16_t input_pass_min;              // Shortest input pass (us)
+uint16_t input_pass_max;              // Longest input pass (us)
+#endif // INPUT_PASS_STATISTICS == 1
+
+#if HTTP_PACING == 1
+// HTTP page segments give way to MQTT sends. See http_pacing_hold().
+extern uint16_t ms_counter;           // Free running ms counter
+struct pacing_queue pacing[2];        // PACING_HTTP and PACING_MQTT
+                                      // queueing delays
+uint16_t pacing_window_start;         // ms_counter at the start of the
+                                      // PACING_WINDOW
+uint32_t pacing_http_us;              // Time spent building HTTP segments
+                                      // in the window (us)
+#endif // HTTP_PACING == 1
+
+#if TRACE_RING_SUPPORT == 1
+// Event trace ring. Events are collected in trace_chunk[] and written to
+// the I2C EEPROM3 slot for trace_seq by trace_service(). See main.h for the
+// chunk layout.
+extern uint16_t ms_counter;           // Free running ms counter
+uint8_t trace_chunk[TRACE_CHUNK_SIZE];
+uint16_t trace_seq;                   // Sequence number of trace_chunk
+uint8_t trace_ready;                  // Set by trace_init() if the I2C
+                                      // EEPROM is present
+uint8_t trace_count;                  // Entries in trace_chunk
+uint8_t trace_written;                // Entries already in the EEPROM slot
+uint8_t trace_dropped;                // Events were dropped, flagged in the
+                                      // next chunk written
+uint32_t trace_base;                  // second_counter at the first entry
+uint16_t trace_write_sec;             // second_counter at the last write
+uint8_t trace_rst_sr;                 // RST_SR captured at boot
+uint8_t trace_tcp[UIP_CONNS];         // Last traced TCP state of each
+                                      // connection
+#if BUILD_SUPPORT == MQTT_BUILD
+uint8_t trace_mqtt_start;             // Last traced mqtt_start
+uint8_t trace_mqtt_restart;           // Last traced mqtt_restart_step
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // TRACE_RING_SUPPORT == 1
+
+#if UDP_TELEMETRY_SUPPORT == 1
+uint8_t telemetry_seq;                // Sequence number of the last
+                                      // telemetry datagram
+uint32_t telemetry_sent;              // second_counter when it was sent
+#if RAM_HEADROOM_STATISTICS == 1 && BUILD_SUPPORT == MQTT_BUILD
+extern uint16_t mqtt_sendbuf_peak;    // Most of the mqtt_sendbuf used
+extern uint8_t mqtt_pbuf_peak;        // Largest message in the MQTT
+                                      // Partial Buffer
+#endif // RAM_HEADROOM_STATISTICS == 1 && BUILD_SUPPORT == MQTT_BUILD
+#endif // UDP_TELEMETRY_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+uint32_t mcast_report_sent;           // second_counter when the IGMP
+                                      // Membership Reports were sent
+uint16_t mcast_last_seq;              // seq of the last group command, or
+                                      // 0x100 if none
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+#if DHCP_SUPPORT == 1
+uint8_t dhcp_state;                   // DHCP_ client state
+uint32_t dhcp_xid;                    // Transaction ID of the exchange
+uint8_t dhcp_offer[8];                // Offered address and server
+uint32_t dhcp_time;                   // second_counter at the last message
+                                      // sent (or at the bind)
+uint32_t dhcp_wait;                   // Seconds from dhcp_time until the
+                                      // next message
+uint8_t dhcp_retry;                   // Seconds until the next retransmit
+uint32_t dhcp_bound;                  // second_counter at the last ACK
+uint32_t dhcp_lease_time;             // Lease time of the last ACK
+#endif // DHCP_SUPPORT == 1
+
+#if RULE_ENGINE_SUPPORT == 1
+uint8_t rule_state;                   // Condition of each rule on the last
+                                      // pass, bit 0 is rule 0
+uint8_t rule_timer[NUM_RULES];        // Seconds until a RULE_ACT_DELAY_OFF
+                                      // turns its Output OFF
+uint8_t rule_second;                  // Low byte of second_counter when the
+                                      // rule_timers were last counted down
+#endif // RULE_ENGINE_SUPPORT == 1
+
+#if SENSOR_DEADBAND_SUPPORT == 1
+int16_t sensor_pub_value[DEADBAND_SENSORS]; // Last published reading of
+                                      // each sensor (see
+                                      // sensor_publish_due())
+uint16_t sensor_pub_time[DEADBAND_SENSORS]; // Low 16 bits of
+                                      // second_counter at that publish
+uint8_t sensor_pub_valid;             // Bit set once a sensor is published
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+
+#if SENSOR_HISTORY_SUPPORT == 1
+struct history_entry history[SENSOR_HISTORY_SIZE]; // Sensor sample ring
+uint8_t history_head;                 // Next entry to write
+uint8_t history_count;                // Samples not yet published
+uint8_t history_lost;                 // Samples overwritten before they
+                                      // were published
+uint32_t history_time;                // second_counter at the last sample
+#endif // SENSOR_HISTORY_SUPPORT == 1
+
+#if MODBUS_TCP_SUPPORT == 1
+struct uip_conn *modbus_conn;         // The Modbus TCP connection
+uint8_t modbus_request[MODBUS_REQUEST_MAX]; // Last request, kept to
+                                      // rebuild the reply on a retransmit
+uint16_t modbus_request_len;          // Length of the last request
+#if INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+#if SENSOR_FIXED_POINT == 1
+extern int32_t ina226_voltage[5];     // Measurements collected from each
+extern int32_t ina226_current[5];     // INA226 by ina226_service()
+extern int32_t ina226_power[5];
+#else // SENSOR_FIXED_POINT == 0
+extern float ina226_voltage[5];       // Measurements collected from each
+extern float ina226_current[5];       // INA226 by ina226_service()
+extern float ina226_power[5];
+#endif // SENSOR_FIXED_POINT == 1
+#endif // INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+#endif // MODBUS_TCP_SUPPORT == 1
+
 #if DS18B20_SUPPORT == 1
 // DS18B20 variables
 uint32_t check_DS18B20_ctr;      // Counter used to trigger temperature
@@ -485,6 +838,8 @@ extern uint8_t FoundROM[5][8];   // Table of found ROM codes
                                  // [x][5] = byte 5 serial number
                                  // [x][6] = MSByte serial number
                                  // [x][7] = CRC
+extern uint8_t DS18B20_scratch[5][2]; // Last temperature read from each
+                                      // sensor
 #endif // DS18B20_SUPPORT == 1
 
 
@@ -495,6 +850,10 @@ struct bme280_dev dev;        // Structure to store the device calibration
 int8_t rslt;		      // Variable to report BME280 function results.
 uint32_t check_BME280_ctr;    // Time counter to determine when to collect the
                               // BME280 measurements.
+#if BME280_NORMAL_MODE_SUPPORT == 1
+uint32_t read_BME280_ctr;     // Time counter to determine when to read the
+                              // latest BME280 normal mode measurements.
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
 struct bme280_data comp_data; // Structure to collect the compensated
                               // pressure, temperature and humidity data.
 uint8_t BME280_found;         // Used to indicate that that a BME280 device
@@ -514,16 +873,24 @@ int8_t send_mqtt_BME280;      // Indicates if new BME280 sensor measurements
 			      // In both environments -1 indicates "nothing to
 			      // transmit".
 extern int32_t comp_data_temperature; // Compensated temperature
+extern int32_t comp_data_pressure;    // Compensated pressure
 extern int32_t comp_data_humidity;    // Compensated humidity
 #endif // BME280_SUPPORT == 1
 
 
 #if INA226_SUPPORT == 1;
 // INA226 variables
+#if SENSOR_FIXED_POINT == 1
+extern int32_t voltage;       // Voltage value reported by the INA226 (mV)
+extern int32_t current;       // Current value reported by the INA226 (mA)
+extern int32_t power;         // Power value reported by the INA226 (mW)
+extern int32_t shunt_voltage; // Shunt Voltage value reported by the INA226 (uV)
+#else // SENSOR_FIXED_POINT == 0
 extern float voltage;       // Voltage value reported by the INA226
 extern float current;       // Current value reported by the INA226
 extern float power;         // Power value reported by the INA226
 extern float shunt_voltage; // Shunt Voltage value reported by the INA226
+#endif // SENSOR_FIXED_POINT == 1
 #endif // INA226_SUPPORT == 1;
 
 
@@ -544,6 +911,9 @@ extern char * flash_ptr;             // Used in code update routines to copy
 extern uint8_t eeprom_num_write;     // Used in code update routines
 extern uint8_t eeprom_num_read;      // Used in code update routines
 extern uint16_t eeprom_base;         // Used in code update routines
+#if FLASH_COPY_STAGING == 1
+extern uint8_t flash_stage_block;    // Used in code update routines
+#endif // FLASH_COPY_STAGING == 1
 uint8_t eeprom_detect;               // Used in code update routines
 
 #endif // OB_EEPROM_SUPPORT == 1
@@ -560,6 +930,14 @@ int main(void)
   uip_ipaddr_t IpAddr;
   uint8_t flash_mismatch;
   extern uint16_t uip_slen;
+#if IDLE_WAIT_SUPPORT == 1
+  uint8_t loop_busy;
+#endif // IDLE_WAIT_SUPPORT == 1
+
+#if RAM_HEADROOM_STATISTICS == 1
+  // Paint the stack before anything else uses it
+  stack_paint();
+#endif // RAM_HEADROOM_STATISTICS == 1
 
   // Initialize and enable clocks and timers. This must be done first to let
   // the processor clock stabilize.
@@ -579,6 +957,9 @@ int main(void)
   reboot_request = 0;
   user_reboot_request = 0;
   restart_request = 0;
+#if HOT_APPLY_CONFIG == 1
+  hot_apply = 0;
+#endif // HOT_APPLY_CONFIG == 1
   t100ms_ctr1 = 0;
   restart_reboot_step = RESTART_REBOOT_IDLE;
   stack_error = 0;
@@ -599,8 +980,20 @@ int main(void)
   mqtt_sanity_ctr = 0;			 // Tracks time for the MQTT sanity
                                          // steps
   mqtt_restart_step = MQTT_RESTART_IDLE; // Step counter for MQTT restart
+#if MQTT_ZERO_COPY == 1
+  mqtt_publish_due = 0;
+#endif // MQTT_ZERO_COPY == 1
   state_request = STATE_REQUEST_IDLE;    // Set the state request received to
                                          // idle
+#if MQTT_DISCOVERY_HASH == 1
+  discovery_request = 0;
+#endif // MQTT_DISCOVERY_HASH == 1
+#if MQTT_HA_STATUS_RESYNC == 1
+  resync_time = 0;
+#endif // MQTT_HA_STATUS_RESYNC == 1
+#if MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
+  resync_full = 1;                       // Publish all pins after boot
+#endif // MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
   // Increment the stored_rotation_ptr to be sure that we won't encounter the
   // TCP connection TIME_WAIT issue in the MQTT server when reboot occurs.
   {
@@ -667,9 +1060,38 @@ int main(void)
 				// stored in I2C EEPROM which uses IO pins 14
 				// and 15 to implement the I2C bus.
 
+#if IDLE_WAIT_SUPPORT == 1
+  idle_init();             // Set up the interrupts that end an idle WAIT.
+                           // Must follow gpio_init().
+#endif // IDLE_WAIT_SUPPORT == 1
+
 
 
   TRANSMIT_counter = 0;    // Initialize the TRANSMIT counter
+#if RUNTIME_DIRTY_FLAGS == 1
+  runtime_dirty = RUNTIME_CONFIG | RUNTIME_TIMERS; // Run every
+                           // check_runtime_changes() step on the first pass
+#endif // RUNTIME_DIRTY_FLAGS == 1
+#if LOOP_PROFILER == 1
+  loop_profile_init();     // Initialize the main loop profiler
+#endif // LOOP_PROFILER == 1
+#if PUBLISH_LATENCY_STATS == 1
+  latency_init();          // Initialize the PUBLISH latency statistics
+#endif // PUBLISH_LATENCY_STATS == 1
+#if INPUT_PASS_STATISTICS == 1
+  input_pass_min = 0xffff; // Initialize the input pass timing
+  input_pass_max = 0;
+#endif // INPUT_PASS_STATISTICS == 1
+#if HTTP_PACING == 1
+  pacing_init();           // Initialize the queueing delay counters
+#endif // HTTP_PACING == 1
+#if RX_DRAIN_SUPPORT == 1
+  rx_drain_max = 0;        // Initialize the receive drain counters
+  rx_drain_limit_counter = 0;
+#endif // RX_DRAIN_SUPPORT == 1
+#if PERIODIC_WORK_FLAGS == 1
+  periodic_sweep_ctr = 0;  // Initialize the periodic sweep counter
+#endif // PERIODIC_WORK_FLAGS == 1
   
   // Restore the saved debug statistics
   restore_eeprom_debug_bytes();
@@ -693,6 +1115,10 @@ int main(void)
 #endif // BUILD_TYPE_CODE_UPLOADER == 1
 #endif // DEBUG_SUPPORT == 15
 
+#if CHKSUM_BENCHMARK == 1
+  uip_chksum_benchmark();  // Compare the C and STM8 checksum loops
+#endif // CHKSUM_BENCHMARK == 1
+
 #if BUILD_TYPE_CODE_UPLOADER == 1
 #if RESPONSE_LOCK_SUPPORT == 1
   // If starting the Code Uploader make sure the Response Lock is turned OFF.
@@ -718,6 +1144,14 @@ int main(void)
 
   LEDcontrol(1);           // turn LED on
   
+#if MULTICAST_GROUP_SUPPORT == 1
+  // Join the stored multicast groups. Enc28j60Init() adds them to the hash
+  // table filter and mcast_service() sends the IGMP reports.
+  memcpy(uip_mcast_groups, &stored_mcast_group[0], 8);
+  mcast_report_sent = second_counter - MCAST_REPORT_INTERVAL;
+  mcast_last_seq = 0x100;
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
   Enc28j60Init();          // Initialize the ENC28J60 ethernet interface
                            // Note: Run restore_eeprom_debug_bytes() before
 			   // this init so that the Stack Overflow bit is
@@ -740,56 +1174,29 @@ int main(void)
   // that only the ON_OFF_words will be updated and the the linked_edge byte
   // will not be updated. The read needs to be performed twice so that
   // ON_OFF_word_new1, ON_OFF_word_new2, and ON_OFF_word will be equalized.
+#if LINKED_PIN_MASKS == 1
+  build_linked_masks();
+#endif // LINKED_PIN_MASKS == 1
   read_input_pins(1);
   read_input_pins(1);
 #endif // LINKED_SUPPORT == 1
 
 
-#if DS18B20_SUPPORT == 1
-  init_DS18B20();          // Initialize DS18B20 sensors
-  // Initialize DS18B20 control variables used in main.c 
-  if (stored_config_settings & 0x08) {
-    // Find all devices
-    FindDevices();
-    // Iniialize DS18B20 timer
-    check_DS18B20_ctr = second_counter;
-    // Initialize DS18B20 sensor add/delete check counter
-    // Collect initial temperature
-    get_temperature();
-    // Iniialize DS18B20 transmit control variable
-    send_mqtt_temperature = -1; // Indicates nothing to send on MQTT yet.
-  }
-#endif // DS18B20_SUPPORT == 1
-
-
-#if BME280_SUPPORT == 1
-  // Initialize the BME280
-  BME280_found = 0;
-//  send_mqtt_BME280 = -1; // Indicates nothing to send on MQTT yet.
-  send_mqtt_BME280 = 2; // Indicates we should send BME280 data as part of boot.
-  check_BME280_ctr = second_counter;
-  rslt = bme280_init(&dev);
-  if (rslt == BME280_OK) {
-    BME280_found = 1;
-    if (stored_config_settings & 0x20) {
-      // If a BME280 sensor was found and the config_settings show the sensor
-      // is enabled then collect the sensor data. This measurement at startup
-      // is needed so that sensor data is available for display when the
-      // IOControl page is shown at boot time.
-      stream_sensor_data_forced_mode(&dev, &comp_data);
-    }
-  }
-  else {
-    // If BME_280 sensor was not found then then force the BME280 Enable bit off.
-    // This will help reduce confusion on the part of the user that may think
-    // they can enable BME280 support on the Config Page but they have not
-    // connected a BME280 sensor.
-    Pending_config_settings &= (uint8_t)(~0x20);
-    // Note: parse_complete was set to 1 duriing main variable initialization.
-    // This will cause any change to the Pending_config_settings to update the
-    // EEPROM if needed.
-  }
-#endif // BME280_SUPPORT == 1
+#if DEFERRED_SENSOR_INIT == 0
+  // Initialize the DS18B20, BME280 and INA226 sensors
+  sensor_init(SENSOR_INIT_DS18B20);
+  sensor_init(SENSOR_INIT_BME280);
+#else // DEFERRED_SENSOR_INIT == 1
+  // The sensor discovery and init is run from the main loop one stage at a
+  // time so that the module answers ARP and starts MQTT without waiting on
+  // the 1-Wire and I2C devices.
+  sensor_init_stage = SENSOR_INIT_DS18B20;
+  sensor_init_ms = ms_counter;
+  boot_arp_time = 0;
+#if BUILD_SUPPORT == MQTT_BUILD
+  boot_mqtt_time = 0;
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // DEFERRED_SENSOR_INIT == 0
 
 
 #if PCF8574_SUPPORT == 1
@@ -816,14 +1223,9 @@ int main(void)
 #endif // PCF8574_SUPPORT == 1
 
 
-#if INA226_SUPPORT == 1
-  // Initialize all INA226 devices
-  ina226_init_all();
-  //   Calibrate all INA226 devices
-  ina226_calibrate_all();
-  //   Configure all INA226 devices
-  ina226_configure_all();
-#endif // INA226_SUPPORT == 1
+#if DEFERRED_SENSOR_INIT == 0
+  sensor_init(SENSOR_INIT_INA226);
+#endif // DEFERRED_SENSOR_INIT == 0
 
 
 
@@ -835,6 +1237,12 @@ int main(void)
   stack_limit2 = 0x55;
 
 
+#if TRACE_RING_SUPPORT == 1
+  // Keep the reset flags for the TRACE_BOOT event
+  trace_rst_sr = (uint8_t)(RST_SR & 0x1f);
+#endif // TRACE_RING_SUPPORT == 1
+
+
 #if DEBUG_SUPPORT == 15
   // Check RST_SR (Reset Status Register)
   if (RST_SR & 0x1f) {
@@ -918,15 +1326,35 @@ int main(void)
   // runtime firmware a copy of the firmware image would be in I2C EEPROM.
   //
   // Copy Flash to I2C EEPROM0.
+#if IMAGE_BACKUP_TASK == 0
   if (eeprom_detect == 1) {
     copy_flash_to_EEPROM0();
     // Flicker LED for 1 second to indicate I2C EEPROM write completion
     fastflash();
   }
+#else // IMAGE_BACKUP_TASK == 1
+  // The copy is checked and if needed made by the main loop, see
+  // image_backup_step().
+  image_backup_state = IMAGE_BACKUP_DONE;
+  if (eeprom_detect == 1) {
+    image_backup_state = IMAGE_BACKUP_CRC;
+    image_backup_index = 0;
+    image_backup_crc = 0xffffffff;
+    I2C_reset();
+    wait_timer(1000); // Wait 1 ms
+  }
+#endif // IMAGE_BACKUP_TASK == 0
 #endif // OB_EEPROM_SUPPORT == 1
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD    
 
 
+#if TRACE_RING_SUPPORT == 1
+  // Find the end of the trace in I2C EEPROM3 and log the boot
+  trace_init();
+  RST_SR = (uint8_t)(RST_SR | 0x1f); // Clear the flags
+#endif // TRACE_RING_SUPPORT == 1
+
+
 #if HTTPD_DIAGNOSTIC_SUPPORT == 1
   // Call the httpd_diagnotic() to verify that the content of the String file
   // is correct. The UART must be enabled for this to work.
@@ -938,6 +1366,11 @@ int main(void)
   // MAIN LOOP
   //-------------------------------------------------------------------------//
   while (1) {
+#if LOOP_PROFILER == 1
+    // Close out the profile of the previous main loop pass
+    loop_profile_loop();
+#endif // LOOP_PROFILER == 1
+
     // Overview of the main loop:
     // - The ENC28J60 does the hardware level work of receiving ethernet
     //   packets. It receives ethernet traffic and, based on the MAC address
@@ -1010,6 +1443,10 @@ int main(void)
     IWDG_KR = 0xaa; // Prevent the IWDG hardware watchdog from firing. If the
                     // processor hangs the IWDG will perform a hardware reset.
 
+#if IDLE_WAIT_SUPPORT == 1
+    loop_busy = 0;  // Set by any phase that did work on this pass
+#endif // IDLE_WAIT_SUPPORT == 1
+
     // The ENC28J60 is set up for a receive buffer of 6KB (see ENC28J60.h).
     // The ENC28J60 buffer size should be more than enough to hold all
     // messages that are received in a burst (say from a Home Assistant
@@ -1032,26 +1469,69 @@ int main(void)
     // I have no idea where most of the above traffic originates, but it all
     // occupies processing and buffer memory in addition to the genuine
     // application traffic of interest.
+    //
+    // If RX_DRAIN_SUPPORT is enabled the receive code below is run in a loop
+    // so that up to RX_DRAIN_MAX_PACKETS packets are read and processed
+    // before the slower housekeeping in the rest of the main loop. This keeps
+    // a burst of packets from backing up in the ENC28J60 receive buffer
+    // (RXERIF overflow). The loop exits as soon as the ENC28J60 has no more
+    // packets waiting.
+
+#if RX_DRAIN_SUPPORT == 1
+    {
+    uint8_t rx_drain_count;
+    rx_drain_count = 0;
+    while (1) {
+#endif // RX_DRAIN_SUPPORT == 1
 
     uip_len = Enc28j60Receive(uip_buf); // Check for incoming packets
+    PROFILE_MARK(PROFILE_RECEIVE);
+#if RAM_HEADROOM_STATISTICS == 1
+    if (uip_len > uip_buf_peak) uip_buf_peak = uip_len;
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if TRACE_RING_SUPPORT == 1
+    if (uip_len > 0) trace_frame(TRACE_RX, uip_buf, uip_len);
+#endif // TRACE_RING_SUPPORT == 1
+
+#if RX_DRAIN_SUPPORT == 1
+    if (uip_len == 0) break; // No more packets waiting
+    rx_drain_count++;
+#endif // RX_DRAIN_SUPPORT == 1
 
     if (uip_len > 0) {
+      // A received packet may carry GUI or MQTT changes, so have
+      // check_runtime_changes() run on this pass.
+      SCHED_EVENT(TASK_RUNTIME);
+#if IDLE_WAIT_SUPPORT == 1
+      loop_busy = 1;
+#endif // IDLE_WAIT_SUPPORT == 1
       if (((struct uip_eth_hdr *) & uip_buf[0])->type == htons(UIP_ETHTYPE_IP)) {
         // This code is executed if incoming traffic is HTTP or MQTT (not ARP).
         // uip_len includes the headers, so it will be > 0 even if no TCP
         // payload.
         uip_input(); // Calls uip_process(UIP_DATA) to process a received
 	// packet.
+#if TRACE_RING_SUPPORT == 1
+        trace_tcp_states();
+#endif // TRACE_RING_SUPPORT == 1
         // If the above process resulted in data that should be sent out on
 	// the network the global variable uip_len will have been set to a
 	// value > 0.
         if (uip_len > 0) {
           uip_arp_out(); // Verifies arp entry in the ARP table and builds
 	                 // the LLH
-          // The original uip code has a uip_split_output function. It is not
-          // needed for this application due to small packet sizes, so the
+          // The original uip code has a uip_split_output function. It is
+          // optional in this application (HTTP_SPLIT_OUTPUT), otherwise the
           // Enc28j60 transmit functions are called directly.
+#if HTTP_SPLIT_OUTPUT == 1
+          uip_split_output();
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if HTTP_SPLIT_OUTPUT == 0
           Enc28j60Send(uip_buf, uip_len);
+#endif // HTTP_SPLIT_OUTPUT == 0
+#if HTTP_MULTI_SEGMENT == 1
+          send_second_segment();
+#endif // HTTP_MULTI_SEGMENT == 1
         }
       }
       else if (((struct uip_eth_hdr *) & uip_buf[0])->type == htons(UIP_ETHTYPE_ARP)) {
@@ -1065,10 +1545,27 @@ int main(void)
           // needed for this application due to small packet sizes, so the
           // Enc28j60 transmit functions are called directly.
           Enc28j60Send(uip_buf, uip_len);
+#if DEFERRED_SENSOR_INIT == 1
+          if (boot_arp_time == 0) boot_arp_time = boot_elapsed();
+#endif // DEFERRED_SENSOR_INIT == 1
         }
       }
+      PROFILE_MARK(PROFILE_UIP);
     }
 
+#if RX_DRAIN_SUPPORT == 1
+    if (rx_drain_count >= RX_DRAIN_MAX_PACKETS) {
+      // Budget used up. Leave any remaining packets for the next pass so
+      // the rest of the main loop (timers, MQTT, IWDG) still runs. Only
+      // count the event if packets really are still waiting.
+      if (Enc28j60PacketCount() > 0) rx_drain_limit_counter++;
+      break;
+    }
+    }
+    if (rx_drain_count > rx_drain_max) rx_drain_max = rx_drain_count;
+    }
+#endif // RX_DRAIN_SUPPORT == 1
+
 #if BUILD_SUPPORT == MQTT_BUILD
     // Perform MQTT startup if 
     // a) MQTT is enabled
@@ -1080,6 +1577,9 @@ int main(void)
      && mqtt_start != MQTT_START_COMPLETE
      && mqtt_restart_step == MQTT_RESTART_IDLE
      && restart_reboot_step == RESTART_REBOOT_IDLE
+#if DEFERRED_SENSOR_INIT == 1
+     && sensor_init_stage == SENSOR_INIT_DONE
+#endif // DEFERRED_SENSOR_INIT == 1
      && user_reboot_request == 0) {
       mqtt_startup();
     }
@@ -1095,8 +1595,16 @@ int main(void)
      && user_reboot_request == 0) {
       mqtt_sanity_check(&mqttclient);
     }
+    PROFILE_MARK(PROFILE_MQTT);
 #endif // BUILD_SUPPORT == MQTT_BUILD
 
+#if TX_DOUBLE_BUFFER == 1
+    // Complete the transmission of the last frame sent if the ENC28J60 has
+    // finished with it. This keeps the handling of TX errors timely when no
+    // further frames are being sent.
+    Enc28j60TxPoll();
+#endif // TX_DOUBLE_BUFFER == 1
+
     // Update the time keeping function
     timer_update();
 
@@ -1115,7 +1623,31 @@ int main(void)
 	  // temperature state changes that need to be PUBLISHed via MQTT.
 	  // publish_outbound will place PUBLISH messages in the MQTT sendbuf
 	  // one per call, and only if the sendbuf is empty.
+#if MQTT_DISCOVERY_HASH == 1
+	  // Home Assistant sent its birth message (it restarted, or the
+	  // broker restarted and lost the retained Config messages). Run the
+	  // Auto Discovery steps of the MQTT startup again.
+#if MQTT_HA_STATUS_RESYNC == 1
+	  // With MQTT_HA_STATUS_RESYNC the resync waits for its time slot
+	  // and only runs Auto Discovery if the settings changed.
+	  if (discovery_request == 1 && second_counter >= resync_time) {
+	    ha_resync();
+	  }
+#else // MQTT_HA_STATUS_RESYNC == 0
+	  if (discovery_request == 1 && (stored_config_settings & 0x02)) {
+	    start_auto_discovery();
+	  }
+#endif // MQTT_HA_STATUS_RESYNC == 1
+#endif // MQTT_DISCOVERY_HASH == 1
+          PROFILE_MARK(PROFILE_OTHER);
+#if MQTT_ZERO_COPY == 1
+	  // With MQTT_ZERO_COPY publish_outbound() runs from the MQTT
+	  // connection poll started by the periodic_service() call below.
+	  mqtt_publish_due = 1;
+#else
 	  publish_outbound();
+#endif // MQTT_ZERO_COPY == 1
+          PROFILE_MARK(PROFILE_MQTT);
 	  // Call the periodic_service() function to clear out the MQTT
 	  // traffic just now placed in the uip_buf. Even though there is
 	  // a periodic_service() call in the main loop we don't want to
@@ -1124,6 +1656,7 @@ int main(void)
 	  // causes loss of MQTT messages and in some cases MQTT errors
 	  // and TCP resets.
 	  periodic_service();
+          PROFILE_MARK(PROFILE_PERIODIC);
 	}
         mqtt_start_ctr1++; // Increment the MQTT start loop timer 1. This is
                            // used to:
@@ -1147,9 +1680,40 @@ int main(void)
     if (periodic_timer_expired()) {
       // The periodic timer expires every X ms (see timer.c).
       // Call the periodic_service() function
+      PROFILE_MARK(PROFILE_OTHER);
+#if ENC28J60_INT_SUPPORT == 1
+      // Fallback EPKTCNT check in case PKTIF did not assert -INT
+      rx_poll_due = 1;
+#endif // ENC28J60_INT_SUPPORT == 1
       periodic_service();
+      PROFILE_MARK(PROFILE_PERIODIC);
     }
 
+#if TRACE_RING_SUPPORT == 1
+    // Add MQTT state events and write the trace to the I2C EEPROM
+    trace_service();
+#endif // TRACE_RING_SUPPORT == 1
+
+#if UDP_TELEMETRY_SUPPORT == 1
+    // Send the UDP telemetry datagram when it is due
+    telemetry_send();
+#endif // UDP_TELEMETRY_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+    // Send the IGMP Membership Reports when they are due
+    mcast_service();
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+#if DHCP_SUPPORT == 1
+    // Send the DHCP messages when they are due
+    dhcp_service();
+#endif // DHCP_SUPPORT == 1
+
+#if SENSOR_HISTORY_SUPPORT == 1
+    // Add the sensor readings to the history ring when they are due
+    history_sample();
+#endif // SENSOR_HISTORY_SUPPORT == 1
+
     // 100ms timer
     if (t100ms_timer_expired()) {
       t100ms_ctr1++;     // Increment the 100ms counter. ctr1 is used in the
@@ -1171,9 +1735,29 @@ int main(void)
     if (eeprom_copy_to_flash_request == I2C_COPY_EEPROM0_REQUEST) {
       eeprom_copy_to_flash_request = I2C_COPY_EEPROM0_WAIT;
       check_I2C_EEPROM_ctr = t100ms_ctr1;
+#if FLASH_COPY_STAGING == 1
+      eeprom_num_write = I2C_EEPROM0_WRITE;
+      eeprom_num_read = I2C_EEPROM0_READ;
+      eeprom_base = I2C_EEPROM0_BASE;
+      flash_stage_block = 0;
+#endif // FLASH_COPY_STAGING == 1
     }
+#if FLASH_COPY_STAGING == 1
+    // Compare one block of the image with Flash on each pass of the main
+    // loop while networking continues. If the I2C EEPROM does not respond
+    // the request is dropped.
+    if ((eeprom_copy_to_flash_request == I2C_COPY_EEPROM0_WAIT) &&
+        (flash_stage_block < 253)) {
+      if (eeprom_stage_block() == 2) {
+        eeprom_copy_to_flash_request = I2C_COPY_EEPROM_IDLE;
+      }
+    }
+#endif // FLASH_COPY_STAGING == 1
     // Give main loop 1000ms for browser update
     if ((eeprom_copy_to_flash_request == I2C_COPY_EEPROM0_WAIT) &&
+#if FLASH_COPY_STAGING == 1
+        (flash_stage_block == 253) &&
+#endif // FLASH_COPY_STAGING == 1
         (t100ms_ctr1 > (check_I2C_EEPROM_ctr + 10))) {
       unlock_flash();
       // eeprom_copy_to_flash will cause a reboot on completion of the
@@ -1208,11 +1792,35 @@ int main(void)
     // is generated when the user inputs a /72 command to start the Code
     // Uploader.
     if (eeprom_copy_to_flash_request == I2C_COPY_EEPROM1_REQUEST) {
+#if IMAGE_BACKUP_TASK == 1
+      // The Code Uploader may reinstall the image from EEPROM0
+      image_backup_finish();
+#endif // IMAGE_BACKUP_TASK == 1
       eeprom_copy_to_flash_request = I2C_COPY_EEPROM1_WAIT;
       check_I2C_EEPROM_ctr = t100ms_ctr1;
+#if FLASH_COPY_STAGING == 1
+      eeprom_num_write = I2C_EEPROM1_WRITE;
+      eeprom_num_read = I2C_EEPROM1_READ;
+      eeprom_base = I2C_EEPROM1_BASE;
+      flash_stage_block = 0;
+#endif // FLASH_COPY_STAGING == 1
+    }
+#if FLASH_COPY_STAGING == 1
+    // Compare one block of the image with Flash on each pass of the main
+    // loop while networking continues. If the I2C EEPROM does not respond
+    // the request is dropped.
+    if ((eeprom_copy_to_flash_request == I2C_COPY_EEPROM1_WAIT) &&
+        (flash_stage_block < 253)) {
+      if (eeprom_stage_block() == 2) {
+        eeprom_copy_to_flash_request = I2C_COPY_EEPROM_IDLE;
+      }
     }
+#endif // FLASH_COPY_STAGING == 1
     // Give main loop 1000ms for browser update
     if ((eeprom_copy_to_flash_request == I2C_COPY_EEPROM1_WAIT) &&
+#if FLASH_COPY_STAGING == 1
+        (flash_stage_block == 253) &&
+#endif // FLASH_COPY_STAGING == 1
         (t100ms_ctr1 > (check_I2C_EEPROM_ctr + 10))) {
       unlock_flash();
       // eeprom_copy_to_flash will cause a reboot on completion of the
@@ -1242,6 +1850,15 @@ int main(void)
       uip_arp_timer(); // Clean out old ARP Table entries. Any entry that has
                        // exceeded the UIP_ARP_MAXAGE without being accessed
 		       // is cleared. UIP_ARP_MAXAGE is typically 20 minutes.
+#if ARP_PENDING_SLOT == 1 && BUILD_SUPPORT == MQTT_BUILD
+      // Refresh the MQTT Server ARP entry before it expires
+      if (mqtt_enabled) {
+        uip_len = 0;
+        check_mqtt_server_arp_entry();
+        if (uip_len > 0) Enc28j60Send(uip_buf, uip_len);
+        uip_len = 0;
+      }
+#endif // ARP_PENDING_SLOT == 1 && BUILD_SUPPORT == MQTT_BUILD
 
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("\r\n");
@@ -1254,18 +1871,60 @@ int main(void)
 #endif // DEBUG_SUPPORT == 15
     }
 
+#if DEFERRED_SENSOR_INIT == 1
+    // Run the next deferred sensor init stage. The stages are spaced so that
+    // received packets are serviced between the 1-Wire and I2C transactions.
+    if (sensor_init_stage != SENSOR_INIT_DONE
+     && (uint16_t)(ms_counter - sensor_init_ms) >= SENSOR_INIT_INTERVAL) {
+      PROFILE_MARK(PROFILE_OTHER);
+      sensor_init(sensor_init_stage);
+      PROFILE_MARK(PROFILE_SENSORS);
+      sensor_init_ms = ms_counter;
+      sensor_init_stage++;
+      if (sensor_init_stage == SENSOR_INIT_STAGES) sensor_init_stage = SENSOR_INIT_DONE;
+    }
+#endif // DEFERRED_SENSOR_INIT == 1
+
+#if IMAGE_BACKUP_TASK == 1
+    // Run the next step of the Flash image backup to I2C EEPROM0
+    if (image_backup_state != IMAGE_BACKUP_DONE) image_backup_step();
+#endif // IMAGE_BACKUP_TASK == 1
+
 #if DS18B20_SUPPORT == 1
     // Update temperature data
     // If a DS18B20 sensor was found and the config_settings show the sensor
     // is enabled then collect the sensor data every 30 seconds.
-    if ((stored_config_settings & 0x08) && (second_counter > (check_DS18B20_ctr + 30))) {
+#if DS18B20_NONBLOCKING == 1
+    // With DS18B20_NONBLOCKING the read is started every 30 seconds and
+    // DS18B20_step() runs one 1-Wire bit slot of the read each main loop
+    // pass. The values are transmitted via MQTT when the last device has
+    // been read.
+    if (SCHED_DUE(TASK_DS18B20)
+     && (stored_config_settings & 0x08) && (second_counter > (check_DS18B20_ctr + 30))) {
+      check_DS18B20_ctr = second_counter;
+      start_temperature();
+    }
+    PROFILE_MARK(PROFILE_OTHER);
+    if (DS18B20_step()) {
+#if BUILD_SUPPORT == MQTT_BUILD
+      send_mqtt_temperature = 4; // Indicates that all 5 temperature sensors
+                                 // need to be transmitted via MQTT.
+#endif // BUILD_SUPPORT == MQTT_BUILD
+    }
+    PROFILE_MARK(PROFILE_SENSORS);
+#else // DS18B20_NONBLOCKING == 0
+    if (SCHED_DUE(TASK_DS18B20)
+     && (stored_config_settings & 0x08) && (second_counter > (check_DS18B20_ctr + 30))) {
       check_DS18B20_ctr = second_counter;
+      PROFILE_MARK(PROFILE_OTHER);
       get_temperature();
+      PROFILE_MARK(PROFILE_SENSORS);
 #if BUILD_SUPPORT == MQTT_BUILD
       send_mqtt_temperature = 4; // Indicates that all 5 temperature sensors
                                  // need to be transmitted via MQTT.
 #endif // BUILD_SUPPORT == MQTT_BUILD
     }
+#endif // DS18B20_NONBLOCKING == 1
 #endif // DS18B20_SUPPORT == 1
 
 #if BME280_SUPPORT == 1
@@ -1273,10 +1932,29 @@ int main(void)
     // is enabled then collect the sensor data every 300 seconds. Not sure of
     // the best interval so 300 seconds (5 min) is used since the BME280 is
     // best suited to weather monitoring.
-    if ((BME280_found == 1) && (stored_config_settings & 0x20)) {
+    if (SCHED_DUE(TASK_BME280)
+     && (BME280_found == 1) && (stored_config_settings & 0x20)) {
+#if BME280_NORMAL_MODE_SUPPORT == 1
+      // With BME280_NORMAL_MODE_SUPPORT the sensor measures in the
+      // background, so the latest filtered values are read every 30
+      // seconds for display without any wait. The MQTT interval is
+      // unchanged.
+      if (second_counter > (read_BME280_ctr + 30)) {
+        read_BME280_ctr = second_counter;
+        PROFILE_MARK(PROFILE_OTHER);
+        bme280_get_sensor_data(&comp_data, &dev);
+        PROFILE_MARK(PROFILE_SENSORS);
+      }
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
       if (second_counter > (check_BME280_ctr + 300)) {
         check_BME280_ctr = second_counter;
+        PROFILE_MARK(PROFILE_OTHER);
+#if BME280_NORMAL_MODE_SUPPORT == 1
+        bme280_get_sensor_data(&comp_data, &dev);
+#else // BME280_NORMAL_MODE_SUPPORT == 0
         stream_sensor_data_forced_mode(&dev, &comp_data);
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
+        PROFILE_MARK(PROFILE_SENSORS);
 #if BUILD_SUPPORT == MQTT_BUILD
         send_mqtt_BME280 = 2; // Indicates that the BME280 sensors need to be
                               // transmitted via MQTT.
@@ -1299,15 +1977,39 @@ int main(void)
       }
     }
 #endif // BME280_SUPPORT == 1
+
+#if INA226_ALERT_SUPPORT == 1
+    // Collect the INA226 measurements when the ALERT pin shows a conversion
+    // is ready.
+#if DEFERRED_SENSOR_INIT == 1
+    if (sensor_init_stage == SENSOR_INIT_DONE) {
+#endif // DEFERRED_SENSOR_INIT == 1
+    PROFILE_MARK(PROFILE_OTHER);
+    ina226_service();
+    PROFILE_MARK(PROFILE_SENSORS);
+#if DEFERRED_SENSOR_INIT == 1
+    }
+#endif // DEFERRED_SENSOR_INIT == 1
+#endif // INA226_ALERT_SUPPORT == 1
     
     
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
     // Check for changes in Output control states, IP address, IP gateway
     // address, Netmask, MAC, and Port number.
     // This functionality is not needed for the CODE_UPLOADER build.
-    check_runtime_changes();
+    // With MAIN_LOOP_SCHEDULER this runs once per millisecond, or on the
+    // pass after a packet is received.
+    if (SCHED_DUE(TASK_RUNTIME)) {
+      PROFILE_MARK(PROFILE_OTHER);
+      check_runtime_changes();
+      PROFILE_MARK(PROFILE_RUNTIME);
+    }
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 
+#if EEPROM_WRITE_CACHE == 1
+    eeprom_cache_service(); // Write the EEPROM cache after a quiet period
+#endif // EEPROM_WRITE_CACHE == 1
+
     // Check for the Reset button
     check_reset_button();
 
@@ -1315,662 +2017,1492 @@ int main(void)
     // reset button or generated by the user making changes in the GUI that
     // require a restart or reboot.
     check_restart_reboot();
+
+#if IDLE_WAIT_SUPPORT == 1
+    // If no packet was received on this pass and no 1-Wire read is in
+    // progress (it steps once per pass) then WAIT for the next interrupt.
+    // The TIM4 interrupt ends the WAIT within 1ms.
+#if DS18B20_NONBLOCKING == 1
+    if (ow_step != OW_STEP_IDLE) loop_busy = 1;
+#endif // DS18B20_NONBLOCKING == 1
+    if (loop_busy == 0) idle_wait();
+#endif // IDLE_WAIT_SUPPORT == 1
   }
   return 0;
 }
 
 
-void periodic_service(void)
+void sensor_init(uint8_t stage)
 {
-  int i;
-  for(i = 0; i < UIP_CONNS; i++) {
-    uip_periodic(i);
-    // uip_periodic() calls uip_process(UIP_TIMER) for each connection.
-    // Every connection is checked in this loop one time. With each pass
-    // only one connection (one HTTP or one MQTT) will transmit unserviced
-    // outbound traffic one packet at a time.
-    //
-    //   HTTP connections (the webbrowser) will generate and place its
-    //   data in the uip_buf via a call to HttpDCall(). HTTP connections
-    //   can have pending transmissions which are continuations of a
-    //   series of packets because the web pages can be broken into
-    //   several packets.
-    //
-    //   MQTT will always use this function to transmit packets. MQTT
-    //   will have placed its outbound packets in the mqtt_sendbuf. MQTT
-    //   connections will consist of a complete message in one packet.
-    //
-    //   Additionally, there will be TCP handshake transactions such as SYN,
-    //   SYNACK, ACK and FIN that are processed as a result of a
-    //   uip_process(UIP_TIMER).
-    //
-    // If uip_periodic() resulted in data that should be sent out on
-    // the network the global variable uip_len will have been set to a
-    // value > 0 so that Enc28j60Send() will be called.
-    //
-    // Note that when the device first powers up and MQTT is enabled the
-    // MQTT processes will attempt to send a SYN to create a TCP
-    // connection. The uip_periodic() function discovers the SYN is
-    // pending to be sent, causing uip_len to be > 0. Below you'll see
-    // that uip_arp_out() is called first, and on the first pass it will
-    // find that an ARP request is needed. The SYN will be replaced with
-    // an ARP request, and on a future cycle through this routine the
-    // SYN will be sent IF the ARP request was successful.
-    
-    if (uip_len > 0) {
-      uip_arp_out(); // Verifies arp entry in the ARP table and builds
-                     // the LLH
-      Enc28j60Send(uip_buf, uip_len);
+  // Runs one stage of the sensor discovery and init. Without
+  // DEFERRED_SENSOR_INIT all stages are run at boot before the main loop.
+  // With DEFERRED_SENSOR_INIT the main loop runs one stage every
+  // SENSOR_INIT_INTERVAL ms after networking is up.
+  switch (stage) {
+#if DS18B20_SUPPORT == 1
+  case SENSOR_INIT_DS18B20:
+    init_DS18B20();          // Initialize DS18B20 sensors
+    // Initialize DS18B20 control variables used in main.c 
+    if (stored_config_settings & 0x08) {
+      // Find all devices
+      FindDevices();
+#if DS18B20_RESOLUTION != 12
+      // Set the conversion resolution in all devices
+      set_resolution();
+#endif // DS18B20_RESOLUTION != 12
+      // Iniialize DS18B20 timer
+      check_DS18B20_ctr = second_counter;
+      // Initialize DS18B20 sensor add/delete check counter
+      // Collect initial temperature
+      get_temperature();
+      // Iniialize DS18B20 transmit control variable
+      send_mqtt_temperature = -1; // Indicates nothing to send on MQTT yet.
+    }
+    break;
+#endif // DS18B20_SUPPORT == 1
+
+#if BME280_SUPPORT == 1
+  case SENSOR_INIT_BME280:
+    // Initialize the BME280
+    BME280_found = 0;
+//  send_mqtt_BME280 = -1; // Indicates nothing to send on MQTT yet.
+    send_mqtt_BME280 = 2; // Indicates we should send BME280 data as part of boot.
+    check_BME280_ctr = second_counter;
+#if BME280_NORMAL_MODE_SUPPORT == 1
+    read_BME280_ctr = second_counter;
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
+    rslt = bme280_init(&dev);
+    if (rslt == BME280_OK) {
+      BME280_found = 1;
+      if (stored_config_settings & 0x20) {
+        // If a BME280 sensor was found and the config_settings show the sensor
+        // is enabled then collect the sensor data. This measurement at startup
+        // is needed so that sensor data is available for display when the
+        // IOControl page is shown at boot time.
+#if BME280_NORMAL_MODE_SUPPORT == 1
+        start_sensor_normal_mode(&dev, &comp_data);
+#else // BME280_NORMAL_MODE_SUPPORT == 0
+        stream_sensor_data_forced_mode(&dev, &comp_data);
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
+      }
+    }
+    else {
+      // If BME_280 sensor was not found then then force the BME280 Enable bit off.
+      // This will help reduce confusion on the part of the user that may think
+      // they can enable BME280 support on the Config Page but they have not
+      // connected a BME280 sensor.
+      Pending_config_settings &= (uint8_t)(~0x20);
+      // Setting parse_complete will cause any change to the
+      // Pending_config_settings to update the EEPROM if needed. At boot
+      // parse_complete was already set during main variable initialization.
+      parse_complete = 1;
+#if RUNTIME_DIRTY_FLAGS == 1
+      runtime_dirty |= RUNTIME_CONFIG;
+#endif // RUNTIME_DIRTY_FLAGS == 1
     }
+    break;
+#endif // BME280_SUPPORT == 1
+
+#if INA226_SUPPORT == 1
+  case SENSOR_INIT_INA226:
+    // Initialize all INA226 devices
+    ina226_init_all();
+    //   Calibrate all INA226 devices
+    ina226_calibrate_all();
+    //   Configure all INA226 devices
+    ina226_configure_all();
+    break;
+#endif // INA226_SUPPORT == 1
   }
 }
 
 
-#if OB_EEPROM_SUPPORT == 1
-uint8_t off_board_EEPROM_detect(void)
+#if DEFERRED_SENSOR_INIT == 1
+uint16_t boot_elapsed(void)
 {
-  // Verify that an I2C EEPROM exists. This routine is directed at
-  // detecting a 256KB I2C EEPROM.
-  //
-  // Presence verification is performed by:
-  //   Reading the first byte of the I2C EEPROM, inverting the byte,
-  //   writing the inverted byte to the I2C EEPROM, and verifying that
-  //   the inversion occurred. If the inversion occurred then eeprom_detect is
-  //   set to 1 and the original byte is restored.
-  //
-  // If detection fails I2C EEPROM support is turned off.
-  
-  uint8_t eeprom_detect;
-  uint8_t byte;
-  
-  eeprom_detect = 0;
-    
-  // Make sure the I2C bus is in a sane condition.
-  I2C_reset();
-  wait_timer(1000); // Wait 1 ms
-  
-  // Read 1 byte from I2C EEPROM.
-  prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, I2C_EEPROM0_BASE, 2);
-  byte = I2C_read_byte(1);
-
-
-  // Write inverted byte to I2C EEPROM.
-  write_one((uint8_t)~byte);
-
+  // Returns the time since boot in ms for the boot time statistics. The
+  // ms_counter wraps after 65 seconds so later times are reported as 0xffff.
+  if (second_counter > 60) return 0xffff;
+  return ms_counter;
+}
+#endif // DEFERRED_SENSOR_INIT == 1
 
-  // Read and validate 1 byte from I2C EEPROM.
-  prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, I2C_EEPROM0_BASE, 2);
-   
-  if ((uint8_t)~byte == I2C_read_byte(1)) {
-    eeprom_detect = 1;
-  }
-  else {
-  }
-    
-  // Restore the original 1 byte to I2C EEPROM.
-  write_one(byte);
 
-  return eeprom_detect;
+#if LOOP_PROFILER == 1
+void loop_profile_init(void)
+{
+  uint8_t i;
+  
+  memset(profile, 0, sizeof(profile));
+  memset(profile_acc, 0, sizeof(profile_acc));
+  for (i = 0; i < PROFILE_PHASES; i++) profile[i].min = 0xffff;
+  profile_ran = 0;
+  profile_report_ctr = second_counter;
+  profile_last = profile_timestamp();
 }
-#endif // OB_EEPROM_SUPPORT == 1
 
 
-#if I2C_SUPPORT == 1
-void prep_read(uint8_t control_write, uint8_t control_read, uint16_t start_address, uint8_t addr_size)
+void loop_profile_mark(uint8_t phase)
 {
-  // Function to set up a read from I2C devices.
-  // control_write / control_read are the Control Bytes needed to address the
-  // I2C device.
-  // start_address identifies the address starting point in the I2C device.
-  // address_size indicates if the address is one byte or two bytes. 1 =
-  // single byte, 2 = two bytes.
-  //
-  // I2C EEPROM:
-  // When setting up a sequential read from the I2C EEPROMs the
-  // following applies:
-  //   control_write / control_read are the Control Bytes needed to address
-  //   the I2C EEPROM.
-  //   start_address identifies the address starting point in the I2C 
-  //   EEPROM and is typically the first (base) address of the region in the
-  //   I2C EEPROM, although it can also be a specific address offset
-  //   into the I2C EEPROM region. For example:
-  //     I2C EEPROM0 base address: 0x0000 using I2C EEPROM0 Control Bytes
-  //     I2C EEPROM1 base address: 0x8000 using I2C EEPROM1 Control Bytes
-  //     I2C EEPROM2 base address: 0x0000 using I2C EEPROM2 Control Bytes
-  //     I2C EEPROM3 base address: 0x8000 using I2C EEPROM3 Control Bytes
-  //   addr_size for I2C EEPROM access is always 2 bytes.
-  //
-  // BME280:
-  // When setting up a read from the BME280 device the address_size is always
-  // 1 byte.
-
-  // Initial write control byte to establish sequential read address
-  I2C_control(control_write);
-  I2C_byte_address(start_address, addr_size);
-  I2C_control(control_read);
+  // Adds the time since the previous mark to the given phase. The main
+  // loop places a mark at the end of each phase, and a PROFILE_OTHER mark
+  // ahead of any phase that doesn't directly follow another mark.
+  uint16_t now;
+  
+  now = profile_timestamp();
+  profile_acc[phase] = (uint16_t)(profile_acc[phase] + (uint16_t)(now - profile_last));
+  profile_last = now;
+  profile_ran |= (uint8_t)(1 << phase);
 }
-#endif // I2C_SUPPORT == 1
 
 
-#if OB_EEPROM_SUPPORT == 1
-void write_one(uint8_t byte)
+static void loop_profile_record(uint8_t phase, uint16_t ticks)
 {
-  // Function to write one byte to the I2C EEPROM
-  // This is only used for the I2C EEPROM detection routine, thus only
-  // uses I2C EEPROM address 0x0000
-  I2C_control(I2C_EEPROM0_WRITE);
-  I2C_byte_address(0x0000, 2);
-  I2C_write_byte(byte);
-  I2C_stop();
-  wait_timer(5000); // Wait 5ms
+  // Updates the min / max and histogram for the phase. The histogram
+  // buckets increase by a factor of 4 (two log2 steps):
+  //   b0 < 40us, b1 < 160us, b2 < 640us, b3 < 2.56ms, b4 < 10.24ms,
+  //   b5 < 40.96ms, b6 < 163.84ms, b7 longer
+  uint8_t b;
+  uint16_t limit;
+  
+  if (ticks < profile[phase].min) profile[phase].min = ticks;
+  if (ticks > profile[phase].max) profile[phase].max = ticks;
+  
+  b = 0;
+  limit = 4;
+  while ((b < (PROFILE_BUCKETS - 1)) && (ticks >= limit)) {
+    b++;
+    limit = (uint16_t)(limit << 2);
+  }
+  if (profile[phase].bucket[b] != 0xffff) profile[phase].bucket[b]++;
 }
-#endif // OB_EEPROM_SUPPORT == 1
 
 
-#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
-void copy_code_uploader_to_EEPROM1(void)
+void loop_profile_loop(void)
 {
-  // This function copies a Code Uploader build to I2C EEPROM1.
-  // The entire Flash is copied up to but not including the IO_TIMERS and
-  // IO_NAMES area of memory.
+  // Called at the top of the main loop. Records the phase times collected
+  // during the previous pass, plus the time of the whole pass.
   uint8_t i;
-  uint16_t address_index;
-  uint8_t I2C_last_flag;
-  uint8_t temp_byte;
-
-  flash_ptr = (char *)FLASH_START_PROGRAM_MEMORY;
-  address_index = I2C_EEPROM1_BASE;
+  uint16_t total;
   
-  I2C_reset();
-  wait_timer(1000); // Wait 1 ms
+  loop_profile_mark(PROFILE_OTHER);
   
-  while (address_index < FLASH_START_USER_RESERVE) {
-    // Note for "while" statement: address_index will be incremented by 128
-    // with each loop.
-    I2C_control(I2C_EEPROM1_WRITE); // Send Write Control Byte for upper
-                                    // I2C EEPROM area
-    I2C_byte_address(address_index, 2);
-    for (i=0; i<128; i++) {
-      I2C_write_byte(*flash_ptr);
-      flash_ptr++;
+  total = 0;
+  for (i = 0; i < PROFILE_LOOP; i++) {
+    if (profile_ran & (uint8_t)(1 << i)) {
+      loop_profile_record(i, profile_acc[i]);
+      total = (uint16_t)(total + profile_acc[i]);
     }
-    I2C_stop();
-    wait_timer(5000); // Wait 5ms
-    address_index += 128;
-    IWDG_KR = 0xaa; // Prevent the IWDG hardware watchdog from firing.
+    profile_acc[i] = 0;
+  }
+  loop_profile_record(PROFILE_LOOP, total);
+  profile_ran = 0;
+  
+#if DEBUG_SUPPORT == 15
+  if (second_counter > (profile_report_ctr + 30)) {
+    profile_report_ctr = second_counter;
+    loop_profile_report();
+    // Don't charge the UART output time to the next loop pass
+    profile_last = profile_timestamp();
   }
+#endif // DEBUG_SUPPORT == 15
 }
-#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 
-#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
-#if OB_EEPROM_SUPPORT == 1
-void copy_flash_to_EEPROM0(void)
+void loop_profile_report(void)
 {
-  // This function copies a Browser Only or MQTT build to I2C EEPROM0.
-  // The entire Flash is copied up to but not including the IO_TIMERS and
-  // IO_NAMES area of memory.
-  // The function should only be called to cover the case where the user has
-  // the I2C EEPROM installed but has updated the Runtime firmware via
-  // the SWIM interface.
+  // Outputs the profile over the UART, one line per phase:
+  //   name min max b0 b1 b2 b3 b4 b5 b6 b7
+  // min and max are in 10us units.
+#if DEBUG_SUPPORT == 15
+  static const char phase_name[PROFILE_PHASES][6] = {
+    "RECV ", "UIP  ", "MQTT ", "PERI ", "RUNT ", "SENS ", "OTHER", "LOOP " };
   uint8_t i;
-  uint16_t address_index;
-  uint8_t I2C_last_flag;
-  uint8_t temp_byte;
-
-  flash_ptr = (char *)FLASH_START_PROGRAM_MEMORY;
-  address_index = I2C_EEPROM0_BASE;
-  I2C_reset();
-  wait_timer(1000); // Wait 1 ms
+  uint8_t j;
   
-  while (address_index < OFFSET_TO_FLASH_START_USER_RESERVE) {
-    I2C_control(I2C_EEPROM0_WRITE);
-    I2C_byte_address(address_index, 2);
-    for (i=0; i<128; i++) {
-      I2C_write_byte(*flash_ptr);
-      flash_ptr++;
+  UARTPrintf("\r\nLoop profile (10us units) min max b0-b7\r\n");
+  for (i = 0; i < PROFILE_PHASES; i++) {
+    UARTPrintf((char *)phase_name[i]);
+    UARTPrintf(" ");
+    emb_itoa(profile[i].min, OctetArray, 10, 5);
+    UARTPrintf(OctetArray);
+    UARTPrintf(" ");
+    emb_itoa(profile[i].max, OctetArray, 10, 5);
+    UARTPrintf(OctetArray);
+    for (j = 0; j < PROFILE_BUCKETS; j++) {
+      UARTPrintf(" ");
+      emb_itoa(profile[i].bucket[j], OctetArray, 10, 5);
+      UARTPrintf(OctetArray);
     }
-    I2C_stop();
-    wait_timer(5000); // Wait 5 ms
-    address_index += 128;
-    IWDG_KR = 0xaa; // Prevent the IWDG hardware watchdog from firing.
+    UARTPrintf("\r\n");
   }
+#endif // DEBUG_SUPPORT == 15
 }
-#endif // OB_EEPROM_SUPPORT == 1
-#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#endif // LOOP_PROFILER == 1
 
 
-// IP Address and MAC Address notes:
-// The ENC28J60 device does not use the Network Module IP Address. The
-// ENC28J60 communicates with the Ethernet using only the MAC address (known
-// in the uIP as "ethernet address"). The IP Address is used only within the
-// IP packets.
-//
-// Note that the ENC28J60 must be told what the MAC Network Module address
-// is. But the ENC28J60 only uses the MAC address for receive filtering. The
-// application (not the ENC28J60) must insert the MAC address as needed in
-// any packets for transmission. This occurs in the uip.c and uip_arp.c
-// functions.
-//
-// The application has hardcoded "factory defaults" for the IP Address,
-// Gateway Address, Netmask, Port number, and MAC Address. The user is able
-// to change any of these and the changes are stored in EEPROM. Thereafter
-// the software uses the addresses from the EEPROM at power on so that user
-// inputs are retained through power cycles.
-//
-// The user can press the Reset Button for 5 seconds to restore "factory
-// defaults".
+#if INPUT_PASS_STATISTICS == 1
+static void timed_read_input_pins(void)
+{
+  // Runs the input pass of check_runtime_changes() and keeps the shortest
+  // and longest time it took. TIM3 counts at 1MHz (16 CPU cycles) and is
+  // left running by wait_timer(), so the difference of two reads is the
+  // time in us. The longest time includes any interrupts taken during the
+  // pass, the shortest is the cost of the pass itself.
+  uint16_t start;
+  uint16_t elapsed;
+  
+  start = ((uint16_t)TIM3_CNTRH << 8) | (uint8_t)TIM3_CNTRL;
+  read_input_pins(0);
+  elapsed = (uint16_t)((((uint16_t)TIM3_CNTRH << 8) | (uint8_t)TIM3_CNTRL) - start);
+  if (elapsed < input_pass_min) input_pass_min = elapsed;
+  if (elapsed > input_pass_max) input_pass_max = elapsed;
+}
+#endif // INPUT_PASS_STATISTICS == 1
 
 
-#if BUILD_SUPPORT == MQTT_BUILD
-void mqtt_startup(void)
+#if HTTP_PACING == 1
+void pacing_init(void)
 {
-  uint8_t i;
-  char client_id_text[26]; // Client ID comprised of text
-                           // "NetworkModule" (13 bytes) and
-			   // MAC (12 bytes) and
-			   // terminator (1 byte)
-			   // for a total of 26 bytes.
-  unsigned char topic_base[55]; // Used for building connect, subscribe,
-                                // and publish topic strings.
-				// Publish string content:
-                                //  NetworkModule/DeviceName123456789/input/xx
-                                //  NetworkModule/DeviceName123456789/output/xx
-                                //  NetworkModule/DeviceName123456789/temp/xxxxxxxxxxxx
-                                //  NetworkModule/DeviceName123456789/temp/BME280-0xxxx
-                                //  NetworkModule/DeviceName123456789/state
-                                //  NetworkModule/DeviceName123456789/state24
-				//  NetworkModule/DeviceName123456789/state-req
-				//  NetworkModule/DeviceName123456789/state-req24
-				// Subscribe string content:
-                                //  NetworkModule/DeviceName123456789/output/+/set
-				//  NetworkModule/DeviceName123456789/state-req
-				//  NetworkModule/DeviceName123456789/state-req24
-				// Last Will string content:
-				//  NetworkModule/DeviceName123456789/availability
-				// Home Assistant config string content:
-				//  homeassistant/switch/macaddressxx/xx/config
-				//  homeassistant/binary_sensor/macaddressxx/xx/config
-				//  homeassistant/sensor/macaddressxx/yyyyyyyyyyyy/config
-				//  homeassistant/sensor/macaddressxx/BME280-0xxxx/config
-				//  homeassistant/sensor/macaddressxx/BME280-1xxxx/config
-				//  homeassistant/sensor/macaddressxx/BME280-2xxxx/config
+  // Clears the queueing delay counters
+  memset(pacing, 0, sizeof(pacing));
+  pacing_window_start = ms_counter;
+  pacing_http_us = 0;
+}
 
-  i = 0;
-  // This function walks through the steps needed to get MQTT initialized and
-  // a connection made to the MQTT Server and Broker
-  // - These steps are run only once at code start, or when restarting the
-  //   client.
-  // - These steps cannot be run until the user has entered the MQTT settings
-  //   in the GUI. The MQTT steps do the following:
-  //   - Verifies that the user has provided a MQTT Server IP Address
-  //   - Requests a TCP Connection with the MQTT Server. This process will
-  //     also perform an ARP request with the MQTT server. Both requests
-  //     occur via the uip_connect() function, and are executed via the
-  //     uip_periodic function.
-  //   - Verifies that the ARP request succeeded.
-  //   - Verifies that the TCP connection request suceeded.
-  //   - Initializes communication with the MQTT Broker.
-  // - Once the above is completed the Home Assistant Auto Discovery messages
-  //   are published (if Home Assistnat Auto Discovery is enabled).
 
-  switch(mqtt_start)
-  {
-  case MQTT_START_TCP_CONNECT:
-    // When first powering up or on a reboot we need to initialize the MQTT
-    // processes.
-    //
-    // The first step is to create a TCP Connection Request to the MQTT
-    // Server. This is done with uip_connect(). uip_connect() doesn't
-    // actually send anything - it just queues the SYN to be sent. The
-    // connection request will actually be sent when uip_periodic is called.
-    // uip_periodic will determine that the connection request is queued,
-    // will perform an ARP request to determine the MAC of the MQTT server,
-    // and will then send the SYN to start the connection process.
-    //
-    // This is the uip_connect() call when the code used the same MQTT port
-    // number for the host port and the local port. This appeared to be
-    // causing problems when reboots occurred, particularly if multiple
-    // Reboot or Save calls were needed for MQTT settings.
-    //    mqtt_conn = uip_connect(&uip_mqttserveraddr, Port_Mqttd, Port_Mqttd);
-    
-    // Following is a fix applied to perform a rotation through multiple
-    // port numbers for the MQTT local port:
-    // This is the only place that uip_connect() is called.
-    // uip_connect(uip_ipaddr_t *ripaddr, uint16_t rport, uint16_t lport)
-    // Here the local port is rotated with each boot to avoid the TIME_WAIT
-    // process in the MQTT server that can delay a TCP reconnect by up to
-    // 4 minutes (typically 2 minutes in Windows and 1 minute in Linux). This
-    // rotation is transparent to users but important for Developers to be
-    // aware of. The local MQTT port numbers are all from the IANA unreserved
-    // range of ports. There could still be in a conflict in the network with
-    // some other application using a selected port number. If that happens
-    // an MQTT error should result (detected in mqtt_sanity_check()), which in
-    // turn should cause a restart of the MQTT functions and selection of a
-    // new alternate port.
-    // The IANA non-reserved (aka Dynamic or Private) port rande is 49152 -
-    // 65535. Any port in this range should be useable for this application,
-    // but it may make some sense to select ports that have some distance
-    // between them to avoid encountering some other application that utilizes
-    // a cluster of ports. The selections made here are arbitraty and can be
-    // changed in the future as needed.
-    // Use the stored_rotation_ptr to select a local MQTT port.
-    {
-      mqtt_local_port = 49193;
-      switch (stored_rotation_ptr)
-      {
-	case 0: mqtt_local_port = ALTERNATE_PORT00; break;
-	case 1: mqtt_local_port = ALTERNATE_PORT01; break;
-	case 2: mqtt_local_port = ALTERNATE_PORT02; break;
-	case 3: mqtt_local_port = ALTERNATE_PORT03; break;
-	case 4: mqtt_local_port = ALTERNATE_PORT04; break;
-      }
-      mqtt_conn = uip_connect(&uip_mqttserveraddr, Port_Mqttd, mqtt_local_port);
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("mqtt_local_port = ");
-// emb_itoa(mqtt_local_port, OctetArray, 10, 5);
-// UARTPrintf(OctetArray);
-// UARTPrintf("\r\n");
-#endif // DEBUG_SUPPORT == 15
-    }
+void pacing_record(uint8_t queue, uint16_t ms)
+{
+  // Adds a queueing delay to the counters of the traffic class
+  struct pacing_queue *pQueue;
+  
+  pQueue = &pacing[queue];
+  if (ms > pQueue->max) pQueue->max = ms;
+  pQueue->sum += ms;
+  pQueue->count++;
+  if (pQueue->count == 0xffff) {
+    // Keep the average valid by halving the totals
+    pQueue->count >>= 1;
+    pQueue->sum >>= 1;
+  }
+}
 
-    if (mqtt_conn != NULL) {
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Good mqtt_conn status\r\n");
-#endif // DEBUG_SUPPORT == 15
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      verify_count = 0; // Clear the ARP verify count
-      mqtt_start_status = MQTT_START_CONNECTIONS_GOOD;
-      mqtt_start = MQTT_START_VERIFY_ARP;
-    }
-    else {
-      mqtt_start_status |= MQTT_START_CONNECTIONS_ERROR;
-    }
-    break;
-      
-  case MQTT_START_VERIFY_ARP:
-    if (mqtt_start_ctr1 > 6) {
-      // mqtt_start_ctr1 causes us to wait 300ms before checking to see if the
-      // ARP request completed.
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      verify_count++; // Increment the ARP verify count
 
-      // ARP Request and TCP Connection request were sent to the MQTT Server
-      // as a result of the uip_connect() in the prior step. Now we loop and
-      // check that the ARP request was successful.
-      if (check_mqtt_server_arp_entry()) {
-        // ARP Reply received
-        mqtt_start_ctr1 = 0; // Clear 50ms counter
-	verify_count = 0;
-        mqtt_start_status |= MQTT_START_ARP_REQUEST_GOOD;
-        mqtt_start = MQTT_START_VERIFY_TCP;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("MQTT ARP Verified\r\n");
-#endif // DEBUG_SUPPORT == 15
-      }
-      if (verify_count > 50) {
-        // mqtt_start_ctr1 allows us to wait up to 15 seconds for the ARP
-        // Reply. If timeout occurs we probably have an error in the MQTT
-        // Server IP Address or there is a network problem. If we timeout
-        // we start over and retry the ARP request.
-        mqtt_start = MQTT_START_TCP_CONNECT;
-        // Clear the error indicator flags
-        mqtt_start_status = MQTT_START_NOT_STARTED;
-      }
-    }
-    break;
+uint8_t http_pacing_hold(void)
+{
+  // Called by HttpDCall() before the next segment of a web page is built.
+  // Returns 1 if the segment has to wait:
+  // - The MQTT connection has messages in the mqtt_sendbuf that are not
+  //   sent yet. periodic_service() polls the MQTT connection first, so
+  //   they go out before the held segment.
+  // - HTTP has used its HTTP_PACING_SHARE of the current PACING_WINDOW
+  //   building segments. The rest of the window is left to the main loop.
+  // HttpDCall() sends the segment anyway once it has waited
+  // PACING_MAX_HOLD ms.
+  if ((uint16_t)(ms_counter - pacing_window_start) >= PACING_WINDOW) {
+    pacing_window_start = ms_counter;
+    pacing_http_us = 0;
+  }
+  if (mqtt_conn != NULL
+   && (mqtt_conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+   && mqtt_send_pending(&mqttclient)) return 1;
+#if HTTP_PACING_SHARE < 100
+  if (pacing_http_us >= (uint32_t)HTTP_PACING_SHARE * (PACING_WINDOW * 10)) return 1;
+#endif // HTTP_PACING_SHARE < 100
+  return 0;
+}
 
-  case MQTT_START_VERIFY_TCP:
-    if (mqtt_start_ctr1 > 6) {
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      verify_count++; // Increment the TCP verify count every 300ms
 
-      // Loop to make sure the TCP connection request was successful. We're
-      // waiting for the SYNACK/ACK process to complete (checking each 300ms).
-      // uip_periodic() runs frequently (each time the periodic_timer expires).
-      // When uip_periodic() runs it calls the uip_process() to receive the
-      // SYNACK and then send the ACK. We will know the ACK was sent when we
-      // see the UIP_ESTABLISHED state for the mqtt connection.
-      
-      if ((mqtt_conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
-        mqtt_start_ctr1 = 0; // Clear 50ms counter
-        mqtt_start_status |= MQTT_START_TCP_CONNECT_GOOD;
-        mqtt_start = MQTT_START_MQTT_INIT;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("MQTT TCP Verified\r\n");
-#endif // DEBUG_SUPPORT == 15
-      }
-      if (verify_count > 166) { // 50 seconds.
-        // This needs to be longer than the RTO timeout in the uip.c code
-	// which is initially 3 seconds but can gradually increase to 48
-	// seconds before a connection abort occurs.
-        // If the connection does not complete we probably have a network
-	// problem.  Try again with a new uip_connect().
-        mqtt_start = MQTT_START_TCP_CONNECT;
-        // Clear the error indicator flags
-        mqtt_start_status = MQTT_START_NOT_STARTED;
-      }
-    }
-    break;
+void http_pacing_spent(uint32_t us)
+{
+  // Adds the time taken to build an HTTP segment to the current window
+  pacing_http_us += us;
+}
+#endif // HTTP_PACING == 1
 
 
-#if HOME_ASSISTANT_SUPPORT == 1
-  case MQTT_START_MQTT_INIT:
-    if (mqtt_start_ctr1 > 4) {
-      // Initialize mqtt client
-      mqtt_init(&mqttclient,
-                mqtt_sendbuf,
-                sizeof(mqtt_sendbuf),
-                &uip_buf[MQTT_PBUF],
-		MQTT_PBUF_SIZE,
-                publish_callback);
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      mqtt_start = MQTT_START_QUEUE_CONNECT;
-    }
-    break;
-#endif // HOME_ASSISTANT_SUPPORT == 1
+#if PUBLISH_LATENCY_STATS == 1
+void latency_init(void)
+{
+  // Clears the input change to PUBLISH latency statistics
+  uint8_t i;
+  
+  memset(latency, 0, sizeof(latency));
+  for (i = 0; i < LATENCY_STAGES; i++) latency[i].min = 0xffff;
+  latency_state = LATENCY_IDLE;
+}
 
 
-#if DOMOTICZ_SUPPORT == 1
-  case MQTT_START_MQTT_INIT:
-    if (mqtt_start_ctr1 > 4) {
-      // Initialize mqtt client
-      mqtt_init(&mqttclient,
-                mqtt_sendbuf,
-                sizeof(mqtt_sendbuf),
-                &uip_buf[UIP_IPTCPH_LEN + UIP_LLH_LEN],
-                UIP_APPDATA_SIZE,
-                publish_callback);
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      mqtt_start = MQTT_START_QUEUE_CONNECT;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("\r\n");
-// UARTPrintf("Sent mqtt_init\r\n");
-#endif // DEBUG_SUPPORT == 15
-    }
-    break;
-#endif // DOMOTICZ_SUPPORT == 1
+static void latency_record(uint8_t stage, uint16_t ms)
+{
+  // Updates the min / max / sum and histogram for the stage. The histogram
+  // buckets increase by a factor of 4:
+  //   b0 < 4ms, b1 < 16ms, b2 < 64ms, b3 < 256ms, b4 < 1.024s,
+  //   b5 < 4.096s, b6 < 16.384s, b7 longer
+  // Buckets stop counting at 9999 so they fit the 4 digit display.
+  uint8_t b;
+  uint16_t limit;
+  
+  if (ms < latency[stage].min) latency[stage].min = ms;
+  if (ms > latency[stage].max) latency[stage].max = ms;
+  latency[stage].sum += ms;
+  latency[stage].count++;
+  
+  b = 0;
+  limit = 4;
+  while ((b < (LATENCY_BUCKETS - 1)) && (ms >= limit)) {
+    b++;
+    limit = (uint16_t)(limit << 2);
+  }
+  if (latency[stage].bucket[b] < 9999) latency[stage].bucket[b]++;
+  
+  if (latency[stage].count == 0xffff) {
+    // Keep the average valid by halving the totals
+    latency[stage].count >>= 1;
+    latency[stage].sum >>= 1;
+  }
+}
 
 
-  case MQTT_START_QUEUE_CONNECT:
-    if (mqtt_start_ctr1 > 4) {
-      // ARP Reply received from the MQTT Server and TCP Connection
-      // established.
-      // We should now be able to message the MQTT Broker, but will wait
-      // 200ms to give some start time.
+void latency_detect(uint32_t changed)
+{
+  // Called with the Input pins that read_input_pins() just found changed
+  // (after debounce). If no change is being timed the lowest changed pin
+  // starts a new measurement.
+  if (latency_state != LATENCY_IDLE || changed == 0) return;
+  latency_mask = changed & (~changed + 1);
+  latency_detected = ms_counter;
+  latency_state = LATENCY_DETECTED;
+}
 
-      // Queue the mqtt_connect message for transmission to the MQTT Broker. 
-      // The mqtt_connect function will create the message and put it in the
-      // mqtt_sendbuf queue.
-      // uip_periodic() will start the process that will call mqtt_sync to
-      // copy the message from the mqtt_sendbuf to the uip_buf.
-  
-      // Create client_id with devicetype and MAC address
-      strcpy(client_id_text, devicetype);
-      // Remove trailing / in devicetype
-      client_id_text[strlen(client_id_text) - 1] = '\0';
-      // Add MAC number
-      strcat(client_id_text, mac_string);
-      client_id = client_id_text;
-  
-      // Ensure we have a clean session
-      connect_flags = MQTT_CONNECT_CLEAN_SESSION;
- 
-      // Create will_topic
-      strcpy(topic_base, devicetype);
-      strcat(topic_base, stored_devicename);
-      strcat(topic_base, "/availability");
 
-      // When a CONNECT is sent to the broker it should respond with a
-      // CONNACK.
-      connack_received = 0;
-      
-      // Queue the message
-      mqtt_connect(&mqttclient,
-                   client_id,              // Based on MAC address
-                   topic_base,             // Will topic
-                   "offline",              // Will message 
-                   7,                      // Will message size
-                   stored_mqtt_username,   // Username
-                   stored_mqtt_password,   // Password
-                   connect_flags,          // Connect flags
-                   mqtt_keep_alive);       // Ping interval
-     
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      mqtt_start = MQTT_START_VERIFY_CONNACK;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("\r\n");
-// UARTPrintf("Sent mqtt_connect\r\n");
-#endif // DEBUG_SUPPORT == 15
-    }
-    break;
+void latency_queued(uint32_t pins)
+{
+  // Called when publish_outbound() queues a PUBLISH for the given pins.
+  // Ends the LATENCY_SCHEDULE stage if the timed pin is one of them.
+  if (latency_state != LATENCY_DETECTED || (pins & latency_mask) == 0) return;
+  latency_queued_at = ms_counter;
+  latency_record(LATENCY_SCHEDULE, (uint16_t)(latency_queued_at - latency_detected));
+  latency_state = LATENCY_QUEUED;
+}
 
-  case MQTT_START_VERIFY_CONNACK:
-    // Verify that the CONNECT CONNACK was received.
-    // When a CONNECT is sent to the broker it should respond with a CONNACK.
-    // The CONNACK will occur very quickly but we will allow up to 10 seconds
-    // before assuming an error has occurred.
-    // A workaround is implemented with the global variable connack_received so
-    // that the mqtt.c code can tell the main.c code that the CONNECT CONNACK
-    // was received.
 
-    if (mqtt_start_ctr1 < 200) {
-      // Allow up to 10 seconds for CONNACK
-      if (connack_received) {
-        mqtt_start_ctr1 = 0; // Clear 50ms counter
-        mqtt_start_status |= MQTT_START_MQTT_CONNECT_GOOD;
-        mqtt_start = MQTT_START_QUEUE_SUBSCRIBE1;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("\r\n");
-// UARTPrintf("connack_received\r\n");
-#endif // DEBUG_SUPPORT == 15
-      }
-    }
-    else {
-      mqtt_start = MQTT_START_TCP_CONNECT;
-      // Clear the error indicator flags
-      mqtt_start_status = MQTT_START_NOT_STARTED;
-    }
-    break;
+void latency_sent(void)
+{
+  // Called when mqtt_send() has copied a PUBLISH to the uip_buf. The first
+  // PUBLISH sent after the timed one was queued ends the measurement. With
+  // MQTT_PUBLISH_BATCH that may be a PUBLISH queued just ahead of it.
+  if (latency_state != LATENCY_QUEUED) return;
+  latency_record(LATENCY_SEND, (uint16_t)(ms_counter - latency_queued_at));
+  latency_record(LATENCY_TOTAL, (uint16_t)(ms_counter - latency_detected));
+  latency_state = LATENCY_IDLE;
+}
+#endif // PUBLISH_LATENCY_STATS == 1
 
 
-#if HOME_ASSISTANT_SUPPORT == 1
-  case MQTT_START_QUEUE_SUBSCRIBE1:
-  case MQTT_START_QUEUE_SUBSCRIBE2:
-  case MQTT_START_QUEUE_SUBSCRIBE3:
-    if (mqtt_start_ctr1 > 4) {
-      // Queue the mqtt_subscribe messages for transmission to the MQTT
-      // Broker.
-      // Wait 200ms before queueing first Subscribe msg.
-      //
-      // The mqtt_subscribe function will create the message and put it in
-      // the mqtt_sendbuf queue. uip_periodic() will start the process that
-      // will call mqtt_sync to transfer the message from the mqtt_sendbuf
-      // to the uip_buf.
-      //
-      // Note: Timing is managed here to prevent placing multiple SUBSCRIBE
-      // messages in the mqtt_sendbuf as that buffer is very small.
-      //
-      // SUBSCRIBE is run three times:
-      //   case MQTT_START_QUEUE_SUBSCRIBE1:
-      //   Subscribe to the output control messages
-      //
-      //   case MQTT_START_QUEUE_SUBSCRIBE2:
-      //   Subscribe to the state-req messages
-      //
-      //   case MQTT_START_QUEUE_SUBSCRIBE3:
-      //   Subscribe to the state-req24 messages
-      //
-	
-      suback_received = 0;
-      strcpy(topic_base, devicetype);
-      strcat(topic_base, stored_devicename);
-      
-      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE1) strcat(topic_base, "/output/+/set");
-      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE2) strcat(topic_base, "/state-req");
-      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE3) strcat(topic_base, "/state-req24");
-      
-      // In the mqtt_subscribe call the maximum QOS level spedified (0 in this
-      // case) is the max QOS level supported for the topic messages being
-      // subcribed to. The SUBSCRIBE itself has no QOS level as a special
-      // SUBACK message must be returned to verify the SUBSCRIBE transaction.
-      mqtt_subscribe(&mqttclient, topic_base, 0);
-      mqtt_start_ctr1 = 0; // Clear 50ms counter
-      
-      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE1) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE1;
-      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE2) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE2;
-      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE3) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE3;
+#if TRACE_RING_SUPPORT == 1
+static uint16_t trace_slot_address(uint16_t seq)
+{
+  return (uint16_t)(I2C_EEPROM3_BASE + ((seq & (TRACE_SLOTS - 1)) * TRACE_CHUNK_SIZE));
+}
+
+
+static uint8_t trace_slot_holds(uint16_t seq)
+{
+  // Returns 1 if the EEPROM3 slot for seq holds the chunk with that
+  // sequence number.
+  uint8_t header[4];
+  
+  prep_read(I2C_EEPROM3_WRITE, I2C_EEPROM3_READ, trace_slot_address(seq), 2);
+  header[0] = I2C_read_byte(0);
+  header[1] = I2C_read_byte(0);
+  header[2] = I2C_read_byte(0);
+  header[3] = I2C_read_byte(1);
+  if (header[3] == TRACE_MARKER
+   && header[0] == (uint8_t)(seq >> 8)
+   && header[1] == (uint8_t)seq) return 1;
+  return 0;
+}
+
+
+void trace_init(void)
+{
+  // Finds where the trace in EEPROM3 ends so that the trace from before
+  // this boot is kept. Slot n only ever holds sequence numbers equal to n
+  // modulo TRACE_SLOTS, so from the chunk in slot 0 the slots written
+  // since it form a run that a binary search can find in 9 reads.
+  uint16_t seq0;
+  uint16_t lo;
+  uint16_t hi;
+  uint16_t mid;
+  
+  if (eeprom_detect == 0) return;
+  
+  prep_read(I2C_EEPROM3_WRITE, I2C_EEPROM3_READ, I2C_EEPROM3_BASE, 2);
+  seq0 = (uint16_t)(I2C_read_byte(0) << 8);
+  seq0 |= I2C_read_byte(0);
+  I2C_read_byte(0);
+  if (I2C_read_byte(1) != TRACE_MARKER || (seq0 & (TRACE_SLOTS - 1)) != 0) {
+    // No trace yet
+    trace_seq = 0;
+  }
+  else {
+    lo = 0;
+    hi = TRACE_SLOTS;
+    while (hi - lo > 1) {
+      mid = (uint16_t)((lo + hi) >> 1);
+      if (trace_slot_holds((uint16_t)(seq0 + mid))) lo = mid;
+      else hi = mid;
     }
-    break;
+    trace_seq = (uint16_t)(seq0 + lo + 1);
+  }
+  
+  trace_ready = 1;
+  trace_write_sec = (uint16_t)second_counter;
+  trace_event(TRACE_BOOT, trace_rst_sr, 0);
+}
 
 
-  case MQTT_START_VERIFY_SUBSCRIBE1:
-  case MQTT_START_VERIFY_SUBSCRIBE2:
-  case MQTT_START_VERIFY_SUBSCRIBE3:
-    // Verify that the SUBSCRIBE SUBACK was received.
-    // When a SUBSCRIBE is sent to the broker it should respond with a SUBACK.
-    // The SUBACK will occur very quickly but we will allow up to 10 seconds
-    // before assuming an error has occurred.
-    // A workaround is implemented with the global variable suback_received so
-    // that the mqtt.c code can tell the main.c code that the SUBSCRIBE SUBACK
-    // was received.
-    //
-    // VERIFY_SUBSCRIBE is run three times
+void trace_event(uint8_t event, uint8_t arg, uint16_t value)
+{
+  // Adds an event to trace_chunk. If the chunk is full and has not been
+  // written yet the event is dropped.
+  uint8_t *p;
+  uint16_t offset;
+  
+  if (trace_ready == 0) return;
+  if (trace_count == TRACE_ENTRIES) {
+    trace_dropped = 1;
+    return;
+  }
+  
+  if (trace_count == 0) {
+    trace_base = second_counter;
+    trace_chunk[4] = (uint8_t)(second_counter >> 24);
+    trace_chunk[5] = (uint8_t)(second_counter >> 16);
+    trace_chunk[6] = (uint8_t)(second_counter >> 8);
+    trace_chunk[7] = (uint8_t)second_counter;
+    trace_chunk[8] = (uint8_t)(ms_counter >> 8);
+    trace_chunk[9] = (uint8_t)ms_counter;
+  }
+  offset = (uint16_t)(ms_counter - ((trace_chunk[8] << 8) | trace_chunk[9]));
+  
+  p = &trace_chunk[TRACE_HEADER_SIZE + (trace_count * TRACE_ENTRY_SIZE)];
+  p[0] = (uint8_t)(offset >> 8);
+  p[1] = (uint8_t)offset;
+  p[2] = event;
+  p[3] = arg;
+  p[4] = (uint8_t)(value >> 8);
+  p[5] = (uint8_t)value;
+  trace_count++;
+}
 
-    if (mqtt_start_ctr1 < 200) {
-      // Allow up to 10 seconds for SUBACK
-      if (suback_received == 1) {
-        mqtt_start_ctr1 = 0; // Clear 50ms counter
-        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE1) mqtt_start = MQTT_START_QUEUE_SUBSCRIBE2;
-        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE2) mqtt_start = MQTT_START_QUEUE_SUBSCRIBE3;
-        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE3) {
-          if (stored_config_settings & 0x02) {
-            // Home Assistant Auto Discovery enabled
-            mqtt_start = MQTT_START_QUEUE_PUBLISH_AUTO;
-            auto_discovery = DEFINE_INPUTS;
-            auto_discovery_step = SEND_OUTPUT_DELETE;
-            pin_ptr = 1;
-            sensor_number = 0;
-          }
-          else {
-            mqtt_start_ctr1 = 0; // Clear 50ms counter
-            mqtt_start = MQTT_START_QUEUE_PUBLISH_ON;
-          }
-	}
-      }
+
+void trace_frame(uint8_t event, uint8_t *pBuffer, uint16_t nBytes)
+{
+  // Adds a TRACE_RX or TRACE_TX event for the Ethernet frame in pBuffer.
+  // The argument is the IP protocol, or for TCP 0x80 with the TCP flags.
+  // ARP frames have argument 0.
+  uint8_t arg;
+  
+  arg = 0;
+  if (pBuffer[12] == 0x08 && pBuffer[13] == 0x00) {
+    arg = pBuffer[23];
+    if (arg == UIP_PROTO_TCP) {
+      arg = (uint8_t)(0x80 | (pBuffer[14 + ((pBuffer[14] & 0x0f) << 2) + 13] & 0x3f));
     }
-    else {
-      mqtt_start = MQTT_START_TCP_CONNECT;
-      // Clear the error indicator flags
-      mqtt_start_status = MQTT_START_NOT_STARTED; 
+  }
+  trace_event(event, arg, nBytes);
+}
+
+
+void trace_tcp_states(void)
+{
+  // Adds a TRACE_TCP event for each connection whose state changed since
+  // the last call. This is called after each uip_input() and uip_periodic()
+  // as those are where uIP changes the connection states.
+  uint8_t i;
+  uint8_t state;
+  
+  for (i = 0; i < UIP_CONNS; i++) {
+    state = (uint8_t)(uip_conns[i].tcpstateflags & UIP_TS_MASK);
+    if (state != trace_tcp[i]) {
+      trace_tcp[i] = state;
+      trace_event(TRACE_TCP, (uint8_t)((i << 4) | state), HTONS(uip_conns[i].lport));
     }
-    break;
-#endif // HOME_ASSISTANT_SUPPORT == 1
+  }
+}
+
+
+static void trace_write(uint8_t close)
+{
+  // Writes trace_chunk to its EEPROM3 slot if it has entries not yet
+  // written. A slot is half of an I2C EEPROM page so it is written in one
+  // page write. If close is set the next chunk is started.
+  uint8_t i;
+  
+  if (trace_count != trace_written) {
+    trace_chunk[0] = (uint8_t)(trace_seq >> 8);
+    trace_chunk[1] = (uint8_t)trace_seq;
+    trace_chunk[2] = trace_count;
+    if (trace_dropped) trace_chunk[2] |= 0x80;
+    trace_chunk[3] = TRACE_MARKER;
+    
+    I2C_control(I2C_EEPROM3_WRITE);
+    I2C_byte_address(trace_slot_address(trace_seq), 2);
+    for (i = 0; i < TRACE_CHUNK_SIZE; i++) I2C_write_byte(trace_chunk[i]);
+    I2C_stop();
+#if I2C_EEPROM_FAST_COPY == 1
+    eeprom_write_wait(I2C_EEPROM3_WRITE);
+#else // I2C_EEPROM_FAST_COPY == 0
+    wait_timer(5000); // Wait 5ms
+#endif // I2C_EEPROM_FAST_COPY == 1
+    
+    trace_written = trace_count;
+    trace_write_sec = (uint16_t)second_counter;
+  }
+  if (close) {
+    trace_seq++;
+    trace_count = 0;
+    trace_written = 0;
+    trace_dropped = 0;
+  }
+}
+
+
+void trace_service(void)
+{
+  // Called from the main loop. Adds MQTT state events and writes the chunk
+  // to the EEPROM when it is full, or when it holds entries not yet written
+  // that are 10 seconds old. A chunk is closed after 50 seconds so that the
+  // 16 bit entry times do not wrap.
+  if (trace_ready == 0) return;
+  
+#if BUILD_SUPPORT == MQTT_BUILD
+  if (mqtt_start != trace_mqtt_start) {
+    trace_mqtt_start = mqtt_start;
+    trace_event(TRACE_MQTT_START, mqtt_start, mqtt_start_status);
+  }
+  if (mqtt_restart_step != trace_mqtt_restart) {
+    trace_mqtt_restart = mqtt_restart_step;
+    trace_event(TRACE_MQTT_RESTART, mqtt_restart_step, 0);
+  }
+#endif // BUILD_SUPPORT == MQTT_BUILD
+  
+  if (trace_count == 0) return;
+  if (trace_count == TRACE_ENTRIES
+   || (uint32_t)(second_counter - trace_base) >= 50) {
+    trace_write(1);
+  }
+  else if ((uint16_t)((uint16_t)second_counter - trace_write_sec) >= 10) {
+    trace_write(0);
+  }
+}
+
+
+void trace_sync(void)
+{
+  // Writes the events collected so far to the EEPROM. Used before the
+  // trace is read out and before a reboot.
+  if (trace_ready == 0) return;
+  trace_event(TRACE_SYNC, 0, 0);
+  trace_write(0);
+}
+#endif // TRACE_RING_SUPPORT == 1
+
+
+void periodic_service(void)
+{
+  int i;
+#if HTTP_PACING == 1
+  int n;
+#endif // HTTP_PACING == 1
+#if PERIODIC_WORK_FLAGS == 1
+  uint8_t sweep;
+
+  // Every PERIODIC_SWEEP_PASSES passes all connections are visited to run
+  // the TCP timers. On the other passes only the connections that asked for
+  // the poll with uip_poll_due() are visited.
+  sweep = 0;
+  if (++periodic_sweep_ctr >= PERIODIC_SWEEP_PASSES) {
+    periodic_sweep_ctr = 0;
+    sweep = 1;
+  }
+#endif // PERIODIC_WORK_FLAGS == 1
+#if HTTP_PACING == 1
+  // The connections are visited starting with the MQTT connection so that
+  // its queued messages are sent before the HTTP segments held back by
+  // http_pacing_hold().
+  i = 0;
+  if (mqtt_conn != NULL) i = (int)(mqtt_conn - uip_conns);
+  for(n = 0; n < UIP_CONNS; n++, i = (i + 1 < UIP_CONNS) ? i + 1 : 0) {
+#else // HTTP_PACING == 0
+  for(i = 0; i < UIP_CONNS; i++) {
+#endif // HTTP_PACING == 1
+#if PERIODIC_WORK_FLAGS == 1
+    if (sweep == 0 && !uip_periodic_is_due(i)) continue;
+#endif // PERIODIC_WORK_FLAGS == 1
+    uip_periodic(i);
+#if TRACE_RING_SUPPORT == 1
+    trace_tcp_states();
+#endif // TRACE_RING_SUPPORT == 1
+    // uip_periodic() calls uip_process(UIP_TIMER) for each connection.
+    // Every connection is checked in this loop one time. With each pass
+    // only one connection (one HTTP or one MQTT) will transmit unserviced
+    // outbound traffic one packet at a time.
+    //
+    //   HTTP connections (the webbrowser) will generate and place its
+    //   data in the uip_buf via a call to HttpDCall(). HTTP connections
+    //   can have pending transmissions which are continuations of a
+    //   series of packets because the web pages can be broken into
+    //   several packets.
+    //
+    //   MQTT will always use this function to transmit packets. MQTT
+    //   will have placed its outbound packets in the mqtt_sendbuf. MQTT
+    //   connections will consist of a complete message in one packet.
+    //
+    //   Additionally, there will be TCP handshake transactions such as SYN,
+    //   SYNACK, ACK and FIN that are processed as a result of a
+    //   uip_process(UIP_TIMER).
+    //
+    // If uip_periodic() resulted in data that should be sent out on
+    // the network the global variable uip_len will have been set to a
+    // value > 0 so that Enc28j60Send() will be called.
+    //
+    // Note that when the device first powers up and MQTT is enabled the
+    // MQTT processes will attempt to send a SYN to create a TCP
+    // connection. The uip_periodic() function discovers the SYN is
+    // pending to be sent, causing uip_len to be > 0. Below you'll see
+    // that uip_arp_out() is called first, and on the first pass it will
+    // find that an ARP request is needed. The SYN will be replaced with
+    // an ARP request, and on a future cycle through this routine the
+    // SYN will be sent IF the ARP request was successful.
+    
+    if (uip_len > 0) {
+      uip_arp_out(); // Verifies arp entry in the ARP table and builds
+                     // the LLH
+#if HTTP_SPLIT_OUTPUT == 1
+      uip_split_output();
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if HTTP_SPLIT_OUTPUT == 0
+      Enc28j60Send(uip_buf, uip_len);
+#endif // HTTP_SPLIT_OUTPUT == 0
+    }
+#if HTTP_MULTI_SEGMENT == 1
+    // Called even if nothing was sent above as a retransmit from the
+    // ENC28J60 TX memory also needs the second segment to be resent.
+    send_second_segment();
+#endif // HTTP_MULTI_SEGMENT == 1
+  }
+}
+
+
+#if HTTP_MULTI_SEGMENT == 1
+void send_second_segment(void)
+{
+  // Called right after a segment was sent for the current connection
+  // (uip_conn). If the connection is an HTTP connection with only one
+  // segment in flight the next segment of the web page is built and sent
+  // without waiting for the acknowledge of the first segment. This keeps
+  // two segments in flight and hides one round trip per pair of segments.
+  // If the first segment was just retransmitted the second segment is
+  // retransmitted here as well.
+  // With TX_DOUBLE_BUFFER the second frame goes to the other TX slot while
+  // the first frame is still being transmitted.
+  uip_sendmore_conn(uip_conn);
+  if (uip_len > 0) {
+    uip_arp_out(); // Verifies arp entry in the ARP table and builds
+                   // the LLH
+#if HTTP_SPLIT_OUTPUT == 1
+    uip_split_output();
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if HTTP_SPLIT_OUTPUT == 0
+    Enc28j60Send(uip_buf, uip_len);
+#endif // HTTP_SPLIT_OUTPUT == 0
+  }
+}
+#endif // HTTP_MULTI_SEGMENT == 1
+
+
+#if OB_EEPROM_SUPPORT == 1
+uint8_t off_board_EEPROM_detect(void)
+{
+  // Verify that an I2C EEPROM exists. This routine is directed at
+  // detecting a 256KB I2C EEPROM.
+  //
+  // Presence verification is performed by:
+  //   Reading the first byte of the I2C EEPROM, inverting the byte,
+  //   writing the inverted byte to the I2C EEPROM, and verifying that
+  //   the inversion occurred. If the inversion occurred then eeprom_detect is
+  //   set to 1 and the original byte is restored.
+  //
+  // If detection fails I2C EEPROM support is turned off.
+  
+  uint8_t eeprom_detect;
+  uint8_t byte;
+  
+  eeprom_detect = 0;
+    
+  // Make sure the I2C bus is in a sane condition.
+  I2C_reset();
+  wait_timer(1000); // Wait 1 ms
+  
+  // Read 1 byte from I2C EEPROM.
+  prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, I2C_EEPROM0_BASE, 2);
+  byte = I2C_read_byte(1);
+
+
+  // Write inverted byte to I2C EEPROM.
+  write_one((uint8_t)~byte);
+
+
+  // Read and validate 1 byte from I2C EEPROM.
+  prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, I2C_EEPROM0_BASE, 2);
+   
+  if ((uint8_t)~byte == I2C_read_byte(1)) {
+    eeprom_detect = 1;
+  }
+  else {
+  }
+    
+  // Restore the original 1 byte to I2C EEPROM.
+  write_one(byte);
+
+  return eeprom_detect;
+}
+#endif // OB_EEPROM_SUPPORT == 1
+
+
+#if I2C_SUPPORT == 1
+void prep_read(uint8_t control_write, uint8_t control_read, uint16_t start_address, uint8_t addr_size)
+{
+  // Function to set up a read from I2C devices.
+  // control_write / control_read are the Control Bytes needed to address the
+  // I2C device.
+  // start_address identifies the address starting point in the I2C device.
+  // address_size indicates if the address is one byte or two bytes. 1 =
+  // single byte, 2 = two bytes.
+  //
+  // I2C EEPROM:
+  // When setting up a sequential read from the I2C EEPROMs the
+  // following applies:
+  //   control_write / control_read are the Control Bytes needed to address
+  //   the I2C EEPROM.
+  //   start_address identifies the address starting point in the I2C 
+  //   EEPROM and is typically the first (base) address of the region in the
+  //   I2C EEPROM, although it can also be a specific address offset
+  //   into the I2C EEPROM region. For example:
+  //     I2C EEPROM0 base address: 0x0000 using I2C EEPROM0 Control Bytes
+  //     I2C EEPROM1 base address: 0x8000 using I2C EEPROM1 Control Bytes
+  //     I2C EEPROM2 base address: 0x0000 using I2C EEPROM2 Control Bytes
+  //     I2C EEPROM3 base address: 0x8000 using I2C EEPROM3 Control Bytes
+  //   addr_size for I2C EEPROM access is always 2 bytes.
+  //
+  // BME280:
+  // When setting up a read from the BME280 device the address_size is always
+  // 1 byte.
+
+  // Initial write control byte to establish sequential read address
+  I2C_control(control_write);
+  I2C_byte_address(start_address, addr_size);
+  I2C_control(control_read);
+}
+#endif // I2C_SUPPORT == 1
+
+
+#if OB_EEPROM_SUPPORT == 1
+void write_one(uint8_t byte)
+{
+  // Function to write one byte to the I2C EEPROM
+  // This is only used for the I2C EEPROM detection routine, thus only
+  // uses I2C EEPROM address 0x0000
+  I2C_control(I2C_EEPROM0_WRITE);
+  I2C_byte_address(0x0000, 2);
+  I2C_write_byte(byte);
+  I2C_stop();
+#if I2C_EEPROM_FAST_COPY == 1
+  eeprom_write_wait(I2C_EEPROM0_WRITE);
+#else // I2C_EEPROM_FAST_COPY == 0
+  wait_timer(5000); // Wait 5ms
+#endif // I2C_EEPROM_FAST_COPY == 1
+}
+#endif // OB_EEPROM_SUPPORT == 1
+
+
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+void copy_code_uploader_to_EEPROM1(void)
+{
+  // This function copies a Code Uploader build to I2C EEPROM1.
+  // The entire Flash is copied up to but not including the IO_TIMERS and
+  // IO_NAMES area of memory.
+  uint8_t i;
+  uint16_t address_index;
+  uint8_t I2C_last_flag;
+  uint8_t temp_byte;
+
+  flash_ptr = (char *)FLASH_START_PROGRAM_MEMORY;
+  address_index = I2C_EEPROM1_BASE;
+  
+  I2C_reset();
+  wait_timer(1000); // Wait 1 ms
+  
+  while (address_index < FLASH_START_USER_RESERVE) {
+    // Note for "while" statement: address_index will be incremented by 128
+    // with each loop.
+    I2C_control(I2C_EEPROM1_WRITE); // Send Write Control Byte for upper
+                                    // I2C EEPROM area
+    I2C_byte_address(address_index, 2);
+    for (i=0; i<128; i++) {
+      I2C_write_byte(*flash_ptr);
+      flash_ptr++;
+    }
+    I2C_stop();
+#if I2C_EEPROM_FAST_COPY == 1
+    eeprom_write_wait(I2C_EEPROM1_WRITE);
+#else // I2C_EEPROM_FAST_COPY == 0
+    wait_timer(5000); // Wait 5ms
+#endif // I2C_EEPROM_FAST_COPY == 1
+    address_index += 128;
+    IWDG_KR = 0xaa; // Prevent the IWDG hardware watchdog from firing.
+  }
+}
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+
+
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#if OB_EEPROM_SUPPORT == 1
+#if IMAGE_BACKUP_TASK == 0
+void copy_flash_to_EEPROM0(void)
+{
+  // This function copies a Browser Only or MQTT build to I2C EEPROM0.
+  // The entire Flash is copied up to but not including the IO_TIMERS and
+  // IO_NAMES area of memory.
+  // The function should only be called to cover the case where the user has
+  // the I2C EEPROM installed but has updated the Runtime firmware via
+  // the SWIM interface.
+  uint8_t i;
+  uint16_t address_index;
+  uint8_t I2C_last_flag;
+  uint8_t temp_byte;
+
+  flash_ptr = (char *)FLASH_START_PROGRAM_MEMORY;
+  address_index = I2C_EEPROM0_BASE;
+  I2C_reset();
+  wait_timer(1000); // Wait 1 ms
+  
+  while (address_index < OFFSET_TO_FLASH_START_USER_RESERVE) {
+    I2C_control(I2C_EEPROM0_WRITE);
+    I2C_byte_address(address_index, 2);
+    for (i=0; i<128; i++) {
+      I2C_write_byte(*flash_ptr);
+      flash_ptr++;
+    }
+    I2C_stop();
+#if I2C_EEPROM_FAST_COPY == 1
+    eeprom_write_wait(I2C_EEPROM0_WRITE);
+#else // I2C_EEPROM_FAST_COPY == 0
+    wait_timer(5000); // Wait 5 ms
+#endif // I2C_EEPROM_FAST_COPY == 1
+    address_index += 128;
+    IWDG_KR = 0xaa; // Prevent the IWDG hardware watchdog from firing.
+  }
+}
+
+
+#else // IMAGE_BACKUP_TASK == 1
+void image_backup_step(void)
+{
+  // Runs one step of the background backup of the Flash image to I2C
+  // EEPROM0. Called by the main loop, so networking runs between the steps.
+  // First the CRC32 of the image is computed 128 bytes per step and compared
+  // with the CRC stored with the last complete copy. If they match the copy
+  // is skipped. Otherwise the image is copied one 128 byte I2C EEPROM page
+  // per step and the new CRC is stored when the copy is complete. Each page
+  // write is finished before returning, so other I2C devices and regions
+  // can be used between the steps.
+  uint8_t i;
+  uint32_t stored_crc;
+  char *ptr;
+
+  ptr = (char *)(FLASH_START_PROGRAM_MEMORY + image_backup_index);
+
+  if (image_backup_state == IMAGE_BACKUP_CRC) {
+    for (i=0; i<128; i++) {
+      image_backup_crc = crc32_update(image_backup_crc, (uint8_t)*ptr);
+      ptr++;
+    }
+    image_backup_index += 128;
+    if (image_backup_index >= OFFSET_TO_FLASH_START_USER_RESERVE) {
+      image_backup_crc = ~image_backup_crc;
+      prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, I2C_EEPROM0_IMAGE_CRC, 2);
+      stored_crc = 0;
+      for (i=0; i<4; i++) {
+        stored_crc = (stored_crc << 8) | I2C_read_byte((uint8_t)(i == 3));
+      }
+      if (stored_crc == image_backup_crc) {
+        image_backup_state = IMAGE_BACKUP_DONE;
+      }
+      else {
+        // Clear the stored CRC first, so that a copy interrupted by a reboot
+        // is never taken as complete.
+        image_backup_store_crc(0);
+        image_backup_index = 0;
+        image_backup_state = IMAGE_BACKUP_COPY;
+      }
+    }
+  }
+  
+  else if (image_backup_state == IMAGE_BACKUP_COPY) {
+    I2C_control(I2C_EEPROM0_WRITE);
+    I2C_byte_address(I2C_EEPROM0_BASE + image_backup_index, 2);
+    for (i=0; i<128; i++) {
+      I2C_write_byte(*ptr);
+      ptr++;
+    }
+    I2C_stop();
+#if I2C_EEPROM_FAST_COPY == 1
+    eeprom_write_wait(I2C_EEPROM0_WRITE);
+#else // I2C_EEPROM_FAST_COPY == 0
+    wait_timer(5000); // Wait 5 ms
+#endif // I2C_EEPROM_FAST_COPY == 1
+    image_backup_index += 128;
+    if (image_backup_index >= OFFSET_TO_FLASH_START_USER_RESERVE) {
+      image_backup_store_crc(image_backup_crc);
+      image_backup_state = IMAGE_BACKUP_DONE;
+    }
+  }
+  
+  IWDG_KR = 0xaa; // Prevent the IWDG hardware watchdog from firing.
+}
+
+
+void image_backup_store_crc(uint32_t crc)
+{
+  // Stores the CRC32 of the image copy in I2C EEPROM0, big endian
+  uint8_t i;
+  
+  I2C_control(I2C_EEPROM0_WRITE);
+  I2C_byte_address(I2C_EEPROM0_IMAGE_CRC, 2);
+  for (i=0; i<4; i++) {
+    I2C_write_byte((uint8_t)(crc >> 24));
+    crc <<= 8;
+  }
+  I2C_stop();
+#if I2C_EEPROM_FAST_COPY == 1
+  eeprom_write_wait(I2C_EEPROM0_WRITE);
+#else // I2C_EEPROM_FAST_COPY == 0
+  wait_timer(5000); // Wait 5 ms
+#endif // I2C_EEPROM_FAST_COPY == 1
+}
+
+
+void image_backup_finish(void)
+{
+  // Completes the backup before anything else uses the EEPROM0 copy
+  while (image_backup_state != IMAGE_BACKUP_DONE) image_backup_step();
+}
+#endif // IMAGE_BACKUP_TASK == 0
+#endif // OB_EEPROM_SUPPORT == 1
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+
+
+// IP Address and MAC Address notes:
+// The ENC28J60 device does not use the Network Module IP Address. The
+// ENC28J60 communicates with the Ethernet using only the MAC address (known
+// in the uIP as "ethernet address"). The IP Address is used only within the
+// IP packets.
+//
+// Note that the ENC28J60 must be told what the MAC Network Module address
+// is. But the ENC28J60 only uses the MAC address for receive filtering. The
+// application (not the ENC28J60) must insert the MAC address as needed in
+// any packets for transmission. This occurs in the uip.c and uip_arp.c
+// functions.
+//
+// The application has hardcoded "factory defaults" for the IP Address,
+// Gateway Address, Netmask, Port number, and MAC Address. The user is able
+// to change any of these and the changes are stored in EEPROM. Thereafter
+// the software uses the addresses from the EEPROM at power on so that user
+// inputs are retained through power cycles.
+//
+// The user can press the Reset Button for 5 seconds to restore "factory
+// defaults".
+
+
+#if BUILD_SUPPORT == MQTT_BUILD
+void mqtt_startup(void)
+{
+  uint8_t i;
+  char client_id_text[26]; // Client ID comprised of text
+                           // "NetworkModule" (13 bytes) and
+			   // MAC (12 bytes) and
+			   // terminator (1 byte)
+			   // for a total of 26 bytes.
+  unsigned char topic_base[55]; // Used for building connect, subscribe,
+                                // and publish topic strings.
+				// Publish string content:
+                                //  NetworkModule/DeviceName123456789/input/xx
+                                //  NetworkModule/DeviceName123456789/output/xx
+                                //  NetworkModule/DeviceName123456789/temp/xxxxxxxxxxxx
+                                //  NetworkModule/DeviceName123456789/temp/BME280-0xxxx
+                                //  NetworkModule/DeviceName123456789/state
+                                //  NetworkModule/DeviceName123456789/state24
+				//  NetworkModule/DeviceName123456789/state-req
+				//  NetworkModule/DeviceName123456789/state-req24
+				// Subscribe string content:
+                                //  NetworkModule/DeviceName123456789/output/+/set
+				//  NetworkModule/DeviceName123456789/state-req
+				//  NetworkModule/DeviceName123456789/state-req24
+				// Last Will string content:
+				//  NetworkModule/DeviceName123456789/availability
+				// Home Assistant config string content:
+				//  homeassistant/switch/macaddressxx/xx/config
+				//  homeassistant/binary_sensor/macaddressxx/xx/config
+				//  homeassistant/sensor/macaddressxx/yyyyyyyyyyyy/config
+				//  homeassistant/sensor/macaddressxx/BME280-0xxxx/config
+				//  homeassistant/sensor/macaddressxx/BME280-1xxxx/config
+				//  homeassistant/sensor/macaddressxx/BME280-2xxxx/config
+
+  i = 0;
+  // This function walks through the steps needed to get MQTT initialized and
+  // a connection made to the MQTT Server and Broker
+  // - These steps are run only once at code start, or when restarting the
+  //   client.
+  // - These steps cannot be run until the user has entered the MQTT settings
+  //   in the GUI. The MQTT steps do the following:
+  //   - Verifies that the user has provided a MQTT Server IP Address
+  //   - Requests a TCP Connection with the MQTT Server. This process will
+  //     also perform an ARP request with the MQTT server. Both requests
+  //     occur via the uip_connect() function, and are executed via the
+  //     uip_periodic function.
+  //   - Verifies that the ARP request succeeded.
+  //   - Verifies that the TCP connection request suceeded.
+  //   - Initializes communication with the MQTT Broker.
+  // - Once the above is completed the Home Assistant Auto Discovery messages
+  //   are published (if Home Assistnat Auto Discovery is enabled).
+
+  switch(mqtt_start)
+  {
+  case MQTT_START_TCP_CONNECT:
+    // When first powering up or on a reboot we need to initialize the MQTT
+    // processes.
+    //
+    // The first step is to create a TCP Connection Request to the MQTT
+    // Server. This is done with uip_connect(). uip_connect() doesn't
+    // actually send anything - it just queues the SYN to be sent. The
+    // connection request will actually be sent when uip_periodic is called.
+    // uip_periodic will determine that the connection request is queued,
+    // will perform an ARP request to determine the MAC of the MQTT server,
+    // and will then send the SYN to start the connection process.
+    //
+    // This is the uip_connect() call when the code used the same MQTT port
+    // number for the host port and the local port. This appeared to be
+    // causing problems when reboots occurred, particularly if multiple
+    // Reboot or Save calls were needed for MQTT settings.
+    //    mqtt_conn = uip_connect(&uip_mqttserveraddr, Port_Mqttd, Port_Mqttd);
+    
+    // Following is a fix applied to perform a rotation through multiple
+    // port numbers for the MQTT local port:
+    // This is the only place that uip_connect() is called.
+    // uip_connect(uip_ipaddr_t *ripaddr, uint16_t rport, uint16_t lport)
+    // Here the local port is rotated with each boot to avoid the TIME_WAIT
+    // process in the MQTT server that can delay a TCP reconnect by up to
+    // 4 minutes (typically 2 minutes in Windows and 1 minute in Linux). This
+    // rotation is transparent to users but important for Developers to be
+    // aware of. The local MQTT port numbers are all from the IANA unreserved
+    // range of ports. There could still be in a conflict in the network with
+    // some other application using a selected port number. If that happens
+    // an MQTT error should result (detected in mqtt_sanity_check()), which in
+    // turn should cause a restart of the MQTT functions and selection of a
+    // new alternate port.
+    // The IANA non-reserved (aka Dynamic or Private) port rande is 49152 -
+    // 65535. Any port in this range should be useable for this application,
+    // but it may make some sense to select ports that have some distance
+    // between them to avoid encountering some other application that utilizes
+    // a cluster of ports. The selections made here are arbitraty and can be
+    // changed in the future as needed.
+    // Use the stored_rotation_ptr to select a local MQTT port.
+    {
+      mqtt_local_port = 49193;
+      switch (stored_rotation_ptr)
+      {
+	case 0: mqtt_local_port = ALTERNATE_PORT00; break;
+	case 1: mqtt_local_port = ALTERNATE_PORT01; break;
+	case 2: mqtt_local_port = ALTERNATE_PORT02; break;
+	case 3: mqtt_local_port = ALTERNATE_PORT03; break;
+	case 4: mqtt_local_port = ALTERNATE_PORT04; break;
+      }
+      mqtt_conn = uip_connect(&uip_mqttserveraddr, Port_Mqttd, mqtt_local_port);
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("mqtt_local_port = ");
+// emb_itoa(mqtt_local_port, OctetArray, 10, 5);
+// UARTPrintf(OctetArray);
+// UARTPrintf("\r\n");
+#endif // DEBUG_SUPPORT == 15
+    }
+
+    if (mqtt_conn != NULL) {
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("Good mqtt_conn status\r\n");
+#endif // DEBUG_SUPPORT == 15
+#if MQTT_FAST_RECONNECT == 1
+      reconnect_start = ms_counter;
+#endif // MQTT_FAST_RECONNECT == 1
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      verify_count = 0; // Clear the ARP verify count
+      mqtt_start_status = MQTT_START_CONNECTIONS_GOOD;
+      mqtt_start = MQTT_START_VERIFY_ARP;
+    }
+    else {
+      mqtt_start_status |= MQTT_START_CONNECTIONS_ERROR;
+    }
+    break;
+      
+  case MQTT_START_VERIFY_ARP:
+#if MQTT_FAST_RECONNECT == 1
+    // On a reconnect the ARP Table usually still holds the MQTT Server
+    // entry, so the first check is made without the 300ms wait.
+    if (mqtt_start_ctr1 > 6 || verify_count == 0) {
+#else
+    if (mqtt_start_ctr1 > 6) {
+#endif // MQTT_FAST_RECONNECT == 1
+      // mqtt_start_ctr1 causes us to wait 300ms before checking to see if the
+      // ARP request completed.
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      verify_count++; // Increment the ARP verify count
+
+      // ARP Request and TCP Connection request were sent to the MQTT Server
+      // as a result of the uip_connect() in the prior step. Now we loop and
+      // check that the ARP request was successful.
+      if (check_mqtt_server_arp_entry()) {
+        // ARP Reply received
+        mqtt_start_ctr1 = 0; // Clear 50ms counter
+	verify_count = 0;
+        mqtt_start_status |= MQTT_START_ARP_REQUEST_GOOD;
+        mqtt_start = MQTT_START_VERIFY_TCP;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("MQTT ARP Verified\r\n");
+#endif // DEBUG_SUPPORT == 15
+      }
+      if (verify_count > 50) {
+        // mqtt_start_ctr1 allows us to wait up to 15 seconds for the ARP
+        // Reply. If timeout occurs we probably have an error in the MQTT
+        // Server IP Address or there is a network problem. If we timeout
+        // we start over and retry the ARP request.
+        mqtt_start = MQTT_START_TCP_CONNECT;
+        // Clear the error indicator flags
+        mqtt_start_status = MQTT_START_NOT_STARTED;
+      }
+    }
+    break;
+
+  case MQTT_START_VERIFY_TCP:
+#if MQTT_FAST_RECONNECT == 1
+    // Check for the established connection on every pass rather than
+    // every 300ms. The 300ms steps below still run the timeout.
+    if ((mqtt_conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      mqtt_start_status |= MQTT_START_TCP_CONNECT_GOOD;
+      mqtt_start = MQTT_START_MQTT_INIT;
+      break;
+    }
+#endif // MQTT_FAST_RECONNECT == 1
+    if (mqtt_start_ctr1 > 6) {
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      verify_count++; // Increment the TCP verify count every 300ms
+
+      // Loop to make sure the TCP connection request was successful. We're
+      // waiting for the SYNACK/ACK process to complete (checking each 300ms).
+      // uip_periodic() runs frequently (each time the periodic_timer expires).
+      // When uip_periodic() runs it calls the uip_process() to receive the
+      // SYNACK and then send the ACK. We will know the ACK was sent when we
+      // see the UIP_ESTABLISHED state for the mqtt connection.
+      
+      if ((mqtt_conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+        mqtt_start_ctr1 = 0; // Clear 50ms counter
+        mqtt_start_status |= MQTT_START_TCP_CONNECT_GOOD;
+        mqtt_start = MQTT_START_MQTT_INIT;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("MQTT TCP Verified\r\n");
+#endif // DEBUG_SUPPORT == 15
+      }
+      if (verify_count > 166) { // 50 seconds.
+        // This needs to be longer than the RTO timeout in the uip.c code
+	// which is initially 3 seconds but can gradually increase to 48
+	// seconds before a connection abort occurs.
+        // If the connection does not complete we probably have a network
+	// problem.  Try again with a new uip_connect().
+        mqtt_start = MQTT_START_TCP_CONNECT;
+        // Clear the error indicator flags
+        mqtt_start_status = MQTT_START_NOT_STARTED;
+      }
+    }
+    break;
+
+
+#if HOME_ASSISTANT_SUPPORT == 1
+  case MQTT_START_MQTT_INIT:
+    if (MQTT_START_SETTLED()) {
+      // Initialize mqtt client
+      mqtt_init(&mqttclient,
+                mqtt_sendbuf,
+                sizeof(mqtt_sendbuf),
+                &uip_buf[MQTT_PBUF],
+		MQTT_PBUF_SIZE,
+                publish_callback);
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      mqtt_start = MQTT_START_QUEUE_CONNECT;
+    }
+    break;
+#endif // HOME_ASSISTANT_SUPPORT == 1
+
+
+#if DOMOTICZ_SUPPORT == 1
+  case MQTT_START_MQTT_INIT:
+    if (MQTT_START_SETTLED()) {
+      // Initialize mqtt client
+      mqtt_init(&mqttclient,
+                mqtt_sendbuf,
+                sizeof(mqtt_sendbuf),
+                &uip_buf[UIP_IPTCPH_LEN + UIP_LLH_LEN],
+                UIP_APPDATA_SIZE,
+                publish_callback);
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      mqtt_start = MQTT_START_QUEUE_CONNECT;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("\r\n");
+// UARTPrintf("Sent mqtt_init\r\n");
+#endif // DEBUG_SUPPORT == 15
+    }
+    break;
+#endif // DOMOTICZ_SUPPORT == 1
+
+
+  case MQTT_START_QUEUE_CONNECT:
+    if (MQTT_START_SETTLED()) {
+      // ARP Reply received from the MQTT Server and TCP Connection
+      // established.
+      // We should now be able to message the MQTT Broker, but will wait
+      // 200ms to give some start time.
+
+      // Queue the mqtt_connect message for transmission to the MQTT Broker. 
+      // The mqtt_connect function will create the message and put it in the
+      // mqtt_sendbuf queue.
+      // uip_periodic() will start the process that will call mqtt_sync to
+      // copy the message from the mqtt_sendbuf to the uip_buf.
+  
+#if MQTT_TOPIC_PREFIX == 1
+      // Build the device topic prefix used by all PUBLISH topics. A Device
+      // Name change causes a restart so the prefix only needs to be built
+      // here.
+      build_topic_prefix();
+#endif // MQTT_TOPIC_PREFIX == 1
+
+      // Create client_id with devicetype and MAC address
+      strcpy(client_id_text, devicetype);
+      // Remove trailing / in devicetype
+      client_id_text[strlen(client_id_text) - 1] = '\0';
+      // Add MAC number
+      strcat(client_id_text, mac_string);
+      client_id = client_id_text;
+  
+      // Ensure we have a clean session
+      connect_flags = MQTT_CONNECT_CLEAN_SESSION;
+ 
+      // Create will_topic
+      strcpy(topic_base, devicetype);
+      strcat(topic_base, stored_devicename);
+      strcat(topic_base, "/availability");
+
+      // When a CONNECT is sent to the broker it should respond with a
+      // CONNACK.
+      connack_received = 0;
+      
+      // Queue the message
+      mqtt_connect(&mqttclient,
+                   client_id,              // Based on MAC address
+                   topic_base,             // Will topic
+                   "offline",              // Will message 
+                   7,                      // Will message size
+                   stored_mqtt_username,   // Username
+                   stored_mqtt_password,   // Password
+                   connect_flags,          // Connect flags
+                   mqtt_keep_alive);       // Ping interval
+     
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      mqtt_start = MQTT_START_VERIFY_CONNACK;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("\r\n");
+// UARTPrintf("Sent mqtt_connect\r\n");
+#endif // DEBUG_SUPPORT == 15
+    }
+    break;
+
+  case MQTT_START_VERIFY_CONNACK:
+    // Verify that the CONNECT CONNACK was received.
+    // When a CONNECT is sent to the broker it should respond with a CONNACK.
+    // The CONNACK will occur very quickly but we will allow up to 10 seconds
+    // before assuming an error has occurred.
+    // A workaround is implemented with the global variable connack_received so
+    // that the mqtt.c code can tell the main.c code that the CONNECT CONNACK
+    // was received.
+
+    if (mqtt_start_ctr1 < 200) {
+      // Allow up to 10 seconds for CONNACK
+      if (connack_received) {
+        mqtt_start_ctr1 = 0; // Clear 50ms counter
+        mqtt_start_status |= MQTT_START_MQTT_CONNECT_GOOD;
+        mqtt_start = MQTT_START_QUEUE_SUBSCRIBE1;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("\r\n");
+// UARTPrintf("connack_received\r\n");
+#endif // DEBUG_SUPPORT == 15
+      }
+    }
+    else {
+      mqtt_start = MQTT_START_TCP_CONNECT;
+      // Clear the error indicator flags
+      mqtt_start_status = MQTT_START_NOT_STARTED;
+    }
+    break;
+
+
+#if HOME_ASSISTANT_SUPPORT == 1
+  case MQTT_START_QUEUE_SUBSCRIBE1:
+  case MQTT_START_QUEUE_SUBSCRIBE2:
+  case MQTT_START_QUEUE_SUBSCRIBE3:
+#if MQTT_DISCOVERY_HASH == 1
+  case MQTT_START_QUEUE_SUBSCRIBE4:
+#endif // MQTT_DISCOVERY_HASH == 1
+    if (MQTT_START_SETTLED()) {
+      // Queue the mqtt_subscribe messages for transmission to the MQTT
+      // Broker.
+      // Wait 200ms before queueing first Subscribe msg.
+      //
+      // The mqtt_subscribe function will create the message and put it in
+      // the mqtt_sendbuf queue. uip_periodic() will start the process that
+      // will call mqtt_sync to transfer the message from the mqtt_sendbuf
+      // to the uip_buf.
+      //
+      // Note: Timing is managed here to prevent placing multiple SUBSCRIBE
+      // messages in the mqtt_sendbuf as that buffer is very small.
+      //
+      // SUBSCRIBE is run three times:
+      //   case MQTT_START_QUEUE_SUBSCRIBE1:
+      //   Subscribe to the output control messages
+      //
+      //   case MQTT_START_QUEUE_SUBSCRIBE2:
+      //   Subscribe to the state-req messages
+      //
+      //   case MQTT_START_QUEUE_SUBSCRIBE3:
+      //   Subscribe to the state-req24 messages
+      //
+      //   case MQTT_START_QUEUE_SUBSCRIBE4:
+      //   With MQTT_DISCOVERY_HASH subscribe to the Home Assistant birth
+      //   message
+      //
+	
+      suback_received = 0;
+      strcpy(topic_base, devicetype);
+      strcat(topic_base, stored_devicename);
+
+#if MQTT_FAST_RECONNECT == 1
+      // With MQTT_FAST_RECONNECT the three device topics are subscribed
+      // with one SUBSCRIBE packet, then the steps continue as if
+      // SUBSCRIBE3 was sent. If the packet does not fit in the
+      // mqtt_sendbuf (long device name) the separate steps are used.
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE1) {
+        if (mqtt_subscribe_multi(&mqttclient, topic_base, subscribe_suffix, 3, 0) == MQTT_OK) {
+          mqtt_start_ctr1 = 0; // Clear 50ms counter
+          mqtt_start = MQTT_START_VERIFY_SUBSCRIBE3;
+	  break;
+	}
+      }
+#endif // MQTT_FAST_RECONNECT == 1
+      
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE1) strcat(topic_base, "/output/+/set");
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE2) strcat(topic_base, "/state-req");
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE3) strcat(topic_base, "/state-req24");
+#if MQTT_DISCOVERY_HASH == 1
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE4) strcpy(topic_base, "homeassistant/status");
+#endif // MQTT_DISCOVERY_HASH == 1
+      
+      // In the mqtt_subscribe call the maximum QOS level spedified (0 in this
+      // case) is the max QOS level supported for the topic messages being
+      // subcribed to. The SUBSCRIBE itself has no QOS level as a special
+      // SUBACK message must be returned to verify the SUBSCRIBE transaction.
+      mqtt_subscribe(&mqttclient, topic_base, 0);
+      mqtt_start_ctr1 = 0; // Clear 50ms counter
+      
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE1) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE1;
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE2) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE2;
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE3) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE3;
+#if MQTT_DISCOVERY_HASH == 1
+      if (mqtt_start == MQTT_START_QUEUE_SUBSCRIBE4) mqtt_start = MQTT_START_VERIFY_SUBSCRIBE4;
+#endif // MQTT_DISCOVERY_HASH == 1
+    }
+    break;
+
+
+  case MQTT_START_VERIFY_SUBSCRIBE1:
+  case MQTT_START_VERIFY_SUBSCRIBE2:
+  case MQTT_START_VERIFY_SUBSCRIBE3:
+#if MQTT_DISCOVERY_HASH == 1
+  case MQTT_START_VERIFY_SUBSCRIBE4:
+#endif // MQTT_DISCOVERY_HASH == 1
+    // Verify that the SUBSCRIBE SUBACK was received.
+    // When a SUBSCRIBE is sent to the broker it should respond with a SUBACK.
+    // The SUBACK will occur very quickly but we will allow up to 10 seconds
+    // before assuming an error has occurred.
+    // A workaround is implemented with the global variable suback_received so
+    // that the mqtt.c code can tell the main.c code that the SUBSCRIBE SUBACK
+    // was received.
+    //
+    // VERIFY_SUBSCRIBE is run three times
+
+    if (mqtt_start_ctr1 < 200) {
+      // Allow up to 10 seconds for SUBACK
+      if (suback_received == 1) {
+        mqtt_start_ctr1 = 0; // Clear 50ms counter
+        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE1) mqtt_start = MQTT_START_QUEUE_SUBSCRIBE2;
+        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE2) mqtt_start = MQTT_START_QUEUE_SUBSCRIBE3;
+#if MQTT_DISCOVERY_HASH == 1
+        // The Home Assistant birth message subscription is added after
+	// SUBSCRIBE3.
+        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE3) mqtt_start = MQTT_START_QUEUE_SUBSCRIBE4;
+        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE4) {
+#else
+        if (mqtt_start == MQTT_START_VERIFY_SUBSCRIBE3) {
+#endif // MQTT_DISCOVERY_HASH == 1
+          if ((stored_config_settings & 0x02)
+#if MQTT_DISCOVERY_HASH == 1
+	   // Skip Auto Discovery if the Config messages already sent (and
+	   // retained by the broker) match the current settings, unless
+	   // Home Assistant asked for them.
+	   && (discovery_request == 1 || discovery_hash() != stored_discovery_hash)
+#endif // MQTT_DISCOVERY_HASH == 1
+	   ) {
+            // Home Assistant Auto Discovery enabled
+            start_auto_discovery();
+          }
+          else {
+            mqtt_start_ctr1 = 0; // Clear 50ms counter
+            mqtt_start = MQTT_START_QUEUE_PUBLISH_ON;
+          }
+	}
+      }
+    }
+    else {
+      mqtt_start = MQTT_START_TCP_CONNECT;
+      // Clear the error indicator flags
+      mqtt_start_status = MQTT_START_NOT_STARTED; 
+    }
+    break;
+#endif // HOME_ASSISTANT_SUPPORT == 1
 
 
 #if DOMOTICZ_SUPPORT == 1
   case MQTT_START_QUEUE_SUBSCRIBE1:
-    if (mqtt_start_ctr1 > 4) {
+    if (MQTT_START_SETTLED()) {
       // Queue the mqtt_subscribe messages for transmission to the MQTT
       // Broker.
       // Wait 200ms before queueing first Subscribe msg.
@@ -2056,7 +3588,19 @@ void mqtt_startup(void)
 
 #if HOME_ASSISTANT_SUPPORT == 1
   case MQTT_START_QUEUE_PUBLISH_AUTO:
+#if MQTT_DISCOVERY_BATCH == 1
+    // With MQTT_DISCOVERY_BATCH the steps below are repeated as long as the
+    // mqtt_sendbuf has room for the next placeholder message, rather than
+    // one step each 100 to 200 ms. mqtt_pal_sendall() then builds the
+    // queued messages back to back in one TCP segment (see
+    // MQTT_PUBLISH_BATCH). The next steps run when mqtt_send() has emptied
+    // the mqtt_sendbuf, which happens as soon as the broker ACKs the
+    // segment in flight.
+    while (auto_discovery != AUTO_COMPLETE
+        && mqtt_check_sendbuf(&mqttclient) >= (auto_discovery == DEFINE_TEMP_SENSORS ? MQTT_DISCOVERY_ROOM_SENSOR : MQTT_DISCOVERY_ROOM_IO)) {
+#else
     if (mqtt_start_ctr1 > 2) {
+#endif // MQTT_DISCOVERY_BATCH == 1
       // Publish Home Assistant Auto Discovery messages
       // This part of the state machine runs only if Home Assistant Auto
       // Discovery is enabled.
@@ -2371,6 +3915,9 @@ void mqtt_startup(void)
         uint8_t j;
         auto_discovery_step = STEP_NULL;
         mqtt_start = MQTT_START_QUEUE_PUBLISH_ON;
+#if MQTT_DISCOVERY_BATCH == 1
+        discovery_time = (uint16_t)(ms_counter - discovery_start);
+#endif // MQTT_DISCOVERY_BATCH == 1
 	// Clear the PCF8574 "force pin delete" indicator if it is set
 	if ((stored_options1 & 0x20) == 0x20) {
 	  j = stored_options1;
@@ -2379,6 +3926,19 @@ void mqtt_startup(void)
 	  stored_options1 = j;
 	  lock_eeprom();
 	}
+#if MQTT_DISCOVERY_HASH == 1
+	// Remember the settings the Config messages were built from. The
+	// EEPROM is only written if they changed.
+	{
+	  uint16_t hash;
+	  hash = discovery_hash();
+	  if (hash != stored_discovery_hash) {
+	    unlock_eeprom();
+	    stored_discovery_hash = hash;
+	    lock_eeprom();
+	  }
+	}
+#endif // MQTT_DISCOVERY_HASH == 1
       }
     }
     break;
@@ -2387,12 +3947,16 @@ void mqtt_startup(void)
 
 #if HOME_ASSISTANT_SUPPORT == 1
   case MQTT_START_QUEUE_PUBLISH_ON:
-    if (mqtt_start_ctr1 > 4) {
+    if (MQTT_START_SETTLED()) {
       // Wait 200ms before queuing the "availability online" PUBLISH message.
       // This message is always published with QOS 0.
+#if MQTT_TOPIC_PREFIX == 1
+      topic_build(topic_base, TOPIC_SUFFIX_AVAILABILITY);
+#else // MQTT_TOPIC_PREFIX == 0
       strcpy(topic_base, devicetype);
       strcat(topic_base, stored_devicename);
       strcat(topic_base, "/availability");
+#endif // MQTT_TOPIC_PREFIX == 1
       mqtt_publish(&mqttclient,
                    topic_base,
                    "online",
@@ -2417,23 +3981,48 @@ void mqtt_startup(void)
 
 
   case MQTT_START_QUEUE_PUBLISH_PINS:
-    if (mqtt_start_ctr1 > 4) {
+    if (MQTT_START_SETTLED()) {
       // Wait 200ms before starting
       // Publish the state of all pins one at a time.
       // This is accomplished by setting ON_OFF_word_sent to the inverse of
       // whatever is currently in ON_OFF_word. This will cause the normal
       // checks for pin state changes to trigger a transmit for every pin.
+#if MQTT_HA_STATUS_RESYNC == 1
+      // After an MQTT restart the broker still holds the retained pin
+      // states, so only the pins that changed since they were last
+      // published are sent. All pins are sent after boot and after Auto
+      // Discovery.
+#endif // MQTT_HA_STATUS_RESYNC == 1
+#if DOMOTICZ_PUBLISH_BATCH == 1
+      // Domoticz keeps the device states, so after an MQTT restart only
+      // the pins that changed since they were last published are sent.
+      // All pins are sent after boot, after an idx change and after a
+      // restart that dropped queued messages.
+#endif // DOMOTICZ_PUBLISH_BATCH == 1
+#if MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
+      if (resync_full) {
+        resync_full = 0;
+#endif // MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
 #if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
       ON_OFF_word_sent = (uint16_t)(~ON_OFF_word);
 #endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
 #if PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
       ON_OFF_word_sent = (uint32_t)(~ON_OFF_word);
 #endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+#if MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
+      }
+#endif // MQTT_HA_STATUS_RESYNC == 1 || DOMOTICZ_PUBLISH_BATCH == 1
       // Indicate succesful completion
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("MQTT Startup Complete\r\n");
 #endif // DEBUG_SUPPORT == 15
       mqtt_start = MQTT_START_COMPLETE;
+#if DEFERRED_SENSOR_INIT == 1
+      if (boot_mqtt_time == 0) boot_mqtt_time = boot_elapsed();
+#endif // DEFERRED_SENSOR_INIT == 1
+#if MQTT_FAST_RECONNECT == 1
+      reconnect_time = (uint16_t)(ms_counter - reconnect_start);
+#endif // MQTT_FAST_RECONNECT == 1
     }
     break;
   } // end switch
@@ -2441,6 +4030,108 @@ void mqtt_startup(void)
 #endif // BUILD_SUPPORT == MQTT_BUILD
 
 
+#if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+void start_auto_discovery(void)
+{
+  // Start the Home Assistant Auto Discovery steps of the MQTT startup.
+  mqtt_start = MQTT_START_QUEUE_PUBLISH_AUTO;
+  auto_discovery = DEFINE_INPUTS;
+  auto_discovery_step = SEND_OUTPUT_DELETE;
+  pin_ptr = 1;
+  sensor_number = 0;
+#if MQTT_DISCOVERY_BATCH == 1
+  discovery_start = ms_counter;
+#endif // MQTT_DISCOVERY_BATCH == 1
+#if MQTT_DISCOVERY_HASH == 1
+  discovery_request = 0;
+#endif // MQTT_DISCOVERY_HASH == 1
+#if MQTT_HA_STATUS_RESYNC == 1
+  resync_full = 1;
+#endif // MQTT_HA_STATUS_RESYNC == 1
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+
+
+#if MQTT_HA_STATUS_RESYNC == 1
+void ha_resync(void)
+{
+  // Answer a Home Assistant birth message. Home Assistant restarted and
+  // has lost the states, but the broker still holds the retained Config
+  // messages unless the settings changed since they were sent. So Auto
+  // Discovery is only run if the discovery hash changed (it republishes
+  // all pins when it completes). Otherwise all pin states are marked for
+  // publish_outbound() (a single message with MQTT_STATE_AGGREGATE) and
+  // the sensors are sent with their next values.
+  discovery_request = 0;
+  if ((stored_config_settings & 0x02) && discovery_hash() != stored_discovery_hash) {
+    start_auto_discovery();
+    return;
+  }
+#if PCF8574_SUPPORT == 0
+  ON_OFF_word_sent = (uint16_t)(~ON_OFF_word);
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+  ON_OFF_word_sent = (uint32_t)(~ON_OFF_word);
+#endif // PCF8574_SUPPORT == 1
+#if DS18B20_SUPPORT == 1
+  if (stored_config_settings & 0x08) send_mqtt_temperature = 4;
+#endif // DS18B20_SUPPORT == 1
+#if BME280_SUPPORT == 1
+  if ((BME280_found == 1) && (stored_config_settings & 0x20)) send_mqtt_BME280 = 2;
+#endif // BME280_SUPPORT == 1
+#if SENSOR_DEADBAND_SUPPORT == 1
+  // Publish the current readings even if they are within the deadband
+  sensor_pub_valid = 0;
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+}
+#endif // MQTT_HA_STATUS_RESYNC == 1
+
+
+#if BUILD_SUPPORT == MQTT_BUILD && MQTT_DISCOVERY_HASH == 1
+uint16_t discovery_hash_add(uint16_t hash, const uint8_t *pData, uint8_t len)
+{
+  // Adds len bytes to a rotate-and-add hash
+  while (len--) {
+    hash = (uint16_t)(((hash << 1) | (hash >> 15)) + *pData++);
+  }
+  return hash;
+}
+
+
+uint16_t discovery_hash(void)
+{
+  // Returns a hash of the settings that are built into the Home Assistant
+  // Auto Discovery Config messages: the device name, the MAC address, the
+  // code revision, the Input / Output / Disabled type of every pin, the
+  // sensor enables, the PCF8574 options, and the DS18B20 sensor IDs.
+  uint16_t hash;
+  uint8_t iotype;
+  int i;
+
+  hash = discovery_hash_add(0, stored_devicename, sizeof(stored_devicename));
+  hash = discovery_hash_add(hash, (const uint8_t *)mac_string, 12);
+  hash = discovery_hash_add(hash, (const uint8_t *)code_revision, (uint8_t)strlen(code_revision));
+  for (i = 0; i < (int)sizeof(pin_control); i++) {
+#if LINKED_SUPPORT == 0
+    iotype = (uint8_t)(pin_control[i] & 0x03);
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+    iotype = chk_iotype(pin_control[i], i, 0x03);
+#endif // LINKED_SUPPORT == 1
+    hash = discovery_hash_add(hash, &iotype, 1);
+  }
+  iotype = (uint8_t)(stored_config_settings & 0x28);
+  hash = discovery_hash_add(hash, &iotype, 1);
+  iotype = (uint8_t)(stored_options1 & 0x28);
+  hash = discovery_hash_add(hash, &iotype, 1);
+#if DS18B20_SUPPORT == 1
+  hash = discovery_hash_add(hash, &FoundROM[0][0], sizeof(FoundROM));
+#endif // DS18B20_SUPPORT == 1
+  return hash;
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD && MQTT_DISCOVERY_HASH == 1
+
+
 #if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 #if DS18B20_SUPPORT == 1
 void define_temp_sensors(void)
@@ -2612,791 +4303,1892 @@ void send_IOT_msg(uint8_t IOT_ptr, uint8_t IOT, uint8_t DefOrDel)
     app_message[1] = 'T';
   }
   
-#if BME280_SUPPORT == 1
-  if (IOT == PRESMSG) {
-    strcat(topic_base, "sensor/");
-    app_message[1] = 'P';
-  }
-#endif // BME280_SUPPORT == 1
+#if BME280_SUPPORT == 1
+  if (IOT == PRESMSG) {
+    strcat(topic_base, "sensor/");
+    app_message[1] = 'P';
+  }
+#endif // BME280_SUPPORT == 1
+
+#if BME280_SUPPORT == 1
+  if (IOT == HUMMSG) {
+    strcat(topic_base, "sensor/");
+    app_message[1] = 'H';
+  }
+#endif // BME280_SUPPORT == 1
+
+  if ((IOT == INPUTMSG) || (IOT == OUTPUTMSG)) {
+    // Create the pin number for the app_message and topic.
+    emb_itoa(IOT_ptr, OctetArray, 10, 2);
+    // Add pin number to payload template
+    app_message[2] = OctetArray[0];
+    app_message[3] = OctetArray[1];
+    app_message[4] = '\0';
+  }
+
+#if DS18B20_SUPPORT == 1
+  if (IOT == TMPRMSG) {
+    // Create the sensor number for the app_message and topic.
+    // Add first part of sensor ID to payload template. For the DS18B20 the ID
+    // is the DS18B20 MAC address.
+    {
+      int i;
+      int j;
+      j = 2;
+      for (i=6; i>0; i--) {
+        int2hex(FoundROM[IOT_ptr][i]);
+        app_message[j++] = OctetArray[0];
+        app_message[j++] = OctetArray[1];
+      }
+      app_message[14] = '\0';
+    }
+  }
+#endif // DS18B20_SUPPORT == 1
+
+#if BME280_SUPPORT == 1
+  if (IOT == TMPRMSG || IOT == PRESMSG || IOT == HUMMSG) {
+    // Create the sensor ID for the app_message and topic.
+    // Add first part of sensor ID to payload template. For the BME280 the ID
+    // is "BME280" plus a one digit number:
+    //   0 = Temperature
+    //   1 = Pressure
+    //   2 = Humidity 
+    create_sensor_ID(IOT_ptr);
+    strcpy(&app_message[2], OctetArray);
+  }
+#endif // BME280_SUPPORT == 1
+
+  // Create the rest of the topic
+  strcat(topic_base, mac_string);
+  strcat(topic_base, "/");
+  strcat(topic_base, &app_message[2]);
+  strcat(topic_base, "/config");
+      
+  // If deleting the pin replace the app_message with NULL (never delete
+  // temperature, pressure, or humidity sensors ... let the user do that in
+  // Home Assistant).
+  if (DefOrDel == DELETE_IOT) app_message[0] = '\0';
+
+  // Send the message
+  // Note: This message will be intercepted in the mqtt_pal.c 
+  //  mqtt_pal_sendall() routine and additional payload content will
+  //  be added.
+  // This message is always published with QOS 0
+  mqtt_publish(&mqttclient,
+               topic_base,
+               app_message,
+               strlen(app_message),
+               MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+
+
+#if BUILD_SUPPORT == MQTT_BUILD
+void mqtt_sanity_check(struct mqtt_client *client)
+{
+  // This is similar to a firmware restart except it is focused on restarting
+  // only the MQTT components.  The process is triggered every XX seconds IF
+  // we don't have an MQTT connection.
+  //
+  // Check the MQTT connection. This is limited to once every X seconds to
+  // reduce the processing consumed by restart attempts.
+  //
+  // Once triggered the sanity_check() function will cause the mqtt_startup()
+  // function to be called from the main loop which will reset the backoff if
+  // successful.
+
+  switch(mqtt_restart_step)
+  {
+  case MQTT_RESTART_IDLE:
+    // Check for a response timeout.
+    // response_timeout is typically 30 seconds, and for a sanity check we
+    // are allowing X timeouts before taking action. See the mqtt.c code.
+    // Note that the Broker ping timeout may be shorter than this response
+    // timeout. If the Broker times out first it will disconnect from this
+    // device. That should not cause a problem.
+    if (client->number_of_timeouts > 1) {
+      // Reset the timeout counter
+      client->number_of_timeouts = 0;
+      MQTT_resp_tout_counter++;
+
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("mqtt_sanity_check Response Timeout\r\n");
+#endif // DEBUG_SUPPORT == 15
+
+      mqtt_restart_step = MQTT_RESTART_BEGIN;
+    }
+
+    // Check for a graceful shutdown of the MQTT Broker, and/or a disconnect
+    // commanded by the broker (possibly the result of response timeout
+    // caused from this module). If this happens we'll be in the
+    // MQTT_START_COMPLETE state and we'll see a UIP_CLOSED. If this
+    // condition occurs it may persist for a long time.
+    if (mqtt_start == MQTT_START_COMPLETE
+     && mqtt_conn->tcpstateflags == UIP_CLOSED) {
+      MQTT_broker_dis_counter++;
+
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("mqtt_sanity_check Broker Disconnect\r\n");
+#endif // DEBUG_SUPPORT == 15
+
+      mqtt_restart_step = MQTT_RESTART_BEGIN;
+    }
+  
+    // Check for an MQTT error
+    // != MQTT_OK needs to be qualified with MQTT_START_COMPLETE because a
+    // not OK condition can be present prior to mqtt_connect() running.
+    if (mqtt_start == MQTT_START_COMPLETE
+     && client->error != MQTT_OK) {
+      MQTT_not_OK_counter++;
+
+
+#if DEBUG_SUPPORT == 15
+// MQTT not OK values are all negative numbers from 0x8000 to 0x801c.
+// For debug display strip the first 4 bits, convert the remaining bits
+// using emb_itoa (as it can only handle positive numbers), then rebuild
+// the error code for display.
+// {
+// int16_t temp1;
+// UARTPrintf("mqtt_sanity_check MQTT_not_OK - Error code: 0x");
+// temp1 = client->error & 0x00ff;
+// emb_itoa(temp1, OctetArray, 16, 4);
+// OctetArray[0] = '8';
+// UARTPrintf(OctetArray);
+// UARTPrintf("\r\n");
+// }
+#endif // DEBUG_SUPPORT == 15
+
+      mqtt_restart_step = MQTT_RESTART_BEGIN;
+    }
+    break;
+
+  case MQTT_RESTART_BEGIN:
+    // MQTT restart process triggered. The process:
+    // 1) Sends an mqtt disconnect just in case there is a connection.
+    // 2) Closes the TCP connection.
+    // 3) Return to the main loop so that the MQTT start process can run.
+    // This process sets up the first two events, but the main.c loop must
+    // run so that the uip_periodic() and uip_input() functions will carry
+    // out execution of the transmit and receive steps needed.
+    mqtt_restart_step = MQTT_RESTART_DISCONNECT_START;
+#if DOMOTICZ_PUBLISH_BATCH == 1
+    // Pin states still in the mqtt_sendbuf are lost with the connection,
+    // so the next connect republishes all pins.
+    if (mqtt_mq_length(&client->mq) != 0) resync_full = 1;
+#endif // DOMOTICZ_PUBLISH_BATCH == 1
+    // Clear the start error indicator flags so the GUI will reflect
+    // that we are no longer in a connected state
+    mqtt_start_status = MQTT_START_NOT_STARTED;
+    break;
+      
+  case MQTT_RESTART_DISCONNECT_START:
+    mqtt_restart_step = MQTT_RESTART_DISCONNECT_WAIT;
+    // Disconnect the MQTT client
+    mqtt_disconnect(&mqttclient);
+    mqtt_sanity_ctr = 0; // Clear 50ms counter
+    break;
+  
+  case MQTT_RESTART_DISCONNECT_WAIT:
+    if (mqtt_sanity_ctr > 20) {
+      // The mqtt_disconnect() is given 1 second to be communicated before
+      // we move on to TCP close
+      mqtt_restart_step = MQTT_RESTART_TCPCLOSE;
+    }
+    break;
+
+  case MQTT_RESTART_TCPCLOSE:
+    // The way a TCP connection close SHOULD work:
+    // 1) A uip_periodic() runs and uip_process(UIP_TIMER) is called
+    // 2) If a connection is in the ESTABLISHED state (meaning a TCP
+    //    connection is open) the uip_process() will make a UIP_APPCALL.
+    // 3) UIP_APPCALL calls the MQTT or HTTP application via
+    //    uip_TcpAppHubCall()
+    // 4) Before the application returns, if it wants to close the
+    //    connection, it should call uip_close()
+    // 5) The UIP code will then go to appsend: and will know to start
+    //    the TCP close process.
+    // So, it looks like all I need to do is make sure the APPCALL performs
+    // a uip_close() before returning to the UIP code. Then the regular
+    // uip_periodic() process should get the job done.
+    //
+    // Signal uip_TcpAppHubCall() to close the TCP connection
+    mqtt_close_tcp = 1;
+    // Capture time to delay the next step
+    mqtt_sanity_ctr = 0; // Clear 50ms counter
+    mqtt_restart_step = MQTT_RESTART_TCPCLOSE_WAIT;
+    break;
+  
+  case MQTT_RESTART_TCPCLOSE_WAIT:
+    // Verify closed ... how?
+    // For the moment I'm not sure how to do this, so I will just allow
+    // enough time for it to happen. That is probably very fast, but I will
+    // allow 2 seconds.
+    if (mqtt_sanity_ctr > 40) {
+      mqtt_close_tcp = 0;
+      mqtt_sanity_ctr = 0; // Clear 50ms counter
+      mqtt_restart_step = MQTT_RESTART_SIGNAL_STARTUP;
+    }
+    break;
+    
+  case MQTT_RESTART_SIGNAL_STARTUP:
+    // Set mqtt_restart_step and mqtt_start to re-run the MQTT connection
+    // steps in the main loop
+    mqtt_restart_step = MQTT_RESTART_IDLE;
+    mqtt_start = MQTT_START_TCP_CONNECT;
+    break;
+    
+  } // end switch
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD
 
-#if BME280_SUPPORT == 1
-  if (IOT == HUMMSG) {
-    strcat(topic_base, "sensor/");
-    app_message[1] = 'H';
-  }
-#endif // BME280_SUPPORT == 1
 
-  if ((IOT == INPUTMSG) || (IOT == OUTPUTMSG)) {
-    // Create the pin number for the app_message and topic.
-    emb_itoa(IOT_ptr, OctetArray, 10, 2);
-    // Add pin number to payload template
-    app_message[2] = OctetArray[0];
-    app_message[3] = OctetArray[1];
-    app_message[4] = '\0';
-  }
+//--------------------------------------------------------------------------//
+// Note that the original LiamBindle MQTT-C code relied on Linux or Microsoft
+// OS processes to provide Link Level, IP, and TCP processing of received and
+// transmitted packets (via a Socket). In this bare metal application the UIP
+// code provides that processing.
+//
+// Before making an mqtt connection we need the equivalent of an OS "open a
+// socket" to the MQTT Server. This is essentially an ARP request associating
+// the MQTT Server IP Address (which we got from GUI input) with the MQTT
+// Server MAC Address, followed by creating a TCP Connection via
+// uip_connect().
+//
+// For reference: In the HTTP IO process "opening a socket" occurs in the
+// uip_input and uip_arpin functions. HTTP has the notion that a browser makes
+// a request, and the web server replies to that request, always in a
+// one-to-one relationship. When a browser on a remote host makes a request to
+// our IP address the remote host performs an ARP request (which we process
+// via the uip_arp_arpin() function). Net result is that this establishes the
+// equivalent of a "socket" with the web server on our device. Subsequent
+// browser requests cause the uip_input() function to extract the IP Addresses
+// and Port Numbers for the HTTP transaction source and destination and uses
+// those to form the needed IP and TCP headers for any transmission that needs
+// to occur. Next the uip_arp_out function is called to form a LLH header
+// (containing the source and destination MAC addresses) for the packet to be
+// transmitted.
+// 
+// The bare metal UIP application uses the same buffer for receive and
+// transmit data (the uip_buf). But the original LiamBindle MQTT-C application
+// expects an independent transmit buffer where it maintains transmit queueing
+// information AND its transmit data. The MQTT transmit buffer (mqtt_sendbuf)
+// retains transmitted messages (queue info + data) for a short time in case
+// error recovery needs to re-transmit it. When it is time to actually
+// transmit data from the mqtt_sendbuf the data is copied to the uip_buf,
+// uip_len is set > 0, and the UIP code will perform the transmission as part
+// of the uip_periodic function.
+//
+// The only messages that must be retained in the mqtt_sendbuf are the
+// CONNECT, SUBSCRIBE, and PINGREQ messages. Since the CONNECT and SUBSCRIBE
+// messages are only sent by the mqtt_startup state machine we can carefully
+// manage that state machine to make sure the ACK for each of those messages
+// is received before continuing the state machine. This means that the only
+// messages that will be retained in the mqtt_sendbuf during normal operation
+// are the PINGREQ messages. PINGREQ messages are only two bytes long. So, we
+// can minimize the size of the mqtt_sendbuf to the point that only a 2 byte
+// message and the longest of any other MQTT transmit message will fit.
+//
+// The mqtt_sendbuf always starts with a 12 byte Message Queue structure.
+// 
+// PINGREQ Msg (in the mqtt_sendbuf)
+//   Fixed Header 2 bytes
+//   Queued Message Header 11 bytes
+//   Total: 13 bytes
+//
+// Output PUBLISH Msg (in the mqtt_sendbuf)
+//   Fixed Header 2 bytes
+//   Variable Header 47 bytes
+//     Topic NetworkModule/DeviceName012345678/output/xx 43 bytes
+//     Topic Length 2 bytes
+//     Packet ID 2 bytes
+//   Queued Message Header 11 bytes
+//   Total: 60 bytes
+//
+// Temperature PUBLISH Msg (in the mqtt_sendbuf)
+//   Fixed Header 2 bytes
+//   Variable Header 51 bytes
+//     Topic NetworkModule/DeviceName012345678/temp/xx-000.0 47 bytes
+//     Topic Length 2 bytes
+//     Packet ID 2 bytes
+//   Queued Message Header 11 bytes
+//   Total: 64 bytes
+//
+// Status PUBLISH Msg (in the mqtt_sendbuf)
+//   Fixed Header 2 bytes
+//   Variable Header 57 bytes
+//     Topic NetworkModule/DeviceName123456789/availabilityoffline 53 bytes
+//     Topic Length 2 bytes
+//     Packet ID 2 bytes
+//   Queued Message Header 11 bytes
+//   Total: 70 bytes
+//   
+// The implication of the above is that in normal operation the mqtt_sendbuf
+// needs to be as large as the Message Queue (12 bytes) plus one PINGREQ
+// message (13 bytes) plus the longest Publish message (70 bytes), or 108
+// bytes.
+//
+// However, during MQTT startup the CONNECT message is even larger as follows:
+// CONNECT Msg (in the mqtt_sendbuf)
+//   Fixed Header 2 bytes
+//   Variable Header 10 bytes
+//     Length of protocol name 2 bytes
+//     Protocol name 4 bytes
+//     Protocol level 1 byte
+//     Connect flags 1 byte
+//     Keep Alive 2 bytes
+//   Payload
+//     Client ID Length 2 bytes
+//     Client ID 25 bytes
+//     Will Topic Length 2 bytes
+//     Will Topic 14+19+13 46 bytes
+//     Will Message Length 2 bytes
+//     Will Message 7 bytes
+//     Username Length 2 bytes
+//     Username 10 bytes
+//     Passwoard Length 2 bytes
+//     Password 10 bytes
+//   Queued Message Header 11 bytes
+// Total 131 bytes
+// Thus the CONNECT message can be up to up to 131 bytes in length. Add the
+// Message Queue (12 bytes) and the mqtt_sendbuf needs to be a minimum of 143
+// bytes. Note that no PINGREQ can occur during the MQTT Startup process, so
+// the CONNECT message will occupy the mqtt_sendbuf alone. This sets the
+// required size of the mqtt_sendbuf at 143 bytes ... will make it 150 to
+// provide a little extra.
+//--------------------------------------------------------------------------//
 
-#if DS18B20_SUPPORT == 1
-  if (IOT == TMPRMSG) {
-    // Create the sensor number for the app_message and topic.
-    // Add first part of sensor ID to payload template. For the DS18B20 the ID
-    // is the DS18B20 MAC address.
-    {
-      int i;
-      int j;
-      j = 2;
-      for (i=6; i>0; i--) {
-        int2hex(FoundROM[IOT_ptr][i]);
-        app_message[j++] = OctetArray[0];
-        app_message[j++] = OctetArray[1];
-      }
-      app_message[14] = '\0';
-    }
-  }
-#endif // DS18B20_SUPPORT == 1
 
-#if BME280_SUPPORT == 1
-  if (IOT == TMPRMSG || IOT == PRESMSG || IOT == HUMMSG) {
-    // Create the sensor ID for the app_message and topic.
-    // Add first part of sensor ID to payload template. For the BME280 the ID
-    // is "BME280" plus a one digit number:
-    //   0 = Temperature
-    //   1 = Pressure
-    //   2 = Humidity 
-    create_sensor_ID(IOT_ptr);
-    strcpy(&app_message[2], OctetArray);
-  }
-#endif // BME280_SUPPORT == 1
 
-  // Create the rest of the topic
-  strcat(topic_base, mac_string);
-  strcat(topic_base, "/");
-  strcat(topic_base, &app_message[2]);
-  strcat(topic_base, "/config");
-      
-  // If deleting the pin replace the app_message with NULL (never delete
-  // temperature, pressure, or humidity sensors ... let the user do that in
-  // Home Assistant).
-  if (DefOrDel == DELETE_IOT) app_message[0] = '\0';
 
-  // Send the message
-  // Note: This message will be intercepted in the mqtt_pal.c 
-  //  mqtt_pal_sendall() routine and additional payload content will
-  //  be added.
-  // This message is always published with QOS 0
-  mqtt_publish(&mqttclient,
-               topic_base,
-               app_message,
-               strlen(app_message),
-               MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
-}
-#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 
 
-#if BUILD_SUPPORT == MQTT_BUILD
-void mqtt_sanity_check(struct mqtt_client *client)
+#if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+void publish_callback(void** unused, struct mqtt_response_publish *published)
 {
-  // This is similar to a firmware restart except it is focused on restarting
-  // only the MQTT components.  The process is triggered every XX seconds IF
-  // we don't have an MQTT connection.
+  char* pBuffer;
+  uint8_t pin_value;
+  uint8_t ParseNum;
+  int i;
+  int k;
+#if PCF8574_SUPPORT == 0
+  uint16_t j;
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+  uint32_t j;
+#endif // PCF8574_SUPPORT == 1
+
+  pin_value = 0;
+  ParseNum = 0;
+  i = 0;
+  
+  // This function will be called if a "Publish" is received from the Broker.
+  // The publish message will contain a payload that, in this application,
+  // will be the output control bits.
+  //
+  // This function is applicable to Home Assistant environments.
   //
-  // Check the MQTT connection. This is limited to once every X seconds to
-  // reduce the processing consumed by restart attempts.
+  // This function is called from within the mqtt_recv() function. The data
+  // left in the uip_buf will remain there until this function completes.
   //
-  // Once triggered the sanity_check() function will cause the mqtt_startup()
-  // function to be called from the main loop which will reset the backoff if
-  // successful.
-
-  switch(mqtt_restart_step)
-  {
-  case MQTT_RESTART_IDLE:
-    // Check for a response timeout.
-    // response_timeout is typically 30 seconds, and for a sanity check we
-    // are allowing X timeouts before taking action. See the mqtt.c code.
-    // Note that the Broker ping timeout may be shorter than this response
-    // timeout. If the Broker times out first it will disconnect from this
-    // device. That should not cause a problem.
-    if (client->number_of_timeouts > 1) {
-      // Reset the timeout counter
-      client->number_of_timeouts = 0;
-      MQTT_resp_tout_counter++;
-
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("mqtt_sanity_check Response Timeout\r\n");
-#endif // DEBUG_SUPPORT == 15
+  // Dissecting the Publish message:
+  // - We know that the MQTT Headers + Payload starts at pointer uip_appdata
+  // - We know that the Fixed Header is 2 bytes
+  // - Next comes the Variable Header topic name. It is one of the following:
+  //   - First bytes contain the Topic Name. So we should expect:
+  //     - "NetworkModule/"
+  //     - "Devicename/"
+  //     - "output/"
+  //     - "xx/" (output number or 'all')
+  //     - "set"
+  //   OR
+  //     - "NetworkModule/"
+  //     - "Devicename/"
+  //     - "state-req"
+  // - We are QOS 0 so no Packet ID
+  // - Next comes the Payload
+  //   - If "Output/xx/set" we expect a payload of "ON" or "OFF"
+  //   - if "Output/all/set" we expect a payload of "ON" or "OFF"
+  //   - If "state-req" we expect no payload
+  //
+  // Once we collect the above information:
+  // - Set or clear an individual pin
+  //   OR
+  // - Loop to set or clear "all" pins
+  //   OR
+  // - Set the state_request variable
+  
+  // Set the pBuffer pointer to the start of the MQTT packet
+  
+  pBuffer = &uip_buf[MQTT_PBUF];
 
-      mqtt_restart_step = MQTT_RESTART_BEGIN;
+#if MQTT_DISCOVERY_HASH == 1
+  // Check for the Home Assistant birth message. The topic
+  // "homeassistant/status" follows the 4 header bytes and the payload
+  // "online" follows the 20 byte topic.
+  if (pBuffer[4] == 'h') {
+    if (pBuffer[24] == 'o' && pBuffer[25] == 'n') {
+      discovery_request = 1;
+#if MQTT_HA_STATUS_RESYNC == 1
+      // Every module on the broker receives the birth message. The low
+      // bits of the MAC spread the resyncs over 2 to 9 seconds.
+      resync_time = second_counter + 2 + (stored_uip_ethaddr_oct[0] & 0x07);
+#endif // MQTT_HA_STATUS_RESYNC == 1
     }
+    return;
+  }
+#endif // MQTT_DISCOVERY_HASH == 1
 
-    // Check for a graceful shutdown of the MQTT Broker, and/or a disconnect
-    // commanded by the broker (possibly the result of response timeout
-    // caused from this module). If this happens we'll be in the
-    // MQTT_START_COMPLETE state and we'll see a UIP_CLOSED. If this
-    // condition occurs it may persist for a long time.
-    if (mqtt_start == MQTT_START_COMPLETE
-     && mqtt_conn->tcpstateflags == UIP_CLOSED) {
-      MQTT_broker_dis_counter++;
+#if MQTT_PUBLISH_DISPATCH == 1
+  // With MQTT_PUBLISH_DISPATCH the topic is located with the pointer and
+  // length provided by mqtt_unpack_publish_response(). The device prefix is
+  // compared with the precomputed topic_prefix, then the remaining topic is
+  // looked up in the inbound_topic table and a single handler is run. Every
+  // topic character is checked, so stale uip_buf content can't be mistaken
+  // for a command. The handling time is kept in 10us units for the Link
+  // Error Statistics page.
+  {
+    const uint8_t *pTopic;
+    const uint8_t *pSuffix;
+    uint16_t len;
+    uint16_t start;
+    uint16_t now;
+    uint8_t command;
+    uint8_t on;
+
+    start = (uint16_t)(TIM1_CNTRH << 8);
+    start = start | TIM1_CNTRL;
+
+    command = INBOUND_NONE;
+    pTopic = published->topic_name;
+    len = published->topic_name_size;
+
+    if (len > (uint16_t)(topic_prefix_len + 1)
+     && memcmp(pTopic, topic_prefix, topic_prefix_len) == 0
+     && pTopic[topic_prefix_len] == '/') {
+      pTopic += topic_prefix_len + 1;
+      len -= topic_prefix_len + 1;
+      for (i=0; i<4; i++) {
+        if (inbound_topic[i].len == len) {
+	  pSuffix = (const uint8_t *)inbound_topic[i].suffix;
+	  for (k=0; k<len; k++) {
+	    if (pSuffix[k] == '+') {
+	      if (pTopic[k] < '0' || pTopic[k] > '9') break;
+	    }
+	    else if (pSuffix[k] != pTopic[k]) break;
+	  }
+	  if (k == len) command = inbound_topic[i].command;
+	  break;
+	}
+      }
+    }
 
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("mqtt_sanity_check Broker Disconnect\r\n");
-#endif // DEBUG_SUPPORT == 15
+    // Output commands carry an "ON" or "OFF" payload
+    on = 2;
+    if (published->application_message_size == 2
+     && ((const uint8_t *)published->application_message)[1] == 'N') on = 1;
+    if (published->application_message_size == 3
+     && ((const uint8_t *)published->application_message)[1] == 'F') on = 0;
 
-      mqtt_restart_step = MQTT_RESTART_BEGIN;
-    }
+    switch (command) {
+      case INBOUND_STATE_REQ:
+        state_request = STATE_REQUEST_RCVD;
+        break;
+      case INBOUND_STATE_REQ24:
+        state_request = STATE_REQUEST_RCVD24;
+        break;
+      case INBOUND_OUTPUT_ALL:
+        if (on == 2) break;
+#if PCF8574_SUPPORT == 0
+        k = 16;
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+	if ((stored_options1 & 0x08)) k = 24;
+	else k = 16;
+#endif // PCF8574_SUPPORT == 1
+        for (i=0; i<k; i++) mqtt_set_output((uint8_t)i, on);
+        mqtt_parse_complete = 1;
+        break;
+      case INBOUND_OUTPUT_PIN:
+        ParseNum = (uint8_t)(((pTopic[7] - '0') * 10) + (pTopic[8] - '0'));
+#if PCF8574_SUPPORT == 0
+        if (ParseNum > 0 && ParseNum < 17) {
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+        if (ParseNum > 0 && ParseNum < 25) {
+#endif // PCF8574_SUPPORT == 1
+          // Adjust Parsenum to match 0 to 15 numbering (instead of 1 to 16)
+          ParseNum--;
+          if (on != 2) mqtt_set_output(ParseNum, on);
+	  // Set the appropriate bit in MQTT_transmit to force a
+	  // publish_pinstate for this pin.
+	  j = 1;
+	  j = (j << ParseNum);
+	  MQTT_transmit = (MQTT_transmit | j);
+        }
+        mqtt_parse_complete = 1;
+        break;
+      default:
+        // Topic not recognized. The message is ignored.
+        break;
+    }
+
+    now = (uint16_t)(TIM1_CNTRH << 8);
+    now = now | TIM1_CNTRL;
+#if FREE_RUNNING_TIMEBASE == 0
+    if (now < start) now = (uint16_t)(now + 64000);
+#endif // FREE_RUNNING_TIMEBASE == 0
+    inbound_time = (uint16_t)(now - start);
+    if (inbound_time > inbound_time_max) inbound_time_max = inbound_time;
+  }
+#else // MQTT_PUBLISH_DISPATCH == 0
+  // Skip the Fixed Header Control Byte (1 byte)
+  // Skip the Fixed Header Remaining Length Byte (1 byte)
+  // Skip the Topic name length bytes (2 bytes)
+  // Skip the NetworkModule/ text (14 bytes)
+  pBuffer += 18;
+  // Skip the Devicename/ text
+  pBuffer += strlen(stored_devicename) + 1;
   
-    // Check for an MQTT error
-    // != MQTT_OK needs to be qualified with MQTT_START_COMPLETE because a
-    // not OK condition can be present prior to mqtt_connect() running.
-    if (mqtt_start == MQTT_START_COMPLETE
-     && client->error != MQTT_OK) {
-      MQTT_not_OK_counter++;
-
+  // Determine if the sub-topic is "output" or "state-req"
+  if (*pBuffer == 'o') {
+    // "output" detected
+    // Format can be any of these:
+    //  If QOS 0:
+    //   output/01/setON
+    //   output/01/setOFF
+    //   output/all/setON
+    //   output/all/setOFF
+    // In the above "ON" or "OFF" are in the payload.
 
-#if DEBUG_SUPPORT == 15
-// MQTT not OK values are all negative numbers from 0x8000 to 0x801c.
-// For debug display strip the first 4 bits, convert the remaining bits
-// using emb_itoa (as it can only handle positive numbers), then rebuild
-// the error code for display.
-// {
-// int16_t temp1;
-// UARTPrintf("mqtt_sanity_check MQTT_not_OK - Error code: 0x");
-// temp1 = client->error & 0x00ff;
-// emb_itoa(temp1, OctetArray, 16, 4);
-// OctetArray[0] = '8';
-// UARTPrintf(OctetArray);
-// UARTPrintf("\r\n");
-// }
-#endif // DEBUG_SUPPORT == 15
+    // Skip past the "output/" characters
+    pBuffer+= 7;
 
-      mqtt_restart_step = MQTT_RESTART_BEGIN;
+    // Check if output field is "all". If so, update all output 
+    // pin_control bytes to ON or OFF 
+    if (*pBuffer == 'a') {
+      // Skip past the "all/setO" part of the message.
+      // Note that an "all" message is always sent with QOS == 0.
+      pBuffer+=8;
+      // Determine if payload is ON or OFF
+      if (*pBuffer == 'N') {
+        // Turn all outputs ON
+#if PCF8574_SUPPORT == 0
+	for (i=0; i<16; i++) {
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+	if ((stored_options1 & 0x08)) k = 24;
+	else k = 16;
+        for (i=0; i<k; i++) {
+#endif // PCF8574_SUPPORT == 1
+#if LINKED_SUPPORT == 0
+	  if ((pin_control[i] & 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+          if (chk_iotype(pin_control[i], i, 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 1
+            // This is an Output
+	    Pending_pin_control[i] = (uint8_t)(pin_control[i] | 0x80);
+	  }
+	}
+      }
+      else {
+        // Turn all outputs OFF
+#if PCF8574_SUPPORT == 0
+	for (i=0; i<16; i++) {
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+	if ((stored_options1 & 0x08)) k = 24;
+	else k = 16;
+        for (i=0; i<k; i++) {
+#endif // PCF8574_SUPPORT == 1
+#if LINKED_SUPPORT == 0
+	  if ((pin_control[i] & 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+          if (chk_iotype(pin_control[i], i, 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 1
+            // This is an Output
+	    Pending_pin_control[i] = (uint8_t)(pin_control[i] & ~0x80);
+	  }
+	}
+      }
     }
-    break;
+    
+#if PCF8574_SUPPORT == 0
+    else if (*pBuffer == '0' || *pBuffer == '1') {
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+    else if (*pBuffer == '0' || *pBuffer == '1' || *pBuffer == '2') {
+#endif // PCF8574_SUPPORT == 1
+      // Output field is a digit
+      // Note that Output messages can are received with QOS == 0.
+      // Collect the IO number
+      // Parse ten's digit
+      ParseNum = (uint8_t)((*pBuffer - '0') * 10);
+      pBuffer++;
+      // Parse one's digit
+      ParseNum += (uint8_t)(*pBuffer - '0');
 
-  case MQTT_RESTART_BEGIN:
-    // MQTT restart process triggered. The process:
-    // 1) Sends an mqtt disconnect just in case there is a connection.
-    // 2) Closes the TCP connection.
-    // 3) Return to the main loop so that the MQTT start process can run.
-    // This process sets up the first two events, but the main.c loop must
-    // run so that the uip_periodic() and uip_input() functions will carry
-    // out execution of the transmit and receive steps needed.
-    mqtt_restart_step = MQTT_RESTART_DISCONNECT_START;
-    // Clear the start error indicator flags so the GUI will reflect
-    // that we are no longer in a connected state
-    mqtt_start_status = MQTT_START_NOT_STARTED;
-    break;
-      
-  case MQTT_RESTART_DISCONNECT_START:
-    mqtt_restart_step = MQTT_RESTART_DISCONNECT_WAIT;
-    // Disconnect the MQTT client
-    mqtt_disconnect(&mqttclient);
-    mqtt_sanity_ctr = 0; // Clear 50ms counter
-    break;
-  
-  case MQTT_RESTART_DISCONNECT_WAIT:
-    if (mqtt_sanity_ctr > 20) {
-      // The mqtt_disconnect() is given 1 second to be communicated before
-      // we move on to TCP close
-      mqtt_restart_step = MQTT_RESTART_TCPCLOSE;
+      // Verify ParseNum is in the correct range
+#if PCF8574_SUPPORT == 0
+      if (ParseNum > 0 && ParseNum < 17) {
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+      if (ParseNum > 0 && ParseNum < 25) {
+#endif // PCF8574_SUPPORT == 1
+        // Adjust Parsenum to match 0 to 15 numbering (instead of 1 to 16)
+        ParseNum--;
+        // Skip past the "1/setO" part of the message. If QOS == 0 there is
+        // no Packet Identifier.
+        pBuffer+=6;
+	// Determine if payload is ON or OFF
+	if (*pBuffer == 'N') {
+	  // Turn output ON (and make sure it is an output)
+#if LINKED_SUPPORT == 0
+	  if ((pin_control[ParseNum] & 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+          if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 1
+            // This is an Output
+	    Pending_pin_control[ParseNum] |= (uint8_t)0x80;
+          }
+	}
+	if (*pBuffer == 'F') {
+	  // Turn output OFF (and make sure it is an output)
+#if LINKED_SUPPORT == 0
+	  if ((pin_control[ParseNum] & 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+          if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 1
+            // This is an Output
+	    Pending_pin_control[ParseNum] &= (uint8_t)~0x80;
+          }
+	}
+	// Set the appropriate bit in MQTT_transmit to force a 
+	// publish_pinstate for this pin.
+	j = 1;
+	j = (j << ParseNum);
+	MQTT_transmit = (MQTT_transmit | j);
+      }
     }
-    break;
-
-  case MQTT_RESTART_TCPCLOSE:
-    // The way a TCP connection close SHOULD work:
-    // 1) A uip_periodic() runs and uip_process(UIP_TIMER) is called
-    // 2) If a connection is in the ESTABLISHED state (meaning a TCP
-    //    connection is open) the uip_process() will make a UIP_APPCALL.
-    // 3) UIP_APPCALL calls the MQTT or HTTP application via
-    //    uip_TcpAppHubCall()
-    // 4) Before the application returns, if it wants to close the
-    //    connection, it should call uip_close()
-    // 5) The UIP code will then go to appsend: and will know to start
-    //    the TCP close process.
-    // So, it looks like all I need to do is make sure the APPCALL performs
-    // a uip_close() before returning to the UIP code. Then the regular
-    // uip_periodic() process should get the job done.
-    //
-    // Signal uip_TcpAppHubCall() to close the TCP connection
-    mqtt_close_tcp = 1;
-    // Capture time to delay the next step
-    mqtt_sanity_ctr = 0; // Clear 50ms counter
-    mqtt_restart_step = MQTT_RESTART_TCPCLOSE_WAIT;
-    break;
+    
+    // The above code effectively did for MQTT what the POST parsing does for
+    // HTML, ie, changed the pin_control byte. So we need to set the 
+    // mqtt_parse_complete value so that the check_runtime_changes() function
+    // will perform the necessary IO actions.
+    mqtt_parse_complete = 1;
+  }
   
-  case MQTT_RESTART_TCPCLOSE_WAIT:
-    // Verify closed ... how?
-    // For the moment I'm not sure how to do this, so I will just allow
-    // enough time for it to happen. That is probably very fast, but I will
-    // allow 2 seconds.
-    if (mqtt_sanity_ctr > 40) {
-      mqtt_close_tcp = 0;
-      mqtt_sanity_ctr = 0; // Clear 50ms counter
-      mqtt_restart_step = MQTT_RESTART_SIGNAL_STARTUP;
+  // Determine if the sub-topic is "state-req" or "state_req24".
+  // This Topic should always be received at QOS 0.
+  else if (*pBuffer == 's') {
+    // "state-req" or "state-req24" detected
+    // Format is:
+    //   state-req
+    //   state-req24
+    // -------------------------------------------------------------------- //
+    // WARNING: To save flash space I don't check every sub-topic character.
+    // But I also don't clear the uip_buf. So, I could pick up on stuff left
+    // by a prevous message if not careful. In this limited application I can
+    // get away with it, but this can trip me up in the future if more
+    // messages are added.
+    // -------------------------------------------------------------------- //
+
+    // Capture the state-req command in OctetArray.
+    for (i=0; i<11; i++) {
+      OctetArray[i] = *pBuffer;
+      pBuffer++;
     }
-    break;
-    
-  case MQTT_RESTART_SIGNAL_STARTUP:
-    // Set mqtt_restart_step and mqtt_start to re-run the MQTT connection
-    // steps in the main loop
-    mqtt_restart_step = MQTT_RESTART_IDLE;
-    mqtt_start = MQTT_START_TCP_CONNECT;
-    break;
+    OctetArray[11] = 0;
     
-  } // end switch
+    if (OctetArray[8] == 'q') {
+      // Confirmed this is a state-req command
+      // Now figure out if the state-req is requesting a 16 pin output or a
+      // 24 pin output. "state-req" is for 16 pins. "state-req24" is for 24
+      // pins.
+      // Assume this is for 16 pins for the moment.
+      state_request = STATE_REQUEST_RCVD;
+      // Move the pBuffer pointer back to the end of the state-req command
+      pBuffer -= 2;
+      // Destroy 'q' in buffer so subsequent "state" messages won't be
+      // misinterpreted
+      *pBuffer = '0';
+      if ((OctetArray[9] == '2') && (OctetArray[10] == '4')) {
+        // This is a state-req24 command
+        state_request = STATE_REQUEST_RCVD24;
+        // Destroy '2' and '4' in buffer so subsequent "state" messages won't
+	// be misinterpreted
+	pBuffer++;
+        *pBuffer = '0';
+	pBuffer++;
+        *pBuffer = '0';
+      }
+    }
+  }
+  // Note: if none of the above matched the parsing we just exit without
+  // executing any functionality (the message is effectively ignored).
+#endif // MQTT_PUBLISH_DISPATCH == 1
 }
-#endif // BUILD_SUPPORT == MQTT_BUILD
-
-
-//--------------------------------------------------------------------------//
-// Note that the original LiamBindle MQTT-C code relied on Linux or Microsoft
-// OS processes to provide Link Level, IP, and TCP processing of received and
-// transmitted packets (via a Socket). In this bare metal application the UIP
-// code provides that processing.
-//
-// Before making an mqtt connection we need the equivalent of an OS "open a
-// socket" to the MQTT Server. This is essentially an ARP request associating
-// the MQTT Server IP Address (which we got from GUI input) with the MQTT
-// Server MAC Address, followed by creating a TCP Connection via
-// uip_connect().
-//
-// For reference: In the HTTP IO process "opening a socket" occurs in the
-// uip_input and uip_arpin functions. HTTP has the notion that a browser makes
-// a request, and the web server replies to that request, always in a
-// one-to-one relationship. When a browser on a remote host makes a request to
-// our IP address the remote host performs an ARP request (which we process
-// via the uip_arp_arpin() function). Net result is that this establishes the
-// equivalent of a "socket" with the web server on our device. Subsequent
-// browser requests cause the uip_input() function to extract the IP Addresses
-// and Port Numbers for the HTTP transaction source and destination and uses
-// those to form the needed IP and TCP headers for any transmission that needs
-// to occur. Next the uip_arp_out function is called to form a LLH header
-// (containing the source and destination MAC addresses) for the packet to be
-// transmitted.
-// 
-// The bare metal UIP application uses the same buffer for receive and
-// transmit data (the uip_buf). But the original LiamBindle MQTT-C application
-// expects an independent transmit buffer where it maintains transmit queueing
-// information AND its transmit data. The MQTT transmit buffer (mqtt_sendbuf)
-// retains transmitted messages (queue info + data) for a short time in case
-// error recovery needs to re-transmit it. When it is time to actually
-// transmit data from the mqtt_sendbuf the data is copied to the uip_buf,
-// uip_len is set > 0, and the UIP code will perform the transmission as part
-// of the uip_periodic function.
-//
-// The only messages that must be retained in the mqtt_sendbuf are the
-// CONNECT, SUBSCRIBE, and PINGREQ messages. Since the CONNECT and SUBSCRIBE
-// messages are only sent by the mqtt_startup state machine we can carefully
-// manage that state machine to make sure the ACK for each of those messages
-// is received before continuing the state machine. This means that the only
-// messages that will be retained in the mqtt_sendbuf during normal operation
-// are the PINGREQ messages. PINGREQ messages are only two bytes long. So, we
-// can minimize the size of the mqtt_sendbuf to the point that only a 2 byte
-// message and the longest of any other MQTT transmit message will fit.
-//
-// The mqtt_sendbuf always starts with a 12 byte Message Queue structure.
-// 
-// PINGREQ Msg (in the mqtt_sendbuf)
-//   Fixed Header 2 bytes
-//   Queued Message Header 11 bytes
-//   Total: 13 bytes
-//
-// Output PUBLISH Msg (in the mqtt_sendbuf)
-//   Fixed Header 2 bytes
-//   Variable Header 47 bytes
-//     Topic NetworkModule/DeviceName012345678/output/xx 43 bytes
-//     Topic Length 2 bytes
-//     Packet ID 2 bytes
-//   Queued Message Header 11 bytes
-//   Total: 60 bytes
-//
-// Temperature PUBLISH Msg (in the mqtt_sendbuf)
-//   Fixed Header 2 bytes
-//   Variable Header 51 bytes
-//     Topic NetworkModule/DeviceName012345678/temp/xx-000.0 47 bytes
-//     Topic Length 2 bytes
-//     Packet ID 2 bytes
-//   Queued Message Header 11 bytes
-//   Total: 64 bytes
-//
-// Status PUBLISH Msg (in the mqtt_sendbuf)
-//   Fixed Header 2 bytes
-//   Variable Header 57 bytes
-//     Topic NetworkModule/DeviceName123456789/availabilityoffline 53 bytes
-//     Topic Length 2 bytes
-//     Packet ID 2 bytes
-//   Queued Message Header 11 bytes
-//   Total: 70 bytes
-//   
-// The implication of the above is that in normal operation the mqtt_sendbuf
-// needs to be as large as the Message Queue (12 bytes) plus one PINGREQ
-// message (13 bytes) plus the longest Publish message (70 bytes), or 108
-// bytes.
-//
-// However, during MQTT startup the CONNECT message is even larger as follows:
-// CONNECT Msg (in the mqtt_sendbuf)
-//   Fixed Header 2 bytes
-//   Variable Header 10 bytes
-//     Length of protocol name 2 bytes
-//     Protocol name 4 bytes
-//     Protocol level 1 byte
-//     Connect flags 1 byte
-//     Keep Alive 2 bytes
-//   Payload
-//     Client ID Length 2 bytes
-//     Client ID 25 bytes
-//     Will Topic Length 2 bytes
-//     Will Topic 14+19+13 46 bytes
-//     Will Message Length 2 bytes
-//     Will Message 7 bytes
-//     Username Length 2 bytes
-//     Username 10 bytes
-//     Passwoard Length 2 bytes
-//     Password 10 bytes
-//   Queued Message Header 11 bytes
-// Total 131 bytes
-// Thus the CONNECT message can be up to up to 131 bytes in length. Add the
-// Message Queue (12 bytes) and the mqtt_sendbuf needs to be a minimum of 143
-// bytes. Note that no PINGREQ can occur during the MQTT Startup process, so
-// the CONNECT message will occupy the mqtt_sendbuf alone. This sets the
-// required size of the mqtt_sendbuf at 143 bytes ... will make it 150 to
-// provide a little extra.
-//--------------------------------------------------------------------------//
-
-
 
 
+#if MQTT_PUBLISH_DISPATCH == 1
+void mqtt_set_output(uint8_t pin, uint8_t on)
+{
+  // This function sets the Pending_pin_control ON/OFF bit for a pin that
+  // was the target of an output PUBLISH. Pins that are not outputs are left
+  // unchanged.
+#if LINKED_SUPPORT == 0
+  if ((pin_control[pin] & 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+  if (chk_iotype(pin_control[pin], pin, 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 1
+    // This is an Output
+    if (on) Pending_pin_control[pin] |= (uint8_t)0x80;
+    else Pending_pin_control[pin] &= (uint8_t)~0x80;
+  }
+}
+#endif // MQTT_PUBLISH_DISPATCH == 1
+#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 
 
-#if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+#if BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
 void publish_callback(void** unused, struct mqtt_response_publish *published)
 {
-  char* pBuffer;
-  uint8_t pin_value;
   uint8_t ParseNum;
+  uint8_t error;
+  uint8_t match_found;
   int i;
-  int k;
-#if PCF8574_SUPPORT == 0
-  uint16_t j;
-#endif // PCF8574_SUPPORT == 0
-#if PCF8574_SUPPORT == 1
-  uint32_t j;
-#endif // PCF8574_SUPPORT == 1
 
-  pin_value = 0;
   ParseNum = 0;
-  i = 0;
-  
-  // This function will be called if a "Publish" is received from the Broker.
-  // The publish message will contain a payload that, in this application,
-  // will be the output control bits.
-  //
-  // This function is applicable to Home Assistant environments.
+  match_found = 0;
+
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("\r\n");
+// UARTPrintf("Running publish_callback\r\n");
+#endif // DEBUG_SUPPORT == 15
+
+  // This function is applicable to Domoticz environments.
   //
-  // This function is called from within the mqtt_recv() function. The data
-  // left in the uip_buf will remain there until this function completes.
+  // This function will be called if a "Publish" is received from the Broker.
+  // Domoticz operates differently that Home Assistant in that the Publish
+  // message will have been completely received and analyzed in the
+  // mqtt_sync() process of the mqtt.c code. This is necessary because
+  // domoticz/out messages can be huge and may cross packet boundaries, which
+  // can only be accounted for if the message is processed within the
+  // mqtt_sync() function.
   //
-  // Dissecting the Publish message:
-  // - We know that the MQTT Headers + Payload starts at pointer uip_appdata
-  // - We know that the Fixed Header is 2 bytes
-  // - Next comes the Variable Header topic name. It is one of the following:
-  //   - First bytes contain the Topic Name. So we should expect:
-  //     - "NetworkModule/"
-  //     - "Devicename/"
-  //     - "output/"
-  //     - "xx/" (output number or 'all')
-  //     - "set"
-  //   OR
-  //     - "NetworkModule/"
-  //     - "Devicename/"
-  //     - "state-req"
-  // - We are QOS 0 so no Packet ID
-  // - Next comes the Payload
-  //   - If "Output/xx/set" we expect a payload of "ON" or "OFF"
-  //   - if "Output/all/set" we expect a payload of "ON" or "OFF"
-  //   - If "state-req" we expect no payload
+  // The only values that need to be extracted from a Domoticz "domoticz/out"
+  // message are the idx and nvalue values. Those are captured in the
+  // mqtt_sync() function and stored in global values idx_string and
+  // nvalue_string.
   //
-  // Once we collect the above information:
-  // - Set or clear an individual pin
-  //   OR
-  // - Loop to set or clear "all" pins
-  //   OR
-  // - Set the state_request variable
+  // In the following code we set or clear an individual pin associated with
+  // the idx value. This requires searching the idx table to determine which
+  // IOn pin is being referenced.
   
   // Set the pBuffer pointer to the start of the MQTT packet
-  
-  pBuffer = &uip_buf[MQTT_PBUF];
 
-  // Skip the Fixed Header Control Byte (1 byte)
-  // Skip the Fixed Header Remaining Length Byte (1 byte)
-  // Skip the Topic name length bytes (2 bytes)
-  // Skip the NetworkModule/ text (14 bytes)
-  pBuffer += 18;
-  // Skip the Devicename/ text
-  pBuffer += strlen(stored_devicename) + 1;
-  
-  // Determine if the sub-topic is "output" or "state-req"
-  if (*pBuffer == 'o') {
-    // "output" detected
-    // Format can be any of these:
-    //  If QOS 0:
-    //   output/01/setON
-    //   output/01/setOFF
-    //   output/all/setON
-    //   output/all/setOFF
-    // In the above "ON" or "OFF" are in the payload.
+  i = 0;
+  error = 0;
 
-    // Skip past the "output/" characters
-    pBuffer+= 7;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("idx_string = ");
+// UARTPrintf(idx_string);
+// UARTPrintf("\r\n");
+// UARTPrintf("nvalue_string = ");
+// UARTPrintf(nvalue_string);
+// UARTPrintf("\r\n");
+#endif // DEBUG_SUPPORT == 15
 
-    // Check if output field is "all". If so, update all output 
-    // pin_control bytes to ON or OFF 
-    if (*pBuffer == 'a') {
-      // Skip past the "all/setO" part of the message.
-      // Note that an "all" message is always sent with QOS == 0.
-      pBuffer+=8;
-      // Determine if payload is ON or OFF
-      if (*pBuffer == 'N') {
-        // Turn all outputs ON
+  if (idx_string[0] == '\0') error = 1;
+  if (nvalue_string[0] == '\0') error = 1;
+
+  if (error == 0) {
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("Starting IO_NAME search\r\n");
+#endif // DEBUG_SUPPORT == 15
+    // If no error was found then the idx and nvalue were captured.
+    // Search the idx table to determine which pin has been set or cleared.
+    // The idx table is stored in the same space normally used to store
+    // pin names.
+    
+    // Assumption is that the idx value is never greater than 6 digits and
+    // there are no leading zeroes.
+    match_found = 0;
+    for (i=0; i<16; i++) {
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("IO_NAME = ");
+// UARTPrintf(IO_NAME[i]);
+// UARTPrintf("\r\n");
+#endif // DEBUG_SUPPORT == 15
+      if (strcmp(idx_string, IO_NAME[i]) == 0) {
+        // Found a match
+	match_found = 1;
+	ParseNum = (uint8_t)i;
+	break;
+      }
+    }
+    
+#if PCF8574_SUPPORT == 1
+    {
+      int j;
+      char temp_byte[16];
+      for (i=16; i<24; i++) {
+        // Read a PCF8574_IO_NAME value from I2C EEPROM
+        prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, PCF8574_I2C_EEPROM_START_IO_NAMES + ((i - 16) * 16), 2);
+        for (j=0; j<15; j++) {
+          temp_byte[j] = I2C_read_byte(0);
+        }
+        temp_byte[15] = I2C_read_byte(1);
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("IO_NAME = ");
+// UARTPrintf(temp_byte);
+// UARTPrintf("\r\n");
+#endif // DEBUG_SUPPORT == 15
+        if (strcmp(idx_string, temp_byte) == 0) {
+          // Found a match
+	  match_found = 1;
+	  ParseNum = (uint8_t)i;
+	  break;
+        }
+      }
+    }
+#endif // PCF8574_SUPPORT == 1
+    
+    if (match_found == 0) {
+      // Do nothing. The idx value is bogus.
+    
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("\r\n");
+// UARTPrintf("No idx match found\r\n");
+#endif // DEBUG_SUPPORT == 15
+
+    }
+  }
+
+  if (match_found == 1) {
+    // Verify ParseNum is in the correct range
+    ParseNum++; // Add 1 to Parsenum for the following check
 #if PCF8574_SUPPORT == 0
-	for (i=0; i<16; i++) {
+    if (ParseNum > 0 && ParseNum < 17) {
 #endif // PCF8574_SUPPORT == 0
 #if PCF8574_SUPPORT == 1
-	if ((stored_options1 & 0x08)) k = 24;
-	else k = 16;
-        for (i=0; i<k; i++) {
+    if (ParseNum > 0 && ParseNum < 25) {
 #endif // PCF8574_SUPPORT == 1
+      ParseNum--; // Subtract one from ParseNum to use it as an array index
+      // Determine if payload is ON or OFF
+      if (nvalue_string[0] == '0') {
+        // Turn output OFF (and make sure it is an output)
 #if LINKED_SUPPORT == 0
-	  if ((pin_control[i] & 0x03) == 0x03) {
+        if ((pin_control[ParseNum] & 0x03) == 0x03) {
 #endif // LINKED_SUPPORT == 0
 #if LINKED_SUPPORT == 1
-          if (chk_iotype(pin_control[i], i, 0x03) == 0x03) {
+        if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
 #endif // LINKED_SUPPORT == 1
-            // This is an Output
-	    Pending_pin_control[i] = (uint8_t)(pin_control[i] | 0x80);
-	  }
-	}
+          // This is an Output
+	  Pending_pin_control[ParseNum] &= (uint8_t)~0x80;
+        }
       }
       else {
-        // Turn all outputs OFF
-#if PCF8574_SUPPORT == 0
-	for (i=0; i<16; i++) {
-#endif // PCF8574_SUPPORT == 0
-#if PCF8574_SUPPORT == 1
-	if ((stored_options1 & 0x08)) k = 24;
-	else k = 16;
-        for (i=0; i<k; i++) {
-#endif // PCF8574_SUPPORT == 1
+        // Turn output ON (and make sure it is an output)
 #if LINKED_SUPPORT == 0
-	  if ((pin_control[i] & 0x03) == 0x03) {
+	if ((pin_control[ParseNum] & 0x03) == 0x03) {
 #endif // LINKED_SUPPORT == 0
 #if LINKED_SUPPORT == 1
-          if (chk_iotype(pin_control[i], i, 0x03) == 0x03) {
+        if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
 #endif // LINKED_SUPPORT == 1
-            // This is an Output
-	    Pending_pin_control[i] = (uint8_t)(pin_control[i] & ~0x80);
-	  }
-	}
+          // This is an Output
+	  Pending_pin_control[ParseNum] |= (uint8_t)0x80;
+        }
+      }
+      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+      // The below doesn't look right. I set the MQTT_transmit which will
+      // force a transmit. But I also changed the Pending_pin_control which
+      // when processed will also cause a transmit. If timing doesn't work
+      // out well we will have a double transmit?
+      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
+      // Set the appropriate bit in MQTT_transmit to force a 
+      // publish_pinstate for this pin.
+      {
+        uint32_t pin_index;
+        pin_index = 1;
+        pin_index = (pin_index << ParseNum);
+        MQTT_transmit = (MQTT_transmit | pin_index);
       }
     }
+  }
     
-#if PCF8574_SUPPORT == 0
-    else if (*pBuffer == '0' || *pBuffer == '1') {
-#endif // PCF8574_SUPPORT == 0
-#if PCF8574_SUPPORT == 1
-    else if (*pBuffer == '0' || *pBuffer == '1' || *pBuffer == '2') {
-#endif // PCF8574_SUPPORT == 1
-      // Output field is a digit
-      // Note that Output messages can are received with QOS == 0.
-      // Collect the IO number
-      // Parse ten's digit
-      ParseNum = (uint8_t)((*pBuffer - '0') * 10);
-      pBuffer++;
-      // Parse one's digit
-      ParseNum += (uint8_t)(*pBuffer - '0');
+  // The above code effectively did for MQTT what the POST parsing does for
+  // HTML, ie, changed the pin_control byte. So we need to set the 
+  // mqtt_parse_complete value so that the check_runtime_changes() function
+  // will perform the necessary IO actions.
+  mqtt_parse_complete = 1;
+  // Note: if none of the above matched the parsing we just exit without
+  // executing any functionality (the message is effectively ignored).
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
 
-      // Verify ParseNum is in the correct range
-#if PCF8574_SUPPORT == 0
-      if (ParseNum > 0 && ParseNum < 17) {
-#endif // PCF8574_SUPPORT == 0
+
+#if UDP_CONTROL_SUPPORT == 1
+static void udp_put32(uint8_t *p, uint32_t value)
+{
+  // Store a 32 bit value MSB first
+  p[0] = (uint8_t)(value >> 24);
+  p[1] = (uint8_t)(value >> 16);
+  p[2] = (uint8_t)(value >> 8);
+  p[3] = (uint8_t)value;
+}
+
+
+void udp_control_call(void)
+{
+  // This function is called by the uip.c code (via UIP_UDP_APPCALL) for each
+  // datagram received on UDP_CONTROL_PORT. The request is at uip_appdata
+  // with uip_len bytes. The reply is written over the request and uip_slen
+  // is set to its length.
+  //
+  // Request:  [cmd] [seq] [data ...]
+  // Reply:    [cmd | 0x80] [seq] [status] [data ...]
+  //   seq is returned unchanged so that a poller can match replies to
+  //   requests.
+  //   status 0 = OK, 1 = bad request, 2 = Response Lock is ON (no data)
+  //   All multi-byte values are sent MSB first. Pin bit 0 is IO 1.
+  //
+  // cmd 0x01 Read pins
+  //   Reply data: [ON_OFF_word 4] [output mask 4]
+  //   The output mask has a 1 for every enabled Output pin.
+  // cmd 0x02 Set outputs
+  //   Request data: [mask 4] [values 4]
+  //   Each pin with a 1 in mask is turned ON or OFF per values. Pins that
+  //   are not enabled Outputs are ignored. The pins change when the main
+  //   loop next runs check_runtime_changes(), so the reply is the same as
+  //   for cmd 0x01 but shows the pin states before the change.
+  // cmd 0x03 Read sensors
+  //   Reply data: [valid 1] [DS18B20 x 5, 2 each] [BME280 temperature 4]
+  //               [BME280 pressure 4] [BME280 humidity 4]
+  //   valid bit 0 = DS18B20 values present, bit 1 = BME280 values present.
+  //   DS18B20 values are the raw sensor readings in 1/16 degree C. BME280
+  //   values are the compensated readings. Fields not present are 0.
+  // cmd 0x04 Read statistics
+  //   Reply data: [second_counter 4] [TRANSMIT_counter 4] [TXERIF 1]
+  //               [RXERIF 1] [MQTT_resp_tout_counter 1]
+  //               [MQTT_not_OK_counter 1] [MQTT_broker_dis_counter 1]
+  // cmd 0x05 Set telemetry collector (UDP_TELEMETRY_SUPPORT)
+  //   Request data: [interval 1]
+  //   The sender's address and port become the collector, and a telemetry
+  //   datagram is sent to it every interval seconds (0 = stop). The
+  //   setting is kept in EEPROM. Reply data: none.
+  //   See telemetry_send() for the telemetry datagram.
+  // cmd 0x06 Multicast groups (MULTICAST_GROUP_SUPPORT)
+  //   Request data: none to read the groups, or [group 1 4] [group 2 4] to
+  //   join them. 0.0.0.0 leaves a group unused, other addresses must be
+  //   224.0.0.0 to 239.255.255.255. The groups are kept in EEPROM.
+  //   Reply data: [group 1 4] [group 2 4]
+  // cmd 0x07 Read DHCP lease (DHCP_SUPPORT)
+  //   Reply data: [state 1] [address 4] [netmask 4] [router 4] [server 4]
+  //   state is the DHCP_ client state (0 = static addresses), the lease is
+  //   the one kept in Flash.
+  //
+  // Group commands: Any request sent to a joined multicast group is
+  // processed the same way, but no reply is sent. A cmd 0x02 sent to a
+  // group switches the outputs of all the modules in it at once. As there
+  // is no reply a sender may send each group command several times. The
+  // copies are ignored while seq is the same as in the last group command,
+  // so the sender must change seq for each new command.
+  extern uint16_t uip_slen;
+  uint8_t *pBuffer;
+  uint32_t mask;
+  uint32_t values;
+  uint8_t num_pins;
+  uint8_t i;
+
+  pBuffer = (uint8_t *)uip_appdata;
+  if (uip_len < 2) return; // Too short to reply to
+
+  num_pins = 16;
 #if PCF8574_SUPPORT == 1
-      if (ParseNum > 0 && ParseNum < 25) {
+  if (stored_options1 & 0x08) num_pins = 24;
 #endif // PCF8574_SUPPORT == 1
-        // Adjust Parsenum to match 0 to 15 numbering (instead of 1 to 16)
-        ParseNum--;
-        // Skip past the "1/setO" part of the message. If QOS == 0 there is
-        // no Packet Identifier.
-        pBuffer+=6;
-	// Determine if payload is ON or OFF
-	if (*pBuffer == 'N') {
-	  // Turn output ON (and make sure it is an output)
+
+  // The status byte is written by each command as it overlays the first
+  // request data byte.
+  pBuffer[0] |= 0x80;
+  uip_slen = 3;
+
+#if RESPONSE_LOCK_SUPPORT == 1
+  if ((stored_options1 & 0x40) == 0x40) {
+    // Response Lock is ON. Like the /xx commands nothing is changed or
+    // reported.
+    pBuffer[2] = 2;
+    return;
+  }
+#endif // RESPONSE_LOCK_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+  if (uip_mcast_rx) {
+    // Process only the first copy of a group command
+    if (pBuffer[1] == mcast_last_seq) return;
+    mcast_last_seq = pBuffer[1];
+  }
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+  switch (pBuffer[0] & 0x7f) {
+    case 0x02:
+      if (uip_len < 10) {
+        pBuffer[2] = 1;
+        return;
+      }
+      mask = ((uint32_t)pBuffer[2] << 24) | ((uint32_t)pBuffer[3] << 16)
+           | ((uint32_t)pBuffer[4] << 8) | pBuffer[5];
+      values = ((uint32_t)pBuffer[6] << 24) | ((uint32_t)pBuffer[7] << 16)
+             | ((uint32_t)pBuffer[8] << 8) | pBuffer[9];
+      for (i = 0; i < num_pins; i++) {
+        if (mask & ((uint32_t)1 << i)) {
+          update_ON_OFF(i, (uint8_t)((values >> i) & 1));
+        }
+      }
+      // Fall through to return the pin states
+
+    case 0x01:
+      pBuffer[2] = 0;
+      mask = 0;
+      for (i = 0; i < num_pins; i++) {
 #if LINKED_SUPPORT == 0
-	  if ((pin_control[ParseNum] & 0x03) == 0x03) {
+        if ((pin_control[i] & 0x03) == 0x03) mask |= ((uint32_t)1 << i);
 #endif // LINKED_SUPPORT == 0
 #if LINKED_SUPPORT == 1
-          if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
+        if (chk_iotype(pin_control[i], i, 0x03) == 0x03) mask |= ((uint32_t)1 << i);
 #endif // LINKED_SUPPORT == 1
-            // This is an Output
-	    Pending_pin_control[ParseNum] |= (uint8_t)0x80;
+      }
+      udp_put32(&pBuffer[3], (uint32_t)ON_OFF_word);
+      udp_put32(&pBuffer[7], mask);
+      uip_slen = 11;
+      break;
+
+    case 0x03:
+      memset(&pBuffer[2], 0, 24);
+#if DS18B20_SUPPORT == 1
+      if (stored_config_settings & 0x08) {
+        pBuffer[3] |= 0x01;
+        for (i = 0; i < 5; i++) {
+          pBuffer[4 + (i * 2)] = DS18B20_scratch[i][1];
+          pBuffer[5 + (i * 2)] = DS18B20_scratch[i][0];
+        }
+      }
+#endif // DS18B20_SUPPORT == 1
+#if BME280_SUPPORT == 1
+      if ((BME280_found == 1) && (stored_config_settings & 0x20)) {
+        pBuffer[3] |= 0x02;
+        udp_put32(&pBuffer[14], (uint32_t)comp_data_temperature);
+        udp_put32(&pBuffer[18], (uint32_t)comp_data_pressure);
+        udp_put32(&pBuffer[22], (uint32_t)comp_data_humidity);
+      }
+#endif // BME280_SUPPORT == 1
+      uip_slen = 26;
+      break;
+
+    case 0x04:
+      pBuffer[2] = 0;
+      udp_put32(&pBuffer[3], second_counter);
+      udp_put32(&pBuffer[7], TRANSMIT_counter);
+      pBuffer[11] = debug_bytes[3];
+      pBuffer[12] = debug_bytes[4];
+      pBuffer[13] = MQTT_resp_tout_counter;
+      pBuffer[14] = MQTT_not_OK_counter;
+      pBuffer[15] = MQTT_broker_dis_counter;
+      uip_slen = 16;
+      break;
+
+#if UDP_TELEMETRY_SUPPORT == 1
+    case 0x05:
+      if (uip_len < 3) {
+        pBuffer[2] = 1;
+        return;
+      }
+      {
+        struct uip_udpip_hdr *pHeader;
+        pHeader = (struct uip_udpip_hdr *)&uip_buf[UIP_LLH_LEN];
+        unlock_eeprom();
+        memcpy(&stored_telemetry_addr[0], &pHeader->srcipaddr[0], 4);
+        stored_telemetry_port = pHeader->srcport;
+        stored_telemetry_interval = pBuffer[2];
+        lock_eeprom();
+      }
+      // Send the first datagram at the next telemetry_send() check
+      telemetry_sent = second_counter - pBuffer[2];
+      pBuffer[2] = 0;
+      break;
+#endif // UDP_TELEMETRY_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+    case 0x06:
+      if (uip_len != 2) {
+        if (uip_len != 10) {
+          pBuffer[2] = 1;
+          return;
+        }
+        for (i = 0; i < 2; i++) {
+          if ((pBuffer[2 + (i * 4)] != 0 || pBuffer[3 + (i * 4)] != 0
+            || pBuffer[4 + (i * 4)] != 0 || pBuffer[5 + (i * 4)] != 0)
+           && (pBuffer[2 + (i * 4)] & 0xf0) != 0xe0) {
+            pBuffer[2] = 1;
+            return;
           }
-	}
-	if (*pBuffer == 'F') {
-	  // Turn output OFF (and make sure it is an output)
+        }
+        if (memcmp(&stored_mcast_group[0], &pBuffer[2], 8) != 0) {
+          unlock_eeprom();
+          memcpy(&stored_mcast_group[0], &pBuffer[2], 8);
+          lock_eeprom();
+        }
+        memcpy(uip_mcast_groups, &stored_mcast_group[0], 8);
+        Enc28j60JoinGroups();
+        // Report the new groups at the next mcast_service() check
+        mcast_report_sent = second_counter - MCAST_REPORT_INTERVAL;
+      }
+      pBuffer[2] = 0;
+      memcpy(&pBuffer[3], &stored_mcast_group[0], 8);
+      uip_slen = 11;
+      break;
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+#if DHCP_SUPPORT == 1
+    case 0x07:
+      pBuffer[2] = 0;
+      pBuffer[3] = dhcp_state;
+      memcpy(&pBuffer[4], &dhcp_lease[0], 16);
+      uip_slen = 20;
+      break;
+#endif // DHCP_SUPPORT == 1
+
+    default:
+      pBuffer[2] = 1;
+      break;
+  }
+}
+
+
+#if UDP_TELEMETRY_SUPPORT == 1
+static void udp_put16(uint8_t *p, uint16_t value)
+{
+  // Store a 16 bit value MSB first
+  p[0] = (uint8_t)(value >> 8);
+  p[1] = (uint8_t)value;
+}
+
+
+void telemetry_send(void)
+{
+  // Called from the main loop. Every stored_telemetry_interval seconds a
+  // datagram with the runtime statistics is sent from UDP_CONTROL_PORT to
+  // the collector set with cmd 0x05. It has the same layout as a reply:
+  //   [0x86] [seq] [0] [data ...]
+  //   seq counts the datagrams so the collector can see losses.
+  //   All multi-byte values are sent MSB first.
+  //   Data:
+  //   3      Valid: bit 0 uIP statistics, bit 1 loop profile,
+  //          bit 2 RAM headroom
+  //   4-7    second_counter
+  //   8-11   TRANSMIT_counter
+  //   12     TXERIF count      13  RXERIF count
+  //   14     MQTT_resp_tout_counter
+  //   15     MQTT_not_OK_counter
+  //   16     MQTT_broker_dis_counter
+  //   17-52  uIP statistics, 4 each: ip.recv, ip.sent, ip.drop, tcp.recv,
+  //          tcp.sent, tcp.drop, tcp.rexmit, tcp.chkerr, tcp.rst
+  //          (NETWORK_STATISTICS, Browser builds)
+  //   53-68  Loop profile maximum of each phase, 2 each in 10us units
+  //          (LOOP_PROFILER, see PROFILE_RECEIVE ... PROFILE_LOOP)
+  //   69-76  Most stack used, largest uip_buf frame, most mqtt_sendbuf
+  //          used, largest MQTT Partial Buffer message, 2 each
+  //          (RAM_HEADROOM_STATISTICS)
+  //   Fields not valid in the build are 0.
+  // The datagram is only sent when the uip_buf is free. If the collector is
+  // not in the ARP table the datagram is replaced by an ARP request and the
+  // next interval is sent normally.
+  uint8_t *pBuffer;
+  uip_ipaddr_t collector;
+#if LOOP_PROFILER == 1
+  uint8_t i;
+#endif // LOOP_PROFILER == 1
+
+  if (stored_telemetry_interval == 0 || uip_len != 0) return;
+  if ((uint32_t)(second_counter - telemetry_sent) < stored_telemetry_interval) return;
+  telemetry_sent = second_counter;
+
+  pBuffer = &uip_buf[UIP_LLH_LEN + UIP_IPUDPH_LEN];
+  memset(pBuffer, 0, 77);
+  pBuffer[0] = 0x86;
+  pBuffer[1] = ++telemetry_seq;
+  udp_put32(&pBuffer[4], second_counter);
+  udp_put32(&pBuffer[8], TRANSMIT_counter);
+  pBuffer[12] = debug_bytes[3];
+  pBuffer[13] = debug_bytes[4];
+  pBuffer[14] = MQTT_resp_tout_counter;
+  pBuffer[15] = MQTT_not_OK_counter;
+  pBuffer[16] = MQTT_broker_dis_counter;
+#if NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
+  pBuffer[3] |= 0x01;
+  udp_put32(&pBuffer[17], uip_stat.ip.recv);
+  udp_put32(&pBuffer[21], uip_stat.ip.sent);
+  udp_put32(&pBuffer[25], uip_stat.ip.drop);
+  udp_put32(&pBuffer[29], uip_stat.tcp.recv);
+  udp_put32(&pBuffer[33], uip_stat.tcp.sent);
+  udp_put32(&pBuffer[37], uip_stat.tcp.drop);
+  udp_put32(&pBuffer[41], uip_stat.tcp.rexmit);
+  udp_put32(&pBuffer[45], uip_stat.tcp.chkerr);
+  udp_put32(&pBuffer[49], uip_stat.tcp.rst);
+#endif // NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
+#if LOOP_PROFILER == 1
+  pBuffer[3] |= 0x02;
+  for (i = 0; i < PROFILE_PHASES; i++) {
+    udp_put16(&pBuffer[53 + (i * 2)], profile[i].max);
+  }
+#endif // LOOP_PROFILER == 1
+#if RAM_HEADROOM_STATISTICS == 1
+  pBuffer[3] |= 0x04;
+  udp_put16(&pBuffer[69], stack_peak());
+  udp_put16(&pBuffer[71], uip_buf_peak);
+#if BUILD_SUPPORT == MQTT_BUILD
+  udp_put16(&pBuffer[73], mqtt_sendbuf_peak);
+  udp_put16(&pBuffer[75], mqtt_pbuf_peak);
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // RAM_HEADROOM_STATISTICS == 1
+
+  memcpy(&collector[0], &stored_telemetry_addr[0], 4);
+  uip_udp_build(collector, stored_telemetry_port, HTONS(UDP_CONTROL_PORT), 77);
+  uip_arp_out(); // Verifies arp entry in the ARP table and builds
+                 // the LLH
+  Enc28j60Send(uip_buf, uip_len);
+  uip_len = 0;
+}
+#endif // UDP_TELEMETRY_SUPPORT == 1
+
+
+#if MULTICAST_GROUP_SUPPORT == 1
+void mcast_service(void)
+{
+  // Called from the main loop. Every MCAST_REPORT_INTERVAL seconds an IGMPv2
+  // Membership Report is sent for each group joined, so that IGMP snooping
+  // switches keep forwarding the group to this port. Unsolicited reports
+  // at less than the Query Interval (125 seconds) keep the membership
+  // without parsing the Queries. A group that is no longer joined times
+  // out in the switch.
+  uint8_t i;
+
+  if (uip_len != 0) return;
+  if ((uint32_t)(second_counter - mcast_report_sent) < MCAST_REPORT_INTERVAL) return;
+  mcast_report_sent = second_counter;
+
+  for (i = 0; i < UIP_MCAST_GROUPS; i++) {
+    if (uip_mcast_groups[i][0] == 0) continue;
+    uip_igmp_report(uip_mcast_groups[i]);
+    uip_arp_out(); // Builds the LLH with the group MAC address
+    Enc28j60Send(uip_buf, uip_len);
+    uip_len = 0;
+  }
+}
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+
+#if DHCP_SUPPORT == 1
+static void dhcp_static(void)
+{
+  // Use the static addresses from the Configuration page
+  uip_ipaddr_t IpAddr;
+
+  uip_ipaddr(IpAddr,
+             stored_hostaddr[3],
+             stored_hostaddr[2],
+             stored_hostaddr[1],
+             stored_hostaddr[0]);
+  uip_sethostaddr(IpAddr);
+  uip_ipaddr(IpAddr,
+             stored_draddr[3],
+             stored_draddr[2],
+             stored_draddr[1],
+             stored_draddr[0]);
+  uip_setdraddr(IpAddr);
+  uip_ipaddr(IpAddr,
+             stored_netmask[3],
+             stored_netmask[2],
+             stored_netmask[1],
+             stored_netmask[0]);
+  uip_setnetmask(IpAddr);
+}
+
+
+static void dhcp_save(uint8_t *lease)
+{
+  // Write the 16 byte lease to Flash. To reduce Flash wear only the 4 byte
+  // words that changed are written (see the IO_TIMER update).
+  uint8_t i;
+
+  unlock_flash();
+  for (i = 0; i < 16; i += 4) {
+    if (memcmp(&dhcp_lease[i], &lease[i], 4) != 0) {
+      // Enable Word Write Once
+      FLASH_CR2 |= FLASH_CR2_WPRG;
+      FLASH_NCR2 &= (uint8_t)(~FLASH_NCR2_NWPRG);
+      memcpy(&dhcp_lease[i], &lease[i], 4);
+    }
+  }
+  lock_flash();
+}
+
+
+void dhcp_init(void)
+{
+  // Called from check_eeprom_settings() after the static addresses are set.
+  // If DHCP is enabled (stored_options2 bit 5) and a lease is stored it is
+  // used at once, and dhcp_service() asks the server to confirm it. Without
+  // a stored lease the static addresses are used until a DISCOVER is
+  // answered.
+  dhcp_state = DHCP_OFF;
+  if ((stored_options2 & 0x20) == 0) return;
+
+  // Start the transaction IDs at a value unique to this module
+  dhcp_xid = ((uint32_t)uip_ethaddr.addr[2] << 24)
+           | ((uint32_t)uip_ethaddr.addr[3] << 16)
+           | ((uint32_t)uip_ethaddr.addr[4] << 8)
+           | uip_ethaddr.addr[5];
+  dhcp_xid += second_counter;
+
+  if (dhcp_lease[0] != 0 && dhcp_lease[4] != 0) {
+    memcpy(uip_hostaddr, &dhcp_lease[0], 4);
+    memcpy(uip_netmask, &dhcp_lease[4], 4);
+    memcpy(uip_draddr, &dhcp_lease[8], 4);
+    dhcp_state = DHCP_REBOOTING;
+  }
+  else dhcp_state = DHCP_SELECTING;
+  dhcp_retry = DHCP_RETRY_MIN;
+  dhcp_time = second_counter;
+  dhcp_wait = 0;
+}
+
+
+static void dhcp_send(uint8_t type)
+{
+  // Build a DISCOVER (type 1) or REQUEST (type 3) in the uip_buf and send
+  // it to the broadcast address. The BROADCAST flag is not set, so servers
+  // send their replies to the module's MAC address and they pass every
+  // receive filter profile. Only a renewal has a client address; the
+  // other messages are sent from 0.0.0.0.
+  uint8_t *pBuffer;
+  uint8_t *p;
+  uint8_t i;
+  uip_ipaddr_t IpAddr;
+  uip_ipaddr_t hostaddr;
+
+  pBuffer = &uip_buf[UIP_LLH_LEN + UIP_IPUDPH_LEN];
+  memset(pBuffer, 0, DHCP_MSG_LEN);
+  pBuffer[0] = 1; // BOOTREQUEST
+  pBuffer[1] = 1; // Ethernet
+  pBuffer[2] = 6; // MAC address length
+  udp_put32(&pBuffer[4], dhcp_xid);
+  if (dhcp_state == DHCP_RENEWING) memcpy(&pBuffer[12], uip_hostaddr, 4);
+  memcpy(&pBuffer[28], &uip_ethaddr.addr[0], 6);
+
+  p = &pBuffer[236];
+  *p++ = 99; // Magic cookie
+  *p++ = 130;
+  *p++ = 83;
+  *p++ = 99;
+  *p++ = 53; // Message type
+  *p++ = 1;
+  *p++ = type;
+  if (dhcp_state == DHCP_REQUESTING || dhcp_state == DHCP_REBOOTING) {
+    *p++ = 50; // Requested address
+    *p++ = 4;
+    if (dhcp_state == DHCP_REQUESTING) memcpy(p, &dhcp_offer[0], 4);
+    else memcpy(p, &dhcp_lease[0], 4);
+    p += 4;
+  }
+  if (dhcp_state == DHCP_REQUESTING) {
+    *p++ = 54; // Server identifier
+    *p++ = 4;
+    memcpy(p, &dhcp_offer[4], 4);
+    p += 4;
+  }
+  for (i = 0; i < 20 && stored_devicename[i] != 0; i++) {}
+  if (i != 0) {
+    *p++ = 12; // Host name
+    *p++ = i;
+    memcpy(p, &stored_devicename[0], i);
+    p += i;
+  }
+  *p++ = 55; // Parameter request list: netmask, router, lease time
+  *p++ = 3;
+  *p++ = 1;
+  *p++ = 3;
+  *p++ = 51;
+  *p = 255; // End
+
+  uip_ipaddr_copy(hostaddr, uip_hostaddr);
+  if (dhcp_state != DHCP_RENEWING) uip_ipaddr(uip_hostaddr, 0, 0, 0, 0);
+  uip_ipaddr(IpAddr, 255, 255, 255, 255);
+  uip_udp_build(IpAddr, HTONS(DHCPC_SERVER_PORT), HTONS(DHCPC_CLIENT_PORT), DHCP_MSG_LEN);
+  uip_ipaddr_copy(uip_hostaddr, hostaddr);
+  uip_arp_out(); // Builds the LLH with the broadcast MAC address
+  Enc28j60Send(uip_buf, uip_len);
+  uip_len = 0;
+}
+
+
+void dhcp_call(void)
+{
+  // Called by the uip.c code (via UIP_DHCP_APPCALL) for each datagram
+  // received on DHCPC_CLIENT_PORT. Replies that are not for the current
+  // transaction are ignored.
+  //   OFFER  while selecting: request the offered address at once.
+  //   ACK    for any request: use the lease, keep it in Flash if it
+  //          changed, and renew it at half the lease time.
+  //   NAK    for any request: forget the lease, return to the static
+  //          addresses and DISCOVER.
+  // Options not present in an ACK keep the current values.
+  uint8_t *pBuffer;
+  uint8_t *p;
+  uint8_t *pEnd;
+  uint8_t type;
+  uint8_t lease[16];
+  uint32_t lease_time;
+
+  pBuffer = (uint8_t *)uip_appdata;
+  if (dhcp_state == DHCP_OFF || dhcp_state == DHCP_BOUND) return;
+  if (uip_len < 240 || pBuffer[0] != 2) return;
+  if (pBuffer[4] != (uint8_t)(dhcp_xid >> 24) || pBuffer[5] != (uint8_t)(dhcp_xid >> 16)
+   || pBuffer[6] != (uint8_t)(dhcp_xid >> 8) || pBuffer[7] != (uint8_t)dhcp_xid) return;
+  if (memcmp(&pBuffer[28], &uip_ethaddr.addr[0], 6) != 0) return;
+  if (pBuffer[236] != 99 || pBuffer[237] != 130 || pBuffer[238] != 83 || pBuffer[239] != 99) return;
+
+  type = 0;
+  lease_time = 0xffffffffUL;
+  memcpy(&lease[0], &pBuffer[16], 4);
+  memcpy(&lease[4], uip_netmask, 4);
+  memcpy(&lease[8], uip_draddr, 4);
+  memcpy(&lease[12], &dhcp_lease[12], 4);
+  p = &pBuffer[240];
+  pEnd = pBuffer + uip_len;
+  while (p < pEnd && *p != 255) {
+    if (*p == 0) {
+      // Pad
+      p++;
+      continue;
+    }
+    if (p + 2 > pEnd || p + 2 + p[1] > pEnd) break;
+    if (p[1] >= 4) {
+      if (p[0] == 1) memcpy(&lease[4], &p[2], 4);
+      if (p[0] == 3) memcpy(&lease[8], &p[2], 4);
+      if (p[0] == 54) memcpy(&lease[12], &p[2], 4);
+      if (p[0] == 51) {
+        lease_time = ((uint32_t)p[2] << 24) | ((uint32_t)p[3] << 16)
+                   | ((uint32_t)p[4] << 8) | p[5];
+      }
+    }
+    if (p[0] == 53 && p[1] == 1) type = p[2];
+    p += 2 + p[1];
+  }
+
+  if (type == 2 && dhcp_state == DHCP_SELECTING) {
+    // OFFER
+    memcpy(&dhcp_offer[0], &lease[0], 4);
+    memcpy(&dhcp_offer[4], &lease[12], 4);
+    dhcp_state = DHCP_REQUESTING;
+    dhcp_retry = DHCP_RETRY_MIN;
+    dhcp_wait = 0;
+  }
+  else if (type == 5 && dhcp_state != DHCP_SELECTING) {
+    // ACK
+    if (memcmp(&dhcp_lease[0], &lease[0], 16) != 0) dhcp_save(lease);
+    memcpy(uip_hostaddr, &lease[0], 4);
+    memcpy(uip_netmask, &lease[4], 4);
+    memcpy(uip_draddr, &lease[8], 4);
+    dhcp_state = DHCP_BOUND;
+    dhcp_lease_time = lease_time;
+    dhcp_bound = second_counter;
+    dhcp_time = second_counter;
+    dhcp_wait = lease_time / 2;
+  }
+  else if (type == 6 && dhcp_state != DHCP_SELECTING) {
+    // NAK
+    memset(&lease[0], 0, 16);
+    dhcp_save(lease);
+    dhcp_static();
+    dhcp_state = DHCP_SELECTING;
+    dhcp_xid++;
+    dhcp_retry = DHCP_RETRY_MIN;
+    dhcp_wait = 0;
+  }
+}
+
+
+void dhcp_service(void)
+{
+  // Called from the main loop. Sends the DHCP message for the current state
+  // when it is due, and retransmits it every DHCP_RETRY_MIN to
+  // DHCP_RETRY_MAX seconds until it is answered:
+  //   SELECTING   DISCOVER
+  //   REQUESTING  REQUEST for the offered address. If there is no ACK the
+  //               client returns to SELECTING.
+  //   REBOOTING   REQUEST for the stored lease. The stored lease is used
+  //               while the server does not answer.
+  //   BOUND       At half the lease time the client starts RENEWING.
+  //   RENEWING    REQUEST with the current address. If the lease expires
+  //               the static addresses are used and the client returns to
+  //               SELECTING.
+  // The message is only sent when the uip_buf is free.
+  if (dhcp_state == DHCP_OFF || uip_len != 0) return;
+  if ((uint32_t)(second_counter - dhcp_time) < dhcp_wait) return;
+
+  if (dhcp_state == DHCP_BOUND) {
+    dhcp_state = DHCP_RENEWING;
+    dhcp_xid++;
+    dhcp_retry = DHCP_RETRY_MIN;
+  }
+  else if (dhcp_state == DHCP_RENEWING
+   && (uint32_t)(second_counter - dhcp_bound) >= dhcp_lease_time) {
+    dhcp_static();
+    dhcp_state = DHCP_SELECTING;
+    dhcp_xid++;
+  }
+  else if (dhcp_state == DHCP_REQUESTING && dhcp_retry == DHCP_RETRY_MAX) {
+    dhcp_state = DHCP_SELECTING;
+    dhcp_xid++;
+    dhcp_retry = DHCP_RETRY_MIN;
+  }
+
+  dhcp_time = second_counter;
+  dhcp_wait = dhcp_retry;
+  if (dhcp_retry < DHCP_RETRY_MAX) dhcp_retry = (uint8_t)(dhcp_retry * 2);
+  if (dhcp_state == DHCP_SELECTING) dhcp_send(1);
+  else dhcp_send(3);
+}
+#endif // DHCP_SUPPORT == 1
+#endif // UDP_CONTROL_SUPPORT == 1
+
+
+#if MODBUS_TCP_SUPPORT == 1
+void modbus_call(void)
+{
+  // Modbus TCP server on MODBUS_TCP_PORT, called from uip_TcpAppHubCall().
+  // Each request must arrive in one TCP segment, and the reply is sent in
+  // one segment from the same call, so a poller gets its answer with the
+  // ACK of its request. One connection is served at a time. A new
+  // connection replaces the old one, so a PLC that lost its connection can
+  // reconnect at once.
+  //
+  // A TCP retransmit must resend the same data, but the request is no
+  // longer in the uip_buf. The request is kept in modbus_request and is
+  // processed again to rebuild the reply. Writes only set outputs to the
+  // requested state, so repeating them does no harm.
+  uint16_t nBytes;
+
+  if (uip_connected()) {
+    modbus_conn = uip_conn;
+    modbus_request_len = 0;
+  }
+
+  if (uip_conn != modbus_conn) {
+    uip_abort();
+    return;
+  }
+
+  if (uip_closed() || uip_aborted() || uip_timedout()) {
+    modbus_conn = NULL;
+    return;
+  }
+
+  if (uip_newdata()) {
+    modbus_request_len = uip_datalen();
+    nBytes = modbus_request_len;
+    if (nBytes > MODBUS_REQUEST_MAX) nBytes = MODBUS_REQUEST_MAX;
+    memcpy(modbus_request, uip_appdata, nBytes);
+    modbus_reply(modbus_request_len);
+  }
+  else if (uip_rexmit() && modbus_request_len != 0) {
+    nBytes = modbus_request_len;
+    if (nBytes > MODBUS_REQUEST_MAX) nBytes = MODBUS_REQUEST_MAX;
+    memcpy(uip_appdata, modbus_request, nBytes);
+    modbus_reply(modbus_request_len);
+  }
+}
+
+
+static uint32_t modbus_pin_mask(uint8_t num_pins, uint8_t type)
+{
+  // Returns a bit mask of the pins of the given type (0x01 = Input,
+  // 0x03 = Output). Bit 0 is IO 1.
+  uint8_t i;
+  uint32_t mask;
+
+  mask = 0;
+  for (i = 0; i < num_pins; i++) {
 #if LINKED_SUPPORT == 0
-	  if ((pin_control[ParseNum] & 0x03) == 0x03) {
+    if ((pin_control[i] & 0x03) == type) mask |= ((uint32_t)1 << i);
 #endif // LINKED_SUPPORT == 0
 #if LINKED_SUPPORT == 1
-          if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
+    if (chk_iotype(pin_control[i], i, 0x03) == type) mask |= ((uint32_t)1 << i);
 #endif // LINKED_SUPPORT == 1
-            // This is an Output
-	    Pending_pin_control[ParseNum] &= (uint8_t)~0x80;
-          }
-	}
-	// Set the appropriate bit in MQTT_transmit to force a 
-	// publish_pinstate for this pin.
-	j = 1;
-	j = (j << ParseNum);
-	MQTT_transmit = (MQTT_transmit | j);
-      }
-    }
-    
-    // The above code effectively did for MQTT what the POST parsing does for
-    // HTML, ie, changed the pin_control byte. So we need to set the 
-    // mqtt_parse_complete value so that the check_runtime_changes() function
-    // will perform the necessary IO actions.
-    mqtt_parse_complete = 1;
   }
-  
-  // Determine if the sub-topic is "state-req" or "state_req24".
-  // This Topic should always be received at QOS 0.
-  else if (*pBuffer == 's') {
-    // "state-req" or "state-req24" detected
-    // Format is:
-    //   state-req
-    //   state-req24
-    // -------------------------------------------------------------------- //
-    // WARNING: To save flash space I don't check every sub-topic character.
-    // But I also don't clear the uip_buf. So, I could pick up on stuff left
-    // by a prevous message if not careful. In this limited application I can
-    // get away with it, but this can trip me up in the future if more
-    // messages are added.
-    // -------------------------------------------------------------------- //
+  return mask;
+}
 
-    // Capture the state-req command in OctetArray.
-    for (i=0; i<11; i++) {
-      OctetArray[i] = *pBuffer;
-      pBuffer++;
-    }
-    OctetArray[11] = 0;
-    
-    if (OctetArray[8] == 'q') {
-      // Confirmed this is a state-req command
-      // Now figure out if the state-req is requesting a 16 pin output or a
-      // 24 pin output. "state-req" is for 16 pins. "state-req24" is for 24
-      // pins.
-      // Assume this is for 16 pins for the moment.
-      state_request = STATE_REQUEST_RCVD;
-      // Move the pBuffer pointer back to the end of the state-req command
-      pBuffer -= 2;
-      // Destroy 'q' in buffer so subsequent "state" messages won't be
-      // misinterpreted
-      *pBuffer = '0';
-      if ((OctetArray[9] == '2') && (OctetArray[10] == '4')) {
-        // This is a state-req24 command
-        state_request = STATE_REQUEST_RCVD24;
-        // Destroy '2' and '4' in buffer so subsequent "state" messages won't
-	// be misinterpreted
-	pBuffer++;
-        *pBuffer = '0';
-	pBuffer++;
-        *pBuffer = '0';
-      }
+
+static uint16_t modbus_input_register(uint8_t reg)
+{
+  // Returns an Input Register. The 32 bit values take two registers, high
+  // word first, and always start at an even register.
+  uint32_t value;
+#if INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+  uint8_t i;
+#endif // INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+
+  value = 0;
+
+  if (reg == 0) {
+#if DS18B20_SUPPORT == 1
+    if (stored_config_settings & 0x08) value |= 0x01;
+#endif // DS18B20_SUPPORT == 1
+#if BME280_SUPPORT == 1
+    if ((BME280_found == 1) && (stored_config_settings & 0x20)) value |= 0x02;
+#endif // BME280_SUPPORT == 1
+#if INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+    value |= 0x04;
+#endif // INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+    return (uint16_t)value;
+  }
+
+#if DS18B20_SUPPORT == 1
+  if (reg < 6) {
+    if ((stored_config_settings & 0x08) == 0) return 0;
+    return (uint16_t)((DS18B20_scratch[reg - 1][1] << 8) | DS18B20_scratch[reg - 1][0]);
+  }
+#endif // DS18B20_SUPPORT == 1
+
+#if BME280_SUPPORT == 1
+  if (reg >= 6 && reg < 12) {
+    if ((BME280_found == 1) && (stored_config_settings & 0x20)) {
+      if (reg < 8) value = (uint32_t)comp_data_temperature;
+      else if (reg < 10) value = (uint32_t)comp_data_pressure;
+      else value = (uint32_t)comp_data_humidity;
     }
   }
-  // Note: if none of the above matched the parsing we just exit without
-  // executing any functionality (the message is effectively ignored).
+#endif // BME280_SUPPORT == 1
+
+#if INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+  if (reg >= 12 && reg < MODBUS_INPUT_REGISTERS) {
+    i = (uint8_t)((reg - 12) / 6);
+#if SENSOR_FIXED_POINT == 1
+    if (((reg - 12) % 6) < 2) value = (uint32_t)ina226_voltage[i];
+    else if (((reg - 12) % 6) < 4) value = (uint32_t)ina226_current[i];
+    else value = (uint32_t)ina226_power[i];
+#else // SENSOR_FIXED_POINT == 0
+    if (((reg - 12) % 6) < 2) value = (uint32_t)(int32_t)(ina226_voltage[i] * 1000);
+    else if (((reg - 12) % 6) < 4) value = (uint32_t)(int32_t)(ina226_current[i] * 1000);
+    else value = (uint32_t)(int32_t)(ina226_power[i] * 1000);
+#endif // SENSOR_FIXED_POINT == 1
+  }
+#endif // INA226_SUPPORT == 1 && INA226_ALERT_SUPPORT == 1
+
+  if (reg & 0x01) return (uint16_t)value;
+  return (uint16_t)(value >> 16);
 }
-#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 
 
-#if BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
-void publish_callback(void** unused, struct mqtt_response_publish *published)
+static void modbus_write_register(uint8_t num_pins, uint8_t reg, uint16_t value)
 {
-  uint8_t ParseNum;
-  uint8_t error;
-  uint8_t match_found;
-  int i;
+  // Holding Register 0 is IO 1 to 16, register 1 is IO 17 to 24. Only the
+  // pins that are Outputs are changed.
+  uint8_t i;
+  uint8_t pin;
+
+  for (i = 0; i < 16; i++) {
+    pin = (uint8_t)((reg * 16) + i);
+    if (pin >= num_pins) break;
+    update_ON_OFF(pin, (uint8_t)((value >> i) & 0x01));
+  }
+}
+
 
-  ParseNum = 0;
-  match_found = 0;
+static uint8_t modbus_out_of_range(uint16_t address, uint16_t quantity, uint16_t limit)
+{
+  // Returns 1 if quantity items starting at address do not all lie below
+  // limit. Written so that nothing wraps in 16 bits.
+  if (address >= limit || quantity == 0 || quantity > limit - address) return 1;
+  return 0;
+}
 
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("\r\n");
-// UARTPrintf("Running publish_callback\r\n");
-#endif // DEBUG_SUPPORT == 15
 
-  // This function is applicable to Domoticz environments.
-  //
-  // This function will be called if a "Publish" is received from the Broker.
-  // Domoticz operates differently that Home Assistant in that the Publish
-  // message will have been completely received and analyzed in the
-  // mqtt_sync() process of the mqtt.c code. This is necessary because
-  // domoticz/out messages can be huge and may cross packet boundaries, which
-  // can only be accounted for if the message is processed within the
-  // mqtt_sync() function.
+void modbus_reply(uint16_t nBytes)
+{
+  // Processes the request at uip_appdata and writes the reply over it.
   //
-  // The only values that need to be extracted from a Domoticz "domoticz/out"
-  // message are the idx and nvalue values. Those are captured in the
-  // mqtt_sync() function and stored in global values idx_string and
-  // nvalue_string.
+  // Request and reply: MBAP header [transaction 2] [protocol 2] [length 2]
+  // [unit 1] followed by [function 1] [data ...]. The unit is not checked.
+  // An error reply is [function | 0x80] [exception] with exception
+  //   1 = function not supported, 2 = address out of range,
+  //   3 = bad quantity or length, 4 = Response Lock is ON
+  // Requests that are not Modbus TCP, or do not fit in one segment, get
+  // no reply.
   //
-  // In the following code we set or clear an individual pin associated with
-  // the idx value. This requires searching the idx table to determine which
-  // IOn pin is being referenced.
-  
-  // Set the pBuffer pointer to the start of the MQTT packet
+  // Coils (functions 1, 5 and 15), 0 to 15 or 23:
+  //   The Output pins, IO 1 is coil 0. Pins that are not Outputs read as 0
+  //   and writing them is ignored.
+  // Discrete Inputs (function 2), 0 to 15 or 23:
+  //   The Input pins, IO 1 is input 0. Pins that are not Inputs read as 0.
+  // Holding Registers (functions 3, 6 and 16), 0 to 1:
+  //   0 = IO 1 to 16, 1 = IO 17 to 24, bit 0 is the lowest IO. Pins that
+  //   are Outputs are changed by a write.
+  // Input Registers (function 4), 0 to 41:
+  //   0      Valid: bit 0 DS18B20, bit 1 BME280, bit 2 INA226
+  //   1-5    DS18B20 sensors 1 to 5 (1/16 degree C)
+  //   6-11   BME280 temperature, pressure and humidity, 32 bits each, as
+  //          sent by UDP control cmd 0x03
+  //   12-41  INA226 sensors 1 to 5, voltage (mV), current (mA) and power
+  //          (mW), 32 bits each. Only with INA226_ALERT_SUPPORT, where the
+  //          measurements are already collected by ina226_service().
+  //   Registers of sensors not in the build or not enabled read as 0.
+  // Outputs are changed with the same update_ON_OFF() logic used by the
+  // /xx commands, and the pin states read are those of the ON_OFF_word.
+  uint8_t *pBuffer;
+  uint8_t num_pins;
+  uint8_t i;
+  uint8_t exception;
+  uint8_t pdu_len;
+  uint16_t address;
+  uint16_t quantity;
+  uint16_t value;
+  uint32_t bits;
+
+  pBuffer = (uint8_t *)uip_appdata;
+
+  // The MBAP length counts the unit and the PDU, and must match the segment
+  if (nBytes < 12 || pBuffer[2] != 0 || pBuffer[3] != 0
+   || nBytes != (uint16_t)(6 + ((pBuffer[4] << 8) | pBuffer[5]))) {
+    return;
+  }
 
-  i = 0;
-  error = 0;
+  num_pins = 16;
+#if PCF8574_SUPPORT == 1
+  if (stored_options1 & 0x08) num_pins = 24;
+#endif // PCF8574_SUPPORT == 1
 
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("idx_string = ");
-// UARTPrintf(idx_string);
-// UARTPrintf("\r\n");
-// UARTPrintf("nvalue_string = ");
-// UARTPrintf(nvalue_string);
-// UARTPrintf("\r\n");
-#endif // DEBUG_SUPPORT == 15
+  address = (uint16_t)((pBuffer[8] << 8) | pBuffer[9]);
+  quantity = (uint16_t)((pBuffer[10] << 8) | pBuffer[11]);
+  exception = 0;
+  pdu_len = 5; // Writes echo the function, address and quantity or value
 
-  if (idx_string[0] == '\0') error = 1;
-  if (nvalue_string[0] == '\0') error = 1;
+#if RESPONSE_LOCK_SUPPORT == 1
+  if ((stored_options1 & 0x40) == 0x40) {
+    // Response Lock is ON. Like the /xx commands nothing is changed or
+    // reported.
+    exception = 4;
+  }
+#endif // RESPONSE_LOCK_SUPPORT == 1
 
-  if (error == 0) {
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Starting IO_NAME search\r\n");
-#endif // DEBUG_SUPPORT == 15
-    // If no error was found then the idx and nvalue were captured.
-    // Search the idx table to determine which pin has been set or cleared.
-    // The idx table is stored in the same space normally used to store
-    // pin names.
-    
-    // Assumption is that the idx value is never greater than 6 digits and
-    // there are no leading zeroes.
-    match_found = 0;
-    for (i=0; i<16; i++) {
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("IO_NAME = ");
-// UARTPrintf(IO_NAME[i]);
-// UARTPrintf("\r\n");
-#endif // DEBUG_SUPPORT == 15
-      if (strcmp(idx_string, IO_NAME[i]) == 0) {
-        // Found a match
-	match_found = 1;
-	ParseNum = (uint8_t)i;
-	break;
-      }
-    }
-    
-#if PCF8574_SUPPORT == 1
-    {
-      int j;
-      char temp_byte[16];
-      for (i=16; i<24; i++) {
-        // Read a PCF8574_IO_NAME value from I2C EEPROM
-        prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, PCF8574_I2C_EEPROM_START_IO_NAMES + ((i - 16) * 16), 2);
-        for (j=0; j<15; j++) {
-          temp_byte[j] = I2C_read_byte(0);
+  if (exception == 0) {
+    switch (pBuffer[7]) {
+      case 0x01:
+      case 0x02:
+        // Read Coils, Read Discrete Inputs
+        if (nBytes != 12 || quantity == 0 || quantity > num_pins) exception = 3;
+        else if (modbus_out_of_range(address, quantity, num_pins)) exception = 2;
+        else {
+          bits = (uint32_t)ON_OFF_word
+               & modbus_pin_mask(num_pins, (uint8_t)(pBuffer[7] == 0x01 ? 0x03 : 0x01));
+          bits = (bits >> address) & (((uint32_t)1 << quantity) - 1);
+          pBuffer[8] = (uint8_t)((quantity + 7) / 8);
+          for (i = 0; i < pBuffer[8]; i++) {
+            pBuffer[9 + i] = (uint8_t)(bits >> (i * 8));
+          }
+          pdu_len = (uint8_t)(2 + pBuffer[8]);
         }
-        temp_byte[15] = I2C_read_byte(1);
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("IO_NAME = ");
-// UARTPrintf(temp_byte);
-// UARTPrintf("\r\n");
-#endif // DEBUG_SUPPORT == 15
-        if (strcmp(idx_string, temp_byte) == 0) {
-          // Found a match
-	  match_found = 1;
-	  ParseNum = (uint8_t)i;
-	  break;
+        break;
+
+      case 0x03:
+      case 0x04:
+        // Read Holding Registers, Read Input Registers
+        if (nBytes != 12 || quantity == 0 || quantity > MODBUS_INPUT_REGISTERS) exception = 3;
+        else if (modbus_out_of_range(address, quantity, (uint16_t)(pBuffer[7] == 0x03 ? 2 : MODBUS_INPUT_REGISTERS))) exception = 2;
+        else {
+          pBuffer[8] = (uint8_t)(quantity * 2);
+          for (i = 0; i < quantity; i++) {
+            if (pBuffer[7] == 0x03) {
+              value = (uint16_t)((uint32_t)ON_OFF_word >> ((address + i) * 16));
+            }
+            else value = modbus_input_register((uint8_t)(address + i));
+            pBuffer[9 + (i * 2)] = (uint8_t)(value >> 8);
+            pBuffer[10 + (i * 2)] = (uint8_t)value;
+          }
+          pdu_len = (uint8_t)(2 + pBuffer[8]);
         }
-      }
-    }
-#endif // PCF8574_SUPPORT == 1
-    
-    if (match_found == 0) {
-      // Do nothing. The idx value is bogus.
-    
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("\r\n");
-// UARTPrintf("No idx match found\r\n");
-#endif // DEBUG_SUPPORT == 15
+        break;
+
+      case 0x05:
+        // Write Single Coil. The value is 0xff00 for ON, 0x0000 for OFF.
+        if (nBytes != 12 || (quantity != 0xff00 && quantity != 0x0000)) exception = 3;
+        else if (modbus_out_of_range(address, 1, num_pins)) exception = 2;
+        else update_ON_OFF((uint8_t)address, (uint8_t)(quantity != 0));
+        break;
+
+      case 0x06:
+        // Write Single Register
+        if (nBytes != 12) exception = 3;
+        else if (modbus_out_of_range(address, 1, 2)) exception = 2;
+        else modbus_write_register(num_pins, (uint8_t)address, quantity);
+        break;
+
+      case 0x0f:
+        // Write Multiple Coils
+        if (nBytes < 13 || quantity == 0 || quantity > num_pins
+         || pBuffer[12] != (uint8_t)((quantity + 7) / 8)
+         || nBytes != (uint16_t)(13 + pBuffer[12])) exception = 3;
+        else if (modbus_out_of_range(address, quantity, num_pins)) exception = 2;
+        else {
+          for (i = 0; i < quantity; i++) {
+            update_ON_OFF((uint8_t)(address + i),
+                          (uint8_t)((pBuffer[13 + (i / 8)] >> (i % 8)) & 0x01));
+          }
+        }
+        break;
+
+      case 0x10:
+        // Write Multiple Registers
+        if (nBytes < 13 || quantity == 0 || quantity > 2
+         || pBuffer[12] != (uint8_t)(quantity * 2)
+         || nBytes != (uint16_t)(13 + pBuffer[12])) exception = 3;
+        else if (modbus_out_of_range(address, quantity, 2)) exception = 2;
+        else {
+          for (i = 0; i < quantity; i++) {
+            modbus_write_register(num_pins, (uint8_t)(address + i),
+              (uint16_t)((pBuffer[13 + (i * 2)] << 8) | pBuffer[14 + (i * 2)]));
+          }
+        }
+        break;
 
+      default:
+        exception = 1;
+        break;
     }
   }
 
-  if (match_found == 1) {
-    // Verify ParseNum is in the correct range
-    ParseNum++; // Add 1 to Parsenum for the following check
-#if PCF8574_SUPPORT == 0
-    if (ParseNum > 0 && ParseNum < 17) {
-#endif // PCF8574_SUPPORT == 0
-#if PCF8574_SUPPORT == 1
-    if (ParseNum > 0 && ParseNum < 25) {
-#endif // PCF8574_SUPPORT == 1
-      ParseNum--; // Subtract one from ParseNum to use it as an array index
-      // Determine if payload is ON or OFF
-      if (nvalue_string[0] == '0') {
-        // Turn output OFF (and make sure it is an output)
-#if LINKED_SUPPORT == 0
-        if ((pin_control[ParseNum] & 0x03) == 0x03) {
-#endif // LINKED_SUPPORT == 0
-#if LINKED_SUPPORT == 1
-        if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
-#endif // LINKED_SUPPORT == 1
-          // This is an Output
-	  Pending_pin_control[ParseNum] &= (uint8_t)~0x80;
-        }
-      }
-      else {
-        // Turn output ON (and make sure it is an output)
-#if LINKED_SUPPORT == 0
-	if ((pin_control[ParseNum] & 0x03) == 0x03) {
-#endif // LINKED_SUPPORT == 0
-#if LINKED_SUPPORT == 1
-        if (chk_iotype(pin_control[ParseNum], ParseNum, 0x03) == 0x03) {
-#endif // LINKED_SUPPORT == 1
-          // This is an Output
-	  Pending_pin_control[ParseNum] |= (uint8_t)0x80;
-        }
-      }
-      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-      // The below doesn't look right. I set the MQTT_transmit which will
-      // force a transmit. But I also changed the Pending_pin_control which
-      // when processed will also cause a transmit. If timing doesn't work
-      // out well we will have a double transmit?
-      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-      // XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX
-      // Set the appropriate bit in MQTT_transmit to force a 
-      // publish_pinstate for this pin.
-      {
-        uint32_t pin_index;
-        pin_index = 1;
-        pin_index = (pin_index << ParseNum);
-        MQTT_transmit = (MQTT_transmit | pin_index);
-      }
-    }
+  if (exception != 0) {
+    pBuffer[7] |= 0x80;
+    pBuffer[8] = exception;
+    pdu_len = 2;
   }
-    
-  // The above code effectively did for MQTT what the POST parsing does for
-  // HTML, ie, changed the pin_control byte. So we need to set the 
-  // mqtt_parse_complete value so that the check_runtime_changes() function
-  // will perform the necessary IO actions.
-  mqtt_parse_complete = 1;
-  // Note: if none of the above matched the parsing we just exit without
-  // executing any functionality (the message is effectively ignored).
+
+  pBuffer[4] = 0;
+  pBuffer[5] = (uint8_t)(pdu_len + 1);
+  uip_send(uip_appdata, (uint16_t)(7 + pdu_len));
 }
-#endif // BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
+#endif // MODBUS_TCP_SUPPORT == 1
 
 
 #if BUILD_SUPPORT == MQTT_BUILD
@@ -3443,8 +6235,45 @@ void publish_outbound(void)
 
   int i;
   int signal_break;
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+#if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+  uint16_t top_j;
+  uint16_t fresh;
+#endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+#if PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+  uint32_t top_j;
+  uint32_t fresh;
+#endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+  int top_i;
+  int scan_count;
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+#if MQTT_STATE_AGGREGATE == 1
+  uint32_t changed;
+#endif // MQTT_STATE_AGGREGATE == 1
 
   signal_break = 0;
+#if MQTT_STATE_AGGREGATE == 1
+  changed = 0;
+#endif // MQTT_STATE_AGGREGATE == 1
+
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+  // Latch every pin that changed since the last call, and every pin that
+  // differs from what was last sent. A pin stays latched until it is
+  // published, so a pin that changes and changes back before its turn is
+  // still published once (with its current state). The time each pin was
+  // latched is kept for the publish delay statistic.
+  publish_tick++;
+  fresh = (ON_OFF_word ^ pin_last_seen) | (ON_OFF_word ^ ON_OFF_word_sent);
+  pin_last_seen = ON_OFF_word;
+  xor_tmp = fresh & ~pin_change_latch;
+  pin_change_latch |= fresh;
+  if (xor_tmp) {
+    for (i = 0; i < (int)sizeof(pin_control); i++) {
+      if (xor_tmp & 1) pin_change_tick[i] = publish_tick;
+      xor_tmp >>= 1;
+    }
+  }
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
 
   // Check the mqtt_sendbuf to make sure it is emptied before PUBLISHing a
   // pin_state message. This is to prevent overflow of the mqtt_sendbuf when
@@ -3491,6 +6320,22 @@ void publish_outbound(void)
     }
 #endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
 
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+    // Scan the latched pins instead of the xor, starting at the pin after
+    // the one published last, and wrap around once through all pins. Each
+    // latched pin is then published within one pass over the pins no
+    // matter how often other pins change.
+    xor_tmp = pin_change_latch;
+    top_i = i;
+    top_j = j;
+    scan_count = top_i + 1;
+    if (publish_rr < top_i) {
+      i = publish_rr;
+      j = 1;
+      j <<= i;
+    }
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+
     while ( 1 ) {
 
 #if DS18B20_SUPPORT == 1
@@ -3536,6 +6381,14 @@ void publish_outbound(void)
       }
 #endif // BME280_SUPPORT == 1 && DOMOTICZ_SUPPORT == 1
 
+#if SENSOR_HISTORY_SUPPORT == 1
+      // Check if a batch of sensor history samples needs to be published
+      if (history_due()) {
+        publish_history();
+	break;
+      }
+#endif // SENSOR_HISTORY_SUPPORT == 1
+
       // Perform a publish_pinstate for each pin that has changed OR if an
       // MQTT PUBLISH attempts to change a pin state.
       // xor_temp is used to detect pin changes generated by the IOControl
@@ -3564,6 +6417,17 @@ void publish_outbound(void)
 	//   if mqtt_parse_complete == 0, indicating that any pin_control
 	//   changes have been processed.
 	// Send a PUBLISH Response containing the pin state
+#if MQTT_STATE_AGGREGATE == 1
+        // With MQTT_STATE_AGGREGATE the changed pins are only collected
+	// here. A single message with all pin states is sent after the
+	// scan completes.
+#if LINKED_SUPPORT == 0
+        if (pin_control[i] & 0x01) changed |= j; // Enabled Input or Output
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+        if (chk_iotype(pin_control[i], i, 0x03) & 0x01) changed |= j;
+#endif // LINKED_SUPPORT == 1
+#else
 #if LINKED_SUPPORT == 0
         if ((pin_control[i] & 0x03) == 0x03) { // Enabled Output
 #endif // LINKED_SUPPORT == 0
@@ -3583,9 +6447,13 @@ void publish_outbound(void)
 	  // Enabled input or Linked Input
 #endif // LINKED_SUPPORT == 1
           publish_pinstate('I', (uint8_t)(i+1), ON_OFF_word, j);
+#if PUBLISH_LATENCY_STATS == 1
+	  latency_queued(j);
+#endif // PUBLISH_LATENCY_STATS == 1
 	  signal_break = 1; // Break out of the while loop, as we can only
 	                    // send one Publish message per pass.
 	}
+#endif // MQTT_STATE_AGGREGATE == 1
 	// else Pin is not enabled so no Publish was required.
 	
         // Update the "sent" pin state information so that the bit in
@@ -3601,17 +6469,59 @@ void publish_outbound(void)
 	// Clear the bit in the MQTT_transmit word to indicate that the
 	// transmit was satisfied.
 	MQTT_transmit &= ~j;
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+        pin_change_latch &= ~j;
+	if (signal_break == 1) {
+	  // Track the longest delay from a latched change to its PUBLISH,
+	  // and continue the next scan with the next pin.
+	  uint16_t delay;
+	  delay = (uint16_t)((uint8_t)(publish_tick - pin_change_tick[i]) * 50);
+	  if (delay > publish_delay_max) publish_delay_max = delay;
+	  if (i == 0) publish_rr = (uint8_t)top_i;
+	  else publish_rr = (uint8_t)(i - 1);
+	}
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
 
 	// Break out of the while() loop only if a PUBLISH Response was sent.
+#if MQTT_PUBLISH_BATCH == 1
+	// With MQTT_PUBLISH_BATCH more pin changes are queued while the
+	// mqtt_sendbuf has room. mqtt_send() packs them into one TCP
+	// segment.
+	if (signal_break == 1) {
+	  if (mqtt_check_sendbuf(&mqttclient) < MQTT_PUBLISH_ROOM) break;
+	  signal_break = 0;
+	}
+#else
 	if (signal_break == 1) break;
+#endif // MQTT_PUBLISH_BATCH == 1
       }
       
       // If no Publish was sent check the next one. Note: If any Publish
       // WAS sent we would have broken out of the while() loop.
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+      if (--scan_count == 0) break;
+      if (i == 0) {
+        i = top_i;
+	j = top_j;
+      }
+      else {
+        j = j >> 1;
+        i--;
+      }
+#else
       if (i == 0) break;
       j = j >> 1;
       i--;
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
     }
+#if MQTT_STATE_AGGREGATE == 1
+    if (changed) {
+      publish_pinstate_changes(changed);
+#if PUBLISH_LATENCY_STATS == 1
+      latency_queued(changed);
+#endif // PUBLISH_LATENCY_STATS == 1
+    }
+#endif // MQTT_STATE_AGGREGATE == 1
   }
 
 #if HOME_ASSISTANT_SUPPORT == 1 // state_request not supported in Domoticz
@@ -3632,6 +6542,29 @@ void publish_outbound(void)
 #endif // BUILD_SUPPORT == MQTT_BUILD
 
 
+#if MQTT_TOPIC_PREFIX == 1
+void build_topic_prefix(void)
+{
+  // This function builds the device topic prefix
+  //   NetworkModule/DeviceName123456789
+  // from the devicetype and the stored_devicename. The prefix is built once
+  // at MQTT start so that the PUBLISH functions only need to copy it.
+  topic_prefix_len = (uint8_t)(stpcpy(stpcpy(topic_prefix, (char *)devicetype), stored_devicename) - (char *)topic_prefix);
+}
+
+
+uint8_t topic_build(unsigned char *topic, uint8_t suffix)
+{
+  // This function copies the device topic prefix to the topic buffer and
+  // adds the suffix selected from the topic_suffix table. The length of the
+  // resulting topic string is returned so the caller can add to the end of
+  // the topic without a strlen().
+  memcpy(topic, topic_prefix, topic_prefix_len);
+  return (uint8_t)(stpcpy(topic + topic_prefix_len, topic_suffix[suffix]) - (char *)topic);
+}
+#endif // MQTT_TOPIC_PREFIX == 1
+
+
 #if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 #if PCF8574_SUPPORT == 0
 void publish_pinstate(uint8_t direction, uint8_t pin, uint16_t value, uint16_t mask)
@@ -3674,8 +6607,10 @@ void publish_pinstate(uint8_t direction, uint8_t pin, uint32_t value, uint32_t m
   
   app_message[0] = '\0';
   
+#if MQTT_TOPIC_PREFIX == 0
   strcpy(topic_base, devicetype);
   strcat(topic_base, stored_devicename);
+#endif // MQTT_TOPIC_PREFIX == 0
 
   // If we are sending an Input message invert the value if the Invert_word
   // bit associated with the pin is 1
@@ -3687,16 +6622,26 @@ void publish_pinstate(uint8_t direction, uint8_t pin, uint32_t value, uint32_t m
     if ((Invert_word & mask)) value = (uint32_t)(~value);
 #endif // PCF8574_SUPPORT == 1
     // Build first part of the topic message
+#if MQTT_TOPIC_PREFIX == 1
+    i = topic_build(topic_base, TOPIC_SUFFIX_INPUT);
+#else // MQTT_TOPIC_PREFIX == 0
     strcat(topic_base, "/input/");
+#endif // MQTT_TOPIC_PREFIX == 1
   }
   // Else this is an Output message. Build the first part of the topic message
   else {
+#if MQTT_TOPIC_PREFIX == 1
+    i = topic_build(topic_base, TOPIC_SUFFIX_OUTPUT);
+#else // MQTT_TOPIC_PREFIX == 0
     strcat(topic_base, "/output/");
+#endif // MQTT_TOPIC_PREFIX == 1
   }
     
   // Add pin number to the topic message
   emb_itoa(pin, OctetArray, 10, 2);
+#if MQTT_TOPIC_PREFIX == 0
   i = (uint8_t)strlen(topic_base);
+#endif // MQTT_TOPIC_PREFIX == 0
   topic_base[i] = OctetArray[0];
   i++;
   topic_base[i] = OctetArray[1];
@@ -3714,12 +6659,12 @@ void publish_pinstate(uint8_t direction, uint8_t pin, uint32_t value, uint32_t m
   }
 
   // Queue publish message
-  // This message is always published with QOS 0
+  // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
   mqtt_publish(&mqttclient,
                topic_base,
 	       app_message,
 	       size,
-	       MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+	       MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
 }
 #endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 
@@ -3794,12 +6739,12 @@ void publish_pinstate(uint8_t direction, uint8_t pin, uint32_t value, uint32_t m
   size = strlen(app_message);
 
   // Queue publish message
-  // This message is always published with QOS 0
+  // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
   mqtt_publish(&mqttclient,
                topic_base,
 	       app_message,
 	       size,
-	       MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+	       MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
 }
 #endif // BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
 
@@ -3888,6 +6833,16 @@ void publish_pinstate_all(uint8_t type)
   }
 #endif // PCF8574_SUPPORT == 1
 
+#if MQTT_TOPIC_PREFIX == 1
+  if (type == STATE_REQUEST_RCVD) {
+    topic_build(topic_base, TOPIC_SUFFIX_STATE);
+  }
+#if PCF8574_SUPPORT == 1
+  if (type == STATE_REQUEST_RCVD24) {
+    topic_build(topic_base, TOPIC_SUFFIX_STATE24);
+  }
+#endif // PCF8574_SUPPORT == 1
+#else // MQTT_TOPIC_PREFIX == 0
   strcpy(topic_base, devicetype);
   strcat(topic_base, stored_devicename);
   
@@ -3899,16 +6854,159 @@ void publish_pinstate_all(uint8_t type)
     strcat(topic_base, "/state24");
   }
 #endif // PCF8574_SUPPORT == 1
+#endif // MQTT_TOPIC_PREFIX == 1
+
+  // Queue publish message
+  // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
+  mqtt_publish(&mqttclient,
+               topic_base,
+	       app_message,
+	       msg_size,
+	       MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+
+
+#if BUILD_SUPPORT == MQTT_BUILD && MQTT_STATE_AGGREGATE == 1
+void publish_pinstate_changes(uint32_t changed)
+{
+  // This function transmits the state of all pins plus a mask of the pins
+  // that changed, in place of the single pin PUBLISH messages. It is used
+  // with MQTT_STATE_AGGREGATE.
+  // The pin states are sent in the same form as the state-req response
+  // (see publish_pinstate_all()) followed by the changed mask in the same
+  // form. A 1 in the changed mask marks an enabled pin that changed or
+  // that was the target of a received MQTT PUBLISH.
+  // If PCF8574 pins are not present the payload is 4 bytes and the topic
+  // is
+  //   NetworkModule/DeviceName123456789/state-chg
+  // If PCF8574 pins are present the payload is 6 bytes and the topic is
+  //   NetworkModule/DeviceName123456789/state-chg24
+  
+  uint32_t k;
+  uint8_t msg_size;
+  unsigned char app_message[6];       // Stores the application message (the
+                                      // payload) that will be sent in an
+				      // MQTT message.
+  unsigned char topic_base[48]; // Used for building the publish topic
+                                // string.
+
+  k = ON_OFF_word;
+#if MQTT_TOPIC_PREFIX == 0
+  strcpy(topic_base, devicetype);
+  strcat(topic_base, stored_devicename);
+#endif // MQTT_TOPIC_PREFIX == 0
+  
+#if PCF8574_SUPPORT == 1
+  if (stored_options1 & 0x08) {
+    app_message[0] = (uint8_t)(k >> 16);
+    app_message[1] = (uint8_t)(k >> 8);
+    app_message[2] = (uint8_t)k;
+    app_message[3] = (uint8_t)(changed >> 16);
+    app_message[4] = (uint8_t)(changed >> 8);
+    app_message[5] = (uint8_t)changed;
+    msg_size = 6;
+#if MQTT_TOPIC_PREFIX == 1
+    topic_build(topic_base, TOPIC_SUFFIX_STATE_CHG24);
+#else // MQTT_TOPIC_PREFIX == 0
+    strcat(topic_base, "/state-chg24");
+#endif // MQTT_TOPIC_PREFIX == 1
+  }
+  else
+#endif // PCF8574_SUPPORT == 1
+  {
+    app_message[0] = (uint8_t)(k >> 8);
+    app_message[1] = (uint8_t)k;
+    app_message[2] = (uint8_t)(changed >> 8);
+    app_message[3] = (uint8_t)changed;
+    msg_size = 4;
+#if MQTT_TOPIC_PREFIX == 1
+    topic_build(topic_base, TOPIC_SUFFIX_STATE_CHG);
+#else // MQTT_TOPIC_PREFIX == 0
+    strcat(topic_base, "/state-chg");
+#endif // MQTT_TOPIC_PREFIX == 1
+  }
+
+  // Queue publish message
+  // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
+  mqtt_publish(&mqttclient,
+               topic_base,
+	       app_message,
+	       msg_size,
+	       MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
+}
+#endif // BUILD_SUPPORT == MQTT_BUILD && MQTT_STATE_AGGREGATE == 1
+
+
+#if SENSOR_DEADBAND_SUPPORT == 1
+static int16_t sensor_publish_value(uint8_t index, int16_t *deadband)
+{
+  // Returns the current reading of a sensor in the units compared with the
+  // deadband, and the deadband in those units.
+  //   0-4  DS18B20, 1/16 degree C
+  //   5    BME280 temperature, 0.01 degree C
+  //   6    BME280 pressure, hPa (altitude adjusted, as published)
+  //   7    BME280 humidity, 0.1 %
+#if DS18B20_SUPPORT == 1
+  if (index < 5) {
+    *deadband = (int16_t)((DEADBAND_TEMPERATURE * 16 + 5) / 10);
+    return (int16_t)(((uint16_t)DS18B20_scratch[index][1] << 8) | DS18B20_scratch[index][0]);
+  }
+#endif // DS18B20_SUPPORT == 1
+#if BME280_SUPPORT == 1
+  if (index == DEADBAND_BME280_TEMP) {
+    *deadband = (int16_t)(DEADBAND_TEMPERATURE * 10);
+    return (int16_t)comp_data_temperature;
+  }
+  if (index == DEADBAND_BME280_PRES) {
+    *deadband = (int16_t)DEADBAND_PRESSURE;
+    return (int16_t)altitude_adjustment();
+  }
+  if (index == DEADBAND_BME280_HUM) {
+    *deadband = (int16_t)(DEADBAND_HUMIDITY * 10);
+    return (int16_t)((comp_data_humidity * 10) / 1024);
+  }
+#endif // BME280_SUPPORT == 1
+  *deadband = 0;
+  return 0;
+}
 
-  // Queue publish message
-  // This message is always published with QOS 0
-  mqtt_publish(&mqttclient,
-               topic_base,
-	       app_message,
-	       msg_size,
-	       MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+
+uint8_t sensor_publish_due(uint8_t index)
+{
+  // Returns 1 if the sensor should be published: on the first publish, when
+  // SENSOR_PUBLISH_MAX_INTERVAL seconds have passed since the last one, or
+  // when the reading moved by at least the deadband and
+  // SENSOR_PUBLISH_MIN_INTERVAL seconds have passed. The caller calls
+  // sensor_publish_mark() when it publishes.
+  int16_t value;
+  int16_t deadband;
+  int16_t diff;
+  uint16_t age;
+
+  if ((sensor_pub_valid & (1 << index)) == 0) return 1;
+  age = (uint16_t)((uint16_t)second_counter - sensor_pub_time[index]);
+  if (age >= SENSOR_PUBLISH_MAX_INTERVAL) return 1;
+  if (age < SENSOR_PUBLISH_MIN_INTERVAL) return 0;
+  value = sensor_publish_value(index, &deadband);
+  diff = (int16_t)(value - sensor_pub_value[index]);
+  if (diff < 0) diff = (int16_t)-diff;
+  if (diff >= deadband) return 1;
+  return 0;
 }
-#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+
+
+void sensor_publish_mark(uint8_t index)
+{
+  // Records the reading and time of a sensor PUBLISH for
+  // sensor_publish_due()
+  int16_t deadband;
+
+  sensor_pub_value[index] = sensor_publish_value(index, &deadband);
+  sensor_pub_time[index] = (uint16_t)second_counter;
+  sensor_pub_valid |= (uint8_t)(1 << index);
+}
+#endif // SENSOR_DEADBAND_SUPPORT == 1
 
 
 #if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
@@ -3943,6 +7041,13 @@ void publish_temperature(uint8_t sensor)
 				//  homeassistant/sensor/macaddressxx/BME280-1xxxx/config
 				//  homeassistant/sensor/macaddressxx/BME280-2xxxx/config
   
+#if SENSOR_DEADBAND_SUPPORT == 1
+  // Skip the PUBLISH while the reading is within its deadband and the
+  // heartbeat interval has not passed
+  if (!sensor_publish_due(sensor)) return;
+  sensor_publish_mark(sensor);
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+  
   if (sensor <= numROMs) {
     // Only Publish if the sensor number is one of the sensors found by
     // FindDevices as indicated by numROMs.
@@ -3953,15 +7058,21 @@ void publish_temperature(uint8_t sensor)
     // The "numROMs" value is also a value from 0 to 4 (for the five sensors).
     
     // Build the topic string
+#if MQTT_TOPIC_PREFIX == 0
     strcpy(topic_base, devicetype);
     strcat(topic_base, stored_devicename);
     strcat(topic_base, "/temp/");
+#endif // MQTT_TOPIC_PREFIX == 0
     
     // Add sensor number to the topic message.
     {
       int i;
       int j;
+#if MQTT_TOPIC_PREFIX == 1
+      j = topic_build(topic_base, TOPIC_SUFFIX_TEMP);
+#else // MQTT_TOPIC_PREFIX == 0
       j = (uint8_t)strlen(topic_base);
+#endif // MQTT_TOPIC_PREFIX == 1
       for (i=6; i>0; i--) {
         int2hex(FoundROM[sensor][i]);
         topic_base[j++] = OctetArray[0];
@@ -3974,12 +7085,12 @@ void publish_temperature(uint8_t sensor)
     convert_temperature(sensor, 0); // Convert to degress C in OctetArray
     
     // Queue publish message
-    // This message is always published with QOS 0
+    // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
     mqtt_publish(&mqttclient,
                  topic_base,
                  OctetArray,   // app_message
                  strlen(OctetArray),
-                 MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+                 MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
   }
 }
 #endif // DS18B20_SUPPORT == 1
@@ -3998,6 +7109,13 @@ void publish_temperature(uint8_t sensor)
   unsigned char app_message[90]; // app_message (payload) is always of the form
     // {"command": "udevice", "idx": 321, "nvalue": 0, "svalue": "22.7", "parse": true}
   
+#if SENSOR_DEADBAND_SUPPORT == 1
+  // Skip the PUBLISH while the reading is within its deadband and the
+  // heartbeat interval has not passed
+  if (!sensor_publish_due(sensor)) return;
+  sensor_publish_mark(sensor);
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+  
   if (sensor <= numROMs && (Sensor_IDX[sensor][0] != '0')) {
     // Only Publish if the sensor number is one of the sensors found by
     // FindDevices as indicated by numROMs AND the sensor has been given an
@@ -4027,12 +7145,12 @@ void publish_temperature(uint8_t sensor)
     strcat(app_message, "\",\"parse\":true}");
     
     // Queue publish message
-    // This message is always published with QOS 0
+    // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
     mqtt_publish(&mqttclient,
                  topic_base,
                  app_message,
                  strlen(app_message),
-                 MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+                 MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
   }
 }
 #endif // DS18B20_SUPPORT == 1
@@ -4071,15 +7189,26 @@ void publish_BME280(int8_t sensor)
 				//  homeassistant/sensor/macaddressxx/BME280-1xxxx/config
 				//  homeassistant/sensor/macaddressxx/BME280-2xxxx/config
 
+
+#if SENSOR_DEADBAND_SUPPORT == 1
+  // Skip the PUBLISH while the reading is within its deadband and the
+  // heartbeat interval has not passed
+  if (!sensor_publish_due((uint8_t)(DEADBAND_BME280_TEMP + sensor))) return;
+  sensor_publish_mark((uint8_t)(DEADBAND_BME280_TEMP + sensor));
+#endif // SENSOR_DEADBAND_SUPPORT == 1
   
   if (BME280_found == 1) {
     // Build the topic string
+#if MQTT_TOPIC_PREFIX == 1
+    topic_build(topic_base, (uint8_t)(TOPIC_SUFFIX_BME280_0 + sensor));
+#else // MQTT_TOPIC_PREFIX == 0
     strcpy(topic_base, devicetype);
     strcat(topic_base, stored_devicename);
     
     if (sensor == 0) strcat(topic_base, "/temp/BME280-0");
     if (sensor == 1) strcat(topic_base, "/pres/BME280-1");
     if (sensor == 2) strcat(topic_base, "/hum/BME280-2");
+#endif // MQTT_TOPIC_PREFIX == 1
     
     // Isolate the two least significant octets of the uip_hostaddr (the module
     // IP address). Convert these two octets into a 4 character hexidecimal and use
@@ -4104,18 +7233,174 @@ void publish_BME280(int8_t sensor)
     }
 
     // Queue publish message
-    // This message is always published with QOS 0
+    // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
     mqtt_publish(&mqttclient,
                  topic_base,
                  OctetArray,   // app_message
                  strlen(OctetArray),
-                 MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+                 MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
   }
 }
 #endif // BME280_SUPPORT == 1
 #endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
 
 
+#if SENSOR_HISTORY_SUPPORT == 1
+static void history_add(uint8_t id, int16_t value)
+{
+  // Adds a sample to the history ring. When the ring is full the oldest
+  // sample that was not yet published is overwritten and counted in
+  // history_lost.
+  history[history_head].time = (uint16_t)second_counter;
+  history[history_head].id = id;
+  history[history_head].value = value;
+  history_head = (uint8_t)((history_head + 1) % SENSOR_HISTORY_SIZE);
+  if (history_count < SENSOR_HISTORY_SIZE) history_count++;
+  else if (history_lost < 255) history_lost++;
+}
+
+
+void history_sample(void)
+{
+  // Called from the main loop. Every SENSOR_HISTORY_INTERVAL seconds the
+  // latest reading of each enabled sensor is added to the history ring.
+  // Sample ids and units:
+  //   0-4   DS18B20 sensors 1 to 5, 1/16 degree C
+  //   5     BME280 temperature, 0.01 degree C
+  //   6     BME280 pressure, hPa (altitude adjusted)
+  //   7     BME280 humidity, 0.1 %
+  //   8     INA226 voltage, 10 mV
+  //   9     INA226 current, mA
+  //   10    INA226 power, 10 mW
+  // The values are the ones the sensor code last read, so an interval
+  // shorter than the sensor read interval repeats readings.
+  if (second_counter < history_time + SENSOR_HISTORY_INTERVAL) return;
+  history_time = second_counter;
+
+#if DS18B20_SUPPORT == 1
+  if (stored_config_settings & 0x08) {
+    uint8_t i;
+    for (i = 0; (int)i <= numROMs && i < 5; i++) {
+      history_add(i, (int16_t)(((uint16_t)DS18B20_scratch[i][1] << 8) | DS18B20_scratch[i][0]));
+    }
+  }
+#endif // DS18B20_SUPPORT == 1
+
+#if BME280_SUPPORT == 1
+  if ((BME280_found == 1) && (stored_config_settings & 0x20)) {
+    history_add(5, (int16_t)comp_data_temperature);
+    history_add(6, (int16_t)altitude_adjustment());
+    history_add(7, (int16_t)((comp_data_humidity * 10) / 1024));
+  }
+#endif // BME280_SUPPORT == 1
+
+#if INA226_SUPPORT == 1
+#if SENSOR_FIXED_POINT == 1
+  history_add(8, (int16_t)(voltage / 10));
+  history_add(9, (int16_t)current);
+  history_add(10, (int16_t)(power / 10));
+#else // SENSOR_FIXED_POINT == 0
+  history_add(8, (int16_t)(voltage * 100));
+  history_add(9, (int16_t)(current * 1000));
+  history_add(10, (int16_t)(power * 100));
+#endif // SENSOR_FIXED_POINT == 1
+#endif // INA226_SUPPORT == 1
+}
+
+
+uint8_t history_due(void)
+{
+  // Returns 1 if a batch of samples should be published: either a full
+  // batch is waiting or the oldest sample has waited SENSOR_HISTORY_MAX_AGE
+  // seconds.
+  uint8_t oldest;
+
+  if (history_count >= SENSOR_HISTORY_BATCH) return 1;
+  if (history_count == 0) return 0;
+  oldest = (uint8_t)((history_head + SENSOR_HISTORY_SIZE - history_count) % SENSOR_HISTORY_SIZE);
+  if ((uint16_t)((uint16_t)second_counter - history[oldest].time) >= SENSOR_HISTORY_MAX_AGE) return 1;
+  return 0;
+}
+
+
+static char *history_put_num(char *pBuffer, int32_t value)
+{
+  // Writes value in decimal without leading zeros
+  char *p;
+
+  if (value < 0) {
+    *pBuffer++ = '-';
+    value = -value;
+  }
+  emb_itoa((uint32_t)value, OctetArray, 10, 10);
+  p = OctetArray;
+  while (*p == '0' && *(p + 1) != '\0') p++;
+  return stpcpy(pBuffer, p);
+}
+
+
+void publish_history(void)
+{
+  // Publishes the oldest samples in the history ring, as many as fit in
+  // SENSOR_HISTORY_PAYLOAD characters. Called from publish_outbound(), so
+  // only while the broker is connected. Samples collected while it was not
+  // are published after the reconnect.
+  //
+  // Topic: NetworkModule/DeviceName123456789/history
+  // Payload: up,lost;age,id,value;age,id,value;...
+  //   up    - second_counter when the message was built
+  //   lost  - samples overwritten in the ring since the last message
+  //   age   - seconds between the sample and "up"
+  //   id    - the sensor (see history_sample())
+  //   value - the reading in the units of the sensor id
+  // The message is not retained.
+  unsigned char topic_base[55]; // Used for building the publish topic
+                                // string:
+                                //  NetworkModule/DeviceName123456789/history
+  char app_message[SENSOR_HISTORY_PAYLOAD + 1];
+  char entry[20];
+  char *pBuffer;
+  char *p;
+  struct history_entry *sample;
+
+#if MQTT_TOPIC_PREFIX == 1
+  topic_build(topic_base, TOPIC_SUFFIX_HISTORY);
+#else // MQTT_TOPIC_PREFIX == 0
+  strcpy(topic_base, devicetype);
+  strcat(topic_base, stored_devicename);
+  strcat(topic_base, "/history");
+#endif // MQTT_TOPIC_PREFIX == 1
+
+  pBuffer = history_put_num(app_message, (int32_t)second_counter);
+  *pBuffer++ = ',';
+  pBuffer = history_put_num(pBuffer, history_lost);
+  history_lost = 0;
+
+  while (history_count) {
+    sample = &history[(uint8_t)((history_head + SENSOR_HISTORY_SIZE - history_count) % SENSOR_HISTORY_SIZE)];
+    p = entry;
+    *p++ = ';';
+    p = history_put_num(p, (uint16_t)((uint16_t)second_counter - sample->time));
+    *p++ = ',';
+    p = history_put_num(p, sample->id);
+    *p++ = ',';
+    p = history_put_num(p, sample->value);
+    if ((pBuffer - app_message) + (p - entry) > SENSOR_HISTORY_PAYLOAD) break;
+    pBuffer = stpcpy(pBuffer, entry);
+    history_count--;
+  }
+
+  // Queue publish message
+  // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
+  mqtt_publish(&mqttclient,
+               topic_base,
+               app_message,
+               (uint16_t)(pBuffer - app_message),
+               MQTT_STATE_QOS);
+}
+#endif // SENSOR_HISTORY_SUPPORT == 1
+
+
 #if BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
 #if BME280_SUPPORT == 1
 void publish_BME280(int8_t sensor)
@@ -4203,6 +7488,17 @@ void publish_BME280(int8_t sensor)
     // environment the Temperature, Humidity, and Pressure values are sent as
     // a single MQTT message.
 
+#if SENSOR_DEADBAND_SUPPORT == 1
+  // The three values share one message, so it is sent when any of them is
+  // due
+  if (!sensor_publish_due(DEADBAND_BME280_TEMP)
+   && !sensor_publish_due(DEADBAND_BME280_PRES)
+   && !sensor_publish_due(DEADBAND_BME280_HUM)) return;
+  sensor_publish_mark(DEADBAND_BME280_TEMP);
+  sensor_publish_mark(DEADBAND_BME280_PRES);
+  sensor_publish_mark(DEADBAND_BME280_HUM);
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+
   if (BME280_found == 1) {
 
     // Build the topic string
@@ -4263,12 +7559,12 @@ void publish_BME280(int8_t sensor)
     strcat(app_message, "0\"}");
 
     // Queue publish message
-    // This message is always published with QOS 0
+    // This message is published with QOS 0 (QOS 1 with MQTT_PUBLISH_QOS1)
     mqtt_publish(&mqttclient,
                  topic_base,
                  app_message,
                  strlen(app_message),
-                 MQTT_PUBLISH_QOS_0 | MQTT_PUBLISH_RETAIN);
+                 MQTT_STATE_QOS | MQTT_PUBLISH_RETAIN);
   }
 }
 #endif // BME280_SUPPORT == 1
@@ -4300,6 +7596,131 @@ void lock_eeprom(void)
 }
 
 
+#if EEPROM_WRITE_CACHE == 1
+static void eeprom_program_word(uint8_t *word, uint8_t *data)
+{
+  // Writes 4 bytes to the word aligned EEPROM address with one word
+  // programming cycle. A byte write takes the same programming time and
+  // wear as the whole word.
+  volatile uint8_t *pEeprom;
+  
+  pEeprom = (volatile uint8_t *)word;
+  unlock_eeprom();
+  // Enable Word Write Once - enables a 4 byte write to EEPROM
+  FLASH_CR2 |= FLASH_CR2_WPRG;
+  FLASH_NCR2 &= (uint8_t)(~FLASH_NCR2_NWPRG);
+  pEeprom[0] = data[0];
+  pEeprom[1] = data[1];
+  pEeprom[2] = data[2];
+  pEeprom[3] = data[3];
+  // Wait for the end of the programming cycle (EOP), or for WR_PG_DIS if
+  // the write was refused
+  while ((FLASH_IAPSR & (FLASH_IAPSR_EOP | FLASH_IAPSR_WR_PG_DIS)) == 0) ;
+  lock_eeprom();
+  if (eeprom_word_writes != 0xffff) eeprom_word_writes++;
+}
+
+
+void eeprom_cache_write(uint8_t *addr, uint8_t value)
+{
+  // Replaces a direct write of "value" to the EEPROM byte at "addr". The
+  // byte is held in the cache and written by eeprom_cache_service() once no
+  // more writes have arrived for EEPROM_CACHE_QUIET_MS. If all of the cache
+  // entries are in use the cache is written first.
+  uint8_t *word;
+  uint8_t bit;
+  uint8_t i;
+  uint8_t entry;
+  
+  word = addr - ((uint16_t)addr & 0x03);
+  bit = (uint8_t)(1 << ((uint16_t)addr & 0x03));
+  entry = EEPROM_CACHE_WORDS;
+  for (i=0; i<EEPROM_CACHE_WORDS; i++) {
+    if (ee_cache_addr[i] == word) break;
+    if (ee_cache_addr[i] == NULL && entry == EEPROM_CACHE_WORDS) entry = i;
+  }
+  
+  if (i < EEPROM_CACHE_WORDS) {
+    // The word is already pending
+    if ((ee_cache_dirty[i] & bit) && ee_cache_data[i][(uint16_t)addr & 0x03] == value) return;
+    if (eeprom_coalesced != 0xffff) eeprom_coalesced++;
+  }
+  else {
+    if (*addr == value) return; // No change
+    if (entry == EEPROM_CACHE_WORDS) {
+      eeprom_cache_flush();
+      entry = 0;
+    }
+    i = entry;
+    ee_cache_addr[i] = word;
+    ee_cache_dirty[i] = 0;
+    ee_cache_used++;
+  }
+  
+  ee_cache_data[i][(uint16_t)addr & 0x03] = value;
+  ee_cache_dirty[i] |= bit;
+  ee_cache_stamp = ms_counter;
+}
+
+
+uint8_t eeprom_cache_read(uint8_t *addr)
+{
+  // Returns the EEPROM byte at "addr" as it will be once the cache is
+  // written, that is the pending value if the byte was written through the
+  // cache.
+  uint8_t *word;
+  uint8_t i;
+  
+  word = addr - ((uint16_t)addr & 0x03);
+  for (i=0; i<EEPROM_CACHE_WORDS; i++) {
+    if (ee_cache_addr[i] == word
+     && (ee_cache_dirty[i] & (uint8_t)(1 << ((uint16_t)addr & 0x03)))) {
+      return ee_cache_data[i][(uint16_t)addr & 0x03];
+    }
+  }
+  return *addr;
+}
+
+
+void eeprom_cache_flush(void)
+{
+  // Writes all of the pending words to the EEPROM. Only the bytes written
+  // through the cache are taken from the cache. The other bytes of the word
+  // are re-read from the EEPROM because they may have been written directly
+  // since the word was cached. Words that were changed back to the EEPROM
+  // content are dropped without a write.
+  uint8_t data[4];
+  uint8_t i;
+  uint8_t j;
+  
+  for (i=0; i<EEPROM_CACHE_WORDS; i++) {
+    if (ee_cache_addr[i] != NULL) {
+      memcpy(&data[0], ee_cache_addr[i], 4);
+      for (j=0; j<4; j++) {
+        if (ee_cache_dirty[i] & (uint8_t)(1 << j)) data[j] = ee_cache_data[i][j];
+      }
+      if (memcmp(&data[0], ee_cache_addr[i], 4) != 0) {
+        eeprom_program_word(ee_cache_addr[i], &data[0]);
+      }
+      ee_cache_addr[i] = NULL;
+    }
+  }
+  ee_cache_used = 0;
+}
+
+
+void eeprom_cache_service(void)
+{
+  // Called from the main loop. Writes the cache after a quiet period so that
+  // rapid changes (for example a Retained relay toggling) cost one write.
+  if (ee_cache_used == 0) return;
+  if ((uint16_t)(ms_counter - ee_cache_stamp) >= EEPROM_CACHE_QUIET_MS) {
+    eeprom_cache_flush();
+  }
+}
+#endif // EEPROM_WRITE_CACHE == 1
+
+
 void unlock_flash(void)
 {
   // Unlock the Flash
@@ -4567,6 +7988,15 @@ void check_eeprom_settings(void)
     
     // Altitude 2 bytes
     memset(&stored_altitude, 0, 2);
+    
+    // UDP telemetry collector and interval 7 bytes
+    memset(&stored_telemetry_addr[0], 0, 7);
+    memset(&stored_mcast_group[0], 0, 8);
+
+#if DHCP_SUPPORT == 1
+    // A new module gets its address from the DHCP server
+    stored_options2 |= 0x20;
+#endif // DHCP_SUPPORT == 1
 
     lock_eeprom();
 
@@ -4614,6 +8044,11 @@ void check_eeprom_settings(void)
              stored_netmask[0]);
   uip_setnetmask(IpAddr);
 
+#if DHCP_SUPPORT == 1
+  // With DHCP enabled the stored lease replaces the static addresses
+  dhcp_init();
+#endif // DHCP_SUPPORT == 1
+
   // Read and use the MQTT Server IP Address from EEPROM
   uip_ipaddr(IpAddr,
              stored_mqttserveraddr[3],
@@ -4707,6 +8142,22 @@ void check_eeprom_settings(void)
     // If the magic number is present: Any 16 bit value is legitimate in the
     // IO_TIMER values so it is not possible to check for corruption.
   }
+#if RULE_ENGINE_SUPPORT == 1
+  // If the magic number didn't match all rules are cleared (not used).
+  if (magic_number_missing_flag == 1) {
+    for (i = 0; i < NUM_RULES; i++) {
+      // Enable Word Write Once
+      FLASH_CR2 |= FLASH_CR2_WPRG;
+      FLASH_NCR2 &= (uint8_t)(~FLASH_NCR2_NWPRG);
+      memset(&rule_table[i][0], 0, 4);
+    }
+  }
+  // The rule conditions start as true so that a toggle rule does not act
+  // on a condition that is already present at boot.
+  rule_state = 0xff;
+  memset(&rule_timer[0], 0, NUM_RULES);
+  rule_second = (uint8_t)second_counter;
+#endif // RULE_ENGINE_SUPPORT == 1
   lock_flash();
   
   // Copy Flash IO_TIMER values to the Pending IO_TIMER variables for STM8
@@ -4717,7 +8168,7 @@ void check_eeprom_settings(void)
   {
     int i;
     for (i=0; i<16; i++) {
-      pin_timer[i] = pin_timer[i] & 0xc000;
+      SET_PIN_TIMER(i, (uint16_t)(pin_timer[i] & 0xc000));
     }
   }
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD
@@ -5304,7 +8755,7 @@ void apply_PCF8574_pin_settings(void)
   {
     int i;
     for (i=16; i<24; i++) {
-      pin_timer[i] = pin_timer[i] & 0xc000;
+      SET_PIN_TIMER(i, (uint16_t)(pin_timer[i] & 0xc000));
     }
   }
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD
@@ -5565,6 +9016,168 @@ void update_mac_string(void)
 }
 
 
+#if RULE_ENGINE_SUPPORT == 1
+uint8_t rule_set(uint8_t index, uint8_t *rule)
+{
+  // Called by URL commands /88 to /8f. Validates a 4 byte rule and writes
+  // it to entry index of the rule table in Flash. Returns 1 if the rule was
+  // accepted. See rule_service() for the rule format.
+  uint8_t cond;
+  uint8_t act;
+  uint8_t num_pins;
+
+  num_pins = 16;
+#if PCF8574_SUPPORT == 1
+  if (stored_options1 & 0x08) num_pins = 24;
+#endif // PCF8574_SUPPORT == 1
+
+  cond = (uint8_t)(rule[0] >> 5);
+  act = (uint8_t)(rule[2] >> 5);
+  if (cond != RULE_COND_NONE) {
+    if (cond > RULE_COND_TEMP_BELOW) return 0;
+    if (cond <= RULE_COND_PIN_OFF && (rule[0] & 0x1f) >= num_pins) return 0;
+    if (cond >= RULE_COND_TEMP_ABOVE && (rule[0] & 0x1f) > 4) return 0;
+    if (act < RULE_ACT_FOLLOW || act > RULE_ACT_DELAY_OFF) return 0;
+    if ((rule[2] & 0x1f) >= num_pins) return 0;
+  }
+
+  if (memcmp(&rule_table[index][0], rule, 4) != 0) {
+    unlock_flash();
+    // Enable Word Write Once
+    FLASH_CR2 |= FLASH_CR2_WPRG;
+    FLASH_NCR2 &= (uint8_t)(~FLASH_NCR2_NWPRG);
+    memcpy(&rule_table[index][0], rule, 4);
+    lock_flash();
+  }
+  // Start the rule as if its condition was already true (see
+  // check_eeprom_settings())
+  rule_state |= (uint8_t)(1 << index);
+  rule_timer[index] = 0;
+  return 1;
+}
+
+
+void rule_service(void)
+{
+  // Evaluates the rule table. Called from check_runtime_changes() after the
+  // Input pins are read and before the Pending_pin_control values are
+  // processed. An action changes the Pending_pin_control byte of its Output
+  // pin and sets parse_complete, the same way a Linked pin does, so the
+  // change is handled just as if a GUI, REST, or MQTT action had changed
+  // the Output pin. Where several rules act on the same Output pin the last
+  // one in the table wins.
+  //
+  // Rule format (4 bytes):
+  //   Byte 0  bits 7-5  Condition (RULE_COND_ in main.h), 0 = not used
+  //           bits 4-0  Pin (0 = IO 1) or DS18B20 sensor (0 to 4)
+  //   Byte 1            Temperature threshold in degrees C (signed)
+  //   Byte 2  bits 7-5  Action (RULE_ACT_ in main.h)
+  //           bits 4-0  Output pin (0 = IO 1)
+  //   Byte 3            RULE_ACT_DELAY_OFF delay in seconds
+  // A rule does nothing if its Output pin is not configured as an Output.
+  // A temperature condition is false while DS18B20 is disabled or the
+  // sensor is not found.
+  uint8_t i;
+  uint8_t mask;
+  uint8_t src;
+  uint8_t out;
+  uint8_t act;
+  uint8_t cond;
+  uint8_t on;
+  uint8_t elapsed;
+#if DS18B20_SUPPORT == 1
+  int16_t temp;
+#endif // DS18B20_SUPPORT == 1
+
+  // Seconds since the last pass, for the RULE_ACT_DELAY_OFF timers
+  elapsed = (uint8_t)((uint8_t)second_counter - rule_second);
+  rule_second = (uint8_t)second_counter;
+
+  for (i = 0, mask = 1; i < NUM_RULES; i++, mask <<= 1) {
+    src = (uint8_t)(rule_table[i][0] & 0x1f);
+    out = (uint8_t)(rule_table[i][2] & 0x1f);
+    act = (uint8_t)(rule_table[i][2] >> 5);
+    if (out >= sizeof(Pending_pin_control)) continue;
+
+    cond = 0;
+    switch (rule_table[i][0] >> 5) {
+      case RULE_COND_PIN_ON:
+        if (ON_OFF_word & ((uint32_t)1 << src)) cond = 1;
+        break;
+      case RULE_COND_PIN_OFF:
+        if ((ON_OFF_word & ((uint32_t)1 << src)) == 0) cond = 1;
+        break;
+#if DS18B20_SUPPORT == 1
+      case RULE_COND_TEMP_ABOVE:
+      case RULE_COND_TEMP_BELOW:
+        if ((stored_config_settings & 0x08) && ((int)src <= numROMs)) {
+          // The reading is in 1/16 degree C
+          temp = (int16_t)(((uint16_t)DS18B20_scratch[src][1] << 8) | DS18B20_scratch[src][0]);
+          if ((rule_table[i][0] >> 5) == RULE_COND_TEMP_ABOVE) {
+            if (temp > (int16_t)((int8_t)rule_table[i][1] * 16)) cond = 1;
+          }
+          else if (temp < (int16_t)((int8_t)rule_table[i][1] * 16)) cond = 1;
+        }
+        break;
+#endif // DS18B20_SUPPORT == 1
+      default:
+        // Rule not used
+        continue;
+    }
+
+    on = 2; // 2 = no change
+    if (cond) {
+      if (act == RULE_ACT_FORCE_OFF) on = 0;
+      else if (act == RULE_ACT_TOGGLE) {
+        // Only act when the condition becomes true
+        if ((rule_state & mask) == 0) {
+          if (Pending_pin_control[out] & 0x80) on = 0;
+          else on = 1;
+        }
+      }
+      else on = 1;
+      rule_timer[i] = 0;
+      rule_state |= mask;
+    }
+    else {
+      if (act == RULE_ACT_FOLLOW) on = 0;
+      if (act == RULE_ACT_DELAY_OFF) {
+        if (rule_state & mask) {
+          // The condition just ended. Start the delay.
+          rule_timer[i] = rule_table[i][3];
+          if (rule_timer[i] == 0) on = 0;
+        }
+        else if (rule_timer[i]) {
+          if (rule_timer[i] <= elapsed) {
+            rule_timer[i] = 0;
+            on = 0;
+          }
+          else rule_timer[i] -= elapsed;
+        }
+      }
+      rule_state &= (uint8_t)~mask;
+    }
+
+    if (on == 2) continue;
+#if LINKED_SUPPORT == 0
+    if ((Pending_pin_control[out] & 0x03) != 0x03) continue;
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+    if (chk_iotype(Pending_pin_control[out], out, 0x03) != 0x03) continue;
+#endif // LINKED_SUPPORT == 1
+    if (on && (Pending_pin_control[out] & 0x80) == 0) {
+      Pending_pin_control[out] |= 0x80;
+      parse_complete = 1;
+    }
+    if (!on && (Pending_pin_control[out] & 0x80)) {
+      Pending_pin_control[out] &= 0x7f;
+      parse_complete = 1;
+    }
+  }
+}
+#endif // RULE_ENGINE_SUPPORT == 1
+
+
 void check_runtime_changes(void)
 {
   //-------------------------------------------------------------------------//
@@ -5613,7 +9226,8 @@ void check_runtime_changes(void)
   // If Linked Pins are enabled check for any edges that may have occurred on
   // linked input pins. This is done at this step to allow a valid input
   // to be treated as a pending output change by the rest of the runtime
-  // changes code.
+  // changes code. The rule table (RULE_ENGINE_SUPPORT) is evaluated at
+  // this step too.
   //
   // Step 8:
   // Manage Output pin Timers. Change Output pin states and Timers as
@@ -5626,8 +9240,40 @@ void check_runtime_changes(void)
   // values in EEPROM.
 
   uint8_t update_EEPROM;
-
+#if PUBLISH_LATENCY_STATS == 1
+  uint32_t input_states;
+#endif // PUBLISH_LATENCY_STATS == 1
+
+#if INPUT_EDGE_CAPTURE == 1
+  edge_capture_service(); // Debounce the edges captured by the EXTI
+                          // interrupts before the input pins are read
+#endif // INPUT_EDGE_CAPTURE == 1
+#if PUBLISH_LATENCY_STATS == 1
+  input_states = ON_OFF_word;
+#if INPUT_PASS_STATISTICS == 1
+  timed_read_input_pins();
+#else // INPUT_PASS_STATISTICS == 0
   read_input_pins(0);
+#endif // INPUT_PASS_STATISTICS == 1
+  // read_input_pins() only changes the Input pin states
+  latency_detect(input_states ^ ON_OFF_word);
+#else // PUBLISH_LATENCY_STATS == 0
+#if INPUT_PASS_STATISTICS == 1
+  timed_read_input_pins();
+#else // INPUT_PASS_STATISTICS == 0
+  read_input_pins(0);
+#endif // INPUT_PASS_STATISTICS == 1
+#endif // PUBLISH_LATENCY_STATS == 1
+
+#if RUNTIME_DIRTY_FLAGS == 1
+  // parse_complete and mqtt_parse_complete are the dirty flags set by
+  // parsepost(), parseget() and publish_callback() once the Pending values
+  // are complete. The Pending values can't change otherwise, so Steps 2 to 6
+  // only run when one of them is set. The input sampler's dirty flag is the
+  // linked_edge word checked in Step 7.
+  if (parse_complete || mqtt_parse_complete) runtime_dirty |= RUNTIME_CONFIG;
+  if (runtime_dirty & RUNTIME_CONFIG) {
+#endif // RUNTIME_DIRTY_FLAGS == 1
 
 
 #if PINOUT_OPTION_SUPPORT == 1
@@ -5678,9 +9324,13 @@ void check_runtime_changes(void)
   if (Pending_config_settings & 0x08) {
     pin_control[15] = Pending_pin_control[15] = (uint8_t)0x00;
     // Update the stored_pin_control[] variables
+#if EEPROM_WRITE_CACHE == 1
+    eeprom_cache_write(&stored_pin_control[15], pin_control[15]);
+#else // EEPROM_WRITE_CACHE == 0
     unlock_eeprom();
     if (stored_pin_control[15] != pin_control[15]) stored_pin_control[15] = pin_control[15];
     lock_eeprom();
+#endif // EEPROM_WRITE_CACHE == 1
   }
 #endif // DS18B20_SUPPORT == 1
 
@@ -5700,10 +9350,15 @@ void check_runtime_changes(void)
   pin_control[13] = Pending_pin_control[13] = (uint8_t)0x00;
   pin_control[14] = Pending_pin_control[14] = (uint8_t)0x00;
   // Update the stored_pin_control[] variables
+#if EEPROM_WRITE_CACHE == 1
+  eeprom_cache_write(&stored_pin_control[13], pin_control[13]);
+  eeprom_cache_write(&stored_pin_control[14], pin_control[14]);
+#else // EEPROM_WRITE_CACHE == 0
   unlock_eeprom();
   if (stored_pin_control[13] != pin_control[13]) stored_pin_control[13] = pin_control[13];
   if (stored_pin_control[14] != pin_control[14]) stored_pin_control[14] = pin_control[14];    
   lock_eeprom();
+#endif // EEPROM_WRITE_CACHE == 1
 #endif // I2C_SUPPORT == 1
 
 
@@ -5714,9 +9369,13 @@ void check_runtime_changes(void)
   // from Disabled in the GUI. This will force the state back to Disabled.
   pin_control[10] = Pending_pin_control[10] = (uint8_t)0x00;
   // Update the stored_pin_control[] variables
+#if EEPROM_WRITE_CACHE == 1
+  eeprom_cache_write(&stored_pin_control[10], pin_control[10]);
+#else // EEPROM_WRITE_CACHE == 0
   unlock_eeprom();
   if (stored_pin_control[10] != pin_control[10]) stored_pin_control[10] = pin_control[10];
   lock_eeprom();
+#endif // EEPROM_WRITE_CACHE == 1
 #endif // DEBUG_SUPPORT == 15
 
 
@@ -5733,8 +9392,14 @@ void check_runtime_changes(void)
 	  // One of the pins is not defined as Linked. Set both pins to the
 	  // pin type value stored in EEPROM. This should just have the effect
 	  // of invalidating the Pending request.
+#if EEPROM_WRITE_CACHE == 1
+	  // A Retained pin state write may still be pending in the cache.
+	  Pending_pin_control[i] = eeprom_cache_read(&stored_pin_control[i]);
+	  Pending_pin_control[i+8] = eeprom_cache_read(&stored_pin_control[i+8]);
+#else // EEPROM_WRITE_CACHE == 0
 	  Pending_pin_control[i] = stored_pin_control[i];
 	  Pending_pin_control[i+8] = stored_pin_control[i+8];
+#endif // EEPROM_WRITE_CACHE == 1
 	}
         // else do nothing - the settings are OK.
       }
@@ -5767,6 +9432,10 @@ void check_runtime_changes(void)
   }
 #endif // LINKED_SUPPORT == 1
 
+#if RUNTIME_DIRTY_FLAGS == 1
+  }
+#endif // RUNTIME_DIRTY_FLAGS == 1
+
 
 #if LINKED_SUPPORT == 1
   {
@@ -5865,6 +9534,13 @@ void check_runtime_changes(void)
   }
 #endif // LINKED_SUPPORT == 1
 
+#if RULE_ENGINE_SUPPORT == 1
+  // Evaluate the rule table. As with the Linked pins this is done before
+  // the Pending_pin_control check so that the rest of this function acts on
+  // the Output pin changes the rules make.
+  rule_service();
+#endif // RULE_ENGINE_SUPPORT == 1
+
 
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD
   // Manage Output pin Timers. Change Output pin states and Timers as
@@ -5927,7 +9603,7 @@ void check_runtime_changes(void)
         if ((pin_control[i] & 0x0b) == 0x03) {
           // Pin is an Output AND Retain is not set
           if (IO_TIMER[i] != Pending_IO_TIMER[i]) {
-            pin_timer[i] = Pending_IO_TIMER[i];
+            SET_PIN_TIMER(i, Pending_IO_TIMER[i]);
           }
         }
       }
@@ -5949,7 +9625,7 @@ void check_runtime_changes(void)
           prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, PCF8574_I2C_EEPROM_START_IO_TIMERS + ((i - 16) * 2), 2);
           IO_timer_value = read_two_bytes();
           if (IO_timer_value != Pending_IO_TIMER[i]) {
-            pin_timer[i] = Pending_IO_TIMER[i];
+            SET_PIN_TIMER(i, Pending_IO_TIMER[i]);
           }
         }
       }
@@ -5964,7 +9640,7 @@ void check_runtime_changes(void)
         if (chk_iotype(pin_control[i], i, 0x0b) == 0x03) {
 	  // Pin is an Output and Retain is not set
           if (IO_TIMER[i] != Pending_IO_TIMER[i]) {
-            pin_timer[i] = Pending_IO_TIMER[i];
+            SET_PIN_TIMER(i, Pending_IO_TIMER[i]);
 	  }
         }
       }
@@ -5986,7 +9662,7 @@ void check_runtime_changes(void)
           prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, PCF8574_I2C_EEPROM_START_IO_TIMERS + ((i - 16) * 2), 2);
           IO_timer_value = read_two_bytes();
           if (IO_timer_value != Pending_IO_TIMER[i]) {
-            pin_timer[i] = Pending_IO_TIMER[i];
+            SET_PIN_TIMER(i, Pending_IO_TIMER[i]);
           }
         }
       }
@@ -6013,6 +9689,13 @@ void check_runtime_changes(void)
   // Note this also applies to Linked pins that are pins 9 to 16 (as those
   //   are also Outputs).
   
+#if RUNTIME_DIRTY_FLAGS == 1
+  // A pin can only reach this state when a pin_timer expires
+  // (decrement_pin_timers() sets RUNTIME_TIMERS) or when the settings
+  // change. parse_complete is checked as well because a Linked pin edge in
+  // Step 7 sets it on this pass.
+  if (parse_complete || (runtime_dirty & (RUNTIME_CONFIG | RUNTIME_TIMERS))) {
+#endif // RUNTIME_DIRTY_FLAGS == 1
 #if LINKED_SUPPORT == 0
   {
     int i;
@@ -6227,6 +9910,9 @@ UARTPrintf("\r\n");
   }
 #endif // PCF8574_SUPPORT == 1
 #endif // LINKED_SUPPORT == 1
+#if RUNTIME_DIRTY_FLAGS == 1
+  }
+#endif // RUNTIME_DIRTY_FLAGS == 1
   
   if (parse_complete) {
   
@@ -6306,12 +9992,12 @@ UARTPrintf("\r\n");
               if (((Pending_pin_control[i] & 0x80) == 0x80) && ((pin_control[i] & 0x10) == 0x00)) {
                 // The user turned the pin ON and the idle state is OFF
                 // Set the pin timer
-                pin_timer[i] = IO_TIMER[i];
+                SET_PIN_TIMER(i, IO_TIMER[i]);
               }
               if (((Pending_pin_control[i] & 0x80) == 0x00) && ((pin_control[i] & 0x10) == 0x10)) {
                 // The user turned the pin OFF and the idle state is ON
                 // Set the pin timer
-                pin_timer[i] = IO_TIMER[i];
+                SET_PIN_TIMER(i, IO_TIMER[i]);
               }
             }
           }
@@ -6340,12 +10026,12 @@ UARTPrintf("\r\n");
               if (((Pending_pin_control[i] & 0x80) == 0x80) && ((pin_control[i] & 0x10) == 0x00)) {
                 // The user turned the pin ON and the idle state is OFF
                 // Set the pin timer
-                pin_timer[i] = IO_timer_value;
+                SET_PIN_TIMER(i, IO_timer_value);
               }
               if (((Pending_pin_control[i] & 0x80) == 0x00) && ((pin_control[i] & 0x10) == 0x10)) {
                 // The user turned the pin OFF and the idle state is ON
                 // Set the pin timer
-                pin_timer[i] = IO_timer_value;
+                SET_PIN_TIMER(i, IO_timer_value);
               }
             }
           }
@@ -6367,12 +10053,12 @@ UARTPrintf("\r\n");
               if (((Pending_pin_control[i] & 0x80) == 0x80) && ((pin_control[i] & 0x10) == 0x00)) {
                 // The user turned the pin ON and the idle state is OFF
                 // Set the pin timer
-                pin_timer[i] = IO_TIMER[i];
+                SET_PIN_TIMER(i, IO_TIMER[i]);
               }
               if (((Pending_pin_control[i] & 0x80) == 0x00) && ((pin_control[i] & 0x10) == 0x10)) {
                 // The user turned the pin OFF and the idle state is ON
                 // Set the pin timer
-                pin_timer[i] = IO_TIMER[i];
+                SET_PIN_TIMER(i, IO_TIMER[i]);
 	      }
             }
           }
@@ -6401,12 +10087,12 @@ UARTPrintf("\r\n");
               if (((Pending_pin_control[i] & 0x80) == 0x80) && ((pin_control[i] & 0x10) == 0x00)) {
                 // The user turned the pin ON and the idle state is OFF
                 // Set the pin timer
-                pin_timer[i] = IO_timer_value;
+                SET_PIN_TIMER(i, IO_timer_value);
               }
               if (((Pending_pin_control[i] & 0x80) == 0x00) && ((pin_control[i] & 0x10) == 0x10)) {
                 // The user turned the pin OFF and the idle state is ON
                 // Set the pin timer
-                pin_timer[i] = IO_timer_value;
+                SET_PIN_TIMER(i, IO_timer_value);
 	      }
             }
           }
@@ -6571,9 +10257,13 @@ UARTPrintf("\r\n");
             // Update the stored_pin_control[] variables
 	    
 	    if (i < 16) {
+#if EEPROM_WRITE_CACHE == 1
+	      eeprom_cache_write(&stored_pin_control[i], pin_control[i]);
+#else // EEPROM_WRITE_CACHE == 0
 	      unlock_eeprom();
               if (stored_pin_control[i] != pin_control[i]) stored_pin_control[i] = pin_control[i];
 	      lock_eeprom();
+#endif // EEPROM_WRITE_CACHE == 1
 	    }
 	    
 #if PCF8574_SUPPORT == 1
@@ -6605,6 +10295,11 @@ UARTPrintf("\r\n");
       }
     }
 
+#if LINKED_PIN_MASKS == 1
+    // The pin types may have changed
+    build_linked_masks();
+#endif // LINKED_PIN_MASKS == 1
+
     // Update the bit registers with the changed Output pin states
     encode_bit_registers(0);
     
@@ -6665,22 +10360,38 @@ UARTPrintf("\r\n");
         if (stored_hostaddr[i] != Pending_hostaddr[i]) {
           // Write the new octet to the EEPROM and signal a restart
           stored_hostaddr[i] = Pending_hostaddr[i];
+#if HOT_APPLY_CONFIG == 1
+          hot_apply |= HOT_APPLY_HOST;
+#else // HOT_APPLY_CONFIG == 0
           restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
         }
         if (stored_draddr[i] != Pending_draddr[i]) {
           // Write the new octet to the EEPROM and signal a restart
           stored_draddr[i] = Pending_draddr[i];
+#if HOT_APPLY_CONFIG == 1
+          hot_apply |= HOT_APPLY_ROUTE;
+#else // HOT_APPLY_CONFIG == 0
           restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
         }
         if (stored_netmask[i] != Pending_netmask[i]) {
           // Write the new octet to the EEPROM and signal a restart
           stored_netmask[i] = Pending_netmask[i];
+#if HOT_APPLY_CONFIG == 1
+          hot_apply |= HOT_APPLY_ROUTE;
+#else // HOT_APPLY_CONFIG == 0
           restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
         }
         if (stored_mqttserveraddr[i] != Pending_mqttserveraddr[i]) {
           // Write the new octet to the EEPROM and signal a restart
           stored_mqttserveraddr[i] = Pending_mqttserveraddr[i];
+#if HOT_APPLY_CONFIG == 1
+          hot_apply |= HOT_APPLY_MQTT;
+#else // HOT_APPLY_CONFIG == 0
           restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
         }
       }
     }
@@ -6689,11 +10400,17 @@ UARTPrintf("\r\n");
     if (stored_port != Pending_port) {
       // Write the new Port number to the EEPROM
       stored_port = Pending_port;
+#if HOT_APPLY_CONFIG == 1
+      // hot_apply_config() will replace the old port in the
+      // uip_listenports table with the new port.
+      hot_apply |= HOT_APPLY_PORT;
+#else // HOT_APPLY_CONFIG == 0
       // A firmware restart will occur to cause this change to take effect.
       // The restart process will call uip_init() which will zero out all
       // entries in the uip_listenports table, and will then put the new
       // listenport number in the table.
       restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
     }
   
     // Check for changes in the Device Name
@@ -6708,7 +10425,11 @@ UARTPrintf("\r\n");
           if (mqtt_enabled) {
             // If MQTT is enabled a restart is required as this affects the
 	    // MQTT topic name.
+#if HOT_APPLY_CONFIG == 1
+            hot_apply |= HOT_APPLY_MQTT;
+#else // HOT_APPLY_CONFIG == 0
             restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
 	  }
 #endif // BUILD_SUPPORT == MQTT_BUILD
         }
@@ -6719,8 +10440,12 @@ UARTPrintf("\r\n");
     if (stored_mqttport != Pending_mqttport) {
       // Write the new MQTT Host Port number to the EEPROM
       stored_mqttport = Pending_mqttport;
+#if HOT_APPLY_CONFIG == 1
+      hot_apply |= HOT_APPLY_MQTT;
+#else // HOT_APPLY_CONFIG == 0
       // A firmware restart will occur to cause this change to take effect
       restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
     }
     
     // Check for changes in the Username or Password
@@ -6731,13 +10456,21 @@ UARTPrintf("\r\n");
       for(i=0; i<11; i++) {
         if (stored_mqtt_username[i] != Pending_mqtt_username[i]) {
           stored_mqtt_username[i] = Pending_mqtt_username[i];
+#if HOT_APPLY_CONFIG == 1
+          hot_apply |= HOT_APPLY_MQTT;
+#else // HOT_APPLY_CONFIG == 0
           // A firmware restart will occur to cause this change to take effect
           restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
         }
         if (stored_mqtt_password[i] != Pending_mqtt_password[i]) {
           stored_mqtt_password[i] = Pending_mqtt_password[i];
+#if HOT_APPLY_CONFIG == 1
+          hot_apply |= HOT_APPLY_MQTT;
+#else // HOT_APPLY_CONFIG == 0
           // A firmware restart will occur to cause this change to take effect
           restart_request = 1;
+#endif // HOT_APPLY_CONFIG == 1
         }
       }
     }
@@ -6781,6 +10514,13 @@ UARTPrintf("\r\n");
       reboot_request = 1;
     }
   }
+#if HOT_APPLY_CONFIG == 1
+  // Settings that can be applied without a restart use the same sequence so
+  // that the POST response and any affected MQTT session are closed first.
+  if (hot_apply && restart_reboot_step == RESTART_REBOOT_IDLE) {
+    restart_reboot_step = RESTART_REBOOT_ARM;
+  }
+#endif // HOT_APPLY_CONFIG == 1
   
   
   // We've set the restart_request or reboot_request bytes (if needed) and
@@ -6788,9 +10528,24 @@ UARTPrintf("\r\n");
   // will be called. This is done this way because we need to let
   // uip_periodic() handle the closing of connections.
 
+#if HTTP_SIZE_CACHE == 1
+  // The changes applied above may change the size of the IO Control and
+  // Configuration pages.
+  if (parse_complete) httpd_page_size_invalidate();
+#endif // HTTP_SIZE_CACHE == 1
+
+#if HTTP_ETAG_SUPPORT == 1
+  // The changes applied above may change the Configuration page, so it
+  // gets a new ETag.
+  if (parse_complete || mqtt_parse_complete) httpd_page_version_bump();
+#endif // HTTP_ETAG_SUPPORT == 1
+
   // Reset parse_complete for future changes
   parse_complete = 0;
   mqtt_parse_complete = 0;
+#if RUNTIME_DIRTY_FLAGS == 1
+  runtime_dirty = 0;
+#endif // RUNTIME_DIRTY_FLAGS == 1
 
   // Periodic check of the stack overflow guardband
   if (stack_limit1 != 0xaa || stack_limit2 != 0x55) {
@@ -6814,6 +10569,34 @@ UARTPrintf("\r\n");
   }
 }
 
+#if RAM_HEADROOM_STATISTICS == 1
+void stack_paint(void)
+{
+  // Fills the unused part of the stack with STACK_PAINT so that stack_peak()
+  // can find the deepest point the stack reaches. Everything below the
+  // locals of this function is unused. A few bytes are left unpainted for
+  // the loop itself. Called at the start of main() and when the Link Error
+  // Statistics are cleared.
+  uint8_t *p;
+  uint8_t marker;
+  
+  for (p = (uint8_t *)STACK_BOTTOM; p < &marker - 8; p++) *p = STACK_PAINT;
+}
+
+
+uint16_t stack_peak(void)
+{
+  // Returns the most stack used (in bytes) since the last stack_paint(). The
+  // first byte from the bottom of the stack that no longer holds the paint
+  // marks the deepest point reached.
+  uint8_t *p;
+  
+  p = (uint8_t *)STACK_BOTTOM;
+  while (p < (uint8_t *)STACK_TOP && *p == STACK_PAINT) p++;
+  return (uint16_t)((uint8_t *)STACK_TOP + 1 - p);
+}
+#endif // RAM_HEADROOM_STATISTICS == 1
+
 #if LINKED_SUPPORT == 1
 uint8_t chk_iotype(uint8_t pin_byte, int pin_index, uint8_t chk_mask)
 {
@@ -6888,6 +10671,37 @@ uint8_t chk_iotype(uint8_t pin_byte, int pin_index, uint8_t chk_mask)
 #endif // LINKED_SUPPORT == 1
 
 
+#if LINKED_PIN_MASKS == 1
+void build_linked_masks(void)
+{
+  // Compiles the pin types in the pin_control bytes into input_pin_mask and
+  // linked_src_mask. Called at boot and whenever the pin_control bytes are
+  // updated from the Pending_pin_control bytes.
+  int i;
+#if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+  uint16_t mask;
+  
+  input_pin_mask = 0;
+  linked_src_mask = 0;
+  for (i=0, mask=1; i<16; i++, mask<<=1) {
+#endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+#if PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+  uint32_t mask;
+  
+  input_pin_mask = 0;
+  linked_src_mask = 0;
+  for (i=0, mask=1; i<24; i++, mask<<=1) {
+#endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
+    if (chk_iotype(pin_control[i], i, 0x03) == 0x01) {
+      input_pin_mask |= mask;
+      // An Input that is Linked is a Linked pin 1 to 8 or 17 to 20
+      if ((pin_control[i] & 0x03) == 0x02) linked_src_mask |= mask;
+    }
+  }
+}
+#endif // LINKED_PIN_MASKS == 1
+
+
 void check_restart_reboot(void)
 {
   // Function provides the sequence and timing required to shut down
@@ -6920,7 +10734,11 @@ void check_restart_reboot(void)
 				//  homeassistant/sensor/macaddressxx/BME280-1xxxx/config
 				//  homeassistant/sensor/macaddressxx/BME280-2xxxx/config
 
+#if HOT_APPLY_CONFIG == 1
+  if (restart_request || reboot_request || hot_apply) {
+#else // HOT_APPLY_CONFIG == 0
   if (restart_request || reboot_request) {
+#endif // HOT_APPLY_CONFIG == 1
     // A restart or reboot has been requested. The restart and reboot
     // requests are set in the check_runtime_changes() function if a restart
     // or reboot is needed.
@@ -6957,6 +10775,14 @@ void check_restart_reboot(void)
       if (t100ms_ctr1 > 9) {
         if (mqtt_enabled) restart_reboot_step = RESTART_REBOOT_SENDOFFLINE;
 	else restart_reboot_step = RESTART_REBOOT_FINISH;
+#if HOT_APPLY_CONFIG == 1
+        // If only the HTTP Port is being hot applied the MQTT session is
+	// left running.
+        if (restart_request == 0 && reboot_request == 0
+	 && (hot_apply & (HOT_APPLY_HOST | HOT_APPLY_ROUTE | HOT_APPLY_MQTT)) == 0) {
+	  restart_reboot_step = RESTART_REBOOT_FINISH;
+	}
+#endif // HOT_APPLY_CONFIG == 1
         // Clear 100ms timer to delay the next step
         t100ms_ctr1 = 0;
       }
@@ -6969,9 +10795,13 @@ void check_restart_reboot(void)
        // This message is always published with QOS 0
        if (mqtt_start == MQTT_START_COMPLETE) {
           // Publish the availability "offline" message
+#if MQTT_TOPIC_PREFIX == 1
+          topic_build(topic_base, TOPIC_SUFFIX_AVAILABILITY);
+#else // MQTT_TOPIC_PREFIX == 0
           strcpy(topic_base, devicetype);
           strcat(topic_base, stored_devicename);
           strcat(topic_base, "/availability");
+#endif // MQTT_TOPIC_PREFIX == 1
           mqtt_publish(&mqttclient,
                        topic_base,
                        "offline",
@@ -7052,6 +10882,13 @@ void check_restart_reboot(void)
 	// Firmware restart
 	restart();
       }
+#if HOT_APPLY_CONFIG == 1
+      if (hot_apply) {
+        restart_reboot_step = RESTART_REBOOT_IDLE;
+	// Apply the network and MQTT settings without a restart
+	hot_apply_config();
+      }
+#endif // HOT_APPLY_CONFIG == 1
       break;
       
     } // end switch
@@ -7069,9 +10906,16 @@ void restart(void)
 
   LEDcontrol(0); // Turn LED off
 
+#if EEPROM_WRITE_CACHE == 1
+  eeprom_cache_flush(); // The restart re-reads the EEPROM settings
+#endif // EEPROM_WRITE_CACHE == 1
+
   parse_complete = 0;
   reboot_request = 0;
   restart_request = 0;
+#if HOT_APPLY_CONFIG == 1
+  hot_apply = 0;           // The restart applies all settings
+#endif // HOT_APPLY_CONFIG == 1
   mqtt_close_tcp = 0;
   
 #if BUILD_SUPPORT == MQTT_BUILD
@@ -7122,6 +10966,81 @@ void restart(void)
 }
 
 
+#if HOT_APPLY_CONFIG == 1
+void hot_apply_config(void)
+{
+  // Applies IP Address, Gateway Address, Netmask, HTTP Port and MQTT
+  // setting changes without a restart. The ENC28J60 is not re-initialized
+  // so the Ethernet link stays up, and only the connections affected by the
+  // change are closed. Called from check_restart_reboot() after any affected
+  // MQTT session has been disconnected.
+  int i;
+
+  if (hot_apply & (HOT_APPLY_HOST | HOT_APPLY_ROUTE)) {
+    uip_ipaddr(IpAddr,
+               stored_hostaddr[3],
+               stored_hostaddr[2],
+               stored_hostaddr[1],
+               stored_hostaddr[0]);
+    uip_sethostaddr(IpAddr);
+    uip_ipaddr(IpAddr,
+               stored_draddr[3],
+               stored_draddr[2],
+               stored_draddr[1],
+               stored_draddr[0]);
+    uip_setdraddr(IpAddr);
+    uip_ipaddr(IpAddr,
+               stored_netmask[3],
+               stored_netmask[2],
+               stored_netmask[1],
+               stored_netmask[0]);
+    uip_setnetmask(IpAddr);
+    // Clear the ARP table as the neighbors may have changed
+    uip_arp_init();
+  }
+
+  for (i = 0; i < UIP_CONNS; i++) {
+    // Connections made to the old IP Address or the old HTTP Port can no
+    // longer be used.
+    if ((hot_apply & HOT_APPLY_HOST)
+     || ((hot_apply & HOT_APPLY_PORT) && uip_conns[i].lport == htons(Port_Httpd))) {
+      uip_conns[i].tcpstateflags = UIP_CLOSED;
+    }
+  }
+
+  if (hot_apply & HOT_APPLY_PORT) {
+    // Move the HTTP listener to the new port
+    uip_unlisten(htons(Port_Httpd));
+    Port_Httpd = stored_port;
+    uip_listen(htons(Port_Httpd));
+  }
+
+#if BUILD_SUPPORT == MQTT_BUILD
+  if (hot_apply & (HOT_APPLY_HOST | HOT_APPLY_ROUTE | HOT_APPLY_MQTT)) {
+    uip_ipaddr(IpAddr,
+               stored_mqttserveraddr[3],
+               stored_mqttserveraddr[2],
+               stored_mqttserveraddr[1],
+               stored_mqttserveraddr[0]);
+    uip_setmqttserveraddr(IpAddr);
+    Port_Mqttd = stored_mqttport;
+    // Reconnect the MQTT session with the new settings. The session was
+    // disconnected and its TCP connection closed by check_restart_reboot().
+    mqtt_close_tcp = 0;
+    mqtt_start = MQTT_START_TCP_CONNECT;
+    mqtt_start_status = MQTT_START_NOT_STARTED;
+    mqtt_start_ctr1 = 0;
+    mqtt_sanity_ctr = 0;
+    MQTT_error_status = 0;
+    mqtt_restart_step = MQTT_RESTART_IDLE;
+  }
+#endif // BUILD_SUPPORT == MQTT_BUILD
+
+  hot_apply = 0;
+}
+#endif // HOT_APPLY_CONFIG == 1
+
+
 void reboot(void)
 {
   // We need to do a hardware reset (reboot).
@@ -7130,6 +11049,13 @@ void reboot(void)
   // retain their values and get used in code at runtime if not properly set
   // by startup initialization.
   
+#if EEPROM_WRITE_CACHE == 1
+  eeprom_cache_flush(); // Don't lose pending EEPROM writes
+#endif // EEPROM_WRITE_CACHE == 1
+#if TRACE_RING_SUPPORT == 1
+  trace_sync(); // Keep the trace up to the reboot
+#endif // TRACE_RING_SUPPORT == 1
+
   // Flicker LED for 1 second to indicate deliberate reboot
   fastflash();
   LEDcontrol(0);  // turn LED off
@@ -7197,6 +11123,9 @@ void read_input_pins(uint8_t init_flag)
   uint16_t mask;
   int i;
   int j;
+#if PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
+  uint16_t io_sample;
+#endif // PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
   
   // Loop across all i/o's and read input port register:bit state
   // and 
@@ -7204,10 +11133,22 @@ void read_input_pins(uint8_t init_flag)
   // the bits in the ON_OFF_word where the corresponding bits match in _new1
   // and _new2 (ie, a debounced change occurred).
 
+#if INPUT_PORT_SAMPLING == 1
+  // Sample and debounce all of the STM8 pins at once, then update the
+  // Input pins in the ON_OFF_word.
+  debounce_io_pins();
+  ON_OFF_word = (uint16_t)((ON_OFF_word & ~io_input_mask) | (io_debounced & io_input_mask));
+#else // INPUT_PORT_SAMPLING == 0
+#if PINOUT_CONST_MASKS == 1
+  io_sample = gather_io_pins();
+#endif // PINOUT_CONST_MASKS == 1
   for (i=0, mask=1; i<16; i++, mask<<=1) {
     // Is the corresponding bit of the input port register set?
+#if PINOUT_CONST_MASKS == 1
+    if (io_sample & mask)
+#else // PINOUT_CONST_MASKS == 0
 #if PINOUT_OPTION_SUPPORT == 0
-    if ( io_reg[ io_map[i].port ].idr & io_map[i].bit)
+    if ( INPUT_IDR(io_map[i].port) & io_map[i].bit)
 #endif // PINOUT_OPTION_SUPPORT == 0
 #if PINOUT_OPTION_SUPPORT == 1
 #if SUPPORT_174 == 0
@@ -7216,8 +11157,9 @@ void read_input_pins(uint8_t init_flag)
 #if SUPPORT_174 == 1
     j = calc_PORT_BIT_index((uint8_t)i);
 #endif // SUPPORT_174 == 1
-    if ( io_reg[ io_map[j].port ].idr & io_map[j].bit)
+    if ( INPUT_IDR(io_map[j].port) & io_map[j].bit)
 #endif // PINOUT_OPTION_SUPPORT == 1
+#endif // PINOUT_CONST_MASKS == 1
       ON_OFF_word_new1 |= (uint16_t)mask;
     else
       ON_OFF_word_new1 &= (uint16_t)(~mask);
@@ -7231,6 +11173,7 @@ void read_input_pins(uint8_t init_flag)
       }
     }
   }
+#endif // INPUT_PORT_SAMPLING == 1
 
   // Copy _new1 to _new2 for the next round
   ON_OFF_word_new2 = ON_OFF_word_new1;
@@ -7277,6 +11220,9 @@ void read_input_pins(uint8_t init_flag)
   uint8_t byte_mask;
   int i;
   int j;
+#if PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
+  uint16_t io_sample;
+#endif // PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
   
   
   // Loop across all i/o's on the STM8 and read input port register:bit state
@@ -7285,10 +11231,24 @@ void read_input_pins(uint8_t init_flag)
   // the bits in the ON_OFF_word where the corresponding bits match in _new1
   // and _new2 (ie, a debounced change occurred).
 
+#if INPUT_PORT_SAMPLING == 1
+  // Sample and debounce all of the STM8 pins at once, then update the
+  // Input pins in the ON_OFF_word. The STM8 pins in ON_OFF_word_new1 are kept
+  // equal to the debounced states.
+  debounce_io_pins();
+  ON_OFF_word = (ON_OFF_word & ~(uint32_t)io_input_mask) | (uint32_t)(io_debounced & io_input_mask);
+  ON_OFF_word_new1 = (ON_OFF_word_new1 & 0xffff0000) | (uint32_t)io_debounced;
+#else // INPUT_PORT_SAMPLING == 0
+#if PINOUT_CONST_MASKS == 1
+  io_sample = gather_io_pins();
+#endif // PINOUT_CONST_MASKS == 1
   for (i=0, mask=1; i<16; i++, mask<<=1) {
     // Is the corresponding bit of the input port register set?
+#if PINOUT_CONST_MASKS == 1
+    if (io_sample & mask)
+#else // PINOUT_CONST_MASKS == 0
 #if PINOUT_OPTION_SUPPORT == 0
-    if ( io_reg[ io_map[i].port ].idr & io_map[i].bit)
+    if ( INPUT_IDR(io_map[i].port) & io_map[i].bit)
 #endif // PINOUT_OPTION_SUPPORT == 0
 #if PINOUT_OPTION_SUPPORT == 1
 #if SUPPORT_174 == 0
@@ -7297,8 +11257,9 @@ void read_input_pins(uint8_t init_flag)
 #if SUPPORT_174 == 1
     j = calc_PORT_BIT_index((uint8_t)i);
 #endif // SUPPORT_174 == 1
-    if ( io_reg[ io_map[j].port ].idr & io_map[j].bit)
+    if ( INPUT_IDR(io_map[j].port) & io_map[j].bit)
 #endif // PINOUT_OPTION_SUPPORT == 1
+#endif // PINOUT_CONST_MASKS == 1
       ON_OFF_word_new1 |= (uint32_t)mask;
     else
       ON_OFF_word_new1 &= (uint32_t)(~mask);
@@ -7312,6 +11273,7 @@ void read_input_pins(uint8_t init_flag)
       }
     }
   }
+#endif // INPUT_PORT_SAMPLING == 1
 
 
 #if PCF8574_SUPPORT == 1
@@ -7373,16 +11335,37 @@ void read_input_pins(uint8_t init_flag)
   uint16_t mask;
   int i;
   int j;
+#if PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
+  uint16_t io_sample;
+#endif // PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
+#if INPUT_PORT_SAMPLING == 1
+  uint16_t changes;
+#endif // INPUT_PORT_SAMPLING == 1
   
   // Loop across all i/o's and read input port register:bit state
   // and 
   // Compare the _new1 and _new2 samples then, for Input pins only, update
   // the bits in the ON_OFF_word where the corresponding bits match in _new1
   // and _new2 (ie, a debounced change occurred).
+#if INPUT_PORT_SAMPLING == 1
+  // Sample and debounce all of the STM8 pins at once. A debounced change on
+  // a Linked pin 1 to 8 is recorded in linked_edge (unless init_flag is
+  // set), then the Input pins (including Linked pins
+  // 1 to 8) are updated in the ON_OFF_word.
+  changes = debounce_io_pins();
+  if (init_flag == 0) linked_edge |= (uint8_t)(changes & io_linked_mask);
+  ON_OFF_word = (uint16_t)((ON_OFF_word & ~io_input_mask) | (io_debounced & io_input_mask));
+#else // INPUT_PORT_SAMPLING == 0
+#if PINOUT_CONST_MASKS == 1
+  io_sample = gather_io_pins();
+#endif // PINOUT_CONST_MASKS == 1
   for (i=0, mask=1; i<16; i++, mask<<=1) {
     // Is the corresponding bit of the input port register set?
+#if PINOUT_CONST_MASKS == 1
+    if (io_sample & mask) {
+#else // PINOUT_CONST_MASKS == 0
 #if PINOUT_OPTION_SUPPORT == 0
-    if ( io_reg[ io_map[i].port ].idr & io_map[i].bit) {
+    if ( INPUT_IDR(io_map[i].port) & io_map[i].bit) {
 #endif // PINOUT_OPTION_SUPPORT == 0
 #if PINOUT_OPTION_SUPPORT == 1
 #if SUPPORT_174 == 0
@@ -7391,14 +11374,16 @@ void read_input_pins(uint8_t init_flag)
 #if SUPPORT_174 == 1
     j = calc_PORT_BIT_index((uint8_t)i);
 #endif // SUPPORT_174 == 1
-    if ( io_reg[ io_map[j].port ].idr & io_map[j].bit) {
+    if ( INPUT_IDR(io_map[j].port) & io_map[j].bit) {
 #endif // PINOUT_OPTION_SUPPORT == 1
+#endif // PINOUT_CONST_MASKS == 1
       ON_OFF_word_new1 |= (uint16_t)mask;
     }
     else {
       ON_OFF_word_new1 &= (uint16_t)(~mask);
     }
     
+#if LINKED_PIN_MASKS == 0
     if ((ON_OFF_word_new1 & mask) == (ON_OFF_word_new2 & mask)) {
       // Check for a debounced edge on pins 1 to 8
       if ((ON_OFF_word & mask) != (ON_OFF_word_new2 & mask)) {
@@ -7425,7 +11410,23 @@ void read_input_pins(uint8_t init_flag)
         else                         ON_OFF_word &= ~mask; // clear
       }
     }
+#endif // LINKED_PIN_MASKS == 0
+  }
+#if LINKED_PIN_MASKS == 1
+  {
+    uint16_t update;
+    // The pins where _new1 and _new2 agree are debounced. For the Input pins
+    // among them the ON_OFF_word is updated, and a change on a Linked pin 1
+    // to 8 is an edge for the linked_edge byte. The boot reads (init_flag
+    // set) don't record edges.
+    update = (uint16_t)(~(ON_OFF_word_new1 ^ ON_OFF_word_new2) & input_pin_mask);
+    if (init_flag == 0) {
+      linked_edge |= (uint8_t)((ON_OFF_word ^ ON_OFF_word_new2) & update & linked_src_mask);
+    }
+    ON_OFF_word = (uint16_t)((ON_OFF_word & ~update) | (ON_OFF_word_new2 & update));
   }
+#endif // LINKED_PIN_MASKS == 1
+#endif // INPUT_PORT_SAMPLING == 1
 
   // Copy _new1 to _new2 for the next round
   ON_OFF_word_new2 = ON_OFF_word_new1;
@@ -7433,7 +11434,11 @@ void read_input_pins(uint8_t init_flag)
   // Update the pin_control bytes to match the debounced ON_OFF_word.
   // Only input pin_control bytes are updated.
   for (i=0, mask=1; i<16; i++, mask<<=1) {
+#if LINKED_PIN_MASKS == 1
+    if (input_pin_mask & mask) {
+#else // LINKED_PIN_MASKS == 0
     if (chk_iotype(pin_control[i], i, 0x03) == 0x01) {
+#endif // LINKED_PIN_MASKS == 1
       if (ON_OFF_word & mask) pin_control[i] |= 0x80;
       else                    pin_control[i] &= 0x7f;
     }
@@ -7467,16 +11472,40 @@ void read_input_pins(uint8_t init_flag)
   uint16_t linked_mask;
   int i;
   int j;
+#if PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
+  uint16_t io_sample;
+#endif // PINOUT_CONST_MASKS == 1 && INPUT_PORT_SAMPLING == 0
+#if INPUT_PORT_SAMPLING == 1
+  uint16_t changes;
+#endif // INPUT_PORT_SAMPLING == 1
   
   // Loop across all STM8 i/o's and read input port register:bit state
   // and 
   // Compare the _new1 and _new2 samples then, for Input pins only, update
   // the bits in the ON_OFF_word where the corresponding bits match in _new1
   // and _new2 (ie, a debounced change occurred).
+#if INPUT_PORT_SAMPLING == 1
+  // Sample and debounce all of the STM8 pins at once. A debounced change on
+  // a Linked pin 1 to 8 is recorded in linked_edge (unless init_flag is
+  // set), then the Input pins (including Linked pins
+  // 1 to 8) are updated in the ON_OFF_word. The STM8 pins in
+  // ON_OFF_word_new1 are kept equal to the debounced states so that the
+  // update loop below agrees.
+  changes = debounce_io_pins();
+  if (init_flag == 0) linked_edge |= (uint8_t)(changes & io_linked_mask);
+  ON_OFF_word = (ON_OFF_word & ~(uint32_t)io_input_mask) | (uint32_t)(io_debounced & io_input_mask);
+  ON_OFF_word_new1 = (ON_OFF_word_new1 & 0xffff0000) | (uint32_t)io_debounced;
+#else // INPUT_PORT_SAMPLING == 0
+#if PINOUT_CONST_MASKS == 1
+  io_sample = gather_io_pins();
+#endif // PINOUT_CONST_MASKS == 1
   for (i=0, mask=1; i<16; i++, mask<<=1) {
     // Is the corresponding bit of the input port register set?
+#if PINOUT_CONST_MASKS == 1
+    if (io_sample & mask) {
+#else // PINOUT_CONST_MASKS == 0
 #if PINOUT_OPTION_SUPPORT == 0
-    if ( io_reg[ io_map[i].port ].idr & io_map[i].bit) {
+    if ( INPUT_IDR(io_map[i].port) & io_map[i].bit) {
 #endif // PINOUT_OPTION_SUPPORT == 0
 #if PINOUT_OPTION_SUPPORT == 1
 #if SUPPORT_174 == 0
@@ -7485,14 +11514,16 @@ void read_input_pins(uint8_t init_flag)
 #if SUPPORT_174 == 1
     j = calc_PORT_BIT_index((uint8_t)i);
 #endif // SUPPORT_174 == 1
-    if ( io_reg[ io_map[j].port ].idr & io_map[j].bit) {
+    if ( INPUT_IDR(io_map[j].port) & io_map[j].bit) {
 #endif // PINOUT_OPTION_SUPPORT == 1
+#endif // PINOUT_CONST_MASKS == 1
       ON_OFF_word_new1 |= (uint32_t)mask;
     }
     else {
       ON_OFF_word_new1 &= (uint32_t)(~mask);
     }
     
+#if LINKED_PIN_MASKS == 0
     if ((ON_OFF_word_new1 & mask) == (ON_OFF_word_new2 & mask)) {
       // Check for a debounced edge on pins 1 to 8
       if ((ON_OFF_word & mask) != (ON_OFF_word_new2 & mask)) {
@@ -7515,7 +11546,9 @@ void read_input_pins(uint8_t init_flag)
 	}
       }
     }
+#endif // LINKED_PIN_MASKS == 0
   }
+#endif // INPUT_PORT_SAMPLING == 1
 
 
 #if PCF8574_SUPPORT == 1
@@ -7530,6 +11563,7 @@ void read_input_pins(uint8_t init_flag)
     else
       ON_OFF_word_new1 &= (uint32_t)(~mask);
     
+#if LINKED_PIN_MASKS == 0
     if ((ON_OFF_word_new1 & mask) == (ON_OFF_word_new2 & mask)) {
       // Check for a debounced edge on pins 17 to 20
       if ((ON_OFF_word & mask) != (ON_OFF_word_new2 & mask)) {
@@ -7551,9 +11585,35 @@ void read_input_pins(uint8_t init_flag)
 	}
       }
     }
+#endif // LINKED_PIN_MASKS == 0
   }
 #endif // PCF8574_SUPPORT == 1
       
+#if LINKED_PIN_MASKS == 1
+  {
+    uint32_t update;
+    uint32_t edges;
+    // The pins where _new1 and _new2 agree are debounced. For the Input pins
+    // among them the ON_OFF_word is updated, and a change on a Linked pin 1
+    // to 8 or 17 to 20 is an edge for the linked_edge word (pins 17 to 20 are
+    // bits 8 to 11). The boot reads (init_flag set) don't record edges.
+    update = ~(ON_OFF_word_new1 ^ ON_OFF_word_new2) & input_pin_mask;
+    edges = (ON_OFF_word ^ ON_OFF_word_new2) & update & linked_src_mask;
+    if (init_flag == 0) {
+      linked_edge |= (uint16_t)((edges & 0x000000ff) | ((edges >> 8) & 0x00000f00));
+    }
+    ON_OFF_word = (ON_OFF_word & ~update) | (ON_OFF_word_new2 & update);
+    
+    // Update the pin_control bytes to match the debounced ON_OFF_word.
+    // Only input pin_control bytes are updated.
+    for (i=0, mask=1; i<24; i++, mask<<=1) {
+      if (update & mask) {
+        if (ON_OFF_word & mask) pin_control[i] |= 0x80;
+        else                    pin_control[i] &= 0x7f;
+      }
+    }
+  }
+#else // LINKED_PIN_MASKS == 0
   for (i=0, mask=1; i<24; i++, mask<<=1) {
     if ((ON_OFF_word_new1 & mask) == (ON_OFF_word_new2 & mask)) {
       // If the old and new bits match, and the bit is for an Input
@@ -7568,6 +11628,7 @@ void read_input_pins(uint8_t init_flag)
       }
     }
   }
+#endif // LINKED_PIN_MASKS == 1
 
   // Copy _new1 to _new2 for the next round
   ON_OFF_word_new2 = ON_OFF_word_new1;  
@@ -7700,6 +11761,10 @@ void write_output_pins(void)
   // Invert the output if the Invert_word has the corresponding bit set.
   xor_tmp = (uint16_t)(Invert_word ^ ON_OFF_word);
 
+#if OUTPUT_PORT_BATCH == 1
+  // Write the STM8 IO pins with one write per port
+  write_io_pins((uint16_t)xor_tmp);
+#else // OUTPUT_PORT_BATCH == 0
   // Loop across all IO and set or clear them according to the mask
   // Skip IO pins that are being used for UART, I2C or DS18B20  
   for (i=0; i<16; i++) {
@@ -7742,6 +11807,7 @@ void write_output_pins(void)
     }
 #endif // PINOUT_OPTION_SUPPORT == 1
   }
+#endif // OUTPUT_PORT_BATCH == 1
 }
 #endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
 
@@ -7787,6 +11853,10 @@ void write_output_pins(void)
   // Invert the output if the Invert_word has the corresponding bit set.
   xor_tmp = (uint32_t)(Invert_word ^ ON_OFF_word);
 
+#if OUTPUT_PORT_BATCH == 1
+  // Write the STM8 IO pins with one write per port
+  write_io_pins((uint16_t)xor_tmp);
+#else // OUTPUT_PORT_BATCH == 0
   // Loop across all IO and set or clear them according to the mask.
   // Skip IO pins that are being used for UART, I2C or DS18B20.
   for (i=0; i<16; i++) {
@@ -7830,6 +11900,7 @@ void write_output_pins(void)
     }
 #endif // PINOUT_OPTION_SUPPORT == 1
   }
+#endif // OUTPUT_PORT_BATCH == 1
 
 
 #if PCF8574_SUPPORT == 1
@@ -7885,6 +11956,83 @@ uint32_t calculate_timer(uint16_t timer_value)
 
 
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD
+#if PIN_TIMER_LIST == 1
+// With PIN_TIMER_LIST the running pin_timers are kept in a list sorted by
+// expiry time, so each 100ms tick only looks at the head of the list. A
+// running pin_timer keeps its start value in pin_timer[] (so the count is
+// non-zero while it runs) and the count is cleared when it expires, which is
+// what the code using the pin_timers checks for.
+#if PCF8574_SUPPORT == 0
+#define PIN_TIMERS	16
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+#define PIN_TIMERS	24
+#endif // PCF8574_SUPPORT == 1
+
+static uint32_t pin_timer_tick;           // 100ms ticks counted by
+                                          // decrement_pin_timers()
+static uint32_t pin_timer_expiry[PIN_TIMERS]; // pin_timer_tick at expiry
+static uint8_t pin_timer_next[PIN_TIMERS];   // Next pin in the list + 1,
+                                             // 0 = end of list
+static uint8_t pin_timer_head;            // First pin in the list + 1,
+                                          // 0 = list empty
+// Length of one count in 100ms ticks for each pin_timer resolution
+static const uint16_t pin_timer_unit[4] = { 1, 10, 600, 36000 };
+
+
+void start_pin_timer(uint8_t pin, uint16_t timer_value)
+{
+  // Sets pin_timer[pin] to timer_value and (re)places the pin in the expiry
+  // list. A timer_value with a zero count just removes the pin from the
+  // list.
+  uint8_t *link;
+  uint32_t expiry;
+  
+  pin_timer[pin] = timer_value;
+  
+  // Remove the pin if it is already running
+  link = &pin_timer_head;
+  while (*link != 0) {
+    if (*link == (uint8_t)(pin + 1)) {
+      *link = pin_timer_next[pin];
+      break;
+    }
+    link = &pin_timer_next[*link - 1];
+  }
+  
+  if ((timer_value & 0x3fff) == 0) return;
+  
+  // Insert the pin ahead of the first pin that expires later
+  expiry = pin_timer_tick + ((uint32_t)(timer_value & 0x3fff) * pin_timer_unit[timer_value >> 14]);
+  pin_timer_expiry[pin] = expiry;
+  link = &pin_timer_head;
+  while (*link != 0) {
+    if ((int32_t)(pin_timer_expiry[*link - 1] - expiry) > 0) break;
+    link = &pin_timer_next[*link - 1];
+  }
+  pin_timer_next[pin] = *link;
+  *link = (uint8_t)(pin + 1);
+}
+
+
+void decrement_pin_timers(void)
+{
+  // Called once per 100ms. Expires the pin_timers at the head of the list
+  // that have reached their expiry tick by clearing their count.
+  uint8_t pin;
+  
+  pin_timer_tick++;
+  while (pin_timer_head != 0) {
+    pin = (uint8_t)(pin_timer_head - 1);
+    if ((int32_t)(pin_timer_tick - pin_timer_expiry[pin]) < 0) break;
+    pin_timer_head = pin_timer_next[pin];
+    pin_timer[pin] &= 0xc000;
+#if RUNTIME_DIRTY_FLAGS == 1
+    runtime_dirty |= RUNTIME_TIMERS;
+#endif // RUNTIME_DIRTY_FLAGS == 1
+  }
+}
+#else // PIN_TIMER_LIST == 0
 void decrement_pin_timers(void)
 {
   int i;
@@ -7892,6 +12040,11 @@ void decrement_pin_timers(void)
   // This function is called once per 100ms, however pin_timers are
   // decremented at 0.1 second, 1 second, 1 minute, or 1 hour intervals
   // depending on the settings for that counter.
+#if RUNTIME_DIRTY_FLAGS == 1
+  // Any of the timers may reach zero, so have check_runtime_changes() check
+  // for expired timers.
+  runtime_dirty |= RUNTIME_TIMERS;
+#endif // RUNTIME_DIRTY_FLAGS == 1
 #if PCF8574_SUPPORT == 0
   for(i=0; i<16; i++) {
 #endif // PCF8574_SUPPORT == 0
@@ -7948,6 +12101,7 @@ void decrement_pin_timers(void)
     }
   }
 }
+#endif // PIN_TIMER_LIST == 1
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD
 
 
@@ -8068,8 +12222,11 @@ void restore_eeprom_debug_bytes(void)
 {
   // Restore debug_bytes from EEPROM to RAM
   
-  debug_bytes[0] = stored_debug_bytes[0]; // debug[0]: Not currently used
-  debug_bytes[1] = stored_debug_bytes[1]; // debug[1]: Not currently used
+  // debug[0] and debug[1]: With FLASH_COPY_STAGING the duration in ms of
+  // the last Flash copy from the I2C EEPROM, high byte first. Otherwise not
+  // currently used.
+  debug_bytes[0] = stored_debug_bytes[0];
+  debug_bytes[1] = stored_debug_bytes[1];
   
   // debug[2]: The ENC28J60 revision part of debug[2] is restored in the
   // Enc28j60Init() function.
@@ -8094,11 +12251,17 @@ void update_debug_storage1() {
   // This function writes the debug[] values to EEPROM. The write occurs only
   // if the debug[] value differs from what is in EEPROM to prevent excessive
   // EEPROM writes.
+#if EEPROM_WRITE_CACHE == 1
+  for (i = 0; i < 10; i++) {
+    eeprom_cache_write(&stored_debug_bytes[i], debug_bytes[i]);
+  }
+#else // EEPROM_WRITE_CACHE == 0
   unlock_eeprom();
   for (i = 0; i < 10; i++) {
     if (stored_debug_bytes[i] != debug_bytes[i]) stored_debug_bytes[i] = debug_bytes[i];
   }
   lock_eeprom();  
+#endif // EEPROM_WRITE_CACHE == 1
 }
 
 
@@ -80,6 +80,40 @@ void spi_init(void)
   // wait 50ms
   wait_timer((uint16_t)50000); // Wait 50ms
 
+#if ENC28J60_HW_SPI == 1
+  // Set up the hardware SPI peripheral. The board must be re-wired so that
+  // the ENC28J60 SCK, SI, and SO connect to the STM8 SPI pins:
+  // Port C
+  //   Bit 7 - Pin 34 - Input  - SPI MISO - ENC28J60 SO
+  //   Bit 6 - Pin 33 - Output - SPI MOSI - ENC28J60 SI
+  //   Bit 5 - Pin 30 - Output - SPI SCK  - ENC28J60 SCK
+  //   Bit 1 - Pin 26 - Output - GPIO     - ENC28J60 -CS
+  // The -CS pin is still driven by select() / deselect() in the Enc28j60.c
+  // module.
+  //
+  // The SPI peripheral takes over PC5, PC6, and PC7 once SPE is set, but
+  // the SCK and MOSI pins are also set to Output PP Fast mode here so they
+  // have clean edges at 8MHz.
+  PC_DDR |= (uint8_t)0x60;    // 0b01100000 SCK and MOSI outputs
+  PC_CR1 |= (uint8_t)0x60;    // Push Pull
+  PC_CR2 |= (uint8_t)0x60;    // Fast mode
+  PC_DDR &= (uint8_t)(~0x80); // MISO input
+  
+  // Enable the SPI clock (it is disabled in clock_init())
+  CLK_PCKENR1 |= CLK_PCKENR1_SPI;
+  
+  // Configure the SPI:
+  //   SPI_CR2: Software slave management with the internal slave select
+  //            held high (SSM = 1, SSI = 1) so the peripheral stays in
+  //            Master mode. Full duplex.
+  //   SPI_CR1: MSB first, fMASTER / 2 = 8MHz (BR = 000), Master, SPI mode
+  //            0,0 (CPOL = 0, CPHA = 0) as required by the ENC28J60, and
+  //            enable the peripheral last.
+  SPI_CR2 = (uint8_t)(SPI_CR2_SSM | SPI_CR2_SSI);
+  SPI_CR1 = (uint8_t)SPI_CR1_MSTR;
+  SPI_CR1 |= (uint8_t)SPI_CR1_SPE;
+#endif // ENC28J60_HW_SPI == 1
+
   // From this point forward the -RESET output and -INT input should 
   // not be needed.
   // Use the following functions to work with the SPI output pins
@@ -96,6 +130,61 @@ void spi_init(void)
 }
 
 
+#if ENC28J60_HW_SPI == 1
+// Hardware SPI versions of the SPI functions
+//
+// Every byte written to SPI_DR clocks a byte in from the ENC28J60, so each
+// function waits for RXNE and reads SPI_DR even when the incoming byte is
+// not needed. This keeps the RX side from flagging an overrun and also
+// guarantees the byte is fully shifted out before the caller raises -CS.
+
+void SpiWriteByte(uint8_t nByte)
+{
+  SPI_DR = nByte;
+  while (!(SPI_SR & SPI_SR_RXNE));
+  nByte = SPI_DR;                  // Discard the byte clocked in
+}
+
+
+void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes)
+{
+  uint8_t dummy;
+  
+  while (nBytes--) {
+    SPI_DR = *pChunk++;
+    while (!(SPI_SR & SPI_SR_RXNE));
+    dummy = SPI_DR;                // Discard the byte clocked in
+  }
+}
+
+
+uint8_t SpiReadByte(void)
+{
+  // Reading a byte works by sending a dummy byte. The ENC28J60 will
+  // ignore the dummy byte, and the clocks used to send the dummy byte
+  // are used to transfer the read byte.
+  SPI_DR = 0;
+  while (!(SPI_SR & SPI_SR_RXNE));
+  return SPI_DR;
+}
+
+
+void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes)
+{
+  // Reading data works by sending dummy bytes. At 8MHz a byte takes 16 CPU
+  // cycles to shift, which is about the same as the loop overhead, so a
+  // simple write / wait / read sequence keeps the SPI close to fully busy.
+  while (nBytes--) {
+    SPI_DR = 0;
+    while (!(SPI_SR & SPI_SR_RXNE));
+    *pChunk++ = SPI_DR;            // Save byte in the buffer
+  }
+}
+#endif // ENC28J60_HW_SPI == 1
+
+
+#if ENC28J60_HW_SPI == 0
+
 void SpiWriteByte(uint8_t nByte)
 {
   // nByte is the data to be sent
@@ -217,3 +306,4 @@ void SPI_clock_pulse(void)
   nop();
   PC_ODR &= (uint8_t)(~0x04);      // SCK low
 }
+#endif // ENC28J60_HW_SPI == 0
@@ -56,6 +56,8 @@ void SpiWriteByte(uint8_t nByte);
 void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes);
 uint8_t SpiReadByte(void);
 void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes);
+#if ENC28J60_HW_SPI == 0
 void SPI_clock_pulse(void);
+#endif // ENC28J60_HW_SPI == 0
 
 #endif /*SPI_H_*/
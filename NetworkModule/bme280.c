@@ -84,6 +84,11 @@ extern uint8_t OctetArray[14];  // Used in emb_itoa conversions and to
 int32_t comp_data_temperature;
 int32_t comp_data_pressure;
 int32_t comp_data_humidity;
+#if SENSOR_STRING_CACHE == 1
+uint8_t BME280_generation;              // Reading generation
+uint8_t BME280_string_generation;       // Generation of the strings in the
+                                        // httpd.c string cache
+#endif // SENSOR_STRING_CACHE == 1
 
 
 // Internal macros
@@ -312,6 +317,9 @@ void bme280_compensate_data(const struct bme280_uncomp_data *uncomp_data,
   comp_data_temperature = comp_data->temperature;
   comp_data_pressure = comp_data->pressure;
   comp_data_humidity = comp_data->humidity;
+#if SENSOR_STRING_CACHE == 1
+  BME280_NEW_READING();
+#endif // SENSOR_STRING_CACHE == 1
 }
 
 
@@ -375,6 +383,10 @@ void set_filter_standby_settings(uint8_t desired_settings,
   bme280_get_regs(reg_addr, &reg_data, 1);
 
   fill_filter_settings(&reg_data, settings);
+#if BME280_NORMAL_MODE_SUPPORT == 1
+  // In normal mode the sensor measures once per standby period
+  reg_data = (uint8_t)(BME280_SET_BITS(reg_data, BME280_STANDBY, BME280_STANDBY_TIME_1000_MS));
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
 
   // Write the oversampling settings in the register
   bme280_set_regs(&reg_addr, &reg_data);
@@ -871,4 +883,42 @@ void stream_sensor_data_forced_mode(struct bme280_dev *dev, struct bme280_data *
   } // end of while loop
 }
 
+
+#if BME280_NORMAL_MODE_SUPPORT == 1
+void start_sensor_normal_mode(struct bme280_dev *dev, struct bme280_data *comp_data)
+{
+  // This API places the sensor in normal mode. In normal mode the sensor
+  // runs a measurement after each 1 second standby period and passes the
+  // results through the IIR filter, so the data registers always hold a
+  // filtered recent measurement and bme280_get_sensor_data() can be called
+  // without starting a measurement or waiting for one.
+  // This function waits once for the first measurement so that sensor data
+  // is available for display at boot time.
+  uint8_t i;
+  uint8_t status_reg;
+
+  // Same oversampling and filter settings as forced mode
+  dev->settings.osr_h = BME280_OVERSAMPLING_1X;
+  dev->settings.osr_p = BME280_OVERSAMPLING_16X;
+  dev->settings.osr_t = BME280_OVERSAMPLING_2X;
+  dev->settings.filter = BME280_FILTER_COEFF_16;
+
+  // Set the sensor settings. This also sets the standby time.
+  bme280_set_sensor_settings(BME280_ALL_SETTINGS_SEL, dev);
+
+  // Start normal mode
+  bme280_set_sensor_mode(BME280_NORMAL_MODE, dev);
+
+  // Wait for the first measurement to complete (about 30ms, maximum 200ms)
+  for (i = 0; i < 100; i++) {
+    wait_timer(2000); // Cause read every 2 ms
+    IWDG_KR = 0xaa;   // Prevent the IWDG hardware watchdog from firing.
+    bme280_get_regs(BME280_STATUS_REG_ADDR, &status_reg, 1);
+    if (i > 2 && (status_reg & 0x08) == 0) break;
+  }
+
+  bme280_get_sensor_data(comp_data, dev);
+}
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
+
 #endif // BME280_SUPPORT == 1
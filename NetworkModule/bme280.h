@@ -332,6 +332,16 @@ void user_i2c_write(uint8_t reg_addr, const uint8_t *data, uint32_t len);
 void stream_sensor_data_forced_mode(struct bme280_dev *dev, struct bme280_data *comp_data);
 
 
+#if BME280_NORMAL_MODE_SUPPORT == 1
+// Function to place the sensor in normal mode and collect the first
+// measurement.
+// dev       : Structure instance of bme280_dev.
+// comp_data : Contains the compensated pressure and/or temperature and/or
+//             humidity data.
+void start_sensor_normal_mode(struct bme280_dev *dev, struct bme280_data *comp_data);
+#endif // BME280_NORMAL_MODE_SUPPORT == 1
+
+
 // Function to combine altitude with the BME280 pressure measurment to arrive
 // at barometric pressure.
 // return Barometric Pressure
@@ -342,6 +352,15 @@ void BME280_temperature_string_C(void);
 void BME280_pressure_string(void);
 void BME280_humidity_string(void);
 
+#if SENSOR_STRING_CACHE == 1
+// Called when comp_data or the altitude changes so that the BME280 strings
+// are formatted again
+extern uint8_t BME280_generation;
+extern uint8_t BME280_string_generation;
+#define BME280_NEW_READING() \
+  BME280_generation = (uint8_t)(BME280_string_generation + 1)
+#endif // SENSOR_STRING_CACHE == 1
+
 
 #endif // BME280_H_
 
@@ -62,14 +62,36 @@
 #define STATE_SENDHEADER429	14	// Or we send the HTTP 429 header
                                         //   with Content-Length = 0 and
 					//   Retry-After of 10 seconds
+#define STATE_SENDHEADER400	15	// Or we send the HTTP 400 header
+                                        //   with Content-Length = 0
 #define STATE_SENDDATA		20	// ... followed by data
 #define STATE_PARSEGET		21	// We are currently parsing the
                                         //   client's GET-request
+#define STATE_WAITEVENT		22	// With HTTP_LONG_POLL the response
+                                        //   is held until a pin changes
+#define STATE_PARSESNAPSHOT	23	// We are currently parsing a POSTed
+                                        //   settings snapshot
+#define STATE_WEBSOCKET		24	// With HTTP_WEBSOCKET the connection
+                                        //   is a WebSocket (see ws_call())
 #define STATE_NULL		127     // Inactive state
 
 #define HEADER200		1       // Generate HTTP/1.1 200 header
 #define HEADER204		2       // Generate HTTP/1.1 200 header
 #define HEADER429		3       // Generate HTTP/1.1 429 header
+#define HEADER200CSS		4       // Generate HTTP/1.1 200 header for
+                                        //   the style sheet
+#define HEADER200GZ		5       // Generate HTTP/1.1 200 header for
+                                        //   the gzip style sheet
+#define HEADER200JSON		6       // Generate HTTP/1.1 200 header for
+                                        //   a JSON response
+#define HEADER200ETAG		7       // Generate HTTP/1.1 200 header with
+                                        //   an ETag
+#define HEADER304		8       // Generate HTTP/1.1 304 header
+#define HEADER200BIN		9       // Generate HTTP/1.1 200 header for
+                                        //   a binary response
+#define HEADER400		10      // Generate HTTP/1.1 400 header
+#define HEADER200JS		11      // Generate HTTP/1.1 200 header for
+                                        //   the WebSocket script
 
 
 #define PARSE_CMD		0       // Parsing the command byte in a POST
@@ -93,6 +115,11 @@
 #define PARSE_FILE_COMPLETE	34	// Termination of good file read
 #define PARSE_FILE_FAIL		35	// Termination of failed file read
 #define PARSE_FILE_FAIL_EXIT	36	// Display of fail code
+#define PARSE_FILE_SEEK_TYPE	37	// Find the first character of the file
+#define PARSE_FILE_BIN_HEADER	38	// Read the binary image header
+#define PARSE_FILE_BIN_DATA	39	// Read the binary image data
+#define PARSE_FILE_BIN_DRAIN	40	// Read the rest of the POST after a
+                                        //   binary image
 
 #define PARSE_NULL		127	// Default init state for the parser
 
@@ -156,6 +183,9 @@ extern uint8_t Pending_config_settings;   // Temp storage for new Config
 
 
 extern uint8_t Pending_uip_ethaddr_oct[6]; // Temp storage for new MAC address
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+extern uint8_t stored_uip_ethaddr_oct[6]; // MAC stored in EEPROM
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
 
 extern uint8_t stored_hostaddr[4];	  // hostaddr stored in EEPROM
 extern uint8_t stored_draddr[4];	  // draddr stored in EEPROM
@@ -226,6 +256,31 @@ uint8_t SREC_start;           // Used to determine if a file upload is an SREC
                               // file.
 uint8_t search_limit;         // Used to limit the time spent searching for
                               // the start of the SREC data
+#if SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+uint8_t page_pending;         // Set while a page write to the I2C EEPROM
+                              // has not yet been verified
+uint16_t page_pending_address; // I2C EEPROM address of the pending page
+uint8_t page_pending_control; // Write Control Byte of the pending page
+uint8_t page_copy[64];        // Copy of the pending page for verification
+#endif // SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+#if BINARY_UPLOAD_SUPPORT == 1
+uint16_t image_remaining;     // Binary image bytes still to be received
+uint32_t image_crc;           // CRC32 of the binary image bytes received
+uint32_t image_crc_expected;  // CRC32 from the binary image header
+#endif // BINARY_UPLOAD_SUPPORT == 1
+#if BLOCK_DELTA_UPLOAD == 1
+uint8_t image_delta;          // Set for a version 2 (block CRC) image
+uint8_t block_index;          // Count of block CRC bytes received
+uint8_t block_skip;           // Set if the I2C EEPROM already holds the block
+uint32_t block_crc_expected;  // CRC32 that precedes the current block
+#endif // BLOCK_DELTA_UPLOAD == 1
+#if RAW_UPLOAD_SUPPORT == 1
+struct tHttpD raw_upload_socket; // Parse state of the raw TCP upload
+struct uip_conn *raw_upload_conn; // Connection that owns the raw upload, or
+                              // NULL
+uint32_t raw_upload_start;    // second_counter at the raw upload connect
+                              // or its last received data
+#endif // RAW_UPLOAD_SUPPORT == 1
 #endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 #if OB_EEPROM_SUPPORT == 1
@@ -234,7 +289,20 @@ uint8_t eeprom_copy_to_flash_request;
                                // copy to flash function.
 uint16_t off_board_eeprom_index; // Used as an index into the I2C EEPROM
                                // when reading webpage templates
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+uint8_t strings_mismatch;      // 1 if the Strings image in the I2C EEPROM
+                               // was not made from this httpd.c, see
+                               // HttpDStringInit()
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 extern uint8_t eeprom_detect;  // Used in code update routines
+#if OB_TEMPLATE_CACHE == 1
+#define PRE_BUF_SIZE	230
+char pre_buf[PRE_BUF_SIZE];    // Read-ahead buffer for templates read from
+                               // the I2C EEPROM. Kept between CopyHttpData()
+                               // calls.
+uint16_t pre_buf_base;         // I2C EEPROM address of pre_buf[0], or 0xffff
+                               // if pre_buf holds no template data
+#endif // OB_TEMPLATE_CACHE == 1
 #endif // OB_EEPROM_SUPPORT == 1
 
 
@@ -244,6 +312,11 @@ extern uint8_t I2C_failcode;         // Used in monitoring I2C transactions
 
 
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#if POST_STREAM_PARSE == 1 && DOMOTICZ_SUPPORT == 1
+uint8_t parse_tail[54];       // With POST_STREAM_PARSE parse_tail holds a
+                              // whole POST component plus its '&'. The
+			      // Domoticz &h00 POST reply is 53 bytes.
+#else
 uint8_t parse_tail[40];       // In Browser and MQTT builds parse_tail is used
                               // to collect each component of a POST sequence.
 			      // If TCP fragmentation occurs parse_tail will
@@ -253,6 +326,7 @@ uint8_t parse_tail[40];       // In Browser and MQTT builds parse_tail is used
 			      // component. In normal POST processing the
 			      // longest component is the &h00 POST reply of
 			      // 37 bytes.
+#endif // POST_STREAM_PARSE == 1 && DOMOTICZ_SUPPORT == 1
 // IMPORTANT POST NOTES:
 // Since parse_tail is a single global variable there is a high probablility
 // of corruption of POST requests if multiple Browser attempt to Save their
@@ -293,6 +367,50 @@ uint8_t parse_GETcmd[11];     // Holds the GET cmd until the entire GET
 			      // processed. The others will be rejected with
 			      // a 429 response and a Retry-After setting of
 			      // 10 seconds.
+			      // With HTTP_GET_QUEUE each connection captures
+			      // its GET cmd in its own tHttpD GETcmd[] and
+			      // parse_GETcmd is only the working copy used
+			      // by parseget(), so no GET request is rejected.
+#if HTTP_KEEPALIVE == 1
+static uint8_t header_keepalive; // Copy of nKeepAlive for the connection
+                              // being served, used by CopyHttpHeader().
+#endif // HTTP_KEEPALIVE == 1
+
+// The request header search state (the gzip, keep-alive and ETag matches).
+// Without HTTP_GET_QUEUE only one GET request is read at a time, so it is
+// kept once here. With HTTP_GET_QUEUE several requests can be read at the
+// same time, so each tHttpD keeps its own.
+#if HTTP_GET_QUEUE == 0
+#if GZIP_STATIC_SUPPORT == 1
+uint8_t gzip_match;           // Number of characters of "gzip" matched
+                              // while reading the GET request headers.
+uint8_t gzip_accepted;        // Set if the GET request headers contain
+                              // "gzip".
+#define GZIP_MATCH(s)		gzip_match
+#define GZIP_ACCEPTED(s)	gzip_accepted
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_KEEPALIVE == 1
+uint8_t keepalive_match;      // Number of characters of "keep-alive"
+                              // matched while reading the GET request
+			      // headers.
+#define KEEPALIVE_MATCH(s)	keepalive_match
+#endif // HTTP_KEEPALIVE == 1
+#if HTTP_ETAG_SUPPORT == 1
+uint8_t etag_match;           // Number of characters of the ETag matched
+                              // while reading the GET request headers.
+uint8_t etag_matched;         // Set if the GET request headers contain the
+                              // current ETag of the Configuration page.
+#define ETAG_MATCH(s)		etag_match
+#define ETAG_MATCHED(s)		etag_matched
+#endif // HTTP_ETAG_SUPPORT == 1
+#endif // HTTP_GET_QUEUE == 0
+#if HTTP_GET_QUEUE == 1
+#define GZIP_MATCH(s)		((s)->nGzipMatch)
+#define GZIP_ACCEPTED(s)	((s)->nGzipAccepted)
+#define KEEPALIVE_MATCH(s)	((s)->nKeepAliveMatch)
+#define ETAG_MATCH(s)		((s)->nEtagMatch)
+#define ETAG_MATCHED(s)		((s)->nEtagMatched)
+#endif // HTTP_GET_QUEUE == 1
 
 
 uint16_t HtmlPageIOControl_size;     // Size of the IOControl template
@@ -336,6 +454,106 @@ extern uint8_t MQTT_resp_tout_counter;    // Counts response timeout events
 extern uint8_t MQTT_not_OK_counter;       // Counts MQTT != OK events
 extern uint8_t MQTT_broker_dis_counter;   // Counts broker disconnect events
 extern uint32_t second_counter;           // Counts seconds since boot
+#if FRAME_COPY_STATISTICS == 1
+extern uint16_t rx_copy_time;             // Last receive frame copy time
+extern uint16_t rx_copy_bytes;            // Size of that receive frame
+extern uint16_t tx_copy_time;             // Last transmit frame copy time
+extern uint16_t tx_copy_bytes;            // Size of that transmit frame
+#endif // FRAME_COPY_STATISTICS == 1
+#if RX_DRAIN_SUPPORT == 1
+extern uint8_t rx_drain_max;              // Deepest receive drain seen
+extern uint16_t rx_drain_limit_counter;   // Counts drains stopped at the limit
+#endif // RX_DRAIN_SUPPORT == 1
+#if RX_PEEK_DISCARD == 1
+extern uint16_t rx_discard_counter;       // Counts frames discarded by peek
+#endif // RX_PEEK_DISCARD == 1
+#if RX_OCCUPANCY_STATISTICS == 1
+extern uint16_t rx_occupancy;             // Last RX buffer occupancy sample
+extern uint16_t rx_occupancy_peak;        // Peak RX buffer occupancy
+extern uint8_t rx_pktcnt_peak;            // Peak EPKTCNT value
+extern uint32_t tx_wait_time;             // Time spent waiting to transmit
+#endif // RX_OCCUPANCY_STATISTICS == 1
+#if ENC28J60_FLOW_CONTROL == 1
+extern uint16_t rx_pause_counter;         // Counts flow control pauses
+#endif // ENC28J60_FLOW_CONTROL == 1
+#if PAGE_BUILD_STATISTICS == 1
+uint32_t page_build_run;                  // Time building the current Link
+                                          // Error Statistics page (us)
+uint32_t page_build_time;                 // Time building the last one (us)
+#endif // PAGE_BUILD_STATISTICS == 1
+#if INPUT_PASS_STATISTICS == 1
+extern uint16_t input_pass_min;           // Shortest input pass (us)
+extern uint16_t input_pass_max;           // Longest input pass (us)
+#endif // INPUT_PASS_STATISTICS == 1
+#if HTTP_PACING == 1
+extern uint16_t ms_counter;               // Free running ms counter
+extern struct pacing_queue pacing[2];     // HTTP and MQTT queueing delays
+#endif // HTTP_PACING == 1
+#if EEPROM_WRITE_CACHE == 1
+extern uint16_t eeprom_word_writes;       // EEPROM programming cycles
+extern uint16_t eeprom_coalesced;         // Byte writes merged by the cache
+#endif // EEPROM_WRITE_CACHE == 1
+#if HTTP_SPLIT_OUTPUT == 1
+extern uint16_t split_count;              // Segments sent as two halves
+extern uint16_t ms_counter;               // Free running ms counter
+uint16_t page_load_start;                 // ms_counter when the page header
+                                          // was sent
+uint16_t page_load_time;                  // Time to send the last page (ms)
+uint8_t page_load_timing;                 // Set while a page is being timed
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if TCP_FAST_REXMIT == 1
+extern uint16_t fast_rexmit_count;        // Duplicate ACK retransmits
+extern uint16_t rexmit_latency_max;       // Longest send to retransmit (ms)
+#endif // TCP_FAST_REXMIT == 1
+#if MQTT_DISCOVERY_BATCH == 1
+extern uint16_t discovery_time;           // Time to send the Auto Discovery
+                                          // messages (ms)
+#endif // MQTT_DISCOVERY_BATCH == 1
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+extern uint16_t publish_delay_max;        // Longest pin change to Publish
+                                          // delay (ms)
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+#if MQTT_FAST_RECONNECT == 1
+extern uint16_t reconnect_time;           // Time of the last MQTT connect
+                                          // sequence (ms)
+#endif // MQTT_FAST_RECONNECT == 1
+#if MQTT_PUBLISH_DISPATCH == 1
+extern uint16_t inbound_time_max;         // Longest received PUBLISH
+                                          // handling time (10us)
+#endif // MQTT_PUBLISH_DISPATCH == 1
+#if DOMOTICZ_PUBLISH_BATCH == 1
+extern uint8_t resync_full;               // Set when the next MQTT connect
+                                          // must republish all pin states
+#endif // DOMOTICZ_PUBLISH_BATCH == 1
+#if DEFERRED_SENSOR_INIT == 1
+extern uint16_t boot_arp_time;            // Boot to first ARP reply (ms)
+#if BUILD_SUPPORT == MQTT_BUILD
+extern uint16_t boot_mqtt_time;           // Boot to first MQTT startup
+                                          // complete (ms)
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // DEFERRED_SENSOR_INIT == 1
+#if RAM_HEADROOM_STATISTICS == 1
+extern uint16_t uip_buf_peak;             // Largest frame held in the uip_buf
+#if BUILD_SUPPORT == MQTT_BUILD
+extern uint16_t mqtt_sendbuf_peak;        // Most of the mqtt_sendbuf used
+extern uint8_t mqtt_pbuf_peak;            // Largest message in the MQTT
+                                          // Partial Buffer
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if MODBUS_TCP_SUPPORT == 1
+extern struct uip_conn *modbus_conn;      // The Modbus TCP connection
+#endif // MODBUS_TCP_SUPPORT == 1
+#if PUBLISH_LATENCY_STATS == 1
+extern struct latency_stage latency[LATENCY_STAGES]; // Input change to
+                                          // PUBLISH latency
+#endif // PUBLISH_LATENCY_STATS == 1
+
+#if HTTPD_STATE_POOL == 1
+// HTTP states assigned to connections while a Browser request is active
+static struct tHttpD httpd_pool[HTTPD_POOL_SIZE];
+static uint8_t httpd_pool_owner[HTTPD_POOL_SIZE]; // uip_conns index of the
+                                          // owner, 0xff if never assigned
+#endif // HTTPD_STATE_POOL == 1
 
 
 #if DS18B20_SUPPORT == 1
@@ -350,9 +568,17 @@ extern uint8_t FoundROM[5][8];            // Table of found ROM codes
                                           // [x][6] = MSByte serial number
                                           // [x][7] = CRC
 extern int numROMs;                       // Count of DS18B20 devices found
+#if STATE_JSON_SUPPORT == 1
+extern uint8_t DS18B20_scratch[5][2];     // Last temperature read from each
+                                          // sensor
+#endif // STATE_JSON_SUPPORT == 1
 #endif // DS18B20_SUPPORT == 1
 
 
+#if BME280_SUPPORT == 0 && CONFIG_SNAPSHOT_SUPPORT == 1
+extern int16_t stored_altitude; // User entered altitude stored in EEPROM
+#endif // BME280_SUPPORT == 0 && CONFIG_SNAPSHOT_SUPPORT == 1
+
 #if BME280_SUPPORT == 1
 extern int16_t stored_altitude; // User entered altitude used for BME280
 				// pressure calibration stored in EEPROM
@@ -360,6 +586,13 @@ extern int16_t stored_altitude; // User entered altitude used for BME280
 extern int32_t comp_data_temperature; // Compensated temperature
 extern int32_t comp_data_pressure;    // Compensated pressure
 extern int32_t comp_data_humidity;    // Compensated humidity
+#if STATE_JSON_SUPPORT == 1
+extern uint8_t BME280_found;          // Set if a BME280 was found at boot
+#endif // STATE_JSON_SUPPORT == 1
+#if SENSOR_STRING_CACHE == 1
+static char BME280_string[3][8];      // Temperature, pressure and humidity
+                                      // strings of the last reading
+#endif // SENSOR_STRING_CACHE == 1
 #endif // BME280_SUPPORT == 1
 
 
@@ -374,6 +607,9 @@ extern uint8_t Sensor_IDX[6][8] @FLASH_START_SENSOR_IDX;
 // is still defined for all builds.
 extern uint16_t IO_TIMER[16] @FLASH_START_IO_TIMERS;
 extern char IO_NAME[16][16] @FLASH_START_IO_NAMES;
+#if RULE_ENGINE_SUPPORT == 1
+extern uint8_t rule_table[NUM_RULES][4] @FLASH_START_RULES;
+#endif // RULE_ENGINE_SUPPORT == 1
 
 // Define RAM addresses for Pending timers
 #if PCF8574_SUPPORT == 0
@@ -387,10 +623,28 @@ extern uint16_t Pending_IO_TIMER[24];
 
 #if INA226_SUPPORT == 1;
 // INA226 variables. Special Software Defined Radio build only.
+#if SENSOR_FIXED_POINT == 1
+extern int32_t voltage;       // Voltage value reported by the INA226 (mV)
+extern int32_t current;       // Current value reported by the INA226 (mA)
+extern int32_t power;         // Power value reported by the INA226 (mW)
+extern int32_t shunt_voltage; // Shunt Voltage value reported by the INA226 (uV)
+#else // SENSOR_FIXED_POINT == 0
 extern float voltage;       // Voltage value reported by the INA226
 extern float current;       // Current value reported by the INA226
 extern float power;         // Power value reported by the INA226
 extern float shunt_voltage; // Shunt Voltage value reported by the INA226
+#endif // SENSOR_FIXED_POINT == 1
+#if INA226_ALERT_SUPPORT == 1
+#if SENSOR_FIXED_POINT == 1
+extern int32_t ina226_voltage[5];
+extern int32_t ina226_current[5];
+extern int32_t ina226_power[5];
+#else // SENSOR_FIXED_POINT == 0
+extern float ina226_voltage[5];
+extern float ina226_current[5];
+extern float ina226_power[5];
+#endif // SENSOR_FIXED_POINT == 1
+#endif // INA226_ALERT_SUPPORT == 1
 #endif // INA226_SUPPORT == 1;
 
 #if SDR_POWER_RELAY_SUPPORT == 1
@@ -432,7 +686,8 @@ extern uint8_t stored_latching_relay_state;
 //   appear in flash memory. For instance %y00 could be used to signal the
 //   application code to insert the string "this is a test string". While this
 //   makes the code harder to read, it makes the web page templates much
-//   smaller.
+//   smaller. tools/nmstrings.py lists the %yxx markers used by each template
+//   and the text still repeated between templates.
 //
 // - All of these insertion steps cause a complication: In the HttpDCall() the
 //   function "sizeof" is called to determine the size of the webpage to be
@@ -566,10 +821,8 @@ extern uint8_t stored_latching_relay_state;
 #if OB_EEPROM_SUPPORT == 0
 static const char g_HtmlPageIOControl[] =
 "%y04%y05"
-      "<title>%a00: IO Control</title>"
-   "</head>"
-   "<body>"
-      "<h1>IO Control</h1>"
+      "<title>%a00: IO Control%y03"
+      "IO Control</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -805,10 +1058,8 @@ const m = (data => {
 #if OB_EEPROM_SUPPORT == 0
 static const char g_HtmlPageConfiguration[] =
 "%y04%y05"
-      "<title>%a00: Configuration</title>"
-   "</head>"
-   "<body>"
-      "<h1>Configuration</h1>"
+      "<title>%a00: Configuration%y03"
+      "Configuration</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -1143,10 +1394,8 @@ const m = (data => {
 #if OB_EEPROM_SUPPORT == 0
 static const char g_HtmlPageIOControl[] =
 "%y04%y05"
-      "<title>%a00: IO Control</title>"
-   "</head>"
-   "<body>"
-      "<h1>IO Control</h1>"
+      "<title>%a00: IO Control%y03"
+      "IO Control</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -1427,10 +1676,8 @@ const m = (data => {
 #if OB_EEPROM_SUPPORT == 0
 static const char g_HtmlPageConfiguration[] =
 "%y04%y05"
-      "<title>%a00: Configuration</title>"
-   "</head>"
-   "<body>"
-      "<h1> Configuration</h1>"
+      "<title>%a00: Configuration%y03"
+      " Configuration</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -1796,10 +2043,8 @@ const m = (data => {
 #if OB_EEPROM_SUPPORT == 0
 static const char g_HtmlPageIOControl[] =
 "%y04%y05"
-      "<title>%a00: IO Control</title>"
-   "</head>"
-   "<body>"
-      "<h1>IO Control</h1>"
+      "<title>%a00: IO Control%y03"
+      "IO Control</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -2066,10 +2311,8 @@ const m = (data => {
 #if OB_EEPROM_SUPPORT == 0
 static const char g_HtmlPageConfiguration[] =
 "%y04%y05"
-      "<title>%a00: Configuration</title>"
-   "</head>"
-   "<body>"
-      "<h1>Configuration</h1>"
+      "<title>%a00: Configuration%y03"
+      "Configuration</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -2419,10 +2662,8 @@ const m = (data => {
 #if PCF8574_SUPPORT == 1
 static const char g_HtmlPagePCFIOControl[] =
 "%y04%y05"
-      "<title>%A00: PCF8574 IO Control</title>"
-   "</head>"
-   "<body>"
-      "<h1>PCF8574 IO Control</h1>"
+      "<title>%A00: PCF8574 IO Control%y03"
+      "PCF8574 IO Control</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -2639,10 +2880,8 @@ const m = (data => {
 #if PCF8574_SUPPORT == 1
 static const char g_HtmlPagePCFConfiguration[] =
 "%y04%y05"
-      "<title>%A00: PCF8574 Configuration</title>"
-   "</head>"
-   "<body>"
-      "<h1>PCF8574 Configuration</h1>"
+      "<title>%A00: PCF8574 Configuration%y03"
+      "PCF8574 Configuration</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -2874,10 +3113,8 @@ const m = (data => {
 #if PCF8574_SUPPORT == 1
 static const char g_HtmlPagePCFIOControl[] =
 "%y04%y05"
-      "<title>%A00: PCF8574 IO Control</title>"
-   "</head>"
-   "<body>"
-      "<h1>PCF8574 IO Control</h1>"
+      "<title>%A00: PCF8574 IO Control%y03"
+      "PCF8574 IO Control</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -3120,10 +3357,8 @@ const m = (data => {
 #if PCF8574_SUPPORT == 1
 static const char g_HtmlPagePCFConfiguration[] =
 "%y04%y05"
-      "<title>%A00: PCF8574 Configuration</title>"
-   "</head>"
-   "<body>"
-      "<h1>PCF8574 Configuration</h1>"
+      "<title>%A00: PCF8574 Configuration%y03"
+      "PCF8574 Configuration</h1>"
       "<form onsubmit='return m.s(event);return false'>"
          "<table>"
             "<tr>"
@@ -3331,10 +3566,8 @@ const m = (data => {
 #define WEBPAGE_STATS1		6
 static const char g_HtmlPageStats1[] =
 "%y04%y05"
-  "<title>%a00: Network Statistics</title>"
-  "</head>"
-  "<body>"
-  "<h1>Network Statistics</h1>"
+  "<title>%a00: Network Statistics%y03"
+  "Network Statistics</h1>"
   "<p>Values shown are since last power on or reset</p>"
   "<table>"
   "<tr><td class='t1'>%e00</td><td class='t2'>Dropped packets at the IP layer</td></tr>"
@@ -3630,7 +3863,112 @@ static const char g_HtmlPageStats2[] =
   "<br>"
   "34 %e34"
   "<br>"
-  "35 %e35";
+  "35 %e35"
+#if FRAME_COPY_STATISTICS == 1
+  "<br>"
+  "36 %e36"
+  "<br>"
+  "37 %e37"
+#endif // FRAME_COPY_STATISTICS == 1
+#if RX_DRAIN_SUPPORT == 1
+  "<br>"
+  "38 %e38"
+#endif // RX_DRAIN_SUPPORT == 1
+#if RX_PEEK_DISCARD == 1
+  "<br>"
+  "39 %e39"
+#endif // RX_PEEK_DISCARD == 1
+#if RX_OCCUPANCY_STATISTICS == 1
+  "<br>"
+  "50 %e50"
+  "<br>"
+  "51 %e51"
+#endif // RX_OCCUPANCY_STATISTICS == 1
+#if HTTP_SPLIT_OUTPUT == 1
+  "<br>"
+  "52 %e52"
+  "<br>"
+  "53 %e53"
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if TCP_FAST_REXMIT == 1
+  "<br>"
+  "54 %e54"
+  "<br>"
+  "55 %e55"
+#endif // TCP_FAST_REXMIT == 1
+#if MQTT_DISCOVERY_BATCH == 1
+  "<br>"
+  "56 %e56"
+#endif // MQTT_DISCOVERY_BATCH == 1
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+  "<br>"
+  "57 %e57"
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+#if MQTT_FAST_RECONNECT == 1
+  "<br>"
+  "58 %e58"
+#endif // MQTT_FAST_RECONNECT == 1
+#if MQTT_PUBLISH_DISPATCH == 1
+  "<br>"
+  "59 %e59"
+#endif // MQTT_PUBLISH_DISPATCH == 1
+#if DEFERRED_SENSOR_INIT == 1
+  "<br>"
+  "60 %e60"
+#if BUILD_SUPPORT == MQTT_BUILD
+  "<br>"
+  "61 %e61"
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // DEFERRED_SENSOR_INIT == 1
+#if RAM_HEADROOM_STATISTICS == 1
+  "<br>"
+  "62 %e62"
+  "<br>"
+  "63 %e63"
+#if BUILD_SUPPORT == MQTT_BUILD
+  "<br>"
+  "64 %e64"
+  "<br>"
+  "65 %e65"
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if PUBLISH_LATENCY_STATS == 1
+  "<br>"
+  "66 %e66"
+  "<br>"
+  "67 %e67"
+  "<br>"
+  "68 %e68"
+  "<br>"
+  "69 %e69"
+  "<br>"
+  "70 %e70"
+  "<br>"
+  "71 %e71"
+#endif // PUBLISH_LATENCY_STATS == 1
+#if ENC28J60_FLOW_CONTROL == 1
+  "<br>"
+  "72 %e72"
+#endif // ENC28J60_FLOW_CONTROL == 1
+#if PAGE_BUILD_STATISTICS == 1
+  "<br>"
+  "73 %e73"
+#endif // PAGE_BUILD_STATISTICS == 1
+#if INPUT_PASS_STATISTICS == 1
+  "<br>"
+  "74 %e74"
+#endif // INPUT_PASS_STATISTICS == 1
+#if HTTP_PACING == 1
+  "<br>"
+  "75 %e75"
+  "<br>"
+  "76 %e76"
+#endif // HTTP_PACING == 1
+#if EEPROM_WRITE_CACHE == 1
+  "<br>"
+  "77 %e77"
+#endif // EEPROM_WRITE_CACHE == 1
+  "";
 #endif // LINK_STATISTICS == 1
 
 
@@ -3641,10 +3979,8 @@ static const char g_HtmlPageStats2[] =
 #define WEBPAGE_SENSOR_SERIAL	8
 static const char g_HtmlPageTmpSerialNum[] =
   "%y04%y05"
-  "<title>%a00: Temperature Sensor Serial Numbers</title>"
-  "</head>"
-  "<body>"
-  "<h1>Temperature Sensor Serial Numbers</h1>"
+  "<title>%a00: Temperature Sensor Serial Numbers%y03"
+  "Temperature Sensor Serial Numbers</h1>"
   "<table>"
   "<tr><td>%e40</td></tr>"
   "<tr><td>%e41</td></tr>"
@@ -3669,6 +4005,89 @@ static const char g_HtmlPageSstate[] =
   "%f00";
 
 
+#if STATE_JSON_SUPPORT == 1
+// JSON state responses
+// URL /b1 and /b2
+// These have no template. The responses are written by json_build().
+#define WEBPAGE_JSON_STATE	25
+#define WEBPAGE_JSON_PINS	26
+#endif // STATE_JSON_SUPPORT == 1
+
+
+#if HTTP_ETAG_SUPPORT == 1
+// Not Modified response
+// Replaces the Configuration page when the Browser already has the current
+// version. There is no template, only the 304 header is sent.
+#define WEBPAGE_NOT_MODIFIED	27
+#endif // HTTP_ETAG_SUPPORT == 1
+
+
+#if HTTP_LONG_POLL == 1
+// Pin change wait
+// The /b3 request is held open with this page id until ON_OFF_word changes
+// or HTTP_LONG_POLL_TIMEOUT seconds pass. The response is then sent with
+// the Very Short IO state page Template.
+#define WEBPAGE_EVENT_WAIT	28
+#endif // HTTP_LONG_POLL == 1
+
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+// Settings snapshot
+// URL /b4
+// There is no template. A GET returns the snapshot written by
+// snapshot_export(), and a POST to the same URL is parsed by
+// snapshot_import().
+#define WEBPAGE_SNAPSHOT	29
+// Header (8) + settings (425) + CRC32 (4)
+#define SNAPSHOT_SIZE		437
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
+
+#if TRACE_RING_SUPPORT == 1
+// Event trace download
+// URL /b5
+// There is no template. A GET returns the trace ring read directly from
+// I2C EEPROM3 (see main.h for the layout).
+#define WEBPAGE_TRACE		30
+#define TRACE_SIZE		32768U // TRACE_SLOTS x TRACE_CHUNK_SIZE
+#endif // TRACE_RING_SUPPORT == 1
+
+
+#if HTTP_WEBSOCKET == 1
+// WebSocket upgrade
+// URL /b6
+// There is no template. The GET is answered with the 101 handshake reply
+// and the connection then carries WebSocket frames (see ws_receive()).
+#define WEBPAGE_WEBSOCKET	31
+#define WS_HANDSHAKE		0x01	// Frames to be sent: The 101 reply
+#define WS_STATE		0x02	//   Pin states text frame
+#define WS_PONG			0x04	//   Pong frame
+#define WS_CLOSE		0x08	//   Close frame
+#define WS_HEARTBEAT		30	// Seconds between state frames if no
+                                        //   pin changes
+
+// WebSocket script of the IO Control pages
+// URL /b7
+// Loaded by the IO Control pages (see s8). It opens the WebSocket and
+// sets the state cells (and the ON / OFF buttons of the Outputs) from each
+// pin states frame. An ON / OFF click is sent at once as a two digit pin
+// command, so an Output switches without a Save and a page reload. Save
+// still works as without the WebSocket. The rows of the page are found
+// from the pin control field (%h00, %H00 in the PCF8574 page) in the page
+// script: the Inputs are listed first, then the Outputs, each in pin
+// order. The script must not contain a '%' character.
+#define WEBPAGE_WS_SCRIPT	32
+static const char g_HtmlWsScript[] =
+  "(()=>{let d=document,f=d.scripts[0].text.match(/([hH])00:'(\\w+)'/),b=f[1]=='H'?16:0,i=[],o=[],"
+  "w=new WebSocket(`ws://${location.host}/b6`);"
+  "f[2].match(/../g).forEach((v,n)=>{v=parseInt(v,16)&3;v==1&&i.push(n);v==3&&o.push(n)});"
+  "i=i.concat(o);"
+  "w.onmessage=e=>d.querySelectorAll('.t3').forEach((c,k)=>{let n=i[k],s=e.data[e.data.length-1-b-n],"
+  "r=d.getElementsByName('o'+n);c.className=`s${s} t3`;r.length&&(r[s=='1'?0:1].checked=!0)});"
+  "d.onchange=e=>{let t=e.target;t.type=='radio'&&w.send(((+t.name.slice(1)+b)*2+ +t.value+100+'').slice(1))}})()";
+#endif // HTTP_WEBSOCKET == 1
+
+
 // Load Uploader page Template
 // This web page is shown when the user requests the Code Uploader with the
 // /72 command. It is stored in the I2C EEPROM and used only in upgradeable
@@ -3690,10 +4109,8 @@ static const char g_HtmlPageSstate[] =
 #if OB_EEPROM_SUPPORT == 2
 static const char g_HtmlPageLoadUploader[] =
   "%y04%y05"
-  "<title>Loading Code Uploader</title>"
-  "</head>"
-  "<body>"
-  "<h1>Loading Code Uploader</h1>"
+  "<title>Loading Code Uploader%y03"
+  "Loading Code Uploader</h1>"
   "<p>"
   "DO NOT ACCESS BROWSER FOR 15 SECONDS.<br><br>"
   "Wait until the progress bar completes, then click Continue.<br><br>"
@@ -3733,10 +4150,8 @@ static const char g_HtmlPageLoadUploader[] = " ";
 #define WEBPAGE_UPLOADER		10
 static const char g_HtmlPageUploader[] =
   "%y04%y05"
-  "<title>Code Uploader</title>"
-  "</head>"
-  "<body>"
-  "<h1>Code Uploader</h1>"
+  "<title>Code Uploader%y03"
+  "Code Uploader</h1>"
   "Uploader Code Revision %w00<br/>"
 
   "<form action='' method='post' enctype='multipart/form-data'>"
@@ -3759,8 +4174,13 @@ static const char g_HtmlPageUploader[] =
   "</script>"
 
   "<p>"
+#if BINARY_UPLOAD_SUPPORT == 1
+  "Use CHOOSE FILE to select a .sx or .nmb file then click SUBMIT. The 30<br>"
+  "second Upload and Flash programming process will start.<br>"
+#else // BINARY_UPLOAD_SUPPORT == 0
   "Use CHOOSE FILE to select a .sx file then click SUBMIT. The 30 second<br>"
   "Upload and Flash programming process will start.<br>"
+#endif // BINARY_UPLOAD_SUPPORT == 1
   "</p>"
   
   "<p><input input type='file' name='file1' accept='.sx' required /></p>"
@@ -3798,33 +4218,20 @@ static const char g_HtmlPageUploader[] =
 #define WEBPAGE_EXISTING_IMAGE	13
 static const char g_HtmlPageExistingImage[] =
   "%y04%y05"
-  "<title>Restoring Existing Image</title>"
-  "</head>"
-  "<body>"
-  "<h1>Restoring Existing Image</h1>"
+  "<title>Restoring Existing Image%y03"
+  "Restoring Existing Image</h1>"
   "<p>"
   "It takes about 15 SECONDS to restore the existing firmware image.<br><br>"
   "DO NOT ATTEMPT BROWSER ACCESS DURING THIS 15 SECOND PERIOD.<br><br>"
   "Wait until the progress bar completes, then click Continue.<br><br>"
   
   "<progress value='0' max='15' id='progressBar'></progress>"
-  "<script>"
-  "var timeleft = 15;"
-  "var downloadTimer = setInterval(function(){"
-    "if(timeleft <= 0){"
-      "clearInterval(downloadTimer);"
-    "}"
-    "document.getElementById('progressBar').value = 15 - timeleft;"
-    "timeleft -= 1;"
-  "}, 1000);"
-  "</script>"
+  "%y08"
   "<br>"
   "<br>"
   
   "</p>"
-  "<button onclick='location=`/`'>Continue</button>"
-  "</body>"
-  "</html>";
+  "%y09";
 #endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 
@@ -3836,31 +4243,18 @@ static const char g_HtmlPageExistingImage[] =
 #define WEBPAGE_TIMER	14
 static const char g_HtmlPageTimer[] =
   "%y04%y05"
-  "<title>Writing Flash</title>"
-  "</head>"
-  "<body>"
-  "<h1>Writing and Verifying Flash</h1>"
+  "<title>Writing Flash%y03"
+  "Writing and Verifying Flash</h1>"
   "<p>"
   "Wait until the progress bar completes, then click Continue.<br><br>"
   
   "<progress value='0' max='15' id='progressBar'></progress>"
-  "<script>"
-  "var timeleft = 15;"
-  "var downloadTimer = setInterval(function(){"
-    "if(timeleft <= 0){"
-      "clearInterval(downloadTimer);"
-    "}"
-    "document.getElementById('progressBar').value = 15 - timeleft;"
-    "timeleft -= 1;"
-  "}, 1000);"
-  "</script>"
+  "%y08"
   "<br>"
   "<br>"
   
   "</p>"
-  "<button onclick='location=`/`'>Continue</button>"
-  "</body>"
-  "</html>";
+  "%y09";
 #endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 
@@ -3871,16 +4265,12 @@ static const char g_HtmlPageTimer[] =
 #define WEBPAGE_UPLOAD_COMPLETE	15
 static const char g_HtmlPageUploadComplete[] =
   "%y04%y05"
-  "<title>Upload Complete</title>"
-  "</head>"
-  "<body>"
-  "<h1>Upload Complete</h1>"
+  "<title>Upload Complete%y03"
+  "Upload Complete</h1>"
   "<p>"
   "Click Continue.<br><br>"
   "</p>"
-  "<button onclick='location=`/`'>Continue</button>"
-  "</body>"
-  "</html>";
+  "%y09";
 #endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 
@@ -3890,19 +4280,15 @@ static const char g_HtmlPageUploadComplete[] =
 #define WEBPAGE_PARSEFAIL	16
 static const char g_HtmlPageParseFail[] =
   "%y04%y05"
-  "<title>Upload Parse Fail</title>"
-  "</head>"
-  "<body>"
-  "<h1>Upload Parse Fail</h1>"
+  "<title>Upload Parse Fail%y03"
+  "Upload Parse Fail</h1>"
   "<p>"
   "Parsing of the uploaded file failed.<br>"
   "Retry the upload. Make sure you selected the correct file.<br>"
   "Fault reason code:<br>"
   "%s02"
   "</p>"
-  "<button onclick='location=`/`'>Continue</button>"
-  "</body>"
-  "</html>";
+  "%y09";
 #endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 /*
@@ -3934,6 +4320,20 @@ static const char g_HtmlPageEEPROMMissing[] =
   "I2C EEPROM Missing";
 #endif // OB_EEPROM_SUPPORT == 1
 
+#if OB_EEPROM_SUPPORT == 1
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+// Strings Mismatch webpage
+// This web page is shown in place of the I2C EEPROM pages when the Strings
+// image was made from a different httpd.c. The page sizes and the %y
+// replacements would not match the templates. /72 still loads the Code
+// Uploader so that the matching Strings file can be uploaded.
+#define WEBPAGE_STRINGS_MISMATCH	33
+static const char g_HtmlPageStringsMismatch[] =
+  "Strings file does not match the code. "
+  "Use /72 to load the Code Uploader and upload the matching Strings file.";
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#endif // OB_EEPROM_SUPPORT == 1
+
 
 
 //---------------------------------------------------------------------------//
@@ -4000,10 +4400,18 @@ static const char g_HtmlPageEEPROMMissing[] =
 #define s2 "" \
   "<button title='Save first!' onclick="
 
-// String for %y03 replacement in web page templates.
+// String for %y03 replacement in web page templates. Closes the <title>
+// and opens the <h1> heading that repeats the title in most pages.
+// Strings images made before %y03 was used have this text in the templates
+// instead. HttpDStringInit() checks for the %y03 in the IO Control template
+// and the I2C EEPROM pages are refused if it is missing.
 #define s3 "" \
-  "not used"
+  "</title>" \
+  "</head>" \
+  "<body>" \
+  "<h1>"
 
+#if STYLE_RESOURCE == 0
 // String for %y04 replacement in web page templates
 #define s4  "" \
   "<html>"\
@@ -4028,6 +4436,22 @@ static const char g_HtmlPageEEPROMMissing[] =
   "</style>"
 //  ".mac input{width:14px;}" \
 
+#endif // STYLE_RESOURCE == 0
+
+#if STYLE_RESOURCE == 1
+// String for %y04 replacement in web page templates
+#define s4  "" \
+  "<html>"\
+  "<head>" \
+  "<link rel='icon' href='data:,'>" \
+  "<meta name='viewport' content='width=device-width'>"
+
+// String for %y05 replacement in web page templates
+// The style sheet is requested by the Browser as a separate resource.
+#define s5 "" \
+  "<link rel=stylesheet href=/b0>"
+#endif // STYLE_RESOURCE == 1
+
 
 
 
@@ -4049,6 +4473,58 @@ static const char g_HtmlPageEEPROMMissing[] =
   "not used"
 #endif // RF_ATTEN_SUPPORT == 1
 
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+// String for %y08 replacement in web page templates
+// Progress bar script of the Existing Image and Timer pages
+#define s8 "" \
+  "<script>" \
+  "var timeleft = 15;" \
+  "var downloadTimer = setInterval(function(){" \
+    "if(timeleft <= 0){" \
+      "clearInterval(downloadTimer);" \
+    "}" \
+    "document.getElementById('progressBar').value = 15 - timeleft;" \
+    "timeleft -= 1;" \
+  "}, 1000);" \
+  "</script>"
+
+// String for %y09 replacement in web page templates
+// Continue button that ends the Code Uploader status pages
+#define s9 "" \
+  "<button onclick='location=`/`'>Continue</button>" \
+  "</body>" \
+  "</html>"
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+
+#if HTTP_WEBSOCKET == 1
+// String sent in place of %y01 (%y00 in Domoticz builds) in the IO Control
+// pages. It is the same string with the WebSocket script (/b7) added, so
+// the page templates, and the Strings image in the I2C EEPROM, do not
+// change. HTTP_WEBSOCKET is not available in the Code Uploader build, so
+// ps[8] is free.
+#if DOMOTICZ_SUPPORT == 0
+#define PS_IOCONTROL_END	1
+#define s8 "" \
+  "</script>" \
+  "</table>" \
+  "<script src=/b7></script>" \
+  "<p>" \
+  "<button type=submit>Save</button> <button type=reset onclick='m.l()'>Undo All</button>" \
+  "</p>" \
+  "</form>"
+#endif // DOMOTICZ_SUPPORT == 0
+#if DOMOTICZ_SUPPORT == 1
+#define PS_IOCONTROL_END	0
+#define s8 "" \
+  "</script>" \
+  "<script src=/b7></script>" \
+  "<p>" \
+  "<button type=submit>Save</button> <button type=reset onclick='m.l()'>Undo All</button>" \
+  "</p>" \
+  "</form>"
+#endif // DOMOTICZ_SUPPORT == 1
+#endif // HTTP_WEBSOCKET == 1
+
 
 // The following creates an array of string lengths corresponding to
 // the strings in the #define statements above
@@ -4061,7 +4537,7 @@ struct page_string {
     uint8_t size_less4;
 };
 
-const struct page_string ps[8] = {
+const struct page_string ps[] = {
     { s0, sizeof(s0)-1, sizeof(s0)-5 },
     { s1, sizeof(s1)-1, sizeof(s1)-5 },
     { s2, sizeof(s2)-1, sizeof(s2)-5 },
@@ -4069,7 +4545,16 @@ const struct page_string ps[8] = {
     { s4, sizeof(s4)-1, sizeof(s4)-5 },
     { s5, sizeof(s5)-1, sizeof(s5)-5 },
     { s6, sizeof(s6)-1, sizeof(s6)-5 },
-    { s7, sizeof(s7)-1, sizeof(s7)-5 }
+    { s7, sizeof(s7)-1, sizeof(s7)-5 },
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+    // %y08 and %y09 are only used in the Code Uploader pages
+    { s8, sizeof(s8)-1, sizeof(s8)-5 },
+    { s9, sizeof(s9)-1, sizeof(s9)-5 }
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+#if HTTP_WEBSOCKET == 1
+    // The IO Control page end with the WebSocket script
+    { s8, sizeof(s8)-1, sizeof(s8)-5 }
+#endif // HTTP_WEBSOCKET == 1
 };
 
 // Access the above strings, string length, and (string length - 4) as
@@ -4079,6 +4564,50 @@ const struct page_string ps[8] = {
 // ps[i].size_less4
 
 
+#if STYLE_RESOURCE == 1
+// Style sheet resource
+// URL /b0
+// The same style sheet is stored as text for Browsers that do not accept
+// gzip, and pre-gzipped. If the style sheet text is changed the gzip bytes
+// must be re-created. They are the output of "gzip -9n" on the style sheet
+// text (without a trailing newline) listed with "xxd -i".
+#define WEBPAGE_STYLE		23
+static const char g_HtmlStyle[] =
+  ".s0{background:red;}"
+  ".s1{background:green;}"
+  "table{border-spacing:8px2px}"
+  ".t1{width:100px;}"
+  ".t2{width:450px;}"
+  ".t3{width:30px;}"
+  ".t8{width:60px;}"
+  ".c{text-align:center;}"
+  ".ip input{width:27px;}"
+  ".s div{width:13px;height:13px;display:inline-block;}"
+  ".hs{height:9px;}";
+#endif // STYLE_RESOURCE == 1
+
+#if GZIP_STATIC_SUPPORT == 1
+#define WEBPAGE_STYLE_GZ	24
+static const uint8_t g_HtmlStyleGz[] = {
+  0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x4d, 0x8d,
+  0x59, 0x0e, 0xc3, 0x20, 0x0c, 0x44, 0xaf, 0xd2, 0x0b, 0x24, 0xca, 0xd2,
+  0x25, 0x25, 0xa7, 0x61, 0xb1, 0xc0, 0x0a, 0x22, 0x08, 0x9c, 0x96, 0x0a,
+  0xe5, 0xee, 0xa5, 0x0d, 0x95, 0xfa, 0xe7, 0x79, 0x7a, 0x33, 0x6e, 0x63,
+  0x97, 0x05, 0x97, 0x8b, 0x0e, 0xeb, 0xe6, 0x14, 0x0b, 0xa0, 0xe6, 0xbd,
+  0x8d, 0xfd, 0x3f, 0xd3, 0x01, 0xc0, 0xcd, 0x3b, 0x71, 0x61, 0x21, 0x8b,
+  0x35, 0x28, 0x08, 0x4d, 0xf4, 0x5c, 0xa2, 0xd3, 0x6c, 0xf2, 0x69, 0xf0,
+  0x69, 0x6f, 0xa9, 0xcf, 0x4f, 0x54, 0x64, 0x58, 0xdf, 0x75, 0x3e, 0x95,
+  0x09, 0x1a, 0x2a, 0x38, 0x5f, 0x2a, 0x18, 0x2b, 0x18, 0x6b, 0x9e, 0x6a,
+  0xbe, 0x1e, 0x59, 0x66, 0x82, 0x44, 0x0d, 0xb7, 0xa8, 0x1d, 0x93, 0xe0,
+  0x08, 0x42, 0xa1, 0xe8, 0x4f, 0xe8, 0xfc, 0x46, 0xd5, 0x1d, 0x6e, 0x5f,
+  0x37, 0x9e, 0x14, 0x3e, 0x7e, 0x0f, 0xc7, 0x82, 0x0c, 0xa0, 0x36, 0x74,
+  0xdc, 0x0a, 0xa3, 0xb7, 0xfc, 0xc5, 0xd0, 0x59, 0x74, 0xd0, 0x08, 0xbb,
+  0xca, 0xa5, 0x74, 0x4c, 0xcc, 0xd5, 0xba, 0x7f, 0x36, 0xde, 0x49, 0xe7,
+  0xb6, 0xd6, 0xf8, 0x00, 0x00, 0x00,
+};
+#endif // GZIP_STATIC_SUPPORT == 1
+
+
 //---------------------------------------------------------------------------//
 // The following compile time pre-processor statements test the string
 // lengths to make sure they are within valid limits. All string lengths
@@ -4114,6 +4643,12 @@ const struct page_string ps[8] = {
 #if (sizeof(s7) > 255)
   #error "string s7 is too big"
 #endif
+
+#if HTTP_WEBSOCKET == 1
+#if (sizeof(s8) > 255)
+  #error "string s8 is too big"
+#endif
+#endif // HTTP_WEBSOCKET == 1
 //---------------------------------------------------------------------------//
 //---------------------------------------------------------------------------//
 //---------------------------------------------------------------------------//
@@ -4222,6 +4757,41 @@ void HttpDStringInit() {
   // Read 2 bytes from I2C EEPROM and convert to uint16_t.
   prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, WEBPAGE_LOADUPLOADER_SIZE_LOCATION, 2);
   HtmlPageLoadUploader_size = read_two_bytes();
+
+
+  // ---------------------------------------------------------------------- //
+  // Check that the Strings image matches the code
+  // ---------------------------------------------------------------------- //
+  // The sizes above are the sizes of the templates in the image, and
+  // adjust_template_size() adds the %y replacements of the templates in this
+  // httpd.c. An image made from an older httpd.c (for example before the
+  // templates used %y03) would give wrong Content-Lengths. The IO Control
+  // templates of all builds start with
+  //   "%y04%y05<title>%a00: IO Control%y03"
+  // so the 4 bytes at offset 31 must be "%y03".
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+  {
+    uint8_t i;
+    uint16_t check_index;
+
+#if BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+    prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, MQTT_WEBPAGE_IOCONTROL_ADDRESS_LOCATION, 2);
+#endif // BUILD_SUPPORT == MQTT_BUILD && HOME_ASSISTANT_SUPPORT == 1
+#if BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
+    prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, MQTT_DOMO_WEBPAGE_IOCONTROL_ADDRESS_LOCATION, 2);
+#endif // BUILD_SUPPORT == MQTT_BUILD && DOMOTICZ_SUPPORT == 1
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD
+    prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, BROWSER_ONLY_WEBPAGE_IOCONTROL_ADDRESS_LOCATION, 2);
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD
+    check_index = (uint16_t)(read_two_bytes() - 0x8000 + 31);
+
+    prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, check_index, 2);
+    strings_mismatch = 0;
+    for (i = 0; i < 4; i++) {
+      if (I2C_read_byte((uint8_t)(i == 3)) != (uint8_t)("%y03"[i])) strings_mismatch = 1;
+    }
+  }
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 #endif // OB_EEPROM_SUPPORT == 1
 }
 
@@ -4354,6 +4924,14 @@ void init_off_board_string_pointers(struct tHttpD* pSocket) {
     // Read 2 bytes
     off_board_eeprom_index = read_two_bytes() - 0x8000;
   }
+
+  // If the Strings image does not match the code show the Strings Mismatch
+  // page instead. WEBPAGE_NULL is the connection start, no page yet.
+  if (strings_mismatch == 1 && pSocket->current_webpage != WEBPAGE_NULL) {
+    pSocket->current_webpage = WEBPAGE_STRINGS_MISMATCH;
+    pSocket->pData = g_HtmlPageStringsMismatch;
+    pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageStringsMismatch) - 1);
+  }
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 }
 #endif // OB_EEPROM_SUPPORT == 1
@@ -4376,6 +4954,34 @@ uint16_t read_two_bytes(void)
 #endif // OB_EEPROM_SUPPORT == 1
 
 
+#if OB_TEMPLATE_CACHE == 1
+uint16_t pre_buf_load(void)
+{
+  // Returns the pre_buf index of the template byte at off_board_eeprom_index.
+  // If the pre_buf already holds that byte, with the few bytes after it that
+  // a marker needs, no I2C EEPROM read is done. This is true for most
+  // packets of a page (a packet rarely uses all of the pre_buf) and for
+  // retransmissions, which move off_board_eeprom_index back. Otherwise the
+  // pre_buf is re-read starting at off_board_eeprom_index.
+  uint16_t i;
+  
+  if (pre_buf_base != 0xffff
+   && off_board_eeprom_index >= pre_buf_base
+   && (uint16_t)(off_board_eeprom_index - pre_buf_base) <= (PRE_BUF_SIZE - 6)) {
+    return (uint16_t)(off_board_eeprom_index - pre_buf_base);
+  }
+  
+  prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, off_board_eeprom_index, 2);
+  for (i = 0; i < (PRE_BUF_SIZE - 1); i++) {
+    pre_buf[i] = I2C_read_byte(0);
+  }
+  pre_buf[PRE_BUF_SIZE - 1] = I2C_read_byte(1);
+  pre_buf_base = off_board_eeprom_index;
+  return 0;
+}
+#endif // OB_TEMPLATE_CACHE == 1
+
+
 #if DEBUG_SUPPORT == 15
 #if OB_EEPROM_SUPPORT == 1
 #if HTTPD_DIAGNOSTIC_SUPPORT == 1
@@ -4495,11 +5101,111 @@ void read_httpd_diagnostic_bytes(void)
 #endif // DEBUG_SUPPORT == 15
 
 
+#if HTTP_ETAG_SUPPORT == 1
+// Configuration page version used to build the ETag
+static uint8_t page_version;       // Bumped on each applied change
+static uint16_t page_config_sum;   // Sum of the settings at the last bump
+static char page_etag[17];         // Current ETag (16 hex characters)
+
+
+void httpd_page_version_bump(void)
+{
+  // Called from check_runtime_changes() when a GUI or MQTT change has been
+  // applied, and at init. The settings sum is kept in the tag so that the
+  // counter starting over after a reboot does not match a tag the Browser
+  // saved before the reboot.
+  uint8_t *p;
+  uint16_t sum;
+  int i;
+  
+  page_version++;
+  
+  // The 128 byte EEPROM starts with stored_devicename (see Main.c)
+  sum = 0;
+  p = (uint8_t *)stored_devicename;
+  for (i = 0; i < 128; i++) sum = (uint16_t)((sum << 1) + (sum >> 15) + p[i]);
+  p = (uint8_t *)IO_NAME;
+  for (i = 0; i < sizeof(IO_NAME); i++) sum = (uint16_t)((sum << 1) + (sum >> 15) + p[i]);
+  p = (uint8_t *)IO_TIMER;
+  for (i = 0; i < sizeof(IO_TIMER); i++) sum = (uint16_t)((sum << 1) + (sum >> 15) + p[i]);
+  page_config_sum = sum;
+}
+
+
+static void etag_build(void)
+{
+  // Builds the Configuration page ETag in page_etag. The tag is the
+  // version counter, the settings sum, the pin states and the MQTT status
+  // boxes, as those are the parts of the page that change.
+  uint8_t mqtt_boxes;
+  
+  mqtt_boxes = (uint8_t)(mqtt_start_status & 0xf0);
+  if (MQTT_error_status == 1) mqtt_boxes |= 0x01;
+  
+  emb_itoa(page_version, &page_etag[0], 16, 2);
+  emb_itoa(page_config_sum, &page_etag[2], 16, 4);
+  emb_itoa((uint32_t)ON_OFF_word, &page_etag[6], 16, 8);
+  emb_itoa(mqtt_boxes, &page_etag[14], 16, 2);
+}
+#endif // HTTP_ETAG_SUPPORT == 1
+
+
+#if HTTP_SIZE_CACHE == 1
+// Page sizes computed by adjust_template_size(). 0 = not computed yet.
+static uint16_t page_size_cache[4];
+static uint8_t page_size_config;   // stored_config_settings for the cache
+static uint8_t page_size_options1; // stored_options1 for the cache
+
+
+void httpd_page_size_invalidate(void)
+{
+  // Called when something that changes the size of a page insertion (IO
+  // Names, Device Name, Feature settings, etc) may have changed.
+  memset(page_size_cache, 0, sizeof(page_size_cache));
+  page_size_config = stored_config_settings;
+  page_size_options1 = stored_options1;
+}
+
+
+static uint8_t page_size_slot(uint8_t webpage)
+{
+  // Returns the page_size_cache entry for the webpage, or 0xff if the size
+  // of the webpage is not cached. Only the pages with user entered strings
+  // are cached. The other pages are sized with a few additions.
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+  if (webpage == WEBPAGE_IOCONTROL) return 0;
+  if (webpage == WEBPAGE_CONFIGURATION) return 1;
+#if DOMOTICZ_SUPPORT == 0 && PCF8574_SUPPORT == 1
+  if (webpage == WEBPAGE_PCF8574_IOCONTROL) return 2;
+#endif // DOMOTICZ_SUPPORT == 0 && PCF8574_SUPPORT == 1
+#if (BUILD_SUPPORT == BROWSER_ONLY_BUILD || HOME_ASSISTANT_SUPPORT == 1) && PCF8574_SUPPORT == 1
+  if (webpage == WEBPAGE_PCF8574_CONFIGURATION) return 3;
+#endif // (BUILD_SUPPORT == BROWSER_ONLY_BUILD || HOME_ASSISTANT_SUPPORT == 1) && PCF8574_SUPPORT == 1
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+  return 0xff;
+}
+#endif // HTTP_SIZE_CACHE == 1
+
+
 uint16_t adjust_template_size(struct tHttpD* pSocket)
 {
   uint16_t size;
+#if HTTP_SIZE_CACHE == 1
+  uint8_t slot;
+#endif // HTTP_SIZE_CACHE == 1
   // declare and pre-calculate repeatedly used values
   int strlen_devicename_adjusted = (strlen(stored_devicename) - 4);
+
+#if HTTP_SIZE_CACHE == 1
+  // Return the cached size if there is one and the settings it was
+  // computed with have not changed.
+  if (stored_config_settings != page_size_config
+   || stored_options1 != page_size_options1) {
+    httpd_page_size_invalidate();
+  }
+  slot = page_size_slot(pSocket->current_webpage);
+  if (slot != 0xff && page_size_cache[slot] != 0) return page_size_cache[slot];
+#endif // HTTP_SIZE_CACHE == 1
   
   // This function calculates the size of the HTML page that will be
   // transmitted based on the size of the web page template plus adjustments
@@ -4540,9 +5246,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_IOCONTROL) {
     size = HtmlPageIOControl_size;
 
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
 
     // Account for Device Name field %a00 in <title> and in body
     // This can be variable in size during run time so we have to calculate it
@@ -4677,6 +5384,12 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
     size = size + ps[0].size_less4;
 #endif // DOMOTICZ_SUPPORT == 1
 
+#if HTTP_WEBSOCKET == 1
+    // The Save and Undo All string is sent with the WebSocket script
+    // (see s8)
+    size = size + ps[8].size - ps[PS_IOCONTROL_END].size;
+#endif // HTTP_WEBSOCKET == 1
+
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD || HOME_ASSISTANT_SUPPORT == 1
     // String for %y02 in web page template
     // There 3 instances:
@@ -4731,9 +5444,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_PCF8574_IOCONTROL) {
     size = HtmlPagePCFIOControl_size;
 
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
 
     // Account for Device Name field %A00 in <title> and in body
     // This can be variable in size during run time so we have to calculate it
@@ -4765,6 +5479,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
     // size = size + (#instances) x (ps[1].size - marker_field_size);
     // size = size + ps[1].size_less4;
     size = size + ps[1].size_less4;
+#if HTTP_WEBSOCKET == 1
+    // The string is sent with the WebSocket script (see s8)
+    size = size + ps[8].size - ps[1].size;
+#endif // HTTP_WEBSOCKET == 1
 
     // String for %y02 in web page template
     // There 4 instances
@@ -4822,9 +5540,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_CONFIGURATION) {
     size = HtmlPageConfiguration_size;
 
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
 
     // Account for Device Name field %a00 in <title> and in body
     // This can be variable in size during run time so we have to calculate it
@@ -5087,9 +5806,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_PCF8574_CONFIGURATION) {
     size = HtmlPagePCFConfiguration_size;
 
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
 
     // Account for Device Name field %A00 in <title> and in body
     // This can be variable in size during run time so we have to calculate it
@@ -5193,9 +5913,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_STATS1) {
     size = (uint16_t)(sizeof(g_HtmlPageStats1) - 1);
 
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
 
     // Account for Device Name field %a00 in <title>
     // This can be variable in size during run time so we have to calculate it
@@ -5231,6 +5952,100 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
     // size = size + (5 x (10 - 4));
     // size = size + (5 x (6));
     size = size + 30;
+#if FRAME_COPY_STATISTICS == 1
+    // Account for Statistics fields %e36, %e37
+    // size = size + (2 x (10 - 4));
+    size = size + 12;
+#endif // FRAME_COPY_STATISTICS == 1
+#if RX_DRAIN_SUPPORT == 1
+    // Account for Statistics field %e38
+    // size = size + (1 x (10 - 4));
+    size = size + 6;
+#endif // RX_DRAIN_SUPPORT == 1
+#if RX_PEEK_DISCARD == 1
+    // Account for Statistics field %e39
+    size = size + 6;
+#endif // RX_PEEK_DISCARD == 1
+#if RX_OCCUPANCY_STATISTICS == 1
+    // Account for Statistics fields %e50, %e51
+    // size = size + (2 x (10 - 4));
+    size = size + 12;
+#endif // RX_OCCUPANCY_STATISTICS == 1
+#if HTTP_SPLIT_OUTPUT == 1
+    // Account for Statistics fields %e52, %e53
+    // size = size + (2 x (10 - 4));
+    size = size + 12;
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if TCP_FAST_REXMIT == 1
+    // Account for Statistics fields %e54, %e55
+    // size = size + (2 x (10 - 4));
+    size = size + 12;
+#endif // TCP_FAST_REXMIT == 1
+#if MQTT_DISCOVERY_BATCH == 1
+    // Account for Statistics field %e56
+    size = size + 6;
+#endif // MQTT_DISCOVERY_BATCH == 1
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+    // Account for Statistics field %e57
+    size = size + 6;
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+#if MQTT_FAST_RECONNECT == 1
+    // Account for Statistics field %e58
+    size = size + 6;
+#endif // MQTT_FAST_RECONNECT == 1
+#if MQTT_PUBLISH_DISPATCH == 1
+    // Account for Statistics field %e59
+    size = size + 6;
+#endif // MQTT_PUBLISH_DISPATCH == 1
+#if DEFERRED_SENSOR_INIT == 1
+    // Account for Statistics field %e60
+    size = size + 6;
+#if BUILD_SUPPORT == MQTT_BUILD
+    // Account for Statistics field %e61
+    size = size + 6;
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // DEFERRED_SENSOR_INIT == 1
+#if RAM_HEADROOM_STATISTICS == 1
+    // Account for Statistics fields %e62, %e63
+    // size = size + (2 x (10 - 4));
+    size = size + 12;
+#if BUILD_SUPPORT == MQTT_BUILD
+    // Account for Statistics fields %e64, %e65
+    size = size + 12;
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if PUBLISH_LATENCY_STATS == 1
+    // Account for Statistics fields %e66, %e67, %e68. Each shows 3 values
+    // of 5 digits separated by spaces.
+    // size = size + (3 x (17 - 4));
+    size = size + 39;
+    // Account for Statistics fields %e69, %e70, %e71. Each shows 8 values
+    // of 4 digits separated by spaces.
+    // size = size + (3 x (39 - 4));
+    size = size + 105;
+#endif // PUBLISH_LATENCY_STATS == 1
+#if ENC28J60_FLOW_CONTROL == 1
+    // Account for Statistics field %e72
+    size = size + 6;
+#endif // ENC28J60_FLOW_CONTROL == 1
+#if PAGE_BUILD_STATISTICS == 1
+    // Account for Statistics field %e73
+    size = size + 6;
+#endif // PAGE_BUILD_STATISTICS == 1
+#if INPUT_PASS_STATISTICS == 1
+    // Account for Statistics field %e74
+    size = size + 7;
+#endif // INPUT_PASS_STATISTICS == 1
+#if HTTP_PACING == 1
+    // Account for Statistics fields %e75 and %e76
+    size = size + (2 * 13);
+#endif // HTTP_PACING == 1
+#if EEPROM_WRITE_CACHE == 1
+    // Account for Statistics field %e77. It shows 2 values of 5 digits
+    // separated by a space.
+    // size = size + (11 - 4);
+    size = size + 7;
+#endif // EEPROM_WRITE_CACHE == 1
   }
 #endif // LINK_STATISTICS == 1
 
@@ -5373,9 +6188,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_SENSOR_SERIAL) {
     size = (uint16_t)(sizeof(g_HtmlPageTmpSerialNum) - 1);
 
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
 
     // Account for Device Name field %a00 in <title>
     // This can be variable in size during run time so we have to calculate it
@@ -5442,9 +6258,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_LOADUPLOADER) {
     size = HtmlPageLoadUploader_size;
     
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
   }
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 #endif // OB_EEPROM_SUPPORT == 1
@@ -5463,9 +6280,10 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_UPLOADER) {
     size = (uint16_t)(sizeof(g_HtmlPageUploader) - 1);
     
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
     
     // Account for Code Revision + Code Type insertion %w00
     // size = size + (#instances x (value_size - marker_field_size));
@@ -5487,9 +6305,15 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_EXISTING_IMAGE) {
     size = (uint16_t)(sizeof(g_HtmlPageExistingImage) - 1);
     
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
+
+    // Account for the progress bar script %y08 and the Continue button
+    // %y09
+    size = size + ps[8].size_less4
+                + ps[9].size_less4;
   }
 
 
@@ -5505,9 +6329,15 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_TIMER) {
     size = (uint16_t)(sizeof(g_HtmlPageTimer) - 1);
     
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
+
+    // Account for the progress bar script %y08 and the Continue button
+    // %y09
+    size = size + ps[8].size_less4
+                + ps[9].size_less4;
   }
 
 
@@ -5523,9 +6353,13 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_UPLOAD_COMPLETE) {
     size = (uint16_t)(sizeof(g_HtmlPageUploadComplete) - 1);
     
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
+
+    // Account for the Continue button %y09
+    size = size + ps[9].size_less4;
   }
 
 
@@ -5541,9 +6375,13 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_PARSEFAIL) {
     size = (uint16_t)(sizeof(g_HtmlPageParseFail) - 1);
     
-    // Account for header replacement strings %y04 %y05
+    // Account for header replacement strings %y04 %y05 %y03
     size = size + ps[4].size_less4
-                + ps[5].size_less4;
+                + ps[5].size_less4
+                + ps[3].size_less4;
+
+    // Account for the Continue button %y09
+    size = size + ps[9].size_less4;
     
     // Account for I2C EEPROM status string %s02
     // size = size + (value size - marker_field_size)
@@ -5567,13 +6405,90 @@ uint16_t adjust_template_size(struct tHttpD* pSocket)
   else if (pSocket->current_webpage == WEBPAGE_EEPROM_MISSING) {
     size = (uint16_t)(sizeof(g_HtmlPageEEPROMMissing) - 1);
   }
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+  else if (pSocket->current_webpage == WEBPAGE_STRINGS_MISMATCH) {
+    size = (uint16_t)(sizeof(g_HtmlPageStringsMismatch) - 1);
+  }
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 #endif // OB_EEPROM_SUPPORT == 1
 
-  return size;
-}
 
+#if STYLE_RESOURCE == 1
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  // Report the size of the style sheet resource
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  else if (pSocket->current_webpage == WEBPAGE_STYLE) {
+    size = (uint16_t)(sizeof(g_HtmlStyle) - 1);
+  }
+#endif // STYLE_RESOURCE == 1
+#if GZIP_STATIC_SUPPORT == 1
+  else if (pSocket->current_webpage == WEBPAGE_STYLE_GZ) {
+    // The gzip bytes have no string terminator
+    size = (uint16_t)(sizeof(g_HtmlStyleGz));
+  }
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_WEBSOCKET == 1
+  else if (pSocket->current_webpage == WEBPAGE_WS_SCRIPT) {
+    size = (uint16_t)(sizeof(g_HtmlWsScript) - 1);
+  }
+#endif // HTTP_WEBSOCKET == 1
 
-void emb_itoa(uint32_t num, char* str, uint8_t base, uint8_t pad)
+
+#if STATE_JSON_SUPPORT == 1
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  // Report the size of the JSON responses
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  //-------------------------------------------------------------------------//
+  else if (pSocket->current_webpage == WEBPAGE_JSON_STATE
+        || pSocket->current_webpage == WEBPAGE_JSON_PINS) {
+    // The response is built in uip_appdata to measure it. This is called
+    // just before the header is copied over it, and the response itself
+    // is built again in the next segment. The numbers are fixed width so
+    // the size does not change in between.
+    size = json_build(pSocket->current_webpage, (char *)uip_appdata);
+  }
+#endif // STATE_JSON_SUPPORT == 1
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+  else if (pSocket->current_webpage == WEBPAGE_SNAPSHOT) {
+    size = SNAPSHOT_SIZE;
+  }
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
+#if TRACE_RING_SUPPORT == 1
+  else if (pSocket->current_webpage == WEBPAGE_TRACE) {
+    size = TRACE_SIZE;
+  }
+#endif // TRACE_RING_SUPPORT == 1
+
+#if HTTP_SIZE_CACHE == 1
+  if (slot != 0xff) page_size_cache[slot] = size;
+#endif // HTTP_SIZE_CACHE == 1
+
+  return size;
+}
+
+
+#if FAST_FORMAT == 1
+// Powers of ten and digit characters for the emb_itoa() conversions
+static const uint32_t pow10_32[6] = {
+  1000000000, 100000000, 10000000, 1000000, 100000, 10000 };
+static const uint16_t pow10_16[4] = { 10000, 1000, 100, 10 };
+static const char hex_digits[] = "0123456789abcdef";
+#endif // FAST_FORMAT == 1
+
+void emb_itoa(uint32_t num, char* str, uint8_t base, uint8_t pad)
 {
   // Implementation of itoa() specific to this application
   // num  - The value to be converted
@@ -5613,6 +6528,69 @@ void emb_itoa(uint32_t num, char* str, uint8_t base, uint8_t pad)
   //       where number is a uint32_t containing the value 0xc0a80004
   //       output string in OctetArray is c0a80004
 
+#if FAST_FORMAT == 1
+  // Decimal digits are found by subtracting powers of ten, the others by
+  // shift and mask, so no long divide is needed. Values up to 65535 (nearly
+  // all of them) are converted with 16 bit arithmetic. As in the generic
+  // version only the lowest "pad" digits are kept.
+  char digits[10];
+  uint16_t num16;
+  uint8_t i;
+  uint8_t shift;
+  uint8_t mask;
+
+  str[pad] = '\0';
+
+  if (base == 10) {
+    // digits[0] is the 1000000000s digit, digits[9] the units digit
+    memset(digits, '0', 10);
+    if (num > 0xffff) {
+      for (i = 0; i < 6; i++) {
+        while (num >= pow10_32[i]) {
+          num -= pow10_32[i];
+          digits[i]++;
+        }
+      }
+    }
+    // num is less than 65536 here
+    num16 = (uint16_t)num;
+    for (i = 0; i < 4; i++) {
+      while (num16 >= pow10_16[i]) {
+        num16 -= pow10_16[i];
+        digits[i + 5]++;
+      }
+    }
+    digits[9] = (char)(num16 + '0');
+
+    // Copy the lowest "pad" digits, pre-padded with zeroes past 10 digits
+    for (i = 0; i < pad; i++) {
+      if ((uint8_t)(pad - i) > 10) str[i] = '0';
+      else str[i] = digits[10 - pad + i];
+    }
+    return;
+  }
+
+  if (base == 16) shift = 4;
+  else if (base == 8) shift = 3;
+  else shift = 1;
+  mask = (uint8_t)(base - 1);
+  i = pad;
+  if (num <= 0xffff) {
+    num16 = (uint16_t)num;
+    while (i > 0) {
+      i--;
+      str[i] = hex_digits[num16 & mask];
+      num16 >>= shift;
+    }
+  }
+  else {
+    while (i > 0) {
+      i--;
+      str[i] = hex_digits[(uint8_t)num & mask];
+      num >>= shift;
+    }
+  }
+#else // FAST_FORMAT == 0
   int i;
   uint8_t rem;
 
@@ -5655,6 +6633,7 @@ void emb_itoa(uint32_t num, char* str, uint8_t base, uint8_t pad)
       end--;
     }
   }
+#endif // FAST_FORMAT == 1
 }
 
 
@@ -5683,14 +6662,19 @@ uint8_t two_hex2int(char chmsb, char chlsb)
 
 void int2hex(uint8_t i)
 {
-  uint8_t j;
   // Convert a single integer into two hex characters (two nibbles).
   // Put the result in global variable OctetArray.
+#if FAST_FORMAT == 1
+  OctetArray[0] = hex_digits[i >> 4];
+  OctetArray[1] = hex_digits[i & 0x0f];
+#else // FAST_FORMAT == 0
+  uint8_t j;
   j = (uint8_t)(i>>4);
   OctetArray[0] = int2nibble(j);
   
   j = (uint8_t)(i & 0x0f);
   OctetArray[1] = int2nibble(j);
+#endif // FAST_FORMAT == 1
   
   OctetArray[2] = '\0';
 }
@@ -5698,9 +6682,15 @@ void int2hex(uint8_t i)
 
 void int16to4hex(uint16_t i)
 {
-  uint8_t j;
   // Convert a 16-bit integer into four hex characters (four nibbles).
   // Put the result in global variable OctetArray.
+#if FAST_FORMAT == 1
+  OctetArray[0] = hex_digits[(uint8_t)(i >> 12)];
+  OctetArray[1] = hex_digits[(uint8_t)(i >> 8) & 0x0f];
+  OctetArray[2] = hex_digits[(uint8_t)(i >> 4) & 0x0f];
+  OctetArray[3] = hex_digits[(uint8_t)i & 0x0f];
+#else // FAST_FORMAT == 0
+  uint8_t j;
   j = (uint8_t)(i>>12);
   OctetArray[0] = int2nibble(j);
   
@@ -5714,34 +6704,103 @@ void int16to4hex(uint16_t i)
   
   j = (uint8_t)(i & 0x000f);
   OctetArray[3] = int2nibble(j);
+#endif // FAST_FORMAT == 1
   
   OctetArray[4] = '\0';
 }
 
 
+#if FAST_FORMAT == 0
+// With FAST_FORMAT the hex_digits table is used instead
 uint8_t int2nibble(uint8_t j)
 {
   // Convert a 4 bit integer to a character (a single nibble).
   if(j<=9) return (uint8_t)(j + '0');
   else return (uint8_t)(j - 10 + 'a');
 }
+#endif // FAST_FORMAT == 0
 
 static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint16_t nDataLen, uint8_t header_type)
 {
   uint16_t nBytes;
   int i;
+  const char* http_string;
   
   static const char http_string1[] = 
     "\r\n"
     "Cache-Control: no-cache, no-store\r\n"
     "Content-Type: text/html; charset=utf-8\r\n";
 
+#if STYLE_RESOURCE == 1
+  static const char http_string_css[] = 
+    "\r\n"
+#if HTTP_CACHE_RESOURCES == 0
+    "Cache-Control: no-cache, no-store\r\n"
+#endif // HTTP_CACHE_RESOURCES == 0
+#if HTTP_CACHE_RESOURCES == 1
+    // The style sheet changes only with a firmware update, so the Browser
+    // may keep it for a day without asking again.
+    "Cache-Control: max-age=86400\r\n"
+#endif // HTTP_CACHE_RESOURCES == 1
+    "Content-Type: text/css\r\n";
+#endif // STYLE_RESOURCE == 1
+
+#if HTTP_WEBSOCKET == 1
+  static const char http_string_js[] = 
+    "\r\n"
+#if HTTP_CACHE_RESOURCES == 0
+    "Cache-Control: no-cache, no-store\r\n"
+#endif // HTTP_CACHE_RESOURCES == 0
+#if HTTP_CACHE_RESOURCES == 1
+    "Cache-Control: max-age=86400\r\n"
+#endif // HTTP_CACHE_RESOURCES == 1
+    "Content-Type: application/javascript\r\n";
+#endif // HTTP_WEBSOCKET == 1
+
+#if STATE_JSON_SUPPORT == 1
+  static const char http_string_json[] = 
+    "\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Content-Type: application/json\r\n";
+#endif // STATE_JSON_SUPPORT == 1
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1 || TRACE_RING_SUPPORT == 1
+  static const char http_string_bin[] = 
+    "\r\n"
+    "Cache-Control: no-cache, no-store\r\n"
+    "Content-Type: application/octet-stream\r\n";
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1 || TRACE_RING_SUPPORT == 1
+
+#if HTTP_ETAG_SUPPORT == 1
+  // The Configuration page may be kept by the Browser, but the Browser has
+  // to check the ETag before using it.
+  static const char http_string_etag[] = 
+    "\r\n"
+    "Cache-Control: no-cache\r\n"
+    "Content-Type: text/html; charset=utf-8\r\n";
+#endif // HTTP_ETAG_SUPPORT == 1
+
   nBytes = 0;
   
   pBuffer = stpcpy(pBuffer, "HTTP/1.1 ");
   nBytes += 9;
 
-  if (header_type == HEADER200) {
+#if HTTP_ETAG_SUPPORT == 1
+  if (header_type == HEADER304) {
+    pBuffer = stpcpy(pBuffer, "304 Not Modified\r\n");
+    nBytes += 18;
+  }
+  else
+#endif // HTTP_ETAG_SUPPORT == 1
+#if CONFIG_SNAPSHOT_SUPPORT == 1 || HTTP_WEBSOCKET == 1
+  if (header_type == HEADER400) {
+    pBuffer = stpcpy(pBuffer, "400 Bad Request\r\n");
+    nBytes += 17;
+  }
+  else
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1 || HTTP_WEBSOCKET == 1
+  if (header_type != HEADER429) {
+    // All header types other than HEADER429 are 200 headers
     pBuffer = stpcpy(pBuffer, "200 OK\r\n");
     nBytes += 8;
   }
@@ -5763,190 +6822,1273 @@ static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint16_t nDataLen, uint8_t head
   pBuffer = stpcpy(pBuffer, OctetArray);
   nBytes += 5;
 
-  pBuffer = stpcpy(pBuffer, http_string1);
-  nBytes += strlen(http_string1);
+  // Select the Content-Type for the header type
+  http_string = http_string1;
+#if STYLE_RESOURCE == 1
+  if (header_type == HEADER200CSS) http_string = http_string_css;
+#endif // STYLE_RESOURCE == 1
+#if GZIP_STATIC_SUPPORT == 1
+  if (header_type == HEADER200GZ) http_string = http_string_css;
+#endif // GZIP_STATIC_SUPPORT == 1
+#if STATE_JSON_SUPPORT == 1
+  if (header_type == HEADER200JSON) http_string = http_string_json;
+#endif // STATE_JSON_SUPPORT == 1
+#if HTTP_WEBSOCKET == 1
+  if (header_type == HEADER200JS) http_string = http_string_js;
+#endif // HTTP_WEBSOCKET == 1
+#if CONFIG_SNAPSHOT_SUPPORT == 1 || TRACE_RING_SUPPORT == 1
+  if (header_type == HEADER200BIN) http_string = http_string_bin;
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1 || TRACE_RING_SUPPORT == 1
+#if HTTP_ETAG_SUPPORT == 1
+  if (header_type == HEADER200ETAG || header_type == HEADER304) {
+    http_string = http_string_etag;
+  }
+#endif // HTTP_ETAG_SUPPORT == 1
+  pBuffer = stpcpy(pBuffer, http_string);
+  nBytes += strlen(http_string);
+
+#if HTTP_ETAG_SUPPORT == 1
+  if (header_type == HEADER200ETAG || header_type == HEADER304) {
+    // ETag:"xxxxxxxxxxxxxxxx"
+    etag_build();
+    pBuffer = stpcpy(pBuffer, "ETag:\"");
+    pBuffer = stpcpy(pBuffer, page_etag);
+    pBuffer = stpcpy(pBuffer, "\"\r\n");
+    nBytes += 25;
+  }
+#endif // HTTP_ETAG_SUPPORT == 1
+
+#if GZIP_STATIC_SUPPORT == 1
+  if (header_type == HEADER200GZ) {
+    pBuffer = stpcpy(pBuffer, "Content-Encoding: gzip\r\n");
+    nBytes += 24;
+  }
+#endif // GZIP_STATIC_SUPPORT == 1
   
   if (header_type == HEADER429) {
     pBuffer = stpcpy(pBuffer, "Retry-After: 10\r\n");
     nBytes += 17;
   }
   
+#if HTTP_KEEPALIVE == 0
   pBuffer = stpcpy(pBuffer, "Connection:close\r\n\r\n");
   nBytes += 20;
+#endif // HTTP_KEEPALIVE == 0
+#if HTTP_KEEPALIVE == 1
+  if (header_keepalive) {
+    pBuffer = stpcpy(pBuffer, "Connection:keep-alive\r\n\r\n");
+    nBytes += 25;
+  }
+  else {
+    pBuffer = stpcpy(pBuffer, "Connection:close\r\n\r\n");
+    nBytes += 20;
+  }
+#endif // HTTP_KEEPALIVE == 1
   
   return nBytes;
 }
 
 
-static uint16_t CopyHttpData(uint8_t* pBuffer,
-                             const char** ppData,
-			     uint16_t* pDataLeft,
-			     uint16_t nMaxBytes,
-			     struct tHttpD* pSocket)
+static uint8_t page_header_type(struct tHttpD* pSocket)
 {
-  // This function copies the selected webpage from flash storage to the
-  // output buffer. This function is called from the HttpDCall() function
-  // (see the "senddata:" part of that function).
-  // pBuffer - the output buffer
-  // ppData - the Flash storage for the Webpage template
-  // pDataLeft - remaining size of the template to be processed
-  // nMaxBytes - size of the output buffer
-  // While performing the copy the stream of characters in the webpage
-  // template is searched for special markers that indicate where template
-  // text should be replaced with variable length text.
-    
-  uint8_t nByte;
-  uint8_t nParsedNum;
-  uint8_t nParsedMode;
-  uint8_t temp;
-  int i;
-  int no_err;
-  unsigned char temp_octet[3];
-  uint8_t* pBuffer_start;
-  
-  // For use only in upgradeable builds:
-  #define PRE_BUF_SIZE	230
-  char pre_buf[PRE_BUF_SIZE];
-  uint16_t pre_buf_ptr = 0;
+  // Returns the header type for the page being sent. Webpages get the
+  // HEADER200 header. The style sheet is sent with a text/css header, and
+  // the gzip version of the style sheet also gets a Content-Encoding
+  // header. The JSON state responses get an application/json header and
+  // the WebSocket script an application/javascript header. The
+  // Configuration page gets an ETag, or only a 304 header if the Browser
+  // already has it.
+#if STYLE_RESOURCE == 1
+  if (pSocket->current_webpage == WEBPAGE_STYLE) return HEADER200CSS;
+#endif // STYLE_RESOURCE == 1
+#if GZIP_STATIC_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_STYLE_GZ) return HEADER200GZ;
+#endif // GZIP_STATIC_SUPPORT == 1
+#if STATE_JSON_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_JSON_STATE
+   || pSocket->current_webpage == WEBPAGE_JSON_PINS) return HEADER200JSON;
+#endif // STATE_JSON_SUPPORT == 1
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_SNAPSHOT) return HEADER200BIN;
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+#if TRACE_RING_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_TRACE) return HEADER200BIN;
+#endif // TRACE_RING_SUPPORT == 1
+#if HTTP_WEBSOCKET == 1
+  if (pSocket->current_webpage == WEBPAGE_WS_SCRIPT) return HEADER200JS;
+#endif // HTTP_WEBSOCKET == 1
+#if HTTP_ETAG_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_CONFIGURATION) return HEADER200ETAG;
+  if (pSocket->current_webpage == WEBPAGE_NOT_MODIFIED) return HEADER304;
+#endif // HTTP_ETAG_SUPPORT == 1
+  return HEADER200;
+}
 
-  
-  nParsedNum = 0;
-  nParsedMode = 0;
-  pBuffer_start =  pBuffer;
 
-  // The input value "nMaxBytes" provided by the calling routine is based on
-  // the MSS (Maximum Segment Size) defined in UIP_TCP_MSS.
-  //
-  // In this "transmit" routine MSS indicates the maximum number of TCP
-  // datagram bytes that the remote host will accept in a TCP segment (the
-  // TCP datagram part of an IP frame). The MSS value is defined in the
-  // uipopt.h file. Later the MSS should be updated with a value obtained from
-  // the browser that is accessing the web server during setup of a connection.
-  // However, I don't think this actually happens, and for simplification I
-  // think UIP is using a single MSS value for transmit and receive. Receive
-  // is the critical direction because we have limited memory to store
-  // incoming packets ... and it is OK if we transmit less than the MSS that a
-  // remote host tells us it can receive. The problem that this causes is that
-  // as we reduce the value of MSS for receive, it also reduces the size of
-  // MSS for transmit, and that causes our web page transmission to take a
-  // very long time (I'm seeing 2 seconds for a simple web page). May have to
-  // work on this some more.
-  //
-  // In the original UIP code there was a "uip_split" function that would
-  // reduce the size of transmitted packets. I think that code was interacting
-  // with the code below creating instability, perhaps because a lot of
-  // short packets were generated. Making the nMaxBytes limit smaller than the
-  // uip_split threshold effectively prevented the uip_split from operating,
-  // and the overall code became stable. I subsequently decided to remove
-  // uip_split from this application.
-  //
-  //-------------------------------------------------------------------------//
-  // See the uipopt.h file for the UIP_TCP_MSS definition. It must be smaller
-  // than the UIP_BUF less the headers that are also inserted in the UIP_BUF
-  // by the UIP code. The UIP_BUF size is determined by the ENC28J60_MAXFRAME
-  // value set in the enc28j60.h file.
-  // 
-  // Note: The ENC28J60 value was on the order of 900 bytes in the original
-  // code. However, due to limited RAM size, a smaller value was selected for
-  // this application. The primary limitation is when building MQTT code
-  // ENC28J60_MAXFRAME ends up being further limited to allow room for the
-  // MQTT variables and data buffer.
-  //
-  // Note: Complete transmission of the typical webpage in this application is
-  // about 4000 bytes.
-  //
-  //-------------------------------------------------------------------------//
-  // nMaxbytes must be smaller than UIP_TCP_MSS due to the need to allow for
-  // the largest string insertion that is NOT a %yxx replacement (as %yxx
-  // replacements can be interrupted if the buffer fills and can be continued
-  // at the next call of this routine).
+#if STATE_JSON_SUPPORT == 1
+static char *json_put_num(char *pBuffer, int32_t value, uint8_t width)
+{
+  // Writes value as a JSON number right aligned in a field of width
+  // characters.
+  char *p;
+  uint8_t len;
+  uint8_t neg;
+
+  neg = 0;
+  if (value < 0) {
+    neg = 1;
+    value = -value;
+  }
+  emb_itoa((uint32_t)value, OctetArray, 10, 10);
+  // Skip the leading zeros (JSON does not allow them)
+  p = OctetArray;
+  while (*p == '0' && *(p + 1) != '\0') p++;
+  len = (uint8_t)(strlen(p) + neg);
+  while (len < width) {
+    *pBuffer++ = ' ';
+    len++;
+  }
+  if (neg) *pBuffer++ = '-';
+  return stpcpy(pBuffer, p);
+}
+
+
+static uint16_t json_build(uint8_t webpage, char *pBuffer)
+{
+  // Writes the JSON response for webpage to pBuffer and returns its length.
+  // The response is written directly to the transmit buffer, so it must fit
+  // in one segment.
   //
-  // nMaxBytes should not cause a TCP datagram formation larger than 536
-  // bytes.
+  // /b1 WEBPAGE_JSON_STATE
+  //   {"up":s,"io":"h","sv":v,"ds":[t,t,t,t,t],"bme":[t,p,h],"ina":[v,c,w],
+  //    "tcp":[r,s,x,d]}
+  //   up  - second_counter
+  //   io  - ON_OFF_word in hex, bit 0 is IO 1
+  //   sv  - sensor valid bits: 1 = DS18B20, 2 = BME280, 4 = INA226
+  //   ds  - raw DS18B20 readings in 1/16 degree C
+  //   bme - compensated BME280 temperature, pressure and humidity
+  //   ina - INA226 voltage (mV), current (mA) and power (mW)
+  //   tcp - uip_stat TCP received, sent, retransmitted and dropped
+  //   Sensors that are not built or not enabled read 0. The tcp counts
+  //   read 0 unless a NETWORK_STATISTICS Browser build.
   //
-  // The following statement over-rides the nMaxBytes value passed to the
-  // function to account for extra bytes that might be sent in a single pass
-  // of the loop below. This causes most packet transmissions to be smaller,
-  // but accomodates those that have the extra bytes inserted.
-  nMaxBytes = UIP_TCP_MSS - 40;
-  //-------------------------------------------------------------------------//
+  // /b2 WEBPAGE_JSON_PINS
+  //   {"pc":"h","n":["name",...]}
+  //   pc  - the pin_control byte of each pin in hex, IO 1 first
+  //   n   - the IO Names of IO 1 to 16
+  //   ru  - the rule table in hex, rule 0 first (RULE_ENGINE_SUPPORT)
+  char *pStart;
+  uint8_t i;
+  uint8_t num_pins;
+  uint8_t valid;
+  int32_t value;
+
+  pStart = pBuffer;
+
+  if (webpage == WEBPAGE_JSON_STATE) {
+    pBuffer = stpcpy(pBuffer, "{\"up\":");
+    pBuffer = json_put_num(pBuffer, (int32_t)second_counter, 10);
+    pBuffer = stpcpy(pBuffer, ",\"io\":\"");
+    emb_itoa((uint32_t)ON_OFF_word, OctetArray, 16, 8);
+    pBuffer = stpcpy(pBuffer, OctetArray);
+
+    valid = 0;
+#if DS18B20_SUPPORT == 1
+    if (stored_config_settings & 0x08) valid |= 0x01;
+#endif // DS18B20_SUPPORT == 1
+#if BME280_SUPPORT == 1
+    if ((BME280_found == 1) && (stored_config_settings & 0x20)) valid |= 0x02;
+#endif // BME280_SUPPORT == 1
+#if INA226_SUPPORT == 1
+    valid |= 0x04;
+#endif // INA226_SUPPORT == 1
+    pBuffer = stpcpy(pBuffer, "\",\"sv\":");
+    pBuffer = json_put_num(pBuffer, valid, 1);
+
+    pBuffer = stpcpy(pBuffer, ",\"ds\":[");
+    for (i = 0; i < 5; i++) {
+      value = 0;
+#if DS18B20_SUPPORT == 1
+      if (valid & 0x01) {
+        value = (int16_t)(((uint16_t)DS18B20_scratch[i][1] << 8) | DS18B20_scratch[i][0]);
+      }
+#endif // DS18B20_SUPPORT == 1
+      if (i) *pBuffer++ = ',';
+      pBuffer = json_put_num(pBuffer, value, 6);
+    }
+
+    pBuffer = stpcpy(pBuffer, "],\"bme\":[");
+    for (i = 0; i < 3; i++) {
+      value = 0;
+#if BME280_SUPPORT == 1
+      if (valid & 0x02) {
+        if (i == 0) value = comp_data_temperature;
+        if (i == 1) value = comp_data_pressure;
+        if (i == 2) value = comp_data_humidity;
+      }
+#endif // BME280_SUPPORT == 1
+      if (i) *pBuffer++ = ',';
+      pBuffer = json_put_num(pBuffer, value, 11);
+    }
 
+    pBuffer = stpcpy(pBuffer, "],\"ina\":[");
+    for (i = 0; i < 3; i++) {
+      value = 0;
+#if INA226_SUPPORT == 1
+      if (i == 0) value = (int32_t)(voltage * 1000);
+      if (i == 1) value = (int32_t)(current * 1000);
+      if (i == 2) value = (int32_t)(power * 1000);
+#endif // INA226_SUPPORT == 1
+      if (i) *pBuffer++ = ',';
+      pBuffer = json_put_num(pBuffer, value, 11);
+    }
 
+    pBuffer = stpcpy(pBuffer, "],\"tcp\":[");
+    for (i = 0; i < 4; i++) {
+      value = 0;
+#if NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
+      // uip_stat is only kept in these builds (see uip.c)
+      if (i == 0) value = (int32_t)uip_stat.tcp.recv;
+      if (i == 1) value = (int32_t)uip_stat.tcp.sent;
+      if (i == 2) value = (int32_t)uip_stat.tcp.rexmit;
+      if (i == 3) value = (int32_t)uip_stat.tcp.drop;
+#endif // NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
+      if (i) *pBuffer++ = ',';
+      pBuffer = json_put_num(pBuffer, value, 10);
+    }
+    pBuffer = stpcpy(pBuffer, "]}");
+  }
 
-  //-------------------------------------------------------------------------//
-#if OB_EEPROM_SUPPORT == 1
-  if (pSocket->current_webpage == WEBPAGE_IOCONTROL
-   || pSocket->current_webpage == WEBPAGE_CONFIGURATION
+  if (webpage == WEBPAGE_JSON_PINS) {
+    num_pins = 16;
 #if PCF8574_SUPPORT == 1
-#if DOMOTICZ_SUPPORT == 0
-   || pSocket->current_webpage == WEBPAGE_PCF8574_IOCONTROL
-   || pSocket->current_webpage == WEBPAGE_PCF8574_CONFIGURATION
-#endif // DOMOTICZ_SUPPORT == 0
+    if (stored_options1 & 0x08) num_pins = 24;
 #endif // PCF8574_SUPPORT == 1
-   || pSocket->current_webpage == WEBPAGE_LOADUPLOADER) {
-    // This code is applicable only when the I2C EERPOM is used to store
-    // a webpage template.
-    // Reading templates from the I2C EEPROM is very slow relative to reading
-    // the templates from STM8 Flash. So the "pre_buf[]" array is used to bulk
-    // read template data from the I2C EEPROM to improve code speed. The
-    // pre_buf is then used to provide data to the webpage transmission code.
-    // Optimization:
-    //  - Packet transmission size will never exceed 440 bytes
-    //  - There isn't enough RAM to have a 440 byte buffer so later in the
-    //    process the pre_buf gets re-loaded
-    //  - Thus the pre_buf only needs to be about 230 bytes (to minimize the
-    //    amount of data read from the I2C EEPROM per packet, thus minimizing
-    //    time spent reading the data).
-    //  - I say "about 230 bytes" because there is some variability in how
-    //    much needs to be read due to the need to compensate for aliasing of
-    //    the read-from-EEPROM vs the collection of "%-nParsedMode-nParsedNum"
-    //    values. To account for this aliasing the buffer will get refilled
-    //    a few bytes before it is completely empty (see the refill code
-    //    further below).
-    //  - "off_board_eeprom_index" is a global value that was filled in prior
-    //    to the call to CopyHttpData() by the init_off_board_string_pointers()
-    //    function (which was called when determining which page to display).
-    
-    {
-      uint16_t i;
-      
-      prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, off_board_eeprom_index, 2);
-      for (i = 0; i < (PRE_BUF_SIZE - 1); i++) {
-        pre_buf[i] = I2C_read_byte(0);
-      }
-      pre_buf[PRE_BUF_SIZE - 1] = I2C_read_byte(1);
-      pre_buf_ptr = 0;
+    pBuffer = stpcpy(pBuffer, "{\"pc\":\"");
+    for (i = 0; i < num_pins; i++) {
+      int2hex(pin_control[i]);
+      pBuffer = stpcpy(pBuffer, OctetArray);
+    }
+    pBuffer = stpcpy(pBuffer, "\",\"n\":[");
+    for (i = 0; i < 16; i++) {
+      // IO Names only contain the is_allowed_char() characters, so they
+      // need no JSON escapes.
+      if (i) *pBuffer++ = ',';
+      *pBuffer++ = '"';
+      pBuffer = stpcpy(pBuffer, IO_NAME[i]);
+      *pBuffer++ = '"';
+    }
+#if RULE_ENGINE_SUPPORT == 1
+    pBuffer = stpcpy(pBuffer, "],\"ru\":\"");
+    for (i = 0; i < (NUM_RULES * 4); i++) {
+      int2hex(rule_table[i >> 2][i & 3]);
+      pBuffer = stpcpy(pBuffer, OctetArray);
     }
+    pBuffer = stpcpy(pBuffer, "\"}");
+#else // RULE_ENGINE_SUPPORT == 0
+    pBuffer = stpcpy(pBuffer, "]}");
+#endif // RULE_ENGINE_SUPPORT == 1
   }
-#endif // OB_EEPROM_SUPPORT == 1
-  //-------------------------------------------------------------------------//
 
+  return (uint16_t)(pBuffer - pStart);
+}
+#endif // STATE_JSON_SUPPORT == 1
 
-  while ((uint16_t)(pBuffer - pBuffer_start) < nMaxBytes) {
-    // This is the main loop for processing the page templates stored in
-    // Flash and inserting variable data as the webpage is copied to the
-    // transmission buffer.
-    //
-    // The variable *pDataLeft counts down the amount of data not yet
-    // "consumed" from the source web page template.
-    //
-    // There are a large number of "markers" in the template (example: %a01)
-    // that get replaced by other text when the template is read and copied
-    // to the transmit buffer. Thus, the amount of data actually sent for a
-    // given page can greatly exceed the original size of the template.
-    //
-    // There are two ways this loop terminates:
-    // 1) If (pBuffer - pBuffer_start) exceeds nMaxBytes.
-    // 2) If *pDataLeft reaches a count of zero.
-    // If the loop terminates and there is still data left to transmit (as
-    // indicated by pDataLeft > 0) the calling routine will call the function
-    // again.
-    
-    if (*pDataLeft > 0) {
-      // If pDataLeft > 0 then we are (or are still) processing a page
-      // template.
-    
-      if (pSocket->insertion_index != 0) {
+
+#if BINARY_UPLOAD_SUPPORT == 1 || CONFIG_SNAPSHOT_SUPPORT == 1 || IMAGE_BACKUP_TASK == 1
+uint32_t crc32_update(uint32_t crc, uint8_t data)
+{
+  // Adds one byte to a CRC32 (IEEE 802.3, reflected polynomial 0xEDB88320,
+  // as used by zlib). Start with 0xffffffff and invert the final value.
+  uint8_t i;
+  
+  crc ^= data;
+  for (i=0; i<8; i++) {
+    if (crc & 1) crc = (crc >> 1) ^ 0xEDB88320;
+    else crc = crc >> 1;
+  }
+  return crc;
+}
+#endif // BINARY_UPLOAD_SUPPORT == 1 || CONFIG_SNAPSHOT_SUPPORT == 1 || IMAGE_BACKUP_TASK == 1
+
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+// The settings snapshot (/b4) is the 8 byte snapshot_header, the settings
+// listed in snapshot_region[] in that order, then a CRC32 of all of the
+// preceding bytes (big endian):
+//   0-3    "NMCS"
+//   4      Format version (1)
+//   5      Reserved (0)
+//   6-7    Snapshot length (SNAPSHOT_SIZE), big endian
+// The settings are copied as they are stored, so multi-byte values are big
+// endian. A new version must only add regions at the end.
+#define SNAPSHOT_PENDING	0	// Imported into a Pending value
+#define SNAPSHOT_FLASH		1	// Staged in the I2C EEPROM, then copied
+				// to Flash
+#define SNAPSHOT_SKIP		2	// Not imported by this build
+
+struct snapshot_region {
+  uint8_t *pStored;	// The current setting
+  uint8_t *pImport;	// Where an imported setting is placed
+  uint16_t size;
+  uint8_t type;
+};
+
+static const uint8_t snapshot_header[8] = {
+  'N', 'M', 'C', 'S', 1, 0, (uint8_t)(SNAPSHOT_SIZE >> 8), (uint8_t)SNAPSHOT_SIZE
+};
+
+// The options bytes and the altitude have no Pending values, so an import
+// holds them here until the CRC32 is checked.
+static uint8_t snapshot_staged[4];
+
+static const struct snapshot_region snapshot_region[] = {
+  { stored_devicename, Pending_devicename, 20, SNAPSHOT_PENDING },
+  // The MAC and IP addresses are exported but never imported, so every
+  // module provisioned from one snapshot keeps its own addresses.
+  { stored_uip_ethaddr_oct, 0, 6, SNAPSHOT_SKIP },
+  { stored_hostaddr, 0, 4, SNAPSHOT_SKIP },
+  { stored_draddr, Pending_draddr, 4, SNAPSHOT_PENDING },
+  { stored_netmask, Pending_netmask, 4, SNAPSHOT_PENDING },
+  { (uint8_t *)&stored_port, (uint8_t *)&Pending_port, 2, SNAPSHOT_PENDING },
+  { stored_mqttserveraddr, Pending_mqttserveraddr, 4, SNAPSHOT_PENDING },
+  { (uint8_t *)&stored_mqttport, (uint8_t *)&Pending_mqttport, 2, SNAPSHOT_PENDING },
+  { (uint8_t *)stored_mqtt_username, (uint8_t *)Pending_mqtt_username, 11, SNAPSHOT_PENDING },
+  { (uint8_t *)stored_mqtt_password, (uint8_t *)Pending_mqtt_password, 11, SNAPSHOT_PENDING },
+  { &stored_config_settings, &Pending_config_settings, 1, SNAPSHOT_PENDING },
+  { &stored_options1, &snapshot_staged[0], 1, SNAPSHOT_PENDING },
+  { &stored_options2, &snapshot_staged[1], 1, SNAPSHOT_PENDING },
+  { (uint8_t *)&stored_altitude, &snapshot_staged[2], 2, SNAPSHOT_PENDING },
+  // The STM8 pins only. pin_control holds the current ON/OFF states.
+  { pin_control, Pending_pin_control, 16, SNAPSHOT_PENDING },
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD
+  { (uint8_t *)IO_TIMER, (uint8_t *)Pending_IO_TIMER, 32, SNAPSHOT_PENDING },
+  { (uint8_t *)IO_NAME, 0, 256, SNAPSHOT_FLASH },
+#else // BUILD_SUPPORT != BROWSER_ONLY_BUILD
+  { (uint8_t *)IO_TIMER, 0, 32, SNAPSHOT_SKIP },
+  { (uint8_t *)IO_NAME, 0, 256, SNAPSHOT_SKIP },
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD
+#if DOMOTICZ_SUPPORT == 1
+  { (uint8_t *)Sensor_IDX, 0, 48, SNAPSHOT_FLASH }
+#else // DOMOTICZ_SUPPORT == 0
+  { (uint8_t *)Sensor_IDX, 0, 48, SNAPSHOT_SKIP }
+#endif // DOMOTICZ_SUPPORT == 1
+};
+
+static uint16_t snapshot_offset;   // Bytes of the POSTed snapshot received
+static uint32_t snapshot_crc;      // CRC32 of the received bytes
+static uint32_t snapshot_crc_rx;   // CRC32 sent at the end of the snapshot
+static uint32_t snapshot_start;    // second_counter at the start of the POST
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+static uint8_t snapshot_chunk[16]; // IO Name / Sensor IDX bytes being
+                                   // staged, or the Flash word being
+                                   // copied
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+
+
+static const struct snapshot_region *snapshot_find(uint16_t *pOffset)
+{
+  // Returns the region holding the settings byte at *pOffset (counted from
+  // the end of the header) and changes *pOffset to the offset in the region.
+  const struct snapshot_region *pRegion;
+  
+  pRegion = &snapshot_region[0];
+  while (*pOffset >= pRegion->size) {
+    *pOffset -= pRegion->size;
+    pRegion++;
+  }
+  return pRegion;
+}
+
+
+static uint8_t snapshot_byte(uint16_t offset)
+{
+  // Returns the byte at offset in the snapshot. The CRC32 is not included.
+  const struct snapshot_region *pRegion;
+  
+  if (offset < 8) return snapshot_header[offset];
+  offset -= 8;
+  pRegion = snapshot_find(&offset);
+  return pRegion->pStored[offset];
+}
+
+
+void snapshot_export(uint8_t *pBuffer, uint16_t offset, uint16_t nBytes)
+{
+  // Writes nBytes of the snapshot starting at offset to pBuffer. The CRC32
+  // is only calculated if the last four bytes are written.
+  uint32_t crc;
+  uint16_t i;
+  
+  crc = 0;
+  if (offset + nBytes > SNAPSHOT_SIZE - 4) {
+    crc = 0xffffffff;
+    for (i = 0; i < SNAPSHOT_SIZE - 4; i++) crc = crc32_update(crc, snapshot_byte(i));
+    crc = ~crc;
+  }
+  while (nBytes--) {
+    if (offset < SNAPSHOT_SIZE - 4) *pBuffer = snapshot_byte(offset);
+    else *pBuffer = (uint8_t)(crc >> ((SNAPSHOT_SIZE - 1 - offset) << 3));
+    pBuffer++;
+    offset++;
+  }
+}
+
+
+void snapshot_import_init(void)
+{
+  // Called when the data of a POST to /b4 starts
+  snapshot_offset = 0;
+  snapshot_crc = 0xffffffff;
+  snapshot_crc_rx = 0;
+  snapshot_start = second_counter;
+}
+
+
+void snapshot_abort(void)
+{
+  // Returns the Pending values to the current settings so that nothing from
+  // an incomplete or damaged snapshot is applied later.
+  const struct snapshot_region *pRegion;
+  
+  for (pRegion = &snapshot_region[0];
+       pRegion < &snapshot_region[sizeof(snapshot_region) / sizeof(snapshot_region[0])];
+       pRegion++) {
+    if (pRegion->type == SNAPSHOT_PENDING) {
+      memcpy(pRegion->pImport, pRegion->pStored, pRegion->size);
+    }
+  }
+}
+
+
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+static uint16_t snapshot_staged_address(const struct snapshot_region *pRegion, uint16_t offset)
+{
+  // Returns the I2C EEPROM address where the byte at offset in a
+  // SNAPSHOT_FLASH region is staged. The SNAPSHOT_FLASH regions are staged
+  // one after the other from SNAPSHOT_I2C_EEPROM_STAGING.
+  const struct snapshot_region *pPrior;
+  uint16_t address;
+  
+  address = (uint16_t)(SNAPSHOT_I2C_EEPROM_STAGING + offset);
+  for (pPrior = &snapshot_region[0]; pPrior < pRegion; pPrior++) {
+    if (pPrior->type == SNAPSHOT_FLASH) address += pPrior->size;
+  }
+  return address;
+}
+
+
+static void snapshot_flash_commit(void)
+{
+  // Copies the staged IO Names and Sensor IDX values from the I2C EEPROM
+  // to Flash. Flash is written in 4 byte words, and only if the word
+  // changes.
+  const struct snapshot_region *pRegion;
+  uint16_t offset;
+  
+  for (pRegion = &snapshot_region[0];
+       pRegion < &snapshot_region[sizeof(snapshot_region) / sizeof(snapshot_region[0])];
+       pRegion++) {
+    if (pRegion->type != SNAPSHOT_FLASH) continue;
+    for (offset = 0; offset < pRegion->size; offset += 4) {
+      prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, snapshot_staged_address(pRegion, offset), 2);
+      snapshot_chunk[0] = I2C_read_byte(0);
+      snapshot_chunk[1] = I2C_read_byte(0);
+      snapshot_chunk[2] = I2C_read_byte(0);
+      snapshot_chunk[3] = I2C_read_byte(1);
+      if (memcmp(&pRegion->pStored[offset], snapshot_chunk, 4) != 0) {
+        unlock_flash();
+        FLASH_CR2 |= FLASH_CR2_WPRG;
+        FLASH_NCR2 &= (uint8_t)(~FLASH_NCR2_NWPRG);
+        memcpy(&pRegion->pStored[offset], snapshot_chunk, 4);
+        lock_flash();
+      }
+    }
+  }
+}
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+
+
+static void snapshot_commit(void)
+{
+  // Applies a complete snapshot. The Pending values are applied by
+  // check_runtime_changes() like a Configuration page Save, and the options
+  // and altitude are written here. Only the user settable options bits are
+  // taken: not the PCF8574 detected bit (options1 bit 3), the pin delete
+  // request (options1 bit 5) or the unused options2 bits 6 and 7. These are only read at boot, so a change
+  // requests a reboot, which check_runtime_changes() combines with any
+  // restart the Pending values need.
+  uint8_t options1;
+  uint8_t options2;
+  int16_t altitude;
+  
+  options1 = (uint8_t)((stored_options1 & 0x28) | (snapshot_staged[0] & 0xd7));
+  options2 = (uint8_t)(snapshot_staged[1] & 0x3f);
+  altitude = (int16_t)(((uint16_t)snapshot_staged[2] << 8) | snapshot_staged[3]);
+  
+  if (options1 != stored_options1
+   || options2 != stored_options2
+   || altitude != stored_altitude) {
+    unlock_eeprom();
+    if (options1 != stored_options1) stored_options1 = options1;
+    if (options2 != stored_options2) stored_options2 = options2;
+    if (altitude != stored_altitude) stored_altitude = altitude;
+    lock_eeprom();
+    user_reboot_request = 1;
+  }
+  
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+  snapshot_flash_commit();
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+  
+  parse_complete = 1;
+}
+
+
+void snapshot_import(struct tHttpD* pSocket, uint8_t *pBuffer, uint16_t nBytes)
+{
+  // Parses the data of a POST to /b4. The settings are collected in the
+  // Pending values (and snapshot_staged[]) as they arrive and are only
+  // applied once the whole snapshot is received and its CRC32 matches, so
+  // all of them are applied together with at most one reboot. The reply is
+  // 200 with no content, or 400 if the snapshot is not valid for this
+  // firmware.
+  //
+  // There is not enough RAM to hold the IO Names and Sensor IDX values, so
+  // they are staged in the I2C EEPROM (at SNAPSHOT_I2C_EEPROM_STAGING) as
+  // they arrive and only copied to Flash once the CRC32 matches. Builds
+  // that import them therefore need OB_EEPROM_SUPPORT (see uipopt.h).
+  const struct snapshot_region *pRegion;
+  uint16_t offset;
+  
+  while (nBytes != 0) {
+    if (snapshot_offset < SNAPSHOT_SIZE - 4) {
+      snapshot_crc = crc32_update(snapshot_crc, *pBuffer);
+      if (snapshot_offset < 8) {
+        if (*pBuffer != snapshot_header[snapshot_offset]) break;
+      }
+      else {
+        offset = (uint16_t)(snapshot_offset - 8);
+        pRegion = snapshot_find(&offset);
+        if (pRegion->type == SNAPSHOT_PENDING) pRegion->pImport[offset] = *pBuffer;
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+        if (pRegion->type == SNAPSHOT_FLASH) {
+          // The staging area is written 16 bytes at a time. The region
+          // sizes are multiples of 16 and the staging area is 128 byte
+          // aligned, so a write never crosses an I2C EEPROM page.
+          snapshot_chunk[offset & 0x0f] = *pBuffer;
+          if ((offset & 0x0f) == 0x0f) {
+            uint8_t i;
+            I2C_control(I2C_EEPROM2_WRITE);
+            I2C_byte_address(snapshot_staged_address(pRegion, (uint16_t)(offset - 15)), 2);
+            for (i=0; i<16; i++) I2C_write_byte(snapshot_chunk[i]);
+            I2C_stop(); // Start the EEPROM internal write cycle
+            wait_timer(5000); // Wait 5ms
+          }
+        }
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1
+      }
+    }
+    else {
+      snapshot_crc_rx = (snapshot_crc_rx << 8) | *pBuffer;
+    }
+    pBuffer++;
+    nBytes--;
+    snapshot_offset++;
+    
+    if (snapshot_offset == SNAPSHOT_SIZE) {
+      if (~snapshot_crc == snapshot_crc_rx) {
+        snapshot_commit();
+        pSocket->nState = STATE_SENDHEADER204;
+        return;
+      }
+      break;
+    }
+  }
+  
+  if (nBytes != 0 || snapshot_offset == SNAPSHOT_SIZE) {
+    // The header or the CRC32 did not match
+    snapshot_abort();
+    pSocket->nState = STATE_SENDHEADER400;
+  }
+}
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
+
+static uint8_t* copy_pin_states(uint8_t* pBuffer)
+{
+  // Copies the pin states in the format used by the "98" and "99" commands
+  // (see %f00 in CopyHttpData()) and returns the end of the copy.
+  // For output pins display the state in the pin_control byte.
+  // For input pins if the Invert bit is set the ON_OFF state needs to
+  // be inverted before displaying.
+  // Bits are output for Pin 16 first and Pin 1 last
+  // If PCF8574 is implemented bits are output for Pin 24 first and
+  // Pin 1 last.
+  // If stored_options1 bit 0x10 is set then any Disabled pin must be
+  // shown as '-'. Otherwise the last known pin state is displayed.
+  int i;
+
+#if PCF8574_SUPPORT == 0
+  i = 15;
+#endif // PCF8574_SUPPORT == 0
+#if PCF8574_SUPPORT == 1
+  if (stored_options1 & 0x08) i = 23;
+  else i = 15;
+#endif // PCF8574_SUPPORT == 1
+
+  while( 1 ) {
+    if (((pin_control[i] & 0x03) == 0x00) && ((stored_options1 & 0x10) == 0x10)) {
+      // This is a Disabled pin and Option is set to display a '-'
+      *pBuffer++ = '-';
+    }
+#if LINKED_SUPPORT == 0
+    else if (pin_control[i] & 0x02) {
+#endif // LINKED_SUPPORT == 0
+#if LINKED_SUPPORT == 1
+    else if (chk_iotype(pin_control[i], i, 0x03) == 0x03) {
+#endif // LINKED_SUPPORT == 1
+      // This is an output
+      if (pin_control[i] & 0x80) {
+        // Output is ON
+        *pBuffer++ = '1';
+      }
+      else {
+        // Output is OFF
+        *pBuffer++ = '0';
+      }
+    }
+    else {
+      // This is an input
+      if (pin_control[i] & 0x80) {
+        // Input is ON, invert if needed
+        if (pin_control[i] & 0x04) *pBuffer = '0';
+        else *pBuffer = '1';
+        pBuffer++;
+      }
+      else {
+        // Input is OFF, invert if needed
+        if (pin_control[i] & 0x04) *pBuffer = '1';
+        else *pBuffer = '0';
+        pBuffer++;
+      }
+    }
+    if (i == 0) break;
+    i--;
+  }
+  return pBuffer;
+}
+
+
+#if HTTP_WEBSOCKET == 1
+// One WebSocket is served at a time. ws_flags collects the frames waiting
+// to be sent and ws_sent the frames in the segment in flight, so that the
+// segment can be rebuilt on uip_rexmit(). A retransmission must repeat the
+// bytes that were sent: the handshake reply does not change, the pin
+// states text is kept in ws_state_text[] and ws_ping[] is not replaced
+// while a segment is in flight.
+static struct uip_conn *ws_conn;   // The WebSocket connection, or NULL
+static uint8_t ws_flags;           // WS_ frames waiting to be sent
+static uint8_t ws_sent;            // WS_ frames in the segment in flight
+#if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+static uint16_t ws_pins;           // ON_OFF_word in the last state frame
+#else
+static uint32_t ws_pins;           // ON_OFF_word in the last state frame
+#endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+static uint16_t ws_time;           // second_counter at the last state frame
+static char ws_key[28];            // Sec-WebSocket-Key from the GET headers,
+                                   // replaced by the Sec-WebSocket-Accept
+                                   // value by ws_accept()
+static uint8_t ws_ping[8];         // Payload of the last ping, returned in
+static uint8_t ws_ping_len;        //   the pong
+static uint8_t ws_state_text[24];  // Pin states text of the last state
+static uint8_t ws_state_len;       //   frame, repeated on uip_rexmit()
+
+static const char ws_guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+
+static uint8_t ws_accept_byte(uint8_t i)
+{
+  // Returns byte i of the padded SHA-1 message: the 24 character key, the
+  // GUID, the 0x80 end marker, zero fill and the 480 bit message length.
+  if (i < 24) return (uint8_t)ws_key[i];
+  if (i < 60) return (uint8_t)ws_guid[i - 24];
+  if (i == 60) return 0x80;
+  if (i == 126) return 0x01;
+  if (i == 127) return 0xe0;
+  return 0;
+}
+
+
+static char ws_base64(uint8_t v)
+{
+  v &= 0x3f;
+  if (v < 26) return (char)('A' + v);
+  if (v < 52) return (char)('a' + v - 26);
+  if (v < 62) return (char)('0' + v - 52);
+  if (v == 62) return '+';
+  return '/';
+}
+
+
+static void ws_accept(void)
+{
+  // Replaces the key in ws_key[] with the Sec-WebSocket-Accept value, the
+  // base64 encoded SHA-1 of the key followed by the GUID. The message is
+  // always two SHA-1 blocks, and the message schedule is kept in a 16 word
+  // rolling buffer.
+  uint32_t h[5];
+  uint32_t w[16];
+  uint32_t a, b, c, d, e, t;
+  uint8_t block;
+  uint8_t i;
+  uint8_t j;
+
+  h[0] = 0x67452301UL;
+  h[1] = 0xefcdab89UL;
+  h[2] = 0x98badcfeUL;
+  h[3] = 0x10325476UL;
+  h[4] = 0xc3d2e1f0UL;
+
+  for (block = 0; block < 128; block += 64) {
+    for (i = 0; i < 16; i++) {
+      w[i] = 0;
+      for (j = 0; j < 4; j++) {
+        w[i] = (w[i] << 8) | ws_accept_byte((uint8_t)(block + (i * 4) + j));
+      }
+    }
+    a = h[0];
+    b = h[1];
+    c = h[2];
+    d = h[3];
+    e = h[4];
+    for (i = 0; i < 80; i++) {
+      if (i >= 16) {
+        t = w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15];
+        w[i & 15] = (t << 1) | (t >> 31);
+      }
+      if (i < 20) t = ((b & c) | (~b & d)) + 0x5a827999UL;
+      else if (i < 40) t = (b ^ c ^ d) + 0x6ed9eba1UL;
+      else if (i < 60) t = ((b & c) | (b & d) | (c & d)) + 0x8f1bbcdcUL;
+      else t = (b ^ c ^ d) + 0xca62c1d6UL;
+      t += ((a << 5) | (a >> 27)) + e + w[i & 15];
+      e = d;
+      d = c;
+      c = (b << 30) | (b >> 2);
+      b = a;
+      a = t;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  // The 20 byte digest is 6 groups of 3 bytes and a last group of 2 bytes
+  // padded with '='.
+  for (i = 0; i < 7; i++) {
+    t = 0;
+    for (j = 0; j < 3; j++) {
+      block = (uint8_t)((i * 3) + j);
+      t <<= 8;
+      if (block < 20) t |= (uint8_t)(h[block >> 2] >> (24 - ((block & 3) * 8)));
+    }
+    ws_key[i * 4] = ws_base64((uint8_t)(t >> 18));
+    ws_key[(i * 4) + 1] = ws_base64((uint8_t)(t >> 12));
+    ws_key[(i * 4) + 2] = ws_base64((uint8_t)(t >> 6));
+    ws_key[(i * 4) + 3] = ws_base64((uint8_t)t);
+  }
+  ws_key[27] = '=';
+}
+
+
+static uint16_t ws_build(uint8_t* pBuffer, uint8_t flags, uint8_t rexmit)
+{
+  // Copies the handshake reply and the frames selected by flags to the
+  // output buffer and returns the number of bytes copied. With rexmit set
+  // the state frame repeats the pin states that were sent before.
+  uint8_t* pStart;
+
+  pStart = pBuffer;
+  if (flags & WS_HANDSHAKE) {
+    pBuffer = (uint8_t *)stpcpy((char *)pBuffer,
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: ");
+    memcpy(pBuffer, ws_key, 28);
+    pBuffer += 28;
+    pBuffer = (uint8_t *)stpcpy((char *)pBuffer, "\r\n\r\n");
+  }
+  if (flags & WS_PONG) {
+    *pBuffer++ = 0x8a;
+    *pBuffer++ = ws_ping_len;
+    memcpy(pBuffer, ws_ping, ws_ping_len);
+    pBuffer += ws_ping_len;
+  }
+  if (flags & WS_STATE) {
+    // Text frame with the pin states in the /98 format
+    *pBuffer++ = 0x81;
+    if (rexmit == 0) {
+      ws_state_len = (uint8_t)(copy_pin_states(ws_state_text) - ws_state_text);
+      ws_pins = ON_OFF_word;
+      ws_time = (uint16_t)second_counter;
+    }
+    *pBuffer++ = ws_state_len;
+    memcpy(pBuffer, ws_state_text, ws_state_len);
+    pBuffer += ws_state_len;
+  }
+  if (flags & WS_CLOSE) {
+    *pBuffer++ = 0x88;
+    *pBuffer++ = 0x00;
+  }
+  return (uint16_t)(pBuffer - pStart);
+}
+
+
+static void ws_receive(uint8_t* pBuffer, uint16_t nBytes)
+{
+  // Processes the frames received from the Browser. Only masked, final
+  // frames of up to 125 bytes that are complete in the segment are
+  // accepted. Anything else closes the WebSocket.
+  //   Text    Two digit /xx pin commands, "00" to "31" ("00" to "47" with
+  //           PCF8574): IO (n / 2) + 1 is turned ON if n is odd, OFF if
+  //           n is even.
+  //   Binary  4 byte mask and 4 byte values, big endian, as UDP control
+  //           cmd 0x02. The pins with a mask bit set are given the value
+  //           bit.
+  //   Close   A close frame is returned and the connection closed.
+  //   Ping    Up to 8 bytes of payload are returned in a pong.
+  uint8_t nLength;
+  uint8_t num_pins;
+  uint8_t i;
+  uint8_t n;
+  uint8_t* pPayload;
+  uint32_t mask;
+  uint32_t values;
+
+  num_pins = 16;
+#if PCF8574_SUPPORT == 1
+  if (stored_options1 & 0x08) num_pins = 24;
+#endif // PCF8574_SUPPORT == 1
+
+  while (nBytes != 0 && ((ws_flags | ws_sent) & WS_CLOSE) == 0) {
+    nLength = (uint8_t)(pBuffer[1] & 0x7f);
+    if (nBytes < 6 || (pBuffer[0] & 0x80) == 0 || (pBuffer[1] & 0x80) == 0
+     || nLength > 125 || nBytes < (uint16_t)(6 + nLength)) {
+      ws_flags |= WS_CLOSE;
+      return;
+    }
+#if RESPONSE_LOCK_SUPPORT == 1
+    if ((stored_options1 & 0x40) == 0x40) {
+      // Response Lock is ON
+      ws_flags |= WS_CLOSE;
+      return;
+    }
+#endif // RESPONSE_LOCK_SUPPORT == 1
+    pPayload = pBuffer + 6;
+    for (i = 0; i < nLength; i++) pPayload[i] ^= pBuffer[2 + (i & 3)];
+
+    switch (pBuffer[0] & 0x0f) {
+      case 0x01:
+        for (i = 0; (uint8_t)(i + 1) < nLength; i += 2) {
+          if (pPayload[i] < '0' || pPayload[i] > '9'
+           || pPayload[i + 1] < '0' || pPayload[i + 1] > '9') break;
+          n = (uint8_t)(((pPayload[i] - '0') * 10) + (pPayload[i + 1] - '0'));
+          if (n < (uint8_t)(num_pins * 2)) update_ON_OFF((uint8_t)(n / 2), (uint8_t)(n % 2));
+        }
+        break;
+
+      case 0x02:
+        if (nLength != 8) break;
+        mask = ((uint32_t)pPayload[0] << 24) | ((uint32_t)pPayload[1] << 16)
+             | ((uint32_t)pPayload[2] << 8) | pPayload[3];
+        values = ((uint32_t)pPayload[4] << 24) | ((uint32_t)pPayload[5] << 16)
+               | ((uint32_t)pPayload[6] << 8) | pPayload[7];
+        for (i = 0; i < num_pins; i++) {
+          if (mask & ((uint32_t)1 << i)) {
+            update_ON_OFF(i, (uint8_t)((values >> i) & 1));
+          }
+        }
+        break;
+
+      case 0x08:
+        ws_flags |= WS_CLOSE;
+        break;
+
+      case 0x09:
+        // A ping that arrives while a segment is in flight is ignored, as
+        // ws_ping[] may be needed to retransmit a pong.
+        if (ws_sent != 0) break;
+        if (nLength > 8) nLength = 8;
+        memcpy(ws_ping, pPayload, nLength);
+        ws_ping_len = nLength;
+        ws_flags |= WS_PONG;
+        break;
+
+      case 0x0a:
+        // Pong
+        break;
+
+      default:
+        // Fragmented and reserved frames are not supported
+        ws_flags |= WS_CLOSE;
+        return;
+    }
+    nLength = (uint8_t)(pBuffer[1] & 0x7f);
+    pBuffer += 6 + nLength;
+    nBytes -= 6 + nLength;
+  }
+}
+
+
+static void ws_call(struct tHttpD* pSocket, uint8_t* pBuffer, uint16_t nBytes)
+{
+  // Runs a connection that has been upgraded to a WebSocket. Called from
+  // HttpDCall() for every event on the connection once nState is
+  // STATE_WEBSOCKET.
+  if (uip_closed() || uip_aborted() || uip_timedout()) {
+    if (uip_conn == ws_conn) ws_conn = NULL;
+    pSocket->nState = STATE_NULL;
+    return;
+  }
+
+  if (uip_conn != ws_conn) {
+    // A newer WebSocket has replaced this one
+    pSocket->nState = STATE_NULL;
+    uip_abort();
+    return;
+  }
+
+  if (uip_acked()) {
+    if (ws_sent & WS_CLOSE) {
+      // The close frame has been delivered
+      ws_conn = NULL;
+      pSocket->nState = STATE_NULL;
+      uip_close();
+      return;
+    }
+    ws_sent = 0;
+  }
+
+  if (uip_rexmit()) {
+    uip_send(uip_appdata, ws_build(uip_appdata, ws_sent, 1));
+    return;
+  }
+
+  if (uip_newdata()) ws_receive(pBuffer, nBytes);
+
+  if (ws_sent == 0) {
+    // Send a state frame when a pin changes, and at least every
+    // WS_HEARTBEAT seconds so that a dead Browser is found by the
+    // retransmission timeout.
+    if (ws_pins != ON_OFF_word
+     || (uint16_t)((uint16_t)second_counter - ws_time) >= WS_HEARTBEAT) {
+      ws_flags |= WS_STATE;
+    }
+    if (ws_flags) {
+      ws_sent = ws_flags;
+      ws_flags = 0;
+      uip_send(uip_appdata, ws_build(uip_appdata, ws_sent, 0));
+    }
+  }
+}
+#endif // HTTP_WEBSOCKET == 1
+
+
+#if HTTP_FUSED_CHKSUM == 1
+static uint16_t payload_sum_hi;  // Sum of the payload bytes at even offsets
+static uint16_t payload_sum_lo;  // Sum of the payload bytes at odd offsets
+
+static void payload_sum(uint8_t* pBuffer_start, uint8_t* pFrom, uint8_t* pTo)
+{
+  // Adds the payload bytes from pFrom up to (not including) pTo to the
+  // payload checksum sums. A byte at an even offset from the start of the
+  // payload is the high byte of a 16 bit checksum word.
+  while (pFrom < pTo) {
+    if ((uint16_t)(pFrom - pBuffer_start) & 1) payload_sum_lo += *pFrom;
+    else payload_sum_hi += *pFrom;
+    pFrom++;
+  }
+}
+#endif // HTTP_FUSED_CHKSUM == 1
+
+
+static uint16_t CopyHttpData(uint8_t* pBuffer,
+                             const char** ppData,
+			     uint16_t* pDataLeft,
+			     uint16_t nMaxBytes,
+			     struct tHttpD* pSocket)
+{
+  // This function copies the selected webpage from flash storage to the
+  // output buffer. This function is called from the HttpDCall() function
+  // (see the "senddata:" part of that function).
+  // pBuffer - the output buffer
+  // ppData - the Flash storage for the Webpage template
+  // pDataLeft - remaining size of the template to be processed
+  // nMaxBytes - size of the output buffer
+  // While performing the copy the stream of characters in the webpage
+  // template is searched for special markers that indicate where template
+  // text should be replaced with variable length text.
+    
+  uint8_t nByte;
+  uint8_t nParsedNum;
+  uint8_t nParsedMode;
+  uint8_t temp;
+  int i;
+  int no_err;
+  unsigned char temp_octet[3];
+  uint8_t* pBuffer_start;
+#if HTTP_FUSED_CHKSUM == 1
+  uint8_t* pSummed;
+#endif // HTTP_FUSED_CHKSUM == 1
+#if HTTP_LITERAL_RUNS == 1
+  uint8_t literal_runs;
+#endif // HTTP_LITERAL_RUNS == 1
+#if PAGE_BUILD_STATISTICS == 1
+  uint32_t build_start;
+#endif // PAGE_BUILD_STATISTICS == 1
+  
+  // For use only in upgradeable builds:
+#if OB_TEMPLATE_CACHE == 0
+  #define PRE_BUF_SIZE	230
+  char pre_buf[PRE_BUF_SIZE];
+#endif // OB_TEMPLATE_CACHE == 0
+  uint16_t pre_buf_ptr = 0;
+
+  
+  nParsedNum = 0;
+  nParsedMode = 0;
+  pBuffer_start =  pBuffer;
+#if PAGE_BUILD_STATISTICS == 1
+  build_start = now_us();
+#endif // PAGE_BUILD_STATISTICS == 1
+#if HTTP_FUSED_CHKSUM == 1
+  // The TCP checksum of the payload is summed while the payload is built.
+  // Bytes copied straight from the template are added as they are copied.
+  // Bytes written by the insertion code are added at the start of the next
+  // pass of the loop below. pSummed tracks how far the payload is summed.
+  // Each of the two sums can take 257 bytes without overflow, which is
+  // more than half of UIP_TCP_MSS.
+  pSummed = pBuffer;
+  payload_sum_hi = 0;
+  payload_sum_lo = 0;
+#endif // HTTP_FUSED_CHKSUM == 1
+
+  // The input value "nMaxBytes" provided by the calling routine is based on
+  // the MSS (Maximum Segment Size) defined in UIP_TCP_MSS.
+  //
+  // In this "transmit" routine MSS indicates the maximum number of TCP
+  // datagram bytes that the remote host will accept in a TCP segment (the
+  // TCP datagram part of an IP frame). The MSS value is defined in the
+  // uipopt.h file. Later the MSS should be updated with a value obtained from
+  // the browser that is accessing the web server during setup of a connection.
+  // However, I don't think this actually happens, and for simplification I
+  // think UIP is using a single MSS value for transmit and receive. Receive
+  // is the critical direction because we have limited memory to store
+  // incoming packets ... and it is OK if we transmit less than the MSS that a
+  // remote host tells us it can receive. The problem that this causes is that
+  // as we reduce the value of MSS for receive, it also reduces the size of
+  // MSS for transmit, and that causes our web page transmission to take a
+  // very long time (I'm seeing 2 seconds for a simple web page). May have to
+  // work on this some more.
+  //
+  // In the original UIP code there was a "uip_split" function that would
+  // reduce the size of transmitted packets. I think that code was interacting
+  // with the code below creating instability, perhaps because a lot of
+  // short packets were generated. Making the nMaxBytes limit smaller than the
+  // uip_split threshold effectively prevented the uip_split from operating,
+  // and the overall code became stable. I subsequently decided to remove
+  // uip_split from this application.
+  //
+  //-------------------------------------------------------------------------//
+  // See the uipopt.h file for the UIP_TCP_MSS definition. It must be smaller
+  // than the UIP_BUF less the headers that are also inserted in the UIP_BUF
+  // by the UIP code. The UIP_BUF size is determined by the ENC28J60_MAXFRAME
+  // value set in the enc28j60.h file.
+  // 
+  // Note: The ENC28J60 value was on the order of 900 bytes in the original
+  // code. However, due to limited RAM size, a smaller value was selected for
+  // this application. The primary limitation is when building MQTT code
+  // ENC28J60_MAXFRAME ends up being further limited to allow room for the
+  // MQTT variables and data buffer.
+  //
+  // Note: Complete transmission of the typical webpage in this application is
+  // about 4000 bytes.
+  //
+  //-------------------------------------------------------------------------//
+  // nMaxbytes must be smaller than UIP_TCP_MSS due to the need to allow for
+  // the largest string insertion that is NOT a %yxx replacement (as %yxx
+  // replacements can be interrupted if the buffer fills and can be continued
+  // at the next call of this routine).
+  //
+  // nMaxBytes should not cause a TCP datagram formation larger than 536
+  // bytes.
+  //
+  // The following statement over-rides the nMaxBytes value passed to the
+  // function to account for extra bytes that might be sent in a single pass
+  // of the loop below. This causes most packet transmissions to be smaller,
+  // but accomodates those that have the extra bytes inserted.
+  nMaxBytes = UIP_TCP_MSS - 40;
+  //-------------------------------------------------------------------------//
+
+#if HTTP_LITERAL_RUNS == 1
+  // Literal runs are copied directly from templates in Flash. This is
+  // cleared below for templates read from the I2C EEPROM.
+  literal_runs = 1;
+#endif // HTTP_LITERAL_RUNS == 1
+
+
+
+  //-------------------------------------------------------------------------//
+#if OB_EEPROM_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_IOCONTROL
+   || pSocket->current_webpage == WEBPAGE_CONFIGURATION
+#if PCF8574_SUPPORT == 1
+#if DOMOTICZ_SUPPORT == 0
+   || pSocket->current_webpage == WEBPAGE_PCF8574_IOCONTROL
+   || pSocket->current_webpage == WEBPAGE_PCF8574_CONFIGURATION
+#endif // DOMOTICZ_SUPPORT == 0
+#endif // PCF8574_SUPPORT == 1
+   || pSocket->current_webpage == WEBPAGE_LOADUPLOADER) {
+    // This code is applicable only when the I2C EERPOM is used to store
+    // a webpage template.
+    // Reading templates from the I2C EEPROM is very slow relative to reading
+    // the templates from STM8 Flash. So the "pre_buf[]" array is used to bulk
+    // read template data from the I2C EEPROM to improve code speed. The
+    // pre_buf is then used to provide data to the webpage transmission code.
+    // Optimization:
+    //  - Packet transmission size will never exceed 440 bytes
+    //  - There isn't enough RAM to have a 440 byte buffer so later in the
+    //    process the pre_buf gets re-loaded
+    //  - Thus the pre_buf only needs to be about 230 bytes (to minimize the
+    //    amount of data read from the I2C EEPROM per packet, thus minimizing
+    //    time spent reading the data).
+    //  - I say "about 230 bytes" because there is some variability in how
+    //    much needs to be read due to the need to compensate for aliasing of
+    //    the read-from-EEPROM vs the collection of "%-nParsedMode-nParsedNum"
+    //    values. To account for this aliasing the buffer will get refilled
+    //    a few bytes before it is completely empty (see the refill code
+    //    further below).
+    //  - "off_board_eeprom_index" is a global value that was filled in prior
+    //    to the call to CopyHttpData() by the init_off_board_string_pointers()
+    //    function (which was called when determining which page to display).
+    
+#if HTTP_LITERAL_RUNS == 1
+    literal_runs = 0;
+#endif // HTTP_LITERAL_RUNS == 1
+#if OB_TEMPLATE_CACHE == 1
+    // With OB_TEMPLATE_CACHE the pre_buf is kept from the last call and is
+    // only re-read if it does not cover off_board_eeprom_index.
+    pre_buf_ptr = pre_buf_load();
+#else // OB_TEMPLATE_CACHE == 0
+    {
+      uint16_t i;
+      
+      prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, off_board_eeprom_index, 2);
+      for (i = 0; i < (PRE_BUF_SIZE - 1); i++) {
+        pre_buf[i] = I2C_read_byte(0);
+      }
+      pre_buf[PRE_BUF_SIZE - 1] = I2C_read_byte(1);
+      pre_buf_ptr = 0;
+    }
+#endif // OB_TEMPLATE_CACHE == 1
+  }
+#endif // OB_EEPROM_SUPPORT == 1
+  //-------------------------------------------------------------------------//
+
+
+#if GZIP_STATIC_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_STYLE_GZ) {
+    // The gzip style sheet is binary data and may contain any byte value,
+    // so it is copied as is instead of being searched for % markers.
+    i = (int)*pDataLeft;
+    if (i > (int)nMaxBytes) i = (int)nMaxBytes;
+    memcpy(pBuffer, *ppData, i);
+    *ppData = *ppData + i;
+    *pDataLeft = *pDataLeft - i;
+    pBuffer += i;
+  }
+  else
+#endif // GZIP_STATIC_SUPPORT == 1
+#if STATE_JSON_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_JSON_STATE
+   || pSocket->current_webpage == WEBPAGE_JSON_PINS) {
+    // The JSON responses are written in one step. pData is moved with
+    // nDataLeft so that a retransmit can step back over the response.
+    pBuffer += json_build(pSocket->current_webpage, (char *)pBuffer);
+    *ppData = *ppData + *pDataLeft;
+    *pDataLeft = 0;
+  }
+  else
+#endif // STATE_JSON_SUPPORT == 1
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_SNAPSHOT) {
+    // The snapshot is binary and is written from the current settings. The
+    // offset into it follows from nDataLeft, and pData is moved with
+    // nDataLeft so that a retransmit can step back.
+    i = (int)*pDataLeft;
+    if (i > (int)nMaxBytes) i = (int)nMaxBytes;
+    snapshot_export(pBuffer, (uint16_t)(SNAPSHOT_SIZE - *pDataLeft), (uint16_t)i);
+    *ppData = *ppData + i;
+    *pDataLeft = *pDataLeft - i;
+    pBuffer += i;
+  }
+  else
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+#if TRACE_RING_SUPPORT == 1
+  if (pSocket->current_webpage == WEBPAGE_TRACE) {
+    // The trace is copied as is from I2C EEPROM3. The offset into it
+    // follows from nDataLeft, and pData is moved with nDataLeft so that a
+    // retransmit can step back.
+    uint16_t k;
+    i = (int)*pDataLeft;
+    if (i > (int)nMaxBytes) i = (int)nMaxBytes;
+    if (i > 0) {
+      prep_read(I2C_EEPROM3_WRITE, I2C_EEPROM3_READ,
+        (uint16_t)(I2C_EEPROM3_BASE + (TRACE_SIZE - *pDataLeft)), 2);
+      for (k = 1; k < (uint16_t)i; k++) *pBuffer++ = I2C_read_byte(0);
+      *pBuffer++ = I2C_read_byte(1);
+    }
+    *ppData = *ppData + i;
+    *pDataLeft = *pDataLeft - i;
+  }
+  else
+#endif // TRACE_RING_SUPPORT == 1
+  while ((uint16_t)(pBuffer - pBuffer_start) < nMaxBytes) {
+    // This is the main loop for processing the page templates stored in
+    // Flash and inserting variable data as the webpage is copied to the
+    // transmission buffer.
+    //
+    // The variable *pDataLeft counts down the amount of data not yet
+    // "consumed" from the source web page template.
+    //
+    // There are a large number of "markers" in the template (example: %a01)
+    // that get replaced by other text when the template is read and copied
+    // to the transmit buffer. Thus, the amount of data actually sent for a
+    // given page can greatly exceed the original size of the template.
+    //
+    // There are two ways this loop terminates:
+    // 1) If (pBuffer - pBuffer_start) exceeds nMaxBytes.
+    // 2) If *pDataLeft reaches a count of zero.
+    // If the loop terminates and there is still data left to transmit (as
+    // indicated by pDataLeft > 0) the calling routine will call the function
+    // again.
+
+#if HTTP_FUSED_CHKSUM == 1
+    // Sum anything written by the insertion code in the last pass
+    if (pSummed != pBuffer) {
+      payload_sum(pBuffer_start, pSummed, pBuffer);
+      pSummed = pBuffer;
+    }
+#endif // HTTP_FUSED_CHKSUM == 1
+    
+    if (*pDataLeft > 0) {
+      // If pDataLeft > 0 then we are (or are still) processing a page
+      // template.
+    
+      if (pSocket->insertion_index != 0) {
         // If we previously interrupted an insertion string transfer to the
 	// transmit buffer then we don't want to read a character from the
 	// template, and instead we want to continue with the insertion string
@@ -6003,12 +8145,16 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 	    // reloading from the current point in the I2C EEPROM (pointed to by
 	    // off_board_eeprom_index) no remaining data in the pre_buf is lost.
             if (pre_buf_ptr > (PRE_BUF_SIZE - 6)) {
+#if OB_TEMPLATE_CACHE == 1
+              pre_buf_ptr = pre_buf_load();
+#else // OB_TEMPLATE_CACHE == 0
               prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, off_board_eeprom_index, 2);
               for (i = 0; i < (PRE_BUF_SIZE - 1); i++) {
                 pre_buf[i] = I2C_read_byte(0);
               }
               pre_buf[PRE_BUF_SIZE - 1] = I2C_read_byte(1);
               pre_buf_ptr = 0;
+#endif // OB_TEMPLATE_CACHE == 1
             }
           }
 	  
@@ -6384,7 +8530,272 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
             int2hex(MQTT_broker_dis_counter);
             pBuffer = stpcpy(pBuffer, OctetArray);
 	  }
+#if FRAME_COPY_STATISTICS == 1
+          else if (nParsedNum == 36 || nParsedNum == 37) {
+	    // Display the last receive (36) or transmit (37) frame copy time
+	    // in 10us units followed by the frame size in bytes
+	    uint16_t copy_time;
+	    uint16_t copy_bytes;
+	    if (nParsedNum == 36) {
+	      copy_time = rx_copy_time;
+	      copy_bytes = rx_copy_bytes;
+	    }
+	    else {
+	      copy_time = tx_copy_time;
+	      copy_bytes = tx_copy_bytes;
+	    }
+            pBuffer = stpcpy(pBuffer, "00");
+            int2hex((uint8_t)(copy_time >> 8));
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)copy_time);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)(copy_bytes >> 8));
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)copy_bytes);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // FRAME_COPY_STATISTICS == 1
+#if RX_DRAIN_SUPPORT == 1
+          else if (nParsedNum == 38) {
+	    // Display the deepest receive drain followed by the count of
+	    // drains that stopped at RX_DRAIN_MAX_PACKETS
+            pBuffer = stpcpy(pBuffer, "0000");
+            int2hex(rx_drain_max);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)(rx_drain_limit_counter >> 8));
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)rx_drain_limit_counter);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // RX_DRAIN_SUPPORT == 1
+#if RX_PEEK_DISCARD == 1
+          else if (nParsedNum == 39) {
+	    // Display the count of frames discarded after the header peek
+	    emb_itoa(rx_discard_counter, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // RX_PEEK_DISCARD == 1
+	}
+#if RX_OCCUPANCY_STATISTICS == 1 || HTTP_SPLIT_OUTPUT == 1 || TCP_FAST_REXMIT == 1 || MQTT_DISCOVERY_BATCH == 1 || MQTT_PUBLISH_ROUND_ROBIN == 1 || MQTT_FAST_RECONNECT == 1 || MQTT_PUBLISH_DISPATCH == 1 || DEFERRED_SENSOR_INIT == 1 || RAM_HEADROOM_STATISTICS == 1 || PUBLISH_LATENCY_STATS == 1 || ENC28J60_FLOW_CONTROL == 1 || PAGE_BUILD_STATISTICS == 1 || INPUT_PASS_STATISTICS == 1 || HTTP_PACING == 1 || EEPROM_WRITE_CACHE == 1
+        else if ((nParsedMode == 'e') && (nParsedNum >= 50) && (nParsedNum < 78)) {
+	  // This displays the receive buffer occupancy statistics, the split
+	  // output statistics, the retransmit statistics, the RAM headroom
+	  // statistics, the PUBLISH latency statistics, the flow control
+	  // count and the EEPROM write counts. They are numbered from 50 as 40 to 49 are used by
+	  // DEBUG_SENSOR_SERIAL.
+	  // %exx
+#if RX_OCCUPANCY_STATISTICS == 1
+          if (nParsedNum == 50) {
+	    // Display the peak EPKTCNT, the peak RX buffer occupancy and the
+	    // last sampled RX buffer occupancy (bytes)
+            int2hex(rx_pktcnt_peak);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)(rx_occupancy_peak >> 8));
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)rx_occupancy_peak);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)(rx_occupancy >> 8));
+            pBuffer = stpcpy(pBuffer, OctetArray);
+            int2hex((uint8_t)rx_occupancy);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+          if (nParsedNum == 51) {
+	    // Display the total time spent waiting for the transmitter in
+	    // milliseconds
+	    emb_itoa(tx_wait_time / 1000, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // RX_OCCUPANCY_STATISTICS == 1
+#if HTTP_SPLIT_OUTPUT == 1
+          if (nParsedNum == 52) {
+	    // Display the number of segments sent as two halves
+	    emb_itoa(split_count, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+          if (nParsedNum == 53) {
+	    // Display the time taken to send the last web page from its
+	    // header to the close in milliseconds
+	    emb_itoa(page_load_time, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if TCP_FAST_REXMIT == 1
+          if (nParsedNum == 54) {
+	    // Display the longest time from sending a segment to its first
+	    // retransmit in milliseconds
+	    emb_itoa(rexmit_latency_max, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+          if (nParsedNum == 55) {
+	    // Display the number of duplicate ACK retransmits
+	    emb_itoa(fast_rexmit_count, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // TCP_FAST_REXMIT == 1
+#if MQTT_DISCOVERY_BATCH == 1
+          if (nParsedNum == 56) {
+	    // Display the time taken to send the Home Assistant Auto
+	    // Discovery messages after the last MQTT connect in milliseconds
+	    emb_itoa(discovery_time, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // MQTT_DISCOVERY_BATCH == 1
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+          if (nParsedNum == 57) {
+	    // Display the longest delay from a pin change to its MQTT
+	    // PUBLISH in milliseconds
+	    emb_itoa(publish_delay_max, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+#if MQTT_FAST_RECONNECT == 1
+          if (nParsedNum == 58) {
+	    // Display the time from the TCP connect to MQTT startup complete
+	    // of the last MQTT connect in milliseconds
+	    emb_itoa(reconnect_time, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // MQTT_FAST_RECONNECT == 1
+#if MQTT_PUBLISH_DISPATCH == 1
+          if (nParsedNum == 59) {
+	    // Display the longest time taken to handle a received MQTT
+	    // PUBLISH in microseconds
+	    emb_itoa((uint32_t)inbound_time_max * 10, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // MQTT_PUBLISH_DISPATCH == 1
+#if DEFERRED_SENSOR_INIT == 1
+          if (nParsedNum == 60) {
+	    // Display the time from boot to the first ARP reply in
+	    // milliseconds
+	    emb_itoa(boot_arp_time, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#if BUILD_SUPPORT == MQTT_BUILD
+          if (nParsedNum == 61) {
+	    // Display the time from boot to the first MQTT startup complete
+	    // in milliseconds
+	    emb_itoa(boot_mqtt_time, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // DEFERRED_SENSOR_INIT == 1
+#if RAM_HEADROOM_STATISTICS == 1
+          if (nParsedNum == 62) {
+	    // Display the most stack used since boot (or the last clear) in
+	    // bytes. The stack has STACK_TOP - STACK_BOTTOM + 1 bytes.
+	    emb_itoa(stack_peak(), OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+          if (nParsedNum == 63) {
+	    // Display the largest frame received into or sent from the
+	    // uip_buf in bytes
+	    emb_itoa(uip_buf_peak, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#if BUILD_SUPPORT == MQTT_BUILD
+          if (nParsedNum == 64) {
+	    // Display the most of the mqtt_sendbuf used in bytes
+	    emb_itoa(mqtt_sendbuf_peak, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+          if (nParsedNum == 65) {
+	    // Display the largest received message held in the MQTT Partial
+	    // Buffer in bytes
+	    emb_itoa(mqtt_pbuf_peak, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if PUBLISH_LATENCY_STATS == 1
+          if (nParsedNum >= 66 && nParsedNum <= 71) {
+	    // Display the Input change to PUBLISH latency for one stage:
+	    //   66, 69 Debounced change to PUBLISH queued
+	    //   67, 70 PUBLISH queued to copied to the uip_buf
+	    //   68, 71 Debounced change to copied to the uip_buf
+	    // Fields 66-68 show min avg max (ms). Fields 69-71 show the 8
+	    // histogram buckets (see latency_record()). The two halves are
+	    // kept in separate fields to keep each insertion under the
+	    // CopyHttpData() buffer margin.
+	    struct latency_stage *pStage;
+	    uint16_t value;
+	    uint8_t k;
+	    if (nParsedNum < 69) {
+	      pStage = &latency[nParsedNum - 66];
+	      for (k = 0; k < 3; k++) {
+	        if (k == 0) value = pStage->count ? pStage->min : 0;
+	        else if (k == 1) value = pStage->count ? (uint16_t)(pStage->sum / pStage->count) : 0;
+	        else value = pStage->max;
+	        emb_itoa(value, OctetArray, 10, 5);
+	        pBuffer = stpcpy(pBuffer, OctetArray);
+	        if (k < 2) *pBuffer++ = ' ';
+	      }
+	    }
+	    else {
+	      pStage = &latency[nParsedNum - 69];
+	      for (k = 0; k < LATENCY_BUCKETS; k++) {
+	        emb_itoa(pStage->bucket[k], OctetArray, 10, 4);
+	        pBuffer = stpcpy(pBuffer, OctetArray);
+	        if (k < LATENCY_BUCKETS - 1) *pBuffer++ = ' ';
+	      }
+	    }
+	  }
+#endif // PUBLISH_LATENCY_STATS == 1
+#if ENC28J60_FLOW_CONTROL == 1
+          if (nParsedNum == 72) {
+	    // Display the count of ENC28J60 flow control pauses
+	    emb_itoa(rx_pause_counter, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // ENC28J60_FLOW_CONTROL == 1
+#if PAGE_BUILD_STATISTICS == 1
+          if (nParsedNum == 73) {
+	    // Display the time taken to build the last Link Error Statistics
+	    // page
+	    emb_itoa(page_build_time, OctetArray, 10, 10);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // PAGE_BUILD_STATISTICS == 1
+#if INPUT_PASS_STATISTICS == 1
+          if (nParsedNum == 74) {
+	    // Display the shortest and the longest input pass (us)
+	    emb_itoa(input_pass_min, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	    *pBuffer++ = ' ';
+	    emb_itoa(input_pass_max, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // INPUT_PASS_STATISTICS == 1
+#if HTTP_PACING == 1
+          if (nParsedNum == 75 || nParsedNum == 76) {
+	    // Display the queueing delays of the HTTP page segments (75) or
+	    // the MQTT messages (76) as count, average and maximum (ms)
+	    struct pacing_queue *pQueue;
+	    pQueue = &pacing[nParsedNum - 75];
+	    emb_itoa(pQueue->count, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	    *pBuffer++ = ' ';
+	    emb_itoa(pQueue->count ? (pQueue->sum / pQueue->count) : 0, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	    *pBuffer++ = ' ';
+	    emb_itoa(pQueue->max, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // HTTP_PACING == 1
+#if EEPROM_WRITE_CACHE == 1
+          if (nParsedNum == 77) {
+	    // Display the EEPROM programming cycles since boot (wear) and the
+	    // byte writes the cache merged into an already pending word. These
+	    // are not cleared by the Clear Statistics button.
+	    emb_itoa(eeprom_word_writes, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	    *pBuffer++ = ' ';
+	    emb_itoa(eeprom_coalesced, OctetArray, 10, 5);
+            pBuffer = stpcpy(pBuffer, OctetArray);
+	  }
+#endif // EEPROM_WRITE_CACHE == 1
 	}
+#endif // RX_OCCUPANCY_STATISTICS == 1 || HTTP_SPLIT_OUTPUT == 1 || TCP_FAST_REXMIT == 1 || MQTT_DISCOVERY_BATCH == 1 || MQTT_PUBLISH_ROUND_ROBIN == 1 || MQTT_FAST_RECONNECT == 1 || MQTT_PUBLISH_DISPATCH == 1 || DEFERRED_SENSOR_INIT == 1 || RAM_HEADROOM_STATISTICS == 1 || PUBLISH_LATENCY_STATS == 1 || ENC28J60_FLOW_CONTROL == 1 || PAGE_BUILD_STATISTICS == 1 || INPUT_PASS_STATISTICS == 1 || HTTP_PACING == 1 || EEPROM_WRITE_CACHE == 1
 #endif // LINK_STATISTICS == 1
 
 
@@ -6415,64 +8826,9 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
         else if ((nParsedMode == 'f') && (nParsedNum == 0)) {
 	  // Display the pin state information in the format used by the "98"
 	  // and "99" command. "99" is the command used in the original
-	  // Network Module.
-	  // For output pins display the state in the pin_control byte.
-	  // For input pins if the Invert bit is set the ON_OFF state needs to
-	  // be inverted before displaying.
-	  // Bits are output for Pin 16 first and Pin 1 last
-	  // If PCF8574 is implemented bits are output for Pin 24 first and
-	  // Pin 1 last.
-	  // If stored_options1 bit 0x10 is set then any Disabled pin must be
-	  // shown as '-'. Otherwise the last known pin state is displayed.
+	  // Network Module. See copy_pin_states().
 	  // %fxx
-
-#if PCF8574_SUPPORT == 0
-	  i = 15;
-#endif // PCF8574_SUPPORT == 0
-#if PCF8574_SUPPORT == 1
-          if (stored_options1 & 0x08) i = 23;
-          else i = 15;
-#endif // PCF8574_SUPPORT == 1
-
-          while( 1 ) {
-	    if (((pin_control[i] & 0x03) == 0x00) && ((stored_options1 & 0x10) == 0x10)) {
-	      // This is a Disabled pin and Option is set to display a '-'
-	      *pBuffer++ = '-';
-	    }
-#if LINKED_SUPPORT == 0
-	    else if (pin_control[i] & 0x02) {
-#endif // LINKED_SUPPORT == 0
-#if LINKED_SUPPORT == 1
-            else if (chk_iotype(pin_control[i], i, 0x03) == 0x03) {
-#endif // LINKED_SUPPORT == 1
-	      // This is an output
-	      if (pin_control[i] & 0x80) {
-	        // Output is ON
-		*pBuffer++ = '1';
-	      }
-	      else {
-	        // Output is OFF
-		*pBuffer++ = '0';
-	      }
-            }
-            else {
-	      // This is an input
-	      if (pin_control[i] & 0x80) {
-	        // Input is ON, invert if needed
-	        if (pin_control[i] & 0x04) *pBuffer = '0';
-	        else *pBuffer = '1';
-                pBuffer++;
-	      }
-	      else {
-		// Input is OFF, invert if needed
-		if (pin_control[i] & 0x04) *pBuffer = '1';
-		else *pBuffer = '0';
-                pBuffer++;
-	      }
-            }
-	    if (i == 0) break;
-	    i--;
-	  }
+	  pBuffer = copy_pin_states(pBuffer);
 	}
 	
 
@@ -7090,6 +9446,12 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 	      pBuffer = stpcpy(pBuffer, "Invalid File Type.......................");
 	    else if (upgrade_failcode == UPGRADE_FAIL_TRUNCATED_FILE)
 	      pBuffer = stpcpy(pBuffer, "Truncated File..........................");
+#if BINARY_UPLOAD_SUPPORT == 1
+	    else if (upgrade_failcode == UPGRADE_FAIL_IMAGE_FORMAT)
+	      pBuffer = stpcpy(pBuffer, "Binary image format incorrect...........");
+	    else if (upgrade_failcode == UPGRADE_FAIL_IMAGE_CRC)
+	      pBuffer = stpcpy(pBuffer, "Binary image CRC error..................");
+#endif // BINARY_UPLOAD_SUPPORT == 1
 	    else
 	      pBuffer = stpcpy(pBuffer, "Unknown Error...........................");
 	  }
@@ -7166,6 +9528,13 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 	  // INA226-1 sensor. Also shows the text fields around that data.
 	  // %txx
 	  
+#if INA226_ALERT_SUPPORT == 1
+	  // Show the measurements collected by ina226_service() when the
+	  // INA226 ALERT pin signalled Conversion Ready.
+	  voltage = ina226_voltage[nParsedNum - 6];
+	  current = ina226_current[nParsedNum - 6];
+	  power = ina226_power[nParsedNum - 6];
+#else // INA226_ALERT_SUPPORT == 0
 	  // Collect data
           // Call ina226_conversion_ready() to determine if a conversion is
           // available to be read.
@@ -7175,12 +9544,20 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
             // voltage, current, power, and shunt_voltage are floats that must
 	    // exist as globals. These are filled with 0 when the call is made
 	    // but are replaced by the ina226_read() function.
-	    if (nParsedNum == 6)  ina226_read_measurements(INA226_1_write, INA226_1_read, 0, 0, 0, 0);
-	    if (nParsedNum == 7)  ina226_read_measurements(INA226_2_write, INA226_2_read, 0, 0, 0, 0);
-	    if (nParsedNum == 8)  ina226_read_measurements(INA226_3_write, INA226_3_read, 0, 0, 0, 0);
-	    if (nParsedNum == 9)  ina226_read_measurements(INA226_4_write, INA226_4_read, 0, 0, 0, 0);
-	    if (nParsedNum == 10) ina226_read_measurements(INA226_5_write, INA226_5_read, 0, 0, 0, 0);
+#if SENSOR_FIXED_POINT == 1
+	    // The fixed point readings are stored directly in the globals.
+	    #define INA226_MEASURES &voltage, &current, &power, 0
+#else // SENSOR_FIXED_POINT == 0
+	    #define INA226_MEASURES 0, 0, 0, 0
+#endif // SENSOR_FIXED_POINT == 1
+	    if (nParsedNum == 6)  ina226_read_measurements(INA226_1_write, INA226_1_read, INA226_MEASURES);
+	    if (nParsedNum == 7)  ina226_read_measurements(INA226_2_write, INA226_2_read, INA226_MEASURES);
+	    if (nParsedNum == 8)  ina226_read_measurements(INA226_3_write, INA226_3_read, INA226_MEASURES);
+	    if (nParsedNum == 9)  ina226_read_measurements(INA226_4_write, INA226_4_read, INA226_MEASURES);
+	    if (nParsedNum == 10) ina226_read_measurements(INA226_5_write, INA226_5_read, INA226_MEASURES);
+	    #undef INA226_MEASURES
 //          }
+#endif // INA226_ALERT_SUPPORT == 1
           pBuffer = show_INA226_CVW_string(pBuffer);
 	}
 #endif // INA226_SUPPORT == 1
@@ -7221,8 +9598,12 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 
 #if BME280_SUPPORT == 1
 	  // Instead of a serial numeber for BME280 output "BME280" instead
-	  // only if the BME280 feature is enabled.
-	  if (nParsedNum == 5 && (stored_config_settings & 0x20)) pBuffer = stpcpy(pBuffer, "BME280------");
+	  // only if the BME280 feature is enabled. adjust_template_size()
+	  // counts 12 characters for this field either way.
+	  if (nParsedNum == 5) {
+	    if (stored_config_settings & 0x20) pBuffer = stpcpy(pBuffer, "BME280------");
+	    else pBuffer = stpcpy(pBuffer, "------------");
+	  }
 #endif // BME280_SUPPORT == 1
 
 #if BME280_SUPPORT == 0
@@ -7354,6 +9735,19 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 	  // for this storage because they are not being used while this code
 	  // is running.
 
+#if HTTP_WEBSOCKET == 1
+	  // The IO Control pages end with the string that also loads the
+	  // WebSocket script (see s8).
+	  if (nParsedNum == PS_IOCONTROL_END
+	   && (pSocket->current_webpage == WEBPAGE_IOCONTROL
+#if PCF8574_SUPPORT == 1
+#if DOMOTICZ_SUPPORT == 0
+	    || pSocket->current_webpage == WEBPAGE_PCF8574_IOCONTROL
+#endif // DOMOTICZ_SUPPORT == 0
+#endif // PCF8574_SUPPORT == 1
+	   )) nParsedNum = 8;
+#endif // HTTP_WEBSOCKET == 1
+
 	  i = pSocket->insertion_index;
 	  pSocket->ParseCmd = nParsedMode;
 	  pSocket->ParseNum = nParsedNum;
@@ -7380,6 +9774,13 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 	// not continuing a string insertion then whatever character we read from
 	// the page template is copied as-is to the uip_buf for transmission.
         *pBuffer = nByte;
+#if HTTP_FUSED_CHKSUM == 1
+        if (pSummed == pBuffer) {
+          if ((uint16_t)(pBuffer - pBuffer_start) & 1) payload_sum_lo += nByte;
+          else payload_sum_hi += nByte;
+          pSummed++;
+        }
+#endif // HTTP_FUSED_CHKSUM == 1
         *ppData = *ppData + 1;
         *pDataLeft = *pDataLeft - 1;
         pBuffer++;
@@ -7397,10 +9798,40 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 	  pre_buf_ptr++;
 	}
 #endif // OB_EEPROM_SUPPORT == 1
+#if HTTP_LITERAL_RUNS == 1
+        if (literal_runs) {
+          // Copy the rest of the literal run, up to the next % marker, the
+	  // end of the template or nMaxBytes. With HTTP_FUSED_CHKSUM these
+	  // bytes are summed at the start of the next pass of the loop.
+          const char* pRun;
+          uint16_t run_max;
+	  uint16_t run;
+          pRun = *ppData;
+          run_max = (uint16_t)(nMaxBytes - (pBuffer - pBuffer_start));
+          if (run_max > *pDataLeft) run_max = *pDataLeft;
+          for (run = 0; run < run_max; run++) {
+            nByte = (uint8_t)pRun[run];
+            if (nByte == '%') break;
+            pBuffer[run] = nByte;
+          }
+          *ppData = *ppData + run;
+          *pDataLeft = *pDataLeft - run;
+          pBuffer += run;
+        }
+#endif // HTTP_LITERAL_RUNS == 1
       }
     }
     else break;
   }
+#if HTTP_FUSED_CHKSUM == 1
+  payload_sum(pBuffer_start, pSummed, pBuffer);
+  uip_payload_chksum(payload_sum_hi, payload_sum_lo, (uint16_t)(pBuffer - pBuffer_start));
+#endif // HTTP_FUSED_CHKSUM == 1
+#if PAGE_BUILD_STATISTICS == 1
+  if (pSocket->current_webpage == WEBPAGE_STATS2) {
+    page_build_run += now_us() - build_start;
+  }
+#endif // PAGE_BUILD_STATISTICS == 1
   return (pBuffer - pBuffer_start);
 }
 
@@ -7433,7 +9864,9 @@ char *show_temperature_string(char *pBuffer, uint8_t nParsedNum)
 char *show_BME280_PTH_string(char *pBuffer)
 {
   int32_t temp_whole;
+#if SENSOR_FIXED_POINT == 0
   int32_t temp_dec;
+#endif // SENSOR_FIXED_POINT == 0
   int32_t temp_F;
   
   pBuffer = stpcpy(pBuffer, "<p>BME280 Sensor<br>");
@@ -7464,6 +9897,10 @@ char *show_BME280_PTH_string(char *pBuffer)
   // Note: Value directly out of the sensor is temperature in Degree C times
   // 100.
   temp_F = (int32_t)((comp_data_temperature * 9) / 5) + 3200;
+#if SENSOR_FIXED_POINT == 1
+  FixedToString(temp_F, 2);
+  pBuffer = stpcpy(pBuffer, OctetArray);   // Display sensor value
+#else // SENSOR_FIXED_POINT == 0
   // Calculate the whole number part of number
   temp_whole = (temp_F / 100);
   // Calculate decimal part of number
@@ -7481,6 +9918,7 @@ char *show_BME280_PTH_string(char *pBuffer)
   pBuffer = stpcpy(pBuffer, ".");          // Insert decimal dot
   emb_itoa((uint32_t)temp_dec, OctetArray, 10, 2);
   pBuffer = stpcpy(pBuffer, OctetArray);   // Display sensor value
+#endif // SENSOR_FIXED_POINT == 1
   #define TEMPTEXT "&#8457;<br>"
   pBuffer = stpcpy(pBuffer, TEMPTEXT);     // Display degress F symbol plus newline
   #undef TEMPTEXT
@@ -7564,7 +10002,11 @@ current = 0.6;
   pBuffer = stpcpy(pBuffer, "Current "); // Copy name to webpage
 //  sprintf(temp, "%3.3f", current);       // Format the string
 //  pBuffer = stpcpy(pBuffer, temp);       // Copy to webpage
+#if SENSOR_FIXED_POINT == 1
+  FixedToString(current, 3);             // Convert mA to string in OctetArray
+#else // SENSOR_FIXED_POINT == 0
   FloatToString(current);                // Convert to string in OctetArray
+#endif // SENSOR_FIXED_POINT == 1
   pBuffer = stpcpy(pBuffer, OctetArray); // Copy to webpage
   pBuffer = stpcpy(pBuffer, " A<br>");   // Copy units to webpage
 
@@ -7577,7 +10019,11 @@ voltage = 12.721;
   pBuffer = stpcpy(pBuffer, "Voltage "); // Copy name to webpage
 //  sprintf(temp, "%3.3f", voltage);       // Format the string
 //  pBuffer = stpcpy(pBuffer, temp);       // Copy to webpage
+#if SENSOR_FIXED_POINT == 1
+  FixedToString(voltage, 3);             // Convert mV to string in OctetArray
+#else // SENSOR_FIXED_POINT == 0
   FloatToString(voltage);                // Convert to string in OctetArray
+#endif // SENSOR_FIXED_POINT == 1
   pBuffer = stpcpy(pBuffer, OctetArray); // Copy to webpage
   pBuffer = stpcpy(pBuffer, " V<br>");   // Copy units to webpage
 
@@ -7590,7 +10036,11 @@ power = 248.92;
   pBuffer = stpcpy(pBuffer, "Wattage "); // Copy name to webpage
 //  sprintf(temp, "%3.3f", power);           // Format the string
 //  pBuffer = stpcpy(pBuffer, temp);       // Copy to webpage
+#if SENSOR_FIXED_POINT == 1
+  FixedToString(power, 3);               // Convert mW to string in OctetArray
+#else // SENSOR_FIXED_POINT == 0
   FloatToString(power);                  // Convert to string in OctetArray
+#endif // SENSOR_FIXED_POINT == 1
   pBuffer = stpcpy(pBuffer, OctetArray); // Copy to webpage
   pBuffer = stpcpy(pBuffer, " W<br>");   // Copy units to webpage
 
@@ -7598,6 +10048,7 @@ power = 248.92;
 }
 
 
+#if SENSOR_FIXED_POINT == 0
 void FloatToString(float fVal)
 {
   // Converts a float value to a string in global OctetArray.
@@ -7605,8 +10056,11 @@ void FloatToString(float fVal)
   // place.
   // Creates the string backwards before copying it character-by-character
   // from the end to the start.
+#if FAST_FORMAT == 0
   char result[8];
-  int16_t dVal, i, j, k;
+  int16_t i, j, k;
+#endif // FAST_FORMAT == 0
+  int16_t dVal;
   int32_t dec;
 
 #if DEBUG_SUPPORT == 15
@@ -7618,9 +10072,15 @@ void FloatToString(float fVal)
                   // round off.
 
   dVal = (int16_t)fVal; // This recast capture the "number" as an int.
+#if FAST_FORMAT == 1
+  // Capture the decimal as three places without the long divide
+  dec = (int32_t)(fVal * 1000) - (int32_t)dVal * 1000;
+  if (dVal > 999) dVal = 999; // Limit to three places.
+#else // FAST_FORMAT == 0
   if (dVal > 999) dVal = 999; // Limit to three places.
   
   dec = (int32_t)(fVal * 1000) % 1000; // Capture the decimal as three places.
+#endif // FAST_FORMAT == 1
 
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("\r\n");
@@ -7630,6 +10090,11 @@ void FloatToString(float fVal)
 // UARTPrintf("\r\n");
 #endif // DEBUG_SUPPORT == 15
 
+#if FAST_FORMAT == 1
+  emb_itoa((uint32_t)dVal, OctetArray, 10, 3);
+  OctetArray[3] = '.';
+  emb_itoa((uint32_t)dec, &OctetArray[4], 10, 3);
+#else // FAST_FORMAT == 0
   // Fill the result varoable with null
   memset(&result[0], 0, 8);
   
@@ -7655,10 +10120,79 @@ void FloatToString(float fVal)
   j = 0;
   memset(&OctetArray[0], 0, 8);
   for (i = k-1; i >= 0; ) OctetArray[j++] = result[i--];
+#endif // FAST_FORMAT == 1
 }
+#endif // SENSOR_FIXED_POINT == 0
 #endif // INA226_SUPPORT == 1
 
 
+#if SENSOR_FIXED_POINT == 1
+#if INA226_SUPPORT == 1 || BME280_SUPPORT == 1
+void FixedToString(int32_t value, uint8_t decimals)
+{
+  // Converts a scaled integer value to a string in global OctetArray.
+  // value is the number times 10 to the power "decimals", for example a
+  // BME280 temperature of 2345 with decimals = 2 is 23.45 degrees, and an
+  // INA226 current of 1200 mA with decimals = 3 is 1.200 A.
+  // The string is a space or minus sign, three whole number digits, a
+  // decimal point, and "decimals" digits. The whole number is limited to 999.
+  uint32_t magnitude;
+#if FAST_FORMAT == 1
+  char digits[11];
+  uint8_t first;
+#else // FAST_FORMAT == 0
+  uint32_t divisor;
+  uint32_t whole;
+#endif // FAST_FORMAT == 1
+  uint8_t i;
+
+#if FAST_FORMAT == 0
+  divisor = 1;
+  for (i = 0; i < decimals; i++) divisor *= 10;
+#endif // FAST_FORMAT == 0
+
+  // Handle negative values
+  if (value < 0) {
+    magnitude = (uint32_t)(-value);
+    OctetArray[0] = '-';
+  }
+  else {
+    magnitude = (uint32_t)value;
+    OctetArray[0] = ' ';
+  }
+
+#if FAST_FORMAT == 1
+  // Convert all 10 digits once and insert the decimal point. digits[first]
+  // is the hundreds digit of the whole number.
+  emb_itoa(magnitude, digits, 10, 10);
+  first = (uint8_t)(7 - decimals);
+  for (i = 0; i < first; i++) {
+    if (digits[i] != '0') break;
+  }
+  if (i < first) {
+    // Limit to three places
+    digits[first] = '9';
+    digits[first + 1] = '9';
+    digits[first + 2] = '9';
+  }
+  OctetArray[1] = digits[first];
+  OctetArray[2] = digits[first + 1];
+  OctetArray[3] = digits[first + 2];
+  OctetArray[4] = '.';
+  memcpy(&OctetArray[5], &digits[10 - decimals], decimals);
+  OctetArray[5 + decimals] = '\0';
+#else // FAST_FORMAT == 0
+  whole = magnitude / divisor;
+  if (whole > 999) whole = 999; // Limit to three places.
+  emb_itoa(whole, &OctetArray[1], 10, 3);
+  OctetArray[4] = '.';
+  emb_itoa(magnitude % divisor, &OctetArray[5], 10, decimals);
+#endif // FAST_FORMAT == 1
+}
+#endif // INA226_SUPPORT == 1 || BME280_SUPPORT == 1
+#endif // SENSOR_FIXED_POINT == 1
+
+
 #if BME280_SUPPORT == 1
 void create_sensor_ID(int8_t sensor)
 {
@@ -7699,11 +10233,19 @@ void create_sensor_ID(int8_t sensor)
 
 
 #if BME280_SUPPORT == 1
+#if SENSOR_STRING_CACHE == 1
+static void format_BME280_temperature_C(void)
+#else // SENSOR_STRING_CACHE == 0
 void BME280_temperature_string_C(void)
+#endif // SENSOR_STRING_CACHE == 1
 {
   // Convert the BME280 temperature into a string in OctetArray.
   // Degrees C is the native output of the sensor.
   
+#if SENSOR_FIXED_POINT == 1
+  // The sensor output is degrees C times 100.
+  FixedToString(comp_data_temperature, 2);
+#else // SENSOR_FIXED_POINT == 0
   int32_t temp_whole;
   int32_t temp_dec;
   char temp_string[11];
@@ -7735,12 +10277,17 @@ void BME280_temperature_string_C(void)
   temp_string[7] = '\0';
   
   strcpy(OctetArray, temp_string);
+#endif // SENSOR_FIXED_POINT == 1
 }
 #endif // BME280_SUPPORT == 1
 
 
 #if BME280_SUPPORT == 1
+#if SENSOR_STRING_CACHE == 1
+static void format_BME280_pressure(void)
+#else // SENSOR_STRING_CACHE == 0
 void BME280_pressure_string(void)
+#endif // SENSOR_STRING_CACHE == 1
 {
   // Convert the BME280 pressure into a string in OctetArray.
   
@@ -7754,7 +10301,11 @@ void BME280_pressure_string(void)
 
 
 #if BME280_SUPPORT == 1
+#if SENSOR_STRING_CACHE == 1
+static void format_BME280_humidity(void)
+#else // SENSOR_STRING_CACHE == 0
 void BME280_humidity_string(void)
+#endif // SENSOR_STRING_CACHE == 1
 {
   // Convert the BME280 humidity into a string in OctetArray.
   
@@ -7767,6 +10318,50 @@ void BME280_humidity_string(void)
 #endif // BME280_SUPPORT == 1
 
 
+#if BME280_SUPPORT == 1 && SENSOR_STRING_CACHE == 1
+static void BME280_strings_update(void)
+{
+  // Formats the BME280 temperature, pressure and humidity strings once per
+  // reading, the first time one of them is needed. The web pages and the
+  // MQTT publishes then copy the same strings until the next reading.
+  if (BME280_string_generation != BME280_generation
+   || BME280_string[0][0] == '\0') {
+    format_BME280_temperature_C();
+    strcpy(BME280_string[0], OctetArray);
+    format_BME280_pressure();
+    strcpy(BME280_string[1], OctetArray);
+    format_BME280_humidity();
+    strcpy(BME280_string[2], OctetArray);
+    BME280_string_generation = BME280_generation;
+  }
+}
+
+
+void BME280_temperature_string_C(void)
+{
+  // Leaves the BME280 temperature string (degrees C) in OctetArray
+  BME280_strings_update();
+  strcpy(OctetArray, BME280_string[0]);
+}
+
+
+void BME280_pressure_string(void)
+{
+  // Leaves the BME280 pressure string (hPa) in OctetArray
+  BME280_strings_update();
+  strcpy(OctetArray, BME280_string[1]);
+}
+
+
+void BME280_humidity_string(void)
+{
+  // Leaves the BME280 humidity string (percent) in OctetArray
+  BME280_strings_update();
+  strcpy(OctetArray, BME280_string[2]);
+}
+#endif // BME280_SUPPORT == 1 && SENSOR_STRING_CACHE == 1
+
+
 #if BME280_SUPPORT == 1
 char *show_space_or_minus(int32_t value, char *pBuffer)
 {
@@ -7784,20 +10379,111 @@ void HttpDInit(void)
   int i;
   register struct uip_conn *uip_connr = uip_conn;
   
+#if HTTPD_STATE_POOL == 1
+  // The struct tHttpD values are initialized when a pool entry is assigned
+  // to a connection
+  for (i = 0; i < HTTPD_POOL_SIZE; i++) {
+    httpd_pool_owner[i] = 0xff;
+  }
+#else
   // Initialize the struct tHttpD values
   for (i = 0; i < UIP_CONNS; i++) {
     uip_connr = &uip_conns[i];
     init_tHttpD_struct(&uip_connr->appstate.HttpDSocket, i);
   }
+#endif // HTTPD_STATE_POOL == 1
   
   // Initialize storage for the GET command
   parse_GETcmd[0] = '\0';
+#if HTTP_GET_QUEUE == 0
+#if GZIP_STATIC_SUPPORT == 1
+  gzip_accepted = 0;
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_ETAG_SUPPORT == 1
+  etag_matched = 0;
+#endif // HTTP_ETAG_SUPPORT == 1
+#endif // HTTP_GET_QUEUE == 0
+
+#if HTTP_SIZE_CACHE == 1
+  httpd_page_size_invalidate();
+#endif // HTTP_SIZE_CACHE == 1
+
+#if HTTP_ETAG_SUPPORT == 1
+  httpd_page_version_bump();
+#endif // HTTP_ETAG_SUPPORT == 1
+
+#if OB_TEMPLATE_CACHE == 1
+  pre_buf_base = 0xffff;
+#endif // OB_TEMPLATE_CACHE == 1
+
+#if RAW_UPLOAD_SUPPORT == 1
+  // Listen for raw TCP uploads
+  raw_upload_conn = NULL;
+  uip_listen(htons(RAW_UPLOAD_PORT));
+#endif // RAW_UPLOAD_SUPPORT == 1
+
+#if MODBUS_TCP_SUPPORT == 1
+  // Listen for Modbus TCP pollers
+  modbus_conn = NULL;
+  uip_listen(htons(MODBUS_TCP_PORT));
+#endif // MODBUS_TCP_SUPPORT == 1
 
   // Start listening on our port
   uip_listen(htons(Port_Httpd));
 }
 
 
+#if HTTPD_STATE_POOL == 1
+struct tHttpD* httpd_get_state(void)
+{
+  // Returns the struct tHttpD assigned to uip_conn, or NULL if there is none.
+  // On uip_connected() a pool entry is assigned. An entry is free if its
+  // owner connection is no longer ESTABLISHED on the HTTP port, so entries
+  // are recovered however the owner connection ended.
+  uint8_t i;
+  uint8_t j;
+  uint8_t owner;
+
+  owner = (uint8_t)(uip_conn - uip_conns);
+
+  if (uip_connected()) {
+    // Release any entry left over from the previous use of this connection
+    for (i = 0; i < HTTPD_POOL_SIZE; i++) {
+      if (httpd_pool_owner[i] == owner) httpd_pool_owner[i] = 0xff;
+    }
+    for (i = 0; i < HTTPD_POOL_SIZE; i++) {
+      j = httpd_pool_owner[i];
+      if (j == 0xff
+       || (uip_conns[j].tcpstateflags & UIP_TS_MASK) != UIP_ESTABLISHED
+       || uip_conns[j].lport != htons(Port_Httpd)) {
+        httpd_pool_owner[i] = owner;
+        uip_conn->appstate.HttpDSlot = i;
+        init_tHttpD_struct(&httpd_pool[i], i);
+        return &httpd_pool[i];
+      }
+    }
+    return NULL;
+  }
+
+  i = uip_conn->appstate.HttpDSlot;
+  if (i < HTTPD_POOL_SIZE && httpd_pool_owner[i] == owner) return &httpd_pool[i];
+  return NULL;
+}
+#endif // HTTPD_STATE_POOL == 1
+
+
+#if PERIODIC_WORK_FLAGS == 1
+uint8_t httpd_busy(struct tHttpD* pSocket)
+{
+  // Returns 1 if the connection is receiving a request or sending a reply.
+  // Idle connections (no request yet, or the reply is complete) return 0 and
+  // are left out of the periodic polls.
+  if (pSocket->nState == STATE_NULL || pSocket->nState == STATE_CONNECTED) return 0;
+  return 1;
+}
+#endif // PERIODIC_WORK_FLAGS == 1
+
+
 void init_tHttpD_struct(struct tHttpD* pSocket, int i) {
   // Initialize the contents of the struct tHttpD
   // This function is called UIP_CONNS times by the HttpDinit function. It is
@@ -7838,20 +10524,56 @@ void init_tHttpD_struct(struct tHttpD* pSocket, int i) {
   pSocket->ParseState = PARSE_NULL;
   pSocket->nNewlines = 0;
   pSocket->insertion_index = 0;
+#if HTTP_KEEPALIVE == 1
+  pSocket->nKeepAlive = 0;
+#endif // HTTP_KEEPALIVE == 1
+#if HTTP_GET_QUEUE == 1
+#if GZIP_STATIC_SUPPORT == 1
+  pSocket->nGzipAccepted = 0;
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_ETAG_SUPPORT == 1
+  pSocket->nEtagMatched = 0;
+#endif // HTTP_ETAG_SUPPORT == 1
+  pSocket->GETcmd[0] = '\0';
+#endif // HTTP_GET_QUEUE == 1
 // #if OB_EEPROM_SUPPORT == 1
 //   init_off_board_string_pointers(pSocket);
 // #endif // OB_EEPROM_SUPPORT == 1
 }
 
 
+#if GZIP_STATIC_SUPPORT == 1 || HTTP_KEEPALIVE == 1 || HTTP_ETAG_SUPPORT == 1 || HTTP_WEBSOCKET == 1
+static uint8_t header_match(uint8_t c, const char* word, uint8_t* pMatch)
+{
+  // Matches the GET request header characters one at a time against the
+  // lower case word. *pMatch counts the characters matched so far so that
+  // the search can continue in the next TCP Fragment. Returns 1 when the
+  // whole word is matched.
+  if (c >= 'A' && c <= 'Z') c = (uint8_t)(c + 32);
+  if (c == (uint8_t)word[*pMatch]) {
+    (*pMatch)++;
+    if (word[*pMatch] == '\0') {
+      *pMatch = 0;
+      return 1;
+    }
+  }
+  else if (c == (uint8_t)word[0]) *pMatch = 1;
+  else *pMatch = 0;
+  return 0;
+}
+#endif // GZIP_STATIC_SUPPORT == 1 || HTTP_KEEPALIVE == 1 || HTTP_ETAG_SUPPORT == 1 || HTTP_WEBSOCKET == 1
+
+
 void HttpDCall(uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
 {
   uint16_t nBufSize;
   int i;
   uint8_t j;
+#if HTTP_PACING == 1
+  uint32_t build_start;
+#endif // HTTP_PACING == 1
   char compare_buf[32];
   uint8_t GET_response_type = 200;
-  uint32_t parse_file_time_start;
   
   // HttpDCall() is used to:
   // a) Receive a request or data from the Browser:
@@ -7874,6 +10596,32 @@ void HttpDCall(uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket)
 
   i = 0;
   j = 0;
+#if HTTP_KEEPALIVE == 1
+  header_keepalive = pSocket->nKeepAlive;
+#endif // HTTP_KEEPALIVE == 1
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+  if (pSocket->nState == STATE_PARSESNAPSHOT) {
+    // If a settings snapshot POST is cut short, or stalls for more than 10
+    // seconds, the Pending values it changed are put back so that a later
+    // Save does not apply part of the snapshot.
+    if (uip_closed() || uip_aborted() || uip_timedout()
+     || (uip_poll() && (uint32_t)(second_counter - snapshot_start) > 10)) {
+      snapshot_abort();
+      pSocket->nState = STATE_NULL;
+      if (uip_poll()) uip_abort();
+      return;
+    }
+  }
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
+#if HTTP_WEBSOCKET == 1
+  if (pSocket->nState == STATE_WEBSOCKET) {
+    // After the upgrade every event on the connection is WebSocket traffic
+    ws_call(pSocket, pBuffer, nBytes);
+    return;
+  }
+#endif // HTTP_WEBSOCKET == 1
 
   if (uip_connected()) {
     // uip_connected() will occur when a connection is established after being
@@ -8067,6 +10815,16 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 // THE CODE THAT A CONNECTION WAS ESTABLISHED AS WE SHOULD START INTERPRETING
 // THE TRANSMISSION RECEIVED FROM THE BROWSER.
     pSocket->nState = STATE_CONNECTED;
+#if HTTP_MULTI_SEGMENT == 1
+    pSocket->nPrevBytes2 = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
+#if HTTP_KEEPALIVE == 1
+    pSocket->nKeepAlive = 0;
+    pSocket->nIdleStart = (uint16_t)second_counter;
+#endif // HTTP_KEEPALIVE == 1
+#if HTTP_PACING == 1
+    pSocket->nHeld = 0;
+#endif // HTTP_PACING == 1
     
 
 // I DON'T THINK THIS NEXT STEP IS NEEDED. IT LOOKS LIKE THIS IS ALREADY DONE
@@ -8096,6 +10854,13 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
     // STATE_SENDDATA several times. Note that GET or POST processing has
     // already sent the TCP HEADER, and uip_acked() indicates an acknowledge
     // from the Browser such that more data can be sent to the Browser.
+
+#if HTTP_MULTI_SEGMENT == 1
+    // If only the first of two segments in flight was acknowledged the
+    // second segment is now the first segment.
+    if (uip_conn->len != 0) pSocket->nPrevBytes = pSocket->nPrevBytes2;
+    pSocket->nPrevBytes2 = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
     
     goto senddata;
   }
@@ -8195,9 +10960,27 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
     // If we are in STATE_CONNECTED (meaning we are reading the first and
     // perhaps only packet in a series) check the first five characters of the
     // uip_buf to see if this is a POST or GET request.
+#if HTTP_KEEPALIVE == 1
+    // With HTTP_KEEPALIVE a connection returns here to read the next
+    // request when the last segment of a response is acknowledged by a
+    // packet that also carries the next request.
+    newdata:
+#endif // HTTP_KEEPALIVE == 1
     if (pSocket->nState == STATE_CONNECTED) {
+#if HTTP_KEEPALIVE == 1
+      // The connection is kept open only if the GET headers ask for it
+      pSocket->nKeepAlive = 0;
+      header_keepalive = 0;
+#endif // HTTP_KEEPALIVE == 1
       if (memcmp("POST", &pBuffer[0], 4) == 0) pSocket->nState = STATE_GOTPOST;
       if (memcmp("GET", &pBuffer[0], 3) == 0)  pSocket->nState = STATE_GOTGET;
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+      // A POST to /b4 carries a settings snapshot instead of form data
+      if (pSocket->nState == STATE_GOTPOST) {
+        pSocket->current_webpage = WEBPAGE_NULL;
+        if (memcmp(" /b4", &pBuffer[4], 4) == 0) pSocket->current_webpage = WEBPAGE_SNAPSHOT;
+      }
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
       pBuffer += 4;
       nBytes -= 4;
       // We are collecting the first packet. Clear parse_tail so it will be
@@ -8261,6 +11044,16 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 	  // Clear nNewlines for future POSTs
 	  pSocket->nNewlines = 0;
 	  
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+	  if (pSocket->current_webpage == WEBPAGE_SNAPSHOT) {
+	    // The body is a binary settings snapshot
+	    snapshot_import_init();
+	    pSocket->nState = STATE_PARSESNAPSHOT;
+	    if (nBytes == 0) return;
+	    break;
+	  }
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
           // Set current_webpage to NULL. This will be used later to aid in
 	  // determining if the POST is coming from an IOControl POST or from
 	  // a Configuration POST.
@@ -8395,18 +11188,7 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 
 	  // Beginning of a data file found.
 	  // Initialize parsing variables.
-          byte_index = 0;
-          parse_index = 0;
-          eeprom_address_index = I2C_EEPROM0_BASE;
-          parse_tail[0] = '\0';
-          byte_tail[0] = '\0';
-          byte_tail[1] = '\0';
-          line_count = 0;
-          checksum = 0;
-          upgrade_failcode = UPGRADE_OK;
-	  non_sequential_detect = 0;
-	  SREC_start = 1;
-          search_limit = 0;
+          upload_init();
 	  for (i=0; i<30; i++) {
 	    // Initialize the search compare buffer
 	    compare_buf[i] = 'z';
@@ -8438,6 +11220,7 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 
 
 
+#if HTTP_GET_QUEUE == 0
     if (pSocket->nState == STATE_GOTGET && parse_GETcmd[0] != '\0') {
       // If we are in state GOTGET but we are already processing a GET Request
       // we need to throw away the new request and return a 429 response.
@@ -8447,6 +11230,13 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 
 
     if (pSocket->nState == STATE_GOTGET && parse_GETcmd[0] == '\0') {
+#endif // HTTP_GET_QUEUE == 0
+#if HTTP_GET_QUEUE == 1
+    if (pSocket->nState == STATE_GOTGET) {
+      // Each connection captures its GET cmd in its own GETcmd[], so GET
+      // requests from several Browsers arriving at the same time are all
+      // accepted. They are parsed in the order their headers complete.
+#endif // HTTP_GET_QUEUE == 1
       // The GET request is processed only if no GET request is already being
       // processed (as indicated by NULL in the first character of the
       // parse_GETcmd).
@@ -8459,13 +11249,39 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
       // is one of the /50 /51 /52 commands like "/51mmmmpppp". That command
       // type is 11 characters long and will completely fill parse_GETcmd[].
       for (i = 0; i < 11; i++) {
+#if HTTP_GET_QUEUE == 0
         parse_GETcmd[i] = *pBuffer;
+#endif // HTTP_GET_QUEUE == 0
+#if HTTP_GET_QUEUE == 1
+        pSocket->GETcmd[i] = *pBuffer;
+#endif // HTTP_GET_QUEUE == 1
         pBuffer++;
       }
       // Reset pBuffer back to the end of the "GET " indentifier so that the
       // search performed in STATE_GOTGET2 will work properly. nBytes is
       // already set properly for that location.
       pBuffer -= 11;
+#if GZIP_STATIC_SUPPORT == 1
+      // Start the search for "gzip" in the request headers
+      GZIP_MATCH(pSocket) = 0;
+      GZIP_ACCEPTED(pSocket) = 0;
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_KEEPALIVE == 1
+      // Start the search for "keep-alive" in the request headers
+      KEEPALIVE_MATCH(pSocket) = 0;
+#endif // HTTP_KEEPALIVE == 1
+#if HTTP_WEBSOCKET == 1
+      // Start the search for the Sec-WebSocket-Key header
+      pSocket->nWsKeyMatch = 0;
+      pSocket->nWsKeyLen = 0;
+#endif // HTTP_WEBSOCKET == 1
+#if HTTP_ETAG_SUPPORT == 1
+      // Start the search for the current ETag in the request headers (it
+      // will be in the If-None-Match header)
+      etag_build();
+      ETAG_MATCH(pSocket) = 0;
+      ETAG_MATCHED(pSocket) = 0;
+#endif // HTTP_ETAG_SUPPORT == 1
       pSocket->nState = STATE_GOTGET2;
     }
 
@@ -8509,6 +11325,42 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 	  }
           else if (*pBuffer == '\r') { }
           else pSocket->nNewlines = 0;
+#if GZIP_STATIC_SUPPORT == 1
+          // Look for "gzip" in the headers (it will be in the Accept-
+	  // Encoding header). The match count is global so that the search
+	  // can continue in the next fragment.
+          if (header_match(*pBuffer, "gzip", &GZIP_MATCH(pSocket))) {
+            GZIP_ACCEPTED(pSocket) = 1;
+          }
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_KEEPALIVE == 1
+          // Look for "keep-alive" in the headers (it will be in the
+	  // Connection header).
+          if (header_match(*pBuffer, "keep-alive", &KEEPALIVE_MATCH(pSocket))) {
+            pSocket->nKeepAlive = 1;
+            header_keepalive = 1;
+          }
+#endif // HTTP_KEEPALIVE == 1
+#if HTTP_ETAG_SUPPORT == 1
+          if (header_match(*pBuffer, page_etag, &ETAG_MATCH(pSocket))) {
+            ETAG_MATCHED(pSocket) = 1;
+          }
+#endif // HTTP_ETAG_SUPPORT == 1
+#if HTTP_WEBSOCKET == 1
+          // Collect the Sec-WebSocket-Key value in ws_key[]. Bit 0x80 of
+	  // nWsKeyLen is set while the value is being collected. A valid key
+	  // is 24 characters.
+          if (pSocket->nWsKeyLen & 0x80) {
+            if (*pBuffer == '\r' || *pBuffer == '\n') pSocket->nWsKeyLen &= 0x7f;
+            else if (*pBuffer != ' ') {
+              if (pSocket->nWsKeyLen < (0x80 + 24)) ws_key[pSocket->nWsKeyLen & 0x7f] = (char)*pBuffer;
+              if (pSocket->nWsKeyLen < (0x80 + 25)) pSocket->nWsKeyLen++;
+            }
+          }
+          else if (header_match(*pBuffer, "sec-websocket-key:", &pSocket->nWsKeyMatch)) {
+            pSocket->nWsKeyLen = 0x80;
+          }
+#endif // HTTP_WEBSOCKET == 1
           pBuffer++;
           nBytes--;
           if (pSocket->nNewlines != 2 && nBytes == 0) {
@@ -8548,1014 +11400,1561 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
     }
 
 
-#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
-    if (pSocket->nState == STATE_PARSEPOST) {
-      // Once STATE_PARSEPOST is entered we remain in that state until the
-      // entire POST is received and processed. So this loop could be
-      // repeated, repeating the call to parsepost(), until all packets are
-      // received and parsed. Once all POST data is received the parsepost()
-      // function will set pSocket->nState = STATE_SENDHEADER204 to end the
-      // process.
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+    if (pSocket->nState == STATE_PARSEPOST) {
+      // Once STATE_PARSEPOST is entered we remain in that state until the
+      // entire POST is received and processed. So this loop could be
+      // repeated, repeating the call to parsepost(), until all packets are
+      // received and parsed. Once all POST data is received the parsepost()
+      // function will set pSocket->nState = STATE_SENDHEADER204 to end the
+      // process.
+
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("\r\n");
+// UARTPrintf("Calling STATE_PARSEPOST. nBytes = ");
+// emb_itoa(nBytes, OctetArray, 10, 3);
+// UARTPrintf(OctetArray);
+// UARTPrintf("\r\n");
+#endif // DEBUG_SUPPORT == 15
+
+      // Parse data the user entered in the GUI.
+      parsepost(pSocket, pBuffer, nBytes);
+    }
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+    if (pSocket->nState == STATE_PARSESNAPSHOT) {
+      // Collect a POSTed settings snapshot. snapshot_import() sets
+      // STATE_SENDHEADER204 or STATE_SENDHEADER400 when it is complete.
+      snapshot_import(pSocket, pBuffer, nBytes);
+    }
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
+
+    if (pSocket->nState == STATE_PARSEGET) {
+      // Parse the GET command and identify the webpage to be copied to the
+      // body of the GET response.
+      // Once STATE_PARSEGET is entered we remain in that state until the
+      // entire GET is received and processed. So this loop could be
+      // repeated, repeating the call to parseget(), until all packets are
+      // received and parsed. Once all GET data is received the parseget()
+      // function will set pSocket->nState = STATE_SENDHEADER200 (or 204) to
+      // end the process.
+#if HTTP_GET_QUEUE == 1
+      // parseget() completes in this call, so the shared parse_GETcmd can
+      // hold this connection's GET cmd while it runs.
+      memcpy(parse_GETcmd, pSocket->GETcmd, sizeof(parse_GETcmd));
+#endif // HTTP_GET_QUEUE == 1
+      parseget(pSocket, pBuffer);
+#if HTTP_WEBSOCKET == 1
+      if (pSocket->nState == STATE_WEBSOCKET) {
+        // Send the handshake reply
+        ws_call(pSocket, pBuffer, 0);
+        return;
+      }
+#endif // HTTP_WEBSOCKET == 1
+    }
+
+
+
+
+
+
+
+    
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+    if (pSocket->nState == STATE_PARSEFILE) {
+      // This step is entered if a POST containing a firmware file was
+      // detected.
+      parsefile(pSocket, pBuffer, nBytes, compare_buf);
+    }
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+
+
+
+
+
+
+
+
+
+#if HTTP_LONG_POLL == 1
+sendheader200:
+#endif // HTTP_LONG_POLL == 1
+    if (pSocket->nState == STATE_SENDHEADER200) {
+      // This step is entered after HTTP request processing is complete in
+      // order to copy an appropriate web page into the body of the reply
+      // to the request.
+      // This step is entered after:
+      //   a) GET processing is complete and a webpage is to be displayed in
+      //      response to the GET.
+      //   b) The Code Uploader has completed processing a file upload.
+      //      Various webpages can be displayed depending on the error status
+      //      of the file upload.
+      // In the uip_send() call we provide the CopyHttpHeader function with
+      // the length of the web page.
+      // Some GET requests do not send a webpage response (just a 200 header
+      // with Content-Length = 0). In those cases STATE_SENDHEADER204 will
+      // have been entered from GET processing (see below).
+      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, adjust_template_size(pSocket), page_header_type(pSocket)));
+      pSocket->nState = STATE_SENDDATA;
+#if HTTP_SPLIT_OUTPUT == 1
+      page_load_start = ms_counter;
+      page_load_timing = 1;
+#endif // HTTP_SPLIT_OUTPUT == 1
+      return;
+    }
+      
+    if (pSocket->nState == STATE_SENDHEADER204) {
+      // This step is entered after HTTP request processing is complete in
+      // in order to copy an "empty" web page into the body of the reply to
+      // the request.
+      // This step is entered after:
+      //   a) POST is complete.
+      //      OR
+      //   b) GET processing is complete and no webpage is to be displayed in
+      //      response to the GET.
+      // In both of these cases we only copy a header with Content_Length: 0
+      // and no data into the body of the reply to the GET or POST.
+      //
+      // Note: In this application a POST is only generated by a IOControl or
+      // Configuration page. STATE_SENDHEADER204 will copy the 200 header into
+      // the body of the reply to the POST with Content-Length = 0. Also note
+      // that the javascript in the IOControl and Configurationose pages will
+      // generate a GET request to update the Browser after the POST is
+      // complete.
+      //
+      // Note: It is not clear if some browsers require a "204 No Content"
+      // header. This appears to work just returning a "200 OK" with Content
+      // Length: 0, which is what actually happens in this application.
+
+#if RESPONSE_LOCK_SUPPORT == 1
+      // A special case when SENDHEADER_204 is requested is the case where the
+      // Response Lock is turned on. In this case we don't want to send
+      // anyting at all, not even the header. This makes it appear that the
+      // webserver does not exist, helping to make the device a little more
+      // secure.
+      if ((stored_options1 & 0x40) == 0x40) {
+        pSocket->nDataLeft = 0;
+        pSocket->nState = STATE_NULL;
+      }
+#endif // RESPONSE_LOCK_SUPPORT == 1
+
+#if RESPONSE_LOCK_SUPPORT == 1
+      else {
+#endif // RESPONSE_LOCK_SUPPORT == 1
+      // Send a 200 response with length 0
+      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, 0, HEADER200));
+      // Clear nDataLeft and go to STATE_SENDDATA, but only to close
+      // connection.
+      pSocket->nDataLeft = 0;
+      pSocket->nState = STATE_SENDDATA;
+#if RESPONSE_LOCK_SUPPORT == 1
+      }
+#endif // RESPONSE_LOCK_SUPPORT == 1
+      return;
+    }
+    
+    if (pSocket->nState == STATE_SENDHEADER429) {
+      // This is a special case where two GET requests have arrived in
+      // parallel from two different Browsers (or Tabs). We can only allow one
+      // at a time, so the second arrival is rejected with a 429 response.
+      // The 429 response has no webpage response (just a 429 header with
+      // Content-Length = 0 and Retry-After set to 10 seconds).
+      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, 0, HEADER429));
+      pSocket->nState = STATE_SENDDATA;
+      return;
+    }
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1 || HTTP_WEBSOCKET == 1
+    if (pSocket->nState == STATE_SENDHEADER400) {
+      // A POSTed settings snapshot or a WebSocket upgrade was rejected. The
+      // 400 response has no body.
+      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, 0, HEADER400));
+      pSocket->nDataLeft = 0;
+      pSocket->nState = STATE_SENDDATA;
+      return;
+    }
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1 || HTTP_WEBSOCKET == 1
+      
+
+    senddata:
+    if (pSocket->nState == STATE_SENDDATA) {
+      // We have sent the HTML Header or HTML Data previously. Now we send
+      // data using the CopyHttpData() function as a pre-processor, and the
+      // uip_send() function to actually copy data from the internal buffer
+      // to the ENC28J60 hardware.
+      // Data is always sent at the end of a "uip_newdata()" as a response to
+      // a Browser request.
+      // When transmitting data to the Browser there may be more data than
+      // will fit in one packet. For instance transmitting one of the Webpage
+      // templates can easily take 10 or more transmit packets. So, additional
+      // data (if any) will be sent on return to this function in response to
+      // "uip_acked()". Whether or not there is additional data to send in a
+      // series of packets is tracked in the nDataLeft variable.
+      // If there is no data to send, or if all data has been sent, we close
+      // the connection.
+      if (pSocket->nDataLeft == 0) {
+        // There is no data to send. Close connection
+        nBufSize = 0;
+      }
+      else {
+#if HTTP_PACING == 1
+        // Give way to MQTT sends. A held segment is sent from a later
+        // uip_poll() (see below).
+        if (http_pacing_hold()) {
+          if (pSocket->nHeld == 0) {
+            pSocket->nHeld = 1;
+            pSocket->nHoldStart = ms_counter;
+            return;
+          }
+          if ((uint16_t)(ms_counter - pSocket->nHoldStart) < PACING_MAX_HOLD) return;
+        }
+        if (pSocket->nHeld) {
+          pSocket->nHeld = 0;
+          pacing_record(PACING_HTTP, (uint16_t)(ms_counter - pSocket->nHoldStart));
+        }
+        build_start = now_us();
+#endif // HTTP_PACING == 1
+#if HTTP_MULTI_SEGMENT == 1
+        if (uip_conn->len != 0) {
+          // A segment is still in flight, so this data goes in the second
+	  // segment.
+          pSocket->nPrevBytes2 = pSocket->nDataLeft;
+          nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss(), pSocket);
+          pSocket->nPrevBytes2 -= pSocket->nDataLeft;
+        }
+        else {
+#endif // HTTP_MULTI_SEGMENT == 1
+        // Copy data to buffer
+        pSocket->nPrevBytes = pSocket->nDataLeft;
+        nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss(), pSocket);
+        pSocket->nPrevBytes -= pSocket->nDataLeft;
+#if HTTP_MULTI_SEGMENT == 1
+        }
+#endif // HTTP_MULTI_SEGMENT == 1
+#if HTTP_PACING == 1
+        http_pacing_spent(now_us() - build_start);
+#endif // HTTP_PACING == 1
+      }
+
+      if (nBufSize == 0) {
+        //No Data has been copied (or there was none to send). Close connection
+#if HTTP_MULTI_SEGMENT == 1
+        // ... but only once every segment in flight is acknowledged.
+        if (uip_conn->len == 0) {
+#endif // HTTP_MULTI_SEGMENT == 1
+#if HTTP_SPLIT_OUTPUT == 1
+        if (page_load_timing) {
+          page_load_time = (uint16_t)(ms_counter - page_load_start);
+          page_load_timing = 0;
+        }
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if HTTP_KEEPALIVE == 1
+        if (pSocket->nKeepAlive) {
+          // The response is complete. Keep the connection open and wait
+	  // for the next request. If the acknowledge came with the next
+	  // request go read it now.
+          pSocket->nState = STATE_CONNECTED;
+          pSocket->nIdleStart = (uint16_t)second_counter;
+          if (uip_acked() && uip_newdata()) goto newdata;
+        }
+        else
+#endif // HTTP_KEEPALIVE == 1
+        uip_close();
+#if HTTP_MULTI_SEGMENT == 1
+        }
+#endif // HTTP_MULTI_SEGMENT == 1
+      }
+      else {
+        //Else send copied data
+        uip_send(uip_appdata, nBufSize);
+      }
+      
+      return;
+    }
+  }
+
+#if HTTP_MULTI_SEGMENT == 1
+  else if (uip_poll() && uip_sendmore) {
+    // The UIP code asks for a second segment while the first segment is in
+    // flight. This continues the page transmission the same way an
+    // acknowledge does.
+    goto senddata;
+  }
+#endif // HTTP_MULTI_SEGMENT == 1
+
+#if HTTP_PACING == 1
+  else if (uip_poll() && pSocket->nState == STATE_SENDDATA && pSocket->nHeld) {
+    // The next segment was held back by http_pacing_hold(). Nothing is in
+    // flight (uIP only polls a connection without outstanding data), so
+    // try again the same way an acknowledge does.
+    goto senddata;
+  }
+#endif // HTTP_PACING == 1
+
+#if HTTP_KEEPALIVE == 1
+  else if (uip_poll() && pSocket->nState == STATE_CONNECTED) {
+    // Close a connection that has waited HTTP_KEEPALIVE_TIMEOUT seconds
+    // for a request.
+    if ((uint16_t)((uint16_t)second_counter - pSocket->nIdleStart) >= HTTP_KEEPALIVE_TIMEOUT) {
+      uip_close();
+    }
+  }
+#endif // HTTP_KEEPALIVE == 1
+
+#if HTTP_LONG_POLL == 1
+  else if (uip_poll() && pSocket->nState == STATE_WAITEVENT) {
+    // A /b3 request is waiting for a pin change. When ON_OFF_word differs
+    // from the value captured with the request (or the wait times out) the
+    // Very Short IO state response is sent the same way a /98 response is.
+    if (pSocket->nEventPins != ON_OFF_word
+     || (uint16_t)((uint16_t)second_counter - pSocket->nEventStart) >= HTTP_LONG_POLL_TIMEOUT) {
+      pSocket->current_webpage = WEBPAGE_SSTATE;
+      pSocket->pData = g_HtmlPageSstate;
+      pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageSstate) - 1);
+      pSocket->nPrevBytes = 0xFFFF;
+      pSocket->nState = STATE_SENDHEADER200;
+      goto sendheader200;
+    }
+  }
+#endif // HTTP_LONG_POLL == 1
+  
+  else if (uip_rexmit()) {
+
+#if DEBUG_SUPPORT == 15
+// Debug notes:
+// This debug needs to be kept for looking into problems with delays in
+// browser updates and browser lockups.
+if (rexmit_count == 0) UARTPrintf("\r\n");
+rexmit_count++;
+UARTPrintf("Re-xmit count = ");
+emb_itoa(rexmit_count, OctetArray, 10, 5);
+UARTPrintf(OctetArray);
+UARTPrintf("\r\n");
+#endif // DEBUG_SUPPORT == 15
+
+#if HTTP_MULTI_SEGMENT == 1
+    // Step back over the data of the second segment in flight (if any). If
+    // the second segment is being retransmitted it is rebuilt here. If the
+    // first segment is being retransmitted the second segment is rebuilt
+    // in the UIP_SENDMORE call that follows.
+    pSocket->pData -= pSocket->nPrevBytes2;
+#if OB_EEPROM_SUPPORT == 1
+    off_board_eeprom_index -= pSocket->nPrevBytes2;
+#endif // OB_EEPROM_SUPPORT == 1
+    pSocket->nDataLeft += pSocket->nPrevBytes2;
+    pSocket->nPrevBytes2 = 0;
+    if (uip_sendmore) {
+      pSocket->nPrevBytes2 = pSocket->nDataLeft;
+      nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss(), pSocket);
+      pSocket->nPrevBytes2 -= pSocket->nDataLeft;
+      uip_send(uip_appdata, nBufSize);
+      return;
+    }
+#endif // HTTP_MULTI_SEGMENT == 1
+
+    if (pSocket->nPrevBytes == 0xFFFF) {
+      // Send header again
+      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, adjust_template_size(pSocket), page_header_type(pSocket)));
+    }
+    else {
+      // The pData pointer needs to be moved back by the number of bytes
+      // consumed from the webpage template.
+      pSocket->pData -= pSocket->nPrevBytes;
+      
+#if OB_EEPROM_SUPPORT == 1
+      // A similar adjustment is required for off_board_eeprom_index when
+      // the webpage is sourced from I2C EEPROM.
+      off_board_eeprom_index -= pSocket->nPrevBytes;
+#endif // OB_EEPROM_SUPPORT == 1
+      
+      pSocket->nDataLeft += pSocket->nPrevBytes;
+      pSocket->nPrevBytes = pSocket->nDataLeft;
+      nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss(), pSocket);
+      pSocket->nPrevBytes -= pSocket->nDataLeft;
+      
+      if (nBufSize == 0) {
+        //No Data has been copied. Close connection
+        uip_close();
+      }
+      else {
+        //Else send copied data
+        uip_send(uip_appdata, nBufSize);
+      }
+    }
+    return;
+  }
+}
+
+
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+void parsefile(struct tHttpD* pSocket, uint8_t* pBuffer, uint16_t nBytes, char *compare_buf) {
+  // compare_buf is the search buffer of HttpDCall(), which was initialized
+  // when the upload POST was found.
+  int i;
+  uint32_t parse_file_time_start;
+  
+  // This step is entered if a POST containing a firmware file was
+  // detected. The file contents will be copied to the I2C EEPROM,
+  // then the I2C EEPROM will be copied to the internal Flash, then
+  // the device will reboot.
+  //
+  // Some notes:
+  // - This application normally parses POST files providing user data
+  //   entries in a Browser session. As such, the size of the data is
+  //   easily less than 65536 characters, thus the nParseLeft variable
+  //   used in normal parsing is a uint16_t type.
+  // - When a SREC file is attached to a POST the datagram can be 1024
+  //   lines x 78 bytes = 79872 characters PLUS some other overhead like
+  //   S0 and S7 records, and some miscellaneous records (partial data,
+  //   0x4000 addresses, etc).
+  //   So nParseLeft cannot be used in receiving the SREC
+  //   file other than as a flag to indicate that parsing is complete.
+  //   Instead the SREC file parser searches for a SREC S7 record to find
+  //   the end of the data then sets nParseLeft to signal that the end of
+  //   data was reached.
+  // - If an invalid file is supplied (ie, not an SREC file) it is detect-
+  //   ed by not finding an "S0" as the first two characters of the file.
+  //   In that case a loop is entered to allow the entire file to be sent
+  //   by the browser, but an upgrade_failcode is set to notify the user
+  //   of the error.
+  // - If an invalid SREC file is provided ... well, can't help the user
+  //   with every possible fart. The invalid SREC file will likely be
+  //   loaded into Flash and reprogramming via the SWIM interface may be
+  //   necessary.
+  // - It is possible that communications are so poor that the conditions
+  //   of the various "while" loops below cannot be met. I've found this
+  //   is particularly true on really bad WiFi connections. A timeout
+  //   funcction is used to cause a "parse fail" exit if the file transfer
+  //   is not completed in 60 seconds.
+  // nBytes is tracked in this function using the global file_nBytes to
+  // enable shared use of the nBytes value in this function and the
+  // read_two_characters function.
+  file_nBytes = nBytes;
+  parse_file_time_start = second_counter;
+
+  // This function uses a step by step state machine to read the data file
+
+  // When first starting the data file read keep in mind that even though
+  // the data part of the packet is just starting, a packet boundary can
+  // occur anywhere. However, we know that there will be at least one byte
+  // left in the current packet when we start.
+
+
+  if (pSocket->ParseState == PARSE_FILE_SEEK_START) {
+
+    // The first thing we need to do is find the start of the actual SREC
+    // file. In order to do this we need to find the end of the "multi-
+    // part boundary".
+    // Since only one SREC file is included in an update file the multi-
+    // part boundary immediately follows the second \r\n\r\n sequence.
+    // This is an example of the boundary text that will precede the first
+    // characters of the SREC data:
+    //
+    // -----------------------------168888385127375703662499690451
+    // Content-Disposition: form-data; name="file1"; filename="NetworkModule.sx"
+    // Content-Type: application/octet-stream
+    //
+    // So, we need to find the start of the SREC data by finding the end
+    // of the phrase "Type: application/octet-stream".
+    // Since a user might provide an invalid file we should also determine
+    // a reasonable point to give up looking for the phrase. Counting up
+    // the above and adding a little buffer for file name differences, we
+    // should find the end of the phrase within 200 characters of starting
+    // the search. If we don't it can be assumed this is not an SREC file.
 
+    while (1) {
+      // Search for the "Type: application/octet-stream" phrase.
+      // Since we can hit a packet boundary at any time we must check for
+      // file_nBytes == 0 and break away to allow the next packet to be
+      // read.
+      // This search works by reading one character at a time from the
+      // pBuffer and placing it in a left shift register. The register
+      // shifts left one character each time a new character would exceed
+      // the length of the register. The register is then compared with
+      // the search phrase.
+      
+      for (i=0; i<29; i++) {
+	// Shift the register contents left
+	compare_buf[i] = compare_buf[i+1];
+      }
+      // Add a new character to the end of the register
+      compare_buf[29] = *pBuffer;
+      pBuffer++;
+      file_nBytes--;
+      file_length--;
+      search_limit++;
+      
+      if (strncmp(compare_buf, "Type: application/octet-stream", 30) == 0) {
+        // Found "Type: application/octet-stream"
+	// The next character starts the SREC content
+#if BINARY_UPLOAD_SUPPORT == 1
+        // (or the binary image header)
+        pSocket->ParseState = PARSE_FILE_SEEK_TYPE;
+#else // BINARY_UPLOAD_SUPPORT == 0
+        pSocket->ParseState = PARSE_FILE_SEEK_SX;
+#endif // BINARY_UPLOAD_SUPPORT == 1
+	break; // Break out of the local while loop
+      }
+	  
+      if ((search_limit > 200) || (file_length == 0)) {
+        // Should have found the phrase by now. Assume this is not a valid
+	// SREC file. Break out of the loop and go to PARSE_FILE_FAIL
+	// The next character starts the SREC content
+        pSocket->ParseState = PARSE_FILE_FAIL;
+	break; // Break out of the local while loop
+      }
+      
+      if (file_nBytes == 0) {
+        // We just read the last character in this packet. Break out
+        // of the local while loop so the next packet will be read.
+        break; // Break out of the local while loop
+      }
+      
+      if (parse_file_time_start > (second_counter + 60)) {
+	// If a timeout occurs assume the connection is too poor to
+	// complete the file transfer and simply abort the connection.
+        pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
 #if DEBUG_SUPPORT == 15
-// UARTPrintf("\r\n");
-// UARTPrintf("Calling STATE_PARSEPOST. nBytes = ");
-// emb_itoa(nBytes, OctetArray, 10, 3);
-// UARTPrintf(OctetArray);
-// UARTPrintf("\r\n");
+// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
 #endif // DEBUG_SUPPORT == 15
+	break; // Break out of the local while loop
+      }
+    } // End of local while loop
+  }
 
-      // Parse data the user entered in the GUI.
-      parsepost(pSocket, pBuffer, nBytes);
-    }
-#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
-
-
-    if (pSocket->nState == STATE_PARSEGET) {
-      // Parse the GET command and identify the webpage to be copied to the
-      // body of the GET response.
-      // Once STATE_PARSEGET is entered we remain in that state until the
-      // entire GET is received and processed. So this loop could be
-      // repeated, repeating the call to parseget(), until all packets are
-      // received and parsed. Once all GET data is received the parseget()
-      // function will set pSocket->nState = STATE_SENDHEADER200 (or 204) to
-      // end the process.
-      parseget(pSocket, pBuffer);
-    }
-
-
-
-
-
-
-
-    
-#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
-    if (pSocket->nState == STATE_PARSEFILE) {
-      // This step is entered if a POST containing a firmware file was
-      // detected. The file contents will be copied to the I2C EEPROM,
-      // then the I2C EEPROM will be copied to the internal Flash, then
-      // the device will reboot.
-      //
-      // Some notes:
-      // - This application normally parses POST files providing user data
-      //   entries in a Browser session. As such, the size of the data is
-      //   easily less than 65536 characters, thus the nParseLeft variable
-      //   used in normal parsing is a uint16_t type.
-      // - When a SREC file is attached to a POST the datagram can be 1024
-      //   lines x 78 bytes = 79872 characters PLUS some other overhead like
-      //   S0 and S7 records, and some miscellaneous records (partial data,
-      //   0x4000 addresses, etc).
-      //   So nParseLeft cannot be used in receiving the SREC
-      //   file other than as a flag to indicate that parsing is complete.
-      //   Instead the SREC file parser searches for a SREC S7 record to find
-      //   the end of the data then sets nParseLeft to signal that the end of
-      //   data was reached.
-      // - If an invalid file is supplied (ie, not an SREC file) it is detect-
-      //   ed by not finding an "S0" as the first two characters of the file.
-      //   In that case a loop is entered to allow the entire file to be sent
-      //   by the browser, but an upgrade_failcode is set to notify the user
-      //   of the error.
-      // - If an invalid SREC file is provided ... well, can't help the user
-      //   with every possible fart. The invalid SREC file will likely be
-      //   loaded into Flash and reprogramming via the SWIM interface may be
-      //   necessary.
-      // - It is possible that communications are so poor that the conditions
-      //   of the various "while" loops below cannot be met. I've found this
-      //   is particularly true on really bad WiFi connections. A timeout
-      //   funcction is used to cause a "parse fail" exit if the file transfer
-      //   is not completed in 60 seconds.
-      // nBytes is tracked in this function using the global file_nBytes to
-      // enable shared use of the nBytes value in this function and the
-      // read_two_characters function.
-      file_nBytes = nBytes;
-      parse_file_time_start = second_counter;
-
-      // This function uses a step by step state machine to read the data file
-
-      // When first starting the data file read keep in mind that even though
-      // the data part of the packet is just starting, a packet boundary can
-      // occur anywhere. However, we know that there will be at least one byte
-      // left in the current packet when we start.
-
-
-      if (pSocket->ParseState == PARSE_FILE_SEEK_START) {
-
-        // The first thing we need to do is find the start of the actual SREC
-        // file. In order to do this we need to find the end of the "multi-
-	// part boundary".
-        // Since only one SREC file is included in an update file the multi-
-	// part boundary immediately follows the second \r\n\r\n sequence.
-	// This is an example of the boundary text that will precede the first
-	// characters of the SREC data:
-        //
-        // -----------------------------168888385127375703662499690451
-        // Content-Disposition: form-data; name="file1"; filename="NetworkModule.sx"
-        // Content-Type: application/octet-stream
-        //
-        // So, we need to find the start of the SREC data by finding the end
-	// of the phrase "Type: application/octet-stream".
-        // Since a user might provide an invalid file we should also determine
-        // a reasonable point to give up looking for the phrase. Counting up
-	// the above and adding a little buffer for file name differences, we
-	// should find the end of the phrase within 200 characters of starting
-	// the search. If we don't it can be assumed this is not an SREC file.
-
-        while (1) {
-	  // Search for the "Type: application/octet-stream" phrase.
-	  // Since we can hit a packet boundary at any time we must check for
-	  // file_nBytes == 0 and break away to allow the next packet to be
-	  // read.
-	  // This search works by reading one character at a time from the
-	  // pBuffer and placing it in a left shift register. The register
-	  // shifts left one character each time a new character would exceed
-	  // the length of the register. The register is then compared with
-	  // the search phrase.
-	  
-	  for (i=0; i<29; i++) {
-	    // Shift the register contents left
-	    compare_buf[i] = compare_buf[i+1];
+  if ((pSocket->ParseState != PARSE_FILE_SEEK_START) || (pSocket->ParseState == PARSE_FILE_FAIL)) {
+    // If the PARSE_FILE_SEEK_START was successful this loop will process
+    // the content of the file.
+    // OR
+    // If there was a PARSE_FILE_FAIL while seeking the start of the file
+    // this loop will finish reading the file (without processing content)
+    // and then exit to the user fail notification.
+    while (1) {
+      // This while() loop is a state machine with four main
+      // "pSocket->ParseState" states:
+      // PARSE_FILE_SEEK_SX
+      //   Parses the leading characters of each SREC looking for the SREC
+      //   type.
+      //     If the SREC type is S0 we are starting receipt of an SREC file
+      //     so the 32K I2C EEPROM0 space is erased to make it available to
+      //     store the parsed SREC content. This SREC must be read to deter-
+      //     mine the "file_type", ie, is it a PROGRAM file or a STRING
+      //     file.
+      //     If the SREC type is S3 we are starting receipt of an SREC data
+      //     line. The "address" contained within the data line is parsed
+      //     then the state machine goes to state PARSE_FILE_SEQUENTIAL or
+      //     state PARSE_FILE_NONSEQ as needed.
+      //     If the SREC type is S7 we are at the last record in the SREC
+      //     file.
+      // PARSE_FILE_SEQUENTIAL
+      //   Parses "sequential" SREC date, ie, the first data record and any
+      //   subsequent data record that has an address that is sequential
+      //   with the previous data record.
+      // PARSE_FILE_NONSEQ
+      //   Parses "non-sequential" SREC data, ie, any data record that has
+      //   an address that is not seqeuntial relative to the previous data
+      //   record.
+      // PARSE_FILE_FAIL
+      //   A parsing failure has occurred. The loop will finish reading the
+      //   file (without processing content) and then exit so the user fail
+      //   notification can occur.
+      // Normal exit: The loop will exit at end of each packet (file_nBytes
+      // == 0). This can occur at any point while reading data. The exit
+      // allows the uip functions to receive the next ethernet packet, then
+      // the STATE_PARSEFILE code will be re-entered to continue this state
+      // machine where we left off. Re-entry is made possible because
+      // "pSocket->nState" and "pSocket->ParseState" are both saved so that
+      // we know where we were when a packet ended (a TCP Fragmentation).
+      
+#if BINARY_UPLOAD_SUPPORT == 1
+      if (pSocket->ParseState == PARSE_FILE_SEEK_TYPE) {
+	// Skip the CRLF characters that follow the multi-part boundary
+	// then look at the first character of the file. A binary image
+	// starts with the "NMBI" header magic, an SREC file starts with
+	// "S0".
+	while (file_nBytes > 0 && file_length > 0) {
+	  if (*pBuffer == '\r' || *pBuffer == '\n') {
+	    pBuffer++;
+	    file_nBytes--;
+	    file_length--;
+	  }
+	  else {
+	    if (*pBuffer == 'N') {
+	      parse_index = 0;
+	      pSocket->ParseState = PARSE_FILE_BIN_HEADER;
+	    }
+	    else pSocket->ParseState = PARSE_FILE_SEEK_SX;
+	    break; // Break out of the local while loop
 	  }
-	  // Add a new character to the end of the register
-	  compare_buf[29] = *pBuffer;
+	}
+      }
+      
+      if (pSocket->ParseState == PARSE_FILE_BIN_HEADER) {
+	// Collect the 16 byte binary image header in parse_tail:
+	//   0-3   "NMBI"
+	//   4     File type: 'N' = Program, 'S' = Strings
+	//   5     Format version (1)
+	//   6-7   Reserved
+	//   8-11  Image length, big endian
+	//   12-15 Image CRC32 (IEEE 802.3 / zlib), big endian
+	while (file_nBytes > 0 && file_length > 0 && parse_index < 16) {
+	  parse_tail[parse_index++] = *pBuffer;
 	  pBuffer++;
 	  file_nBytes--;
 	  file_length--;
-	  search_limit++;
-	  
-          if (strncmp(compare_buf, "Type: application/octet-stream", 30) == 0) {
-            // Found "Type: application/octet-stream"
-	    // The next character starts the SREC content
-            pSocket->ParseState = PARSE_FILE_SEEK_SX;
-	    break; // Break out of the local while loop
+	}
+	if (parse_index == 16) {
+	  image_remaining = (uint16_t)((parse_tail[10] << 8) | parse_tail[11]);
+	  image_crc_expected = ((uint32_t)parse_tail[12] << 24)
+			     | ((uint32_t)parse_tail[13] << 16)
+			     | ((uint32_t)parse_tail[14] << 8)
+			     | (uint32_t)parse_tail[15];
+	  if (parse_tail[4] == 'N') file_type = FILETYPE_PROGRAM;
+	  else if (parse_tail[4] == 'S') file_type = FILETYPE_STRING;
+	  else {
+            upgrade_failcode = UPGRADE_FAIL_INVALID_FILETYPE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_INVALID_FILETYPE\r\n");
 	  }
-	      
-          if ((search_limit > 200) || (file_length == 0)) {
-            // Should have found the phrase by now. Assume this is not a valid
-	    // SREC file. Break out of the loop and go to PARSE_FILE_FAIL
-	    // The next character starts the SREC content
+#if BLOCK_DELTA_UPLOAD == 1
+	  // A version 2 image carries a CRC32 ahead of each 128 byte block.
+	  // The blocks must fill the image exactly, and a Program image must
+	  // cover all of Flash as the I2C EEPROM is not erased first.
+	  image_delta = 0;
+	  if (parse_tail[5] == 2) {
+	    image_delta = 1;
+	    parse_tail[5] = 1; // Otherwise checked as a version 1 header
+	    if (((image_remaining & 0x7f) != 0)
+	     || ((file_type == FILETYPE_PROGRAM)
+	      && (image_remaining != (OFFSET_TO_FLASH_START_USER_RESERVE)))) {
+              upgrade_failcode = UPGRADE_FAIL_IMAGE_FORMAT;
+	    }
+	  }
+#endif // BLOCK_DELTA_UPLOAD == 1
+	  if ((strncmp((char *)parse_tail, "NMBI", 4) != 0)
+	   || (parse_tail[5] != 1)
+	   || (parse_tail[8] != 0)
+	   || (parse_tail[9] != 0)
+	   || (image_remaining == 0)
+	   || (image_remaining > (OFFSET_TO_FLASH_START_USER_RESERVE))) {
+            upgrade_failcode = UPGRADE_FAIL_IMAGE_FORMAT;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_IMAGE_FORMAT\r\n");
+	  }
+	  if (upgrade_failcode != UPGRADE_OK) {
             pSocket->ParseState = PARSE_FILE_FAIL;
-	    break; // Break out of the local while loop
 	  }
-	  
-          if (file_nBytes == 0) {
-            // We just read the last character in this packet. Break out
-            // of the local while loop so the next packet will be read.
-            break; // Break out of the local while loop
-          }
-	  
-	  if (parse_file_time_start > (second_counter + 60)) {
-	    // If a timeout occurs assume the connection is too poor to
-	    // complete the file transfer and simply abort the connection.
-            pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
-#endif // DEBUG_SUPPORT == 15
-	    break; // Break out of the local while loop
+	  else {
+	    // The image replaces the full content of the I2C EEPROM so any
+	    // space not covered by the image reads back as zero.
+#if BLOCK_DELTA_UPLOAD == 1
+	    // A block CRC image is compared block by block with the I2C
+	    // EEPROM content instead.
+	    if (image_delta == 0) upload_erase();
+	    block_index = 0;
+#else // BLOCK_DELTA_UPLOAD == 0
+	    upload_erase();
+#endif // BLOCK_DELTA_UPLOAD == 1
+	    image_crc = 0xffffffff;
+	    memset(parse_tail, 0, 64);
+	    parse_index = 0;
+	    eeprom_address_index = 0;
+	    pSocket->ParseState = PARSE_FILE_BIN_DATA;
 	  }
-        } // End of local while loop
+	}
       }
-
-      if ((pSocket->ParseState != PARSE_FILE_SEEK_START) || (pSocket->ParseState == PARSE_FILE_FAIL)) {
-        // If the PARSE_FILE_SEEK_START was successful this loop will process
-	// the content of the file.
-	// OR
-	// If there was a PARSE_FILE_FAIL while seeking the start of the file
-	// this loop will finish reading the file (without processing content)
-	// and then exit to the user fail notification.
-        while (1) {
-          // This while() loop is a state machine with four main
-	  // "pSocket->ParseState" states:
-	  // PARSE_FILE_SEEK_SX
-	  //   Parses the leading characters of each SREC looking for the SREC
-	  //   type.
-	  //     If the SREC type is S0 we are starting receipt of an SREC file
-	  //     so the 32K I2C EEPROM0 space is erased to make it available to
-	  //     store the parsed SREC content. This SREC must be read to deter-
-	  //     mine the "file_type", ie, is it a PROGRAM file or a STRING
-	  //     file.
-	  //     If the SREC type is S3 we are starting receipt of an SREC data
-	  //     line. The "address" contained within the data line is parsed
-	  //     then the state machine goes to state PARSE_FILE_SEQUENTIAL or
-	  //     state PARSE_FILE_NONSEQ as needed.
-	  //     If the SREC type is S7 we are at the last record in the SREC
-	  //     file.
-	  // PARSE_FILE_SEQUENTIAL
-	  //   Parses "sequential" SREC date, ie, the first data record and any
-	  //   subsequent data record that has an address that is sequential
-	  //   with the previous data record.
-	  // PARSE_FILE_NONSEQ
-	  //   Parses "non-sequential" SREC data, ie, any data record that has
-	  //   an address that is not seqeuntial relative to the previous data
-	  //   record.
-	  // PARSE_FILE_FAIL
-	  //   A parsing failure has occurred. The loop will finish reading the
-	  //   file (without processing content) and then exit so the user fail
-	  //   notification can occur.
-	  // Normal exit: The loop will exit at end of each packet (file_nBytes
-	  // == 0). This can occur at any point while reading data. The exit
-	  // allows the uip functions to receive the next ethernet packet, then
-	  // the STATE_PARSEFILE code will be re-entered to continue this state
-	  // machine where we left off. Re-entry is made possible because
-	  // "pSocket->nState" and "pSocket->ParseState" are both saved so that
-	  // we know where we were when a packet ended (a TCP Fragmentation).
-          
-          if (pSocket->ParseState == PARSE_FILE_SEEK_SX) {
-	    // This parse looks S0, S3, and S7 SREC records and will parse them
-	    // based on expected content. There are error checks in the loop
-	    // looking for incorrect format or unexpected end-of-file.
-	    while (1) {
-	      // Each time the loop starts we expect to be able to read two
-	      // characters UNLESS we are at the end of a packet (which is OK)
-	      // OR if we find there is only 1 character left in the file
-	      // (which is not OK). Check for the end-of-file problem.
-	      if (file_length < 2) {
-	        // If we got here and find there are not at least 2 characters
-		// left in the overall file then something has gone wrong.
-                  upgrade_failcode = UPGRADE_FAIL_TRUNCATED_FILE;
-	      
+      
+      if (pSocket->ParseState == PARSE_FILE_BIN_DATA) {
+	// Copy the image bytes straight into parse_tail and write each 64
+	// byte page to the I2C EEPROM. No character conversion or per-line
+	// checksum is needed, the CRC32 covers the whole image.
+	while (file_nBytes > 0 && file_length > 0 && image_remaining > 0) {
+#if BLOCK_DELTA_UPLOAD == 1
+	  if (image_delta == 1 && block_index < 4) {
+	    // Collect the CRC32 that precedes the block then check whether
+	    // the I2C EEPROM already holds the block.
+	    block_crc_expected = (block_crc_expected << 8) | *pBuffer;
+	    pBuffer++;
+	    file_nBytes--;
+	    file_length--;
+	    block_index++;
+	    if (block_index == 4) {
+	      block_skip = upload_block_matches(eeprom_address_index, block_crc_expected);
+	    }
+	    continue;
+	  }
+#endif // BLOCK_DELTA_UPLOAD == 1
+	  parse_tail[parse_index] = *pBuffer;
+	  image_crc = crc32_update(image_crc, *pBuffer);
+	  pBuffer++;
+	  file_nBytes--;
+	  file_length--;
+	  image_remaining--;
+	  parse_index++;
+	  if (parse_index == 64 || image_remaining == 0) {
+#if BLOCK_DELTA_UPLOAD == 1
+	    if (image_delta == 1) upload_block_page(eeprom_address_index);
+	    else upload_page_write(eeprom_address_index);
+#else // BLOCK_DELTA_UPLOAD == 0
+	    upload_page_write(eeprom_address_index);
+#endif // BLOCK_DELTA_UPLOAD == 1
+#if SREC_UPLOAD_PIPELINE == 0
+	    upload_page_verify();
+#endif // SREC_UPLOAD_PIPELINE == 0
+	    eeprom_address_index += 64;
+	    memset(parse_tail, 0, 64);
+	    parse_index = 0;
+	  }
+	}
+	if (image_remaining == 0) {
+	  upload_page_verify();
+	  if (~image_crc != image_crc_expected) {
+	    upgrade_failcode = UPGRADE_FAIL_IMAGE_CRC;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_IMAGE_CRC\r\n");
+	  }
+	  if (upgrade_failcode == UPGRADE_OK) {
+	    pSocket->ParseState = PARSE_FILE_BIN_DRAIN;
+	  }
+	  else pSocket->ParseState = PARSE_FILE_FAIL;
+	}
+      }
+      
+      if (pSocket->ParseState == PARSE_FILE_BIN_DRAIN) {
+	// Read the closing multi-part boundary that follows the image.
+	while (file_nBytes > 0 && file_length > 0) {
+	  pBuffer++;
+	  file_nBytes--;
+	  file_length--;
+	}
+	if (file_length == 0) pSocket->ParseState = PARSE_FILE_COMPLETE;
+      }
+#endif // BINARY_UPLOAD_SUPPORT == 1
+
+      if (pSocket->ParseState == PARSE_FILE_SEEK_SX) {
+	// This parse looks S0, S3, and S7 SREC records and will parse them
+	// based on expected content. There are error checks in the loop
+	// looking for incorrect format or unexpected end-of-file.
+	while (1) {
+	  // Each time the loop starts we expect to be able to read two
+	  // characters UNLESS we are at the end of a packet (which is OK)
+	  // OR if we find there is only 1 character left in the file
+	  // (which is not OK). Check for the end-of-file problem.
+	  if (file_length < 2) {
+	    // If we got here and find there are not at least 2 characters
+	    // left in the overall file then something has gone wrong.
+              upgrade_failcode = UPGRADE_FAIL_TRUNCATED_FILE;
+	  
 // UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_TRUNCATED_FILE\r\n");
 
-                  pSocket->ParseState = PARSE_FILE_FAIL;
-	          break; // Break out of the local while loop
-	      }
-	      
-              // Try to read two characters from the SREC
-              pBuffer = read_two_characters(pBuffer);
-              if (byte_tail[0] == '\0') {
-	        // No characters were found. This can occur when an end of
-	        // packet occurs during a CRLF sequence. The read attempt will
-	        // have set file_nBytes to zero. Break out of the local while
-	        // loop so that the next packet will be read.
-	        break;
-	      }
-              if (byte_tail[1] == '\0') {
-                // We only found 1 character so we just read the last character
-	        // in this packet. The read_two_characters() function will have
-	        // set file_nBytes to zero. Break out of the local while loop so
-	        // the next packet will be read.
-                break;
-              }
-            
-	      // If we didn't break out then we successfully read two charac-
-	      // ters.
-	      
-	      // If this is the start of the SREC parsing the file MUST begin
-	      // with "S0" ... otherwise we must assume this is not an SREC file
-	      // and we will abort the parsing.
-	      if (SREC_start == 1) {
-	        if (strncmp(byte_tail, "S0", 2) != 0) {
-	          // This does not appear to be an SREC file. Abort.
-                  upgrade_failcode = UPGRADE_FAIL_NOT_SREC;
-	      
+              pSocket->ParseState = PARSE_FILE_FAIL;
+	      break; // Break out of the local while loop
+	  }
+	  
+          // Try to read two characters from the SREC
+          pBuffer = read_two_characters(pBuffer);
+          if (byte_tail[0] == '\0') {
+	    // No characters were found. This can occur when an end of
+	    // packet occurs during a CRLF sequence. The read attempt will
+	    // have set file_nBytes to zero. Break out of the local while
+	    // loop so that the next packet will be read.
+	    break;
+	  }
+          if (byte_tail[1] == '\0') {
+            // We only found 1 character so we just read the last character
+	    // in this packet. The read_two_characters() function will have
+	    // set file_nBytes to zero. Break out of the local while loop so
+	    // the next packet will be read.
+            break;
+          }
+        
+	  // If we didn't break out then we successfully read two charac-
+	  // ters.
+	  
+	  // If this is the start of the SREC parsing the file MUST begin
+	  // with "S0" ... otherwise we must assume this is not an SREC file
+	  // and we will abort the parsing.
+	  if (SREC_start == 1) {
+	    if (strncmp(byte_tail, "S0", 2) != 0) {
+	      // This does not appear to be an SREC file. Abort.
+              upgrade_failcode = UPGRADE_FAIL_NOT_SREC;
+	  
 // UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_NOT_SREC\r\n");
 
-                  pSocket->ParseState = PARSE_FILE_FAIL;
-	          break; // Break out of the local while loop
-	        }
-	        else SREC_start = 0;
-	      }
-	      
-	      // "byte_index" is used to track progress in dissecting the
-	      // incoming SREC.
-	      
-	      if (byte_index == 0) {
-	        if (strncmp(byte_tail, "S0", 2) == 0) {
-                  // Check if the two characters are "S0", indicating the start
-		  // of a SREC file.
+              pSocket->ParseState = PARSE_FILE_FAIL;
+	      break; // Break out of the local while loop
+	    }
+	    else SREC_start = 0;
+	  }
+	  
+	  // "byte_index" is used to track progress in dissecting the
+	  // incoming SREC.
+	  
+	  if (byte_index == 0) {
+	    if (strncmp(byte_tail, "S0", 2) == 0) {
+              // Check if the two characters are "S0", indicating the start
+	      // of a SREC file.
 
 // UARTPrintf("Found S0\r\n");
 
-                  // Erase I2C EEPROM0 to provide a clean space to store the
-		  // incoming SREC data.
-		  
-		  {
-		    uint16_t i;
-		    uint8_t j;
-		    uint16_t temp_eeprom_address_index;
-		    for (i=0; i<256; i++) {
-		      // Write 256 blocks of 128 bytes each with zero
-                      I2C_control(I2C_EEPROM0_WRITE); // Send Write Control Byte
-		      temp_eeprom_address_index = i * 128;
-                      I2C_byte_address(temp_eeprom_address_index, 2);
-		      for (j=0; j<128; j++) {
-		        // Write a zero byte
-		        I2C_write_byte(0);
-		      }
-                      I2C_stop(); // Start the EEPROM internal write cycle
-                      IWDG_KR = 0xaa; // Prevent the IWDG from firing.
-                      // Wait for completion of write.
-		      // For simplicity I'm waiting 5ms (the max time required).
-		      // This loop could be sped up by using "acknowledge
-		      // polling" (see the 24AA1025 EEPROM spec).
-                      wait_timer(5000); // Wait 5ms
-                    }
-		  }
-		  // Now go on to determining what kind of file was sent
-		  file_type = FILETYPE_SEARCH;
-	          byte_index = 2;
-                  // Clear byte_tail for subsequent reads
-                  byte_tail[0] = '\0';
-                  byte_tail[1] = '\0';
-	          // Continue to read the address value in this SREC
-	          continue;
-	        }
-	        else if (strncmp(byte_tail, "S3", 2) == 0) {
-                  // Check if the two characters are "S3", indicating the start
-		  // of a new SREC data line.
-
-// UARTPrintf("Found S3\r\n");
-
-	          byte_index = 2;
-                  // Clear byte_tail for subsequent reads
-                  byte_tail[0] = '\0';
-                  byte_tail[1] = '\0';
-	          // Continue to read the address value in this SREC
-	          continue;
-	        }
-	        else if (strncmp(byte_tail, "S7", 2) == 0) {
-// UARTPrintf("Found S7\r\n");
-                  // Check if the two characters are "S7", indicating the end of
-		  // data.
-		 
-		  if (parse_index != 0) {
-		    // If any data remains in parse_tail write it to the I2C EEPROM.
-                    {
-                      int i;
-                      uint8_t I2C_last_flag;
-                      uint8_t temp_byte;
-                      
-		      // Send Write Control Byte
-	              if (file_type == FILETYPE_PROGRAM) {
-                        I2C_control(I2C_EEPROM0_WRITE);
-		      }
-	              if (file_type == FILETYPE_STRING) {
-                        I2C_control(I2C_EEPROM2_WRITE);
-		      }
-                      I2C_byte_address(eeprom_address_index, 2);
-                      for (i=0; i<64; i++) {
-		        I2C_write_byte(parse_tail[i]);
-		      }
-                      I2C_stop();
-                      wait_timer(5000); // Wait 5ms
-                      IWDG_KR = 0xaa; // Prevent the IWDG from firing.
-                      // Validate data in I2C EEPROM
-	              if (file_type == FILETYPE_PROGRAM) {
-                        prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
-                      }
-	              if (file_type == FILETYPE_STRING) {
-                        prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
-                      }
-	              I2C_last_flag = 0;
-                      for (i=0; i<64; i++) {
-                        if (i == 63) I2C_last_flag = 1;
-                        temp_byte = I2C_read_byte(I2C_last_flag);
-                        if (temp_byte != parse_tail[i]) {
-                          upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
-                          pSocket->ParseState = PARSE_FILE_FAIL;
-	                  break; // Break out of the local while loop
-                        }
-                      }
-                    }
-		  }
-		  
-		  // At this point all data is processed. Go on to the
-		  // PARSE_FILE_COMPLETE code.
- 
-	          pSocket->ParseState = PARSE_FILE_COMPLETE;
-		  
-		  continue; // Continue reading characters until end of file
-	        }
-	        else {
-	          // Throw away characters and continue search
-                  // Clear byte_tail for subsequent reads
-                  byte_tail[0] = '\0';
-                  byte_tail[1] = '\0';
-		  continue;
-                } 
-	      }
-	    
-	      if (byte_index == 2) {
-	        // Read the data count value
-                data_count = two_hex2int(byte_tail[0], byte_tail[1]);
-	        // Start checksum
-	        checksum = data_count;
-	        byte_index = 4;
-                // Clear byte_tail for subsequent reads
-                byte_tail[0] = '\0';
-                byte_tail[1] = '\0';
-	        continue;
-	      }
-	    
-	      if (byte_index == 4) {
-	        // Ignore first byte of address value
-	        data_count--;
-	        // Add to checksum. Value is always 00
-	        checksum += 0;
-	        byte_index = 6;
-                // Clear byte_tail for subsequent reads
-                byte_tail[0] = '\0';
-                byte_tail[1] = '\0';
-	        continue;
-	      }
-	    
-	      if (byte_index == 6) {
-	        // Ignore the second byte of address value
-	        data_count--;
-	        // Add to checksum. Value is always 00
-	        checksum += 0;
-	        byte_index = 8;
-                // Clear byte_tail for subsequent reads
-                byte_tail[0] = '\0';
-                byte_tail[1] = '\0';
-	        continue;
-	      }
-	    
-	      if (byte_index == 8 && file_type != FILETYPE_SEARCH) {
-	        // Capture the high order byte of the address value
-                temp_address = two_hex2int(byte_tail[0], byte_tail[1]);
-	        data_count--;
-	        checksum += (uint8_t)temp_address;
-	        temp_address = temp_address << 8;
-	        byte_index = 10;
-                // Clear byte_tail for subsequent reads
-                byte_tail[0] = '\0';
-                byte_tail[1] = '\0';
-	        continue;
-	      }
-	    
-	      if (byte_index == 8 && file_type == FILETYPE_SEARCH) {
-	        // Determine file_type
-	        data_count--;
-	        // Capture the first byte of the file type
-	        // 'N' (0x4E) is a NetworkModule program file
-	        // 'S' (0x53) is a String File
-                if (two_hex2int(byte_tail[0], byte_tail[1]) == 0x4E) {
-	          file_type = FILETYPE_PROGRAM;
-
-// UARTPrintf("file_type = FILETYPE_PROGRAM\r\n");
-	      
-	        }
-	        else if (two_hex2int(byte_tail[0], byte_tail[1]) == 0x53) {
-	          file_type = FILETYPE_STRING;
-
-// UARTPrintf("file_type = FILETYPE_STRING\r\n");
-	      
-                }
-		else {
-                  upgrade_failcode = UPGRADE_FAIL_INVALID_FILETYPE;
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_INVALID_FILETYPE\r\n");
-                  pSocket->ParseState = PARSE_FILE_FAIL;
-                  break; // Break out of the local while loop
-		}
-		
-	        // Reset byte_index and byte_tail
-	        byte_index = 0;
-                byte_tail[0] = '\0';
-                byte_tail[1] = '\0';
-	        // Break out of while loop so that next SREC will be read
-                break;
-	      }
-	    
-	      if (byte_index == 10) {
-	        // Capture the low order byte of the address value
-                temp_address_low = two_hex2int(byte_tail[0], byte_tail[1]);
-	        data_count--;
-	        checksum += (uint8_t)temp_address_low;
-	        temp_address |= temp_address_low;
-	      
-	        if ((temp_address < 0x8000) || (temp_address > (FLASH_START_USER_RESERVE - 1))) {
-	          // If the address is not in the range 0x8000 to
-	          // FLASH_START_USER_DATA_RESERVE we ignore the SREC and
-		  // stay in ParseState PARSE_FILE_SEEK_SX to search for the
- 		  // next SREC.
-	          byte_index = 0;
-                  // Clear byte_tail for subsequent reads
-                  byte_tail[0] = '\0';
-                  byte_tail[1] = '\0';
-	          break;
-	        }
-	        else {
-	          // Else we start processing the SREC
-                  new_address = temp_address;
-	        }
+              // Erase I2C EEPROM0 to provide a clean space to store the
+	      // incoming SREC data.
 	      
-	        if (new_address == 0x8000) {
-	          // If this is the start of the firmware image set address and
-	          // parse the first SREC in the image
-	          address = 0x8000;
-                  pSocket->ParseState = PARSE_FILE_SEQUENTIAL;
-                  // Clear byte_tail for subsequent reads
-                  byte_tail[0] = '\0';
-                  byte_tail[1] = '\0';
-                  break;
-	        }
-	      
-	        if (new_address > 0x8000) {
-	          // Handle valid addresses beyond the starting address
-	          if (new_address == address) {
-	            // While reading the SREC "address" should have incremented
-		    // up to equal the "new_address". If so then continue read-
-		    // ing data
-                    pSocket->ParseState = PARSE_FILE_SEQUENTIAL;
-                    // Clear byte_tail for subsequent reads
-                    byte_tail[0] = '\0';
-                    byte_tail[1] = '\0';
-	            break;
-	          }
-		  
-		  else {
-		    // This is a case where the "new_address" is not sequential
-		    // with the prevous data read.
-		    // In this case we need to finish writing data we were col-
-		    // lecting, then we need to use the PARSE_FILE_NONSEQ code
-		    // to begin collection of data at the new_address.
-		    //   If the new_address is in space already written to the
-		    //   I2C EEPROM an over-write of the I2C EEPROM content will
-		    //   occur.
-		    //   If the new_address is in space futher out in the I2C
-		    //   EEPROM the I2C EEPROM writes will begin at that new_address.
-		    // 
-		    if (parse_index != 0) {
-		      // If we were in the middle of writing a 64 byte block to
-		      // I2C EEPROM we need to finish that. Write the 64 bytes of
-		      // data that are in the parse_tail array into the I2C EEPROM.
-                      {
-                        int i;
-                        uint8_t I2C_last_flag;
-                        uint8_t temp_byte;
-			
-                        // Send Write Control Byte
-	                if (file_type == FILETYPE_PROGRAM) {
-                          I2C_control(I2C_EEPROM0_WRITE);
-			}
-	                if (file_type == FILETYPE_STRING) {
-                          I2C_control(I2C_EEPROM2_WRITE);
-			}
-			
-		        // At this point the eeprom_address_index will be point-
-		        // ing at the start of the 64 byte I2C EEPROM block that was
-		        // being processed when the out-of-sequence address was
-		        // encountereed.
-                        I2C_byte_address(eeprom_address_index, 2);
-                        for (i=0; i<64; i++) {
-		          I2C_write_byte(parse_tail[i]);
-		        }
-                        I2C_stop();
-                        wait_timer(5000); // Wait 5ms
-                        IWDG_KR = 0xaa; // Prevent the IWDG from firing.
-			
-                        // Validate data in I2C EEPROM
-	                if (file_type == FILETYPE_PROGRAM) {
-                          prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
-			}
-	                if (file_type == FILETYPE_STRING) {
-                          prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
-			}
-			
-	                I2C_last_flag = 0;
-                        for (i=0; i<64; i++) {
-                          if (i == 63) I2C_last_flag = 1;
-                          temp_byte = I2C_read_byte(I2C_last_flag);
-                           if (temp_byte != parse_tail[i]) {
-                             upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
-                             pSocket->ParseState = PARSE_FILE_FAIL;
-                             break; // Break out of the local while loop
-                          }
-                        }
-                      }
-		    }
-		  
-		    // Go to the non-sequential data processing
-                    pSocket->ParseState = PARSE_FILE_NONSEQ;
-                    // Clear byte_tail for subsequent reads
-                    byte_tail[0] = '\0';
-                    byte_tail[1] = '\0';
-		    
-		    // Set "address" to be equal to "new_address"
-		    address = new_address;
-		    
-		    // Indicate initial detection of the non-sequential data.
-		    // This is used to allow the processing to be re-entrant
-		    // should TCP Fragmentation occur.
-		    non_sequential_detect = 1;
-		    
-	            break;
-		  }
-	        }
-	      }
-	    
-              if (file_nBytes == 0) {
-                // We just read the last character in this packet. Break out
-                // of the local while loop so the next packet will be read.
-                break;
-              }
-	      
-	      if (parse_file_time_start > (second_counter + 60)) {
-	        // If a timeout occurs assume the connection is too poor to
-	        // complete the file transfer and simply abort the connection.
-                pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
-#endif // DEBUG_SUPPORT == 15
-	        break; // Break out of the local while loop
-	      }
-	    } // End of local while() loop
-	  }
-
-          if (pSocket->ParseState == PARSE_FILE_SEQUENTIAL) {
-	    // This parse is entered knowing that the next two characters are a
-	    // data byte.
-	    while (1) {
-              // Read two characters from the SREC
-              pBuffer = read_two_characters(pBuffer);
-              if (byte_tail[0] == '\0') {
-	        // No characters were found. This can occur when an end of
-	        // packet occurs during a CRLF sequence. The read attempt will
-	        // have set file_nBytes to zero. Break out of the local while
-	        // loop so that the next packet will be read.
-	        break;
-	      }
-              if (byte_tail[1] == '\0') {
-                // We only found 1 character so we just read the last character
-	        // in this packet. The read_two_characters() function will have
-	        // set file_nBytes to zero. Break out of the local while loop so
-	        // the next packet will be read.
-                break;
-              }
-	    
-	      // If we didn't break out then we successfully read two characters
-              data_value = two_hex2int(byte_tail[0], byte_tail[1]);
-              checksum += data_value;
-              data_count--;
+	      upload_erase();
+	      // Now go on to determining what kind of file was sent
+	      file_type = FILETYPE_SEARCH;
+	      byte_index = 2;
+              // Clear byte_tail for subsequent reads
+              byte_tail[0] = '\0';
+              byte_tail[1] = '\0';
+	      // Continue to read the address value in this SREC
+	      continue;
+	    }
+	    else if (strncmp(byte_tail, "S3", 2) == 0) {
+              // Check if the two characters are "S3", indicating the start
+	      // of a new SREC data line.
+
+// UARTPrintf("Found S3\r\n");
+
+	      byte_index = 2;
               // Clear byte_tail for subsequent reads
               byte_tail[0] = '\0';
               byte_tail[1] = '\0';
+	      // Continue to read the address value in this SREC
+	      continue;
+	    }
+	    else if (strncmp(byte_tail, "S7", 2) == 0) {
+// UARTPrintf("Found S7\r\n");
+              // Check if the two characters are "S7", indicating the end of
+	      // data.
+	     
+#if SREC_UPLOAD_PIPELINE == 1
+	      // If any data remains in parse_tail write it to the I2C
+	      // EEPROM, then wait for and verify the last page write.
+	      if (parse_index != 0) upload_page_write(eeprom_address_index);
+	      upload_page_verify();
 	      
-	      if (data_count > 0) {
-	        // Copy data to parse_tail
-	        parse_tail[parse_index++] = data_value;
-	        address++; // Increment the incoming address counter
+	      // At this point all data is processed. A miscompare found
+	      // in any page write is reported here as the writes are
+	      // verified one page behind the parser.
+	      if (upgrade_failcode == UPGRADE_OK) {
+		pSocket->ParseState = PARSE_FILE_COMPLETE;
 	      }
-	      
-	      if (data_count == 0) {
-	        // We just read the last byte in this SREC. The byte just read
-	        // was the checksum. Check for validity.
-	        if (checksum != 0xff) {
-	          // Handle Checksum Error
-                  upgrade_failcode = UPGRADE_FAIL_FILE_READ_CHECKSUM;
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_FILE_READ_CHECKSUM\r\n");
-                  pSocket->ParseState = PARSE_FILE_FAIL;
-                  break; // Break out of the local while loop
-	        }
+	      else {
+                pSocket->ParseState = PARSE_FILE_FAIL;
+		break; // Break out of the local while loop
 	      }
-	    
-	      if (parse_index == 64 && file_type == FILETYPE_PROGRAM) {
-	        // Copy parse_tail to I2C EEPROM0
-	        
-                // Write the 64 bytes of data that are in the parse_tail array
-                // into the I2C EEPROM.
+#else // SREC_UPLOAD_PIPELINE == 0
+	      if (parse_index != 0) {
+		// If any data remains in parse_tail write it to the I2C EEPROM.
                 {
                   int i;
                   uint8_t I2C_last_flag;
                   uint8_t temp_byte;
                   
-                  I2C_control(I2C_EEPROM0_WRITE); // Send Write Control Byte
+		  // Send Write Control Byte
+		  if (file_type == FILETYPE_PROGRAM) {
+                    I2C_control(I2C_EEPROM0_WRITE);
+		  }
+		  if (file_type == FILETYPE_STRING) {
+                    I2C_control(I2C_EEPROM2_WRITE);
+		  }
                   I2C_byte_address(eeprom_address_index, 2);
                   for (i=0; i<64; i++) {
-                    I2C_write_byte(parse_tail[i]);
-                  }
+		    I2C_write_byte(parse_tail[i]);
+		  }
                   I2C_stop();
                   wait_timer(5000); // Wait 5ms
                   IWDG_KR = 0xaa; // Prevent the IWDG from firing.
                   // Validate data in I2C EEPROM
-                  prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
-	          I2C_last_flag = 0;
-                  for (i=0; i<64; i++) {
-                    if (i == 63) I2C_last_flag = 1;
-                    temp_byte = I2C_read_byte(I2C_last_flag);
-                    if (temp_byte != parse_tail[i]) {
-                      upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
-                      pSocket->ParseState = PARSE_FILE_FAIL;
-                      break; // Break out of the local while loop
-                    }
+		  if (file_type == FILETYPE_PROGRAM) {
+                    prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
                   }
-                  eeprom_address_index += 64;
-                }
-              }
-	    
-	      if (parse_index == 64 && file_type == FILETYPE_STRING) {
-	        // Copy parse_tail to I2C EEPROM2
-	        
-                // Write the 64 bytes of data that are in the parse_tail array
-                // into the I2C EEPROM.
-                {
-                  int i;
-                  uint8_t I2C_last_flag;
-                  uint8_t temp_byte;
-                  
-                  I2C_control(I2C_EEPROM2_WRITE); // Send Write Control Byte
-                  I2C_byte_address(eeprom_address_index, 2);
-                  for (i=0; i<64; i++) {
-                    I2C_write_byte(parse_tail[i]);
+		  if (file_type == FILETYPE_STRING) {
+                    prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
                   }
-                  I2C_stop();
-                  wait_timer(5000); // Wait 5ms
-                  IWDG_KR = 0xaa; // Prevent the IWDG from firing.
-                  // Validate data in I2C EEPROM
-                  prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
-	          I2C_last_flag = 0;
+		  I2C_last_flag = 0;
                   for (i=0; i<64; i++) {
                     if (i == 63) I2C_last_flag = 1;
                     temp_byte = I2C_read_byte(I2C_last_flag);
                     if (temp_byte != parse_tail[i]) {
-                      upgrade_failcode = STRING_EEPROM_MISCOMPARE;
-// UARTPrintf("UPGRADE_FAILCODE = STRING_EEPROM_MISCOMPARE\r\n");
+                      upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
                       pSocket->ParseState = PARSE_FILE_FAIL;
-                      break; // Break out of the local while loop
+		      break; // Break out of the local while loop
                     }
                   }
-                  eeprom_address_index += 64;
                 }
 	      }
-
-	      if (parse_index == 64) {
-	        // This is just a cleanup routine to make debug easier. This
-	        // will zero out the parse_tail array so that subsequent writes
-	        // to parse tail that end before filling it will be followed by
-	        // zeroes.
-	        for (i=0; i<64; i++) parse_tail[i] = 0;
-	        parse_index = 0; // Clear for next data
-	      }
 	      
-	      if (data_count == 0) {
-                // Go on to read next SREC
-                byte_index = 0;
-                pSocket->ParseState = PARSE_FILE_SEEK_SX;
-                break;
-	      }
-	    
-              if (file_nBytes == 0) {
-                // We just read the last character in this packet. Break out
-                // of the local while loop so the next packet will be read.
-                break;
-              }
+	      // At this point all data is processed. Go on to the
+	      // PARSE_FILE_COMPLETE code.
+ 
+	      pSocket->ParseState = PARSE_FILE_COMPLETE;
+#endif // SREC_UPLOAD_PIPELINE == 1
 	      
-	      if (parse_file_time_start > (second_counter + 60)) {
-	        // If a timeout occurs assume the connection is too poor to
-	        // complete the file transfer and simply abort the connection.
-                pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
-#endif // DEBUG_SUPPORT == 15
-	        break; // Break out of the local while loop
-	      }
-	    } // End of local while() loop
+	      continue; // Continue reading characters until end of file
+	    }
+	    else {
+	      // Throw away characters and continue search
+              // Clear byte_tail for subsequent reads
+              byte_tail[0] = '\0';
+              byte_tail[1] = '\0';
+	      continue;
+            } 
+	  }
+	
+	  if (byte_index == 2) {
+	    // Read the data count value
+            data_count = two_hex2int(byte_tail[0], byte_tail[1]);
+	    // Start checksum
+	    checksum = data_count;
+	    byte_index = 4;
+            // Clear byte_tail for subsequent reads
+            byte_tail[0] = '\0';
+            byte_tail[1] = '\0';
+	    continue;
+	  }
+	
+	  if (byte_index == 4) {
+	    // Ignore first byte of address value
+	    data_count--;
+	    // Add to checksum. Value is always 00
+	    checksum += 0;
+	    byte_index = 6;
+            // Clear byte_tail for subsequent reads
+            byte_tail[0] = '\0';
+            byte_tail[1] = '\0';
+	    continue;
 	  }
+	
+	  if (byte_index == 6) {
+	    // Ignore the second byte of address value
+	    data_count--;
+	    // Add to checksum. Value is always 00
+	    checksum += 0;
+	    byte_index = 8;
+            // Clear byte_tail for subsequent reads
+            byte_tail[0] = '\0';
+            byte_tail[1] = '\0';
+	    continue;
+	  }
+	
+	  if (byte_index == 8 && file_type != FILETYPE_SEARCH) {
+	    // Capture the high order byte of the address value
+            temp_address = two_hex2int(byte_tail[0], byte_tail[1]);
+	    data_count--;
+	    checksum += (uint8_t)temp_address;
+	    temp_address = temp_address << 8;
+	    byte_index = 10;
+            // Clear byte_tail for subsequent reads
+            byte_tail[0] = '\0';
+            byte_tail[1] = '\0';
+	    continue;
+	  }
+	
+	  if (byte_index == 8 && file_type == FILETYPE_SEARCH) {
+	    // Determine file_type
+	    data_count--;
+	    // Capture the first byte of the file type
+	    // 'N' (0x4E) is a NetworkModule program file
+	    // 'S' (0x53) is a String File
+            if (two_hex2int(byte_tail[0], byte_tail[1]) == 0x4E) {
+	      file_type = FILETYPE_PROGRAM;
 
+// UARTPrintf("file_type = FILETYPE_PROGRAM\r\n");
+	  
+	    }
+	    else if (two_hex2int(byte_tail[0], byte_tail[1]) == 0x53) {
+	      file_type = FILETYPE_STRING;
 
-          if (pSocket->ParseState == PARSE_FILE_NONSEQ) {
-            // This is a case where the new_address is not sequential with the
-	    // previous adddress.
-	    //
-	    // If this occurs then only the data in the SREC is copied to the I2C
-	    // EEPROM, but it requires reading the existing data from the I2C EEPROM
-	    // then inserting the new SREC data into the existing I2C EEPROM data.
-	    //
-            // The "address" and "eeprom_address_index" values will be updated
-	    // according to the addressing values needed by this special case,
-	    // causing all new SREC addresses to be treated as non-sequential
-	    // until they start becoming sequential again.
-	    //
-	    // WHAT IF THE NON-SEQUENTIAL DATA OCCUPIES MORE THAN ONE SREC?
-	    // If the additional SRECs are sequential relative to the first non-
-	    // sequential address encountered they will be handled by the seq-
-	    // uential data processing routine. If the next SREC is non-sequen-
-	    // tial this routine will run again.
-	    //
-	    // WHAT IF THE NON-SEQUENTIAL SREC STARTS AT A POINT OTHER THAN 0
-	    // RELATIVE TO THE 64 BYTE WRITES TO I@C EEPROM?
-	    // This is actually the typical case, so the code needs to read the
-	    // existing data from the I2C EEPROM to preserve previously written
-	    // data, then an offset is calculated to determine the point that
-	    // new SREC data needs to start within the existing EEPROM data.
-	    // a) The data to read from the I2C EEPROM is the 64 bytes starting at
-	    //    ((new_address - 0x8000) & 0xFFC0).
-	    // b) The offset into this data for writing the new data is
-	    //    (new_address & 0x003F).
-	    // NOTE: (a) and (b) are performed only once at the initial detect-
-	    // ion of a non-sequential SREC case. The "non_sequential_detect"
-	    // flag is used to manage this. This is necessary as TCP Fragmenta-
-	    // tion may cause the process to be re-entered.
-	    // c) Read the incoming SREC and write the contents to parse_tail.
-	    //    If the end of parse_tail is reached or the end of the SREC is
-	    //    reached write the parse_tail to the I2C EEPROM.
-	    // d) If the end of the parse_tail is reached but there is still
-	    //    data in the incoming SREC then read the next 64 bytes from the
-	    //    I2C EEPROM into parse_tail, and continue writing the incoming SREC
-	    //    data into the parse_tail starting at byte [0].
-	    //    When the end of the SREC is reached write the parse_tail to
-	    //    the I2C EEPROM.
-	    // e) Exit comments: "address" and "eeprom_address_index" never get
-	    //    changed in this process so when this parsing completes we will
-	    //    go on to reading the next SREC. If that next SREC has a
-	    //    new_address lower than the current address the non-sequential
-	    //    process repeats. Otherwise the regular read SREC process runs.
-	    
-            // Why not use the above technique for every SREC?
-	    // Because it would result in twice as many writes to the I2C EEPROM
-	    // taking a lot longer to do the programming. Twice as many writes
-	    // will occur because it is typical for the incoming data to be
-	    // skewed relative to the 64 byte writes to the I2C EEPROM, and the
-	    // incoming SREC data is in 32 byte blocks as opposed to the 64 byte
-	    // blocks being written to the I2C EEPROM.
+// UARTPrintf("file_type = FILETYPE_STRING\r\n");
 	  
-	    if (non_sequential_detect == 1) {
-	      // Calculate the starting index of the I2C EEPROM block
-	      eeprom_address_index = (new_address - 0x8000) & 0xFFC0;
-	      
-	      // Read the existing I2C EEPROM data into parse_tail
-	      if (file_type == FILETYPE_PROGRAM) {
-                prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
-              }
-	      if (file_type == FILETYPE_STRING) {
-                prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
-              }
-	      
-	      for (i=0; i<63; i++) {
-                parse_tail[i] = I2C_read_byte(0);
-              }
-              parse_tail[63] = I2C_read_byte(1);
-	      
-	      // Set the offset into parse_tail for the new data.
-              parse_index = (uint8_t)(new_address & 0x003F);
-	      
-	      // Clear initial detect flag so this "if" section will be bypassed
-	      // if the code is re-entered due to handle TCP Fragmentation.
-	      non_sequential_detect = 0;
+            }
+	    else {
+              upgrade_failcode = UPGRADE_FAIL_INVALID_FILETYPE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_INVALID_FILETYPE\r\n");
+              pSocket->ParseState = PARSE_FILE_FAIL;
+              break; // Break out of the local while loop
 	    }
 	    
-	    // This parse is entered knowing that the next two characters are a
-	    // data byte, and that all the data of interest is contained in a
-	    // single incoming SREC.
-	    
-	    while (1) {
-              // Read two characters from the data line
-              pBuffer = read_two_characters(pBuffer);
-              if (byte_tail[0] == '\0') {
-	        // No characters were found. This can occur when an end of
-	        // packet occurs during a CRLF sequence. The read attempt will
-	        // have set file_nBytes to zero. Break out of the local while
-	        // loop so that the next packet will be read.
-	        break;
-	      }
-              if (byte_tail[1] == '\0') {
-                // We only found 1 character so we just read the last character
-	        // in this packet. The read_two_characters() function will have
-	        // set file_nBytes to zero. Break out of the local while loop so
-	        // the next packet will be read.
-                break;
-              }
-	    
-	      // If we didn't break out then we successfully read two characters
-              data_value = two_hex2int(byte_tail[0], byte_tail[1]);
-              checksum += data_value;
-	      data_count--;
+	    // Reset byte_index and byte_tail
+	    byte_index = 0;
+            byte_tail[0] = '\0';
+            byte_tail[1] = '\0';
+	    // Break out of while loop so that next SREC will be read
+            break;
+	  }
+	
+	  if (byte_index == 10) {
+	    // Capture the low order byte of the address value
+            temp_address_low = two_hex2int(byte_tail[0], byte_tail[1]);
+	    data_count--;
+	    checksum += (uint8_t)temp_address_low;
+	    temp_address |= temp_address_low;
+	  
+	    if ((temp_address < 0x8000) || (temp_address > (FLASH_START_USER_RESERVE - 1))) {
+	      // If the address is not in the range 0x8000 to
+	      // FLASH_START_USER_DATA_RESERVE we ignore the SREC and
+	      // stay in ParseState PARSE_FILE_SEEK_SX to search for the
+	      // next SREC.
+	      byte_index = 0;
               // Clear byte_tail for subsequent reads
               byte_tail[0] = '\0';
               byte_tail[1] = '\0';
-	      
-	      if (data_count > 0) {
-	        // Copy data to parse_tail
-	        parse_tail[parse_index++] = data_value;
-	        address++; // Increment the incoming address counter
-	      }
-	      
-	      if (data_count == 0) {
-	        // We just read the last byte in this SREC. The byte just read
-	        // was the checksum. Check for validity.
-	        if (checksum != 0xff) {
-	          // Handle Checksum Error
-                  upgrade_failcode = UPGRADE_FAIL_FILE_READ_CHECKSUM;
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_FILE_READ_CHECKSUM\r\n");
-                  pSocket->ParseState = PARSE_FILE_FAIL;
-                  break; // Break out of the local while loop
-	        }
-	        else {
-	        }
+	      break;
+	    }
+	    else {
+	      // Else we start processing the SREC
+              new_address = temp_address;
+	    }
+	  
+	    if (new_address == 0x8000) {
+	      // If this is the start of the firmware image set address and
+	      // parse the first SREC in the image
+	      address = 0x8000;
+              pSocket->ParseState = PARSE_FILE_SEQUENTIAL;
+              // Clear byte_tail for subsequent reads
+              byte_tail[0] = '\0';
+              byte_tail[1] = '\0';
+              break;
+	    }
+	  
+	    if (new_address > 0x8000) {
+	      // Handle valid addresses beyond the starting address
+	      if (new_address == address) {
+		// While reading the SREC "address" should have incremented
+		// up to equal the "new_address". If so then continue read-
+		// ing data
+                pSocket->ParseState = PARSE_FILE_SEQUENTIAL;
+                // Clear byte_tail for subsequent reads
+                byte_tail[0] = '\0';
+                byte_tail[1] = '\0';
+		break;
 	      }
 	      
-	      if (data_count == 0 || parse_index == 64) {
-                // Copy parse_tail to I2C EEPROM0
-	        
-                // Write the data in the parse_tail array into the I2C
-	        // EEPROM.
-                {
-                  int i;
-                  uint8_t I2C_last_flag;
-                  uint8_t temp_byte;
-		  
-	          if (file_type == FILETYPE_PROGRAM) {
-                    I2C_control(I2C_EEPROM0_WRITE); // Send Write Control Byte
-		  }
-	          if (file_type == FILETYPE_STRING) {
-                    I2C_control(I2C_EEPROM2_WRITE); // Send Write Control Byte
-		  }
-		  
-                  I2C_byte_address(eeprom_address_index, 2);
-                  for (i=0; i<64; i++) {
-                    I2C_write_byte(parse_tail[i]);
-                  }
-                  I2C_stop();
-                  wait_timer(5000); // Wait 5ms
-                  IWDG_KR = 0xaa; // Prevent the IWDG from firing.
-		  
-                  // Validate data in I2C EEPROM
-	          if (file_type == FILETYPE_PROGRAM) {
-                    prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
-		  }
-	          if (file_type == FILETYPE_STRING) {
-                    prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
-		  }
-		  
-	          I2C_last_flag = 0;
-                  for (i=0; i<64; i++) {
-                    if (i == 63) I2C_last_flag = 1;
-                    temp_byte = I2C_read_byte(I2C_last_flag);
-                    if (temp_byte != parse_tail[i]) {
-                      upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
+	      else {
+		// This is a case where the "new_address" is not sequential
+		// with the prevous data read.
+		// In this case we need to finish writing data we were col-
+		// lecting, then we need to use the PARSE_FILE_NONSEQ code
+		// to begin collection of data at the new_address.
+		//   If the new_address is in space already written to the
+		//   I2C EEPROM an over-write of the I2C EEPROM content will
+		//   occur.
+		//   If the new_address is in space futher out in the I2C
+		//   EEPROM the I2C EEPROM writes will begin at that new_address.
+		// 
+#if SREC_UPLOAD_PIPELINE == 1
+		// If we were in the middle of writing a 64 byte block to
+		// I2C EEPROM we need to finish that.
+		if (parse_index != 0) upload_page_write(eeprom_address_index);
+#else // SREC_UPLOAD_PIPELINE == 0
+		if (parse_index != 0) {
+		  // If we were in the middle of writing a 64 byte block to
+		  // I2C EEPROM we need to finish that. Write the 64 bytes of
+		  // data that are in the parse_tail array into the I2C EEPROM.
+                  {
+                    int i;
+                    uint8_t I2C_last_flag;
+                    uint8_t temp_byte;
+		    
+                    // Send Write Control Byte
+		    if (file_type == FILETYPE_PROGRAM) {
+                      I2C_control(I2C_EEPROM0_WRITE);
+		    }
+		    if (file_type == FILETYPE_STRING) {
+                      I2C_control(I2C_EEPROM2_WRITE);
+		    }
+		    
+		    // At this point the eeprom_address_index will be point-
+		    // ing at the start of the 64 byte I2C EEPROM block that was
+		    // being processed when the out-of-sequence address was
+		    // encountereed.
+                    I2C_byte_address(eeprom_address_index, 2);
+                    for (i=0; i<64; i++) {
+		      I2C_write_byte(parse_tail[i]);
+		    }
+                    I2C_stop();
+                    wait_timer(5000); // Wait 5ms
+                    IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+		    
+                    // Validate data in I2C EEPROM
+		    if (file_type == FILETYPE_PROGRAM) {
+                      prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
+		    }
+		    if (file_type == FILETYPE_STRING) {
+                      prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
+		    }
+		    
+		    I2C_last_flag = 0;
+                    for (i=0; i<64; i++) {
+                      if (i == 63) I2C_last_flag = 1;
+                      temp_byte = I2C_read_byte(I2C_last_flag);
+                       if (temp_byte != parse_tail[i]) {
+                         upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
 // UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
-                      pSocket->ParseState = PARSE_FILE_FAIL;
-                      break; // Break out of the local while loop
+                         pSocket->ParseState = PARSE_FILE_FAIL;
+                         break; // Break out of the local while loop
+                      }
                     }
                   }
-                }
-	      }
+		}
+#endif // SREC_UPLOAD_PIPELINE == 1
 	      
-	      if (parse_index == 64 && data_count != 0) {
-	        // Hit end of parse_tail but still have data to read from this
-	        // SREC. Read the next 64 bytes from the I2C EEPROM into parse_tail,
-	        // and continue writing the incoming SREC data into the
-	        // parse_tail starting at byte [0]. When the end of the SREC
-	        // data is reached write the parse_tail to the I2C EEPROM.
-	        
-	        // Point to next block in I2C EEPROM
-	        eeprom_address_index += 64;
+		// Go to the non-sequential data processing
+                pSocket->ParseState = PARSE_FILE_NONSEQ;
+                // Clear byte_tail for subsequent reads
+                byte_tail[0] = '\0';
+                byte_tail[1] = '\0';
 		
-                // Read the next existing I2C EEPROM data into parse_tail
-	        if (file_type == FILETYPE_PROGRAM) {
-                  prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
-		}
-	        if (file_type == FILETYPE_STRING) {
-                  prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
-		}
+		// Set "address" to be equal to "new_address"
+		address = new_address;
 		
-	        for (i=0; i<63; i++) {
-	          parse_tail[i] = I2C_read_byte(0);
-	        }
-	        parse_tail[63] = I2C_read_byte(1);
+		// Indicate initial detection of the non-sequential data.
+		// This is used to allow the processing to be re-entrant
+		// should TCP Fragmentation occur.
+		non_sequential_detect = 1;
+		
+		break;
+	      }
+	    }
+	  }
+	
+          if (file_nBytes == 0) {
+            // We just read the last character in this packet. Break out
+            // of the local while loop so the next packet will be read.
+            break;
+          }
+	  
+	  if (parse_file_time_start > (second_counter + 60)) {
+	    // If a timeout occurs assume the connection is too poor to
+	    // complete the file transfer and simply abort the connection.
+            pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
+#endif // DEBUG_SUPPORT == 15
+	    break; // Break out of the local while loop
+	  }
+	} // End of local while() loop
+      }
+
+      if (pSocket->ParseState == PARSE_FILE_SEQUENTIAL) {
+	// This parse is entered knowing that the next two characters are a
+	// data byte.
+	while (1) {
+          // Read two characters from the SREC
+          pBuffer = read_two_characters(pBuffer);
+          if (byte_tail[0] == '\0') {
+	    // No characters were found. This can occur when an end of
+	    // packet occurs during a CRLF sequence. The read attempt will
+	    // have set file_nBytes to zero. Break out of the local while
+	    // loop so that the next packet will be read.
+	    break;
+	  }
+          if (byte_tail[1] == '\0') {
+            // We only found 1 character so we just read the last character
+	    // in this packet. The read_two_characters() function will have
+	    // set file_nBytes to zero. Break out of the local while loop so
+	    // the next packet will be read.
+            break;
+          }
+	
+	  // If we didn't break out then we successfully read two characters
+          data_value = two_hex2int(byte_tail[0], byte_tail[1]);
+          checksum += data_value;
+          data_count--;
+          // Clear byte_tail for subsequent reads
+          byte_tail[0] = '\0';
+          byte_tail[1] = '\0';
+	  
+	  if (data_count > 0) {
+	    // Copy data to parse_tail
+	    parse_tail[parse_index++] = data_value;
+	    address++; // Increment the incoming address counter
+	  }
+	  
+	  if (data_count == 0) {
+	    // We just read the last byte in this SREC. The byte just read
+	    // was the checksum. Check for validity.
+	    if (checksum != 0xff) {
+	      // Handle Checksum Error
+              upgrade_failcode = UPGRADE_FAIL_FILE_READ_CHECKSUM;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_FILE_READ_CHECKSUM\r\n");
+              pSocket->ParseState = PARSE_FILE_FAIL;
+              break; // Break out of the local while loop
+	    }
+	  }
+	
+#if SREC_UPLOAD_PIPELINE == 1
+	  if (parse_index == 64) {
+	    // Start the write of parse_tail to the I2C EEPROM. The write
+	    // completes while the following SREC data is parsed.
+	    upload_page_write(eeprom_address_index);
+            eeprom_address_index += 64;
+	  }
+#else // SREC_UPLOAD_PIPELINE == 0
+	  if (parse_index == 64 && file_type == FILETYPE_PROGRAM) {
+	    // Copy parse_tail to I2C EEPROM0
+	    
+            // Write the 64 bytes of data that are in the parse_tail array
+            // into the I2C EEPROM.
+            {
+              int i;
+              uint8_t I2C_last_flag;
+              uint8_t temp_byte;
+              
+              I2C_control(I2C_EEPROM0_WRITE); // Send Write Control Byte
+              I2C_byte_address(eeprom_address_index, 2);
+              for (i=0; i<64; i++) {
+                I2C_write_byte(parse_tail[i]);
+              }
+              I2C_stop();
+              wait_timer(5000); // Wait 5ms
+              IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+              // Validate data in I2C EEPROM
+              prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
+	      I2C_last_flag = 0;
+              for (i=0; i<64; i++) {
+                if (i == 63) I2C_last_flag = 1;
+                temp_byte = I2C_read_byte(I2C_last_flag);
+                if (temp_byte != parse_tail[i]) {
+                  upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
+                  pSocket->ParseState = PARSE_FILE_FAIL;
+                  break; // Break out of the local while loop
+                }
+              }
+              eeprom_address_index += 64;
+            }
+          }
+	
+	  if (parse_index == 64 && file_type == FILETYPE_STRING) {
+	    // Copy parse_tail to I2C EEPROM2
+	    
+            // Write the 64 bytes of data that are in the parse_tail array
+            // into the I2C EEPROM.
+            {
+              int i;
+              uint8_t I2C_last_flag;
+              uint8_t temp_byte;
+              
+              I2C_control(I2C_EEPROM2_WRITE); // Send Write Control Byte
+              I2C_byte_address(eeprom_address_index, 2);
+              for (i=0; i<64; i++) {
+                I2C_write_byte(parse_tail[i]);
+              }
+              I2C_stop();
+              wait_timer(5000); // Wait 5ms
+              IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+              // Validate data in I2C EEPROM
+              prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
+	      I2C_last_flag = 0;
+              for (i=0; i<64; i++) {
+                if (i == 63) I2C_last_flag = 1;
+                temp_byte = I2C_read_byte(I2C_last_flag);
+                if (temp_byte != parse_tail[i]) {
+                  upgrade_failcode = STRING_EEPROM_MISCOMPARE;
+// UARTPrintf("UPGRADE_FAILCODE = STRING_EEPROM_MISCOMPARE\r\n");
+                  pSocket->ParseState = PARSE_FILE_FAIL;
+                  break; // Break out of the local while loop
+                }
+              }
+              eeprom_address_index += 64;
+            }
+	  }
+#endif // SREC_UPLOAD_PIPELINE == 1
+
+	  if (parse_index == 64) {
+	    // This is just a cleanup routine to make debug easier. This
+	    // will zero out the parse_tail array so that subsequent writes
+	    // to parse tail that end before filling it will be followed by
+	    // zeroes.
+	    for (i=0; i<64; i++) parse_tail[i] = 0;
+	    parse_index = 0; // Clear for next data
+	  }
+	  
+	  if (data_count == 0) {
+            // Go on to read next SREC
+            byte_index = 0;
+            pSocket->ParseState = PARSE_FILE_SEEK_SX;
+            break;
+	  }
+	
+          if (file_nBytes == 0) {
+            // We just read the last character in this packet. Break out
+            // of the local while loop so the next packet will be read.
+            break;
+          }
+	  
+	  if (parse_file_time_start > (second_counter + 60)) {
+	    // If a timeout occurs assume the connection is too poor to
+	    // complete the file transfer and simply abort the connection.
+            pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
+#endif // DEBUG_SUPPORT == 15
+	    break; // Break out of the local while loop
+	  }
+	} // End of local while() loop
+      }
+
+
+      if (pSocket->ParseState == PARSE_FILE_NONSEQ) {
+        // This is a case where the new_address is not sequential with the
+	// previous adddress.
+	//
+	// If this occurs then only the data in the SREC is copied to the I2C
+	// EEPROM, but it requires reading the existing data from the I2C EEPROM
+	// then inserting the new SREC data into the existing I2C EEPROM data.
+	//
+        // The "address" and "eeprom_address_index" values will be updated
+	// according to the addressing values needed by this special case,
+	// causing all new SREC addresses to be treated as non-sequential
+	// until they start becoming sequential again.
+	//
+	// WHAT IF THE NON-SEQUENTIAL DATA OCCUPIES MORE THAN ONE SREC?
+	// If the additional SRECs are sequential relative to the first non-
+	// sequential address encountered they will be handled by the seq-
+	// uential data processing routine. If the next SREC is non-sequen-
+	// tial this routine will run again.
+	//
+	// WHAT IF THE NON-SEQUENTIAL SREC STARTS AT A POINT OTHER THAN 0
+	// RELATIVE TO THE 64 BYTE WRITES TO I@C EEPROM?
+	// This is actually the typical case, so the code needs to read the
+	// existing data from the I2C EEPROM to preserve previously written
+	// data, then an offset is calculated to determine the point that
+	// new SREC data needs to start within the existing EEPROM data.
+	// a) The data to read from the I2C EEPROM is the 64 bytes starting at
+	//    ((new_address - 0x8000) & 0xFFC0).
+	// b) The offset into this data for writing the new data is
+	//    (new_address & 0x003F).
+	// NOTE: (a) and (b) are performed only once at the initial detect-
+	// ion of a non-sequential SREC case. The "non_sequential_detect"
+	// flag is used to manage this. This is necessary as TCP Fragmenta-
+	// tion may cause the process to be re-entered.
+	// c) Read the incoming SREC and write the contents to parse_tail.
+	//    If the end of parse_tail is reached or the end of the SREC is
+	//    reached write the parse_tail to the I2C EEPROM.
+	// d) If the end of the parse_tail is reached but there is still
+	//    data in the incoming SREC then read the next 64 bytes from the
+	//    I2C EEPROM into parse_tail, and continue writing the incoming SREC
+	//    data into the parse_tail starting at byte [0].
+	//    When the end of the SREC is reached write the parse_tail to
+	//    the I2C EEPROM.
+	// e) Exit comments: "address" and "eeprom_address_index" never get
+	//    changed in this process so when this parsing completes we will
+	//    go on to reading the next SREC. If that next SREC has a
+	//    new_address lower than the current address the non-sequential
+	//    process repeats. Otherwise the regular read SREC process runs.
+	
+        // Why not use the above technique for every SREC?
+	// Because it would result in twice as many writes to the I2C EEPROM
+	// taking a lot longer to do the programming. Twice as many writes
+	// will occur because it is typical for the incoming data to be
+	// skewed relative to the 64 byte writes to the I2C EEPROM, and the
+	// incoming SREC data is in 32 byte blocks as opposed to the 64 byte
+	// blocks being written to the I2C EEPROM.
+      
+	if (non_sequential_detect == 1) {
+	  // Calculate the starting index of the I2C EEPROM block
+	  eeprom_address_index = (new_address - 0x8000) & 0xFFC0;
+	  
+#if SREC_UPLOAD_PIPELINE == 1
+	  // The block may be the one still being written
+	  upload_page_verify();
+#endif // SREC_UPLOAD_PIPELINE == 1
+	  
+	  // Read the existing I2C EEPROM data into parse_tail
+	  if (file_type == FILETYPE_PROGRAM) {
+            prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
+          }
+	  if (file_type == FILETYPE_STRING) {
+            prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
+          }
+	  
+	  for (i=0; i<63; i++) {
+            parse_tail[i] = I2C_read_byte(0);
+          }
+          parse_tail[63] = I2C_read_byte(1);
+	  
+	  // Set the offset into parse_tail for the new data.
+          parse_index = (uint8_t)(new_address & 0x003F);
+	  
+	  // Clear initial detect flag so this "if" section will be bypassed
+	  // if the code is re-entered due to handle TCP Fragmentation.
+	  non_sequential_detect = 0;
+	}
+	
+	// This parse is entered knowing that the next two characters are a
+	// data byte, and that all the data of interest is contained in a
+	// single incoming SREC.
+	
+	while (1) {
+          // Read two characters from the data line
+          pBuffer = read_two_characters(pBuffer);
+          if (byte_tail[0] == '\0') {
+	    // No characters were found. This can occur when an end of
+	    // packet occurs during a CRLF sequence. The read attempt will
+	    // have set file_nBytes to zero. Break out of the local while
+	    // loop so that the next packet will be read.
+	    break;
+	  }
+          if (byte_tail[1] == '\0') {
+            // We only found 1 character so we just read the last character
+	    // in this packet. The read_two_characters() function will have
+	    // set file_nBytes to zero. Break out of the local while loop so
+	    // the next packet will be read.
+            break;
+          }
+	
+	  // If we didn't break out then we successfully read two characters
+          data_value = two_hex2int(byte_tail[0], byte_tail[1]);
+          checksum += data_value;
+	  data_count--;
+          // Clear byte_tail for subsequent reads
+          byte_tail[0] = '\0';
+          byte_tail[1] = '\0';
+	  
+	  if (data_count > 0) {
+	    // Copy data to parse_tail
+	    parse_tail[parse_index++] = data_value;
+	    address++; // Increment the incoming address counter
+	  }
+	  
+	  if (data_count == 0) {
+	    // We just read the last byte in this SREC. The byte just read
+	    // was the checksum. Check for validity.
+	    if (checksum != 0xff) {
+	      // Handle Checksum Error
+              upgrade_failcode = UPGRADE_FAIL_FILE_READ_CHECKSUM;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_FILE_READ_CHECKSUM\r\n");
+              pSocket->ParseState = PARSE_FILE_FAIL;
+              break; // Break out of the local while loop
+	    }
+	    else {
+	    }
+	  }
+	  
+#if SREC_UPLOAD_PIPELINE == 1
+	  if (data_count == 0 || parse_index == 64) {
+            // Write the data in the parse_tail array into the I2C
+	    // EEPROM.
+	    upload_page_write(eeprom_address_index);
+	  }
+#else // SREC_UPLOAD_PIPELINE == 0
+	  if (data_count == 0 || parse_index == 64) {
+            // Copy parse_tail to I2C EEPROM0
 	    
-	        // The local while loop continues to finish reading the incoming
-	        // SREC.
-	      }
+            // Write the data in the parse_tail array into the I2C
+	    // EEPROM.
+            {
+              int i;
+              uint8_t I2C_last_flag;
+              uint8_t temp_byte;
 	      
-	      if (parse_index == 64) {
-	        parse_index = 0; // Clear for next data
+	      if (file_type == FILETYPE_PROGRAM) {
+                I2C_control(I2C_EEPROM0_WRITE); // Send Write Control Byte
 	      }
-	      
-	      if (data_count == 0) {
-                // Go on to read next SREC
-                byte_index = 0;
-                pSocket->ParseState = PARSE_FILE_SEEK_SX;
-                break;
+	      if (file_type == FILETYPE_STRING) {
+                I2C_control(I2C_EEPROM2_WRITE); // Send Write Control Byte
 	      }
 	      
-              if (file_nBytes == 0) {
-                // We just read the last character in this packet. Break out
-                // of the local while loop so the next packet will be read.
-                break;
+              I2C_byte_address(eeprom_address_index, 2);
+              for (i=0; i<64; i++) {
+                I2C_write_byte(parse_tail[i]);
               }
+              I2C_stop();
+              wait_timer(5000); // Wait 5ms
+              IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+	      
+              // Validate data in I2C EEPROM
+	      if (file_type == FILETYPE_PROGRAM) {
+                prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
+	      }
+	      if (file_type == FILETYPE_STRING) {
+                prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
+	      }
 	      
-	      if (parse_file_time_start > (second_counter + 60)) {
-	        // If a timeout occurs assume the connection is too poor to
-	        // complete the file transfer and simply abort the connection.
-                pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
+	      I2C_last_flag = 0;
+              for (i=0; i<64; i++) {
+                if (i == 63) I2C_last_flag = 1;
+                temp_byte = I2C_read_byte(I2C_last_flag);
+                if (temp_byte != parse_tail[i]) {
+                  upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
+                  pSocket->ParseState = PARSE_FILE_FAIL;
+                  break; // Break out of the local while loop
+                }
+              }
+            }
+	  }
+#endif // SREC_UPLOAD_PIPELINE == 1
+	  
+	  if (parse_index == 64 && data_count != 0) {
+	    // Hit end of parse_tail but still have data to read from this
+	    // SREC. Read the next 64 bytes from the I2C EEPROM into parse_tail,
+	    // and continue writing the incoming SREC data into the
+	    // parse_tail starting at byte [0]. When the end of the SREC
+	    // data is reached write the parse_tail to the I2C EEPROM.
+	    
+	    // Point to next block in I2C EEPROM
+	    eeprom_address_index += 64;
+	    
+#if SREC_UPLOAD_PIPELINE == 1
+	    upload_page_verify();
+#endif // SREC_UPLOAD_PIPELINE == 1
+	    
+            // Read the next existing I2C EEPROM data into parse_tail
+	    if (file_type == FILETYPE_PROGRAM) {
+              prep_read(I2C_EEPROM0_WRITE, I2C_EEPROM0_READ, eeprom_address_index, 2);
+	    }
+	    if (file_type == FILETYPE_STRING) {
+              prep_read(I2C_EEPROM2_WRITE, I2C_EEPROM2_READ, eeprom_address_index, 2);
+	    }
+	    
+	    for (i=0; i<63; i++) {
+	      parse_tail[i] = I2C_read_byte(0);
+	    }
+	    parse_tail[63] = I2C_read_byte(1);
+	
+	    // The local while loop continues to finish reading the incoming
+	    // SREC.
+	  }
+	  
+	  if (parse_index == 64) {
+	    parse_index = 0; // Clear for next data
+	  }
+	  
+	  if (data_count == 0) {
+            // Go on to read next SREC
+            byte_index = 0;
+            pSocket->ParseState = PARSE_FILE_SEEK_SX;
+            break;
+	  }
+	  
+          if (file_nBytes == 0) {
+            // We just read the last character in this packet. Break out
+            // of the local while loop so the next packet will be read.
+            break;
+          }
+	  
+	  if (parse_file_time_start > (second_counter + 60)) {
+	    // If a timeout occurs assume the connection is too poor to
+	    // complete the file transfer and simply abort the connection.
+            pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
 #endif // DEBUG_SUPPORT == 15
-	        break; // Break out of the local while loop
-	      }
-	    } // End of local while loop
+	    break; // Break out of the local while loop
 	  }
-	
+	} // End of local while loop
+      }
+    
 
-          if (pSocket->ParseState == PARSE_FILE_FAIL) {
-            // Abort parsing.
-	    // Enter a loop that will allow the Browser to finish sending
-	    // whatever it was sending.
+      if (pSocket->ParseState == PARSE_FILE_FAIL) {
+        // Abort parsing.
+	// Enter a loop that will allow the Browser to finish sending
+	// whatever it was sending.
 
 // UARTPrintf("Entered PARSE_FILE_FAIL file_length = ");
 // emb_itoa(file_length, OctetArray, 10, 6);
@@ -9566,58 +12965,30 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 // UARTPrintf("PARSE_FILE_FAIL\r\n");
 #endif // DEBUG_SUPPORT == 15
 
-	    while (file_length > 0) {
-	      // Use the read_two_characters() function to deplete the incoming
-	      // packets. Once file_length reaches zero we've received all
-	      // packets.
-	      // Note that if we "break" it allows the program to fetch another
-	      // packet and then we return to this routine to read and deplete
-	      // that packet.
-	      // Also note that when file_length reaches zero file_nBytes should
-	      // also be zero if all is working correctly.
-	      
-              // Read two characters from the data line
-              pBuffer = read_two_characters(pBuffer);
-              IWDG_KR = 0xaa; // Prevent the IWDG from firing.
-	      if (file_length == 0) {
-	        // All packets read.
-                break; // Break out of the local while loop
-              }
-	      
-              if (file_nBytes == 0) {
-                // The read_two_characters() function will set file_nBytes to
-	        // zero if an end of packet occurred. If so break out of the
-	        // local while loop so the next packet will be read.
-                break; // Break out of the local while loop
-	      }
-	      
-	      if (parse_file_time_start > (second_counter + 60)) {
-	        // If a timeout occurs assume the connection is too poor to
-	        // complete the file transfer and simply abort the connection.
-                pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
-#endif // DEBUG_SUPPORT == 15
-	        break; // Break out of the local while loop
-	      }
-	    } // End of local while loop
-	    
-	    if (file_length == 0) {
-	      // All packets read. Go on to the PARSE_FILE_FAIL_EXIT routine.
-	      pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
-            }
-	  }
-
+	while (file_length > 0) {
+	  // Use the read_two_characters() function to deplete the incoming
+	  // packets. Once file_length reaches zero we've received all
+	  // packets.
+	  // Note that if we "break" it allows the program to fetch another
+	  // packet and then we return to this routine to read and deplete
+	  // that packet.
+	  // Also note that when file_length reaches zero file_nBytes should
+	  // also be zero if all is working correctly.
+	  
+          // Read two characters from the data line
+          pBuffer = read_two_characters(pBuffer);
+          IWDG_KR = 0xaa; // Prevent the IWDG from firing.
 	  if (file_length == 0) {
 	    // All packets read.
-	    break; // Break out of main while loop
+            break; // Break out of the local while loop
           }
 	  
           if (file_nBytes == 0) {
-            // We just read the last character in this packet. Break out
-            // of the main while loop so the next packet will be read.
-            break; // Break out of main while loop
-          }
+            // The read_two_characters() function will set file_nBytes to
+	    // zero if an end of packet occurred. If so break out of the
+	    // local while loop so the next packet will be read.
+            break; // Break out of the local while loop
+	  }
 	  
 	  if (parse_file_time_start > (second_counter + 60)) {
 	    // If a timeout occurs assume the connection is too poor to
@@ -9626,264 +12997,282 @@ rexmit_count = 0; // Used only for sending the rexmit count via UART
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
 #endif // DEBUG_SUPPORT == 15
-	    break; // Break out of the main while loop
+	    break; // Break out of the local while loop
 	  }
-        } // End of main while loop
-      }
-    
-      if (pSocket->ParseState == PARSE_FILE_COMPLETE && file_type == FILETYPE_PROGRAM) {
-        // All data is now in I2C EEPROM0. Signal the main.c loop to
-	// copy the data to Flash and display a Timer window to have the
-	// user wait until Flash programming completes and the module reboots.
-
-#if DEBUG_SUPPORT == 15
-// UARTPrintf("Sending Copy EEPROM to Flash request\r\n");
-#endif // DEBUG_SUPPORT == 15
-
-	eeprom_copy_to_flash_request = I2C_COPY_EEPROM0_REQUEST;
-        pSocket->nParseLeft = 0;
-	
-	pSocket->current_webpage = WEBPAGE_TIMER;
-        pSocket->pData = g_HtmlPageTimer;
-        pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageTimer) - 1);
-	
-	// Send the response
-        pSocket->nPrevBytes = 0xFFFF;
-        pSocket->nState = STATE_SENDHEADER200;
-      }
-
-
-      if (pSocket->ParseState == PARSE_FILE_COMPLETE && file_type == FILETYPE_STRING) {
-        // All data is now in I2C EEPROM2.
-	// Display the Upload Complete GUI.
-        pSocket->nDataLeft = 0;
-        pSocket->nParseLeft = 0;
+	} // End of local while loop
 	
-	pSocket->current_webpage = WEBPAGE_UPLOAD_COMPLETE;
-        pSocket->pData = g_HtmlPageUploadComplete;
-        pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageUploadComplete) - 1);
-	
-        // Send the response
-        pSocket->nPrevBytes = 0xFFFF;
-        pSocket->nState = STATE_SENDHEADER200;
-      }
-
-
-      if ((file_length < 2)
-       && (pSocket->ParseState != PARSE_FILE_COMPLETE)
-       && (pSocket->ParseState != PARSE_FILE_FAIL_EXIT)) {
-        // If we are at the end of the file
-	// AND we have not hit PARSE_FILE_COMPLETE (which occurs when an S7
-	//   record is processed)
-	// AND we have not already encountered a PARSE_FILE_FAIL_EXIT
-	// then something else has gone wrong.
-        upgrade_failcode = UPGRADE_FAIL_TRUNCATED_FILE;
-	      
-// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_TRUNCATED_FILE\r\n");
-
-        pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
-      }
-
-
-      if (pSocket->ParseState == PARSE_FILE_FAIL_EXIT) {
-        // Parsing aborted. Display a GUI with the fail reason code.
-
-// UARTPrintf("\r\n");
-// UARTPrintf("Parse FAIL XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX");
-// UARTPrintf("\r\n");
-
-	// Display the fail reason and tell the user to try again.
-        pSocket->nParseLeft = 0;
-	pSocket->current_webpage = WEBPAGE_PARSEFAIL;
-        pSocket->pData = g_HtmlPageParseFail;
-        pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageParseFail) - 1);
-	// Send the response
-        pSocket->nPrevBytes = 0xFFFF;
-        pSocket->nState = STATE_SENDHEADER200;
-      }
-    }
-#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
-
-
-
-
-
-
-
-
-
-    if (pSocket->nState == STATE_SENDHEADER200) {
-      // This step is entered after HTTP request processing is complete in
-      // order to copy an appropriate web page into the body of the reply
-      // to the request.
-      // This step is entered after:
-      //   a) GET processing is complete and a webpage is to be displayed in
-      //      response to the GET.
-      //   b) The Code Uploader has completed processing a file upload.
-      //      Various webpages can be displayed depending on the error status
-      //      of the file upload.
-      // In the uip_send() call we provide the CopyHttpHeader function with
-      // the length of the web page.
-      // Some GET requests do not send a webpage response (just a 200 header
-      // with Content-Length = 0). In those cases STATE_SENDHEADER204 will
-      // have been entered from GET processing (see below).
-      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, adjust_template_size(pSocket), HEADER200));
-      pSocket->nState = STATE_SENDDATA;
-      return;
-    }
-      
-    if (pSocket->nState == STATE_SENDHEADER204) {
-      // This step is entered after HTTP request processing is complete in
-      // in order to copy an "empty" web page into the body of the reply to
-      // the request.
-      // This step is entered after:
-      //   a) POST is complete.
-      //      OR
-      //   b) GET processing is complete and no webpage is to be displayed in
-      //      response to the GET.
-      // In both of these cases we only copy a header with Content_Length: 0
-      // and no data into the body of the reply to the GET or POST.
-      //
-      // Note: In this application a POST is only generated by a IOControl or
-      // Configuration page. STATE_SENDHEADER204 will copy the 200 header into
-      // the body of the reply to the POST with Content-Length = 0. Also note
-      // that the javascript in the IOControl and Configurationose pages will
-      // generate a GET request to update the Browser after the POST is
-      // complete.
-      //
-      // Note: It is not clear if some browsers require a "204 No Content"
-      // header. This appears to work just returning a "200 OK" with Content
-      // Length: 0, which is what actually happens in this application.
-
-#if RESPONSE_LOCK_SUPPORT == 1
-      // A special case when SENDHEADER_204 is requested is the case where the
-      // Response Lock is turned on. In this case we don't want to send
-      // anyting at all, not even the header. This makes it appear that the
-      // webserver does not exist, helping to make the device a little more
-      // secure.
-      if ((stored_options1 & 0x40) == 0x40) {
-        pSocket->nDataLeft = 0;
-        pSocket->nState = STATE_NULL;
-      }
-#endif // RESPONSE_LOCK_SUPPORT == 1
-
-#if RESPONSE_LOCK_SUPPORT == 1
-      else {
-#endif // RESPONSE_LOCK_SUPPORT == 1
-      // Send a 200 response with length 0
-      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, 0, HEADER200));
-      // Clear nDataLeft and go to STATE_SENDDATA, but only to close
-      // connection.
-      pSocket->nDataLeft = 0;
-      pSocket->nState = STATE_SENDDATA;
-#if RESPONSE_LOCK_SUPPORT == 1
-      }
-#endif // RESPONSE_LOCK_SUPPORT == 1
-      return;
-    }
-    
-    if (pSocket->nState == STATE_SENDHEADER429) {
-      // This is a special case where two GET requests have arrived in
-      // parallel from two different Browsers (or Tabs). We can only allow one
-      // at a time, so the second arrival is rejected with a 429 response.
-      // The 429 response has no webpage response (just a 429 header with
-      // Content-Length = 0 and Retry-After set to 10 seconds).
-      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, 0, HEADER429));
-      pSocket->nState = STATE_SENDDATA;
-      return;
-    }
-      
-
-    senddata:
-    if (pSocket->nState == STATE_SENDDATA) {
-      // We have sent the HTML Header or HTML Data previously. Now we send
-      // data using the CopyHttpData() function as a pre-processor, and the
-      // uip_send() function to actually copy data from the internal buffer
-      // to the ENC28J60 hardware.
-      // Data is always sent at the end of a "uip_newdata()" as a response to
-      // a Browser request.
-      // When transmitting data to the Browser there may be more data than
-      // will fit in one packet. For instance transmitting one of the Webpage
-      // templates can easily take 10 or more transmit packets. So, additional
-      // data (if any) will be sent on return to this function in response to
-      // "uip_acked()". Whether or not there is additional data to send in a
-      // series of packets is tracked in the nDataLeft variable.
-      // If there is no data to send, or if all data has been sent, we close
-      // the connection.
-      if (pSocket->nDataLeft == 0) {
-        // There is no data to send. Close connection
-        nBufSize = 0;
-      }
-      else {
-        // Copy data to buffer
-        pSocket->nPrevBytes = pSocket->nDataLeft;
-        nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss(), pSocket);
-        pSocket->nPrevBytes -= pSocket->nDataLeft;
+	if (file_length == 0) {
+	  // All packets read. Go on to the PARSE_FILE_FAIL_EXIT routine.
+	  pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
+        }
       }
 
-      if (nBufSize == 0) {
-        //No Data has been copied (or there was none to send). Close connection
-        uip_close();
+      if (file_length == 0) {
+	// All packets read.
+	break; // Break out of main while loop
       }
-      else {
-        //Else send copied data
-        uip_send(uip_appdata, nBufSize);
+      
+      if (file_nBytes == 0) {
+        // We just read the last character in this packet. Break out
+        // of the main while loop so the next packet will be read.
+        break; // Break out of main while loop
       }
       
-      return;
-    }
+      if (parse_file_time_start > (second_counter + 60)) {
+	// If a timeout occurs assume the connection is too poor to
+	// complete the file transfer and simply abort the connection.
+        pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
+#if DEBUG_SUPPORT == 15
+// UARTPrintf("Timeout: goto PARSE_FILE_FAIL_EXIT\r\n");
+#endif // DEBUG_SUPPORT == 15
+	break; // Break out of the main while loop
+      }
+    } // End of main while loop
   }
-  
-  else if (uip_rexmit()) {
+
+  if (pSocket->ParseState == PARSE_FILE_COMPLETE && file_type == FILETYPE_PROGRAM) {
+    // All data is now in I2C EEPROM0. Signal the main.c loop to
+    // copy the data to Flash and display a Timer window to have the
+    // user wait until Flash programming completes and the module reboots.
 
 #if DEBUG_SUPPORT == 15
-// Debug notes:
-// This debug needs to be kept for looking into problems with delays in
-// browser updates and browser lockups.
-if (rexmit_count == 0) UARTPrintf("\r\n");
-rexmit_count++;
-UARTPrintf("Re-xmit count = ");
-emb_itoa(rexmit_count, OctetArray, 10, 5);
-UARTPrintf(OctetArray);
-UARTPrintf("\r\n");
+// UARTPrintf("Sending Copy EEPROM to Flash request\r\n");
 #endif // DEBUG_SUPPORT == 15
 
-    if (pSocket->nPrevBytes == 0xFFFF) {
-      // Send header again
-      uip_send(uip_appdata, CopyHttpHeader(uip_appdata, adjust_template_size(pSocket), HEADER200));
+    eeprom_copy_to_flash_request = I2C_COPY_EEPROM0_REQUEST;
+    pSocket->nParseLeft = 0;
+    
+    pSocket->current_webpage = WEBPAGE_TIMER;
+    pSocket->pData = g_HtmlPageTimer;
+    pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageTimer) - 1);
+    
+    // Send the response
+    pSocket->nPrevBytes = 0xFFFF;
+    pSocket->nState = STATE_SENDHEADER200;
+  }
+
+
+  if (pSocket->ParseState == PARSE_FILE_COMPLETE && file_type == FILETYPE_STRING) {
+    // All data is now in I2C EEPROM2.
+    // Display the Upload Complete GUI.
+    pSocket->nDataLeft = 0;
+    pSocket->nParseLeft = 0;
+    
+    pSocket->current_webpage = WEBPAGE_UPLOAD_COMPLETE;
+    pSocket->pData = g_HtmlPageUploadComplete;
+    pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageUploadComplete) - 1);
+    
+    // Send the response
+    pSocket->nPrevBytes = 0xFFFF;
+    pSocket->nState = STATE_SENDHEADER200;
+  }
+
+
+  if ((file_length < 2)
+   && (pSocket->ParseState != PARSE_FILE_COMPLETE)
+   && (pSocket->ParseState != PARSE_FILE_FAIL_EXIT)) {
+    // If we are at the end of the file
+    // AND we have not hit PARSE_FILE_COMPLETE (which occurs when an S7
+    //   record is processed)
+    // AND we have not already encountered a PARSE_FILE_FAIL_EXIT
+    // then something else has gone wrong.
+    upgrade_failcode = UPGRADE_FAIL_TRUNCATED_FILE;
+	  
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_TRUNCATED_FILE\r\n");
+
+    pSocket->ParseState = PARSE_FILE_FAIL_EXIT;
+  }
+
+
+  if (pSocket->ParseState == PARSE_FILE_FAIL_EXIT) {
+    // Parsing aborted. Display a GUI with the fail reason code.
+
+// UARTPrintf("\r\n");
+// UARTPrintf("Parse FAIL XXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXXX");
+// UARTPrintf("\r\n");
+
+    // Display the fail reason and tell the user to try again.
+    pSocket->nParseLeft = 0;
+    pSocket->current_webpage = WEBPAGE_PARSEFAIL;
+    pSocket->pData = g_HtmlPageParseFail;
+    pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageParseFail) - 1);
+    // Send the response
+    pSocket->nPrevBytes = 0xFFFF;
+    pSocket->nState = STATE_SENDHEADER200;
+  }
+}
+
+#if RAW_UPLOAD_SUPPORT == 1
+void raw_upload_call(void)
+{
+  // Raw TCP upload on RAW_UPLOAD_PORT. The client sends the length of the
+  // file as 4 bytes (big endian) followed by the file itself (a .sx file,
+  // or a .nmb image with BINARY_UPLOAD_SUPPORT). The file goes through
+  // parsefile() exactly as a browser upload does, but without the HTTP and
+  // multi-part boundary parsing. The module replies with one line, "OK" or
+  // "FAIL nn" where nn is the upgrade_failcode, then closes the connection.
+  // A Program file is copied to Flash by the main loop after the reply is
+  // sent, as for a browser upload.
+  // The file parsing variables are shared, so only one upload connection
+  // is accepted at a time.
+  struct tHttpD* pSocket;
+  uint8_t* pBuffer;
+  uint16_t nBytes;
+  
+  pSocket = &raw_upload_socket;
+  
+  if (uip_connected()) {
+    if (raw_upload_conn != NULL
+     && raw_upload_conn != uip_conn
+     && (raw_upload_conn->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+      // An upload is already in progress
+      uip_abort();
+      return;
     }
-    else {
-      // The pData pointer needs to be moved back by the number of bytes
-      // consumed from the webpage template.
-      pSocket->pData -= pSocket->nPrevBytes;
-      
-#if OB_EEPROM_SUPPORT == 1
-      // A similar adjustment is required for off_board_eeprom_index when
-      // the webpage is sourced from I2C EEPROM.
-      off_board_eeprom_index -= pSocket->nPrevBytes;
-#endif // OB_EEPROM_SUPPORT == 1
-      
-      pSocket->nDataLeft += pSocket->nPrevBytes;
-      pSocket->nPrevBytes = pSocket->nDataLeft;
-      nBufSize = CopyHttpData(uip_appdata, &pSocket->pData, &pSocket->nDataLeft, uip_mss(), pSocket);
-      pSocket->nPrevBytes -= pSocket->nDataLeft;
-      
-      if (nBufSize == 0) {
-        //No Data has been copied. Close connection
-        uip_close();
-      }
-      else {
-        //Else send copied data
-        uip_send(uip_appdata, nBufSize);
+    raw_upload_conn = uip_conn;
+    raw_upload_start = second_counter;
+    upload_init();
+    file_length = 0;
+    pSocket->nState = STATE_CONNECTED;
+    pSocket->nParseLeft = 0; // Counts the length bytes received
+  }
+  
+  if (uip_conn != raw_upload_conn) {
+    uip_abort();
+    return;
+  }
+  
+#if PERIODIC_WORK_FLAGS == 1
+  // Keep the connection in the periodic polls for the timeout below
+  uip_poll_due();
+#endif // PERIODIC_WORK_FLAGS == 1
+
+  if (uip_closed() || uip_aborted() || uip_timedout()) {
+    raw_upload_conn = NULL;
+    return;
+  }
+  
+  if (uip_newdata() && pSocket->nState != STATE_SENDDATA) {
+    pBuffer = uip_appdata;
+    nBytes = uip_datalen();
+    // The idle timeout below counts from the last data received
+    raw_upload_start = second_counter;
+    
+    while (pSocket->nState == STATE_CONNECTED && nBytes > 0) {
+      file_length = (file_length << 8) | *pBuffer;
+      pBuffer++;
+      nBytes--;
+      pSocket->nParseLeft++;
+      if (pSocket->nParseLeft == 4) {
+        // Start parsing at the first character of the file
+        pSocket->nState = STATE_PARSEFILE;
+#if BINARY_UPLOAD_SUPPORT == 1
+        pSocket->ParseState = PARSE_FILE_SEEK_TYPE;
+#else // BINARY_UPLOAD_SUPPORT == 0
+        pSocket->ParseState = PARSE_FILE_SEEK_SX;
+#endif // BINARY_UPLOAD_SUPPORT == 1
+        pSocket->nParseLeft = 1;
+        if (file_length < 2 || file_length > 99999) {
+          upgrade_failcode = UPGRADE_FAIL_TRUNCATED_FILE;
+          pSocket->nState = STATE_SENDHEADER200;
+        }
       }
     }
-    return;
+    
+    if (pSocket->nState == STATE_PARSEFILE && nBytes > 0) {
+      // The search buffer is only used for the multi-part boundary, which
+      // is not present here.
+      parsefile(pSocket, pBuffer, nBytes, NULL);
+    }
+    
+    if (pSocket->nState == STATE_SENDHEADER200) {
+      // parsefile() is done. Send the reply.
+      pSocket->nState = STATE_SENDDATA;
+      uip_send(uip_appdata, raw_upload_status((char *)uip_appdata));
+    }
+  }
+  
+  else if (pSocket->nState == STATE_SENDDATA) {
+    if (uip_rexmit()) {
+      uip_send(uip_appdata, raw_upload_status((char *)uip_appdata));
+    }
+    else if (uip_acked()) uip_close();
+  }
+  
+  else if (uip_poll() && (uint32_t)(second_counter - raw_upload_start) > 60) {
+    // The client stopped sending. Free the upload for another connection.
+    raw_upload_conn = NULL;
+    uip_abort();
+  }
+}
+
+
+uint16_t raw_upload_status(char *pBuffer)
+{
+  // Writes the raw upload reply line to pBuffer and returns its length
+  if (upgrade_failcode == UPGRADE_OK) {
+    strcpy(pBuffer, "OK\r\n");
+    return 4;
   }
+  strcpy(pBuffer, "FAIL ");
+  emb_itoa(upgrade_failcode, OctetArray, 10, 2);
+  strcpy(pBuffer + 5, OctetArray);
+  strcpy(pBuffer + 7, "\r\n");
+  return 9;
 }
+#endif // RAW_UPLOAD_SUPPORT == 1
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
 
 
 
 #if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#if POST_STREAM_PARSE == 1
+void parsepost(struct tHttpD* pSocket, char *pBuffer, uint16_t nBytes) {
+  // This function parses data the user entered in the GUI.
+  //
+  // The POST data is read one byte at a time straight from the uip_buf and
+  // collected in parse_tail until the '&' that ends the POST component
+  // arrives. The complete component (with its '&') is then handed to
+  // parse_local_buf(), which stores the value in the Pending_ variables.
+  // A component cut by the end of a TCP Fragment stays in parse_tail until
+  // the next fragment arrives, so nothing is copied twice and no local_buf
+  // is needed on the stack. The last POST component "z00=0" has no '&' and
+  // is handed over as soon as its fifth byte arrives.
+  uint8_t j;
+  
+  j = (uint8_t)strlen((char *)parse_tail);
+  
+  while (nBytes != 0) {
+    if (j == sizeof(parse_tail) - 1) {
+      // A POST component longer than any the GUI sends. Abort the POST
+      // without setting parse_complete so that none of the changes are
+      // applied.
+      parse_tail[0] = '\0';
+      pSocket->nParseLeft = 0;
+      pSocket->nState = STATE_SENDHEADER204;
+      break;
+    }
+    parse_tail[j++] = *pBuffer;
+    parse_tail[j] = '\0';
+    pBuffer++;
+    nBytes--;
+    
+    if (parse_tail[j - 1] == '&'
+     || (j == 5 && strcmp((char *)parse_tail, "z00=0") == 0)) {
+      parse_local_buf(pSocket, (char *)parse_tail, j);
+      j = 0;
+      parse_tail[0] = '\0';
+      // parse_local_buf() ends the POST when it parses "z00=0" or finds
+      // an error.
+      if (pSocket->nState != STATE_PARSEPOST) break;
+    }
+  }
+  return;
+}
+#endif // POST_STREAM_PARSE == 1
+
+
+#if POST_STREAM_PARSE == 0
 void parsepost(struct tHttpD* pSocket, char *pBuffer, uint16_t nBytes) {
   // This function parses data the user entered in the GUI.
   
@@ -10137,6 +13526,7 @@ void parsepost(struct tHttpD* pSocket, char *pBuffer, uint16_t nBytes) {
   }
   return;
 }
+#endif // POST_STREAM_PARSE == 0
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 
 
@@ -10458,6 +13848,11 @@ void parse_local_buf(struct tHttpD* pSocket, char* local_buf, uint16_t lbi_max)
 	            memcpy(&IO_NAME[pSocket->ParseNum][i], &tmp_Pending[i], 4);
 	            i += 4;
 	          }
+#if DOMOTICZ_PUBLISH_BATCH == 1
+		  // The device with the new idx gets its state on the next
+		  // MQTT connect.
+		  resync_full = 1;
+#endif // DOMOTICZ_PUBLISH_BATCH == 1
                 }
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("\r\n");
@@ -11762,6 +15157,14 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 #if OB_EEPROM_SUPPORT == 1
           init_off_board_string_pointers(pSocket);
 #endif // OB_EEPROM_SUPPORT == 1
+#if HTTP_ETAG_SUPPORT == 1
+          if (ETAG_MATCHED(pSocket)) {
+            // The Browser already has this version of the page. Only the
+	    // 304 header is sent.
+	    pSocket->current_webpage = WEBPAGE_NOT_MODIFIED;
+            pSocket->nDataLeft = 0;
+	  }
+#endif // HTTP_ETAG_SUPPORT == 1
 	  break;
 
 
@@ -11828,6 +15231,11 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 
 #if LINK_STATISTICS == 1
         case 0x66: // Show Link Error Statistics page
+#if PAGE_BUILD_STATISTICS == 1
+	  // Field 73 shows the build time of the previous page
+	  page_build_time = page_build_run;
+	  page_build_run = 0;
+#endif // PAGE_BUILD_STATISTICS == 1
 	  pSocket->current_webpage = WEBPAGE_STATS2;
           pSocket->pData = g_HtmlPageStats2;
           pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlPageStats2) - 1);
@@ -11850,6 +15258,64 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 	  MQTT_resp_tout_counter = 0;
 	  MQTT_not_OK_counter = 0;
 	  MQTT_broker_dis_counter = 0;
+#if FRAME_COPY_STATISTICS == 1
+	  rx_copy_time = 0;
+	  rx_copy_bytes = 0;
+	  tx_copy_time = 0;
+	  tx_copy_bytes = 0;
+#endif // FRAME_COPY_STATISTICS == 1
+#if RX_DRAIN_SUPPORT == 1
+	  rx_drain_max = 0;
+	  rx_drain_limit_counter = 0;
+#endif // RX_DRAIN_SUPPORT == 1
+#if RX_PEEK_DISCARD == 1
+	  rx_discard_counter = 0;
+#endif // RX_PEEK_DISCARD == 1
+#if RX_OCCUPANCY_STATISTICS == 1
+	  rx_occupancy = 0;
+	  rx_occupancy_peak = 0;
+	  rx_pktcnt_peak = 0;
+	  tx_wait_time = 0;
+#endif // RX_OCCUPANCY_STATISTICS == 1
+#if HTTP_SPLIT_OUTPUT == 1
+	  split_count = 0;
+	  page_load_time = 0;
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if TCP_FAST_REXMIT == 1
+	  fast_rexmit_count = 0;
+	  rexmit_latency_max = 0;
+#endif // TCP_FAST_REXMIT == 1
+#if MQTT_PUBLISH_ROUND_ROBIN == 1
+	  publish_delay_max = 0;
+#endif // MQTT_PUBLISH_ROUND_ROBIN == 1
+#if MQTT_PUBLISH_DISPATCH == 1
+	  inbound_time_max = 0;
+#endif // MQTT_PUBLISH_DISPATCH == 1
+#if RAM_HEADROOM_STATISTICS == 1
+	  stack_paint();
+	  uip_buf_peak = 0;
+#if BUILD_SUPPORT == MQTT_BUILD
+	  mqtt_sendbuf_peak = 0;
+	  mqtt_pbuf_peak = 0;
+#endif // BUILD_SUPPORT == MQTT_BUILD
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if PUBLISH_LATENCY_STATS == 1
+	  latency_init();
+#endif // PUBLISH_LATENCY_STATS == 1
+#if ENC28J60_FLOW_CONTROL == 1
+	  rx_pause_counter = 0;
+#endif // ENC28J60_FLOW_CONTROL == 1
+#if PAGE_BUILD_STATISTICS == 1
+	  page_build_time = 0;
+	  page_build_run = 0;
+#endif // PAGE_BUILD_STATISTICS == 1
+#if INPUT_PASS_STATISTICS == 1
+	  input_pass_min = 0xffff;
+	  input_pass_max = 0;
+#endif // INPUT_PASS_STATISTICS == 1
+#if HTTP_PACING == 1
+	  pacing_init();
+#endif // HTTP_PACING == 1
 	  
 	  pSocket->current_webpage = WEBPAGE_STATS2;
           pSocket->pData = g_HtmlPageStats2;
@@ -12220,6 +15686,9 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 	    unlock_eeprom();	
 	    stored_altitude = (int16_t)altitude_local;
 	    lock_eeprom();
+#if SENSOR_STRING_CACHE == 1
+	    BME280_NEW_READING(); // The pressure depends on the altitude
+#endif // SENSOR_STRING_CACHE == 1
           }
 	  // Didn't break so far so parse was successful
 	  // Set parse_complete for the check_runtime_changes() process
@@ -12379,6 +15848,114 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 #endif // PCF8574_SUPPORT == 1
           
           
+#if RX_FILTER_PROFILES == 1
+        case 0x86:
+	  // User entered ENC28J60 Receive Filter Profile.
+	  // User enters one digit to select the profile:
+	  //   0 = Standard: our MAC address plus all broadcasts
+	  //   1 = Our MAC address plus ARP broadcasts only
+	  //   2 = Profile 1 plus selected multicast groups
+	  // See set_rx_filter_profile() in the Enc28j60.c file.
+	  //
+          // Example URL command
+          //   192.168.1.182/861
+          //   The above example selects Receive Filter Profile 1.
+	  {
+	    uint8_t profile;
+	    uint8_t j;
+	    if (parse_GETcmd[3] >= '0' && parse_GETcmd[3] <= '2') {
+	      profile = (uint8_t)(parse_GETcmd[3] - '0');
+	      if (((stored_options2 >> 3) & 0x03) != profile) {
+	        j = (uint8_t)((stored_options2 & 0xe7) | (profile << 3));
+	        unlock_eeprom();
+	        stored_options2 = j;
+	        lock_eeprom();
+	        // Request a reboot to re-initialize the ENC28J60 filters.
+	        user_reboot_request = 1;
+	      }
+	      // Set parse_complete for the check_runtime_changes() process
+              parse_complete = 1;
+	    }
+            // Always display the IOControl page even if there is no parse
+	    // fail. The PARSE_FAIL state will cause this to happen.
+	    pSocket->ParseState = PARSE_FAIL;
+	  }
+	  break;
+#endif // RX_FILTER_PROFILES == 1
+
+
+#if DHCP_SUPPORT == 1
+        case 0x87:
+	  // User entered DHCP enable.
+	  //   0 = Use the static addresses on the Configuration page
+	  //   1 = Get the addresses from a DHCP server
+	  // See dhcp_service() in the main.c file.
+	  //
+          // Example URL command
+          //   192.168.1.182/871
+          //   The above example enables DHCP.
+	  {
+	    uint8_t j;
+	    if (parse_GETcmd[3] == '0' || parse_GETcmd[3] == '1') {
+	      j = (uint8_t)(stored_options2 & 0xdf);
+	      if (parse_GETcmd[3] == '1') j |= 0x20;
+	      if (stored_options2 != j) {
+	        unlock_eeprom();
+	        stored_options2 = j;
+	        lock_eeprom();
+	        // Request a reboot to change the addresses.
+	        user_reboot_request = 1;
+	      }
+	      // Set parse_complete for the check_runtime_changes() process
+              parse_complete = 1;
+	    }
+            // Always display the IOControl page even if there is no parse
+	    // fail. The PARSE_FAIL state will cause this to happen.
+	    pSocket->ParseState = PARSE_FAIL;
+	  }
+	  break;
+#endif // DHCP_SUPPORT == 1
+
+
+#if RULE_ENGINE_SUPPORT == 1
+        case 0x88:
+        case 0x89:
+        case 0x8a:
+        case 0x8b:
+        case 0x8c:
+        case 0x8d:
+        case 0x8e:
+        case 0x8f:
+	  // User entered a rule. /88 sets rule 0 and /8f sets rule 7. The rule
+	  // is 8 hex characters for its 4 bytes. See rule_service() in the
+	  // main.c file for the format. A rule of all zeros removes the rule.
+	  //
+          // Example URL command
+          //   192.168.1.182/8820002b00
+          //   The above example sets rule 0: IO 1 ON turns IO 12 ON,
+          //   IO 1 OFF turns IO 12 OFF.
+	  {
+	    uint8_t rule[4];
+	    uint8_t j;
+	    for (j = 0; j < 8; j++) {
+	      if (hex2int(parse_GETcmd[3 + j]) < 0) break;
+	    }
+	    if (j == 8) {
+	      for (j = 0; j < 4; j++) {
+	        rule[j] = two_hex2int(parse_GETcmd[3 + (j * 2)], parse_GETcmd[4 + (j * 2)]);
+	      }
+	      if (rule_set((uint8_t)(pSocket->ParseNum - 0x88), rule)) {
+	        // Set parse_complete for the check_runtime_changes() process
+                parse_complete = 1;
+	      }
+	    }
+            // Always display the IOControl page even if there is no parse
+	    // fail. The PARSE_FAIL state will cause this to happen.
+	    pSocket->ParseState = PARSE_FAIL;
+	  }
+	  break;
+#endif // RULE_ENGINE_SUPPORT == 1
+
 	case 0x91: // Reboot
 	  user_reboot_request = 1;
           GET_response_type = 204; // Send header but no webpage
@@ -12408,6 +15985,86 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 #endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
 
 
+#if STYLE_RESOURCE == 1
+        case 0xb0: // Send the style sheet
+	  // The style sheet is linked from the head of every webpage. The
+	  // gzip version is sent if the Browser accepts it.
+#if GZIP_STATIC_SUPPORT == 1
+	  if (GZIP_ACCEPTED(pSocket)) {
+	    pSocket->current_webpage = WEBPAGE_STYLE_GZ;
+            pSocket->pData = g_HtmlStyleGz;
+            pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlStyleGz));
+	  }
+	  else
+#endif // GZIP_STATIC_SUPPORT == 1
+	  {
+	    pSocket->current_webpage = WEBPAGE_STYLE;
+            pSocket->pData = g_HtmlStyle;
+            pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlStyle) - 1);
+	  }
+	  break;
+#endif // STYLE_RESOURCE == 1
+
+
+#if STATE_JSON_SUPPORT == 1
+        case 0xb1: // Send the JSON state response
+        case 0xb2: // Send the JSON pin response
+	  // The response is built by json_build() rather than copied from
+	  // a template, so pData is not used. nDataLeft only marks that the
+	  // response still has to be sent.
+	  if (pSocket->ParseNum == 0xb1) pSocket->current_webpage = WEBPAGE_JSON_STATE;
+	  else pSocket->current_webpage = WEBPAGE_JSON_PINS;
+          pSocket->nDataLeft = 1;
+	  break;
+#endif // STATE_JSON_SUPPORT == 1
+
+
+#if HTTP_LONG_POLL == 1
+        case 0xb3: // Wait for a pin change
+	  // Capture the pin states the Browser is assumed to have. The
+	  // response is not sent until they change (see STATE_WAITEVENT).
+	  pSocket->current_webpage = WEBPAGE_EVENT_WAIT;
+	  pSocket->nEventPins = ON_OFF_word;
+	  pSocket->nEventStart = (uint16_t)second_counter;
+          pSocket->nDataLeft = 0;
+	  break;
+#endif // HTTP_LONG_POLL == 1
+
+
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+        case 0xb4: // Send the settings snapshot
+	  // The snapshot is written by snapshot_export() as it is sent.
+	  pSocket->current_webpage = WEBPAGE_SNAPSHOT;
+          pSocket->nDataLeft = SNAPSHOT_SIZE;
+	  break;
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
+
+
+#if TRACE_RING_SUPPORT == 1
+        case 0xb5: // Send the event trace
+	  // Write out the events collected so far, then send EEPROM3.
+	  trace_sync();
+	  pSocket->current_webpage = WEBPAGE_TRACE;
+          pSocket->nDataLeft = TRACE_SIZE;
+	  break;
+#endif // TRACE_RING_SUPPORT == 1
+
+
+#if HTTP_WEBSOCKET == 1
+        case 0xb6: // Upgrade to a WebSocket
+	  // The handshake reply is sent by ws_call() (see STATE_WEBSOCKET).
+	  pSocket->current_webpage = WEBPAGE_WEBSOCKET;
+          pSocket->nDataLeft = 0;
+	  break;
+
+        case 0xb7: // Send the WebSocket script of the IO Control pages
+	  pSocket->current_webpage = WEBPAGE_WS_SCRIPT;
+          pSocket->pData = g_HtmlWsScript;
+          pSocket->nDataLeft = (uint16_t)(sizeof(g_HtmlWsScript) - 1);
+	  break;
+#endif // HTTP_WEBSOCKET == 1
+
+
 #if RESPONSE_LOCK_SUPPORT == 1
         case 0xa0:
 	  // Turn the Response Lock on or off.
@@ -12789,6 +16446,27 @@ void parseget(struct tHttpD* pSocket, char *pBuffer)
 #endif // DEBUG_SUPPORT == 15
 
         pSocket->nState = STATE_SENDHEADER200;
+#if HTTP_LONG_POLL == 1
+        // A /b3 request is held until the uip_poll() that finds a pin
+	// change.
+        if (pSocket->current_webpage == WEBPAGE_EVENT_WAIT) {
+          pSocket->nState = STATE_WAITEVENT;
+	}
+#endif // HTTP_LONG_POLL == 1
+#if HTTP_WEBSOCKET == 1
+        // A /b6 request with a valid key becomes the WebSocket. Any
+	// previous WebSocket is aborted on its next poll.
+        if (pSocket->current_webpage == WEBPAGE_WEBSOCKET) {
+          if (pSocket->nWsKeyLen == 24) {
+            ws_accept();
+            ws_conn = uip_conn;
+            ws_flags = WS_HANDSHAKE | WS_STATE;
+            ws_sent = 0;
+            pSocket->nState = STATE_WEBSOCKET;
+          }
+          else pSocket->nState = STATE_SENDHEADER400;
+	}
+#endif // HTTP_WEBSOCKET == 1
       }
       if (GET_response_type == 204) {
         // No return webpage - send header 200 with Content-Length: 0
@@ -12949,4 +16627,191 @@ char *read_two_characters(char *pBuffer)
     return pBuffer;
   }
 }
+
+
+void upload_init(void)
+{
+  // Initializes the file parsing variables at the start of an upload.
+  byte_index = 0;
+  parse_index = 0;
+  eeprom_address_index = I2C_EEPROM0_BASE;
+  parse_tail[0] = '\0';
+  byte_tail[0] = '\0';
+  byte_tail[1] = '\0';
+  line_count = 0;
+  checksum = 0;
+  upgrade_failcode = UPGRADE_OK;
+  non_sequential_detect = 0;
+  SREC_start = 1;
+#if SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+  page_pending = 0;
+#endif // SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+  search_limit = 0;
+}
+
+
+void upload_erase(void)
+{
+  // Writes zero to all of I2C EEPROM0 so that any part of the 32K space not
+  // covered by the uploaded file reads back as zero.
+  uint16_t i;
+  uint8_t j;
+  uint16_t temp_eeprom_address_index;
+  for (i=0; i<256; i++) {
+    // Write 256 blocks of 128 bytes each with zero
+    I2C_control(I2C_EEPROM0_WRITE); // Send Write Control Byte
+    temp_eeprom_address_index = i * 128;
+    I2C_byte_address(temp_eeprom_address_index, 2);
+    for (j=0; j<128; j++) {
+      // Write a zero byte
+      I2C_write_byte(0);
+    }
+    I2C_stop(); // Start the EEPROM internal write cycle
+    IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+    // Wait for completion of write.
+    // For simplicity I'm waiting 5ms (the max time required).
+    // This loop could be sped up by using "acknowledge
+    // polling" (see the 24AA1025 EEPROM spec).
+#if SREC_UPLOAD_PIPELINE == 1
+    // With SREC_UPLOAD_PIPELINE the next block is started
+    // as soon as the EEPROM ACKs again.
+    eeprom_write_wait(I2C_EEPROM0_WRITE);
+#else // SREC_UPLOAD_PIPELINE == 0
+    wait_timer(5000); // Wait 5ms
+#endif // SREC_UPLOAD_PIPELINE == 1
+  }
+}
+
+
+#if SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+void upload_page_verify(void)
+{
+  // Waits for the pending page write to complete then reads the page back
+  // from the I2C EEPROM and compares it with page_copy. A miscompare sets
+  // upgrade_failcode, which is checked when the S7 record or the end of a
+  // binary image is reached.
+  int i;
+  uint8_t I2C_last_flag;
+  uint8_t temp_byte;
+  
+  if (page_pending == 0) return;
+  page_pending = 0;
+  
+  // ACK polling: the I2C EEPROM does not ACK its Control Byte until the
+  // internal write cycle is done.
+  eeprom_write_wait(page_pending_control);
+  IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+  
+  prep_read(page_pending_control,
+            (uint8_t)(page_pending_control | 0x01),
+	    page_pending_address,
+	    2);
+  I2C_last_flag = 0;
+  for (i=0; i<64; i++) {
+    // All 64 bytes are read so that the read ends with a NACK and STOP
+    if (i == 63) I2C_last_flag = 1;
+    temp_byte = I2C_read_byte(I2C_last_flag);
+    if (temp_byte != page_copy[i] && upgrade_failcode == UPGRADE_OK) {
+      if (file_type == FILETYPE_STRING) upgrade_failcode = STRING_EEPROM_MISCOMPARE;
+      else upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
+    }
+  }
+}
+
+
+void upload_page_write(uint16_t eeprom_address)
+{
+  // Starts the write of the 64 bytes in parse_tail to the I2C EEPROM at
+  // eeprom_address and returns without waiting for the EEPROM internal write
+  // cycle. The previous page write is verified first, so while the parser
+  // runs on the following SREC data (and the next TCP segment is received)
+  // the EEPROM is programming the last page.
+  int i;
+  
+  upload_page_verify();
+  
+  if (file_type == FILETYPE_STRING) page_pending_control = I2C_EEPROM2_WRITE;
+  else page_pending_control = I2C_EEPROM0_WRITE;
+  page_pending_address = eeprom_address;
+  
+  I2C_control(page_pending_control); // Send Write Control Byte
+  I2C_byte_address(eeprom_address, 2);
+  for (i=0; i<64; i++) {
+    I2C_write_byte(parse_tail[i]);
+    page_copy[i] = parse_tail[i];
+  }
+  I2C_stop(); // Start the EEPROM internal write cycle
+  IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+  page_pending = 1;
+}
+#endif // SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+
+
+#if BLOCK_DELTA_UPLOAD == 1
+uint8_t upload_block_matches(uint16_t eeprom_address, uint32_t crc_expected)
+{
+  // Returns 1 if the CRC32 of the 128 byte block at eeprom_address in the
+  // I2C EEPROM matches crc_expected. Used both to find the blocks that do
+  // not need to be written and to verify the blocks that were written.
+  int i;
+  uint8_t I2C_last_flag;
+  uint8_t control;
+  uint32_t crc;
+  
+  if (file_type == FILETYPE_STRING) control = I2C_EEPROM2_WRITE;
+  else control = I2C_EEPROM0_WRITE;
+  
+  // Wait for any write still in progress (ACK polling)
+  eeprom_write_wait(control);
+  
+  prep_read(control, (uint8_t)(control | 0x01), eeprom_address, 2);
+  crc = 0xffffffff;
+  I2C_last_flag = 0;
+  for (i=0; i<128; i++) {
+    if (i == 127) I2C_last_flag = 1;
+    crc = crc32_update(crc, I2C_read_byte(I2C_last_flag));
+  }
+  IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+  
+  if (~crc == crc_expected) return 1;
+  return 0;
+}
+
+
+void upload_block_page(uint16_t eeprom_address)
+{
+  // Writes the 64 bytes in parse_tail to the I2C EEPROM at eeprom_address
+  // unless the block holding the page already matched its CRC. At the end
+  // of each written block the block is read back and checked against its
+  // CRC, so no page copy is kept.
+  int i;
+  uint8_t control;
+  
+  if (block_skip == 0) {
+    if (file_type == FILETYPE_STRING) control = I2C_EEPROM2_WRITE;
+    else control = I2C_EEPROM0_WRITE;
+    eeprom_write_wait(control); // Wait for the previous page write
+    I2C_control(control); // Send Write Control Byte
+    I2C_byte_address(eeprom_address, 2);
+    for (i=0; i<64; i++) {
+      I2C_write_byte(parse_tail[i]);
+    }
+    I2C_stop(); // Start the EEPROM internal write cycle
+    IWDG_KR = 0xaa; // Prevent the IWDG from firing.
+  }
+  
+  if (eeprom_address & 0x40) {
+    // Second page of the block
+    if (block_skip == 0 && upgrade_failcode == UPGRADE_OK) {
+      if (upload_block_matches((uint16_t)(eeprom_address & 0xff80), block_crc_expected) == 0) {
+        if (file_type == FILETYPE_STRING) upgrade_failcode = STRING_EEPROM_MISCOMPARE;
+        else upgrade_failcode = UPGRADE_FAIL_EEPROM_MISCOMPARE;
+// UARTPrintf("UPGRADE_FAILCODE = UPGRADE_FAIL_EEPROM_MISCOMPARE\r\n");
+      }
+    }
+    block_index = 0;
+  }
+}
+#endif // BLOCK_DELTA_UPLOAD == 1
 #endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
@@ -62,6 +62,13 @@
 #define UPGRADE_FAIL_NOT_SREC			5
 #define UPGRADE_FAIL_INVALID_FILETYPE		6
 #define UPGRADE_FAIL_TRUNCATED_FILE		7
+#define UPGRADE_FAIL_IMAGE_FORMAT		8
+#define UPGRADE_FAIL_IMAGE_CRC			9
+
+#if RAW_UPLOAD_SUPPORT == 1
+// TCP port for the raw (length prefixed) firmware upload
+#define RAW_UPLOAD_PORT				8089
+#endif // RAW_UPLOAD_SUPPORT == 1
 
 #define FILETYPE_SEARCH		0
 #define FILETYPE_PROGRAM	1
@@ -123,9 +130,46 @@ struct tHttpD
   uint8_t ParseNum;
   uint8_t ParseState;
   uint16_t nPrevBytes;
+#if HTTP_MULTI_SEGMENT == 1
+  uint16_t nPrevBytes2;
+#endif // HTTP_MULTI_SEGMENT == 1
   uint8_t current_webpage;
   uint8_t insertion_index;
   int structID;
+#if HTTP_KEEPALIVE == 1
+  uint8_t nKeepAlive;
+  uint16_t nIdleStart;
+#endif // HTTP_KEEPALIVE == 1
+#if HTTP_GET_QUEUE == 1
+#if HTTP_KEEPALIVE == 1
+  uint8_t nKeepAliveMatch;
+#endif // HTTP_KEEPALIVE == 1
+#if GZIP_STATIC_SUPPORT == 1
+  uint8_t nGzipMatch;
+  uint8_t nGzipAccepted;
+#endif // GZIP_STATIC_SUPPORT == 1
+#if HTTP_ETAG_SUPPORT == 1
+  uint8_t nEtagMatch;
+  uint8_t nEtagMatched;
+#endif // HTTP_ETAG_SUPPORT == 1
+  uint8_t GETcmd[11];
+#endif // HTTP_GET_QUEUE == 1
+#if HTTP_LONG_POLL == 1
+#if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+  uint16_t nEventPins;
+#else
+  uint32_t nEventPins;
+#endif // PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
+  uint16_t nEventStart;
+#endif // HTTP_LONG_POLL == 1
+#if HTTP_WEBSOCKET == 1
+  uint8_t nWsKeyMatch;
+  uint8_t nWsKeyLen;
+#endif // HTTP_WEBSOCKET == 1
+#if HTTP_PACING == 1
+  uint8_t nHeld;
+  uint16_t nHoldStart;
+#endif // HTTP_PACING == 1
   
 // nState		Tracks the parsing state of a POST and subsequent
 //			response to the Browser
@@ -147,6 +191,8 @@ struct tHttpD
 //			bridging of TCP Fragmentation.
 // nPrevBytes		Used in the case of uip_rexmit to determine if the
 //			header needs to be retransmitted.
+// nPrevBytes2		With HTTP_MULTI_SEGMENT the number of template bytes
+//			consumed by the second segment in flight.
 // current_webpage	Tracks the current webpage being displayed in the GUI.
 // insertion_index	Tracks the position in a "long string" being trans-
 //			mitted in a webpage to allow bridging of TCP Frag-
@@ -155,6 +201,36 @@ struct tHttpD
 //                      sort out when connections were being used. It will be
 //                      left in the code for now as it proved to be very
 //                      useful.
+// nKeepAlive		With HTTP_KEEPALIVE set if the GET request being
+//			answered asked for a persistent connection.
+// nIdleStart		With HTTP_KEEPALIVE the second_counter value when the
+//			connection started waiting for a request.
+// nKeepAliveMatch	With HTTP_GET_QUEUE the number of characters of
+//			"keep-alive" matched while reading the GET request
+//			headers.
+// nGzipMatch		With HTTP_GET_QUEUE the number of characters of "gzip"
+//			matched while reading the GET request headers.
+// nGzipAccepted	With HTTP_GET_QUEUE set if the GET request headers
+//			contain "gzip".
+// nEtagMatch		With HTTP_GET_QUEUE the number of characters of the
+//			Configuration page ETag matched while reading the GET
+//			request headers.
+// nEtagMatched		With HTTP_GET_QUEUE set if the GET request headers
+//			contain the current ETag.
+// GETcmd		With HTTP_GET_QUEUE the GET cmd captured for this
+//			connection (see parse_GETcmd).
+// nEventPins		With HTTP_LONG_POLL the ON_OFF_word value when the /b3
+//			request was received.
+// nEventStart		With HTTP_LONG_POLL the second_counter value when the
+//			/b3 request was received.
+// nWsKeyMatch		Number of characters of "sec-websocket-key:" matched
+//			while reading the GET request headers.
+// nWsKeyLen		Number of Sec-WebSocket-Key characters collected, bit
+//			0x80 set while collecting.
+// nHeld		With HTTP_PACING set while the next page segment is
+//			held back by http_pacing_hold().
+// nHoldStart		With HTTP_PACING the ms_counter value when the segment
+//			was first held.
 };
 
 
@@ -163,8 +239,17 @@ void httpd_diagnostic(void);
 void HttpDStringInit(void);
 void init_off_board_string_pointers(struct tHttpD* pSocket);
 uint16_t read_two_bytes(void);
+#if OB_TEMPLATE_CACHE == 1
+uint16_t pre_buf_load(void);
+#endif // OB_TEMPLATE_CACHE == 1
 void read_httpd_diagnostic_bytes(void);
 uint16_t adjust_template_size(struct tHttpD* pSocket);
+#if HTTP_SIZE_CACHE == 1
+void httpd_page_size_invalidate(void);
+#endif // HTTP_SIZE_CACHE == 1
+#if HTTP_ETAG_SUPPORT == 1
+void httpd_page_version_bump(void);
+#endif // HTTP_ETAG_SUPPORT == 1
 
 static uint16_t CopyHttpHeader(uint8_t* pBuffer, uint16_t nDataLen, uint8_t header_type);
 static uint16_t CopyHttpData(uint8_t* pBuffer,
@@ -172,29 +257,70 @@ static uint16_t CopyHttpData(uint8_t* pBuffer,
 			     uint16_t* pDataLeft,
 			     uint16_t nMaxBytes,
 			     struct tHttpD* pSocket);
+#if STATE_JSON_SUPPORT == 1
+static uint16_t json_build(uint8_t webpage, char *pBuffer);
+#endif // STATE_JSON_SUPPORT == 1
+#if BINARY_UPLOAD_SUPPORT == 1 || CONFIG_SNAPSHOT_SUPPORT == 1 || IMAGE_BACKUP_TASK == 1
+uint32_t crc32_update(uint32_t crc, uint8_t data);
+#endif // BINARY_UPLOAD_SUPPORT == 1 || CONFIG_SNAPSHOT_SUPPORT == 1 || IMAGE_BACKUP_TASK == 1
+#if CONFIG_SNAPSHOT_SUPPORT == 1
+void snapshot_export(uint8_t *pBuffer, uint16_t offset, uint16_t nBytes);
+void snapshot_import_init(void);
+void snapshot_abort(void);
+void snapshot_import(struct tHttpD* pSocket, uint8_t *pBuffer, uint16_t nBytes);
+#endif // CONFIG_SNAPSHOT_SUPPORT == 1
 void create_sensor_ID(int8_t sensor);
 char *show_temperature_string(char * pBuffer, uint8_t nParsedNum);
 char *show_BME280_PTH_string(char *pBuffer);
 char *show_INA226_CVW_string(char *pBuffer);
+#if SENSOR_FIXED_POINT == 1
+void FixedToString(int32_t value, uint8_t decimals);
+#else // SENSOR_FIXED_POINT == 0
 void FloatToString(float fVal);
+#endif // SENSOR_FIXED_POINT == 1
 char *show_space_or_minus(int32_t value, char *pBuffer);
 
 void emb_itoa(uint32_t num, char* str, uint8_t base, uint8_t pad);
 int hex2int(char ch);
 uint8_t two_hex2int(char chmsb, char chlsb);
+#if FAST_FORMAT == 0
 uint8_t int2nibble(uint8_t j);
+#endif // FAST_FORMAT == 0
 void int2hex(uint8_t i);
 void int16to4hex(uint16_t i);
 
 void HttpDInit(void);
 void init_tHttpD_struct(struct tHttpD* pSocket, int i);
+#if HTTPD_STATE_POOL == 1
+struct tHttpD* httpd_get_state(void);
+#endif // HTTPD_STATE_POOL == 1
+#if PERIODIC_WORK_FLAGS == 1
+uint8_t httpd_busy(struct tHttpD* pSocket);
+#endif // PERIODIC_WORK_FLAGS == 1
 void HttpDCall(uint8_t* pBuffer, uint16_t nBytes, struct tHttpD* pSocket);
 
 char *read_two_characters(char *pBuffer);
+void upload_init(void);
+void upload_erase(void);
+#if SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+void upload_page_verify(void);
+void upload_page_write(uint16_t eeprom_address);
+#endif // SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+#if BLOCK_DELTA_UPLOAD == 1
+uint8_t upload_block_matches(uint16_t eeprom_address, uint32_t crc_expected);
+void upload_block_page(uint16_t eeprom_address);
+#endif // BLOCK_DELTA_UPLOAD == 1
 void parsepost(struct tHttpD* pSocket, char *pBuffer, uint16_t nBytes);
 void parse_local_buf(struct tHttpD* pSocket, char* local_buf, uint16_t lbi_max);
 void update_ON_OFF(uint8_t i, uint8_t j);
 void parseget(struct tHttpD* pSocket, char *pBuffer);
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+void parsefile(struct tHttpD* pSocket, uint8_t* pBuffer, uint16_t nBytes, char *compare_buf);
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+#if RAW_UPLOAD_SUPPORT == 1
+void raw_upload_call(void);
+uint16_t raw_upload_status(char *pBuffer);
+#endif // RAW_UPLOAD_SUPPORT == 1
 void parse_command_abort(struct tHttpD* pSocket);
 
 #endif /*HTTPD_H_*/
@@ -54,12 +54,43 @@
 // #include <math.h>
 
 
+#if SENSOR_FIXED_POINT == 1
+int32_t voltage;       // Voltage value reported by the INA226 (mV)
+int32_t current;       // Current value reported by the INA226 (mA)
+int32_t power;         // Power value reported by the INA226 (mW)
+int32_t shunt_voltage; // Shunt Voltage value reported by the INA226 (uV)
+
+uint16_t current_lsb;  // Current LSB in 100nA units
+#else // SENSOR_FIXED_POINT == 0
 float voltage;       // Voltage value reported by the INA226
 float current;       // Current value reported by the INA226
 float power;         // Power value reported by the INA226
 float shunt_voltage; // Shunt Voltage value reported by the INA226
 
 float current_lsb;
+#endif // SENSOR_FIXED_POINT == 1
+
+#if INA226_ALERT_SUPPORT == 1
+// Measurements collected from each INA226 when ALERT signals Conversion Ready
+#if SENSOR_FIXED_POINT == 1
+int32_t ina226_voltage[5];
+int32_t ina226_current[5];
+int32_t ina226_power[5];
+#else // SENSOR_FIXED_POINT == 0
+float ina226_voltage[5];
+float ina226_current[5];
+float ina226_power[5];
+#endif // SENSOR_FIXED_POINT == 1
+
+// I2C control words for each INA226
+static const uint8_t ina226_address[5][2] = {
+  { INA226_1_write, INA226_1_read },
+  { INA226_2_write, INA226_2_read },
+  { INA226_3_write, INA226_3_read },
+  { INA226_4_write, INA226_4_read },
+  { INA226_5_write, INA226_5_read }
+};
+#endif // INA226_ALERT_SUPPORT == 1
 
 extern uint8_t stored_options2; // Options stored in EEPROM
 
@@ -108,6 +139,64 @@ void ina226_disable()
 */
 
 
+#if SENSOR_FIXED_POINT == 1
+void ina226_calibrate_all()
+{
+  uint16_t shunt_resistance;
+  uint16_t max_current;
+  
+  // Calibrate all INA226 devices
+  // The limits are the same as the float version below, but the shunt
+  // resistance is given in milliohms and the max_current in milliamps.
+  //   Option 0: 0.002 ohm shunt, 20A max current
+  //   Option 1: 0.010 ohm shunt, 8A max current
+  //   Option 2: 0.100 ohm shunt, 0.8A max current
+  shunt_resistance = 2;
+  max_current = 20000;
+  if ((stored_options2 & 0x07) == 0x01) {
+    shunt_resistance = 10;
+    max_current = 8000;
+  }
+  if ((stored_options2 & 0x07) == 0x02) {
+    shunt_resistance = 100;
+    max_current = 800;
+  }
+  ina226_calibrate(INA226_1_write, shunt_resistance, max_current);
+  ina226_calibrate(INA226_2_write, shunt_resistance, max_current);
+  ina226_calibrate(INA226_3_write, shunt_resistance, max_current);
+  ina226_calibrate(INA226_4_write, shunt_resistance, max_current);
+  ina226_calibrate(INA226_5_write, shunt_resistance, max_current);
+}
+
+
+void ina226_calibrate(uint8_t write_command, uint16_t r_shunt, uint16_t max_current)
+{
+  uint32_t lsb_nA;
+  uint32_t scale;
+  uint16_t calib_reg;
+  
+  // r_shunt is in milliohms and max_current is in milliamps.
+  //
+  // Compute the current LSB as max_expected_current/2**15 in nA units.
+  // max_current * 1000000 / 32768 is reduced to max_current * 15625 / 512 to
+  // stay within 32 bits.
+  lsb_nA = ((uint32_t)max_current * 15625) / 512;
+
+  // The calibration register is 0.00512 / (current_lsb * r_shunt). With the
+  // LSB in nA and r_shunt in milliohms the constant becomes 5.12e9, which is
+  // too large for 32 bits, so it is divided by r_shunt first.
+  scale = (5120000 / r_shunt) * 1000;
+  calib_reg = (uint16_t)(scale / lsb_nA);
+
+  // Re-compute and store real current LSB in 100nA units
+  current_lsb = (uint16_t)((scale / calib_reg) / 100);
+
+  // Write calibration
+  ina226_write_reg(write_command, INA226_REG_CALIBRATION, calib_reg);
+}
+
+
+#else // SENSOR_FIXED_POINT == 0
 void ina226_calibrate_all()
 {
   float shunt_resistance;
@@ -193,16 +282,18 @@ void ina226_calibrate(uint8_t write_command, float r_shunt, float max_current)
   // Write calibration
   ina226_write_reg(write_command, INA226_REG_CALIBRATION, calib_reg);
 }
+#endif // SENSOR_FIXED_POINT == 1
 
 
 void ina226_configure_all()
 {
   // Configure all five INA226 devices
-  ina226_configure(INA226_1_write, 4, 0);
-  ina226_configure(INA226_2_write, 4, 0);
-  ina226_configure(INA226_3_write, 4, 0);
-  ina226_configure(INA226_4_write, 4, 0);
-  ina226_configure(INA226_5_write, 4, 0);
+  // The averaging is set by INA226_AVERAGE in uipopt.h (default 0)
+  ina226_configure(INA226_1_write, 4, INA226_AVERAGE);
+  ina226_configure(INA226_2_write, 4, INA226_AVERAGE);
+  ina226_configure(INA226_3_write, 4, INA226_AVERAGE);
+  ina226_configure(INA226_4_write, 4, INA226_AVERAGE);
+  ina226_configure(INA226_5_write, 4, INA226_AVERAGE);
 }
 
 
@@ -236,6 +327,14 @@ void ina226_configure(uint8_t write_command, uint8_t period, uint8_t average)
   
   // Write the configuration value
   ina226_write_reg(write_command, INA226_REG_CONFIGURATION, reg);
+
+#if INA226_ALERT_SUPPORT == 1
+  // Assert the ALERT pin on Conversion Ready. The Latch Enable bit holds
+  // ALERT asserted until the Mask/Enable register is read by
+  // ina226_read_measurements().
+  ina226_write_reg(write_command, INA226_REG_MASK_ENABLE,
+                   INA226_MASK_ENABLE__CNVR | INA226_MASK_ENABLE__LEN);
+#endif // INA226_ALERT_SUPPORT == 1
 }
 
 
@@ -247,7 +346,11 @@ int ina226_conversion_ready(uint8_t write_command, uint8_t read_command)
 }
 
 
+#if SENSOR_FIXED_POINT == 1
+void ina226_read_measurements(uint8_t write_command, uint8_t read_command, int32_t *voltage, int32_t *current, int32_t *power, int32_t *shunt_voltage)
+#else // SENSOR_FIXED_POINT == 0
 void ina226_read_measurements(uint8_t write_command, uint8_t read_command, float *voltage, float *current, float *power, float *shunt_voltage)
+#endif // SENSOR_FIXED_POINT == 1
 {
   uint16_t voltage_reg;
   int16_t current_reg;
@@ -270,6 +373,28 @@ void ina226_read_measurements(uint8_t write_command, uint8_t read_command, float
   (void) ina226_read_reg(write_command, read_command, INA226_REG_MASK_ENABLE);
 
   // Check for the requested measures and compute their values
+#if SENSOR_FIXED_POINT == 1
+  if (voltage) {
+    // Convert to mV (LSB is 1.25mV)
+    *voltage = ((uint32_t)voltage_reg * 5) / 4;
+  }
+
+  if (current) {
+    // Convert to mA (current_lsb is in 100nA units)
+    *current = ((int32_t)current_reg * current_lsb) / 10000;
+  }
+
+  if (power) {
+    // Convert to mW (power LSB is 25 x current_lsb). The POWER register is
+    // unsigned.
+    *power = (int32_t)(((uint32_t)(uint16_t)power_reg * current_lsb) / 400);
+  }
+
+  if (shunt_voltage) {
+    // Convert to uV (LSB is 2.5uV)
+    *shunt_voltage = ((int32_t)shunt_voltage_reg * 5) / 2;
+  }
+#else // SENSOR_FIXED_POINT == 0
   if (voltage) {
     // Convert to Volts
     *voltage = (float) voltage_reg * 1.25e-3;
@@ -289,7 +414,31 @@ void ina226_read_measurements(uint8_t write_command, uint8_t read_command, float
     // Convert to Volts
     *shunt_voltage = (float) shunt_voltage_reg * 2.5e-6;
   }
+#endif // SENSOR_FIXED_POINT == 1
+}
+
+
+#if INA226_ALERT_SUPPORT == 1
+void ina226_service(void)
+{
+  // Called from the main loop. When the ALERT pin is asserted at least one
+  // INA226 has completed a conversion. All devices are configured alike so
+  // the measurements of all five are collected. Reading each device also
+  // reads its Mask/Enable register, which releases its ALERT output.
+  uint8_t i;
+
+  if (!INA226_ALERT_ASSERTED()) return;
+
+  for (i = 0; i < 5; i++) {
+    ina226_read_measurements(ina226_address[i][0],
+                             ina226_address[i][1],
+                             &ina226_voltage[i],
+                             &ina226_current[i],
+                             &ina226_power[i],
+                             0);
+  }
 }
+#endif // INA226_ALERT_SUPPORT == 1
 
 
 void ina226_write_reg(uint8_t write_command, uint8_t register_address, uint16_t value)
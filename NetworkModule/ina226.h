@@ -64,19 +64,38 @@
 #define INA226_CONFIGURATION__MODE_MASK			0x0007
 #define INA226_CONFIGURATION__MODE_SHIFT		0
 
+#define INA226_MASK_ENABLE__CNVR			0x0400
 #define INA226_MASK_ENABLE__CVRF			0x0008
+#define INA226_MASK_ENABLE__LEN				0x0001
+
+#if INA226_ALERT_SUPPORT == 1
+// The wired-together INA226 ALERT outputs are connected to PE6. ALERT is
+// active low.
+#define INA226_ALERT_ASSERTED()	(!(PE_IDR & 0x40))
+#endif // INA226_ALERT_SUPPORT == 1
 
 
 
 void ina226_init_all(void);
 void ina226_calibrate_all(void);
+#if SENSOR_FIXED_POINT == 1
+void ina226_calibrate(uint8_t write_command, uint16_t r_shunt, uint16_t max_current);
+#else // SENSOR_FIXED_POINT == 0
 void ina226_calibrate(uint8_t write_command, float r_shunt, float max_current);
+#endif // SENSOR_FIXED_POINT == 1
 void ina226_configure_all(void);
 void ina226_configure(uint8_t write_command, uint8_t period, uint8_t average);
 int ina226_conversion_ready(uint8_t write_command, uint8_t read_command);
+#if SENSOR_FIXED_POINT == 1
+void ina226_read_measurements(uint8_t write_command, uint8_t read_command, int32_t *voltage, int32_t *current, int32_t *power, int32_t *shunt_voltage);
+#else // SENSOR_FIXED_POINT == 0
 void ina226_read_measurements(uint8_t write_command, uint8_t read_command, float *voltage, float *current, float *power, float *shunt_voltage);
+#endif // SENSOR_FIXED_POINT == 1
 void ina226_write_reg(uint8_t write_command, uint8_t register_address, uint16_t value);
 uint16_t ina226_read_reg(uint8_t write_command, uint8_t read_command, uint8_t register_address);
+#if INA226_ALERT_SUPPORT == 1
+void ina226_service(void);
+#endif // INA226_ALERT_SUPPORT == 1
 
 
 #endif /* __INA226_H__ */
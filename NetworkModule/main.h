@@ -101,14 +101,20 @@
 // Total 6 x 8 = 48 bytes
 #define FLASH_START_SENSOR_IDX		0xfe80 // 0xfe80 to 0xfeaf
 
-// Empty space starting at 0xfeb0 to 0xfebf (16 bytes)
+// Last DHCP lease (used only in DHCP_SUPPORT builds)
+// Address, netmask, router and server, 4 bytes each
+// Flash space occupied is 0xfeb0 to 0xfebf (16 bytes)
+#define FLASH_START_DHCP_LEASE		0xfeb0
 
 // Start of IO_TIMER storage in Flash
 // There are 16 timers, each 2 bytes, for a total of 32 bytes
 // Flash space occupied is 0xfec0 to 0xfedf
 #define FLASH_START_IO_TIMERS	0xfec0
 
-// Empty space starting at 0xfee0 to feff (32 bytes)
+// Rule table (used only in RULE_ENGINE_SUPPORT builds)
+// There are 8 rules, each 4 bytes, for a total of 32 bytes
+// Flash space occupied is 0xfee0 to 0xfeff
+#define FLASH_START_RULES	0xfee0
 
 // Start of IO_NAME storage in Flash
 // There are 16 IO_NAMEs, each 16 bytes, for a total of 256 bytes
@@ -163,6 +169,12 @@
 // in the future, thus addresses 0x7ee0 to 0x7eef are considered allocated.
 #define PCF8574_I2C_EEPROM_PIN_CONTROL_STORAGE	 0x7ee0
 
+// Location in I2C EEPROM Region 2 where a settings snapshot POSTed to /b4
+// (CONFIG_SNAPSHOT_SUPPORT) holds the IO Names and Sensor IDX values until
+// its CRC32 is checked. 304 bytes are used, addresses 0x7d80 to 0x7ebf are
+// considered allocated. The Strings file must end below this.
+#define SNAPSHOT_I2C_EEPROM_STAGING	0x7d80
+
 
 
 // MQTT Start States
@@ -180,11 +192,21 @@
 #define MQTT_START_VERIFY_SUBSCRIBE2    23
 #define MQTT_START_QUEUE_SUBSCRIBE3	24
 #define MQTT_START_VERIFY_SUBSCRIBE3    25
+#define MQTT_START_QUEUE_SUBSCRIBE4	26
+#define MQTT_START_VERIFY_SUBSCRIBE4    27
 #define MQTT_START_QUEUE_PUBLISH_ON	30
 #define MQTT_START_QUEUE_PUBLISH_AUTO   31
 #define MQTT_START_QUEUE_PUBLISH_PINS	32
 #define MQTT_START_COMPLETE		40
 
+// Settle time before each MQTT Start step is run (200ms). With
+// MQTT_FAST_RECONNECT each step runs as soon as the prior step completed.
+#if MQTT_FAST_RECONNECT == 1
+#define MQTT_START_SETTLED()		1
+#else
+#define MQTT_START_SETTLED()		(mqtt_start_ctr1 > 4)
+#endif // MQTT_FAST_RECONNECT == 1
+
 // MQTT Start Status
 #define MQTT_START_NOT_STARTED		0x00
 #define MQTT_START_CONNECTIONS_ERROR	0x01
@@ -235,6 +257,27 @@
 #define STATE_REQUEST_RCVD		1
 #define STATE_REQUEST_RCVD24		2
 
+// Inbound PUBLISH commands (MQTT_PUBLISH_DISPATCH)
+#define INBOUND_NONE			0
+#define INBOUND_STATE_REQ		1
+#define INBOUND_STATE_REQ24		2
+#define INBOUND_OUTPUT_PIN		3
+#define INBOUND_OUTPUT_ALL		4
+
+// MQTT topic suffixes for topic_build() (MQTT_TOPIC_PREFIX)
+#define TOPIC_SUFFIX_INPUT		0
+#define TOPIC_SUFFIX_OUTPUT		1
+#define TOPIC_SUFFIX_STATE		2
+#define TOPIC_SUFFIX_STATE24		3
+#define TOPIC_SUFFIX_STATE_CHG		4
+#define TOPIC_SUFFIX_STATE_CHG24	5
+#define TOPIC_SUFFIX_TEMP		6
+#define TOPIC_SUFFIX_BME280_0		7
+#define TOPIC_SUFFIX_BME280_1		8
+#define TOPIC_SUFFIX_BME280_2		9
+#define TOPIC_SUFFIX_AVAILABILITY	10
+#define TOPIC_SUFFIX_HISTORY		11
+
 // Restart State Machine Controls
 #define RESTART_REBOOT_IDLE		0
 #define RESTART_REBOOT_ARM		1
@@ -245,12 +288,215 @@
 #define RESTART_REBOOT_TCPWAIT		7
 #define RESTART_REBOOT_FINISH		8
 
+#if LOOP_PROFILER == 1
+// Main loop profiler phases
+#define PROFILE_RECEIVE			0 // Enc28j60Receive()
+#define PROFILE_UIP			1 // uip_input() / uip_arp_arpin() + send
+#define PROFILE_MQTT			2 // MQTT startup, sanity check, publish
+#define PROFILE_PERIODIC		3 // periodic_service()
+#define PROFILE_RUNTIME			4 // check_runtime_changes()
+#define PROFILE_SENSORS			5 // DS18B20 and BME280 reads
+#define PROFILE_OTHER			6 // Everything else in the main loop
+#define PROFILE_LOOP			7 // Complete main loop pass
+#define PROFILE_PHASES			8
+#define PROFILE_BUCKETS			8
+#define PROFILE_MARK(phase)		loop_profile_mark(phase)
+#else
+#define PROFILE_MARK(phase)
+#endif // LOOP_PROFILER == 1
+
+#if RAM_HEADROOM_STATISTICS == 1
+// The stack starts at __stack (0x7ff, see the .lkf file) and grows down to
+// the stack_limit guardband in the .iconst segment at 0x5fe.
+#define STACK_BOTTOM			0x0600
+#define STACK_TOP			0x07ff
+#define STACK_PAINT			0xa5
+#endif // RAM_HEADROOM_STATISTICS == 1
+
+#if PUBLISH_LATENCY_STATS == 1
+// Input change to MQTT PUBLISH latency stages
+#define LATENCY_SCHEDULE		0 // Debounced change to PUBLISH queued
+#define LATENCY_SEND			1 // PUBLISH queued to copied to uip_buf
+#define LATENCY_TOTAL			2 // Debounced change to uip_buf
+#define LATENCY_STAGES			3
+#define LATENCY_BUCKETS			8
+#define LATENCY_IDLE			0
+#define LATENCY_DETECTED		1
+#define LATENCY_QUEUED			2
+struct latency_stage {
+  uint16_t min;                      // Shortest time seen (ms)
+  uint16_t max;                      // Longest time seen (ms)
+  uint32_t sum;                      // Total of the times (ms)
+  uint16_t count;                    // Number of times recorded
+  uint16_t bucket[LATENCY_BUCKETS];  // Histogram of the times
+};
+#endif // PUBLISH_LATENCY_STATS == 1
+
+#if HTTP_PACING == 1
+// Queueing delay counters of the two traffic classes. PACING_HTTP counts
+// the page segments held back by http_pacing_hold(), PACING_MQTT the
+// messages sent from the mqtt_sendbuf.
+#define PACING_HTTP			0
+#define PACING_MQTT			1
+#define PACING_WINDOW			20   // ms
+#define PACING_MAX_HOLD			100  // ms an HTTP segment may be held
+struct pacing_queue {
+  uint16_t count;                    // Number of delays recorded
+  uint32_t sum;                      // Total of the delays (ms)
+  uint16_t max;                      // Longest delay (ms)
+};
+#endif // HTTP_PACING == 1
+
+#if TRACE_RING_SUPPORT == 1
+// Event trace ring in I2C EEPROM3. The trace is written in 64 byte chunks,
+// one per slot, with the slot given by the chunk sequence number:
+//   0-1    Sequence number, big endian
+//   2      Number of entries (bit 7 set if events were dropped while
+//          the chunk was full)
+//   3      TRACE_MARKER
+//   4-7    second_counter at the first entry, big endian
+//   8-9    ms_counter at the first entry, big endian
+//   10-63  TRACE_ENTRIES entries of 6 bytes:
+//            0-1  ms since the first entry, big endian
+//            2    Event
+//            3    Event argument
+//            4-5  Event value, big endian
+#define TRACE_CHUNK_SIZE		64
+#define TRACE_HEADER_SIZE		10
+#define TRACE_ENTRY_SIZE		6
+#define TRACE_ENTRIES			9
+#define TRACE_SLOTS			512 // 32KB of EEPROM3
+#define TRACE_MARKER			0x54
+// Events
+#define TRACE_BOOT			1 // arg: RST_SR reset flags
+#define TRACE_RX			2 // arg: IP protocol (0 = ARP) or 0x80 |
+                                          //   TCP flags, value: frame length
+#define TRACE_TX			3 // As TRACE_RX
+#define TRACE_TCP			4 // arg: connection << 4 | new state,
+                                          //   value: local port
+#define TRACE_REXMIT			5 // arg: nrtx, value: local port
+#define TRACE_RXERIF			6 // value: RXERIF count
+#define TRACE_MQTT_START		7 // arg: mqtt_start,
+                                          //   value: mqtt_start_status
+#define TRACE_MQTT_RESTART		8 // arg: mqtt_restart_step
+#define TRACE_SYNC			9 // Trace written on demand
+#endif // TRACE_RING_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+// Seconds between the IGMP Membership Reports for the multicast groups
+#define MCAST_REPORT_INTERVAL		60
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+#if MODBUS_TCP_SUPPORT == 1
+// Longest Modbus TCP request served: Write Multiple Registers of both
+// Holding Registers. See modbus_reply() for the register map.
+#define MODBUS_REQUEST_MAX		17
+#define MODBUS_INPUT_REGISTERS		42
+#endif // MODBUS_TCP_SUPPORT == 1
+
+#if DHCP_SUPPORT == 1
+// DHCP client states (see dhcp_service())
+#define DHCP_OFF			0	// Static addresses
+#define DHCP_SELECTING			1	// DISCOVER sent
+#define DHCP_REQUESTING			2	// REQUEST sent for an offer
+#define DHCP_REBOOTING			3	// REQUEST sent for the stored lease
+#define DHCP_BOUND			4	// Lease granted
+#define DHCP_RENEWING			5	// REQUEST sent to extend the lease
+// Seconds between retransmissions, doubled after each one
+#define DHCP_RETRY_MIN			4
+#define DHCP_RETRY_MAX			64
+// Length of the DHCP messages sent (the BOOTP minimum)
+#define DHCP_MSG_LEN			300
+#endif // DHCP_SUPPORT == 1
+
+#if RULE_ENGINE_SUPPORT == 1
+// Rule table (see rule_service())
+#define NUM_RULES			8
+// Condition types, bits 7-5 of rule byte 0
+#define RULE_COND_NONE			0	// Rule not used
+#define RULE_COND_PIN_ON		1	// Pin is ON
+#define RULE_COND_PIN_OFF		2	// Pin is OFF
+#define RULE_COND_TEMP_ABOVE		3	// DS18B20 above byte 1 deg C
+#define RULE_COND_TEMP_BELOW		4	// DS18B20 below byte 1 deg C
+// Action types, bits 7-5 of rule byte 2
+#define RULE_ACT_FOLLOW			1	// ON while true, else OFF
+#define RULE_ACT_FORCE_OFF		2	// OFF while true (interlock)
+#define RULE_ACT_FORCE_ON		3	// ON while true
+#define RULE_ACT_TOGGLE			4	// Toggle when it becomes true
+#define RULE_ACT_DELAY_OFF		5	// ON while true, OFF byte 3
+						// seconds after
+#endif // RULE_ENGINE_SUPPORT == 1
+
+#if SENSOR_DEADBAND_SUPPORT == 1
+// Sensors with a deadband (see sensor_publish_due()). 0 to 4 are the
+// DS18B20 sensors.
+#define DEADBAND_BME280_TEMP		5
+#define DEADBAND_BME280_PRES		6
+#define DEADBAND_BME280_HUM		7
+#define DEADBAND_SENSORS		8
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+
+#if SENSOR_HISTORY_SUPPORT == 1
+// Sensor history ring (see history_sample())
+#define SENSOR_HISTORY_SIZE		32	// Samples in the ring
+#define SENSOR_HISTORY_BATCH		5	// Samples that start a PUBLISH
+#define SENSOR_HISTORY_MAX_AGE		120	// Seconds before a partial
+						// batch is published
+#define SENSOR_HISTORY_PAYLOAD		72	// Longest PUBLISH payload. The
+						// message must fit in the
+						// mqtt_sendbuf.
+struct history_entry {
+  uint16_t time;			// Low 16 bits of second_counter
+  uint8_t id;				// Sensor, see history_sample()
+  int16_t value;
+};
+#endif // SENSOR_HISTORY_SUPPORT == 1
+
 
 int main(void);
 void periodic_service(void);
+#if HTTP_MULTI_SEGMENT == 1
+void send_second_segment(void);
+#endif // HTTP_MULTI_SEGMENT == 1
+#if LOOP_PROFILER == 1
+void loop_profile_init(void);
+void loop_profile_mark(uint8_t phase);
+void loop_profile_loop(void);
+void loop_profile_report(void);
+#endif // LOOP_PROFILER == 1
+#if RAM_HEADROOM_STATISTICS == 1
+void stack_paint(void);
+uint16_t stack_peak(void);
+#endif // RAM_HEADROOM_STATISTICS == 1
+#if PUBLISH_LATENCY_STATS == 1
+void latency_init(void);
+void latency_detect(uint32_t changed);
+void latency_queued(uint32_t pins);
+void latency_sent(void);
+#endif // PUBLISH_LATENCY_STATS == 1
+#if HTTP_PACING == 1
+void pacing_init(void);
+void pacing_record(uint8_t queue, uint16_t ms);
+uint8_t http_pacing_hold(void);
+void http_pacing_spent(uint32_t us);
+#endif // HTTP_PACING == 1
+#if TRACE_RING_SUPPORT == 1
+void trace_init(void);
+void trace_event(uint8_t event, uint8_t arg, uint16_t value);
+void trace_frame(uint8_t event, uint8_t *pBuffer, uint16_t nBytes);
+void trace_tcp_states(void);
+void trace_service(void);
+void trace_sync(void);
+#endif // TRACE_RING_SUPPORT == 1
 void init_IWDG(void);
 void unlock_eeprom(void);
 void lock_eeprom(void);
+#if EEPROM_WRITE_CACHE == 1
+void eeprom_cache_write(uint8_t *addr, uint8_t value);
+uint8_t eeprom_cache_read(uint8_t *addr);
+void eeprom_cache_flush(void);
+void eeprom_cache_service(void);
+#endif // EEPROM_WRITE_CACHE == 1
 void unlock_flash(void);
 void lock_flash(void);
 void upgrade_EEPROM(void);
@@ -261,12 +507,28 @@ uint8_t is_digit(uint8_t character);
 void update_mac_string(void);
 void check_runtime_changes(void);
 uint8_t chk_iotype(uint8_t pin_byte, int pin_index, uint8_t chk_mask);
+#if LINKED_PIN_MASKS == 1
+void build_linked_masks(void);
+#endif // LINKED_PIN_MASKS == 1
+// Sensor init stages run by sensor_init()
+#define SENSOR_INIT_DONE	0
+#define SENSOR_INIT_DS18B20	1
+#define SENSOR_INIT_BME280	2
+#define SENSOR_INIT_INA226	3
+#define SENSOR_INIT_STAGES	4
+void sensor_init(uint8_t stage);
+#if DEFERRED_SENSOR_INIT == 1
+uint16_t boot_elapsed(void);
+#endif // DEFERRED_SENSOR_INIT == 1
 void read_input_pins(uint8_t init_flag);
 void encode_bit_registers(uint8_t sort_init);
 void write_output_pins(void);
 void check_reset_button(void);
 void check_restart_reboot(void);
 void restart(void);
+#if HOT_APPLY_CONFIG == 1
+void hot_apply_config(void);
+#endif // HOT_APPLY_CONFIG == 1
 void reboot(void);
 void oneflash(void);
 void fastflash(void);
@@ -282,17 +544,62 @@ uint8_t compare_flash_to_EEPROM0(void);
 void copy_flash_to_EEPROM0(void);
 uint8_t compare_flash_to_EEPROM1(void);
 void copy_code_uploader_to_EEPROM1(void);
+#if IMAGE_BACKUP_TASK == 1
+// Flash image backup steps run by image_backup_step()
+#define IMAGE_BACKUP_DONE	0
+#define IMAGE_BACKUP_CRC	1
+#define IMAGE_BACKUP_COPY	2
+void image_backup_step(void);
+void image_backup_store_crc(uint32_t crc);
+void image_backup_finish(void);
+#endif // IMAGE_BACKUP_TASK == 1
 
 uint32_t calculate_timer(uint16_t timer_value);
 void decrement_pin_timers(void);
+#if PIN_TIMER_LIST == 1
+void start_pin_timer(uint8_t pin, uint16_t timer_value);
+// Starts (or with a zero count stops) a pin_timer
+#define SET_PIN_TIMER(pin, value)	start_pin_timer((uint8_t)(pin), (value))
+#else // PIN_TIMER_LIST == 0
+#define SET_PIN_TIMER(pin, value)	(pin_timer[pin] = (value))
+#endif // PIN_TIMER_LIST == 1
 
 void mqtt_startup(void);
 void define_temp_sensors(void);
 void define_BME280_sensors(void);
 void send_IOT_msg(uint8_t IOT_ptr, uint8_t IOT, uint8_t DefOrDel);
+void start_auto_discovery(void);
+void ha_resync(void);
+uint16_t discovery_hash_add(uint16_t hash, const uint8_t *pData, uint8_t len);
+uint16_t discovery_hash(void);
 void mqtt_sanity_check(struct mqtt_client *client);
 void publish_callback(void** unused, struct mqtt_response_publish *published);
+#if MQTT_PUBLISH_DISPATCH == 1
+void mqtt_set_output(uint8_t pin, uint8_t on);
+#endif // MQTT_PUBLISH_DISPATCH == 1
 void publish_outbound(void);
+#if UDP_CONTROL_SUPPORT == 1
+void udp_control_call(void);
+#endif // UDP_CONTROL_SUPPORT == 1
+#if UDP_TELEMETRY_SUPPORT == 1
+void telemetry_send(void);
+#endif // UDP_TELEMETRY_SUPPORT == 1
+#if MULTICAST_GROUP_SUPPORT == 1
+void mcast_service(void);
+#endif // MULTICAST_GROUP_SUPPORT == 1
+#if DHCP_SUPPORT == 1
+void dhcp_init(void);
+void dhcp_call(void);
+void dhcp_service(void);
+#endif // DHCP_SUPPORT == 1
+#if RULE_ENGINE_SUPPORT == 1
+uint8_t rule_set(uint8_t index, uint8_t *rule);
+void rule_service(void);
+#endif // RULE_ENGINE_SUPPORT == 1
+#if MODBUS_TCP_SUPPORT == 1
+void modbus_call(void);
+void modbus_reply(uint16_t nBytes);
+#endif // MODBUS_TCP_SUPPORT == 1
 
 #if PCF8574_SUPPORT == 0 && DOMOTICZ_SUPPORT == 0
 void publish_pinstate(uint8_t direction, uint8_t pin, uint16_t value, uint16_t mask);
@@ -302,8 +609,24 @@ void publish_pinstate(uint8_t direction, uint8_t pin, uint32_t value, uint32_t m
 #endif // PCF8574_SUPPORT == 1 || DOMOTICZ_SUPPORT == 1
 
 void publish_pinstate_all(uint8_t type);
+#if MQTT_TOPIC_PREFIX == 1
+void build_topic_prefix(void);
+uint8_t topic_build(unsigned char *topic, uint8_t suffix);
+#endif // MQTT_TOPIC_PREFIX == 1
+#if MQTT_STATE_AGGREGATE == 1
+void publish_pinstate_changes(uint32_t changed);
+#endif // MQTT_STATE_AGGREGATE == 1
 void publish_temperature(uint8_t sensor);
 void publish_BME280(int8_t sensor);
+#if SENSOR_DEADBAND_SUPPORT == 1
+uint8_t sensor_publish_due(uint8_t index);
+void sensor_publish_mark(uint8_t index);
+#endif // SENSOR_DEADBAND_SUPPORT == 1
+#if SENSOR_HISTORY_SUPPORT == 1
+void history_sample(void);
+uint8_t history_due(void);
+void publish_history(void);
+#endif // SENSOR_HISTORY_SUPPORT == 1
 
 int8_t reverse_bit_order(uint8_t k);
 
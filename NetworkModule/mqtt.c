@@ -49,6 +49,9 @@ SOFTWARE.
 #if BUILD_SUPPORT == MQTT_BUILD
 
 extern uint32_t second_counter;
+#if HTTP_PACING == 1
+extern uint16_t ms_counter;       // Free running ms counter
+#endif // HTTP_PACING == 1
 extern uint16_t uip_slen;
 extern uint8_t MQTT_error_status; // Global so GUI can show error status
                                   // indicator
@@ -59,6 +62,11 @@ uint8_t suback_received;          // Used to communicate SUBSCRIBE SUBACK
 
 uint8_t mqtt_sendbuf[MQTT_SENDBUF_SIZE]; // Buffer to contain MQTT transmit
                                          // queue and data.
+#if RAM_HEADROOM_STATISTICS == 1
+uint16_t mqtt_sendbuf_peak;       // Most of the mqtt_sendbuf used (bytes)
+uint8_t mqtt_pbuf_peak;           // Largest message in the MQTT Partial
+                                  // Buffer (bytes)
+#endif // RAM_HEADROOM_STATISTICS == 1
 extern uint8_t mqtt_start;        // Tracks the MQTT startup steps
 
 extern uint8_t OctetArray[14];    // Used in emb_itoa conversions and to
@@ -68,6 +76,14 @@ extern uint8_t OctetArray[14];    // Used in emb_itoa conversions and to
 uint8_t current_msg_length;		// Contains the length of the MQTT
 					// message currently being extracted
 					// from the uip_buf.
+#if MQTT_RECV_STREAM == 1
+uint8_t recv_step;			// Tracks which part of the MQTT
+					// message is being received
+uint8_t recv_lshift;			// Remaining Length byte shift
+uint8_t recv_oversize;			// Set if the message does not fit
+					// in the MQTT Partial Buffer
+uint32_t recv_remaining;		// Message bytes not yet received
+#endif // MQTT_RECV_STREAM == 1
 #endif // HOME_ASSISTANT_SUPPORT == 1
 
 #if DOMOTICZ_SUPPORT == 1
@@ -103,6 +119,12 @@ uint8_t mqtt_partial_buffer_length;	// Trackes the length of data in the
 uint8_t pbi;				// Partial Buffer Index - provides an
 					// index for writing and reading the
 					// MQTT partial buffer
+#if MQTT_ZERO_COPY == 1
+uint8_t mqtt_direct_send;		// Set while the MQTT connection poll
+					// runs publish_outbound(). QOS 0
+					// PUBLISH messages are then packed
+					// directly into the uip_buf.
+#endif // MQTT_ZERO_COPY == 1
 
 
 
@@ -198,6 +220,86 @@ int16_t mqtt_sync(struct mqtt_client *client)
     msgBuffer = uip_appdata;
     total_msg_length = uip_len;
     
+#if MQTT_RECV_STREAM == 1
+    // With MQTT_RECV_STREAM the messages are extracted with a resumable
+    // parser. The Control Byte and the Remaining Length bytes (1 to 4
+    // bytes) are read one at a time, then the rest of the message is
+    // copied to the MQTT Partial Buffer in one block per packet. The parser
+    // step is kept in global memory so a message split across packets
+    // continues where the last packet left off, and every complete message
+    // in a packet is processed in this pass. A message that does not fit
+    // in the MQTT Partial Buffer is read to its end and discarded rather
+    // than overrunning the uip_buf.
+    while (total_msg_length > 0) {
+      if (recv_step == RECV_STEP_BODY) {
+        uint16_t n;
+        uint16_t copy;
+        n = total_msg_length;
+        if (recv_remaining < n) n = (uint16_t)recv_remaining;
+        copy = n;
+        if (copy > (uint16_t)(MQTT_PBUF_SIZE - pbi)) {
+          copy = (uint16_t)(MQTT_PBUF_SIZE - pbi);
+          recv_oversize = 1;
+        }
+        memcpy(&uip_buf[MQTT_PBUF + pbi], msgBuffer, copy);
+        pbi = (uint8_t)(pbi + copy);
+        msgBuffer += n;
+        total_msg_length -= n;
+        recv_remaining -= n;
+      }
+      else {
+        // Capture a header byte from the uip_buf
+        uip_buf[MQTT_PBUF + pbi] = *msgBuffer;
+        msgBuffer++;
+        total_msg_length--;
+        if (recv_step == RECV_STEP_CONTROL) {
+          pbi = 1;
+          recv_remaining = 0;
+          recv_lshift = 0;
+          recv_oversize = 0;
+          recv_step = RECV_STEP_LENGTH;
+          continue;
+        }
+        // Remaining Length byte. The MQTT spec allows a maximum of 4 bytes.
+        if (recv_lshift == 28) {
+          recv_step = RECV_STEP_CONTROL;
+          pbi = 0;
+          return MQTT_ERROR_INVALID_REMAINING_LENGTH;
+        }
+        recv_remaining += (uint32_t)(uip_buf[MQTT_PBUF + pbi] & 0x7f) << recv_lshift;
+        recv_lshift += 7;
+        pbi++;
+        if (uip_buf[MQTT_PBUF + pbi - 1] & 0x80) continue;
+        recv_step = RECV_STEP_BODY;
+      }
+      
+      if (recv_step == RECV_STEP_BODY && recv_remaining == 0) {
+        // Captured a complete message. Call mqtt_recv() then clear the
+        // MQTT Partial Buffer handling variables in case there are more
+        // MQTT messages in the uip_buf after this message.
+        recv_step = RECV_STEP_CONTROL;
+        if (recv_oversize) {
+          pbi = 0;
+          continue;
+        }
+        mqtt_partial_buffer_length = pbi;
+        err = mqtt_recv(client);
+        mqtt_partial_buffer_length = 0;
+        pbi = 0;
+        if (err != MQTT_OK) {
+          return err;
+        }
+        // Call send (see below)
+        err = mqtt_send(client);
+        // Set global MQTT error flag so GUI can show status
+        if (err == MQTT_OK) MQTT_error_status = 1;
+        else MQTT_error_status = 0;
+        if (err != MQTT_OK) {
+          return err;
+        }
+      }
+    } // end of while loop
+#else // MQTT_RECV_STREAM == 0
     while (total_msg_length > 0) {
       // If total_msg_length is greater than zero then there is data in the
       // uip_buf that needs to be read.
@@ -279,6 +381,7 @@ int16_t mqtt_sync(struct mqtt_client *client)
       // are all retained in global memory so that the next packet starts
       // where this one left off.
     } // end of while loop
+#endif // MQTT_RECV_STREAM == 1
   }
   
   // Call send
@@ -938,6 +1041,21 @@ uint16_t mqtt_check_sendbuf(struct mqtt_client *client)
 }
 
 
+#if HTTP_PACING == 1
+uint8_t mqtt_send_pending(struct mqtt_client *client)
+{
+    // Returns 1 if the mqtt_sendbuf holds a message that has not been sent
+    int16_t i;
+    int16_t len;
+    len = mqtt_mq_length(&client->mq);
+    for (i = 0; i < len; i++) {
+        if (mqtt_mq_get(&client->mq, i)->state == MQTT_QUEUED_UNSENT) return 1;
+    }
+    return 0;
+}
+#endif // HTTP_PACING == 1
+
+
 
 uint16_t mqtt_next_pid(struct mqtt_client *client)
 {
@@ -977,6 +1095,9 @@ int16_t mqtt_init(struct mqtt_client *client,
     current_msg_length = 0;
     mqtt_partial_buffer_length = 0;
     pbi = 0;
+#if HOME_ASSISTANT_SUPPORT == 1 && MQTT_RECV_STREAM == 1
+    recv_step = RECV_STEP_CONTROL;
+#endif // HOME_ASSISTANT_SUPPORT == 1 && MQTT_RECV_STREAM == 1
 
     if (client == NULL || sendbuf == NULL || recvbuf == NULL) {
       return MQTT_ERROR_NULLPTR;
@@ -1070,6 +1191,43 @@ int16_t mqtt_publish(struct mqtt_client *client,
     if (client->error < 0) {
         return client->error;
     }
+
+#if MQTT_ZERO_COPY == 1
+    // In the MQTT connection poll the uip_buf is free for transmit data and
+    // the connection has nothing in flight, so a QOS 0 PUBLISH is packed
+    // directly behind any data already placed in the uip_buf. This skips
+    // the copy from the mqtt_sendbuf in mqtt_pal_sendall(). The mqtt_sendbuf
+    // is still used if it holds unsent messages (to keep the messages in
+    // order) or if the PUBLISH does not fit in the TCP segment.
+    if (mqtt_direct_send == 1 && (publish_flags & MQTT_PUBLISH_QOS_MASK) == 0) {
+        int16_t i;
+        int16_t len;
+        len = mqtt_mq_length(&client->mq);
+        for (i = 0; i < len; i++) {
+            if (mqtt_mq_get(&client->mq, i)->state == MQTT_QUEUED_UNSENT) break;
+        }
+        if (i == len) {
+            rv = mqtt_pack_publish_request(
+                    (uint8_t *)uip_appdata + uip_slen, (uint16_t)(UIP_TCP_MSS - uip_slen),
+                    topic_name,
+                    packet_id,
+                    application_message,
+                    application_message_size,
+                    publish_flags
+                    );
+            if (rv < 0) {
+              client->error = rv;
+              return rv;
+            }
+            if (rv > 0) {
+              uip_slen += rv;
+              client->time_of_last_send = second_counter;
+              return MQTT_OK;
+            }
+        }
+    }
+#endif // MQTT_ZERO_COPY == 1
+
     mqtt_mq_clean(&client->mq);
     
     rv = mqtt_pack_publish_request(
@@ -1129,6 +1287,49 @@ int16_t mqtt_subscribe(struct mqtt_client *client,
 }
 
 
+#if MQTT_FAST_RECONNECT == 1
+int16_t mqtt_subscribe_multi(struct mqtt_client *client,
+                             const char* topic_prefix,
+			     const char * const *topic_suffix,
+			     uint8_t count,
+			     int max_qos_level)
+{
+    int16_t rv;
+    uint16_t packet_id;
+    struct mqtt_queued_message *msg;
+    packet_id = mqtt_next_pid(client);
+
+    if (client->error < 0) {
+        return client->error;
+    }
+    mqtt_mq_clean(&client->mq);
+    
+    rv = mqtt_pack_subscribe_multi_request(
+            client->mq.curr, client->mq.curr_sz,
+            packet_id,
+            topic_prefix,
+            topic_suffix,
+            count,
+            max_qos_level
+            );
+	    
+    if (rv < 0) {
+      client->error = rv;
+      return rv;
+    }
+    // The caller falls back to one SUBSCRIBE per topic if the packet does
+    // not fit.
+    if (rv == 0) return MQTT_ERROR_SEND_BUFFER_IS_FULL;
+    msg = mqtt_mq_register(&client->mq, rv);
+    
+    // save the control type and packet id of the message
+    msg->control_type = MQTT_CONTROL_SUBSCRIBE;
+    msg->packet_id = packet_id;
+    return MQTT_OK;
+}
+#endif // MQTT_FAST_RECONNECT == 1
+
+
 int16_t mqtt_ping(struct mqtt_client *client)
 {
     int16_t rv;
@@ -1193,9 +1394,17 @@ int16_t mqtt_send(struct mqtt_client *client)
     // As a result the loop below will terminate with a break if a message is
     // transferred from the mqtt_sendbuf to the uip_buf. The code will be
     // called again later to pick up the next message in the queue.
+    // With MQTT_PUBLISH_BATCH mqtt_pal_sendall() appends each message to
+    // the uip_buf, so the loop continues and all queued messages that fit
+    // are sent in one TCP segment. mqtt_pal_sendall() returns 0 for a
+    // message that does not fit, which ends the loop the same way a
+    // partial send does.
     
     int16_t len;
     int16_t i = 0;
+#if MQTT_PUBLISH_QOS1 == 1
+    uint8_t inflight;
+#endif // MQTT_PUBLISH_QOS1 == 1
     
     if (client->error < 0 && client->error != MQTT_ERROR_SEND_BUFFER_IS_FULL) {
       return client->error;
@@ -1205,6 +1414,18 @@ int16_t mqtt_send(struct mqtt_client *client)
     // number of messages in the message queue.
     len = mqtt_mq_length(&client->mq);
 
+#if MQTT_PUBLISH_QOS1 == 1
+    // Count the QOS 1 PUBLISH messages still awaiting a PUBACK. A new QOS 1
+    // PUBLISH is only sent while fewer than MQTT_QOS1_WINDOW are in flight.
+    inflight = 0;
+    for(; i < len; ++i) {
+      struct mqtt_queued_message *msg = mqtt_mq_get(&client->mq, i);
+      if (msg->control_type == MQTT_CONTROL_PUBLISH
+       && msg->state == MQTT_QUEUED_AWAITING_ACK) inflight++;
+    }
+    i = 0;
+#endif // MQTT_PUBLISH_QOS1 == 1
+
     for(; i < len; ++i) {
       // Even though only one message can be sent each time this function
       // is entered a for() loop is required in case a previously sent
@@ -1231,6 +1452,22 @@ int16_t mqtt_send(struct mqtt_client *client)
       // goto next message if we don't need to send
       if (!resend) continue;
 
+#if MQTT_PUBLISH_QOS1 == 1
+      if (msg->control_type == MQTT_CONTROL_PUBLISH && (msg->start[0] & MQTT_PUBLISH_QOS_MASK)) {
+        if (msg->state == MQTT_QUEUED_UNSENT) {
+          // Hold this and all later QOS 1 PUBLISH messages (to keep them in
+	  // order) until a PUBACK opens the window. Other messages (PINGREQ,
+	  // QOS 0 PUBLISH) are not held.
+          if (inflight >= MQTT_QOS1_WINDOW) continue;
+          inflight++;
+	}
+	else {
+	  // A resend after a PUBACK timeout is marked as a duplicate
+	  msg->start[0] |= MQTT_PUBLISH_DUP;
+	}
+      }
+#endif // MQTT_PUBLISH_QOS1 == 1
+
       // we're sending the message
       {
 	// Some notes about this part of the code. The original code was
@@ -1264,10 +1501,20 @@ int16_t mqtt_send(struct mqtt_client *client)
             // Whole message has been sent - and by "sent" we mean copied
 	    // to the uip_buf.
             client->send_offset = 0;
+#if PUBLISH_LATENCY_STATS == 1
+            if (msg->control_type == MQTT_CONTROL_PUBLISH) latency_sent();
+#endif // PUBLISH_LATENCY_STATS == 1
           }
         }
       }
 
+#if HTTP_PACING == 1
+      // Until the first send time_sent holds the ms_counter value when the
+      // message was queued (see mqtt_mq_register()).
+      if (msg->state == MQTT_QUEUED_UNSENT) {
+        pacing_record(PACING_MQTT, (uint16_t)(ms_counter - (uint16_t)msg->time_sent));
+      }
+#endif // HTTP_PACING == 1
       // update timeout watcher
       client->time_of_last_send = second_counter;
       msg->time_sent = client->time_of_last_send;
@@ -1292,8 +1539,14 @@ int16_t mqtt_send(struct mqtt_client *client)
         msg->state = MQTT_QUEUED_COMPLETE;
         break;
       case MQTT_CONTROL_PUBLISH:
+#if MQTT_PUBLISH_QOS1 == 1
+	// A QOS 1 PUBLISH waits for its PUBACK
+	if (msg->start[0] & MQTT_PUBLISH_QOS_MASK) msg->state = MQTT_QUEUED_AWAITING_ACK;
+	else msg->state = MQTT_QUEUED_COMPLETE;
+#else
 	// This application only sends messages at QOS 0
 	msg->state = MQTT_QUEUED_COMPLETE;
+#endif // MQTT_PUBLISH_QOS1 == 1
         break;
       case MQTT_CONTROL_CONNECT:
       case MQTT_CONTROL_SUBSCRIBE:
@@ -1304,9 +1557,11 @@ int16_t mqtt_send(struct mqtt_client *client)
           client->error = MQTT_ERROR_MALFORMED_REQUEST;
           return MQTT_ERROR_MALFORMED_REQUEST;
       }
+#if MQTT_PUBLISH_BATCH == 0
       // Need to break here - we sent one message (we can only send one
       // message each time this function is called).
       break;
+#endif // MQTT_PUBLISH_BATCH == 0
     }
 
     // check for keep-alive
@@ -1362,6 +1617,9 @@ int16_t mqtt_recv(struct mqtt_client *client)
 
     consumed = 0;
 
+#if RAM_HEADROOM_STATISTICS == 1
+    if (mqtt_partial_buffer_length > mqtt_pbuf_peak) mqtt_pbuf_peak = mqtt_partial_buffer_length;
+#endif // RAM_HEADROOM_STATISTICS == 1
     if (mqtt_partial_buffer_length > 0) rv = mqtt_partial_buffer_length;
     else rv = -1;
     // Attempt to parse
@@ -1384,8 +1642,8 @@ int16_t mqtt_recv(struct mqtt_client *client)
     // MQTT_CONTROL_PUBLISH:
     //     -> stage response, none if qos==0, PUBACK if qos==1, PUBREC if qos==2
     //     -> call publish callback
-    // MQTT_CONTROL_PUBACK: (not implemented as we always PUBLISH with qos==0 thus
-    //                       never receive a PUBACK)
+    // MQTT_CONTROL_PUBACK: (only with MQTT_PUBLISH_QOS1, otherwise we always
+    //                       PUBLISH with qos==0 thus never receive a PUBACK)
     //     -> release associated PUBLISH
     // MQTT_CONTROL_PUBREC: (Not implemented - Only for qos 2)
     //     -> release PUBLISH
@@ -1444,6 +1702,19 @@ int16_t mqtt_recv(struct mqtt_client *client)
             client->publish_response_callback(&client->publish_response_callback_state, &response.decoded.publish);
             break;
 
+#if MQTT_PUBLISH_QOS1 == 1
+        case MQTT_CONTROL_PUBACK:
+            // release associated PUBLISH
+            // A PUBACK for an unknown or already acknowledged packet ID is
+            // ignored. The broker sends a second PUBACK when it receives a
+            // resent (DUP) PUBLISH, so this is not an error.
+            msg = mqtt_mq_find(&client->mq, MQTT_CONTROL_PUBLISH, &response.decoded.puback.packet_id);
+            if (msg != NULL && msg->state == MQTT_QUEUED_AWAITING_ACK) {
+                msg->state = MQTT_QUEUED_COMPLETE;
+            }
+            break;
+#endif // MQTT_PUBLISH_QOS1 == 1
+
         case MQTT_CONTROL_SUBACK:
             // release associated SUBSCRIBE
             msg = mqtt_mq_find(&client->mq, MQTT_CONTROL_SUBSCRIBE, &response.decoded.suback.packet_id);
@@ -1456,6 +1727,19 @@ int16_t mqtt_recv(struct mqtt_client *client)
             msg->state = MQTT_QUEUED_COMPLETE;
             // check that subscription was successful (not currently only one
             // subscribe at a time)
+#if MQTT_FAST_RECONNECT == 1
+            // A SUBSCRIBE from mqtt_subscribe_multi() has one return code per
+            // topic filter.
+            {
+                uint16_t k;
+                for (k = 1; k < response.decoded.suback.num_return_codes; k++) {
+                    if (response.decoded.suback.return_codes[k] == MQTT_SUBACK_FAILURE) {
+                        client->error = MQTT_ERROR_SUBSCRIBE_FAILED;
+                        mqtt_recv_ret = MQTT_ERROR_SUBSCRIBE_FAILED;
+                    }
+                }
+            }
+#endif // MQTT_FAST_RECONNECT == 1
             if (response.decoded.suback.return_codes[0] == MQTT_SUBACK_FAILURE) {
                 client->error = MQTT_ERROR_SUBSCRIBE_FAILED;
                 mqtt_recv_ret = MQTT_ERROR_SUBSCRIBE_FAILED;
@@ -1858,11 +2142,17 @@ int16_t mqtt_pack_publish_request(uint8_t *buf, uint16_t bufsz,
     
     // calculate remaining length
     remaining_length = (uint32_t)(strlen(topic_name) + 2);
+#if MQTT_PUBLISH_QOS1 == 1
+    // A QOS 1 PUBLISH carries a packet id after the topic
+    if (publish_flags & MQTT_PUBLISH_QOS_MASK) remaining_length += 2;
+#endif // MQTT_PUBLISH_QOS1 == 1
 
     remaining_length += (uint32_t)application_message_size;
     fixed_header.remaining_length = remaining_length;
 
     // force dup to 0 if qos is 0 [Spec MQTT-3.3.1-2]
+    // (also for the first send of a QOS 1 PUBLISH - mqtt_send() sets dup
+    // if the PUBLISH is resent)
     publish_flags &= (uint8_t)(~MQTT_PUBLISH_DUP);
     
     fixed_header.control_flags = publish_flags;
@@ -1879,6 +2169,11 @@ int16_t mqtt_pack_publish_request(uint8_t *buf, uint16_t bufsz,
 
     // pack variable header
     buf += mqtt_pack_str(buf, topic_name);
+#if MQTT_PUBLISH_QOS1 == 1
+    if (publish_flags & MQTT_PUBLISH_QOS_MASK) {
+      buf += mqtt_pack_uint16(buf, packet_id);
+    }
+#endif // MQTT_PUBLISH_QOS1 == 1
     
     // pack payload
     memcpy(buf, application_message, application_message_size);
@@ -1949,6 +2244,23 @@ int16_t mqtt_unpack_suback_response (struct mqtt_response *mqtt_response, const
 }
 
 
+#if MQTT_PUBLISH_QOS1 == 1
+/* PUBACK */
+int16_t mqtt_unpack_puback_response(struct mqtt_response *mqtt_response, const uint8_t *buf)
+{
+    // assert remaining length is 2 (the packet id)
+    if (mqtt_response->fixed_header.remaining_length != 2) {
+      return MQTT_ERROR_MALFORMED_RESPONSE;
+    }
+
+    // unpack packet_id
+    mqtt_response->decoded.puback.packet_id = mqtt_unpack_uint16(buf);
+
+    return 2;
+}
+#endif // MQTT_PUBLISH_QOS1 == 1
+
+
 /* SUBSCRIBE */
 int16_t mqtt_pack_subscribe_request(uint8_t *buf, uint16_t bufsz, uint16_t packet_id, char *topic, int max_qos_level)
 {
@@ -1983,6 +2295,60 @@ int16_t mqtt_pack_subscribe_request(uint8_t *buf, uint16_t bufsz, uint16_t packe
 }
 
 
+#if MQTT_FAST_RECONNECT == 1
+int16_t mqtt_pack_subscribe_multi_request(uint8_t *buf, uint16_t bufsz,
+                                          uint16_t packet_id,
+					  const char *topic_prefix,
+					  const char * const *topic_suffix,
+					  uint8_t count,
+					  int max_qos_level)
+{
+    int16_t rv;
+    uint8_t i;
+    uint16_t prefix_len;
+    uint16_t suffix_len;
+    const uint8_t *const start = buf;
+    struct mqtt_fixed_header fixed_header;
+
+    prefix_len = (uint16_t)strlen(topic_prefix);
+
+    // build the fixed header
+    fixed_header.control_type = MQTT_CONTROL_SUBSCRIBE;
+    fixed_header.control_flags = 2u;
+    fixed_header.remaining_length = 2u; // size of variable header
+    // payload is each topic name + max qos (1 byte)
+    for (i = 0; i < count; i++) {
+      fixed_header.remaining_length += (prefix_len + strlen(topic_suffix[i]) + 2 + 1);
+    }
+
+    // pack the fixed header
+    rv = mqtt_pack_fixed_header(buf, bufsz, &fixed_header);
+    if (rv <= 0) return rv;
+    buf += rv;
+    bufsz -= rv;
+
+    // check that the buffer has enough space
+    if (bufsz < fixed_header.remaining_length) return 0;
+        
+    // pack variable header
+    buf += mqtt_pack_uint16(buf, packet_id);
+
+    // pack payload
+    for (i = 0; i < count; i++) {
+      suffix_len = (uint16_t)strlen(topic_suffix[i]);
+      buf += mqtt_pack_uint16(buf, (uint16_t)(prefix_len + suffix_len));
+      memcpy(buf, topic_prefix, prefix_len);
+      buf += prefix_len;
+      memcpy(buf, topic_suffix[i], suffix_len);
+      buf += suffix_len;
+      *buf++ = (uint8_t)max_qos_level; //max_qos
+    }
+
+    return buf - start;
+}
+#endif // MQTT_FAST_RECONNECT == 1
+
+
 /* MESSAGE QUEUE */
 void mqtt_mq_init(struct mqtt_message_queue *mq, void *buf, uint16_t bufsz) 
 {  
@@ -2004,10 +2370,21 @@ struct mqtt_queued_message* mqtt_mq_register(struct mqtt_message_queue *mq, uint
     mq->queue_tail->start = mq->curr;
     mq->queue_tail->size = nbytes;
     mq->queue_tail->state = MQTT_QUEUED_UNSENT;
+#if HTTP_PACING == 1
+    // time_sent is only used once the message is sent. Until then it holds
+    // the time the message was queued for the PACING_MQTT delay.
+    mq->queue_tail->time_sent = ms_counter;
+#endif // HTTP_PACING == 1
 
     // move curr and recalculate curr_sz
     mq->curr += nbytes;
     mq->curr_sz = mqtt_mq_currsz(mq);
+#if RAM_HEADROOM_STATISTICS == 1
+    // The queued messages and their queue entries use what is not free
+    if (MQTT_SENDBUF_SIZE - mq->curr_sz > mqtt_sendbuf_peak) {
+      mqtt_sendbuf_peak = MQTT_SENDBUF_SIZE - mq->curr_sz;
+    }
+#endif // RAM_HEADROOM_STATISTICS == 1
 
     return mq->queue_tail;
 }
@@ -2098,6 +2475,11 @@ int16_t mqtt_unpack_response(struct mqtt_response* response, const uint8_t *buf,
         case MQTT_CONTROL_SUBACK:
             rv = mqtt_unpack_suback_response(response, buf);
             break;
+#if MQTT_PUBLISH_QOS1 == 1
+        case MQTT_CONTROL_PUBACK:
+            rv = mqtt_unpack_puback_response(response, buf);
+            break;
+#endif // MQTT_PUBLISH_QOS1 == 1
         case MQTT_CONTROL_PINGRESP:
             return rv;
         default:
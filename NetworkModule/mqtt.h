@@ -87,11 +87,59 @@ SOFTWARE.
 
 
 // Size of the mqtt_sendbuf
+#if MQTT_ZERO_COPY == 1 && MQTT_PUBLISH_QOS1 == 0
+// With MQTT_ZERO_COPY state and sensor PUBLISH messages normally bypass the
+// mqtt_sendbuf. It must still hold the largest CONNECT (120 bytes) plus its
+// mqtt_queued_message entry.
+#define MQTT_SENDBUF_SIZE 136
+#else
 #define MQTT_SENDBUF_SIZE 160
+#endif // MQTT_ZERO_COPY == 1 && MQTT_PUBLISH_QOS1 == 0
+
+#if MQTT_PUBLISH_BATCH == 1
+// mqtt_sendbuf space needed to queue one more pin state PUBLISH: the
+// longest pin topic and payload (50 bytes) plus its mqtt_queued_message
+// entry.
+#if DOMOTICZ_PUBLISH_BATCH == 1
+// The Domoticz switchlight message is "domoticz/in" and a payload of up
+// to 58 bytes.
+#define MQTT_PUBLISH_ROOM 90
+#else
+#define MQTT_PUBLISH_ROOM 64
+#endif // DOMOTICZ_PUBLISH_BATCH == 1
+#endif // MQTT_PUBLISH_BATCH == 1
+
+#if MQTT_DISCOVERY_BATCH == 1
+// mqtt_sendbuf space needed to queue one more Auto Discovery placeholder
+// PUBLISH: 58 bytes for a pin, 72 bytes for a sensor.
+#define MQTT_DISCOVERY_ROOM_IO 60
+#define MQTT_DISCOVERY_ROOM_SENSOR 80
+#endif // MQTT_DISCOVERY_BATCH == 1
+
+#if MQTT_PUBLISH_QOS1 == 1
+// State and sensor PUBLISH messages are sent at QOS 1. A QOS 1 PUBLISH
+// stays in the mqtt_sendbuf until its PUBACK is received, so the number of
+// PUBLISH messages awaiting a PUBACK is limited. Two of the longest state
+// PUBLISH messages plus their mqtt_queued_message entries fit in the
+// mqtt_sendbuf with room left for a PINGREQ.
+#define MQTT_STATE_QOS MQTT_PUBLISH_QOS_1
+#define MQTT_QOS1_WINDOW 2
+#else
+#define MQTT_STATE_QOS MQTT_PUBLISH_QOS_0
+#endif // MQTT_PUBLISH_QOS1 == 1
+
+#if MQTT_RECV_STREAM == 1
+// mqtt_sync() receive parser steps
+#define RECV_STEP_CONTROL 0
+#define RECV_STEP_LENGTH 1
+#define RECV_STEP_BODY 2
+#endif // MQTT_RECV_STREAM == 1
 
 
 // Function reports the remaining size of the mqtt_sendbuf (the free space
-// remaining in the buffer).
+// remaining in the buffer). struct mqtt_client is only declared further
+// down, so it is declared here for the prototype.
+struct mqtt_client;
 uint16_t mqtt_check_sendbuf(struct mqtt_client *client);
 
 
@@ -288,6 +336,16 @@ struct mqtt_response_pubrel {
 };
 */
 
+#if MQTT_PUBLISH_QOS1 == 1
+// The response to a QOS 1 PUBLISH packet.
+// see <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Toc398718043">
+// MQTT v3.1.1: PUBACK - Publish Acknowledgement.
+struct mqtt_response_puback {
+    // The published messages packet ID.
+    uint16_t packet_id;
+};
+#endif // MQTT_PUBLISH_QOS1 == 1
+
 // An enumeration of subscription acknowledgement return codes.
 // see <a href="http://docs.oasis-open.org/mqtt/mqtt/v3.1.1/os/mqtt-v3.1.1-os.html#_Figure_3.26_-">
 // MQTT v3.1.1: SUBACK Return Codes.
@@ -335,6 +393,9 @@ struct mqtt_response {
     union {
         struct mqtt_response_connack  connack;
         struct mqtt_response_publish  publish;
+#if MQTT_PUBLISH_QOS1 == 1
+        struct mqtt_response_puback   puback;
+#endif // MQTT_PUBLISH_QOS1 == 1
 //        struct mqtt_response_pubrel   pubrel;
         struct mqtt_response_suback   suback;
         struct mqtt_response_pingresp pingresp;
@@ -399,6 +460,21 @@ int16_t mqtt_unpack_publish_response (struct mqtt_response *mqtt_response, const
 int16_t mqtt_unpack_suback_response(struct mqtt_response *mqtt_response, const uint8_t *buf);
 
 
+#if MQTT_PUBLISH_QOS1 == 1
+// Deserialize a PUBACK packet from buf.
+// pre - mqtt_unpack_fixed_header must have returned a positive value and the
+// mqtt_response must have a control type of MQTT_CONTROL_PUBACK.
+//  
+// mqtt_response - the response that is initialized from the contents of buf.
+// buf - the buffer with the incoming data.
+// returns - The number of bytes that were consumed, or a negative value if
+// there was a protocol violation.
+// 
+// see mqtt_response_puback
+int16_t mqtt_unpack_puback_response(struct mqtt_response *mqtt_response, const uint8_t *buf);
+#endif // MQTT_PUBLISH_QOS1 == 1
+
+
 // Deserialize a packet from the broker.
 // response - the mqtt_response that will be initialize from buf.
 // buf - the incoming data buffer.
@@ -565,6 +641,30 @@ int16_t mqtt_pack_subscribe_request(uint8_t *buf, uint16_t bufsz,
 				    int max_qos_level);
 
 
+#if MQTT_FAST_RECONNECT == 1
+// Serialize a SUBSCRIBE packet with several topic filters and put it in buf.
+// Each topic filter is topic_prefix followed by one of the topic_suffix
+// strings, so the full filters never need to be built in RAM.
+// buf - the buffer to put the SUBSCRIBE packet in.
+// bufsz - the maximum number of bytes that can be put into buf.
+// packet_id - the packet ID to be used.
+// topic_prefix - the start of every topic filter
+// topic_suffix - the ends of the topic filters
+// count - the number of topic filters
+// max_qos_level - The maximum QOS level with which the broker can send
+//     application messages for these topics.
+// returns - The number of bytes put into buf, 0 if buf is too small to fit
+//     the SUBSCRIBE packet, a negative value if there was a protocol
+//     violation.
+int16_t mqtt_pack_subscribe_multi_request(uint8_t *buf, uint16_t bufsz,
+                                          uint16_t packet_id,
+					  const char *topic_prefix,
+					  const char * const *topic_suffix,
+					  uint8_t count,
+					  int max_qos_level);
+#endif // MQTT_FAST_RECONNECT == 1
+
+
 // Serialize a PINGREQ and put it into buf.
 // buf - the buffer to put the PINGREQ packet in.
 // bufsz - the maximum number of bytes that can be put into buf.
@@ -941,6 +1041,28 @@ int16_t mqtt_subscribe(struct mqtt_client *client,
 			       int max_qos_level);
 
 
+#if MQTT_FAST_RECONNECT == 1
+// Subscribe to several topics with one SUBSCRIBE packet.
+//
+// prerequisite: mqtt_connect must have been called.
+//  
+// client - The MQTT client.
+// topic_prefix - The start of every topic filter.
+// topic_suffix - The ends of the topic filters.
+// count - The number of topic filters.
+// max_qos_level - The maximum QOS level with which the broker can send
+//     application messages for these topics.
+// returns - MQTT_OK upon success, MQTT_ERROR_SEND_BUFFER_IS_FULL if the
+//     packet does not fit in the mqtt_sendbuf (nothing is queued and the
+//     client error is not set), an MQTTErrors otherwise.
+int16_t mqtt_subscribe_multi(struct mqtt_client *client,
+                             const char* topic_prefix,
+			     const char * const *topic_suffix,
+			     uint8_t count,
+			     int max_qos_level);
+#endif // MQTT_FAST_RECONNECT == 1
+
+
 // Ping the broker. 
 // prerequisite: mqtt_connect must have been called.
 // client - The MQTT client.
@@ -958,4 +1080,12 @@ int16_t mqtt_ping(struct mqtt_client *client);
 // To re-establish the session, mqtt_connect must be called.
 int16_t mqtt_disconnect(struct mqtt_client *client);
 
+
+#if HTTP_PACING == 1
+// Check for messages in the mqtt_sendbuf that are not sent yet.
+// client - The MQTT client.
+// returns - 1 if a message is waiting to be sent, 0 otherwise.
+uint8_t mqtt_send_pending(struct mqtt_client *client);
+#endif // HTTP_PACING == 1
+
 #endif // define __MQTT_H__
@@ -158,6 +158,7 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
   
   char* pBuffer;
   char* mBuffer;
+  char* pStart;
   uint8_t template_buf[4];
   uint8_t payload_buf[16];
   uint16_t payload_size;
@@ -266,7 +267,14 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
   // Check if Publish message with a payload.
   // See https://bytesofgigabytes.com/mqtt/mqtt-protocol-packet-structure/
   // for description of the packet structure examined here.
+#if MQTT_PUBLISH_QOS1 == 1
+  // Auto Discovery placeholders are always published at QOS 0. A QOS 1
+  // PUBLISH has a packet id in front of the payload and is never checked
+  // for a placeholder.
+  if ((template_buf[0] & 0xf6) == 0x30) {
+#else
   if ((template_buf[0] & 0xf0) == 0x30) {
+#endif // MQTT_PUBLISH_QOS1 == 1
     // This is a Publish message
     // Examine remaining length
     if (((template_buf[1] & 0x80) != 0x80)
@@ -335,7 +343,14 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
 	auto_found = 1;
         // Set pointer to uip_appdata, which is the position in the uip_buf
 	// where transmit data is to be placed.
-        pBuffer = uip_appdata;
+#if MQTT_PUBLISH_BATCH == 1
+	// With MQTT_PUBLISH_BATCH the message is built behind any messages
+	// already placed in the uip_buf by this mqtt_send() call.
+        pStart = (char *)uip_appdata + uip_slen;
+#else
+        pStart = uip_appdata;
+#endif // MQTT_PUBLISH_BATCH == 1
+        pBuffer = pStart;
         // Copy the Fixed Header Byte 1 to the uip_buf
         *pBuffer++ = template_buf[0];
 	
@@ -382,6 +397,15 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
 	// Add device name size to payload size
 //        payload_size += (3 * (uint8_t)strlen(stored_devicename));
         payload_size += (2 * (uint8_t)strlen(stored_devicename));
+
+#if MQTT_PUBLISH_BATCH == 1
+	// The message built below is at most payload_size + template_buf[1]
+	// bytes. If it does not fit in the segment behind the messages
+	// already in the uip_buf it is left for the next segment. Returning
+	// 0 tells mqtt_send() that nothing was consumed.
+	if (uip_slen != 0
+	 && (uip_slen + payload_size + template_buf[1]) > UIP_TCP_MSS) return 0;
+#endif // MQTT_PUBLISH_BATCH == 1
     
 	// The "remaining length" value in the MQTT message was 1 byte when we
 	// started, and will be 2 bytes as a result of the payload replacement.
@@ -464,14 +488,18 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
 	}
 	
         // Insert the new remaining length value in the uip_buf.
-        mBuffer = uip_appdata + 1;
+        mBuffer = pStart + 1;
 	*((uint16_t*)mBuffer) = *((uint16_t*)&new_remaining[0]); // copy 2 bytes
 	
 	// Calculate uip_slen (it will be used later). It is the new remaining 
 	// length plus 3 (for the control byte and the two remaining length
 	// bytes). Remember that payload_size is currently equal to the new
 	// remaining length value.
+#if MQTT_PUBLISH_BATCH == 1
+	uip_slen += payload_size + 3;
+#else
 	uip_slen = payload_size + 3;
+#endif // MQTT_PUBLISH_BATCH == 1
     
         // Build the Auto Discovery payload and copy it to the uip_buf. The
 	// pBuffer pointer is already pointing to the the uip_buf location
@@ -741,8 +769,17 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
   if (auto_found != 1) {
     // The payload did not require the replacement procedure, so simply copy
     // the payload data into the uip_buf and set the uip_slen value.
+#if MQTT_PUBLISH_BATCH == 1
+    // Append the message behind any messages already placed in the uip_buf
+    // by this mqtt_send() call. If it does not fit it is left for the next
+    // segment.
+    if (uip_slen != 0 && (uip_slen + len) > UIP_TCP_MSS) return 0;
+    memcpy((uint8_t *)uip_appdata + uip_slen, buf, len);
+    uip_slen += len;
+#else
     memcpy(uip_appdata, buf, len);
     uip_slen = len;
+#endif // MQTT_PUBLISH_BATCH == 1
   }
 
 /*
@@ -824,8 +861,17 @@ int16_t mqtt_pal_sendall(const void* buf, uint16_t len) {
   // This code only services a normal MQTT packet which is completely formed
   // external to this function. Simply copy the payload data into the uip_buf
   // and set the uip_slen value.
+#if MQTT_PUBLISH_BATCH == 1
+  // Append the message behind any messages already placed in the uip_buf
+  // by this mqtt_send() call. If it does not fit it is left for the next
+  // segment.
+  if (uip_slen != 0 && (uip_slen + len) > UIP_TCP_MSS) return 0;
+  memcpy((uint8_t *)uip_appdata + uip_slen, buf, len);
+  uip_slen += len;
+#else
   memcpy(uip_appdata, buf, len);
   uip_slen = len;
+#endif // MQTT_PUBLISH_BATCH == 1
 
 
 
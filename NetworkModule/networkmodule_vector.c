@@ -1,7 +1,24 @@
 /*	INTERRUPT VECTORS TABLE FOR STM8S005
  *	Copyright (c) 2008 by COSMIC Software
  */
+#include "uipopt.h"
+
 extern void _stext();		/* startup routine */
+#if INPUT_EDGE_CAPTURE == 1
+extern @interrupt void exti_porta_isr(void);	/* IO edge capture, see Gpio.c */
+extern @interrupt void exti_portc_isr(void);
+extern @interrupt void exti_portd_isr(void);
+extern @interrupt void exti_porte_isr(void);
+#endif // INPUT_EDGE_CAPTURE == 1
+#if FREE_RUNNING_TIMEBASE == 1
+extern @interrupt void tim1_overflow_isr(void);	/* Timebase, see timer.c */
+#endif // FREE_RUNNING_TIMEBASE == 1
+#if IDLE_WAIT_SUPPORT == 1
+extern @interrupt void tim4_idle_isr(void);	/* Idle wake, see timer.c */
+#if ENC28J60_INT_SUPPORT == 1 && INPUT_EDGE_CAPTURE == 0
+extern @interrupt void exti_enc28j60_isr(void);
+#endif // ENC28J60_INT_SUPPORT == 1 && INPUT_EDGE_CAPTURE == 0
+#endif // IDLE_WAIT_SUPPORT == 1
 
 #pragma section const {vector}
 
@@ -11,14 +28,30 @@ void (* const @vector _vectab[32])() = {
 	0,			/* TLI         */
 	0,			/* AWU         */
 	0,			/* CLK         */
+#if INPUT_EDGE_CAPTURE == 1
+	exti_porta_isr,		/* EXTI0       */
+	0,			/* EXTI1       */
+	exti_portc_isr,		/* EXTI2       */
+	exti_portd_isr,		/* EXTI3       */
+	exti_porte_isr,		/* EXTI4       */
+#else // INPUT_EDGE_CAPTURE == 0
 	0,			/* EXTI0       */
 	0,			/* EXTI1       */
+#if IDLE_WAIT_SUPPORT == 1 && ENC28J60_INT_SUPPORT == 1
+	exti_enc28j60_isr,	/* EXTI2       */
+#else // IDLE_WAIT_SUPPORT == 0 || ENC28J60_INT_SUPPORT == 0
 	0,			/* EXTI2       */
+#endif // IDLE_WAIT_SUPPORT == 1 && ENC28J60_INT_SUPPORT == 1
 	0,			/* EXTI3       */
 	0,			/* EXTI4       */
+#endif // INPUT_EDGE_CAPTURE == 1
 	0,0,			/* Reserved    */
 	0,			/* SPI         */
+#if FREE_RUNNING_TIMEBASE == 1
+	tim1_overflow_isr,	/* TIMER 1 OVF */
+#else // FREE_RUNNING_TIMEBASE == 0
 	0,			/* TIMER 1 OVF */
+#endif // FREE_RUNNING_TIMEBASE == 1
 	0,			/* TIMER 1 CAP */
 	0,			/* TIMER 2 OVF */
 	0,			/* TIMER 2 CAP */
@@ -29,7 +62,11 @@ void (* const @vector _vectab[32])() = {
 	0,			/* UART2 TX    */
 	0,			/* UART2 RX    */
 	0,			/* ADC1        */
+#if IDLE_WAIT_SUPPORT == 1
+	tim4_idle_isr,		/* TIMER 4 OVF */
+#else // IDLE_WAIT_SUPPORT == 0
 	0,			/* TIMER 4 OVF */
+#endif // IDLE_WAIT_SUPPORT == 1
 	0,			/* EEPROM ECC  */
 	0,0,0,0,0,		/* Reserved    */
 	};
@@ -43,6 +43,13 @@ uint8_t I2C_PCF8574_1_WRITE_CMD; // Used to store the write command for the
 				 // indicator. If it remains at zero this
 				 // indicates no PCF devices were discovered.
 
+#if PCF8574_EVENT_IO == 1
+uint8_t PCF8574_out_shadow;      // Last byte written to the PCF8574
+uint8_t PCF8574_in_cache;        // Last byte read from the PCF8574
+uint8_t PCF8574_shadow_valid;    // PCF8574_OUT_VALID and PCF8574_IN_VALID
+                                 // flags
+#endif // PCF8574_EVENT_IO == 1
+
 void PCF8574_init()
 {
   // Search for PCF8574 and PCF8574A devices. Either device type may be on the
@@ -69,6 +76,11 @@ void PCF8574_init()
   uint8_t found;
   found = 0;
   
+#if PCF8574_EVENT_IO == 1
+  // The first write and read after a search always access the device
+  PCF8574_shadow_valid = 0;
+#endif // PCF8574_EVENT_IO == 1
+  
   I2C_PCF8574_1_WRITE_CMD = 0x40; // Start search with PCF8574 devices
   while (1) {
     // In this loop the I2C_PCF8574_1_WRITE_CMD is used as the loop control
@@ -136,6 +148,15 @@ void PCF8574_init()
 void PCF8574_write(uint8_t byte)
 {
   // Function to write single byte to PCF8574
+#if PCF8574_EVENT_IO == 1
+  // The device is only written when the output byte changes. A write also
+  // clears the PCF8574 INT output, so an input change that occurred just
+  // before the write would not be signalled: the input cache is
+  // invalidated to force the next PCF8574_read() to read the device.
+  if ((PCF8574_shadow_valid & PCF8574_OUT_VALID) && (byte == PCF8574_out_shadow)) return;
+  PCF8574_out_shadow = byte;
+  PCF8574_shadow_valid = PCF8574_OUT_VALID;
+#endif // PCF8574_EVENT_IO == 1
   I2C_control(I2C_PCF8574_1_WRITE_CMD);
   I2C_write_byte(byte);
   I2C_stop();
@@ -161,11 +182,26 @@ uint8_t PCF8574_read()
   uint8_t byte;
   uint8_t read_cmd;
   
+#if PCF8574_EVENT_IO == 1
+  // The PCF8574 asserts INT when an input changes from the state last read
+  // (or written), so the device is only read when INT is asserted. Other
+  // calls return the cached byte, which still lets read_input_pins()
+  // complete its two sample debounce.
+  if ((PCF8574_shadow_valid & PCF8574_IN_VALID) && !PCF8574_INT_ASSERTED()) {
+    return PCF8574_in_cache;
+  }
+#endif // PCF8574_EVENT_IO == 1
+  
   read_cmd = (uint8_t)(I2C_PCF8574_1_WRITE_CMD | 0x01);
   I2C_control(read_cmd);
   byte = I2C_read_byte(1);
 //  I2C_stop();
   
+#if PCF8574_EVENT_IO == 1
+  PCF8574_in_cache = byte;
+  PCF8574_shadow_valid |= PCF8574_IN_VALID;
+#endif // PCF8574_EVENT_IO == 1
+  
   return byte;
 }
 
@@ -25,6 +25,14 @@
 #ifndef __PCF8574_H__
 #define __PCF8574_H__
 
+#if PCF8574_EVENT_IO == 1
+// The PCF8574 -INT output is connected to PE7. -INT is active low.
+#define PCF8574_INT_ASSERTED()	(!(PE_IDR & 0x80))
+
+// PCF8574_shadow_valid flags
+#define PCF8574_OUT_VALID	0x01	// PCF8574_out_shadow matches the device
+#define PCF8574_IN_VALID	0x02	// PCF8574_in_cache matches the device
+#endif // PCF8574_EVENT_IO == 1
 
 void PCF8574_init(void);
 void PCF8574_write(uint8_t byte);
@@ -38,6 +38,41 @@ uint32_t second_counter;      // MQTT timing: 1 second counter
 
 uint16_t ms_counter;          // Free running ms counter
 
+#if FREE_RUNNING_TIMEBASE == 1
+static volatile uint16_t tim1_high; // TIM1 overflow count. Upper 16 bits of
+                              // the 32 bit timebase.
+static uint32_t tb_ms_base;   // Timebase count at the last whole ms counted
+                              // by timer_update()
+uint32_t ms_time;             // 32 bit free running ms counter
+#endif // FREE_RUNNING_TIMEBASE == 1
+
+#if LOOP_PROFILER == 1 && FREE_RUNNING_TIMEBASE == 0
+uint16_t tim1_elapsed;        // TIM1 counts (10us) removed from TIM1 by
+                              // timer_update(), see profile_timestamp()
+#endif // LOOP_PROFILER == 1 && FREE_RUNNING_TIMEBASE == 0
+
+#if MAIN_LOOP_SCHEDULER == 1
+// Period in ms of each main loop task (indexed by the TASK_ defines in
+// timer.h)
+static const uint16_t sched_period[SCHED_TASKS] = {
+  1,       // TASK_RUNTIME  check_runtime_changes()
+  1000,    // TASK_DS18B20  DS18B20 read check
+  1000     // TASK_BME280   BME280 read check
+};
+struct sched_task sched_table[SCHED_TASKS]; // Deadline and statistics per task
+uint8_t sched_events;         // Event pending bits, one per task
+#endif // MAIN_LOOP_SCHEDULER == 1
+
+#if IDLE_WAIT_SUPPORT == 1
+static volatile uint16_t idle_wake_stamp; // TIM1 count when the wake
+                              // interrupt ran
+uint16_t idle_count;          // Number of WAITs (saturates at 0xffff)
+uint32_t idle_ticks;          // Total time in WAIT in 10us units
+uint16_t idle_max;            // Longest WAIT in 10us units
+uint16_t idle_latency_max;    // Longest time from the wake interrupt to
+                              // the main loop resuming, in 10us units
+#endif // IDLE_WAIT_SUPPORT == 1
+
 void clock_init(void)
 {
   // Initialize clock speeds and timers
@@ -175,13 +210,27 @@ void clock_init(void)
   // are not used. This will configure TIM1 to increment at ~100KHz. The
   // timer is stopped, reloaded, and restarted in the timer_update()
   // function.
+#if FREE_RUNNING_TIMEBASE == 1
+  // With the FREE_RUNNING_TIMEBASE TIM1 is never stopped or reloaded. It
+  // counts over its full 16 bit range and the update interrupt extends the
+  // count to 32 bits (see tim1_overflow_isr()).
+  TIM1_ARRH = (uint8_t)(0xFF);  // Timing 655ms; Count to decimal
+  TIM1_ARRL = (uint8_t)(0xFF);  //   65535 (0xFFFF)
+#else // FREE_RUNNING_TIMEBASE == 0
   TIM1_ARRH = (uint8_t)(0xFA);  // Timing 640ms; Count to decimal
   TIM1_ARRL = (uint8_t)(0x00);  //   64000 (0xFA00)
+#endif // FREE_RUNNING_TIMEBASE == 1
   TIM1_PSCRH = (uint8_t)(0x00); // 16MHz / (1+159) = 100KHz
   TIM1_PSCRL = (uint8_t)(0x9F); //   10us period
   TIM1_EGR = (uint8_t)0x01;     // Set UG bit to load the PSCR. The
                                 // bit is auto-cleared by hardware.
   TIM1_SR1 = (uint8_t)(~0x01);  // Clear the UIF (update interrupt flag)
+#if FREE_RUNNING_TIMEBASE == 1
+  tim1_high = 0;
+  tb_ms_base = 0;
+  ms_time = 0;
+  TIM1_IER = (uint8_t)0x01;     // Enable the update interrupt
+#endif // FREE_RUNNING_TIMEBASE == 1
   TIM1_CR1 |= 0x01;             // Enable the counter
 
 
@@ -226,7 +275,96 @@ void clock_init(void)
   second_toggle = 0;         // Initialize toggle for seconds counter
   second_counter = 0;        // Initialize seconds counter
   ms_counter = 0;            // Initialize free running ms counter
+
+#if MAIN_LOOP_SCHEDULER == 1
+  {
+    uint8_t i;
+    for (i = 0; i < SCHED_TASKS; i++) {
+      sched_table[i].due = sched_period[i];
+      sched_table[i].max_late = 0;
+      sched_table[i].overruns = 0;
+    }
+    sched_events = 0;
+  }
+#endif // MAIN_LOOP_SCHEDULER == 1
+
+#if FREE_RUNNING_TIMEBASE == 1
+  rim();                     // Start counting TIM1 overflows
+#endif // FREE_RUNNING_TIMEBASE == 1
+}
+
+
+#if FREE_RUNNING_TIMEBASE == 1
+@interrupt void tim1_overflow_isr(void)
+{
+  // TIM1 update (overflow) interrupt. Counts the upper 16 bits of the
+  // timebase.
+  TIM1_SR1 = (uint8_t)(~0x01);  // Clear the UIF (update interrupt flag)
+  tim1_high++;
+}
+
+
+static uint32_t tb_read(void)
+{
+  // Returns the 32 bit timebase count (10us per count). Must be called with
+  // interrupts disabled or from an interrupt. An overflow that has not been
+  // counted yet by tim1_overflow_isr() is still flagged in UIF. If UIF is set
+  // and the counter has already wrapped the overflow is added here. The
+  // count rolls over about every 11.9 hours.
+  uint16_t high;
+  uint16_t counter;
+  
+  high = tim1_high;
+  counter = (uint16_t)(TIM1_CNTRH << 8);
+  counter = counter | TIM1_CNTRL;
+  if ((TIM1_SR1 & 0x01) && counter < 0x8000) high++;
+  
+  return ((uint32_t)high << 16) | counter;
+}
+
+
+static uint32_t tb_div100(uint32_t ticks)
+{
+  // Converts timebase counts to ms. Gaps between timer_update() calls are
+  // almost always less than 655ms, so the 16 bit divide is used for those.
+  if (ticks < 0x10000) return (uint16_t)ticks / 100;
+  return ticks / 100;
+}
+
+
+uint32_t now_us(void)
+{
+  // Returns the free running 32 bit time in microseconds with a 10us
+  // resolution. The value rolls over every 71.5 minutes, so differences
+  // between two values are valid up to that length. Not for use in
+  // interrupts (interrupts are enabled on return).
+  uint32_t ticks;
+  
+  sim();
+  ticks = tb_read();
+  rim();
+  
+  return ticks * 10;
+}
+
+
+uint32_t now_ms(void)
+{
+  // Returns the free running 32 bit time in milliseconds. This is ms_time
+  // plus the whole milliseconds accumulated since the last timer_update(),
+  // so it is current even when the main loop has been delayed. Not for use
+  // in interrupts (interrupts are enabled on return).
+  uint32_t ticks;
+  uint32_t ms;
+  
+  sim();
+  ticks = tb_read() - tb_ms_base;
+  ms = ms_time;
+  rim();
+  
+  return ms + tb_div100(ticks);
 }
+#endif // FREE_RUNNING_TIMEBASE == 1
 
 
 void timer_update(void)
@@ -281,12 +419,36 @@ void timer_update(void)
   // calling timer_update(). If the counter does over-flow the time collected
   // can be in error in 640ms increments. The overall main loop design must
   // guarantee that this does not happen.
+  //
+  // With the FREE_RUNNING_TIMEBASE TIM1 is not stopped or reloaded. The
+  // elapsed time is the difference between the 32 bit timebase and the
+  // timebase count of the last whole millisecond, so no ticks are lost and
+  // the 640ms limit above does not apply.
 
   
-  uint16_t counter;
   uint16_t time_ms;
+#if FREE_RUNNING_TIMEBASE == 1
+  uint32_t elapsed;
+#else // FREE_RUNNING_TIMEBASE == 0
+  uint16_t counter;
   uint16_t remainder;
+#endif // FREE_RUNNING_TIMEBASE == 1
   
+#if FREE_RUNNING_TIMEBASE == 1
+  // Interrupts are disabled so that ms_timestamp() and now_ms() never see
+  // tb_ms_base advanced before ms_counter and ms_time.
+  sim();
+  elapsed = tb_read() - tb_ms_base;
+  time_ms = (uint16_t)tb_div100(elapsed);
+  tb_ms_base += (uint32_t)time_ms * 100;
+  ms_time += time_ms;
+#else // FREE_RUNNING_TIMEBASE == 0
+#if INPUT_EDGE_CAPTURE == 1 || IDLE_WAIT_SUPPORT == 1
+  // The EXTI edge capture and idle wake interrupts read TIM1 (and
+  // ms_counter with ms_timestamp()). Keep them from splitting the TIM1 read
+  // or seeing TIM1 reloaded before ms_counter is updated.
+  sim();
+#endif // INPUT_EDGE_CAPTURE == 1 || IDLE_WAIT_SUPPORT == 1
   // Read the counter
   counter = (uint16_t)(TIM1_CNTRH << 8);
   counter = counter | TIM1_CNTRL;
@@ -303,6 +465,7 @@ void timer_update(void)
   TIM1_CNTRH = (uint8_t)(remainder >> 8);
   TIM1_CNTRL = (uint8_t)(remainder & 0x00ff);
   TIM1_CR1 |= (uint8_t)0x01;		// Enable counter
+#endif // FREE_RUNNING_TIMEBASE == 1
 
   // Increment the timers per the number of ms collected above. The timer's
   // respective "_expired" function calls will determine their timeout points.
@@ -316,6 +479,14 @@ void timer_update(void)
   // not called every millisecond the content of the ms_counter can leap ahead,
   // but the total count remains accurate.
   ms_counter = (uint16_t)(ms_counter + time_ms);
+#if FREE_RUNNING_TIMEBASE == 1 || INPUT_EDGE_CAPTURE == 1 || IDLE_WAIT_SUPPORT == 1
+  rim();
+#endif // FREE_RUNNING_TIMEBASE == 1 || INPUT_EDGE_CAPTURE == 1 || IDLE_WAIT_SUPPORT == 1
+
+#if LOOP_PROFILER == 1 && FREE_RUNNING_TIMEBASE == 0
+  // Keep the profiler time base running across the TIM1 reload
+  tim1_elapsed = (uint16_t)(tim1_elapsed + (time_ms * 100));
+#endif // LOOP_PROFILER == 1 && FREE_RUNNING_TIMEBASE == 0
   
   
   // Update the second_counter. The second_counter is a 32 bit unsigned
@@ -391,6 +562,226 @@ uint8_t arp_timer_expired(void)
 }
 
 
+#if LOOP_PROFILER == 1
+uint16_t profile_timestamp(void)
+{
+  // Returns a free running count with a 10us period for use by the main
+  // loop profiler. TIM1 is reloaded by timer_update() so the counts removed
+  // from TIM1 are added back here. The count rolls over every 655ms, so
+  // differences between two timestamps are valid up to that length.
+  //
+  // With the FREE_RUNNING_TIMEBASE TIM1 is never reloaded and the TIM1
+  // counter is the low 16 bits of the timebase. Interrupts are disabled so
+  // the two byte read is not split by an interrupt reading TIM1.
+  uint16_t counter;
+  
+#if FREE_RUNNING_TIMEBASE == 1
+  sim();
+  counter = (uint16_t)(TIM1_CNTRH << 8);
+  counter = counter | TIM1_CNTRL;
+  rim();
+  
+  return counter;
+#else // FREE_RUNNING_TIMEBASE == 0
+  counter = (uint16_t)(TIM1_CNTRH << 8);
+  counter = counter | TIM1_CNTRL;
+  
+  return (uint16_t)(tim1_elapsed + counter);
+#endif // FREE_RUNNING_TIMEBASE == 1
+}
+#endif // LOOP_PROFILER == 1
+
+
+#if INPUT_EDGE_CAPTURE == 1
+uint16_t ms_timestamp(void)
+{
+  // Returns the free running ms_counter plus the whole milliseconds that
+  // have accumulated in TIM1 since the last timer_update(). This lets the
+  // EXTI edge capture interrupts timestamp an edge when it occurs rather
+  // than when the main loop next runs timer_update(). Callers outside of an
+  // interrupt must disable interrupts around the call so that the two byte
+  // TIM1 read is not split by an interrupt reading TIM1.
+#if FREE_RUNNING_TIMEBASE == 1
+  return (uint16_t)(ms_counter + tb_div100(tb_read() - tb_ms_base));
+#else // FREE_RUNNING_TIMEBASE == 0
+  uint16_t counter;
+  
+  counter = (uint16_t)(TIM1_CNTRH << 8);
+  counter = counter | TIM1_CNTRL;
+  
+  return (uint16_t)(ms_counter + (counter / 100));
+#endif // FREE_RUNNING_TIMEBASE == 1
+}
+#endif // INPUT_EDGE_CAPTURE == 1
+
+
+#if IDLE_WAIT_SUPPORT == 1
+static uint16_t tim1_count(void)
+{
+  uint16_t counter;
+  
+  counter = (uint16_t)(TIM1_CNTRH << 8);
+  counter = counter | TIM1_CNTRL;
+  return counter;
+}
+
+
+void idle_wake_mark(void)
+{
+  // Called by every interrupt that can end an idle_wait() to record the
+  // time of the wake event.
+  idle_wake_stamp = tim1_count();
+}
+
+
+@interrupt void tim4_idle_isr(void)
+{
+  // TIM4 update every 1ms. This bounds the time spent in WAIT so that the
+  // main loop timers and scheduler deadlines (all in ms) are still met.
+  TIM4_SR = (uint8_t)(~0x01);   // Clear the UIF (update interrupt flag)
+  idle_wake_mark();
+}
+
+
+#if ENC28J60_INT_SUPPORT == 1 && INPUT_EDGE_CAPTURE == 0
+@interrupt void exti_enc28j60_isr(void)
+{
+  // Port C external interrupt on the falling edge of the ENC28J60 -INT
+  // output (PC5). Only used to wake idle_wait(); the main loop then reads
+  // the ENC28J60 as usual.
+  idle_wake_mark();
+}
+#endif // ENC28J60_INT_SUPPORT == 1 && INPUT_EDGE_CAPTURE == 0
+
+
+void idle_init(void)
+{
+  // Sets up the interrupts that wake the processor from WAIT:
+  // - TIM4 is run at 16MHz / 128 = 125KHz and reloads at 125 for a 1ms
+  //   update interrupt.
+  // - With ENC28J60_INT_SUPPORT the ENC28J60 -INT output (PC5) generates a
+  //   Port C interrupt on its falling edge so that a received packet ends
+  //   the WAIT at once. With INPUT_EDGE_CAPTURE Port C is already set to
+  //   interrupt on both edges and edge_capture() ignores PC5.
+  // - With INPUT_EDGE_CAPTURE the Input pin edges also end a WAIT.
+  // Must be called after gpio_init().
+  sim();
+  CLK_PCKENR1 |= (uint8_t)0x10;	// TIM4 clock enabled
+  TIM4_PSCR = (uint8_t)0x07;	// Pre-scale divider is 2^7 = divide by 128
+  TIM4_ARR = (uint8_t)124;	// Count 0 to 124 = 1ms
+  TIM4_SR = (uint8_t)(~0x01);	// Clear the UIF (update interrupt flag)
+  TIM4_IER = (uint8_t)0x01;	// Enable the update interrupt
+  TIM4_CR1 = (uint8_t)0x01;	// Enable TIM4
+  
+#if ENC28J60_INT_SUPPORT == 1
+#if INPUT_EDGE_CAPTURE == 0
+  EXTI_CR1 = (uint8_t)((EXTI_CR1 & ~0x30) | 0x20); // Port C falling edge only
+#endif // INPUT_EDGE_CAPTURE == 0
+  PC_CR2 |= (uint8_t)0x20;	// Enable the PC5 (-INT) external interrupt
+#endif // ENC28J60_INT_SUPPORT == 1
+  
+  idle_count = 0;
+  idle_ticks = 0;
+  idle_max = 0;
+  idle_latency_max = 0;
+  rim();
+}
+
+
+void idle_wait(void)
+{
+  // Called at the end of a main loop pass that found no work. The processor
+  // is put in WAIT mode (WFI): the CPU clock stops and the peripherals keep
+  // running until an interrupt occurs. The TIM4 interrupt ends the WAIT
+  // within 1ms, and the ENC28J60 and Input edge interrupts end it
+  // immediately.
+  //
+  // Interrupts are disabled while the ENC28J60 -INT pin is checked so that
+  // an edge arriving between the check and the WFI is held pending and ends
+  // the WAIT at once (WFI re-enables interrupts). A packet that is already
+  // waiting skips the WAIT because its falling edge has already passed.
+  //
+  // The time in WAIT and the wake latency (time from the wake interrupt to
+  // the main loop resuming) are recorded. TIM1 is not reloaded here so the
+  // difference of two TIM1 counts is valid unless TIM1 wrapped. With the
+  // FREE_RUNNING_TIMEBASE TIM1 wraps at 65536 and the 16 bit difference is
+  // valid across the wrap.
+  uint16_t start;
+  uint16_t end;
+  uint16_t latency;
+  
+  sim();
+#if ENC28J60_INT_SUPPORT == 1
+  if (ENC28J60_INT_ASSERTED()) {
+    rim();
+    return;
+  }
+#endif // ENC28J60_INT_SUPPORT == 1
+  start = tim1_count();
+  idle_wake_stamp = start;
+  wfi();
+  sim();
+  end = tim1_count();
+  latency = (uint16_t)(end - idle_wake_stamp);
+  rim();
+  
+#if FREE_RUNNING_TIMEBASE == 0
+  if (end < start) return; // TIM1 wrapped
+#endif // FREE_RUNNING_TIMEBASE == 0
+  if (idle_count != 0xffff) idle_count++;
+  idle_ticks += (uint16_t)(end - start);
+  if ((uint16_t)(end - start) > idle_max) idle_max = (uint16_t)(end - start);
+  if (latency > idle_latency_max) idle_latency_max = latency;
+}
+#endif // IDLE_WAIT_SUPPORT == 1
+
+
+#if MAIN_LOOP_SCHEDULER == 1
+uint8_t sched_due(uint8_t task)
+{
+  // Called by the main loop for each scheduled task (see SCHED_DUE()).
+  // Returns 1 if the task should run on this pass, either because its
+  // deadline has been reached or because an event was posted for it with
+  // SCHED_EVENT(). Otherwise returns 0 and the task is skipped.
+  //
+  // When a deadline is reached the next deadline is one period later, so
+  // tasks keep their rate even if the main loop is late. max_late records
+  // the worst lateness in ms. If a whole period was missed the overrun
+  // counter is incremented and the task is rescheduled from now rather
+  // than running several times to catch up. Running a task for an event
+  // does not move its deadline.
+  //
+  // Deadlines are compared with ms_counter as a signed difference, so
+  // periods must be less than 32 seconds.
+  uint16_t late;
+  uint8_t mask;
+  
+  mask = (uint8_t)(1 << task);
+  late = (uint16_t)(ms_counter - sched_table[task].due);
+  
+  if (late & 0x8000) {
+    // Deadline not yet reached
+    if (sched_events & mask) {
+      sched_events &= (uint8_t)(~mask);
+      return 1;
+    }
+    return 0;
+  }
+  
+  sched_events &= (uint8_t)(~mask);
+  if (late > sched_table[task].max_late) sched_table[task].max_late = late;
+  if (late >= sched_period[task]) {
+    if (sched_table[task].overruns != 0xffff) sched_table[task].overruns++;
+    sched_table[task].due = (uint16_t)(ms_counter + sched_period[task]);
+  }
+  else {
+    sched_table[task].due = (uint16_t)(sched_table[task].due + sched_period[task]);
+  }
+  return 1;
+}
+#endif // MAIN_LOOP_SCHEDULER == 1
+
+
 void wait_timer(uint16_t wait)
 {
   // This function waits for expiration of TIM3 and will not return until the
@@ -402,6 +793,9 @@ void wait_timer(uint16_t wait)
   // time. While the counter can count to 65535 it is recommended that a max
   // wait of 50000 be used so that the code has time to evaluate. Call the
   // delay multiple times if more than 50000uS is needed.
+  //
+  // TIM3 is restarted for every wait and is not shared with the
+  // FREE_RUNNING_TIMEBASE, so the short 1-Wire waits keep a 1us resolution.
   uint16_t counter;
 
   TIM3_CR1 &= (uint8_t)(~0x01);		// Disable counter
@@ -33,6 +33,56 @@ uint8_t arp_timer_expired(void);
 uint8_t mqtt_timer_expired(void);
 uint8_t t100ms_timer_expired(void);
 void wait_timer(uint16_t wait);
+#if LOOP_PROFILER == 1
+uint16_t profile_timestamp(void);
+#endif // LOOP_PROFILER == 1
+#if FREE_RUNNING_TIMEBASE == 1
+extern uint32_t ms_time;
+uint32_t now_us(void);
+uint32_t now_ms(void);
+#endif // FREE_RUNNING_TIMEBASE == 1
+
+#if INPUT_EDGE_CAPTURE == 1
+uint16_t ms_timestamp(void);
+#endif // INPUT_EDGE_CAPTURE == 1
+
+#if IDLE_WAIT_SUPPORT == 1
+extern uint16_t idle_count;
+extern uint32_t idle_ticks;
+extern uint16_t idle_max;
+extern uint16_t idle_latency_max;
+void idle_wake_mark(void);
+void idle_init(void);
+void idle_wait(void);
+#endif // IDLE_WAIT_SUPPORT == 1
+
+#if MAIN_LOOP_SCHEDULER == 1
+// Main loop tasks run by the scheduler. The periods are in sched_period[]
+// in timer.c.
+#define TASK_RUNTIME	0	// check_runtime_changes()
+#define TASK_DS18B20	1	// DS18B20 read check
+#define TASK_BME280	2	// BME280 read check
+#define SCHED_TASKS	3
+
+struct sched_task {
+  uint16_t due;              // ms_counter value of the next deadline
+  uint16_t max_late;         // Worst lateness past a deadline in ms
+  uint16_t overruns;         // Number of times a whole period was missed
+};
+
+extern struct sched_task sched_table[SCHED_TASKS];
+extern uint8_t sched_events;
+
+uint8_t sched_due(uint8_t task);
+
+// SCHED_DUE() is true if the task should run on this pass. SCHED_EVENT()
+// makes the task run on the next pass regardless of its deadline.
+#define SCHED_DUE(task)		sched_due(task)
+#define SCHED_EVENT(task)	(sched_events |= (uint8_t)(1 << (task)))
+#else // MAIN_LOOP_SCHEDULER == 0
+#define SCHED_DUE(task)		1
+#define SCHED_EVENT(task)
+#endif // MAIN_LOOP_SCHEDULER == 1
 
 #endif /* __TIMER_H__ */
 
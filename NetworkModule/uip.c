@@ -151,6 +151,64 @@ uint8_t uip_flags;                    /* The uip_flags variable is used for
                                          communication between the TCP/IP
 					 stack and the application program. */
 				      
+#if HTTP_MULTI_SEGMENT == 1
+uint8_t uip_sendmore;                 /* Set while the application fills the
+                                         second segment of the window. */
+
+static uint8_t send_seg2;             /* Set when the segment being sent is
+                                         the second segment of the window. */
+#endif // HTTP_MULTI_SEGMENT == 1
+
+#if PERIODIC_WORK_FLAGS == 1
+uint8_t uip_periodic_due;             /* One bit per connection. Set if the
+                                         application has outbound work for
+                                         the connection. */
+#endif // PERIODIC_WORK_FLAGS == 1
+
+#if TCP_FAST_REXMIT == 1
+uint16_t fast_rexmit_count;           /* Counts duplicate ACK retransmits. */
+uint16_t rexmit_latency_max;          /* Longest time from sending a segment
+                                         to its first retransmit (ms). */
+
+// RTT estimator tick is 32ms (ms_counter >> 5)
+#define TCP_RTT_SHIFT		5
+// RTO limits in ticks: about 200ms, and UIP_RTO
+#define TCP_RTO_MIN		7
+#define TCP_RTO_MAX		((UIP_RTO * 1000) >> TCP_RTT_SHIFT)
+// Duplicate ACKs that trigger a fast retransmit
+#define TCP_DUPACK_THRESHOLD	3
+#endif // TCP_FAST_REXMIT == 1
+
+#if TCP_SYN_BACKLOG == 1
+// SYNs that arrived while all connections were in use
+struct syn_backlog_entry {
+  uip_ipaddr_t ripaddr;  // Remote IP address
+  uint16_t rport;        // Remote port, 0 if the entry is unused
+  uint16_t lport;        // Local (listening) port
+  uint8_t seqno[4];      // Sequence number of the SYN
+  uint16_t ms;           // ms_counter when the SYN was last received
+};
+#define TCP_SYN_BACKLOG_SIZE	2
+static struct syn_backlog_entry syn_backlog[TCP_SYN_BACKLOG_SIZE];
+// A backlog entry is dropped after 10 seconds
+#define TCP_SYN_BACKLOG_AGE	10000
+// TIME_WAIT of connections accepted on a listening port (seconds)
+#define TCP_SERVER_TIME_WAIT	2
+#endif // TCP_SYN_BACKLOG == 1
+
+#if HTTP_SPLIT_OUTPUT == 1
+uint16_t split_count;                 /* Counts segments sent as two
+                                         halves. */
+#endif // HTTP_SPLIT_OUTPUT == 1
+
+#if HTTP_FUSED_CHKSUM == 1
+static uint16_t payload_sum;          /* Checksum of the payload provided
+                                         by uip_payload_chksum(). */
+static uint16_t payload_sum_len;      /* Length of the summed payload. */
+static uint8_t payload_sum_valid;     /* Set when payload_sum can be used
+                                         for the next TCP checksum. */
+#endif // HTTP_FUSED_CHKSUM == 1
+
 struct uip_conn *uip_conn;            /* uip_conn always points to the current
                                          connection. */
 
@@ -217,6 +275,14 @@ static uint16_t tmp16;
 #define BUF ((struct uip_tcpip_hdr *)&uip_buf[UIP_LLH_LEN])
 #define FBUF ((struct uip_tcpip_hdr *)&uip_reassbuf[0])
 #define ICMPBUF ((struct uip_icmpip_hdr *)&uip_buf[UIP_LLH_LEN])
+#if UDP_CONTROL_SUPPORT == 1
+#define UDPBUF ((struct uip_udpip_hdr *)&uip_buf[UIP_LLH_LEN])
+#endif // UDP_CONTROL_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+uip_ipaddr_t uip_mcast_groups[UIP_MCAST_GROUPS]; // Multicast groups joined
+uint8_t uip_mcast_rx;           // 1 while a datagram to a group is processed
+#endif // MULTICAST_GROUP_SUPPORT == 1
 
 #if NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
 struct uip_stats uip_stat;
@@ -254,9 +320,9 @@ void uip_add32(uint8_t *op32, uint16_t op16)
 #endif /* UIP_ARCH_ADD32 */
 
 
-#if ! UIP_ARCH_CHKSUM
+#if ! UIP_ARCH_CHKSUM || CHKSUM_BENCHMARK == 1
 //---------------------------------------------------------------------------//
-static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len)
+static uint16_t chksum_c(uint16_t sum, const uint8_t *data, uint16_t len)
 {
   uint16_t t;
   const uint8_t *dataptr;
@@ -280,6 +346,131 @@ static uint16_t chksum(uint16_t sum, const uint8_t *data, uint16_t len)
   /* Return sum in host byte order. */
   return sum;
 }
+#endif /* ! UIP_ARCH_CHKSUM || CHKSUM_BENCHMARK == 1 */
+
+
+#if UIP_ARCH_CHKSUM || HTTP_FUSED_CHKSUM == 1
+//---------------------------------------------------------------------------//
+static uint16_t chksum_fold(uint16_t hi, uint16_t lo)
+{
+  // Combines a high byte sum and a low byte sum (as made by chksum_arch()
+  // and CopyHttpData()) into a 16 bit one's complement sum. hi has a weight of 256. The part of
+  // hi * 256 that does not fit in 16 bits is added back at the bottom (the
+  // end around carry).
+  uint16_t sum;
+  uint16_t t;
+
+  sum = lo;
+  t = (uint16_t)(hi << 8);
+  sum += t;
+  if (sum < t) sum++; /* carry */
+  t = hi >> 8;
+  sum += t;
+  if (sum < t) sum++; /* carry */
+  return sum;
+}
+#endif /* UIP_ARCH_CHKSUM || HTTP_FUSED_CHKSUM == 1 */
+
+
+#if UIP_ARCH_CHKSUM
+//---------------------------------------------------------------------------//
+static uint16_t chksum_arch(uint16_t sum, const uint8_t *data, uint16_t len)
+{
+  // STM8 version of chksum(). The C version builds each 16 bit word from
+  // two bytes and needs a compare and branch after every word add to catch
+  // the carry. Here the high bytes and the low bytes of the words are
+  // summed in two 16 bit accumulators instead, 4 words per pass. Adding
+  // bytes can't overflow an accumulator until more than 257 bytes are
+  // added, so the carries are only folded back in after each block of up
+  // to 60 passes (240 bytes per accumulator).
+  uint16_t hi;
+  uint16_t lo;
+  uint8_t n;
+
+  hi = sum >> 8;
+  lo = sum & 0xff;
+
+  while (len >= 8) {
+    if (len >= (60 * 8)) n = 60;
+    else n = (uint8_t)(len >> 3);
+    len -= (uint16_t)(n << 3);
+    do {
+      hi += data[0];
+      lo += data[1];
+      hi += data[2];
+      lo += data[3];
+      hi += data[4];
+      lo += data[5];
+      hi += data[6];
+      lo += data[7];
+      data += 8;
+    } while (--n);
+    sum = chksum_fold(hi, lo);
+    hi = sum >> 8;
+    lo = sum & 0xff;
+  }
+
+  // Remaining words and the odd byte (if any)
+  while (len >= 2) {
+    hi += data[0];
+    lo += data[1];
+    data += 2;
+    len -= 2;
+  }
+  if (len) hi += data[0];
+
+  /* Return sum in host byte order. */
+  return chksum_fold(hi, lo);
+}
+#define chksum chksum_arch
+#else
+#define chksum chksum_c
+#endif /* UIP_ARCH_CHKSUM */
+
+
+#if CHKSUM_BENCHMARK == 1
+//---------------------------------------------------------------------------//
+void uip_chksum_benchmark(void)
+{
+  // Times 10 runs of each checksum loop over a 500 byte buffer and prints
+  // the time per run in microseconds and CPU cycles (16MHz) on the UART.
+  // The uip_buf is used as the buffer, so this must only be called before
+  // the network is started.
+  uint16_t i;
+  uint16_t start;
+  uint16_t time_c;
+  uint16_t time_arch;
+  uint16_t sum_c;
+  uint16_t sum_arch;
+
+  for (i = 0; i < 500; i++) uip_buf[i] = (uint8_t)((i * 7) + 3);
+
+  start = profile_timestamp();
+  for (i = 0; i < 10; i++) sum_c = chksum_c(0, uip_buf, 500);
+  time_c = (uint16_t)(profile_timestamp() - start);
+
+  start = profile_timestamp();
+  for (i = 0; i < 10; i++) sum_arch = chksum_arch(0, uip_buf, 500);
+  time_arch = (uint16_t)(profile_timestamp() - start);
+
+  // 10 runs of 10us ticks gives microseconds per run
+  UARTPrintf("chksum 500 bytes   C: ");
+  emb_itoa(time_c, OctetArray, 10, 5);
+  UARTPrintf(OctetArray);
+  UARTPrintf("us ");
+  emb_itoa((uint32_t)time_c * 16, OctetArray, 10, 6);
+  UARTPrintf(OctetArray);
+  UARTPrintf(" cycles   ARCH: ");
+  emb_itoa(time_arch, OctetArray, 10, 5);
+  UARTPrintf(OctetArray);
+  UARTPrintf("us ");
+  emb_itoa((uint32_t)time_arch * 16, OctetArray, 10, 6);
+  UARTPrintf(OctetArray);
+  UARTPrintf(" cycles");
+  if (sum_c != sum_arch) UARTPrintf("   SUM MISMATCH");
+  UARTPrintf("\r\n");
+}
+#endif // CHKSUM_BENCHMARK == 1
 
 
 //---------------------------------------------------------------------------//
@@ -317,6 +508,20 @@ static uint16_t upper_layer_chksum(uint8_t proto)
   /* Sum IP source and destination addresses. */
   sum = chksum(sum, (uint8_t *)&BUF->srcipaddr[0], 2 * sizeof(uip_ipaddr_t));
 
+#if HTTP_FUSED_CHKSUM == 1
+  if (payload_sum_valid
+   && proto == UIP_PROTO_TCP
+   && BUF->tcpoffset == ((UIP_TCPH_LEN / 4) << 4)
+   && upper_layer_len == UIP_TCPH_LEN + payload_sum_len) {
+    // The application summed the payload while building it. Add that sum
+    // and only sum the TCP header below.
+    sum += payload_sum;
+    if (sum < payload_sum) sum++; /* carry */
+    upper_layer_len = UIP_TCPH_LEN;
+  }
+  payload_sum_valid = 0;
+#endif // HTTP_FUSED_CHKSUM == 1
+
   /* Sum TCP header and data. */
   sum = chksum(sum, &uip_buf[UIP_IPH_LEN + UIP_LLH_LEN], upper_layer_len);
 
@@ -329,7 +534,15 @@ uint16_t uip_tcpchksum(void)
 {
   return upper_layer_chksum(UIP_PROTO_TCP);
 }
-#endif /* UIP_ARCH_CHKSUM */
+
+
+#if UDP_CONTROL_SUPPORT == 1
+//---------------------------------------------------------------------------//
+uint16_t uip_udpchksum(void)
+{
+  return upper_layer_chksum(UIP_PROTO_UDP);
+}
+#endif // UDP_CONTROL_SUPPORT == 1
 
 
 //---------------------------------------------------------------------------//
@@ -337,6 +550,16 @@ void uip_init(void)
 {
   for (c = 0; c < UIP_LISTENPORTS; ++c) uip_listenports[c] = 0;
   for (c = 0; c < UIP_CONNS; ++c) uip_conns[c].tcpstateflags = UIP_CLOSED;
+#if TCP_FAST_REXMIT == 1
+  fast_rexmit_count = 0;
+  rexmit_latency_max = 0;
+#endif // TCP_FAST_REXMIT == 1
+#if TCP_SYN_BACKLOG == 1
+  for (c = 0; c < TCP_SYN_BACKLOG_SIZE; ++c) syn_backlog[c].rport = 0;
+#endif // TCP_SYN_BACKLOG == 1
+#if PERIODIC_WORK_FLAGS == 1
+  uip_periodic_due = 0;
+#endif // PERIODIC_WORK_FLAGS == 1
   /* IPv4 initialization. */
   
 #if NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
@@ -393,10 +616,21 @@ uip_connect(uip_ipaddr_t *ripaddr, uint16_t rport, uint16_t lport)
   conn->initialmss = conn->mss = UIP_TCP_MSS;
   
   conn->len = 1;   /* TCP length of the SYN is one. */
+#if HTTP_SPLIT_OUTPUT == 1
+  conn->split = 0; /* Connections made by this device are MQTT. */
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if HTTP_MULTI_SEGMENT == 1
+  conn->len2 = 0;
+  conn->rexmit2 = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
   conn->nrtx = 0;
   conn->timer = 1; /* Send the SYN next time around. */
   conn->ms_tracker = ms_counter; // Time tracker
   conn->rto = UIP_RTO;
+#if TCP_FAST_REXMIT == 1
+  conn->rto = TCP_RTO_MAX; /* RTO in RTT ticks. */
+  conn->dupacks = 0;
+#endif // TCP_FAST_REXMIT == 1
   conn->sa = 0;
   conn->sv = 16;   /* Initial value of the RTT variance. */
   conn->lport = lport;
@@ -461,6 +695,125 @@ void uip_listen(uint16_t port)
 }
 
 
+#if TCP_FAST_REXMIT == 1
+//---------------------------------------------------------------------------//
+static void uip_rtt_update(struct uip_conn *conn)
+{
+  // Van Jacobson RTT estimator (as in the original uIP code) but using the
+  // measured time since the segment was sent in 32ms ticks. sa holds 8 x the
+  // smoothed RTT and sv 4 x the mean deviation, so the measured RTT is
+  // limited to 31 ticks to keep them within 8 bits.
+  int8_t m;
+  uint16_t ticks;
+
+  ticks = (uint16_t)(ms_counter - conn->send_ms) >> TCP_RTT_SHIFT;
+  if (ticks > 31) ticks = 31;
+  m = (int8_t)ticks;
+  m = (int8_t)(m - (conn->sa >> 3));
+  conn->sa += m;
+  if (m < 0) m = (int8_t)(-m);
+  m = (int8_t)(m - (conn->sv >> 2));
+  conn->sv += m;
+  ticks = (uint16_t)((conn->sa >> 3) + conn->sv);
+  if (ticks < TCP_RTO_MIN) ticks = TCP_RTO_MIN;
+  if (ticks > TCP_RTO_MAX) ticks = TCP_RTO_MAX;
+  conn->rto = (uint8_t)ticks;
+}
+
+
+//---------------------------------------------------------------------------//
+static void uip_rexmit_stamp(struct uip_conn *conn)
+{
+  // Called when a data segment is retransmitted. Records the time from the
+  // first transmission of the segment to its first retransmit and restarts
+  // the RTO timing.
+  uint16_t latency;
+
+  if (conn->nrtx <= 1) {
+    latency = (uint16_t)(ms_counter - conn->send_ms);
+    if (latency > rexmit_latency_max) rexmit_latency_max = latency;
+  }
+  conn->send_ms = ms_counter;
+  conn->dupacks = 0;
+}
+#endif // TCP_FAST_REXMIT == 1
+
+
+#if TCP_SYN_BACKLOG == 1
+//---------------------------------------------------------------------------//
+static uint8_t uip_is_server_conn(struct uip_conn *conn)
+{
+  // Returns 1 if the connection was accepted on a listening port
+  for (c = 0; c < UIP_LISTENPORTS; ++c) {
+    if (uip_listenports[c] != 0 && conn->lport == uip_listenports[c]) return 1;
+  }
+  return 0;
+}
+
+
+//---------------------------------------------------------------------------//
+static void uip_syn_backlog_add(void)
+{
+  // Keep the SYN in BUF that found no free connection. A repeated SYN from
+  // the same host and port only refreshes its entry. If the backlog is full
+  // the SYN is dropped.
+  struct syn_backlog_entry *entry;
+  struct syn_backlog_entry *slot;
+
+  slot = 0;
+  for (c = 0; c < TCP_SYN_BACKLOG_SIZE; ++c) {
+    entry = &syn_backlog[c];
+    if (entry->rport == BUF->srcport
+     && uip_ipaddr_cmp(entry->ripaddr, BUF->srcipaddr)) {
+      slot = entry;
+      break;
+    }
+    if (slot == 0 && entry->rport == 0) slot = entry;
+  }
+  if (slot == 0) return;
+
+  uip_ipaddr_copy(slot->ripaddr, BUF->srcipaddr);
+  slot->rport = BUF->srcport;
+  slot->lport = BUF->destport;
+  memcpy(slot->seqno, BUF->seqno, 4);
+  slot->ms = ms_counter;
+}
+
+
+//---------------------------------------------------------------------------//
+static uint8_t uip_syn_backlog_take(void)
+{
+  // Rebuild the oldest waiting SYN in BUF and remove it from the backlog.
+  // Entries that are too old are discarded. Returns 0 if no SYN is waiting.
+  struct syn_backlog_entry *entry;
+  struct syn_backlog_entry *oldest;
+
+  oldest = 0;
+  for (c = 0; c < TCP_SYN_BACKLOG_SIZE; ++c) {
+    entry = &syn_backlog[c];
+    if (entry->rport == 0) continue;
+    if ((uint16_t)(ms_counter - entry->ms) > TCP_SYN_BACKLOG_AGE) {
+      entry->rport = 0;
+      continue;
+    }
+    if (oldest == 0
+     || (uint16_t)(ms_counter - entry->ms) > (uint16_t)(ms_counter - oldest->ms)) {
+      oldest = entry;
+    }
+  }
+  if (oldest == 0) return 0;
+
+  uip_ipaddr_copy(BUF->srcipaddr, oldest->ripaddr);
+  BUF->srcport = oldest->rport;
+  BUF->destport = oldest->lport;
+  memcpy(BUF->seqno, oldest->seqno, 4);
+  BUF->tcpoffset = 5 << 4; // No options
+  oldest->rport = 0;
+  return 1;
+}
+#endif // TCP_SYN_BACKLOG == 1
+
+
 //---------------------------------------------------------------------------//
 static void uip_add_rcv_nxt(uint16_t n)
 {
@@ -511,6 +864,13 @@ void uip_process(uint8_t flag)
   
   uip_sappdata = uip_appdata = &uip_buf[UIP_IPTCPH_LEN + UIP_LLH_LEN];
 
+#if HTTP_MULTI_SEGMENT == 1
+  send_seg2 = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
+#if HTTP_FUSED_CHKSUM == 1
+  payload_sum_valid = 0;
+#endif // HTTP_FUSED_CHKSUM == 1
+
   // Check if we were invoked because of a poll request for a particular
   // connection. A UIP_POLL_REQUEST will occur without any receive data
   // present, so uip_len should be zero when it occurs.
@@ -524,10 +884,46 @@ void uip_process(uint8_t flag)
     goto drop;
   }
 
+#if HTTP_MULTI_SEGMENT == 1
+  // Check if we were invoked to fill the second segment of the transmit
+  // window. This happens right after a first segment was sent. The
+  // application is asked for new data if no second segment is in flight yet,
+  // or asked to rebuild the second segment if it has to be retransmitted
+  // (the first segment was retransmitted just before this call).
+  else if (flag == UIP_SENDMORE) {
+    if ((uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+     && uip_outstanding(uip_connr)
+     && (uip_connr->len2 == 0 || uip_connr->rexmit2)) {
+      uip_len = 0;
+      uip_slen = 0;
+      if (uip_connr->rexmit2) uip_flags = UIP_REXMIT;
+      else uip_flags = UIP_POLL;
+      uip_sendmore = 1;
+      UIP_APPCALL(); // Get the data for the second segment
+      uip_sendmore = 0;
+      if (uip_slen > 0 && !(uip_flags & (UIP_ABORT | UIP_CLOSE))) {
+        // A retransmit must not send more than was sent the first time.
+        if (uip_connr->rexmit2) uip_slen = uip_connr->len2;
+	else uip_connr->len2 = uip_slen;
+	uip_connr->rexmit2 = 0;
+	send_seg2 = 1;
+	goto apprexmit;
+      }
+      uip_connr->rexmit2 = 0;
+    }
+    goto drop;
+  }
+#endif // HTTP_MULTI_SEGMENT == 1
+
   // Check if we were invoked because of the perodic timer firing.  A
   // UIP_TIMER will occur without any receive data present, so uip_len
   // should be zero when it occurs.
   else if (flag == UIP_TIMER) {
+#if PERIODIC_WORK_FLAGS == 1
+    // The application sets the bit again during this call if it still has
+    // outbound work.
+    uip_periodic_due &= (uint8_t)~uip_conn_bit(uip_connr);
+#endif // PERIODIC_WORK_FLAGS == 1
     // Increase the initial sequence number.
     if (++iss[3] == 0) {
       if (++iss[2] == 0) {
@@ -557,6 +953,15 @@ void uip_process(uint8_t flag)
 // UARTPrintf("  uip.c: close due to timeout1\r\n");
 #endif // DEBUG_SUPPORT == 15
       }
+#if TCP_SYN_BACKLOG == 1
+      // HTTP server connections leave TIME_WAIT early so that the
+      // connection can be reused.
+      if (uip_connr->tcpstateflags == UIP_TIME_WAIT
+       && uip_connr->timer >= TCP_SERVER_TIME_WAIT
+       && uip_is_server_conn(uip_connr)) {
+        uip_connr->tcpstateflags = UIP_CLOSED;
+      }
+#endif // TCP_SYN_BACKLOG == 1
     }
     else if (uip_connr->tcpstateflags != UIP_CLOSED) {
       // If the connection has outstanding data but has timed out the
@@ -576,6 +981,21 @@ void uip_process(uint8_t flag)
 	uip_connr->ms_tracker = ms_counter;
       }
 
+#if TCP_FAST_REXMIT == 1
+      // Data segments are retransmitted when the RTO from the RTT estimator
+      // expires, doubled for each retransmit already made. The seconds
+      // timer remains as the upper limit.
+      if (uip_outstanding(uip_connr)
+       && (uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+        tmp16 = (uint16_t)((uint16_t)uip_connr->rto << TCP_RTT_SHIFT);
+        if (uip_connr->nrtx > 4) tmp16 <<= 4;
+        else tmp16 <<= uip_connr->nrtx;
+        if ((uint16_t)(ms_counter - uip_connr->send_ms) >= tmp16) {
+          uip_connr->timer = 0;
+        }
+      }
+#endif // TCP_FAST_REXMIT == 1
+
       if (uip_outstanding(uip_connr)) {
 //        if (uip_connr->timer-- == 0) {
         if (uip_connr->timer == 0) {
@@ -614,6 +1034,9 @@ void uip_process(uint8_t flag)
 #endif // DEBUG_SUPPORT == 15
 
 	  ++(uip_connr->nrtx);
+#if TRACE_RING_SUPPORT == 1
+	  trace_event(TRACE_REXMIT, uip_connr->nrtx, HTONS(uip_connr->lport));
+#endif // TRACE_RING_SUPPORT == 1
 	  
           // Ok, so we need to retransmit. We do this differently depending on
 	  // which state we are in.
@@ -650,6 +1073,28 @@ void uip_process(uint8_t flag)
 	      goto tcp_send_syn;
 
             case UIP_ESTABLISHED:
+#if TCP_FAST_REXMIT == 1
+              uip_rexmit_stamp(uip_connr);
+#endif // TCP_FAST_REXMIT == 1
+#if HTTP_MULTI_SEGMENT == 1
+              // A second segment in flight is resent too, in a separate
+	      // UIP_SENDMORE call made once this retransmit is sent.
+              if (uip_connr->len2 != 0) uip_connr->rexmit2 = 1;
+#endif // HTTP_MULTI_SEGMENT == 1
+#if TCP_REXMIT_FROM_TXBUF == 1
+              // If the segment is still in the ENC28J60 TX memory it is
+	      // retransmitted from there (with the acknowledge number
+	      // updated if needed). The application is not called, so its
+	      // state still reflects the segment in flight.
+              if (!(uip_connr->tcpstateflags & UIP_STOPPED)
+	       && Enc28j60Resend(uip_connr->lport,
+	                         uip_connr->rport,
+	                         uip_connr->snd_nxt,
+	                         uip_connr->len,
+	                         uip_connr->rcv_nxt)) {
+                goto drop;
+	      }
+#endif // TCP_REXMIT_FROM_TXBUF == 1
               // In the ESTABLISHED state, we call upon the application to do
 	      // the actual retransmit after which we jump into the code for
 	      // sending out the packet (the apprexmit label).
@@ -686,6 +1131,15 @@ void uip_process(uint8_t flag)
         goto appsend;
       }
     }
+#if TCP_SYN_BACKLOG == 1
+    else if (uip_syn_backlog_take()) {
+      // A CLOSED connection is available for a SYN that arrived while all
+      // connections were in use. The SYN was rebuilt in BUF without options
+      // so the MSS is set here.
+      uip_connr->initialmss = uip_connr->mss = UIP_TCP_MSS;
+      goto syn_backlog_accept;
+    }
+#endif // TCP_SYN_BACKLOG == 1
     goto drop;
   }
 
@@ -737,6 +1191,22 @@ void uip_process(uint8_t flag)
   // If the packet is not destined for our IP address drop it.
   // What typically gets dropped here is an IP Broadcast packet (IP
   // address FF:FF:FF:FF)
+#if MULTICAST_GROUP_SUPPORT == 1
+  // UDP datagrams sent to a multicast group we joined are also accepted.
+  uip_mcast_rx = 0;
+  if (BUF->proto == UIP_PROTO_UDP && uip_mcast_joined(BUF->destipaddr)) {
+    uip_mcast_rx = 1;
+  }
+  else
+#endif // MULTICAST_GROUP_SUPPORT == 1
+#if DHCP_SUPPORT == 1
+  // DHCP replies are sent to the offered address, which is not yet ours,
+  // or to the broadcast address.
+  if (BUF->proto == UIP_PROTO_UDP && UDPBUF->destport == HTONS(DHCPC_CLIENT_PORT)) {
+    // Accept
+  }
+  else
+#endif // DHCP_SUPPORT == 1
   if (!uip_ipaddr_cmp(BUF->destipaddr, uip_hostaddr)) {
     UIP_STAT(++uip_stat.ip.drop);
 // UARTPrintf("  uip.c: drop not our IP address\r\n");
@@ -755,6 +1225,12 @@ void uip_process(uint8_t flag)
     goto tcp_input;
   }
 
+#if UDP_CONTROL_SUPPORT == 1
+  if (BUF->proto == UIP_PROTO_UDP) {
+    // Check for UDP datagram. If so, proceed with UDP input processing.
+    goto udp_input;
+  }
+#endif // UDP_CONTROL_SUPPORT == 1
 
   // ICMPv4 processing code follows.
   if (BUF->proto != UIP_PROTO_ICMP) { // We only allow ICMP packets from here.
@@ -795,6 +1271,71 @@ void uip_process(uint8_t flag)
   // End of IPv4 input header processing code.
 
 
+#if UDP_CONTROL_SUPPORT == 1
+  // ----------------------------------------------------------------------- //
+  // UDP input processing. Only UDP_CONTROL_PORT (and DHCPC_CLIENT_PORT with
+  // DHCP_SUPPORT) is served. There are no UDP connections: the application
+  // answers each datagram in place and the reply goes back to the sender's
+  // address and port.
+  udp_input:
+
+  // Drop datagrams for other ports, with a length that does not fit the IP
+  // packet, or with a bad checksum (a zero checksum means none was sent).
+#if DHCP_SUPPORT == 0
+  if (UDPBUF->destport != HTONS(UDP_CONTROL_PORT)) goto drop;
+#endif // DHCP_SUPPORT == 0
+#if DHCP_SUPPORT == 1
+  if (UDPBUF->destport != HTONS(UDP_CONTROL_PORT)
+   && UDPBUF->destport != HTONS(DHCPC_CLIENT_PORT)) goto drop;
+#endif // DHCP_SUPPORT == 1
+  tmp16 = htons(UDPBUF->udplen);
+  if (tmp16 < UIP_UDPH_LEN || tmp16 > uip_len - UIP_IPH_LEN) goto drop;
+  if (UDPBUF->udpchksum != 0 && uip_udpchksum() != 0xffff) goto drop;
+
+  // The application finds the request at uip_appdata with uip_len bytes. It
+  // writes any reply over the request and sets uip_slen.
+  uip_len = tmp16 - UIP_UDPH_LEN;
+  uip_sappdata = uip_appdata = &uip_buf[UIP_LLH_LEN + UIP_IPUDPH_LEN];
+  uip_slen = 0;
+#if DHCP_SUPPORT == 1
+  if (UDPBUF->destport == HTONS(DHCPC_CLIENT_PORT)) {
+    // The DHCP client sends its messages from dhcp_service(), never as a
+    // reply.
+    UIP_DHCP_APPCALL();
+    goto drop;
+  }
+#endif // DHCP_SUPPORT == 1
+  UIP_UDP_APPCALL();
+  if (uip_slen == 0) goto drop;
+#if MULTICAST_GROUP_SUPPORT == 1
+  // A group command reaches many modules. Replies would only flood the
+  // sender.
+  if (uip_mcast_rx) goto drop;
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+  // Turn the datagram around.
+  tmp16 = UDPBUF->srcport;
+  UDPBUF->srcport = UDPBUF->destport;
+  UDPBUF->destport = tmp16;
+  uip_ipaddr_copy(BUF->destipaddr, BUF->srcipaddr);
+  uip_ipaddr_copy(BUF->srcipaddr, uip_hostaddr);
+
+  uip_len = uip_slen + UIP_IPUDPH_LEN;
+  BUF->ttl = UIP_TTL;
+  BUF->len[0] = (uint8_t)(uip_len >> 8);
+  BUF->len[1] = (uint8_t)(uip_len & 0xff);
+  UDPBUF->udplen = htons((uint16_t)(uip_slen + UIP_UDPH_LEN));
+
+  // Calculate UDP checksum. A computed value of zero is sent as 0xffff as
+  // zero means "no checksum".
+  UDPBUF->udpchksum = 0;
+  UDPBUF->udpchksum = ~(uip_udpchksum());
+  if (UDPBUF->udpchksum == 0) UDPBUF->udpchksum = 0xffff;
+
+  goto ip_send_nolen;
+#endif // UDP_CONTROL_SUPPORT == 1
+
+
   // ----------------------------------------------------------------------- //
   // TCP input processing. At this point we've determined that incoming data
   // is for us.
@@ -915,14 +1456,39 @@ void uip_process(uint8_t flag)
     }
   }
 
+#if TCP_SYN_BACKLOG == 1
+  if (uip_connr == 0) {
+    // No CLOSED or TIME_WAIT connection. A server connection in FIN_WAIT_2
+    // has sent all of its data and is only waiting for the host to close, so
+    // the oldest one is reused.
+    for (c = 0; c < UIP_CONNS; ++c) {
+      if (uip_conns[c].tcpstateflags == UIP_FIN_WAIT_2
+       && (uip_connr == 0 || uip_conns[c].timer > uip_connr->timer)) {
+        uip_connr = &uip_conns[c];
+      }
+    }
+    if (uip_connr != 0 && uip_is_server_conn(uip_connr) == 0) uip_connr = 0;
+  }
+#endif // TCP_SYN_BACKLOG == 1
+
   if (uip_connr == 0) {
     // All connections are used already, we drop packet and hope that the
     // remote end will retransmit the packet at a time when we have more spare
     // connections.
     UIP_STAT(++uip_stat.tcp.syndrop);
+#if TCP_SYN_BACKLOG == 1
+    // The SYN is kept in the backlog and accepted from the periodic pass
+    // when a connection becomes available.
+    uip_syn_backlog_add();
+#endif // TCP_SYN_BACKLOG == 1
     goto drop;
   }
   uip_conn = uip_connr;
+#if TCP_SYN_BACKLOG == 1
+  syn_backlog_accept:
+  // uip_connr and uip_conn are the same at this point when coming from the
+  // periodic pass.
+#endif // TCP_SYN_BACKLOG == 1
 
   // Fill in the necessary fields for the new connection.
   uip_connr->rto = uip_connr->timer = UIP_RTO;
@@ -935,16 +1501,28 @@ void uip_process(uint8_t flag)
   uip_connr->sa = 0;
   uip_connr->sv = 4;
   uip_connr->nrtx = 0;
+#if TCP_FAST_REXMIT == 1
+  uip_connr->rto = TCP_RTO_MAX; // RTO in RTT ticks. timer still is seconds.
+  uip_connr->dupacks = 0;
+#endif // TCP_FAST_REXMIT == 1
   uip_connr->lport = BUF->destport;
   uip_connr->rport = BUF->srcport;
   uip_ipaddr_copy(uip_connr->ripaddr, BUF->srcipaddr);
   uip_connr->tcpstateflags = UIP_SYN_RCVD;
+#if HTTP_SPLIT_OUTPUT == 1
+  // Connections accepted on the listening port are HTTP connections.
+  uip_connr->split = 1;
+#endif // HTTP_SPLIT_OUTPUT == 1
 
   uip_connr->snd_nxt[0] = iss[0];
   uip_connr->snd_nxt[1] = iss[1];
   uip_connr->snd_nxt[2] = iss[2];
   uip_connr->snd_nxt[3] = iss[3];
   uip_connr->len = 1;
+#if HTTP_MULTI_SEGMENT == 1
+  uip_connr->len2 = 0;
+  uip_connr->rexmit2 = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
   
   // rcv_nxt should be the seqno from the incoming packet + 1.
   uip_connr->rcv_nxt[3] = BUF->seqno[3];
@@ -1239,6 +1817,15 @@ void uip_process(uint8_t flag)
 
       // Do RTT (Round Trip Time) estimation, unless we have done rexmits.
 
+#if TCP_FAST_REXMIT == 1
+      // Only data segments are timed (send_ms is set when they are sent)
+      if (uip_connr->nrtx == 0
+       && (uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED) {
+        uip_rtt_update(uip_connr);
+      }
+      uip_connr->dupacks = 0;
+#endif // TCP_FAST_REXMIT == 1
+#if TCP_FAST_REXMIT == 0
       if (uip_connr->nrtx == 0) {
         int8_t m;
         m = (int8_t)(uip_connr->rto - uip_connr->timer);
@@ -1250,16 +1837,87 @@ void uip_process(uint8_t flag)
         uip_connr->sv += m;
         uip_connr->rto = (uint8_t)((uip_connr->sa >> 3) + uip_connr->sv);
       }
+#endif // TCP_FAST_REXMIT == 0
 
       // Set the acknowledged flag.
       uip_flags = UIP_ACKDATA;
       // Reset the retransmission timer.
       uip_connr->timer = uip_connr->rto;
+#if TCP_FAST_REXMIT == 1
+      // rto is in RTT ticks. The seconds timer restarts at UIP_RTO.
+      uip_connr->timer = UIP_RTO;
+#endif // TCP_FAST_REXMIT == 1
 
       // Reset length of outstanding data.
       uip_connr->len = 0;
+#if HTTP_MULTI_SEGMENT == 1
+      // If a second segment is in flight it becomes the outstanding data.
+      uip_connr->len = uip_connr->len2;
+      uip_connr->len2 = 0;
+      uip_connr->rexmit2 = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
+    }
+#if HTTP_MULTI_SEGMENT == 1
+    else if (uip_connr->len2 != 0) {
+      // Check for an acknowledge of both segments in flight. No RTT
+      // estimation is done in this case.
+      uip_add32(uip_acc32, uip_connr->len2);
+      if (BUF->ackno[0] == uip_acc32[0]
+        && BUF->ackno[1] == uip_acc32[1]
+        && BUF->ackno[2] == uip_acc32[2]
+        && BUF->ackno[3] == uip_acc32[3]) {
+        uip_connr->snd_nxt[0] = uip_acc32[0];
+        uip_connr->snd_nxt[1] = uip_acc32[1];
+        uip_connr->snd_nxt[2] = uip_acc32[2];
+        uip_connr->snd_nxt[3] = uip_acc32[3];
+        uip_flags = UIP_ACKDATA;
+        uip_connr->timer = uip_connr->rto;
+#if TCP_FAST_REXMIT == 1
+        uip_connr->timer = UIP_RTO;
+        uip_connr->dupacks = 0;
+#endif // TCP_FAST_REXMIT == 1
+        uip_connr->len = 0;
+        uip_connr->len2 = 0;
+        uip_connr->rexmit2 = 0;
+      }
     }
+#endif // HTTP_MULTI_SEGMENT == 1
   }
+
+#if TCP_FAST_REXMIT == 1
+  // A pure ACK that acknowledges none of the outstanding data is a duplicate
+  // ACK. The peer has received a later segment (or a duplicate), so the
+  // outstanding segment was probably lost. It is retransmitted at once
+  // instead of waiting for the RTO.
+  if ((BUF->flags & TCP_ACK)
+   && uip_outstanding(uip_connr)
+   && !(uip_flags & UIP_ACKDATA)
+   && uip_len == 0
+   && (BUF->flags & (TCP_SYN | TCP_FIN | TCP_RST)) == 0
+   && (uip_connr->tcpstateflags & UIP_TS_MASK) == UIP_ESTABLISHED
+   && BUF->ackno[0] == uip_connr->snd_nxt[0]
+   && BUF->ackno[1] == uip_connr->snd_nxt[1]
+   && BUF->ackno[2] == uip_connr->snd_nxt[2]
+   && BUF->ackno[3] == uip_connr->snd_nxt[3]) {
+    ++uip_connr->dupacks;
+#if HTTP_MULTI_SEGMENT == 1
+    // With only two segments in flight the peer can send no more than one
+    // duplicate ACK (early retransmit, RFC 5827).
+    if (uip_connr->len2 != 0) uip_connr->dupacks = TCP_DUPACK_THRESHOLD;
+#endif // HTTP_MULTI_SEGMENT == 1
+    if (uip_connr->dupacks >= TCP_DUPACK_THRESHOLD) {
+      fast_rexmit_count++;
+      uip_rexmit_stamp(uip_connr);
+#if HTTP_MULTI_SEGMENT == 1
+      if (uip_connr->len2 != 0) uip_connr->rexmit2 = 1;
+#endif // HTTP_MULTI_SEGMENT == 1
+      uip_slen = 0;
+      uip_flags = UIP_REXMIT;
+      UIP_APPCALL(); // Call to get old data for retransmit
+      goto apprexmit;
+    }
+  }
+#endif // TCP_FAST_REXMIT == 1
   
   // Do different things depending on in what state the connection is.
   switch (uip_connr->tcpstateflags & UIP_TS_MASK) {
@@ -1519,11 +2177,18 @@ void uip_process(uint8_t flag)
 #if DEBUG_SUPPORT == 15
 // UARTPrintf("uip.c uip_slen > 0\r\n");
 #endif // DEBUG_SUPPORT == 15
+#if HTTP_MULTI_SEGMENT == 0
           // If the connection has acknowledged data, the contents of the
 	  // ->len variable should be discarded.
 	  if ((uip_flags & UIP_ACKDATA) != 0) {
 	    uip_connr->len = 0;
 	  }
+#endif // HTTP_MULTI_SEGMENT == 0
+#if HTTP_MULTI_SEGMENT == 1
+          // The ACK processing above has already discarded the acknowledged
+	  // data. If ->len is still non-zero it holds the second segment
+	  // which is still in flight.
+#endif // HTTP_MULTI_SEGMENT == 1
 	  
 	  // If the ->len variable is non-zero the connection has already
 	  // data in transit and cannot send anymore right now.
@@ -1550,6 +2215,14 @@ void uip_process(uint8_t flag)
 	    // everything has been acknowledged.
             uip_connr->len = uip_slen;
 	  }
+#if HTTP_MULTI_SEGMENT == 1
+	  else if ((uip_flags & UIP_ACKDATA) != 0 && uip_connr->len2 == 0) {
+	    // The first segment was acknowledged while the second segment is
+	    // still in flight. The new data is sent as the second segment.
+	    uip_connr->len2 = uip_slen;
+	    send_seg2 = 1;
+	  }
+#endif // HTTP_MULTI_SEGMENT == 1
 	  else {
 	    // If the application already had unacknowledged data, we make
 	    // sure that the application does not send (i.e., retransmit) out
@@ -1568,8 +2241,19 @@ void uip_process(uint8_t flag)
 	// If the application has data to be sent, or if the incoming packet
 	// had new data in it, we must send out a packet.
 	if (uip_slen > 0 && uip_connr->len > 0) {
+#if TCP_FAST_REXMIT == 1
+	  // Time the segment for the RTT estimator and the RTO. A second
+	  // segment is covered by the timing of the first one.
+#if HTTP_MULTI_SEGMENT == 1
+	  if (!send_seg2)
+#endif // HTTP_MULTI_SEGMENT == 1
+	  uip_connr->send_ms = ms_counter;
+#endif // TCP_FAST_REXMIT == 1
 	  // Add the length of the IP and TCP headers.
 	  uip_len = uip_connr->len + UIP_TCPIP_HLEN;
+#if HTTP_MULTI_SEGMENT == 1
+	  if (send_seg2) uip_len = uip_connr->len2 + UIP_TCPIP_HLEN;
+#endif // HTTP_MULTI_SEGMENT == 1
 	  // We always set the ACK flag in response packets.
 	  BUF->flags = TCP_ACK | TCP_PSH;
 	  // Send the packet.
@@ -1737,6 +2421,17 @@ UARTPrintf("  uip.c: UIP_CLOSING\r\n");
   BUF->seqno[2] = uip_connr->snd_nxt[2];
   BUF->seqno[3] = uip_connr->snd_nxt[3];
 
+#if HTTP_MULTI_SEGMENT == 1
+  if (send_seg2) {
+    // The second segment follows the first segment still in flight.
+    uip_add32(uip_connr->snd_nxt, uip_connr->len);
+    BUF->seqno[0] = uip_acc32[0];
+    BUF->seqno[1] = uip_acc32[1];
+    BUF->seqno[2] = uip_acc32[2];
+    BUF->seqno[3] = uip_acc32[3];
+  }
+#endif // HTTP_MULTI_SEGMENT == 1
+
   BUF->proto = UIP_PROTO_TCP;
   
   BUF->srcport = uip_connr->lport;
@@ -1787,6 +2482,9 @@ UARTPrintf("  uip.c: UIP_CLOSING\r\n");
   BUF->ipchksum = 0;
   BUF->ipchksum = ~(uip_ipchksum());
 
+#if UDP_CONTROL_SUPPORT == 1
+  if (BUF->proto == UIP_PROTO_TCP)
+#endif // UDP_CONTROL_SUPPORT == 1
   UIP_STAT(++uip_stat.tcp.sent);
 
 
@@ -1827,3 +2525,169 @@ void uip_send(const char *data, int len)
     }
   }
 }
+
+
+#if HTTP_FUSED_CHKSUM == 1
+//---------------------------------------------------------------------------//
+void uip_payload_chksum(uint16_t hi, uint16_t lo, uint16_t len)
+{
+  // Called by the application with the checksum of the payload it just
+  // built in the uip_appdata buffer, as the sum of the high bytes (even
+  // offsets) and the sum of the low bytes (odd offsets). The sum is used
+  // by the next TCP checksum calculation if the segment length matches.
+  payload_sum = chksum_fold(hi, lo);
+  payload_sum_len = len;
+  payload_sum_valid = 1;
+}
+#endif // HTTP_FUSED_CHKSUM == 1
+
+
+#if UDP_TELEMETRY_SUPPORT == 1 || DHCP_SUPPORT == 1
+//---------------------------------------------------------------------------//
+void uip_udp_build(uip_ipaddr_t ripaddr, uint16_t rport, uint16_t lport, uint16_t len)
+{
+  // Builds the headers for a datagram the application sends on its own
+  // rather than as a reply from udp_input.
+  uip_len = len + UIP_IPUDPH_LEN;
+  BUF->vhl = 0x45;
+  BUF->tos = 0;
+  BUF->len[0] = (uint8_t)(uip_len >> 8);
+  BUF->len[1] = (uint8_t)(uip_len & 0xff);
+  ++ipid;
+  BUF->ipid[0] = (uint8_t)(ipid >> 8);
+  BUF->ipid[1] = (uint8_t)(ipid & 0xff);
+  BUF->ipoffset[0] = BUF->ipoffset[1] = 0;
+  BUF->ttl = UIP_TTL;
+  BUF->proto = UIP_PROTO_UDP;
+  uip_ipaddr_copy(BUF->srcipaddr, uip_hostaddr);
+  uip_ipaddr_copy(BUF->destipaddr, ripaddr);
+  BUF->ipchksum = 0;
+  BUF->ipchksum = ~(uip_ipchksum());
+
+  UDPBUF->srcport = lport;
+  UDPBUF->destport = rport;
+  UDPBUF->udplen = htons((uint16_t)(len + UIP_UDPH_LEN));
+  UDPBUF->udpchksum = 0;
+  UDPBUF->udpchksum = ~(uip_udpchksum());
+  if (UDPBUF->udpchksum == 0) UDPBUF->udpchksum = 0xffff;
+}
+#endif // UDP_TELEMETRY_SUPPORT == 1 || DHCP_SUPPORT == 1
+
+
+#if MULTICAST_GROUP_SUPPORT == 1
+//---------------------------------------------------------------------------//
+uint8_t uip_mcast_joined(uip_ipaddr_t addr)
+{
+  uint8_t i;
+
+  for (i = 0; i < UIP_MCAST_GROUPS; i++) {
+    if (uip_mcast_groups[i][0] != 0 && uip_ipaddr_cmp(addr, uip_mcast_groups[i])) return 1;
+  }
+  return 0;
+}
+
+
+//---------------------------------------------------------------------------//
+void uip_igmp_report(uip_ipaddr_t group)
+{
+  // IGMPv2 Membership Report (RFC 2236) so that IGMP snooping switches
+  // forward the group to us. The IP header carries the Router Alert option
+  // and is 24 bytes, so it is built here byte by byte rather than with the
+  // 20 byte BUF header.
+  uint8_t *pBuffer;
+  uint16_t chk;
+
+  pBuffer = &uip_buf[UIP_LLH_LEN];
+  uip_len = 32;
+  pBuffer[0] = 0x46;                      // IPv4, 6 word header
+  pBuffer[1] = 0;
+  pBuffer[2] = 0;
+  pBuffer[3] = 32;
+  ++ipid;
+  pBuffer[4] = (uint8_t)(ipid >> 8);
+  pBuffer[5] = (uint8_t)(ipid & 0xff);
+  pBuffer[6] = pBuffer[7] = 0;
+  pBuffer[8] = 1;                         // TTL 1, stay on the local net
+  pBuffer[9] = 2;                         // IGMP
+  pBuffer[10] = pBuffer[11] = 0;
+  memcpy(&pBuffer[12], uip_hostaddr, 4);
+  memcpy(&pBuffer[16], group, 4);
+  pBuffer[20] = 0x94;                     // Router Alert option
+  pBuffer[21] = 0x04;
+  pBuffer[22] = pBuffer[23] = 0;
+  chk = ~(uip_chksum((uint16_t *)pBuffer, 24));
+  memcpy(&pBuffer[10], &chk, 2);
+
+  pBuffer[24] = 0x16;                     // Version 2 Membership Report
+  pBuffer[25] = 0;
+  pBuffer[26] = pBuffer[27] = 0;
+  memcpy(&pBuffer[28], group, 4);
+  chk = ~(uip_chksum((uint16_t *)&pBuffer[24], 8));
+  memcpy(&pBuffer[26], &chk, 2);
+}
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+
+#if HTTP_SPLIT_OUTPUT == 1
+//---------------------------------------------------------------------------//
+static void split_headers(void)
+{
+  // Updates the IP length and both checksums after uip_len was changed.
+  // uip_len includes the LLH at this point.
+  BUF->len[0] = (uint8_t)((uip_len - UIP_LLH_LEN) >> 8);
+  BUF->len[1] = (uint8_t)((uip_len - UIP_LLH_LEN) & 0xff);
+  BUF->ipchksum = 0;
+  BUF->ipchksum = ~(uip_ipchksum());
+  BUF->tcpchksum = 0;
+  BUF->tcpchksum = ~(uip_tcpchksum());
+}
+
+
+//---------------------------------------------------------------------------//
+void uip_split_output(void)
+{
+  // Sends the frame in the uip_buf. This is called in place of
+  // Enc28j60Send() after uip_arp_out() has added the LLH.
+  //
+  // If the frame is a TCP data segment on a connection that has splitting
+  // switched on (uip_conn->split) the segment is sent as two segments, each
+  // with half of the data. Many hosts delay the ACK of a single segment
+  // (for up to 200ms) but ACK every second segment immediately. uIP only
+  // keeps one segment in flight, so without the split each packet of a web
+  // page can wait for the delayed ACK.
+  // The ACK for the second half acknowledges the whole segment, so the
+  // rest of the uIP code does not need to know about the split.
+  uint16_t tcplen;
+  uint16_t len1;
+  uint8_t *pData;
+
+  tcplen = uip_len - UIP_LLH_LEN - UIP_TCPIP_HLEN;
+  pData = &uip_buf[UIP_LLH_LEN + UIP_TCPIP_HLEN];
+
+  if (((struct uip_eth_hdr *)&uip_buf[0])->type == HTONS(UIP_ETHTYPE_IP)
+   && BUF->proto == UIP_PROTO_TCP
+   && BUF->tcpoffset == ((UIP_TCPH_LEN / 4) << 4)
+   && BUF->srcport == uip_conn->lport
+   && uip_conn->split
+   && uip_len > UIP_LLH_LEN + UIP_TCPIP_HLEN + 1) {
+    // Send the first half
+    len1 = tcplen / 2;
+    uip_len = UIP_LLH_LEN + UIP_TCPIP_HLEN + len1;
+    split_headers();
+    Enc28j60Send(uip_buf, uip_len);
+
+    // Move the second half to the start of the data and send it with the
+    // sequence number advanced past the first half.
+    memmove(pData, pData + len1, tcplen - len1);
+    uip_add32(BUF->seqno, len1);
+    BUF->seqno[0] = uip_acc32[0];
+    BUF->seqno[1] = uip_acc32[1];
+    BUF->seqno[2] = uip_acc32[2];
+    BUF->seqno[3] = uip_acc32[3];
+    uip_len = UIP_LLH_LEN + UIP_TCPIP_HLEN + (tcplen - len1);
+    split_headers();
+    split_count++;
+  }
+  Enc28j60Send(uip_buf, uip_len);
+}
+#endif // HTTP_SPLIT_OUTPUT == 1
@@ -323,6 +323,48 @@ void uip_setipid(uint16_t id);
 #define uip_poll_conn(conn) do { uip_conn = conn; \
                                  uip_process(UIP_POLL_REQUEST); } while (0)
 
+#if HTTP_MULTI_SEGMENT == 1
+/**
+ * Request a second segment for a connection that has one segment in flight.
+ * The application is called with uip_sendmore set, and any data it provides
+ * is sent with a sequence number following the segment in flight. If the
+ * second segment needs to be retransmitted the application is called with
+ * uip_rexmit() true instead.
+ *
+ * conn - A pointer to the uip_conn struct for the connection to be processed.
+ *
+ */
+#define uip_sendmore_conn(conn) do { uip_conn = conn; \
+                                     uip_process(UIP_SENDMORE); } while (0)
+#endif // HTTP_MULTI_SEGMENT == 1
+
+#if PERIODIC_WORK_FLAGS == 1
+/**
+ * The bit of a connection in uip_periodic_due.
+ *
+ * conn - A pointer to the uip_conn struct for the connection.
+ *
+ */
+#define uip_conn_bit(conn) ((uint8_t)(1 << ((conn) - uip_conns)))
+
+/**
+ * Request the periodic poll for the current connection.
+ * Called by the application when it has outbound work that it will send on
+ * a later poll. The request is cleared on each uip_periodic() of the
+ * connection, so the application has to repeat it while the work remains.
+ *
+ */
+#define uip_poll_due() (uip_periodic_due |= uip_conn_bit(uip_conn))
+
+/**
+ * Check whether a connection requested the periodic poll.
+ *
+ * conn - The number of the connection.
+ *
+ */
+#define uip_periodic_is_due(conn) (uip_periodic_due & (uint8_t)(1 << (conn)))
+#endif // PERIODIC_WORK_FLAGS == 1
+
 /**
  * The uIP packet buffer.
  * The uip_buf array is used to hold incoming and outgoing packets. The device
@@ -456,6 +498,64 @@ struct uip_conn *uip_connect(uip_ipaddr_t *ripaddr, uint16_t rport, uint16_t lpo
  */
 void uip_send(const char *data, int len);
 
+#if HTTP_FUSED_CHKSUM == 1
+/**
+ * Provide the checksum of the payload placed at uip_appdata, summed while
+ * the payload was built. hi is the sum of the bytes at even offsets and lo
+ * the sum of the bytes at odd offsets, len the payload length. The TCP
+ * checksum then only needs to sum the pseudo header and the TCP header.
+ */
+void uip_payload_chksum(uint16_t hi, uint16_t lo, uint16_t len);
+#endif // HTTP_FUSED_CHKSUM == 1
+
+#if UDP_TELEMETRY_SUPPORT == 1 || DHCP_SUPPORT == 1
+/**
+ * Build the IP and UDP headers for a datagram of len bytes that the
+ * application placed in the uip_buf after the UDP header. Sets uip_len so
+ * the datagram can be sent with uip_arp_out() and Enc28j60Send().
+ *
+ * ripaddr - The destination IP address.
+ * rport - The destination port, in network byte order.
+ * lport - The source port, in network byte order.
+ */
+void uip_udp_build(uip_ipaddr_t ripaddr, uint16_t rport, uint16_t lport, uint16_t len);
+#endif // UDP_TELEMETRY_SUPPORT == 1 || DHCP_SUPPORT == 1
+
+#if DHCP_SUPPORT == 1
+/**
+ * The DHCP client and server UDP ports. Datagrams to DHCPC_CLIENT_PORT are
+ * accepted for any destination address and passed to UIP_DHCP_APPCALL.
+ */
+#define DHCPC_CLIENT_PORT 68
+#define DHCPC_SERVER_PORT 67
+#endif // DHCP_SUPPORT == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+/**
+ * The IPv4 multicast groups joined. UDP datagrams sent to one of them are
+ * accepted as if sent to uip_hostaddr. An unused entry is 0.0.0.0.
+ */
+#define UIP_MCAST_GROUPS 2
+extern uip_ipaddr_t uip_mcast_groups[UIP_MCAST_GROUPS];
+
+/**
+ * Set by uip_input() while the application is called for a datagram sent
+ * to a multicast group. No reply is sent for such a datagram.
+ */
+extern uint8_t uip_mcast_rx;
+
+/**
+ * Check if addr is one of the groups in uip_mcast_groups. Returns 1 if so.
+ */
+uint8_t uip_mcast_joined(uip_ipaddr_t addr);
+
+/**
+ * Build an IGMPv2 Membership Report for group in the uip_buf. Sets uip_len
+ * so the report can be sent with uip_arp_out() and Enc28j60Send().
+ */
+void uip_igmp_report(uip_ipaddr_t group);
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
 
 /**
  * The length of any incoming data that is currently avaliable (if avaliable)
@@ -884,6 +984,19 @@ struct uip_conn {
   uint16_t ms_tracker;   // Tracks time in milliseconds to service the retrans-
                          // nmission timer.
   uint8_t nrtx;          // The number of retransmissions for the last segment sent.
+#if HTTP_MULTI_SEGMENT == 1
+  uint16_t len2;         // Length of the second segment sent after the len
+                         // segment and not yet acknowledged.
+  uint8_t rexmit2;       // Set when the second segment has to be resent.
+#endif // HTTP_MULTI_SEGMENT == 1
+#if HTTP_SPLIT_OUTPUT == 1
+  uint8_t split;         // Set if data segments are sent as two halves. The
+                         // application may change this at any time.
+#endif // HTTP_SPLIT_OUTPUT == 1
+#if TCP_FAST_REXMIT == 1
+  uint16_t send_ms;      // ms_counter when the outstanding data was sent.
+  uint8_t dupacks;       // Duplicate ACKs received for the outstanding data.
+#endif // TCP_FAST_REXMIT == 1
 
   /** The application state. */
   uip_tcp_appstate_t appstate;
@@ -959,6 +1072,21 @@ extern struct uip_stats uip_stat;
  */
 extern uint8_t uip_flags;
 
+#if HTTP_MULTI_SEGMENT == 1
+/* uip_sendmore:
+ * Set while the application is called to fill (or retransmit) the second
+ * segment of the transmit window. See uip_sendmore_conn().
+ */
+extern uint8_t uip_sendmore;
+#endif // HTTP_MULTI_SEGMENT == 1
+
+#if PERIODIC_WORK_FLAGS == 1
+/* uip_periodic_due:
+ * One bit per connection, set with uip_poll_due(). See PERIODIC_WORK_FLAGS.
+ */
+extern uint8_t uip_periodic_due;
+#endif // PERIODIC_WORK_FLAGS == 1
+
 /* The following flags may be set in the global variable uip_flags before
    calling the application callback. The UIP_ACKDATA, UIP_NEWDATA, and
    UIP_CLOSE flags may both be set at the same time, whereas the others are
@@ -1027,6 +1155,9 @@ void uip_process(uint8_t flag);
 #define UIP_POLL_REQUEST  3
 /* Tells uIP that a connection should be polled. */
 
+#define UIP_SENDMORE      4
+/* Tells uIP to fill the second segment of the transmit window. */
+
 /* The TCP states used in the uip_conn->tcpstateflags. */
 #define UIP_CLOSED      0
 #define UIP_SYN_RCVD    1
@@ -1102,6 +1233,30 @@ struct uip_icmpip_hdr {
 #define UIP_APPDATA_SIZE (UIP_BUFSIZE - UIP_LLH_LEN - UIP_TCPIP_HLEN)
 
 
+#if UDP_CONTROL_SUPPORT == 1
+/* The UDP and IP headers. */
+struct uip_udpip_hdr {
+  /* IPv4 header. */
+  uint8_t vhl,
+    tos,
+    len[2],
+    ipid[2],
+    ipoffset[2],
+    ttl,
+    proto;
+  uint16_t ipchksum;
+  uint16_t srcipaddr[2],
+    destipaddr[2];
+
+  /* UDP header. */
+  uint16_t srcport,
+    destport;
+  uint16_t udplen;
+  uint16_t udpchksum;
+};
+#endif // UDP_CONTROL_SUPPORT == 1
+
+
 #define UIP_PROTO_ICMP  1
 #define UIP_PROTO_TCP   6
 #define UIP_PROTO_UDP   17
@@ -1112,6 +1267,8 @@ struct uip_icmpip_hdr {
 #define UIP_TCPH_LEN   20  /* Size of TCP header */
 #define UIP_IPTCPH_LEN (UIP_TCPH_LEN + UIP_IPH_LEN)  /* Size of IP + TCP header */
 #define UIP_TCPIP_HLEN UIP_IPTCPH_LEN
+#define UIP_UDPH_LEN   8   /* Size of UDP header */
+#define UIP_IPUDPH_LEN (UIP_UDPH_LEN + UIP_IPH_LEN)  /* Size of IP + UDP header */
 
 
 extern uip_ipaddr_t uip_hostaddr, uip_netmask, uip_draddr;
@@ -1153,5 +1310,29 @@ uint16_t uip_ipchksum(void);
  */
 uint16_t uip_tcpchksum(void);
 
+#if UDP_CONTROL_SUPPORT == 1
+/**
+ * Calculate the UDP checksum of the packet in uip_buf.
+ * return - The UDP checksum of the UDP datagram in uip_buf.
+ */
+uint16_t uip_udpchksum(void);
+#endif // UDP_CONTROL_SUPPORT == 1
+
+#if UIP_ARCH_CHKSUM == 1 && LOOP_PROFILER == 1 && DEBUG_SUPPORT == 15
+// With the loop profiler time base and the UART available the C and STM8
+// checksum loops are compared once at boot.
+#define CHKSUM_BENCHMARK	1
+void uip_chksum_benchmark(void);
+#endif // UIP_ARCH_CHKSUM == 1 && LOOP_PROFILER == 1 && DEBUG_SUPPORT == 15
+
+#if HTTP_SPLIT_OUTPUT == 1
+/**
+ * Send the frame in uip_buf, splitting a TCP data segment into two halves
+ * if the connection has splitting switched on (see uip_conn->split). Called
+ * in place of Enc28j60Send() after uip_arp_out().
+ */
+void uip_split_output(void);
+#endif // HTTP_SPLIT_OUTPUT == 1
+
 
 #endif /* __UIP_H__ */
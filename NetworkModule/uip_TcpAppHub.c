@@ -60,11 +60,21 @@ extern uint16_t mqtt_local_port;
 extern struct mqtt_client mqttclient; // Pointer to MQTT client declared in main.c
 extern uint8_t mqtt_start;
 extern uint8_t mqtt_close_tcp;
+#if MQTT_ZERO_COPY == 1
+extern uint8_t mqtt_direct_send;
+extern uint8_t mqtt_publish_due;
+#endif // MQTT_ZERO_COPY == 1
 #endif // BUILD_SUPPORT == MQTT_BUILD
 
 void uip_TcpAppHubCall(void)
 // We get here via UIP_APPCALL in the uip.c code
 {
+#if HTTP_MULTI_SEGMENT == 1
+  // Only the HTTP server can keep a second segment in flight. MQTT always
+  // completes a message exchange one segment at a time.
+  if (uip_sendmore && uip_conn->lport != htons(Port_Httpd)) return;
+#endif // HTTP_MULTI_SEGMENT == 1
+
   if(uip_conn->lport == htons(Port_Httpd)) {
     // This code is called if incoming traffic is HTTP. HttpDCall will read
     // the incoming data from the uip_buf, then create any needed output
@@ -75,7 +85,30 @@ void uip_TcpAppHubCall(void)
 
 // UARTPrintf("uip_tcpapphub Browser call\r\n");
 
+#if HTTPD_STATE_POOL == 1
+    {
+      struct tHttpD* pSocket;
+      pSocket = httpd_get_state();
+      if (pSocket) {
+        HttpDCall(uip_appdata, uip_datalen(), pSocket);
+#if PERIODIC_WORK_FLAGS == 1
+        // Keep the connection in the periodic polls while a request is
+        // being answered
+        if (httpd_busy(pSocket)) uip_poll_due();
+#endif // PERIODIC_WORK_FLAGS == 1
+      }
+      // No HTTP state is free for a new connection. Reset it, the Browser
+      // will try again.
+      else if (uip_connected()) uip_abort();
+    }
+#else
     HttpDCall(uip_appdata, uip_datalen(), &uip_conn->appstate.HttpDSocket);
+#if PERIODIC_WORK_FLAGS == 1
+    // Keep the connection in the periodic polls while a request is being
+    // answered
+    if (httpd_busy(&uip_conn->appstate.HttpDSocket)) uip_poll_due();
+#endif // PERIODIC_WORK_FLAGS == 1
+#endif // HTTPD_STATE_POOL == 1
   }
 
 #if BUILD_SUPPORT == MQTT_BUILD
@@ -92,6 +125,18 @@ void uip_TcpAppHubCall(void)
     if (mqtt_start > MQTT_START_QUEUE_CONNECT) {
       // Only call mqtt_sync if we know the client has been initialized
       mqtt_sync(&mqttclient);
+#if MQTT_ZERO_COPY == 1
+      // With MQTT_ZERO_COPY the pin and sensor PUBLISH messages are built
+      // here, in the connection poll, so that mqtt_publish() can pack
+      // them directly into the uip_buf. A poll only occurs when the
+      // connection has no data in flight.
+      if (uip_poll() && mqtt_publish_due == 1 && mqtt_start == MQTT_START_COMPLETE) {
+        mqtt_publish_due = 0;
+        mqtt_direct_send = 1;
+        publish_outbound();
+        mqtt_direct_send = 0;
+      }
+#endif // MQTT_ZERO_COPY == 1
       // If mqtt_close_tcp == 1 we are forcing a TCP connection close on return
       // to the UIP code. Note that the uip_TcpAppHubCall() function can only
       // be called if in the ESTABLISHED state - so a uip_close() is a valid
@@ -101,6 +146,26 @@ void uip_TcpAppHubCall(void)
       mqtt_close_tcp = 0;
       uip_close();
     }
+#if PERIODIC_WORK_FLAGS == 1
+    // MQTT is always polled. mqtt_sync() sends the queued messages and the
+    // keep alive PINGs from the poll.
+    else uip_poll_due();
+#endif // PERIODIC_WORK_FLAGS == 1
   }
 #endif // BUILD_SUPPORT == MQTT_BUILD
+
+#if RAW_UPLOAD_SUPPORT == 1
+  else if(uip_conn->lport == htons(RAW_UPLOAD_PORT)) {
+    // This code is called for the raw TCP firmware upload.
+    raw_upload_call();
+  }
+#endif // RAW_UPLOAD_SUPPORT == 1
+
+#if MODBUS_TCP_SUPPORT == 1
+  else if(uip_conn->lport == htons(MODBUS_TCP_PORT)) {
+    // This code is called for Modbus TCP requests from a PLC or SCADA
+    // poller.
+    modbus_call();
+  }
+#endif // MODBUS_TCP_SUPPORT == 1
 }
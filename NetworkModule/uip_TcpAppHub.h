@@ -63,10 +63,25 @@ void uip_TcpAppHubCall(void);
 
 #define UIP_APPCALL    uip_TcpAppHubCall
 
+#if UDP_CONTROL_SUPPORT == 1
+// UDP datagrams for UDP_CONTROL_PORT are handed to the control protocol in
+// main.c
+#define UIP_UDP_APPCALL udp_control_call
+#endif // UDP_CONTROL_SUPPORT == 1
+
+#if DHCP_SUPPORT == 1
+// DHCP replies for DHCPC_CLIENT_PORT are handed to the DHCP client in main.c
+#define UIP_DHCP_APPCALL dhcp_call
+#endif // DHCP_SUPPORT == 1
+
 
 typedef union 
 {
+#if HTTPD_STATE_POOL == 1
+  uint8_t HttpDSlot;        // Index of the connection's tHttpD in the pool
+#else
   struct tHttpD HttpDSocket;
+#endif // HTTPD_STATE_POOL == 1
 } uip_tcp_appstate_t;
 
 
@@ -128,6 +128,16 @@ static uint8_t i, c;
 static uint8_t arptime;
 static uint8_t tmpage;
 
+#if ARP_PENDING_SLOT == 1
+// The IP address (destination or default router) that the frame in the
+// ENC28J60 hold slot is waiting on. Zero if no frame is held.
+static uint16_t hold_ipaddr[2];
+
+// Number of ARP timer ticks before expiry at which the MQTT Server entry is
+// refreshed
+#define ARP_REFRESH_TICKS 2
+#endif // ARP_PENDING_SLOT == 1
+
 #define BUF   ((struct arp_hdr *)&uip_buf[0])
 #define IPBUF ((struct ethip_hdr *)&uip_buf[0])
 
@@ -145,6 +155,9 @@ uip_arp_init(void)
   for(i = 0; i < UIP_ARPTAB_SIZE; ++i) {
     memset(arp_table[i].ipaddr, 0, 4);
   }
+#if ARP_PENDING_SLOT == 1
+  memset(hold_ipaddr, 0, 4);
+#endif // ARP_PENDING_SLOT == 1
 }
 
 
@@ -172,9 +185,30 @@ uip_arp_timer(void)
       memset(tabptr->ipaddr, 0, 4);
     }
   }
+#if ARP_PENDING_SLOT == 1
+  // A frame still held after a full ARP timer tick is dropped. TCP will have
+  // retransmitted it by now.
+  memset(hold_ipaddr, 0, 4);
+#endif // ARP_PENDING_SLOT == 1
 }
 
 
+#if ARP_PENDING_SLOT == 1
+//---------------------------------------------------------------------------//
+static void
+uip_arp_send_held(uint16_t *ipaddr, struct uip_eth_addr *ethaddr)
+{
+  // If the frame in the hold slot is waiting on this IP address send it now
+  // with the MAC address just learned.
+  if((hold_ipaddr[0] | hold_ipaddr[1]) != 0 &&
+     uip_ipaddr_cmp(ipaddr, hold_ipaddr)) {
+    memset(hold_ipaddr, 0, 4);
+    Enc28j60SendHeld(ethaddr->addr);
+  }
+}
+#endif // ARP_PENDING_SLOT == 1
+
+
 //---------------------------------------------------------------------------//
 static void
 uip_arp_update(uint16_t *ipaddr, struct uip_eth_addr *ethaddr)
@@ -280,6 +314,9 @@ uip_arp_arpin(void)
 	 table, since it is likely that we will do more communication
 	 with this host in the future. */
       uip_arp_update(BUF->sipaddr, &BUF->shwaddr);
+#if ARP_PENDING_SLOT == 1
+      uip_arp_send_held(BUF->sipaddr, &BUF->shwaddr);
+#endif // ARP_PENDING_SLOT == 1
       
       /* The reply opcode is 2. */
       BUF->opcode = HTONS(2);
@@ -303,6 +340,9 @@ uip_arp_arpin(void)
        for us. */
     if(uip_ipaddr_cmp(BUF->dipaddr, uip_hostaddr)) {
       uip_arp_update(BUF->sipaddr, &BUF->shwaddr);
+#if ARP_PENDING_SLOT == 1
+      uip_arp_send_held(BUF->sipaddr, &BUF->shwaddr);
+#endif // ARP_PENDING_SLOT == 1
     }
     break;
   }
@@ -311,6 +351,31 @@ uip_arp_arpin(void)
 }
 
 
+//---------------------------------------------------------------------------//
+static void
+uip_arp_request(void)
+{
+  // Build an ARP request for ipaddr in the uip_buf.
+  memset(BUF->ethhdr.dest.addr, 0xff, 6);
+  memset(BUF->dhwaddr.addr, 0x00, 6);
+  memcpy(BUF->ethhdr.src.addr, uip_ethaddr.addr, 6);
+  memcpy(BUF->shwaddr.addr, uip_ethaddr.addr, 6);
+
+  uip_ipaddr_copy(BUF->dipaddr, ipaddr);
+  uip_ipaddr_copy(BUF->sipaddr, uip_hostaddr);
+  BUF->opcode = HTONS(ARP_REQUEST); /* ARP request. */
+  BUF->hwtype = HTONS(ARP_HWTYPE_ETH);
+  BUF->protocol = HTONS(UIP_ETHTYPE_IP);
+  BUF->hwlen = 6;
+  BUF->protolen = 4;
+  BUF->ethhdr.type = HTONS(UIP_ETHTYPE_ARP);
+
+  uip_appdata = &uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN];
+
+  uip_len = sizeof(struct arp_hdr);
+}
+
+
 //---------------------------------------------------------------------------//
 /**
  * Prepend Ethernet header to an outbound IP packet and see if we need to send out an
@@ -351,6 +416,18 @@ uip_arp_out(void)
   if(uip_ipaddr_cmp(IPBUF->destipaddr, broadcast_ipaddr)) {
     memcpy(IPBUF->ethhdr.dest.addr, broadcast_ethaddr.addr, 6);
   }
+#if MULTICAST_GROUP_SUPPORT == 1
+  else if ((((uint8_t *)IPBUF->destipaddr)[0] & 0xf0) == 0xe0) {
+    // IPv4 multicast. The MAC address is 01-00-5E plus the low 23 bits of
+    // the group address (RFC 1112), no ARP is needed.
+    IPBUF->ethhdr.dest.addr[0] = 0x01;
+    IPBUF->ethhdr.dest.addr[1] = 0x00;
+    IPBUF->ethhdr.dest.addr[2] = 0x5e;
+    IPBUF->ethhdr.dest.addr[3] = (uint8_t)(((uint8_t *)IPBUF->destipaddr)[1] & 0x7f);
+    IPBUF->ethhdr.dest.addr[4] = ((uint8_t *)IPBUF->destipaddr)[2];
+    IPBUF->ethhdr.dest.addr[5] = ((uint8_t *)IPBUF->destipaddr)[3];
+  }
+#endif // MULTICAST_GROUP_SUPPORT == 1
   else {
     // Check if the destination address is on the local network.
     if(!uip_ipaddr_maskcmp(IPBUF->destipaddr, uip_hostaddr, uip_netmask)) {
@@ -377,23 +454,16 @@ uip_arp_out(void)
       // The destination address was not in our ARP table, so we overwrite the
       // IP packet with an ARP request.
       
-      memset(BUF->ethhdr.dest.addr, 0xff, 6);
-      memset(BUF->dhwaddr.addr, 0x00, 6);
-      memcpy(BUF->ethhdr.src.addr, uip_ethaddr.addr, 6);
-      memcpy(BUF->shwaddr.addr, uip_ethaddr.addr, 6);
-    
-      uip_ipaddr_copy(BUF->dipaddr, ipaddr);
-      uip_ipaddr_copy(BUF->sipaddr, uip_hostaddr);
-      BUF->opcode = HTONS(ARP_REQUEST); /* ARP request. */
-      BUF->hwtype = HTONS(ARP_HWTYPE_ETH);
-      BUF->protocol = HTONS(UIP_ETHTYPE_IP);
-      BUF->hwlen = 6;
-      BUF->protolen = 4;
-      BUF->ethhdr.type = HTONS(UIP_ETHTYPE_ARP);
-
-      uip_appdata = &uip_buf[UIP_TCPIP_HLEN + UIP_LLH_LEN];
-    
-      uip_len = sizeof(struct arp_hdr);
+#if ARP_PENDING_SLOT == 1
+      // Park the IP packet in the ENC28J60 hold slot first. It is sent by
+      // uip_arp_arpin() when the ARP reply arrives.
+      memcpy(IPBUF->ethhdr.src.addr, uip_ethaddr.addr, 6);
+      IPBUF->ethhdr.type = HTONS(UIP_ETHTYPE_IP);
+      Enc28j60Hold(uip_buf, (uint16_t)(uip_len + sizeof(struct uip_eth_hdr)));
+      uip_ipaddr_copy(hold_ipaddr, ipaddr);
+#endif // ARP_PENDING_SLOT == 1
+
+      uip_arp_request();
       return;
     }
 
@@ -430,6 +500,14 @@ int check_mqtt_server_arp_entry(void)
     tabptr = &arp_table[i];
     if(uip_ipaddr_cmp(ipaddr, tabptr->ipaddr)) {
       // Found the IP address in the ARP table
+#if ARP_PENDING_SLOT == 1
+      // If the entry is about to expire build an ARP request in the uip_buf
+      // so that the reply renews the entry before uip_arp_timer() clears
+      // it. The caller sends the request if uip_len > 0.
+      if ((uint8_t)(arptime - tabptr->time) >= (UIP_ARP_MAXAGE - ARP_REFRESH_TICKS)) {
+        uip_arp_request();
+      }
+#endif // ARP_PENDING_SLOT == 1
       return (uint8_t)1;
       break;
     }
@@ -151,6 +151,8 @@ void uip_arp_timer(void);
 // void uip_get_mqtt_server_mac(uip_ipaddr_t uip_mqttserveraddr);
 
 // Check for the MQTT Server entry in the ARP Table
+// With ARP_PENDING_SLOT an ARP request is left in the uip_buf (uip_len > 0)
+// if the entry is about to expire.
 int check_mqtt_server_arp_entry(void);
 
 
@@ -78,8 +78,6 @@
 
 
 #include "uip_types.h"
-#include "Enc28j60.h"
-#include "uip_TcpAppHub.h"
 #include "uipopt.h"
 
 
@@ -641,6 +639,347 @@
 #define SUPPORT_174 1
 
 
+// Optional performance features
+// These #defines are not part of the BUILD_TYPE tables above. They default
+// to disabled so that the standard builds are unchanged. A developer can
+// enable them individually for a specific build. See the descriptions at
+// the end of the #define documentation below.
+#define ENC28J60_HW_SPI			0
+#define FRAME_COPY_STATISTICS		0
+#define RX_DRAIN_SUPPORT		0
+#define RX_DRAIN_MAX_PACKETS		8
+#define RX_PEEK_DISCARD			0
+#define RX_FILTER_PROFILES		0
+#define TX_DOUBLE_BUFFER		0
+#define ENC28J60_INT_SUPPORT		0
+#define ENC28J60_BANK_SHADOW		0
+#define TCP_REXMIT_FROM_TXBUF		0
+#define LOOP_PROFILER			0
+#define RX_OCCUPANCY_STATISTICS		0
+#define HTTP_MULTI_SEGMENT		0
+#define HTTP_SPLIT_OUTPUT		0
+#define UIP_ARCH_CHKSUM			0
+#define HTTP_FUSED_CHKSUM		0
+#define ARP_PENDING_SLOT		0
+#define HTTPD_STATE_POOL		0
+#define HTTPD_POOL_SIZE			3
+#define PERIODIC_WORK_FLAGS		0
+#define PERIODIC_SWEEP_PASSES		10
+#define TCP_FAST_REXMIT			0
+#define TCP_SYN_BACKLOG			0
+#define UDP_CONTROL_SUPPORT		0
+#define UDP_CONTROL_PORT		8087
+#define HTTP_LITERAL_RUNS		0
+#define HTTP_SIZE_CACHE			0
+#define GZIP_STATIC_SUPPORT		0
+#define HTTP_KEEPALIVE			0
+#define HTTP_KEEPALIVE_TIMEOUT		10
+#define STATE_JSON_SUPPORT		0
+#define HTTP_ETAG_SUPPORT		0
+#define HTTP_GET_QUEUE			0
+#define POST_STREAM_PARSE		0
+#define HTTP_CACHE_RESOURCES		0
+#define HTTP_LONG_POLL			0
+#define HTTP_LONG_POLL_TIMEOUT		25
+#define MQTT_PUBLISH_BATCH		0
+#define MQTT_DISCOVERY_BATCH		0
+#define MQTT_DISCOVERY_HASH		0
+#define MQTT_PUBLISH_ROUND_ROBIN	0
+#define MQTT_STATE_AGGREGATE		0
+#define MQTT_PUBLISH_QOS1		0
+#define MQTT_FAST_RECONNECT		0
+#define MQTT_ZERO_COPY			0
+#define MQTT_TOPIC_PREFIX		0
+#define MQTT_PUBLISH_DISPATCH		0
+#define MQTT_RECV_STREAM		0
+#define DS18B20_NONBLOCKING		0
+#define DS18B20_SKIP_ROM		0
+#define DS18B20_CRC_CHECK		0
+#define DS18B20_RESOLUTION		12
+#define BME280_NORMAL_MODE_SUPPORT	0
+#define SENSOR_FIXED_POINT		0
+#define INA226_ALERT_SUPPORT		0
+#define INA226_AVERAGE			0
+#define I2C_HW_SUPPORT			0
+#define I2C_EEPROM_FAST_COPY		0
+#define PCF8574_EVENT_IO		0
+#define INPUT_EDGE_CAPTURE		0
+#define INPUT_DEBOUNCE_MS		20
+#define INPUT_PORT_SAMPLING		0
+#define INPUT_DEBOUNCE_DEPTH		2
+#define OUTPUT_PORT_BATCH		0
+#define MAIN_LOOP_SCHEDULER		0
+#define IDLE_WAIT_SUPPORT		0
+#define PIN_TIMER_LIST			0
+#define FREE_RUNNING_TIMEBASE		0
+#define LINKED_PIN_MASKS		0
+#define RUNTIME_DIRTY_FLAGS		0
+#define EEPROM_WRITE_CACHE		0
+#define EEPROM_CACHE_QUIET_MS		2000
+#define DEFERRED_SENSOR_INIT		0
+#define HOT_APPLY_CONFIG		0
+#define SREC_UPLOAD_PIPELINE		0
+#define BINARY_UPLOAD_SUPPORT		0
+#define BLOCK_DELTA_UPLOAD		0
+#define OB_TEMPLATE_CACHE		0
+#define RAW_UPLOAD_SUPPORT		0
+#define FLASH_COPY_STAGING		0
+#define CONFIG_SNAPSHOT_SUPPORT		0
+#define RAM_HEADROOM_STATISTICS		0
+#define PUBLISH_LATENCY_STATS		0
+#define TRACE_RING_SUPPORT		0
+#define UDP_TELEMETRY_SUPPORT		0
+#define MULTICAST_GROUP_SUPPORT		0
+#define MODBUS_TCP_SUPPORT		0
+#define MODBUS_TCP_PORT			502
+#define HTTP_WEBSOCKET			0
+#define DHCP_SUPPORT			0
+#define RULE_ENGINE_SUPPORT		0
+#define SENSOR_HISTORY_SUPPORT		0
+#define SENSOR_HISTORY_INTERVAL		30
+#define SENSOR_DEADBAND_SUPPORT		0
+#define DEADBAND_TEMPERATURE		2
+#define DEADBAND_PRESSURE		1
+#define DEADBAND_HUMIDITY		1
+#define SENSOR_PUBLISH_MIN_INTERVAL	30
+#define SENSOR_PUBLISH_MAX_INTERVAL	900
+#define MQTT_HA_STATUS_RESYNC		0
+#define ENC28J60_BUFFER_SPLIT		0
+#define ENC28J60_FLOW_CONTROL		0
+#define FAST_FORMAT			0
+#define PAGE_BUILD_STATISTICS		0
+#define IMAGE_BACKUP_TASK		0
+#define PINOUT_CONST_MASKS		0
+#define INPUT_PASS_STATISTICS		0
+#define SENSOR_STRING_CACHE		0
+#define HTTP_PACING			0
+#define HTTP_PACING_SHARE		50
+#define DOMOTICZ_PUBLISH_BATCH		0
+
+#if INPUT_DEBOUNCE_DEPTH < 1 || INPUT_DEBOUNCE_DEPTH > 4
+  #error "INPUT_DEBOUNCE_DEPTH must be 1 to 4"
+#endif
+#if EEPROM_CACHE_QUIET_MS < 1 || EEPROM_CACHE_QUIET_MS > 30000
+  #error "EEPROM_CACHE_QUIET_MS must be 1 to 30000"
+#endif
+#if HTTP_PACING_SHARE < 10 || HTTP_PACING_SHARE > 100
+  #error "HTTP_PACING_SHARE must be 10 to 100"
+#endif
+#if INA226_AVERAGE > 7
+  #error "INA226_AVERAGE must be 0 to 7"
+#endif
+#if DS18B20_RESOLUTION < 9 || DS18B20_RESOLUTION > 12
+  #error "DS18B20_RESOLUTION must be 9 to 12"
+#endif
+#if ENC28J60_HW_SPI == 1 && DS18B20_SUPPORT == 1
+  #error "ENC28J60_HW_SPI uses IO 16 - DS18B20_SUPPORT must be disabled"
+#endif
+#if ENC28J60_HW_SPI == 1 && ENC28J60_INT_SUPPORT == 1
+  #error "ENC28J60_HW_SPI uses PC5 - ENC28J60_INT_SUPPORT must be disabled"
+#endif
+#if OB_TEMPLATE_CACHE == 1 && OB_EEPROM_SUPPORT == 0
+// Templates are read from the I2C EEPROM only in upgradeable builds.
+#undef OB_TEMPLATE_CACHE
+#define OB_TEMPLATE_CACHE	0
+#endif
+#if FLASH_COPY_STAGING == 1 && OB_EEPROM_SUPPORT == 0
+// Flash is only copied from the I2C EEPROM in upgradeable builds.
+#undef FLASH_COPY_STAGING
+#define FLASH_COPY_STAGING	0
+#endif
+#if CONFIG_SNAPSHOT_SUPPORT == 1 && OB_EEPROM_SUPPORT == 0 && (BUILD_SUPPORT == BROWSER_ONLY_BUILD || DOMOTICZ_SUPPORT == 1)
+// An imported snapshot stages the IO Names and Sensor IDX values in the I2C
+// EEPROM until its CRC32 is checked.
+#undef CONFIG_SNAPSHOT_SUPPORT
+#define CONFIG_SNAPSHOT_SUPPORT	0
+#endif
+#if IMAGE_BACKUP_TASK == 1 && (OB_EEPROM_SUPPORT == 0 || BUILD_SUPPORT == CODE_UPLOADER_BUILD)
+// Only the runtime images of upgradeable builds are backed up to EEPROM0.
+#undef IMAGE_BACKUP_TASK
+#define IMAGE_BACKUP_TASK	0
+#endif
+#if RAM_HEADROOM_STATISTICS == 1 && LINK_STATISTICS == 0
+// The peaks are shown on the Link Error Statistics page.
+#undef RAM_HEADROOM_STATISTICS
+#define RAM_HEADROOM_STATISTICS	0
+#endif
+#if PUBLISH_LATENCY_STATS == 1 && (BUILD_SUPPORT != MQTT_BUILD || LINK_STATISTICS == 0)
+// Only MQTT builds publish Input changes.
+#undef PUBLISH_LATENCY_STATS
+#define PUBLISH_LATENCY_STATS	0
+#endif
+#if HTTP_PACING == 1 && (BUILD_SUPPORT != MQTT_BUILD || FREE_RUNNING_TIMEBASE == 0)
+// HTTP gives way to MQTT, and the segment build time is measured with
+// now_us().
+#undef HTTP_PACING
+#define HTTP_PACING	0
+#endif
+#if DOMOTICZ_PUBLISH_BATCH == 1 && (BUILD_SUPPORT != MQTT_BUILD || DOMOTICZ_SUPPORT == 0)
+// Only the Domoticz MQTT builds publish to domoticz/in.
+#undef DOMOTICZ_PUBLISH_BATCH
+#define DOMOTICZ_PUBLISH_BATCH	0
+#endif
+#if INPUT_PASS_STATISTICS == 1 && LINK_STATISTICS == 0
+// The input pass times are shown on the Link Error Statistics page.
+#undef INPUT_PASS_STATISTICS
+#define INPUT_PASS_STATISTICS	0
+#endif
+#if PAGE_BUILD_STATISTICS == 1 && (LINK_STATISTICS == 0 || FREE_RUNNING_TIMEBASE == 0)
+// The build time is measured with now_us() and shown on the Link Error
+// Statistics page.
+#undef PAGE_BUILD_STATISTICS
+#define PAGE_BUILD_STATISTICS	0
+#endif
+#if TRACE_RING_SUPPORT == 1 && OB_EEPROM_SUPPORT == 0
+// The trace is kept in the I2C EEPROM of upgradeable builds.
+#undef TRACE_RING_SUPPORT
+#define TRACE_RING_SUPPORT	0
+#endif
+#if UDP_TELEMETRY_SUPPORT == 1 && UDP_CONTROL_SUPPORT == 0
+// The collector is set with a UDP control command.
+#undef UDP_TELEMETRY_SUPPORT
+#define UDP_TELEMETRY_SUPPORT	0
+#endif
+#if MULTICAST_GROUP_SUPPORT == 1 && UDP_CONTROL_SUPPORT == 0
+// Group commands are UDP control requests.
+#undef MULTICAST_GROUP_SUPPORT
+#define MULTICAST_GROUP_SUPPORT	0
+#endif
+#if DHCP_SUPPORT == 1 && UDP_CONTROL_SUPPORT == 0
+// The DHCP client uses the uIP UDP input.
+#undef DHCP_SUPPORT
+#define DHCP_SUPPORT		0
+#endif
+#if SENSOR_DEADBAND_SUPPORT == 1 && BUILD_SUPPORT != MQTT_BUILD
+// Only MQTT builds publish the sensors.
+#undef SENSOR_DEADBAND_SUPPORT
+#define SENSOR_DEADBAND_SUPPORT	0
+#endif
+#if SENSOR_HISTORY_SUPPORT == 1 && (BUILD_SUPPORT != MQTT_BUILD || HOME_ASSISTANT_SUPPORT == 0)
+// The history is published with the Home Assistant device topics.
+#undef SENSOR_HISTORY_SUPPORT
+#define SENSOR_HISTORY_SUPPORT	0
+#endif
+#if BLOCK_DELTA_UPLOAD == 1 && BINARY_UPLOAD_SUPPORT == 0
+  #error "BLOCK_DELTA_UPLOAD requires BINARY_UPLOAD_SUPPORT"
+#endif
+
+#if HTTPD_STATE_POOL == 1
+// The TCP control blocks no longer carry the HTTP state (see
+// HTTPD_STATE_POOL), so the connection table is made larger.
+#undef UIP_CONNS
+#define UIP_CONNS       8
+#endif // HTTPD_STATE_POOL == 1
+#if PERIODIC_WORK_FLAGS == 1 && UIP_CONNS > 8
+  #error "PERIODIC_WORK_FLAGS keeps one bit per connection - UIP_CONNS must be 8 or less"
+#endif
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+// The Code Uploader has no IO to control.
+#undef UDP_CONTROL_SUPPORT
+#define UDP_CONTROL_SUPPORT	0
+#undef GZIP_STATIC_SUPPORT
+#define GZIP_STATIC_SUPPORT	0
+#undef HTTP_KEEPALIVE
+#define HTTP_KEEPALIVE		0
+#undef STATE_JSON_SUPPORT
+#define STATE_JSON_SUPPORT	0
+#undef HTTP_ETAG_SUPPORT
+#define HTTP_ETAG_SUPPORT	0
+#undef HTTP_CACHE_RESOURCES
+#define HTTP_CACHE_RESOURCES	0
+#undef HTTP_LONG_POLL
+#define HTTP_LONG_POLL		0
+#undef CONFIG_SNAPSHOT_SUPPORT
+#define CONFIG_SNAPSHOT_SUPPORT	0
+#undef TRACE_RING_SUPPORT
+#define TRACE_RING_SUPPORT	0
+#undef UDP_TELEMETRY_SUPPORT
+#define UDP_TELEMETRY_SUPPORT	0
+#undef MULTICAST_GROUP_SUPPORT
+#define MULTICAST_GROUP_SUPPORT	0
+#undef MODBUS_TCP_SUPPORT
+#define MODBUS_TCP_SUPPORT	0
+#undef HTTP_WEBSOCKET
+#define HTTP_WEBSOCKET		0
+#undef DHCP_SUPPORT
+#define DHCP_SUPPORT		0
+#undef RULE_ENGINE_SUPPORT
+#define RULE_ENGINE_SUPPORT	0
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+#if BUILD_SUPPORT != CODE_UPLOADER_BUILD
+// Uploads are only parsed by the Code Uploader.
+#undef RAW_UPLOAD_SUPPORT
+#define RAW_UPLOAD_SUPPORT	0
+#endif // BUILD_SUPPORT != CODE_UPLOADER_BUILD
+#if GZIP_STATIC_SUPPORT == 1 || HTTP_CACHE_RESOURCES == 1
+// The style sheet is sent as a separate resource at /b0
+#define STYLE_RESOURCE		1
+#else
+#define STYLE_RESOURCE		0
+#endif // GZIP_STATIC_SUPPORT == 1 || HTTP_CACHE_RESOURCES == 1
+#if HOME_ASSISTANT_SUPPORT == 0
+// Auto Discovery messages are only sent in Home Assistant builds.
+#undef MQTT_DISCOVERY_BATCH
+#define MQTT_DISCOVERY_BATCH	0
+#undef MQTT_DISCOVERY_HASH
+#define MQTT_DISCOVERY_HASH	0
+#undef MQTT_STATE_AGGREGATE
+#define MQTT_STATE_AGGREGATE	0
+#undef MQTT_TOPIC_PREFIX
+#define MQTT_TOPIC_PREFIX	0
+#undef MQTT_PUBLISH_DISPATCH
+#define MQTT_PUBLISH_DISPATCH	0
+#undef MQTT_RECV_STREAM
+#define MQTT_RECV_STREAM	0
+#endif // HOME_ASSISTANT_SUPPORT == 0
+#if MQTT_DISCOVERY_HASH == 0
+// The status driven resync uses the Home Assistant birth message
+// subscription and the discovery hash.
+#undef MQTT_HA_STATUS_RESYNC
+#define MQTT_HA_STATUS_RESYNC	0
+#endif // MQTT_DISCOVERY_HASH == 0
+#if INA226_SUPPORT == 0
+// The INA226 ALERT pin is only used in builds with INA226 sensors.
+#undef INA226_ALERT_SUPPORT
+#define INA226_ALERT_SUPPORT	0
+#endif // INA226_SUPPORT == 0
+#if BUILD_SUPPORT != BROWSER_ONLY_BUILD
+// Pin timers are only used in the Browser Only build.
+#undef PIN_TIMER_LIST
+#define PIN_TIMER_LIST		0
+#endif // BUILD_SUPPORT != BROWSER_ONLY_BUILD
+#if LINKED_SUPPORT == 0
+// The Linked pin masks are only used in builds with Linked pins.
+#undef LINKED_PIN_MASKS
+#define LINKED_PIN_MASKS	0
+#endif // LINKED_SUPPORT == 0
+#if BUILD_SUPPORT != MQTT_BUILD
+// Pin state PUBLISH messages are only sent in MQTT builds.
+#undef MQTT_PUBLISH_ROUND_ROBIN
+#define MQTT_PUBLISH_ROUND_ROBIN	0
+#undef MQTT_PUBLISH_QOS1
+#define MQTT_PUBLISH_QOS1	0
+#undef MQTT_FAST_RECONNECT
+#define MQTT_FAST_RECONNECT	0
+#undef MQTT_ZERO_COPY
+#define MQTT_ZERO_COPY		0
+#endif // BUILD_SUPPORT != MQTT_BUILD
+#if MQTT_DISCOVERY_BATCH == 1 && MQTT_PUBLISH_BATCH == 0
+  #error "MQTT_DISCOVERY_BATCH packs messages with MQTT_PUBLISH_BATCH - it must be enabled"
+#endif
+#if DOMOTICZ_PUBLISH_BATCH == 1 && MQTT_PUBLISH_BATCH == 0
+  #error "DOMOTICZ_PUBLISH_BATCH packs messages with MQTT_PUBLISH_BATCH - it must be enabled"
+#endif
+#if MQTT_PUBLISH_DISPATCH == 1 && MQTT_TOPIC_PREFIX == 0
+  #error "MQTT_PUBLISH_DISPATCH compares topics with the MQTT_TOPIC_PREFIX prefix - it must be enabled"
+#endif
+
+// These headers are included after the feature settings above so that they
+// can test the settings in their own #if statements.
+#include "Enc28j60.h"
+#include "uip_TcpAppHub.h"
+
+
   // The following describes the various #defines used in the above #define
   // tables.
 
@@ -843,6 +1182,1228 @@
   // 0 = No support
   // 1 = Supported
 
+  // ENC28J60_HW_SPI
+  // Drives the ENC28J60 with the STM8 hardware SPI peripheral instead of
+  // the bit bang SPI on Port C bits 1 to 4. The hardware SPI runs at 8MHz.
+  // The frame copy times have not been measured on a re-wired board; use
+  // FRAME_COPY_STATISTICS to compare the two on hardware.
+  // The STM8S005 SPI peripheral is fixed to these pins, so the board must
+  // be re-wired to use this option:
+  //   PC5 (Pin 30) - SPI SCK  - to ENC28J60 SCK (no longer -INT)
+  //   PC6 (Pin 33) - SPI MOSI - to ENC28J60 SI  (IO 16 is lost)
+  //   PC7 (Pin 34) - SPI MISO - to ENC28J60 SO  (IO 8 is lost)
+  //   PC1 (Pin 26) - -CS stays as a GPIO output
+  // IO 8 and IO 16 must be left Disabled in the Configuration page. This
+  // is why the bit bang SPI remains the default for the unmodified HW-584.
+  // If ENC28J60_HW_SPI is Supported:
+  //   Must Disable DS18B20_SUPPORT (the DS18B20 uses IO 16)
+  // 0 = Bit bang SPI
+  // 1 = Hardware SPI
+
+  // FRAME_COPY_STATISTICS
+  // Measures the time spent copying frame data across the SPI interface
+  // (using the 10us TIM1 time base) and reports it as field 36 (receive)
+  // and field 37 (transmit) on the Link Error Statistics page. Each field
+  // shows the last copy time in 10us units followed by the byte count of
+  // that frame, in hex. Useful for comparing the bit bang SPI against
+  // ENC28J60_HW_SPI on the same network traffic.
+  // 0 = No support
+  // 1 = Supported
+
+  // RX_DRAIN_SUPPORT
+  // Normally the main loop reads one packet from the ENC28J60 per pass and
+  // then runs all of the MQTT, timer, and GPIO housekeeping before reading
+  // the next one. A burst of traffic (for instance a Home Assistant "toggle
+  // all" of 16 PUBLISH messages) can then overflow the ENC28J60 receive
+  // buffer. With RX_DRAIN_SUPPORT the main loop keeps reading and
+  // processing packets until the ENC28J60 has none waiting, up to
+  // RX_DRAIN_MAX_PACKETS packets per pass. The deepest drain seen and the
+  // number of times the RX_DRAIN_MAX_PACKETS limit was hit with packets
+  // still waiting are shown as field 38 on the Link Error Statistics page.
+  // Adds about 150 bytes of Flash and 3 bytes of RAM.
+  // 0 = No support
+  // 1 = Supported
+
+  // RX_DRAIN_MAX_PACKETS
+  // The maximum number of packets processed in one receive drain when
+  // RX_DRAIN_SUPPORT is enabled. Each packet can take a few milliseconds
+  // if it results in a page or MQTT transmission, so this value bounds the
+  // time the main loop spends in the receive drain.
+
+  // RX_PEEK_DISCARD
+  // Much of the traffic that passes the ENC28J60 MAC filter is dropped by
+  // uip anyway (ARP for other hosts, broadcasts, IP traffic for other
+  // addresses, unknown protocols, TCP to ports we don't use). With
+  // RX_PEEK_DISCARD the Enc28j60Receive() function first copies only the
+  // frame headers (42 bytes) and checks the ethertype, ARP target address,
+  // destination IP address, protocol, and TCP destination port (listening
+  // ports plus the local port of any open HTTP or MQTT connection). If the
+  // frame is not ours the rest of it is skipped without being copied over
+  // the SPI. ICMP (ping) and frames with IP options are always passed to
+  // uip. Note that TCP frames to unused ports are silently dropped rather
+  // than answered with a RST. The number of discarded frames is shown as
+  // field 39 on the Link Error Statistics page.
+  // 0 = No support
+  // 1 = Supported
+
+  // RX_FILTER_PROFILES
+  // Adds URL command /86x to select one of three ENC28J60 receive filter
+  // profiles. The profile is saved in EEPROM and applied when the ENC28J60
+  // is initialized (the command causes a reboot).
+  //   /860 Standard: frames to our MAC address plus all broadcasts
+  //   /861 Frames to our MAC address plus ARP broadcasts only. Uses the
+  //        ENC28J60 pattern match filter so other broadcast traffic is
+  //        rejected in hardware.
+  //   /862 Same as /861 plus the multicast groups in the hash table
+  //        filter (see mcast_hash in Enc28j60.c)
+  // On a busy network segment profile 1 removes most of the per-frame work
+  // of the MCU. Note that profile 1 will block DHCP and other broadcast
+  // based protocols.
+  // 0 = No support
+  // 1 = Supported
+
+  // TX_DOUBLE_BUFFER
+  // Splits the ENC28J60 transmit memory into two slots. Enc28j60Send()
+  // copies the next frame into the free slot while the previous frame is
+  // still being transmitted, and returns as soon as the transmission is
+  // started instead of waiting for it to complete. The completion of a
+  // frame (including the late collision retries) is handled when the next
+  // frame is sent, or from the main loop via Enc28j60TxPoll(). This allows
+  // the SPI copy of a frame to overlap with the wire time of the previous
+  // frame.
+  // 0 = No support
+  // 1 = Supported
+
+  // ENC28J60_INT_SUPPORT
+  // Enables the ENC28J60 -INT output (connected to PC5) for packet arrival
+  // (PKTIF), receive overflow (RXERIF) and transmit complete / error (TXIF /
+  // TXERIF). Enc28j60Receive() and Enc28j60TxPoll() read the PC5 pin and
+  // only access the ENC28J60 over SPI when -INT is asserted, removing the
+  // bank switch and EPKTCNT read from every main loop pass when the network
+  // is idle. The pin is read directly rather than via an EXTI interrupt: -INT
+  // stays asserted while any enabled event is pending so a level check can't
+  // miss an event (an edge interrupt can if a second packet arrives before
+  // the first is processed). The EXTI edge interrupt is only used to wake
+  // idle_wait() (IDLE_WAIT_SUPPORT). Because of the ENC28J60 PKTIF errata
+  // EPKTCNT is also read every 20ms (the periodic timer) when -INT is not
+  // asserted, so a waiting packet is never left in the buffer.
+  // Can't be used with ENC28J60_HW_SPI.
+  // 0 = No support
+  // 1 = Supported
+
+  // ENC28J60_BANK_SHADOW
+  // Keeps a copy of the ENC28J60 bank select bits so Enc28j60SwitchBank()
+  // does nothing if the bank is already selected, and only clears / sets
+  // the bank select bits that actually change otherwise. This reduces the
+  // SPI operations for each received frame from 12 to 10, for each
+  // transmitted frame from 10 to 8, and for each idle main loop pass from
+  // 4 to 2.
+  // 0 = No support
+  // 1 = Supported
+
+  // TCP_REXMIT_FROM_TXBUF
+  // When uip needs to retransmit a TCP segment for an ESTABLISHED
+  // connection it normally calls the application (httpd or MQTT) to
+  // regenerate the segment. With TCP_REXMIT_FROM_TXBUF the ENC28J60 driver
+  // checks whether the last frame written to the TX memory is that
+  // segment (same ports, sequence number and length). If so, only the
+  // acknowledge number and TCP checksum are patched (when they changed)
+  // and the frame is transmitted again from the TX memory. If any other
+  // frame was sent in between the segment is regenerated as before.
+  // 0 = No support
+  // 1 = Supported
+
+  // LOOP_PROFILER
+  // Times each phase of the main loop (receive, uip_input, MQTT startup /
+  // sanity check / publish, periodic_service, check_runtime_changes, sensor
+  // reads, everything else, and the complete pass) using TIM1 (10us
+  // resolution). For each phase the min, max, and a histogram with 8
+  // buckets (<40us, <160us, <640us, <2.56ms, <10.24ms, <40.96ms, <163.84ms,
+  // longer) are kept. The results are output on the UART every 30 seconds,
+  // so DEBUG_SUPPORT 15 is needed to see them. Uses about 180 bytes of RAM.
+  // 0 = No support
+  // 1 = Supported
+
+  // RX_OCCUPANCY_STATISTICS
+  // Adds two fields to the Link Error Statistics page (LINK_STATISTICS must
+  // be enabled) to help size the ENC28J60 RX / TX memory split:
+  //   50  Peak EPKTCNT (2 hex digits), peak RX buffer occupancy in bytes
+  //       (4 hex digits), last sampled RX buffer occupancy (4 hex digits).
+  //       The occupancy (ERXWRPT vs ERXRDPT) is sampled each time a packet
+  //       is received.
+  //   51  Total time in milliseconds spent waiting for the ENC28J60
+  //       transmitter (the TXRTS wait in Enc28j60Send() and the wait for
+  //       transmit complete).
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_MULTI_SEGMENT
+  // Lets an HTTP connection keep two segments in flight when sending a web
+  // page instead of waiting for the acknowledge of each segment. The second
+  // segment is built from the page template right after the first segment
+  // is sent. If a segment has to be retransmitted the template position is
+  // moved back and the segment is built again, so no copy of the data in
+  // flight is kept. Many hosts delay the acknowledge of a single segment,
+  // and sending a second segment gets the acknowledge back sooner.
+  // MQTT connections are not affected.
+  // Costs about 20 bytes of RAM. Works best with TX_DOUBLE_BUFFER.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_SPLIT_OUTPUT
+  // Restores the uIP split output stage. Each outgoing TCP data segment on
+  // a connection with uip_conn->split set is sent as two segments of half
+  // the size. Hosts that delay the ACK of a single segment (up to 200ms on
+  // Windows and Linux) ACK the second segment right away. The split is on
+  // for HTTP connections and off for MQTT connections.
+  // If LINK_STATISTICS is enabled fields are added to the Link Error
+  // Statistics page to measure the gain:
+  //   52  Number of segments sent as two halves.
+  //   53  Time in milliseconds to send the last web page, from the header
+  //       to the connection close.
+  // A split segment is not retransmitted from the ENC28J60 TX memory when
+  // TCP_REXMIT_FROM_TXBUF is enabled (the application rebuilds it instead).
+  // 0 = No support
+  // 1 = Supported
+
+  // UIP_ARCH_CHKSUM
+  // Replaces the uIP C checksum loop used by uip_ipchksum() and
+  // uip_tcpchksum() with a version tuned for the STM8. The high and low
+  // bytes of the 16 bit words are summed in separate accumulators, 4 words
+  // per pass, and the carries are folded back in once per block instead of
+  // being tested after every word.
+  // If LOOP_PROFILER is enabled and DEBUG_SUPPORT is 15 both loops are timed
+  // over a 500 byte buffer at boot and the results are printed on the UART.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_FUSED_CHKSUM
+  // CopyHttpData() sums the TCP checksum of a web page segment while it
+  // copies the template into the transmit buffer and hands the sum to uIP
+  // (uip_payload_chksum()). The TCP checksum then only covers the pseudo
+  // header and the TCP header instead of another pass over the payload.
+  // Segments not built by CopyHttpData() (headers, MQTT) are summed as
+  // before.
+  // 0 = No support
+  // 1 = Supported
+
+  // ARP_PENDING_SLOT
+  // When uip_arp_out() has to replace an outgoing packet with an ARP request
+  // the packet is first parked in a hold slot in the ENC28J60 memory. The
+  // parked packet is sent as soon as the ARP reply arrives instead of waiting
+  // for the TCP retransmit timer. The hold slot is taken from the end of the
+  // ENC28J60 RX buffer (the RX buffer shrinks from 6kb to 5.4kb).
+  // The ARP entry of the MQTT Server is also refreshed with an ARP request
+  // shortly before it would expire, so an MQTT publish does not stall on an
+  // ARP lookup every UIP_ARP_MAXAGE.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTPD_STATE_POOL
+  // Removes the HTTP state (struct tHttpD) from each uip_conn. The state is
+  // taken from a pool of HTTPD_POOL_SIZE entries when a Browser connects and
+  // is given up when the connection leaves the ESTABLISHED state. This makes
+  // a TCP control block about 20 bytes smaller and UIP_CONNS is increased
+  // to 8, so a dashboard, a phone, MQTT and extra Browsers no longer compete
+  // for 4 connections. A Browser that connects while the pool is in use is
+  // reset as before.
+  // RAM: 8 connections plus a pool of 3 use about 120 bytes more than the
+  // standard 4 connections.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTPD_POOL_SIZE
+  // The number of HTTP states in the pool when HTTPD_STATE_POOL is enabled.
+  // Each entry uses about 20 bytes of RAM.
+
+  // PERIODIC_WORK_FLAGS
+  // periodic_service() normally runs uip_periodic() for every connection on
+  // every pass, including closed and idle connections. With this option
+  // each connection has a "poll due" bit (uip_periodic_due) that the
+  // application sets with uip_poll_due() while it has outbound work: the
+  // HTTP server while it is answering a request, MQTT while it is
+  // connected. Normal passes only visit connections with the bit set. Every
+  // PERIODIC_SWEEP_PASSES passes all connections are visited so that the
+  // TCP timers (retransmit, TIME_WAIT, SYN) still run. The TCP timers count
+  // seconds, so a sweep every 200ms does not change their timing.
+  // 0 = No support
+  // 1 = Supported
+
+  // PERIODIC_SWEEP_PASSES
+  // The number of periodic_service() passes between full sweeps when
+  // PERIODIC_WORK_FLAGS is enabled. The periodic timer runs every 20ms.
+
+  // TCP_FAST_REXMIT
+  // Replaces the fixed UIP_RTO (3 seconds) for data segments with a
+  // retransmit timeout computed per connection from the measured round trip
+  // time. The uIP sa / sv fields are used for the Van Jacobson estimator in
+  // 32ms ticks, and the RTO is kept between about 200ms and UIP_RTO. The
+  // RTO doubles for each further retransmit of the same segment. The
+  // seconds based timer stays in place as an upper limit.
+  // A data segment is also retransmitted at once on TCP_DUPACK_THRESHOLD
+  // duplicate ACKs, or on the first duplicate ACK if HTTP_MULTI_SEGMENT has
+  // a second segment in flight (early retransmit, RFC 5827).
+  // This mostly helps the MQTT connection, where one lost PUBLISH otherwise
+  // holds up pin state reporting for 3 seconds or more.
+  // The Link Error Statistics page shows the longest time from sending a
+  // segment to its first retransmit and the number of fast retransmits.
+  // 0 = No support
+  // 1 = Supported
+
+  // TCP_SYN_BACKLOG
+  // Handles bursts of Browser or poller connections when all UIP_CONNS are
+  // in use. A SYN that finds no free connection is kept in a small backlog
+  // (2 entries) instead of being dropped, and the handshake is completed
+  // from the periodic pass as soon as a connection is free. Connections
+  // accepted on a listening port (the HTTP server) also leave TIME_WAIT
+  // after 2 seconds instead of UIP_TIME_WAIT_TIMEOUT, and one in FIN_WAIT_2
+  // (all data delivered, only the Browser's FIN missing) is reused if no
+  // other connection is free.
+  // 0 = No support
+  // 1 = Supported
+
+  // UDP_CONTROL_SUPPORT
+  // Adds UDP input to uIP and a request / response datagram protocol on
+  // UDP_CONTROL_PORT for pollers that would otherwise open a TCP connection
+  // for each command. One datagram can read the pin states, set any number
+  // of outputs, read the sensor values or read the statistics. Outputs are
+  // changed with the same update_ON_OFF() logic used by the /xx commands.
+  // See udp_control_call() in main.c for the datagram format. Not available
+  // in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // UDP_CONTROL_PORT
+  // The local UDP port served when UDP_CONTROL_SUPPORT is enabled.
+
+  // HTTP_LITERAL_RUNS
+  // When CopyHttpData() copies a literal byte from a webpage template in
+  // Flash it copies the rest of the literal run up to the next % marker in
+  // a tight loop, instead of going around the full template loop for
+  // every byte. Templates read from the I2C EEPROM are still copied one
+  // byte at a time through the pre_buf.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_SIZE_CACHE
+  // Keeps the page size computed by adjust_template_size() for the IO
+  // Control and Configuration pages (and their PCF8574 versions), so the
+  // Content-Length is sent without adding up the IO Name lengths again or
+  // re-reading the PCF8574 IO Names from the I2C EEPROM. The cache is
+  // cleared when check_runtime_changes() applies a POST or command, and
+  // when the Features or Options settings change.
+  // 0 = No support
+  // 1 = Supported
+
+  // GZIP_STATIC_SUPPORT
+  // Moves the style sheet that the %y04 %y05 strings insert in every
+  // webpage to a separate resource (URL /b0). The webpages link to it. The
+  // resource is stored in Flash both as text and pre-gzipped, and the
+  // gzip version is sent with "Content-Encoding: gzip" when the GET request
+  // headers show the Browser accepts gzip. The webpage templates keep their
+  // % markers, so the templates stored in the I2C EEPROM are not changed.
+  // Not available in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_KEEPALIVE
+  // Keeps the connection open after a GET response if the Browser sent a
+  // "Connection: keep-alive" header. The response carries the same header
+  // and HttpDCall() goes back to STATE_CONNECTED to wait for the next
+  // request on the same connection. The page, the style sheet and the
+  // command URLs then share one connection instead of paying for a
+  // connection setup and TIME_WAIT each. POST responses and clients that
+  // do not ask for keep-alive still get "Connection:close". A connection
+  // that waits for a request more than HTTP_KEEPALIVE_TIMEOUT seconds is
+  // closed so that idle Browsers do not hold the UIP_CONNS slots. Not
+  // available in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_KEEPALIVE_TIMEOUT
+  // Seconds a connection may wait for a request when HTTP_KEEPALIVE is
+  // enabled.
+
+  // STATE_JSON_SUPPORT
+  // Adds two short JSON responses for monitoring tools so they do not have
+  // to read the IO Control page. They are written directly to the transmit
+  // buffer without a webpage template.
+  // /b1 returns the uptime, ON_OFF_word, the DS18B20, BME280 and INA226
+  //     readings and the uIP TCP counters.
+  // /b2 returns the pin_control bytes and the IO Names of IO 1 to 16.
+  // Numbers are right aligned in fixed width fields (JSON allows the
+  // leading spaces), so the Content-Length does not change as the values
+  // change. See json_build() in httpd.c for the field list. Not available
+  // in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_ETAG_SUPPORT
+  // Sends the Configuration page with an ETag and "Cache-Control: no-cache"
+  // so that the Browser keeps the page and asks again with If-None-Match.
+  // If the tag still matches only a 304 Not Modified header is sent. The
+  // tag is a version counter that check_runtime_changes() bumps when a GUI
+  // or MQTT change is applied, a sum of the EEPROM settings and IO Names
+  // (so the counter restarting after a reboot does not match an old tag),
+  // the pin states and the MQTT status boxes. Not available in the Code
+  // Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_GET_QUEUE
+  // Normally only one GET request is read at a time because the GET cmd is
+  // held in the global parse_GETcmd until the end of the request headers
+  // arrives. A GET request arriving on a second connection in that time
+  // gets a 429 response and the Browser retries 10 seconds later. With
+  // HTTP_GET_QUEUE each connection captures its GET cmd and header search
+  // state in its own tHttpD, and each request is parsed as soon as its
+  // headers are complete. Two dashboards, or a script and a Browser, then
+  // get their responses the first time. Costs 11 bytes of RAM per
+  // connection.
+  // 0 = No support
+  // 1 = Supported
+
+  // POST_STREAM_PARSE
+  // Replaces the POST pre-process in parsepost(). Normally each packet of
+  // a POST is copied into a 300 byte local_buf on the stack and the
+  // partial POST component at the end of the packet is copied again
+  // through parse_tail. With POST_STREAM_PARSE the bytes are read straight
+  // from the uip_buf into parse_tail one POST component at a time, and
+  // each component is parsed as soon as its '&' arrives. This removes the
+  // local_buf from the stack and the second copy of the fragment tail.
+  // Not used in the Code Uploader build, which has its own file parser.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_CACHE_RESOURCES
+  // Moves the style sheet to the /b0 resource the same way
+  // GZIP_STATIC_SUPPORT does (it can be used with or without it), and
+  // sends it with "Cache-Control: max-age=86400" instead of "no-cache,
+  // no-store". After the first visit the Browser loads only the webpage
+  // HTML. The webpage javascript is not moved to a resource: each page
+  // has its own script that is built around the % marker values of that
+  // page, so there is no shared script to cache. Not available in the
+  // Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_LONG_POLL
+  // Adds the /b3 request. Instead of answering at once the response is
+  // held until one of the pins in ON_OFF_word changes, then the Very Short
+  // IO state (the same as /98) is sent. A client that keeps a /b3 request
+  // open sees pin changes without repeated polling. The wait uses the
+  // uip_poll() calls on the connection, so each waiting client holds one
+  // of the UIP_CONNS connections. If nothing changes the response is sent
+  // after HTTP_LONG_POLL_TIMEOUT seconds so that the client can refresh
+  // and idle connections are not held forever. Not available in the Code
+  // Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_PUBLISH_BATCH
+  // Normally publish_outbound() queues one pin state PUBLISH per MQTT timer
+  // tick and mqtt_send() copies one message into the uip_buf per call, so
+  // a burst of 16 pin changes takes 16 ticks and 16 TCP segments. With
+  // MQTT_PUBLISH_BATCH publish_outbound() queues pin changes while the
+  // mqtt_sendbuf has room, and mqtt_pal_sendall() appends each message
+  // behind the previous one in the uip_buf, so mqtt_send() sends the
+  // queued messages in one TCP segment as long as they fit in
+  // UIP_TCP_MSS. The first message of a segment is always sent, so a Home
+  // Assistant Auto Discovery message that fills a segment on its own still
+  // works. Only used in MQTT builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_DISCOVERY_BATCH
+  // Normally the Home Assistant Auto Discovery step of the MQTT startup
+  // queues one Config message every 100 to 200 ms. With
+  // MQTT_DISCOVERY_BATCH the step queues Config placeholder messages as
+  // long as the mqtt_sendbuf has room, and MQTT_PUBLISH_BATCH builds them
+  // back to back in one segment up to UIP_TCP_MSS. A pin delete message
+  // and a pin define message usually share a segment, and the next
+  // messages are queued as soon as the segment is ACKed. The time taken
+  // by the Auto Discovery step is shown as field 56 of the Link Error
+  // Statistics page (LINK_STATISTICS). Requires MQTT_PUBLISH_BATCH. Only
+  // used in Home Assistant builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_DISCOVERY_HASH
+  // Normally every MQTT connect (at boot and after each MQTT restart) sends
+  // the full set of retained Home Assistant Auto Discovery Config messages.
+  // With MQTT_DISCOVERY_HASH a 16 bit hash of the settings used in the
+  // Config messages (device name, MAC, code revision, pin types, sensor and
+  // PCF8574 options, DS18B20 IDs) is stored in EEPROM bytes 79-80 when Auto
+  // Discovery completes. On the next connect Auto Discovery is skipped if
+  // the hash still matches. The device also subscribes to the Home
+  // Assistant birth message (homeassistant/status). When "online" is
+  // received the Auto Discovery steps are run again, which covers a Home
+  // Assistant restart and a broker that lost its retained messages. Only
+  // used in Home Assistant builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_PUBLISH_ROUND_ROBIN
+  // Normally publish_outbound() scans the pins from the highest numbered
+  // pin down on every pass, so a fast toggling high numbered pin can keep
+  // the lower numbered pins waiting. With MQTT_PUBLISH_ROUND_ROBIN every
+  // changed pin is latched until it is published, and each scan starts
+  // at the pin after the last one published. A pin that changes several
+  // times before its turn is published once with its current state. The
+  // longest delay (in ms, 50ms resolution) from a pin change to its
+  // PUBLISH is shown as field 57 of the Link Error Statistics page
+  // (LINK_STATISTICS). Uses about 30 bytes of RAM. Only used in MQTT
+  // builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_STATE_AGGREGATE
+  // Normally each pin change is sent as its own PUBLISH on the pin's
+  // input/xx or output/xx topic. With MQTT_STATE_AGGREGATE the pin changes
+  // found in one publish_outbound() pass are sent as a single PUBLISH on
+  // the state-chg topic (state-chg24 if PCF8574 pins are present). The
+  // payload holds the pin states in the same form as the state-req
+  // response followed by a mask of the pins that changed. The single pin
+  // topics are not sent in this mode, so Home Assistant entities created
+  // by Auto Discovery will not follow the pin states. Only used in Home
+  // Assistant builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_PUBLISH_QOS1
+  // Normally all PUBLISH messages are sent at QOS 0, so a PUBLISH lost on
+  // the way to the broker is only recovered by a later state PUBLISH or
+  // state-req. With MQTT_PUBLISH_QOS1 the pin state and sensor PUBLISH
+  // messages are sent at QOS 1. Each stays in the mqtt_sendbuf until the
+  // broker returns a PUBACK, and is resent (with the DUP flag) if the
+  // PUBACK does not arrive within the response timeout. At most
+  // MQTT_QOS1_WINDOW (see mqtt.h) PUBLISH messages wait for a PUBACK at
+  // once. Availability and Auto Discovery messages stay at QOS 0. Only
+  // used in MQTT builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_FAST_RECONNECT
+  // Normally each MQTT startup step (see mqtt_startup()) waits 200ms
+  // before it runs, the ARP and TCP checks are made every 300ms, and the
+  // three device topics are subscribed one SUBSCRIBE at a time. With
+  // MQTT_FAST_RECONNECT a cached ARP entry for the MQTT Server is used
+  // without waiting, the TCP connection is checked on every pass, each
+  // step runs as soon as the prior step completed, and the device topics
+  // are subscribed with a single SUBSCRIBE packet (if it fits in the
+  // mqtt_sendbuf). The time from the TCP connect to MQTT startup complete
+  // of the last connect is shown in ms as field 58 of the Link Error
+  // Statistics page (LINK_STATISTICS). Only used in MQTT builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_ZERO_COPY
+  // Normally mqtt_publish() packs each PUBLISH into the mqtt_sendbuf and
+  // mqtt_pal_sendall() later copies it to the uip_buf. With MQTT_ZERO_COPY
+  // publish_outbound() is run from the MQTT connection poll, and the QOS 0
+  // pin state and sensor PUBLISH messages are packed directly into the
+  // transmit area of the uip_buf (the MQTT Partial Buffer is left alone as
+  // it holds receive data). Auto Discovery, CONNECT, SUBSCRIBE and QOS 1
+  // messages still use the mqtt_sendbuf. Unless MQTT_PUBLISH_QOS1 is used
+  // the mqtt_sendbuf is reduced from 160 to 136 bytes. Only used in MQTT
+  // builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_TOPIC_PREFIX
+  // Normally each pin state, sensor and availability PUBLISH rebuilds the
+  // "NetworkModule/DeviceName" part of its topic with strcpy() and strcat()
+  // calls. With MQTT_TOPIC_PREFIX the prefix is built once at MQTT start
+  // (a Device Name change causes a restart) and each topic is made by
+  // copying the prefix and a suffix from a const table. Only used in Home
+  // Assistant builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_PUBLISH_DISPATCH
+  // Normally publish_callback() identifies a received PUBLISH by stepping
+  // through the topic at fixed offsets and testing selected characters.
+  // With MQTT_PUBLISH_DISPATCH the topic is compared with the
+  // MQTT_TOPIC_PREFIX device prefix and the rest is looked up in a const
+  // table of the subscribed topics, selecting one pin or command handler.
+  // Every topic character is verified. The longest handling time of a
+  // received PUBLISH is shown in us as field 59 of the Link Error
+  // Statistics page (LINK_STATISTICS). Requires MQTT_TOPIC_PREFIX. Only
+  // used in Home Assistant builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_RECV_STREAM
+  // Normally mqtt_sync() expects a one byte Remaining Length and copies
+  // every received MQTT message into the 60 byte MQTT Partial Buffer even
+  // if it is longer. With MQTT_RECV_STREAM the messages in each TCP packet
+  // are extracted with a resumable parser that reads a Remaining Length of
+  // up to 4 bytes, copies the message body in one block, and continues a
+  // message split across packets with the next packet. Messages too long
+  // for the MQTT Partial Buffer are discarded. Domoticz builds already
+  // filter long messages in mqtt_sync(). Only used in Home Assistant
+  // builds.
+  // 0 = No support
+  // 1 = Supported
+
+  // DS18B20_NONBLOCKING
+  // Normally get_temperature() reads all DS18B20 sensors and starts their
+  // next conversion in one call, holding the main loop for about 3ms per
+  // sensor. With DS18B20_NONBLOCKING the 30 second read is run as a state
+  // machine that performs one reset pulse or one 1-Wire bit slot per main
+  // loop pass, so Ethernet and MQTT processing continue during the read.
+  // The read at boot is still done with get_temperature().
+  // 0 = No support
+  // 1 = Supported
+
+  // DS18B20_SKIP_ROM
+  // Normally a separate match_ROM + convert_temp sequence is sent to each
+  // DS18B20 after its temperature is read. With DS18B20_SKIP_ROM a single
+  // skip_ROM + convert_temp sequence is sent after the last device is read,
+  // starting the conversion in all devices at once. The scratchpads are
+  // still read one device at a time by ROM code.
+  // 0 = No support
+  // 1 = Supported
+
+  // DS18B20_CRC_CHECK
+  // With DS18B20_CRC_CHECK all 9 scratchpad bytes are read and checked
+  // with dallas_crc8(). A read that fails the CRC keeps the last good
+  // temperature. Adds 56 bit slots (about 4ms) per device to each read.
+  // 0 = No support
+  // 1 = Supported
+
+  // DS18B20_RESOLUTION
+  // The DS18B20 conversion resolution in bits (9 to 12). At 12 bits the
+  // devices are left at their power up default. A lower setting is
+  // written to all devices at boot and shortens the conversion time from
+  // 750ms (12 bits) to 375ms, 188ms or 94ms (11, 10, 9 bits).
+
+  // BME280_NORMAL_MODE_SUPPORT
+  // Normally each BME280 reading starts a forced mode measurement and
+  // waits about 30ms for it to complete. With BME280_NORMAL_MODE_SUPPORT
+  // the BME280 is placed in normal mode at boot, measuring once a second
+  // with the IIR filter applied, and the latest values are read from the
+  // data registers with no wait. The displayed values are refreshed every
+  // 30 seconds; the MQTT interval is unchanged.
+  // 0 = No support
+  // 1 = Supported
+
+  // SENSOR_FIXED_POINT
+  // The INA226 calibration and readings are computed in float and shown
+  // with FloatToString(), which pulls the soft-float library into Flash.
+  // With SENSOR_FIXED_POINT the INA226 shunt and current LSB are integers
+  // (milliohms and 100nA units) and the readings are kept in milli-units.
+  // FixedToString() formats any scaled integer and is shared by the INA226
+  // display and the BME280 temperature strings used by the MQTT publishers.
+  // The DS18B20 code is already integer only.
+  // 0 = No support
+  // 1 = Supported
+
+  // INA226_ALERT_SUPPORT
+  // The ALERT outputs of the INA226 devices (open drain, wired together) are
+  // connected to PE6 (pin 24, an unused input with pull-up). Each INA226 is
+  // configured to assert ALERT on Conversion Ready, and the main loop reads
+  // the measurements of all devices into a cache only when the pin is
+  // asserted. The INA226 web page shows the cached values rather than
+  // reading the devices over I2C on every page request. The pin is read
+  // directly rather than via an EXTI interrupt as the firmware does not
+  // otherwise use interrupts, and ALERT stays asserted until the readings
+  // are collected so a level check can't miss a conversion.
+  // 0 = No support
+  // 1 = Supported
+
+  // INA226_AVERAGE
+  // Sets the INA226 on-chip averaging (AVG bits of the Configuration
+  // register) passed to ina226_configure(). With the 1.1ms conversion times
+  // used here a value of 4 (128 samples) gives a new reading about every
+  // 280ms.
+  // 0 = 1 sample (no averaging)
+  // 1 = 4, 2 = 16, 3 = 64, 4 = 128, 5 = 256, 6 = 512, 7 = 1024 samples
+
+  // I2C_HW_SUPPORT
+  // Drives the I2C bus with the STM8 I2C peripheral at about 400kHz instead
+  // of the bit bang I2C on IO 14 and IO 15 (roughly 15us per bit). The
+  // I2C_control / I2C_byte_address / I2C_read_byte / I2C_write_byte /
+  // I2C_stop interface is unchanged, so the I2C EEPROM copies, the EEPROM
+  // string reads and the BME280, INA226 and PCF8574 accesses all speed up.
+  // The STM8S005 I2C peripheral is fixed to these pins, so the board must
+  // be re-wired to use this option:
+  //   PB4 (Pin 18) - I2C SCL (instead of IO 14)
+  //   PB5 (Pin 17) - I2C SDA (instead of IO 15)
+  // IO 14 and IO 15 are still reserved when I2C is enabled.
+  // 0 = Bit bang I2C
+  // 1 = Hardware I2C
+
+  // I2C_EEPROM_FAST_COPY
+  // Shortens the I2C EEPROM image copies. The copies already write full 128
+  // byte EEPROM pages. copy_flash_to_EEPROM0(),
+  // copy_code_uploader_to_EEPROM1() and the EEPROM detection write use ACK
+  // polling (eeprom_write_wait()) to detect the end of each page write
+  // instead of a fixed 5ms wait. eeprom_copy_to_flash() reads the whole
+  // image as one sequential read instead of re-addressing the EEPROM for
+  // every 128 byte block.
+  // 0 = No support
+  // 1 = Supported
+
+  // PCF8574_EVENT_IO
+  // PCF8574_write() keeps a shadow of the last byte written and only writes
+  // the expander when the output byte changes. The PCF8574 -INT output (open
+  // drain) is connected to PE7 (pin 23, an unused input with pull-up) and
+  // PCF8574_read() only reads the expander when -INT is asserted; otherwise
+  // it returns the last byte read. This removes the two I2C transactions
+  // from every read_input_pins() / write_output_pins() pass when nothing
+  // changes.
+  // 0 = No support
+  // 1 = Supported
+
+  // INPUT_EDGE_CAPTURE
+  // Input pins on Ports A, C, D and E generate an external interrupt on both
+  // edges. The interrupt stores the port state and a millisecond timestamp in
+  // a small ring, and the main loop debounces each port by time: the port is
+  // accepted once it has had no edge for INPUT_DEBOUNCE_MS. Input latency is
+  // then INPUT_DEBOUNCE_MS after the last edge regardless of main loop
+  // jitter. This is the only feature that enables interrupts. The Port G
+  // Inputs (IO 7 and IO 15) have no external interrupt and remain polled.
+  // 0 = No support
+  // 1 = Supported
+  //
+  // INPUT_DEBOUNCE_MS
+  // Quiet time in milliseconds required before an edge captured with
+  // INPUT_EDGE_CAPTURE is accepted.
+
+  // INPUT_PORT_SAMPLING
+  // read_input_pins() reads each GPIO port once and debounces the 16 STM8
+  // IO pins together with a vertical counter (debounce_io_pins()) instead of
+  // looking up and comparing each pin separately. The pinout option mapping
+  // and the Input / Linked pin masks are resolved once in gpio_init().
+  // 0 = No support
+  // 1 = Supported
+  //
+  // INPUT_DEBOUNCE_DEPTH
+  // Number of consecutive samples (1 to 4) a pin must hold a new state
+  // before INPUT_PORT_SAMPLING accepts it. 2 matches the per pin debounce.
+
+  // OUTPUT_PORT_BATCH
+  // write_output_pins() writes the STM8 IO pins with one ODR write per port
+  // (write_io_pins()) instead of a read-modify-write per pin. The pinout
+  // option mapping and the pins reserved for the UART, I2C and DS18B20 are
+  // resolved into tables that are only rebuilt when the config settings
+  // change. Outputs that share a port switch simultaneously.
+  // 0 = No support
+  // 1 = Supported
+
+  // MAIN_LOOP_SCHEDULER
+  // The main loop runs the housekeeping tasks that do not need to run on
+  // every pass from a deadline scheduler (sched_due() in timer.c) instead
+  // of calling them on every pass. check_runtime_changes() runs once per
+  // millisecond, or on the pass after a packet is received (SCHED_EVENT()),
+  // and the DS18B20 and BME280 read checks run once per second. The worst
+  // lateness and the number of missed periods are recorded per task in
+  // sched_table[]. Packet receive, MQTT and the periodic_service() timers
+  // are unchanged.
+  // 0 = No support
+  // 1 = Supported
+
+  // IDLE_WAIT_SUPPORT
+  // When a main loop pass receives no packet the processor is put in WAIT
+  // mode (WFI) until the next interrupt instead of spinning. A 1ms TIM4
+  // interrupt bounds the WAIT so all ms timers and scheduler deadlines are
+  // met. With ENC28J60_INT_SUPPORT the ENC28J60 -INT pin (PC5) interrupt
+  // ends the WAIT as soon as a packet arrives, and with INPUT_EDGE_CAPTURE
+  // so do Input pin edges. The time spent in WAIT and the worst wake latency
+  // are recorded in idle_ticks, idle_max and idle_latency_max (timer.c).
+  // 0 = No support
+  // 1 = Supported
+
+  // PIN_TIMER_LIST
+  // The running pin_timers are kept in a list sorted by expiry time
+  // (start_pin_timer() in main.c), so the 100ms decrement_pin_timers() tick
+  // only checks the timers that are due instead of walking every pin. Each
+  // timer expires exactly its count times its resolution after it was
+  // started. Only used in the Browser Only build, which is the only build
+  // with pin timers.
+  // 0 = No support
+  // 1 = Supported
+
+  // FREE_RUNNING_TIMEBASE
+  // TIM1 free runs and is never stopped or reloaded by timer_update(). The
+  // TIM1 update interrupt extends the count to a 32 bit timebase with a 10us
+  // resolution, read with now_us() and now_ms() (timer.c). timer_update(),
+  // the loop profiler and the ENC28J60 and MQTT handling times are all based
+  // on it, so no ticks are lost in a reload and long main loop delays no
+  // longer have a 640ms limit. wait_timer() and the 1-Wire timing stay on
+  // TIM3, which gives them 1us resolution.
+  // 0 = No support
+  // 1 = Supported
+
+  // LINKED_PIN_MASKS
+  // The pin types in the pin_control bytes are compiled into an Input pin
+  // mask and a Linked Input pin mask (build_linked_masks() in main.c) at
+  // boot and when the pin_control bytes change. read_input_pins() then
+  // updates the ON_OFF_word and finds the Linked pin edges with a few word
+  // operations instead of calling chk_iotype() for every pin on every pass.
+  // Only used in builds with LINKED_SUPPORT.
+  // 0 = No support
+  // 1 = Supported
+
+  // RUNTIME_DIRTY_FLAGS
+  // check_runtime_changes() only runs the Pending settings validation steps
+  // (pinout, DS18B20, I2C, UART and Linked pin checks) on a pass where
+  // parse_complete or mqtt_parse_complete is set, and only checks the
+  // Browser Only build pin_timers for expiry after decrement_pin_timers()
+  // has run. The input pins are still read on every pass.
+  // 0 = No support
+  // 1 = Supported
+
+  // EEPROM_WRITE_CACHE
+  // The Retained pin state writes to stored_pin_control and the debug byte
+  // writes in update_debug_storage1() go through a small write-back cache
+  // (eeprom_cache_write() in main.c) instead of being written a byte at a
+  // time. Changed bytes in the same 4 byte EEPROM word are merged and written
+  // with one word programming cycle once no writes have arrived for
+  // EEPROM_CACHE_QUIET_MS. The cache is also written before a restart or
+  // reboot. eeprom_word_writes counts the programming cycles (wear) and
+  // eeprom_coalesced counts the byte writes merged into a pending word.
+  // With LINK_STATISTICS both are shown as field 77 of the Link Error
+  // Statistics page. The other writes to stored_pin_control also go
+  // through the cache so that they are not overwritten by a pending write.
+  // Pending writes are lost if power fails during the quiet period.
+  // 0 = No support
+  // 1 = Supported
+
+  // EEPROM_CACHE_QUIET_MS
+  // Time in ms without a new cached write before the EEPROM_WRITE_CACHE is
+  // written to the EEPROM. Must be 1 to 30000.
+
+  // DEFERRED_SENSOR_INIT
+  // The DS18B20, BME280 and INA226 discovery and init (sensor_init() in
+  // main.c) is moved out of the boot sequence and run by the main loop one
+  // stage every 50ms, so the module answers ARP and HTTP as soon as the
+  // ENC28J60 is up. The MQTT startup waits for the last stage so that Auto
+  // Discovery sees the sensors that were found. The boot to first ARP reply
+  // and boot to MQTT connected times are shown on the Link Error Statistics
+  // page as fields 60 and 61 (ms, 65535 if over 60 seconds).
+  // 0 = No support
+  // 1 = Supported
+
+  // HOT_APPLY_CONFIG
+  // IP Address, Gateway Address, Netmask, HTTP Port, MQTT Server, MQTT Port,
+  // MQTT Username, MQTT Password and Device Name changes are applied by
+  // hot_apply_config() in main.c instead of a firmware restart. The ENC28J60
+  // and uIP are not re-initialized. An IP Address change closes all
+  // connections, an HTTP Port change closes only the HTTP connections, and
+  // the MQTT session is disconnected and reconnected only if a setting it
+  // uses changed. MAC and Feature changes still restart or reboot.
+  // 0 = No support
+  // 1 = Supported
+
+  // SREC_UPLOAD_PIPELINE
+  // Code Uploader build only. Each 64 byte page of an uploaded SREC file is
+  // written to the I2C EEPROM by upload_page_write() in httpd.c without
+  // waiting for the EEPROM write cycle. The page is verified (after ACK
+  // polling) just before the next page is started, so programming overlaps
+  // the parsing of the following SREC records and the receipt of the next
+  // TCP segment. The S0 erase also uses ACK polling instead of a 5ms wait
+  // per block. A miscompare is reported with the usual UPGRADE_FAIL codes
+  // when the S7 record is reached.
+  // 0 = No support
+  // 1 = Supported
+
+  // BINARY_UPLOAD_SUPPORT
+  // Code Uploader build only. In addition to .sx files the uploader accepts
+  // a binary .nmb image made from the .sx file by tools/sx2nmb.py. The image
+  // is a 16 byte header ("NMBI", file type, version, length, CRC32) followed
+  // by the raw memory image starting at 0x8000. The bytes are copied
+  // straight into the I2C EEPROM pages with no hex conversion, so the upload
+  // is less than half the size of the SREC file and needs far less parsing.
+  // The CRC32 is checked at the end of the image before the Flash copy is
+  // requested.
+  // 0 = No support
+  // 1 = Supported
+
+  // BLOCK_DELTA_UPLOAD
+  // Requires BINARY_UPLOAD_SUPPORT. Adds the version 2 .nmb image made by
+  // "tools/sx2nmb.py --delta", which puts a CRC32 ahead of each 128 byte
+  // block. Before a block is written the CRC32 of the block already in the
+  // I2C EEPROM is calculated, and if it matches the block is not written.
+  // Written blocks are verified by CRC32 instead of a byte compare. A
+  // routine upgrade that changes only part of the code or strings writes
+  // only the changed blocks, which is faster and saves EEPROM wear.
+  // 0 = No support
+  // 1 = Supported
+
+  // OB_TEMPLATE_CACHE
+  // Upgradeable builds only (OB_EEPROM_SUPPORT). The 230 byte pre_buf that
+  // CopyHttpData() fills from the I2C EEPROM is made a global tagged with
+  // the EEPROM address of its first byte, instead of a local that is
+  // re-read for every packet. A packet that starts inside the data already
+  // in the pre_buf (most packets of a page, and all retransmissions) needs
+  // no I2C EEPROM read. Costs 232 bytes of RAM, but the stack used by
+  // CopyHttpData() is 230 bytes smaller.
+  // 0 = No support
+  // 1 = Supported
+
+  // RAW_UPLOAD_SUPPORT
+  // Code Uploader build only. Adds a plain TCP upload on port 8089
+  // (RAW_UPLOAD_PORT in httpd.h) for scripted upgrades. The client sends
+  // the file length as 4 bytes, big endian, then the .sx file (or .nmb
+  // image with BINARY_UPLOAD_SUPPORT). The file is parsed and written to
+  // the I2C EEPROM as for a browser upload, without the HTTP header and
+  // multi-part boundary parsing. The module replies "OK" or "FAIL nn"
+  // (nn = upgrade fail code) on one line and closes the connection; a
+  // Program file is then copied to Flash. Example:
+  //   python3 -c "import socket,struct,sys; d=open(sys.argv[1],'rb').read();
+  //   s=socket.create_connection((sys.argv[2],8089));
+  //   s.sendall(struct.pack('>I',len(d))+d); print(s.recv(64))" f.nmb ip
+  // 0 = No support
+  // 1 = Supported
+
+  // FLASH_COPY_STAGING
+  // Upgradeable builds only (OB_EEPROM_SUPPORT). Shortens the time the
+  // module is off the network while Flash is reprogrammed from the I2C
+  // EEPROM (after a Code Uploader upgrade, a /73 restore or a /72 command).
+  // Flash programming replaces the running code, so it can't run alongside
+  // the network stack. Instead, while the copy request waits, the main loop
+  // compares one 128 byte block of the image with Flash per pass and
+  // records the blocks that differ (33 bytes of RAM). eeprom_copy_to_flash()
+  // then only programs those blocks; unchanged blocks are still read from
+  // the I2C EEPROM, so use with I2C_HW_SUPPORT and I2C_EEPROM_FAST_COPY for
+  // the shortest window. The duration of eeprom_copy_to_flash() in ms is
+  // saved in the first two debug bytes, shown as the first four hex digits
+  // of the debug bytes in the Statistics page. The flash_update segment
+  // grows, and must still fit in its 512 bytes (check the .map file).
+  // 0 = No support
+  // 1 = Supported
+
+  // CONFIG_SNAPSHOT_SUPPORT
+  // Not available in the Code Uploader. Lets a whole device configuration
+  // be copied between modules for provisioning. GET /b4 returns a 437 byte
+  // binary snapshot (application/octet-stream) of the network, MQTT, pin
+  // and options settings, the IO Timers and IO Names (Browser builds) and
+  // the Domoticz IDX values, followed by a CRC32 (the same CRC as the .nmb
+  // upload images). POSTing the file back to /b4 gets a 200 reply if it was
+  // accepted or 400 if it was not. The network, MQTT, pin and options
+  // settings are held until the CRC32 is checked and then applied like a
+  // Configuration page Save, with at most one reboot. The MAC address and
+  // the IP address are exported but not imported, so each module keeps its
+  // own. The IO Names and IDX values are too large to hold in RAM, so they
+  // are staged in the I2C EEPROM (0x7d80 to 0x7ebf of region 2) and only
+  // written to Flash once the CRC32 matches. Browser and Domoticz builds
+  // therefore need OB_EEPROM_SUPPORT (the upgradeable builds); the option
+  // is turned off in those builds without it. Values this build does not
+  // use are exported but not imported.
+  // PCF8574 pins (IO 17 to 24) are not included. Example:
+  //   curl -o cfg.bin http://192.168.1.4/b4
+  //   curl --data-binary @cfg.bin -H "Content-Type: application/octet-stream" http://192.168.1.5/b4
+  // 0 = No support
+  // 1 = Supported
+
+  // RAM_HEADROOM_STATISTICS
+  // Requires LINK_STATISTICS. Shows how much of the RAM buffers is really
+  // used so that they can be sized from data. At boot the unused stack
+  // (0x600 to 0x7ff, above the stack_limit guardband) is filled with a
+  // pattern, and the Link Error Statistics page shows:
+  //   62 The most stack used in bytes (of 512)
+  //   63 The largest frame received into or sent from the uip_buf
+  //   64 The most of the mqtt_sendbuf used (MQTT builds)
+  //   65 The largest message held in the MQTT Partial Buffer (MQTT builds)
+  // Clear Link Error Statistics repaints the stack and clears the peaks.
+  // The stack figure includes interrupt frames, so check it after a session
+  // that exercised every page and MQTT feature in use.
+  // 0 = No support
+  // 1 = Supported
+
+  // PUBLISH_LATENCY_STATS
+  // MQTT builds with LINK_STATISTICS only. Times how long an Input pin
+  // change takes to reach the network, in ms. One change is timed at a
+  // time; changes on other pins while it is in flight are not timed. The
+  // Link Error Statistics page shows:
+  //   66, 69 Debounced change to PUBLISH queued
+  //   67, 70 PUBLISH queued to copied to the uip_buf
+  //   68, 71 Debounced change to copied to the uip_buf
+  // as min avg max (66-68) and an 8 bucket histogram (69-71) with buckets
+  // <4ms, <16ms, <64ms, <256ms, <1s, <4s, <16s and longer. The debounce
+  // delay before a change is seen is fixed by the pin settings and is not
+  // included.
+  // 0 = No support
+  // 1 = Supported
+
+  // TRACE_RING_SUPPORT
+  // Upgradeable builds only. Keeps a trace of timestamped events in the
+  // unused I2C EEPROM3 region so that intermittent stalls can be followed
+  // after the fact, including across a watchdog reset. Events are:
+  // frames received and sent (protocol, TCP flags and length), TCP state
+  // changes, TCP retransmits, RXERIF overflows, MQTT startup and restart
+  // steps, and each boot with the reset cause. Events are collected in
+  // RAM 9 at a time and written as 64 byte chunks to a 512 chunk ring.
+  // A chunk is also written when its events are 10 seconds old, so a
+  // watchdog reset loses at most the last 10 seconds. GET /b5 writes out
+  // the events collected so far and returns the 32KB ring, which
+  // tools/nmtrace.py decodes:
+  //   curl -o trace.bin http://192.168.1.4/b5
+  //   python3 tools/nmtrace.py trace.bin
+  // Every frame is traced, so on a busy network the EEPROM is written
+  // often. Enable it while chasing a problem rather than permanently.
+  // 0 = No support
+  // 1 = Supported
+
+  // UDP_TELEMETRY_SUPPORT
+  // Requires UDP_CONTROL_SUPPORT. Sends a 77 byte datagram with the
+  // runtime statistics (uptime, transmit and error counters, and the uIP,
+  // loop profile and RAM headroom statistics that are enabled in the
+  // build) to a collector at a fixed interval, so the module can be
+  // watched over time without polling web pages. The collector sends UDP
+  // control cmd 0x05 with the interval in seconds and receives the
+  // datagrams on the port it sent from. The setting is kept in EEPROM so
+  // the stream continues after a reboot. See telemetry_send() in main.c
+  // for the layout.
+  // 0 = No support
+  // 1 = Supported
+
+  // MULTICAST_GROUP_SUPPORT
+  // Requires UDP_CONTROL_SUPPORT. Lets the module join up to 2 IPv4
+  // multicast groups, set with UDP control cmd 0x06 and kept in EEPROM.
+  // The groups are added to the ENC28J60 hash table filter, and IGMPv2
+  // Membership Reports are sent every minute for switches that use IGMP
+  // snooping. UDP control requests sent to a group are processed without
+  // a reply, so one cmd 0x02 datagram switches the outputs of every module
+  // in the group within a few milliseconds of each other, instead of one
+  // HTTP or MQTT command per module. See udp_control_call() in main.c.
+  // 0 = No support
+  // 1 = Supported
+
+  // MODBUS_TCP_SUPPORT
+  // Adds a Modbus TCP server on MODBUS_TCP_PORT so that PLCs can poll the
+  // pins and sensors directly (functions 1, 2, 3, 4, 5, 6, 15 and 16).
+  // Coils are the Output pins, Discrete Inputs the Input pins, the two
+  // Holding Registers all pins as bits, and the Input Registers the
+  // DS18B20, BME280 and INA226 values. Each request is answered from the
+  // same segment it arrives in. One connection is served at a time. See
+  // modbus_reply() in main.c for the register map. Not available in the
+  // Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_WEBSOCKET
+  // Adds a WebSocket (RFC 6455) upgrade at /b6. The connection stays open
+  // after the handshake. Text frames carry the two digit /xx pin commands
+  // (for example "0103" turns IO 1 and IO 2 ON) and binary frames the
+  // mask and values of UDP control cmd 0x02. The module pushes a text
+  // frame with the pin states in the /98 format when ON_OFF_word changes,
+  // and at least every WS_HEARTBEAT seconds. One WebSocket is served at a
+  // time, a new upgrade closes the previous one. The IO Control pages load
+  // a script (/b7) that uses the WebSocket: an ON / OFF click switches the
+  // Output at once, without a Save and a page reload, and the pin states
+  // shown follow the frames. The script is sent from Flash, also in the
+  // upgradeable builds, and the page templates do not change. Not
+  // available in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // DHCP_SUPPORT
+  // Requires UDP_CONTROL_SUPPORT. Adds a DHCP client, enabled with URL
+  // command /871 (/870 returns to the static addresses on the
+  // Configuration page). A new module has DHCP enabled. The last lease is
+  // kept in Flash and is used from the first moment after a reboot, while
+  // the lease is confirmed with the server in the background, so the
+  // module is reachable as quickly as with a static address. Only a NAK
+  // from the server (or an expired lease) starts a full DISCOVER, and the
+  // static addresses are used until a new lease is granted. The device
+  // name is sent as the host name. See dhcp_service() in main.c. Not
+  // available in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // RULE_ENGINE_SUPPORT
+  // Adds a table of 8 local rules evaluated on every pass of
+  // check_runtime_changes(), after the Input pins are read. Each rule has
+  // a condition on a pin or a DS18B20 temperature and an action on an
+  // Output pin: follow, interlock (force OFF), force ON, toggle, or ON
+  // with a delayed OFF. The rules react within milliseconds and keep
+  // working without the broker. They are set with URL commands /88 to /8f
+  // and kept in Flash. See rule_service() in main.c for the rule format.
+  // Not available in the Code Uploader build.
+  // 0 = No support
+  // 1 = Supported
+
+  // SENSOR_HISTORY_SUPPORT
+  // MQTT Home Assistant builds only. Every SENSOR_HISTORY_INTERVAL seconds
+  // the DS18B20, BME280 and INA226 readings are added to a RAM ring of
+  // timestamped samples. The ring is published in batches of several
+  // samples per PUBLISH on the .../history topic, so no samples are lost
+  // while the broker connection is down: the ring is published after the
+  // reconnect. The per sensor state topics are still published for Home
+  // Assistant. See publish_history() in main.c for the payload format.
+  // 0 = No support
+  // 1 = Supported
+
+  // SENSOR_DEADBAND_SUPPORT
+  // MQTT builds only. A DS18B20 or BME280 reading is only published if it
+  // differs from the last published value by at least its deadband, or if
+  // SENSOR_PUBLISH_MAX_INTERVAL seconds have passed since that publish (the
+  // heartbeat). A changed reading is held back until
+  // SENSOR_PUBLISH_MIN_INTERVAL seconds have passed. The deadbands are:
+  //   DEADBAND_TEMPERATURE  0.1 degree C
+  //   DEADBAND_PRESSURE     hPa
+  //   DEADBAND_HUMIDITY     %
+  // Pressure and humidity are published in whole units, so a deadband of 1
+  // publishes every change in the published value. See
+  // sensor_publish_due() in main.c.
+  // 0 = No support
+  // 1 = Supported
+
+  // MQTT_HA_STATUS_RESYNC
+  // MQTT Home Assistant builds only. Requires MQTT_DISCOVERY_HASH. Normally
+  // every MQTT connect republishes the state of all pins, and the Home
+  // Assistant birth message (homeassistant/status "online") restarts the
+  // full Auto Discovery. With MQTT_HA_STATUS_RESYNC the full pin republish
+  // is only done after boot and after Auto Discovery; other reconnects
+  // only publish the pins that changed, because the broker still holds the
+  // retained states. When "online" is received the module waits 2 to 9
+  // seconds (set by the low bits of the MAC so a number of modules do not
+  // all answer at once), then runs Auto Discovery only if the discovery
+  // hash changed, otherwise republishes the pin states (one message with
+  // MQTT_STATE_AGGREGATE) and the sensor values. See ha_resync() in
+  // main.c. This relies on a broker that keeps retained messages.
+  // 0 = No support
+  // 1 = Supported
+
+  // ENC28J60_BUFFER_SPLIT
+  // Normally the 8kb ENC28J60 memory is split into a 6kb RX ring and a 2kb
+  // TX area. Frames are never larger than ENC28J60_MAXFRAME, so with
+  // ENC28J60_BUFFER_SPLIT the TX area only holds the slots that are used:
+  // one 576 byte slot, or two with TX_DOUBLE_BUFFER. The hold slot of
+  // ARP_PENDING_SLOT is the same size. The rest goes to the RX ring, which
+  // grows from 6kb to 7.4kb (6.9kb with TX_DOUBLE_BUFFER, 6.3kb with both
+  // TX_DOUBLE_BUFFER and ARP_PENDING_SLOT). See Enc28j60.h.
+  // 0 = No support
+  // 1 = Supported
+
+  // ENC28J60_FLOW_CONTROL
+  // EXPERIMENTAL: the PAUSE frame and backpressure behaviour has not been
+  // tested against a switch, and the host simulation (host/) does not model
+  // them.
+  // Normally a full ENC28J60 RX ring drops the frames that arrive (counted
+  // as RXERIF). With ENC28J60_FLOW_CONTROL the ring occupancy is checked
+  // each time a frame is received. When it passes 3/4 of the ring the link
+  // partner is slowed down with PAUSE frames (full duplex) or backpressure
+  // (half duplex) through the EFLOCON register. It is released again when
+  // the ring is below 1/4 full. The switch must honour PAUSE frames (802.3x
+  // flow control) for this to work in full duplex; MACON1.TXPAUS and
+  // MACON1.RXPAUS are set in full duplex so the module also honours PAUSE
+  // frames from the switch. The number of pauses is shown as field 72 of
+  // the Link Error Statistics page (LINK_STATISTICS).
+  // 0 = No support
+  // 1 = Supported
+
+  // FAST_FORMAT
+  // emb_itoa() is used for every number on the web pages and in the MQTT
+  // messages. The STM8 has no 32 bit divide, so the generic version calls
+  // the long divide library routine twice for each digit. With FAST_FORMAT
+  // decimal digits are found by subtracting powers of ten (16 bit arithmetic
+  // for values up to 65535), hex, octal and binary digits by shift and mask,
+  // and int2hex() and int16to4hex() look up a nibble table. The sensor
+  // strings (FixedToString() and FloatToString()) are made from one
+  // emb_itoa() conversion instead of dividing the value. The output is the
+  // same as without FAST_FORMAT. The tables take 49 bytes of flash.
+  // 0 = No support
+  // 1 = Supported
+
+  // PAGE_BUILD_STATISTICS
+  // Measures the time CopyHttpData() spends building the Link Error
+  // Statistics page, summed over all of the segments of the page, and shows
+  // it in microseconds as field 73 of the next Link Error Statistics page.
+  // Nearly all of the page is numbers, so this shows the cost of the number
+  // formatting, for example with and without FAST_FORMAT. Needs
+  // LINK_STATISTICS and FREE_RUNNING_TIMEBASE.
+  // 0 = No support
+  // 1 = Supported
+
+  // IMAGE_BACKUP_TASK
+  // Upgradeable Browser Only and MQTT builds (OB_EEPROM_SUPPORT) copy the
+  // running image from Flash to I2C EEPROM0 at every boot, so that the Code
+  // Uploader can reinstall it. That takes more than a second, and the
+  // module is off the network until it is done. With IMAGE_BACKUP_TASK the
+  // main loop first computes the CRC32 of the image, 128 bytes per pass, and
+  // compares it with the CRC stored in EEPROM0 with the last complete copy
+  // (I2C_EEPROM0_IMAGE_CRC). The copy is skipped if they match. Otherwise
+  // one 128 byte page is copied per pass. The module answers on the network
+  // from the start, and the copy is completed before the Code Uploader is
+  // started with the /72 command. The LED no longer flickers after the
+  // copy.
+  // 0 = No support
+  // 1 = Supported
+
+  // PINOUT_CONST_MASKS
+  // The input pass that runs every millisecond tests each of the 16 IO pins
+  // through the io_map[] / io_reg[] tables, and with PINOUT_OPTION_SUPPORT
+  // it first looks up the pin for the Pinout Option. With
+  // PINOUT_CONST_MASKS the pins of each Pinout Option are listed at build
+  // time (PINOUT_OPTION1 to 4 in Gpio.c) and gather_io_pins() reads each
+  // port once and tests the pins with constant masks. The Pinout Option is
+  // selected once at boot. With OUTPUT_PORT_BATCH the output writes use the
+  // same lists. The pin tests take about 150 bytes of flash per Pinout
+  // Option. Compare the time of the input pass with INPUT_PASS_STATISTICS.
+  // 0 = No support
+  // 1 = Supported
+
+  // INPUT_PASS_STATISTICS
+  // Times the read_input_pins() pass of check_runtime_changes() with TIM3
+  // (1us, 16 CPU cycles) and shows the shortest and longest pass in us as
+  // field 74 of the Link Error Statistics page. The longest pass includes
+  // the interrupts taken during it. Needs LINK_STATISTICS.
+  // 0 = No support
+  // 1 = Supported
+
+  // SENSOR_STRING_CACHE
+  // The DS18B20 and BME280 readings are converted to strings each time a
+  // web page or an MQTT publish shows them, including for every TCP
+  // retransmission of a page. With SENSOR_STRING_CACHE a new reading moves
+  // a generation number on, and the strings are formatted once, the first
+  // time they are needed after that. The web pages and the MQTT publishes
+  // then copy the cached strings. The cache uses 80 bytes of RAM for the
+  // DS18B20 (degrees C and F for 5 devices) and 26 bytes for the BME280
+  // (temperature C, pressure, humidity). The BME280 degrees F shown on the
+  // IO Control page and the INA226 values are still formatted on each use.
+  // Without INA226_ALERT_SUPPORT each page reads a new INA226 measurement
+  // so there is no reading to share.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_PACING
+  // While a Browser loads a page every acknowledge builds and sends the
+  // next page segment, and an MQTT PUBLISH queued for a pin change waits
+  // behind them. With HTTP_PACING (MQTT builds) the next page segment is
+  // held while the mqtt_sendbuf holds unsent messages, and
+  // periodic_service() polls the MQTT connection first so that they go out
+  // first. HTTP may also spend at most HTTP_PACING_SHARE percent of each
+  // 20ms window building page segments. A segment is never held longer
+  // than 100ms. Field 75 of the Link Error Statistics page shows the held
+  // HTTP segments and field 76 the messages sent from the mqtt_sendbuf,
+  // each as count, average and longest queueing delay in ms. Needs
+  // FREE_RUNNING_TIMEBASE.
+  // 0 = No support
+  // 1 = Supported
+
+  // HTTP_PACING_SHARE
+  // With HTTP_PACING the percentage (10 to 100) of each 20ms window that
+  // HTTP may spend building page segments. 100 only holds the segments
+  // for MQTT sends.
+
+  // DOMOTICZ_PUBLISH_BATCH
+  // MQTT Domoticz builds only. Requires MQTT_PUBLISH_BATCH. Domoticz takes
+  // one switchlight command per domoticz/in message, so a burst of pin
+  // changes is one message per device. With DOMOTICZ_PUBLISH_BATCH
+  // publish_outbound() checks the mqtt_sendbuf for room for the longer
+  // Domoticz message, and MQTT_PUBLISH_BATCH sends the queued commands
+  // back to back in one TCP segment. The full republish of all devices is
+  // only done after boot, after the idx of IO 1 to 16 is changed on the
+  // Configuration page, and after an MQTT restart that dropped queued
+  // messages. Other reconnects only publish the devices that changed,
+  // because Domoticz keeps the device states.
+  // 0 = No support
+  // 1 = Supported
+
 
 
 //---------------------------------------------------------------------------//
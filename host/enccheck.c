@@ -0,0 +1,172 @@
+// enccheck.c
+//
+// ENC28J60 driver check for the host simulation build. nmsim and pagecheck
+// replace Enc28j60.c by sim_enc28j60.c, so the driver itself is not run
+// there. This program links the driver with a register model of the
+// ENC28J60 behind the Spi.h interface and checks the receive filter set up
+// against the ENC28J60 datasheet:
+//
+//   hash     Enc28j60HashPointer() of the datasheet example address
+//            01-00-00-00-01-2C must be 0x34 (EHT6 bit 4).
+//   profile  Receive filter profile 2 (All Hosts and mDNS) must set EHT7
+//            to 0xc0 and ERXFCON to 0xb4.
+//   groups   Enc28j60JoinGroups() with 224.0.0.1 joined (and profile 0)
+//            must set EHT7 to 0x80 and the HTEN bit of ERXFCON.
+//
+// The first two need RX_FILTER_PROFILES and the last MULTICAST_GROUP_SUPPORT
+// (make enccheck sets both).
+//
+// The register model only handles the control register commands (RCR,
+// WCR, BFS, BFC) with the bank selected by ECON1. That is all the filter
+// set up uses.
+//
+// Usage: enccheck
+// The exit status is 1 if a check fails.
+
+#include "main.h"
+#include "sim.h"
+
+#define ENC_ECON1	0x1f	// ECON1 (all banks)
+#define ENC_EHT0	0x00	// EHT0 to EHT7 (bank 1)
+#define ENC_ERXFCON	0x18	// ERXFCON (bank 1)
+
+void Enc28j60SwitchBank(uint8_t nBank);
+
+static uint8_t enc_reg[4][32];          // Registers 0x00 to 0x1a per bank,
+                                        // 0x1b to 0x1f are in enc_reg[0]
+static uint8_t spi_opcode;              // Command byte of the transfer
+static uint8_t spi_state;               // 0 = command byte next, 1 = data
+                                        // byte next, 2 = read next
+static int failed;
+
+
+static uint8_t *enc_register(uint8_t addr)
+{
+  if (addr >= 0x1b) return &enc_reg[0][addr];
+  return &enc_reg[enc_reg[0][ENC_ECON1] & 0x03][addr];
+}
+
+
+void spi_init(void)
+{
+  spi_state = 0;
+}
+
+
+void SpiWriteByte(uint8_t nByte)
+{
+  uint8_t *reg;
+
+  if (spi_state == 1) {
+    reg = enc_register((uint8_t)(spi_opcode & 0x1f));
+    switch (spi_opcode & 0xe0) {
+      case 0x40: *reg = nByte; break;                  // WCR
+      case 0x80: *reg |= nByte; break;                 // BFS
+      case 0xa0: *reg &= (uint8_t)~nByte; break;       // BFC
+    }
+    spi_state = 0;
+    return;
+  }
+  if (spi_state == 2) return;  // Dummy byte of a MAC / MII register read
+  spi_opcode = nByte;
+  switch (nByte & 0xe0) {
+    case 0x00: spi_state = 2; break;
+    case 0x40: case 0x80: case 0xa0: spi_state = 1; break;
+    default:
+      fprintf(stderr, "enccheck: SPI command 0x%02x is not modelled\n", nByte);
+      exit(2);
+  }
+}
+
+
+uint8_t SpiReadByte(void)
+{
+  spi_state = 0;
+  return *enc_register((uint8_t)(spi_opcode & 0x1f));
+}
+
+
+void SpiWriteChunk(const uint8_t* pChunk, uint16_t nBytes)
+{
+  fprintf(stderr, "enccheck: buffer memory is not modelled\n");
+  exit(2);
+}
+
+
+void SpiReadChunk(uint8_t* pChunk, uint16_t nBytes)
+{
+  fprintf(stderr, "enccheck: buffer memory is not modelled\n");
+  exit(2);
+}
+
+
+#if ENC28J60_HW_SPI == 0
+void SPI_clock_pulse(void)
+{
+}
+#endif // ENC28J60_HW_SPI == 0
+
+
+void sim_reset(unsigned char rst_sr)
+{
+  fprintf(stderr, "enccheck: module reset (RST_SR 0x%02x)\n", rst_sr);
+  exit(2);
+}
+
+
+static void check(const char *name, unsigned int got, unsigned int expected)
+{
+  printf("%-40s 0x%02x  %s\n", name, got, got == expected ? "ok" : "FAIL");
+  if (got != expected) failed = 1;
+}
+
+
+#if RX_FILTER_PROFILES == 1 || MULTICAST_GROUP_SUPPORT == 1
+static void check_eht(const char *name, const uint8_t *expected)
+{
+  char text[64];
+  uint8_t i;
+
+  for (i = 0; i < 8; i++) {
+    snprintf(text, sizeof(text), "%s EHT%u", name, i);
+    check(text, enc_reg[1][ENC_EHT0 + i], expected[i]);
+  }
+}
+#endif // RX_FILTER_PROFILES == 1 || MULTICAST_GROUP_SUPPORT == 1
+
+
+int main(void)
+{
+#if RX_FILTER_PROFILES == 1
+  static const uint8_t example[6] = { 0x01, 0x00, 0x00, 0x00, 0x01, 0x2c };
+  static const uint8_t profile2_eht[8] = { 0, 0, 0, 0, 0, 0, 0, 0xc0 };
+#endif // RX_FILTER_PROFILES == 1
+#if MULTICAST_GROUP_SUPPORT == 1
+  static const uint8_t groups_eht[8] = { 0, 0, 0, 0, 0, 0, 0, 0x80 };
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  sim_power_on();
+
+#if RX_FILTER_PROFILES == 1
+  check("hash pointer 01-00-00-00-01-2C", Enc28j60HashPointer(example), 0x34);
+
+  memset(enc_reg, 0, sizeof(enc_reg));
+  Enc28j60SwitchBank(1);
+  set_rx_filter_profile(2);
+  check_eht("profile 2", profile2_eht);
+  check("profile 2 ERXFCON", enc_reg[1][ENC_ERXFCON], 0xb4);
+#endif // RX_FILTER_PROFILES == 1
+
+#if MULTICAST_GROUP_SUPPORT == 1
+  memset(enc_reg, 0, sizeof(enc_reg));
+  memset(uip_mcast_groups, 0, sizeof(uip_mcast_groups));
+  // The EEPROM is zero after sim_power_on(), so the profile is 0
+  uip_ipaddr(uip_mcast_groups[0], 224, 0, 0, 1);
+  Enc28j60JoinGroups();
+  check_eht("groups 224.0.0.1", groups_eht);
+  check("groups ERXFCON HTEN", enc_reg[1][ENC_ERXFCON] & 0x04, 0x04);
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+  return failed;
+}
@@ -0,0 +1,27 @@
+// host.h
+//
+// Included ahead of every file of the host simulation build (gcc -include).
+// See prepare.sh for the edits made to the firmware sources.
+
+#ifndef __HOST_H__
+#define __HOST_H__
+
+// stm8s-005.h requires a known compiler. The Cosmic branch is used and its
+// inline assembly is dropped, so sim(), rim(), nop() and wfi() do nothing.
+#define __CSMC__ 1
+#define _asm(x)
+#define _fctcpy(x) 0
+
+// The STM8 EEPROM, which holds the @eeprom variables (see prepare.sh), and
+// the placement of the @FLASH_START_xxx variables. sim_hw.c saves and
+// restores both with the state file.
+extern unsigned char sim_eeprom[128];
+#define NM_FLASH __attribute__((section("nm_flash")))
+
+// The program memory (0x8000 to 0xffff) is only read and written by the
+// upgradeable builds when the code image is copied to or from the I2C
+// EEPROM. It is simulated by sim_flash[] in sim_hw.c.
+extern char sim_flash[0x8000];
+#define SIM_FLASH(addr) (sim_flash + ((addr) - 0x8000))
+
+#endif /* __HOST_H__ */
@@ -0,0 +1,157 @@
+// iostm8s005.h
+//
+// Host simulation build replacement for the Cosmic STM8S005 register header.
+// The registers are ordinary variables defined in sim_regs.c:
+//   - The port registers PA to PG are laid out as at 0x5000 in sim_ports[],
+//     which is also the io_reg[] array of Gpio.c.
+//   - FLASH_IAPSR always reads as unlocked with the last write complete, so
+//     the unlock and programming waits in Main.c return at once.
+//   - A write of WDGA (0x80) to WWDG_CR resets the simulated module (see
+//     sim_hw.c).
+//   - All other registers just hold the last value written. The timers,
+//     SPI, I2C and UART registers are only used by the drivers that the
+//     simulation replaces.
+
+#ifndef __IOSTM8S005_H__
+#define __IOSTM8S005_H__
+
+// The port registers, 5 per port from PA_ODR. Gpio.c accesses the same
+// bytes as io_reg[] (struct io_registers is laid out like the registers), so
+// the array has that symbol name.
+extern volatile unsigned char sim_ports[35] __asm__("io_reg");
+
+#define PA_ODR		sim_ports[0x00]
+#define PA_IDR		sim_ports[0x01]
+#define PA_DDR		sim_ports[0x02]
+#define PA_CR1		sim_ports[0x03]
+#define PA_CR2		sim_ports[0x04]
+#define PB_ODR		sim_ports[0x05]
+#define PB_IDR		sim_ports[0x06]
+#define PB_DDR		sim_ports[0x07]
+#define PB_CR1		sim_ports[0x08]
+#define PB_CR2		sim_ports[0x09]
+#define PC_ODR		sim_ports[0x0a]
+#define PC_IDR		sim_ports[0x0b]
+#define PC_DDR		sim_ports[0x0c]
+#define PC_CR1		sim_ports[0x0d]
+#define PC_CR2		sim_ports[0x0e]
+#define PD_ODR		sim_ports[0x0f]
+#define PD_IDR		sim_ports[0x10]
+#define PD_DDR		sim_ports[0x11]
+#define PD_CR1		sim_ports[0x12]
+#define PD_CR2		sim_ports[0x13]
+#define PE_ODR		sim_ports[0x14]
+#define PE_IDR		sim_ports[0x15]
+#define PE_DDR		sim_ports[0x16]
+#define PE_CR1		sim_ports[0x17]
+#define PE_CR2		sim_ports[0x18]
+#define PF_ODR		sim_ports[0x19]
+#define PF_IDR		sim_ports[0x1a]
+#define PF_DDR		sim_ports[0x1b]
+#define PF_CR1		sim_ports[0x1c]
+#define PF_CR2		sim_ports[0x1d]
+#define PG_ODR		sim_ports[0x1e]
+#define PG_IDR		sim_ports[0x1f]
+#define PG_DDR		sim_ports[0x20]
+#define PG_CR1		sim_ports[0x21]
+#define PG_CR2		sim_ports[0x22]
+
+volatile unsigned char *sim_flash_iapsr(void);
+#define FLASH_IAPSR	(*sim_flash_iapsr())
+
+// All other registers. sim_regs.c defines SIM_REG() to define them.
+#ifndef SIM_REG
+#define SIM_REG(name) extern volatile unsigned char name;
+#endif
+
+SIM_REG(CLK_CCOR)
+SIM_REG(CLK_CKDIVR)
+SIM_REG(CLK_CSSR)
+SIM_REG(CLK_ECKR)
+SIM_REG(CLK_HSITRIMR)
+SIM_REG(CLK_ICKR)
+SIM_REG(CLK_PCKENR1)
+SIM_REG(CLK_PCKENR2)
+SIM_REG(CLK_SWCR)
+SIM_REG(CLK_SWIMCCR)
+SIM_REG(CLK_SWR)
+SIM_REG(EXTI_CR1)
+SIM_REG(EXTI_CR2)
+SIM_REG(FLASH_CR2)
+SIM_REG(FLASH_DUKR)
+SIM_REG(FLASH_NCR2)
+SIM_REG(FLASH_PUKR)
+SIM_REG(I2C_CCRH)
+SIM_REG(I2C_CCRL)
+SIM_REG(I2C_CR1)
+SIM_REG(I2C_CR2)
+SIM_REG(I2C_DR)
+SIM_REG(I2C_FREQR)
+SIM_REG(I2C_ITR)
+SIM_REG(I2C_OARH)
+SIM_REG(I2C_OARL)
+SIM_REG(I2C_SR1)
+SIM_REG(I2C_SR2)
+SIM_REG(I2C_SR3)
+SIM_REG(I2C_TRISER)
+SIM_REG(ITC_SPR1)
+SIM_REG(ITC_SPR2)
+SIM_REG(ITC_SPR3)
+SIM_REG(ITC_SPR4)
+SIM_REG(ITC_SPR5)
+SIM_REG(ITC_SPR6)
+SIM_REG(ITC_SPR7)
+SIM_REG(ITC_SPR8)
+SIM_REG(IWDG_KR)
+SIM_REG(IWDG_PR)
+SIM_REG(IWDG_RLR)
+SIM_REG(RST_SR)
+SIM_REG(SPI_CR1)
+SIM_REG(SPI_CR2)
+SIM_REG(SPI_DR)
+SIM_REG(SPI_ICR)
+SIM_REG(SPI_SR)
+SIM_REG(TIM1_ARRH)
+SIM_REG(TIM1_ARRL)
+SIM_REG(TIM1_CNTRH)
+SIM_REG(TIM1_CNTRL)
+SIM_REG(TIM1_CR1)
+SIM_REG(TIM1_EGR)
+SIM_REG(TIM1_IER)
+SIM_REG(TIM1_PSCRH)
+SIM_REG(TIM1_PSCRL)
+SIM_REG(TIM1_SR1)
+SIM_REG(TIM2_CNTRH)
+SIM_REG(TIM2_CNTRL)
+SIM_REG(TIM2_CR1)
+SIM_REG(TIM2_EGR)
+SIM_REG(TIM2_IER)
+SIM_REG(TIM2_PSCR)
+SIM_REG(TIM2_SR1)
+SIM_REG(TIM3_CNTRH)
+SIM_REG(TIM3_CNTRL)
+SIM_REG(TIM3_CR1)
+SIM_REG(TIM3_EGR)
+SIM_REG(TIM3_IER)
+SIM_REG(TIM3_PSCR)
+SIM_REG(TIM3_SR1)
+SIM_REG(TIM4_ARR)
+SIM_REG(TIM4_CNTR)
+SIM_REG(TIM4_CR1)
+SIM_REG(TIM4_EGR)
+SIM_REG(TIM4_IER)
+SIM_REG(TIM4_PSCR)
+SIM_REG(TIM4_SR)
+SIM_REG(UART2_BRR1)
+SIM_REG(UART2_BRR2)
+SIM_REG(UART2_CR1)
+SIM_REG(UART2_CR2)
+SIM_REG(UART2_CR3)
+SIM_REG(UART2_CR4)
+SIM_REG(UART2_CR5)
+SIM_REG(UART2_DR)
+SIM_REG(UART2_SR)
+SIM_REG(WWDG_CR)
+SIM_REG(WWDG_WR)
+
+#endif /* __IOSTM8S005_H__ */
@@ -0,0 +1,112 @@
+#!/usr/bin/env python3
+"""Make the Strings image of the upgradeable builds from httpd.c.
+
+The upgradeable builds (OB_EEPROM_SUPPORT) read the IOControl,
+Configuration, PCF8574 and Load Uploader page templates from the Strings
+region of the I2C EEPROM. On a module they come from the Strings File that
+the prepsx pre-processor extracts from httpd.c. This script extracts the
+templates the same way, from the text after each xxx_BEGIN define, and
+writes the Strings region as a binary image for the host simulation build
+(nmsim -e, pagecheck -e):
+
+    xxx_ADDRESS_LOCATION    2 bytes, big endian: 0x8000 + template offset
+    xxx_SIZE_LOCATION       2 bytes, big endian: template size
+    0x0100 onward           the templates
+
+The locations are read from httpd.h. Unused bytes are 0xff, as in an erased
+I2C EEPROM. The image must end below the settings snapshot staging area at
+0x7d80 and the PCF8574 storage at 0x7ec0.
+
+Usage: mkstrings.py httpd.c httpd.h strings.bin
+"""
+
+import re
+import sys
+
+BEGIN = re.compile(r"^#define\s+(\w+)_BEGIN\b")
+TEMPLATE = re.compile(r"static const char (g_Html\w+)\[\]\s*=")
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+LOCATION = re.compile(r"^#define\s+(\w+)_(ADDRESS|SIZE)_LOCATION\s+(0x[0-9a-fA-F]+)")
+ESCAPE = re.compile(r"\\(x[0-9a-fA-F]+|[0-7]{1,3}|.)")
+SIMPLE = {"n": "\n", "r": "\r", "t": "\t", "0": "\0"}
+
+TEMPLATE_START = 0x0100
+IMAGE_END = 0x7d80   # SNAPSHOT_I2C_EEPROM_STAGING
+
+
+def unescape(literal):
+    def one(m):
+        e = m.group(1)
+        if e[0] == "x":
+            return chr(int(e[1:], 16))
+        if e[0] in "01234567" and len(e) > 1:
+            return chr(int(e, 8))
+        return SIMPLE.get(e, e)
+    return ESCAPE.sub(one, literal)
+
+
+def read_templates(path):
+    """Returns {name: bytes} for each xxx_BEGIN in httpd.c."""
+    with open(path, encoding="latin-1") as f:
+        lines = f.read().splitlines()
+    templates = {}
+    i = 0
+    while i < len(lines):
+        m = BEGIN.match(lines[i])
+        i += 1
+        if not m:
+            continue
+        name = m.group(1)
+        # The template is the first static const char g_Htmlxxx[] after the
+        # define
+        while i < len(lines) and not TEMPLATE.search(lines[i]):
+            i += 1
+        if i == len(lines):
+            sys.exit("%s: no template after %s_BEGIN" % (path, name))
+        rest = lines[i][TEMPLATE.search(lines[i]).end():]
+        text = ""
+        while True:
+            if not rest.lstrip().startswith(("#", "//")):
+                text += "".join(unescape(s) for s in LITERAL.findall(rest))
+            if rest.rstrip().endswith(";") or i + 1 >= len(lines):
+                break
+            i += 1
+            rest = lines[i]
+        templates[name] = text.encode("latin-1")
+    return templates
+
+
+def read_locations(path):
+    """Returns {name: (address location, size location)} from httpd.h."""
+    found = {}
+    with open(path, encoding="latin-1") as f:
+        for line in f:
+            m = LOCATION.match(line)
+            if m:
+                found.setdefault(m.group(1), {})[m.group(2)] = int(m.group(3), 16)
+    return {n: (v["ADDRESS"], v["SIZE"]) for n, v in found.items()
+            if "ADDRESS" in v and "SIZE" in v}
+
+
+def main(argv):
+    if len(argv) != 4:
+        sys.exit(__doc__.rstrip().rsplit("\n", 1)[-1])
+    templates = read_templates(argv[1])
+    locations = read_locations(argv[2])
+    image = bytearray(b"\xff" * TEMPLATE_START)
+    for name, text in templates.items():
+        if name not in locations:
+            sys.exit("%s: no %s_ADDRESS_LOCATION / _SIZE_LOCATION" % (argv[2], name))
+        address, size = locations[name]
+        image[address:address + 2] = (0x8000 + len(image)).to_bytes(2, "big")
+        image[size:size + 2] = len(text).to_bytes(2, "big")
+        image += text
+    if len(image) > IMAGE_END:
+        sys.exit("Strings image is %d bytes, more than the %d available"
+                 % (len(image), IMAGE_END))
+    with open(argv[3], "wb") as f:
+        f.write(image)
+
+
+if __name__ == "__main__":
+    main(sys.argv)
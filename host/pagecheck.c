@@ -0,0 +1,453 @@
+// pagecheck.c
+//
+// Page template check for the host simulation build. The firmware boots as
+// in nmsim, but without a network interface. Once the main loop runs, each
+// web page of the build is requested through the HTTP application call
+// (uip_TcpAppHubCall(), as uip_process() makes it) and the reply is checked:
+//
+//   length   The Content-Length in the header, which is the
+//            adjust_template_size() prediction, must equal the number of
+//            body bytes CopyHttpData() produced.
+//   golden   With -g DIR the body is compared with DIR/<config>-<page>.txt.
+//            Digits are masked with '#' first, as live values (counters,
+//            timers) change from run to run. A missing golden file is an
+//            error. -u writes the golden files.
+//   ns/byte  Host CPU time (CLOCK_THREAD_CPUTIME_ID) of the CopyHttpData()
+//            calls of the page divided by the body size, best of -r runs.
+//            Host time is only a relative measure of the expansion cost,
+//            for comparing builds and changes to the template code.
+//
+// The configuration is selected with -c:
+//   new      A new module, the EEPROM is written with the defaults at boot.
+//   set      A configured module: a long device name, other addresses and
+//            ports, the MQTT, DS18B20 and BME280 features of the build
+//            enabled and a mix of disabled, inverted, input and output pins.
+//
+// The upgradeable builds read the page templates from the I2C EEPROM, so
+// they need the Strings image made by mkstrings.py (-e).
+//
+// Usage: pagecheck [-c new|set] [-e strings] [-g golden] [-u] [-o outdir]
+//                  [-n name] [-r runs]
+// The exit status is 1 if any page is incomplete, has a length error or
+// differs from its golden file, and 2 if the check could not run (the
+// module reset or hung).
+
+#define _XOPEN_SOURCE 600
+
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "main.h"
+#include "sim.h"
+
+#define MAX_PAGE	16384	// Largest reply accepted
+#define MAX_CALLS	1000	// Application calls allowed for one reply
+#define BOOT_WAIT_MS	1500	// Main loop run time before the check
+#define TIME_LIMIT_S	60	// The check fails if it takes longer
+
+extern char *uip_sappdata;
+extern uint16_t uip_slen;
+extern uint16_t Port_Httpd;
+
+extern uint8_t stored_devicename[20];
+extern uint8_t stored_EEPROM_revision1;
+extern uint8_t stored_EEPROM_revision2;
+extern uint8_t stored_uip_ethaddr_oct[6];
+extern uint16_t stored_port;
+extern uint8_t stored_netmask[4];
+extern uint8_t stored_draddr[4];
+extern uint8_t stored_hostaddr[4];
+extern uint8_t stored_magic1;
+extern uint8_t stored_magic2;
+extern uint8_t stored_magic3;
+extern uint8_t stored_magic4;
+extern uint16_t stored_mqttport;
+extern uint8_t stored_mqttserveraddr[4];
+extern char stored_mqtt_username[11];
+extern char stored_mqtt_password[11];
+extern uint8_t stored_config_settings;
+extern uint8_t stored_prior_config;
+extern uint8_t stored_pin_control[16];
+
+int nm_main(void);
+
+struct page {
+  const char *cmd;       // URL command
+  const char *name;
+};
+
+static const struct page pages[] = {
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+  { "60", "IO Control" },
+  { "61", "Configuration" },
+#if PCF8574_SUPPORT == 1
+#if BUILD_TYPE_BROWSER_UPGRADEABLE == 1 || HOME_ASSISTANT_SUPPORT == 1
+  { "62", "PCF8574 IO Control" },
+  { "63", "PCF8574 Configuration" },
+#endif // BUILD_TYPE_BROWSER_UPGRADEABLE == 1 || HOME_ASSISTANT_SUPPORT == 1
+#endif // PCF8574_SUPPORT == 1
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#if BUILD_SUPPORT == CODE_UPLOADER_BUILD
+  { "", "Code Uploader" },
+#endif // BUILD_SUPPORT == CODE_UPLOADER_BUILD
+#if LINK_STATISTICS == 1
+  { "66", "Link Error Statistics" },
+#endif // LINK_STATISTICS == 1
+#if NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
+  { "68", "Network Statistics" },
+#endif // NETWORK_STATISTICS == 1 && BUILD_SUPPORT == BROWSER_ONLY_BUILD
+#if RF_ATTEN_SUPPORT == 1
+  { "75", "RF Attenuator" },
+#endif // RF_ATTEN_SUPPORT == 1
+#if INA226_SUPPORT == 1
+  { "76", "INA226" },
+#endif // INA226_SUPPORT == 1
+#if SDR_POWER_RELAY_SUPPORT == 1
+  { "77", "SDR Power Relay" },
+#endif // SDR_POWER_RELAY_SUPPORT == 1
+#if BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+  { "98", "Very Short Form IO States" },
+  { "99", "Short Form IO States" },
+#endif // BUILD_SUPPORT == BROWSER_ONLY_BUILD || BUILD_SUPPORT == MQTT_BUILD
+#if STYLE_RESOURCE == 1
+  { "b0", "Style sheet" },
+#endif // STYLE_RESOURCE == 1
+#if STATE_JSON_SUPPORT == 1
+  { "b1", "JSON state" },
+  { "b2", "JSON pins" },
+#endif // STATE_JSON_SUPPORT == 1
+#if HTTP_WEBSOCKET == 1
+  { "b7", "WebSocket script" },
+#endif // HTTP_WEBSOCKET == 1
+};
+
+static const char *config = "new";
+static const char *golden_dir;
+static const char *out_dir;
+static const char *build_name = "";
+static int update;
+static int runs = 5;
+static int failures;
+
+static char reply[MAX_PAGE];
+static unsigned int reply_len;
+static uint64_t body_ns;    // CPU time of the calls after the header
+
+
+static uint64_t cpu_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+
+static int app_call(uint8_t flags, const char *data, uint16_t len)
+{
+  // One application call as uip_process() makes it. Appends what the
+  // application sent to reply[]. Returns the uip_flags left by the call.
+  uint64_t start;
+  int header_sent;
+
+  uip_sappdata = uip_appdata = (char *)&uip_buf[UIP_LLH_LEN + UIP_IPTCPH_LEN];
+  if (len) memcpy(uip_appdata, data, len);
+  uip_len = len;
+  uip_slen = 0;
+  uip_flags = flags;
+#if HTTP_MULTI_SEGMENT == 1
+  uip_sendmore = 0;
+#endif // HTTP_MULTI_SEGMENT == 1
+
+  header_sent = (reply_len != 0);
+  start = cpu_ns();
+  uip_TcpAppHubCall();
+  if (header_sent) body_ns += cpu_ns() - start;
+
+  if (uip_slen > 0 && !(uip_flags & UIP_ABORT)) {
+    if (reply_len + uip_slen > sizeof(reply)) {
+      fprintf(stderr, "pagecheck: reply too long\n");
+      exit(2);
+    }
+    memcpy(reply + reply_len, uip_sappdata, uip_slen);
+    reply_len += uip_slen;
+  }
+  uip_conn->len = uip_slen;
+  return uip_flags;
+}
+
+
+static int request(const char *cmd)
+{
+  // Requests a page on a free connection and runs it to the close. The
+  // connection is left closed, so the main loop does not see it. Returns 0
+  // if the reply is complete.
+  char get[128];
+  struct uip_conn *conn;
+  int calls;
+  int flags;
+  int i;
+
+  conn = NULL;
+  for (i = 0; i < UIP_CONNS; i++) {
+    if (uip_conns[i].tcpstateflags == UIP_CLOSED) {
+      conn = &uip_conns[i];
+      break;
+    }
+  }
+  if (conn == NULL) {
+    fprintf(stderr, "pagecheck: no free connection\n");
+    exit(2);
+  }
+  conn->lport = htons(Port_Httpd);
+  conn->rport = HTONS(50000);
+  conn->tcpstateflags = UIP_ESTABLISHED;
+  conn->mss = UIP_TCP_MSS;
+  conn->len = 0;
+  uip_conn = conn;
+
+  reply_len = 0;
+  body_ns = 0;
+  sprintf(get, "GET /%s HTTP/1.1\r\nHost: pagecheck\r\nConnection: close\r\n\r\n", cmd);
+
+  app_call(UIP_CONNECTED, NULL, 0);
+  flags = app_call(UIP_NEWDATA, get, (uint16_t)strlen(get));
+  for (calls = 0; calls < MAX_CALLS && !(flags & (UIP_CLOSE | UIP_ABORT)); calls++) {
+    // Data that was sent is acknowledged at once, otherwise the application
+    // is polled
+    if (conn->len) {
+      conn->len = 0;
+      flags = app_call(UIP_ACKDATA, NULL, 0);
+    }
+    else flags = app_call(UIP_POLL, NULL, 0);
+  }
+
+  conn->tcpstateflags = UIP_CLOSED;
+  return (flags & UIP_CLOSE) ? 0 : -1;
+}
+
+
+static void mask_digits(char *text, unsigned int len)
+{
+  unsigned int i;
+
+  for (i = 0; i < len; i++) {
+    if (text[i] >= '0' && text[i] <= '9') text[i] = '#';
+  }
+}
+
+
+static int write_file(const char *path, const char *data, unsigned int len)
+{
+  FILE *f;
+
+  f = fopen(path, "wb");
+  if (f == NULL || fwrite(data, 1, len, f) != len) {
+    perror(path);
+    if (f) fclose(f);
+    return -1;
+  }
+  return fclose(f);
+}
+
+
+static const char *golden_check(const char *file, char *body, unsigned int len)
+{
+  // Compares the masked body with the golden file, or writes the golden file
+  static char golden[MAX_PAGE];
+  char path[512];
+  FILE *f;
+  size_t n;
+
+  snprintf(path, sizeof(path), "%s/%s", golden_dir, file);
+  if (update) return write_file(path, body, len) == 0 ? "written" : "ERROR";
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    failures++;
+    return "MISSING";
+  }
+  n = fread(golden, 1, sizeof(golden), f);
+  fclose(f);
+  if (n == len && memcmp(golden, body, len) == 0) return "ok";
+  failures++;
+  return "DIFFERS";
+}
+
+
+static void check_page(const struct page *p)
+{
+  char file[64];
+  char path[512];
+  char *body;
+  char *cl;
+  unsigned int body_len;
+  unsigned int content_length;
+  uint64_t best;
+  const char *golden;
+  int r;
+
+  best = 0;
+  for (r = 0; r < runs; r++) {
+    if (request(p->cmd) != 0) {
+      printf("%-4s %-27s no reply (no close after %d calls)\n", p->cmd, p->name, MAX_CALLS);
+      failures++;
+      return;
+    }
+    if (r == 0 || body_ns < best) best = body_ns;
+  }
+
+  reply[reply_len < sizeof(reply) ? reply_len : sizeof(reply) - 1] = '\0';
+  body = strstr(reply, "\r\n\r\n");
+  cl = strstr(reply, "Content-Length:");
+  if (body == NULL || cl == NULL || cl > body) {
+    printf("%-4s %-27s no Content-Length header\n", p->cmd, p->name);
+    failures++;
+    return;
+  }
+  body += 4;
+  body_len = reply_len - (unsigned int)(body - reply);
+  content_length = (unsigned int)strtoul(cl + 15, NULL, 10);
+
+  snprintf(file, sizeof(file), "%s-%s.txt", config, p->cmd[0] ? p->cmd : "default");
+  if (out_dir) {
+    snprintf(path, sizeof(path), "%s/%s", out_dir, file);
+    write_file(path, body, body_len);
+  }
+
+  mask_digits(body, body_len);
+  golden = golden_dir ? golden_check(file, body, body_len) : "-";
+  if (content_length != body_len) failures++;
+
+  printf("%-4s %-27s %6u %6u%s %7.2f  %s\n", p->cmd, p->name, content_length, body_len,
+         content_length != body_len ? " LENGTH ERROR" : "",
+         body_len ? (double)best / body_len : 0.0, golden);
+}
+
+
+static void check_pages(void)
+{
+  // Called once per main loop pass (in place of a frame receive). Runs the
+  // check once the module has been up for BOOT_WAIT_MS.
+  static struct timespec start;
+  static int started;
+  struct timespec now;
+  unsigned int i;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (!started) {
+    start = now;
+    started = 1;
+    return;
+  }
+  if ((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000 < BOOT_WAIT_MS) return;
+
+  printf("%s %s (ns/byte best of %d)\n", build_name, config, runs);
+  printf("page name                        length   body  ns/byte  golden\n");
+  for (i = 0; i < sizeof(pages) / sizeof(pages[0]); i++) check_page(&pages[i]);
+  fflush(stdout);
+  if (failures) {
+    if (golden_dir && !update) fprintf(stderr, "pagecheck: see %s for the pages\n", out_dir ? out_dir : "-o");
+    exit(1);
+  }
+  exit(0);
+}
+
+
+static void time_limit(int sig)
+{
+  static const char msg[] = "pagecheck: time limit, the module hangs\n";
+
+  write(2, msg, sizeof(msg) - 1);
+  _exit(2);
+}
+
+
+void sim_reset(unsigned char rst_sr)
+{
+  // A page request must not reset the module
+  fprintf(stderr, "pagecheck: module reset (RST_SR 0x%02x) during the check\n", rst_sr);
+  exit(2);
+}
+
+
+static void configure(void)
+{
+  // The EEPROM of a configured module (see the defaults in
+  // check_eeprom_settings() in Main.c)
+  static const uint8_t pin_control[16] = {
+    0x03, 0x83, 0x8b, 0x07,     // Outputs: off, on, on + retain, inverted
+    0x01, 0x05, 0x01, 0x05,     // Inputs, some inverted
+    0x00, 0x00, 0x83, 0x03,     // Disabled, outputs
+    0x01, 0x9b, 0x00, 0x01 };   // Input, output on + retain, disabled
+
+  memcpy(stored_devicename, "PageCheck-Module-19", 20);
+  stored_EEPROM_revision1 = 0x01;
+  stored_EEPROM_revision2 = 0xf5;
+  memcpy(stored_uip_ethaddr_oct, "\xc2\x4d\x69\x6b\x65\x00", 6);
+  stored_port = 80;
+  memcpy(stored_netmask, "\x00\xff\xff\xff", 4);
+  memcpy(stored_draddr, "\x01\x64\xa8\xc0", 4);   // 192.168.100.1
+  memcpy(stored_hostaddr, "\xc8\x64\xa8\xc0", 4); // 192.168.100.200
+  stored_mqttport = 18830;
+  memcpy(stored_mqttserveraddr, "\x0a\x64\xa8\xc0", 4);
+  memcpy(stored_mqtt_username, "mqttuser10", 11);
+  memcpy(stored_mqtt_password, "mqttpass10", 11);
+  // The sensors and MQTT are enabled if the build supports them, as its
+  // Configuration page would allow
+  stored_config_settings = 0x00;
+#if DS18B20_SUPPORT == 1
+  stored_config_settings |= 0x08;
+#endif // DS18B20_SUPPORT == 1
+#if BME280_SUPPORT == 1
+  stored_config_settings |= 0x20;
+#endif // BME280_SUPPORT == 1
+#if BUILD_SUPPORT == MQTT_BUILD
+  stored_config_settings |= 0x04;
+#endif // BUILD_SUPPORT == MQTT_BUILD
+  stored_prior_config = stored_config_settings;
+  memcpy(stored_pin_control, pin_control, 16);
+  stored_magic4 = 0x55;
+  stored_magic3 = 0xee;
+  stored_magic2 = 0x0f;
+  stored_magic1 = 0xf0;
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *strings_file;
+  int c;
+
+  strings_file = NULL;
+  while ((c = getopt(argc, argv, "c:e:g:n:o:r:u")) != -1) {
+    switch (c) {
+      case 'c': config = optarg; break;
+      case 'e': strings_file = optarg; break;
+      case 'g': golden_dir = optarg; break;
+      case 'n': build_name = optarg; break;
+      case 'o': out_dir = optarg; break;
+      case 'r': runs = atoi(optarg) > 0 ? atoi(optarg) : 1; break;
+      case 'u': update = 1; break;
+      default:
+        fprintf(stderr, "usage: %s [-c new|set] [-e strings] [-g golden] [-u] [-o outdir] [-n name] [-r runs]\n", argv[0]);
+        return 2;
+    }
+  }
+  if (strcmp(config, "new") != 0 && strcmp(config, "set") != 0) {
+    fprintf(stderr, "pagecheck: unknown configuration %s\n", config);
+    return 2;
+  }
+
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  signal(SIGALRM, time_limit);
+  alarm(TIME_LIMIT_S);
+  sim_power_on();
+  if (strings_file != NULL && sim_load_strings(strings_file) != 0) return 2;
+  if (strcmp(config, "set") == 0) configure();
+
+  sim_ifname = NULL;
+  sim_loop_hook = check_pages;
+  return nm_main();
+}
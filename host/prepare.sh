@@ -0,0 +1,149 @@
+#!/bin/sh
+# Prepares a copy of the NetworkModule sources for the host simulation build.
+#
+# Usage: prepare.sh SRCDIR DSTDIR BUILD_TYPE [NAME=VALUE ...]
+#
+# The firmware is written for the Cosmic STM8 compiler. The copy in DSTDIR
+# is edited so that gcc can compile it. Line numbers are not changed, so
+# compiler messages point at the lines in the firmware sources.
+#   @eeprom variables     are placed at their STM8 EEPROM addresses in
+#                         sim_eeprom[] (see below)
+#   @FLASH_START_xxx      variables are placed in the nm_flash section
+#   @0x5000 (io_reg)      is defined by sim_regs.c over the port registers
+#   @far @interrupt etc   are removed
+#   #pragma section       lines are removed
+#   "#if X == 1;"         the stray ';' Cosmic accepts is removed
+#   "#if (sizeof(sN)"     string size checks become _Static_assert()
+#   UIP_BYTE_ORDER        is UIP_LITTLE_ENDIAN (the STM8 is big endian)
+#   main()                is renamed nm_main() (see sim_hw.c, pagecheck.c)
+#   Flash code pointers   (char *)FLASH_START_PROGRAM_MEMORY point at the
+#                         simulated program memory (SIM_FLASH() in host.h)
+#
+# uipopt.h is edited to select BUILD_TYPE (for example MQTT_HOME_STANDARD)
+# and to set each NAME=VALUE option. Only the option list at the top of
+# uipopt.h is changed, so the build type overrides further down still apply
+# just as when uipopt.h is edited by hand.
+#
+# Only files that changed are replaced in DSTDIR so that make rebuilds only
+# what depends on them.
+
+set -e
+
+if [ $# -lt 3 ]; then
+  echo "usage: $0 SRCDIR DSTDIR BUILD_TYPE [NAME=VALUE ...]" >&2
+  exit 2
+fi
+
+src=$1
+dst=$2
+build=$3
+shift 3
+
+tmp=$dst.tmp
+rm -rf "$tmp"
+mkdir -p "$tmp" "$dst"
+cp "$src"/*.c "$src"/*.h "$tmp"
+rm -f "$tmp"/networkmodule_vector.c
+
+for f in "$tmp"/*.c "$tmp"/*.h; do
+  sed -i \
+    -e 's/\r$//' \
+    -e 's/ @FLASH_START_[A-Z_]*;/ NM_FLASH;/' \
+    -e '/^volatile struct io_registers io_reg\[.*@0x5000;/d' \
+    -e 's/@far //g; s/@interrupt //g; s/@near //g; s/@tiny //g' \
+    -e 's/^#pragma section.*$//' \
+    -e 's/^\(#if .*\);[[:blank:]]*$/\1/' \
+    -e 's/^#if (sizeof(s[0-9]*) > 255)$/#if 1/' \
+    -e 's/^  #error "string \(s[0-9]*\) is too big"$/_Static_assert(sizeof(\1) <= 255, "string \1 is too big");/' \
+    -e 's/^\(#define UIP_BYTE_ORDER[[:blank:]]*\)UIP_BIG_ENDIAN/\1UIP_LITTLE_ENDIAN/' \
+    -e 's/^int main(void)\(;*\)$/int nm_main(void)\1/' \
+    -e 's/(char \*)FLASH_START_PROGRAM_MEMORY/(char *)SIM_FLASH(FLASH_START_PROGRAM_MEMORY)/' \
+    -e 's/(char \*)(FLASH_START_PROGRAM_MEMORY + /(char *)SIM_FLASH(FLASH_START_PROGRAM_MEMORY + /' \
+    "$f"
+done
+
+# The @eeprom variables in Main.c. The firmware relies on their layout (the
+# Cosmic linker places them in reverse order of declaration without any
+# padding), so each one becomes a symbol at its offset in sim_eeprom[], which
+# is defined at the end of Main.c for this (an assembler symbol can only be
+# set relative to a symbol of the same file). The
+# default settings table stores the two 16 bit ports big endian, those bytes
+# are swapped for the host.
+awk '
+/^@eeprom / {
+  line = $0
+  sub(/^@eeprom /, "", line)
+  decl = line
+  sub(/;.*/, "", decl)
+  type = decl
+  sub(/[ \t].*/, "", type)
+  name = decl
+  sub(/^[^ \t]*[ \t]+/, "", name)
+  dim = 1
+  if (match(name, /\[[0-9]+\]/)) {
+    dim = substr(name, RSTART + 1, RLENGTH - 2)
+    sub(/\[.*/, "", name)
+  }
+  if (type == "uint8_t" || type == "char") size = 1
+  else if (type == "uint16_t" || type == "int16_t") size = 2
+  else {
+    print "prepare.sh: unknown @eeprom type " type > "/dev/stderr"
+    exit 1
+  }
+  n++
+  names[n] = name
+  sizes[n] = size * dim
+  print "extern " line
+  next
+}
+/^    0x1f, 0x90,$/ { print "    0x90, 0x1f,"; next }
+/^    0x07, 0x5b,$/ { print "    0x5b, 0x07,"; next }
+{ print }
+END {
+  # Word aligned like the STM8 EEPROM at 0x4000 (see eeprom_cache_write())
+  print "unsigned char sim_eeprom[128] __attribute__((aligned(4)));"
+  off = 0
+  for (i = n; i >= 1; i--) {
+    printf "__asm__(\".globl %s\\n\\t.set %s, sim_eeprom + %d\");\n", names[i], names[i], off
+    off += sizes[i]
+  }
+  if (off > 128) {
+    print "prepare.sh: @eeprom variables exceed 128 bytes" > "/dev/stderr"
+    exit 1
+  }
+}' "$tmp/Main.c" > "$tmp/Main.c.new"
+mv "$tmp/Main.c.new" "$tmp/Main.c"
+sed -i 's/@eeprom//' "$tmp/stm8s-005.h"
+
+# Select the build type
+opt=$tmp/uipopt.h
+if ! grep -q "^#define BUILD_TYPE_$build[[:blank:]]" "$opt"; then
+  echo "$0: unknown build type $build" >&2
+  exit 1
+fi
+sed -i -e 's/^\(#define BUILD_TYPE_[A-Z0-9_]*[[:blank:]]*\)1$/\10/' \
+       -e "s/^\(#define BUILD_TYPE_$build[[:blank:]]*\)0$/\11/" "$opt"
+
+# Set the options
+for kv in "$@"; do
+  name=${kv%%=*}
+  value=${kv#*=}
+  if [ "$name" = "$kv" ] || ! grep -q "^#define $name[[:blank:]]" "$opt"; then
+    echo "$0: $kv is not an option in the uipopt.h option list" >&2
+    exit 1
+  fi
+  # The first definition is the option list entry. A later one belongs to a
+  # check that turns the option off where it is not supported.
+  sed -i "0,/^#define $name[[:blank:]]/s/^\(#define $name[[:blank:]]*\)[^[:blank:]/]*/\1$value/" "$opt"
+done
+
+# Some includes differ in case from the file names (Cosmic runs on Windows)
+for f in "$tmp"/*.h; do
+  l=$(basename "$f" | tr A-Z a-z)
+  if [ "$l" != "$(basename "$f")" ]; then cp "$f" "$tmp/$l"; fi
+done
+
+for f in "$tmp"/*; do
+  cmp -s "$f" "$dst/$(basename "$f")" || cp "$f" "$dst/"
+done
+rm -rf "$tmp"
@@ -0,0 +1,32 @@
+// sim.h
+//
+// Interfaces between the files of the host simulation build. The firmware
+// interfaces (Enc28j60.h, I2C.h, timer.h, UART.h) are implemented as the
+// firmware declares them.
+
+#ifndef __SIM_H__
+#define __SIM_H__
+
+// sim_regs.c
+void sim_power_on(void);              // Power on state of the registers
+int sim_load_strings(const char *path); // Load a Strings image into the
+                                      // I2C EEPROM
+
+// sim_hw.c (nmsim) or pagecheck.c
+void sim_reset(unsigned char rst_sr); // Reset the module with the RST_SR
+                                      // flags given
+
+// sim_enc28j60.c
+extern const char *sim_ifname;        // TAP interface name, NULL for none
+extern void (*sim_loop_hook)(void);   // Called once per main loop pass
+int sim_tap_wait(int ms);             // Wait up to ms for a frame. Returns
+                                      // 1 if a frame is waiting.
+
+// sim_i2c.c
+#define SIM_I2C_EEPROM_SIZE 0x10000
+extern unsigned char sim_i2c_eeprom[2][SIM_I2C_EEPROM_SIZE]; // I2C EEPROM
+                                      // at 0xa0 (EEPROM0 / EEPROM1) and
+                                      // 0xa8 (EEPROM2 / EEPROM3)
+void sim_i2c_init(void);
+
+#endif /* __SIM_H__ */
@@ -0,0 +1,268 @@
+// sim_enc28j60.c
+//
+// Host simulation build replacement for Enc28j60.c and Spi.c. Frames are
+// sent and received on a Linux TAP interface (see sim_hw.c for the set up).
+// The ENC28J60 receive filter is applied to the received frames (unicast to
+// our MAC plus broadcasts, or the RX_FILTER_PROFILES profile) and frames
+// longer than ENC28J60_MAXFRAME are dropped as Enc28j60Receive() does.
+// Transmits complete at once and never fail. Without a TAP interface
+// (sim_ifname NULL) nothing is received and transmits are dropped.
+
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+#include <linux/if.h>
+#include <linux/if_tun.h>
+
+#include "main.h"
+#include "sim.h"
+
+#define ENC28J60_EREVID		6	// Silicon revision B7
+
+extern uint8_t debug_bytes[10];
+extern uint32_t TRANSMIT_counter;      // Counts any transmit
+#if RX_FILTER_PROFILES == 1
+extern uint8_t stored_options2;        // Additional options stored in EEPROM
+#endif // RX_FILTER_PROFILES == 1
+
+#if FRAME_COPY_STATISTICS == 1
+// The copy times stay 0, there is no SPI copy
+uint16_t rx_copy_time;                 // Last receive frame copy time
+uint16_t rx_copy_bytes;                // Size of that receive frame
+uint16_t tx_copy_time;                 // Last transmit frame copy time
+uint16_t tx_copy_bytes;                // Size of that transmit frame
+#endif // FRAME_COPY_STATISTICS == 1
+
+#if RX_OCCUPANCY_STATISTICS == 1
+// The receive buffer is the TAP queue, its occupancy is not known
+uint16_t rx_occupancy;                 // Last sampled RX buffer occupancy
+uint16_t rx_occupancy_peak;            // Peak RX buffer occupancy (bytes)
+uint8_t rx_pktcnt_peak;                // Peak EPKTCNT value
+uint32_t tx_wait_time;                 // Total time (us) spent waiting for
+                                       // a previous transmit to complete
+#endif // RX_OCCUPANCY_STATISTICS == 1
+
+#if ENC28J60_FLOW_CONTROL == 1
+uint16_t rx_pause_counter;             // Counts high watermark crossings.
+#endif // ENC28J60_FLOW_CONTROL == 1
+
+#if ENC28J60_INT_SUPPORT == 1
+uint8_t rx_poll_due;                   // Not used, there is no -INT pin
+#endif // ENC28J60_INT_SUPPORT == 1
+
+#if RX_PEEK_DISCARD == 1
+uint16_t rx_discard_counter;	// Counts frames discarded by the peek
+#endif // RX_PEEK_DISCARD == 1
+
+#if ARP_PENDING_SLOT == 1
+static uint8_t hold_frame[ENC28J60_MAXFRAME]; // The hold slot
+static uint16_t hold_len;              // Length of the frame in the hold slot
+#endif // ARP_PENDING_SLOT == 1
+
+const char *sim_ifname = "nm0";
+void (*sim_loop_hook)(void);
+
+static int tap_fd = -1;
+static uint8_t rx_broadcast;           // 0 = ARP broadcasts only
+static uint8_t rx_multicast;           // 1 = IPv4 multicast frames accepted
+static uint8_t rx_frame[2048];
+
+
+static void tap_open(void)
+{
+  struct ifreq ifr;
+
+  tap_fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+  if (tap_fd < 0) {
+    perror("nmsim: /dev/net/tun");
+    exit(1);
+  }
+  // Not kept open across the exec of a watchdog reset
+  fcntl(tap_fd, F_SETFD, FD_CLOEXEC);
+  memset(&ifr, 0, sizeof(ifr));
+  ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+  strncpy(ifr.ifr_name, sim_ifname, IFNAMSIZ - 1);
+  if (ioctl(tap_fd, TUNSETIFF, &ifr) < 0) {
+    perror("nmsim: TUNSETIFF");
+    fprintf(stderr, "nmsim: create the TAP first: ip tuntap add %s mode tap user $USER\n", sim_ifname);
+    exit(1);
+  }
+}
+
+
+int sim_tap_wait(int ms)
+{
+  struct pollfd pfd;
+
+  if (tap_fd < 0) return 0;
+  pfd.fd = tap_fd;
+  pfd.events = POLLIN;
+  return poll(&pfd, 1, ms) > 0;
+}
+
+
+static uint8_t frame_accepted(uint8_t* pFrame)
+{
+  // The ENC28J60 receive filter (see set_rx_filter_profile() in Enc28j60.c)
+  if (memcmp(pFrame, uip_ethaddr.addr, 6) == 0) return 1;
+  if (memcmp(pFrame, "\xff\xff\xff\xff\xff\xff", 6) == 0) {
+    if (rx_broadcast) return 1;
+    return (pFrame[12] == 0x08 && pFrame[13] == 0x06); // ARP
+  }
+  if (pFrame[0] == 0x01 && pFrame[1] == 0x00 && pFrame[2] == 0x5e) return rx_multicast;
+  return 0;
+}
+
+
+void spi_init(void)
+{
+}
+
+
+void Enc28j60Init(void)
+{
+  if (tap_fd < 0 && sim_ifname != NULL) tap_open();
+
+  rx_broadcast = 1;
+  rx_multicast = 0;
+#if RX_FILTER_PROFILES == 1
+  set_rx_filter_profile((uint8_t)((stored_options2 >> 3) & 0x03));
+#endif // RX_FILTER_PROFILES == 1
+#if MULTICAST_GROUP_SUPPORT == 1
+  Enc28j60JoinGroups();
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+  debug_bytes[2] = (uint8_t)(debug_bytes[2] & 0x80);
+  debug_bytes[2] = (uint8_t)(debug_bytes[2] | ENC28J60_EREVID);
+  update_debug_storage1(); // Only write the EEPROM if the byte changed.
+}
+
+
+#if RX_FILTER_PROFILES == 1
+void set_rx_filter_profile(uint8_t profile)
+{
+  // Profile 0: Unicast to our MAC, plus all broadcasts.
+  // Profile 1: Unicast to our MAC, plus only ARP broadcasts.
+  // Profile 2: Same as Profile 1 plus multicast.
+  if (profile == 0 || profile > 2) {
+    rx_broadcast = 1;
+    rx_multicast = 0;
+    return;
+  }
+  rx_broadcast = 0;
+  rx_multicast = (uint8_t)(profile == 2);
+}
+#endif // RX_FILTER_PROFILES == 1
+
+
+#if MULTICAST_GROUP_SUPPORT == 1
+void Enc28j60JoinGroups(void)
+{
+  // The hash table filter is not simulated. All IPv4 multicast frames are
+  // passed and uip drops the groups that were not joined.
+  rx_multicast = 1;
+}
+#endif // MULTICAST_GROUP_SUPPORT == 1
+
+
+#if RX_DRAIN_SUPPORT == 1
+uint8_t Enc28j60PacketCount(void)
+{
+  // Only tells if there is at least one frame waiting
+  return (uint8_t)sim_tap_wait(0);
+}
+#endif // RX_DRAIN_SUPPORT == 1
+
+
+uint16_t Enc28j60Receive(uint8_t* pBuffer)
+{
+  ssize_t n;
+
+  // The main loop calls Enc28j60Receive() once per pass
+  if (sim_loop_hook != NULL) sim_loop_hook();
+  if (tap_fd < 0) return 0;
+
+  // Wait up to 1ms so that an idle main loop does not use a whole host CPU.
+  // A main loop pass on the module takes about that long.
+  if (!sim_tap_wait(1)) return 0;
+
+  while (1) {
+    n = read(tap_fd, rx_frame, sizeof(rx_frame));
+    if (n <= 0) return 0;
+    if (n < 14 || n > ENC28J60_MAXFRAME || !frame_accepted(rx_frame)) continue;
+    memcpy(pBuffer, rx_frame, (size_t)n);
+    return (uint16_t)n;
+  }
+}
+
+
+void Enc28j60Send(uint8_t* pBuffer, uint16_t nBytes)
+{
+  if (tap_fd >= 0 && write(tap_fd, pBuffer, nBytes) < 0 && errno != EAGAIN) perror("nmsim: TAP write");
+#if FRAME_COPY_STATISTICS == 1
+  tx_copy_bytes = nBytes;
+#endif // FRAME_COPY_STATISTICS == 1
+
+  // Count any transmit
+  TRANSMIT_counter++;
+}
+
+
+void Enc28j60SendComplete(void)
+{
+}
+
+
+#if TCP_REXMIT_FROM_TXBUF == 1
+uint8_t Enc28j60Resend(uint16_t lport, uint16_t rport, uint8_t* pSeqno, uint16_t len, uint8_t* pAckno)
+{
+  // The TX memory is not simulated, so the application always regenerates
+  // the segment
+  return 0;
+}
+#endif // TCP_REXMIT_FROM_TXBUF == 1
+
+
+#if ARP_PENDING_SLOT == 1
+void Enc28j60Hold(uint8_t* pBuffer, uint16_t nBytes)
+{
+  // Copy a frame that is waiting on an ARP reply into the hold slot. A new
+  // frame replaces any frame already held.
+  if (nBytes > sizeof(hold_frame)) return;
+  memcpy(hold_frame, pBuffer, nBytes);
+  hold_len = nBytes;
+}
+
+
+void Enc28j60SendHeld(uint8_t* pDestMac)
+{
+  // Write the destination MAC address into the frame in the hold slot and
+  // transmit it
+  if (hold_len == 0) return;
+  memcpy(hold_frame, pDestMac, 6);
+  Enc28j60Send(hold_frame, hold_len);
+  hold_len = 0;
+}
+#endif // ARP_PENDING_SLOT == 1
+
+
+#if TX_DOUBLE_BUFFER == 1
+void Enc28j60TxPoll(void)
+{
+}
+#endif // TX_DOUBLE_BUFFER == 1
+
+
+void reset_transmit_logic(void)
+{
+}
+
+
+uint8_t wait_for_xmit_complete(void)
+{
+  return 0;
+}
@@ -0,0 +1,247 @@
+// sim_hw.c
+//
+// Host simulation build: the nmsim program, the watchdog resets and the state
+// file that keeps the STM8 EEPROM, the Flash variables and the I2C EEPROM across
+// restarts of the simulation, the same way they survive a power cycle of
+// the module.
+//
+// Usage: nmsim [-e strings] [-i tap] [-s statefile]
+//   -e strings    Strings image made by mkstrings.py. It is loaded into the
+//                 I2C EEPROM at every start, so an upgradeable build always
+//                 has the web pages of its source tree.
+//   -i tap        TAP interface to attach to (default nm0). Create it once
+//                 with "ip tuntap add nm0 mode tap user $USER", give it an
+//                 address in the module's subnet and set it up.
+//   -s statefile  File for the EEPROM and Flash contents (default
+//                 nmsim.state). If it is missing, or was saved by a
+//                 different build, the module starts as a new module.
+//
+// reboot() and the Reset button restart the module through the WWDG. A
+// write of WDGA to WWDG_CR, or the IWDG running out because the main loop
+// stopped servicing IWDG_KR, saves the state and restarts the program (exec)
+// with the matching RST_SR flag set, so the firmware sees a watchdog reset.
+// SIGINT and SIGTERM save the state and exit.
+
+#define _XOPEN_SOURCE 600
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "iostm8s005.h"
+#include "sim.h"
+
+#define TICK_MS		10	// Watchdog check interval
+#define STATE_MAGIC	"NMSIM01"
+
+static const char *state_file = "nmsim.state";
+static const char *strings_file;
+static char **sim_argv;
+static char **sim_envp;                 // environ plus NMSIM_RST_SR
+static char rst_env[] = "NMSIM_RST_SR=0";
+
+static unsigned int iwdg_count;         // ms since IWDG_KR was last serviced
+
+// The firmware's @FLASH_START_xxx variables (see host.h). The section
+// symbols are weak so that a build without any Flash variables still links.
+extern char __start_nm_flash[] __attribute__((weak));
+extern char __stop_nm_flash[] __attribute__((weak));
+
+int nm_main(void);
+
+
+struct state_block {
+  char *data;
+  unsigned long size;
+};
+
+
+static int state_blocks(struct state_block *b)
+{
+  b[0].data = (char *)sim_eeprom;
+  b[0].size = sizeof(sim_eeprom);
+  b[1].data = __start_nm_flash;
+  b[1].size = (unsigned long)(__stop_nm_flash - __start_nm_flash);
+  b[2].data = sim_flash;
+  b[2].size = sizeof(sim_flash);
+  b[3].data = (char *)sim_i2c_eeprom;
+  b[3].size = sizeof(sim_i2c_eeprom);
+  return 4;
+}
+
+
+static void save_state(void)
+{
+  // Also called from the signal handlers, so only async-signal-safe calls
+  // are used.
+  struct state_block b[4];
+  int n;
+  int i;
+  int fd;
+  unsigned long size;
+
+  fd = open(state_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return;
+  n = state_blocks(b);
+  if (write(fd, STATE_MAGIC, 8) != 8) n = 0;
+  for (i = 0; i < n; i++) {
+    size = b[i].size;
+    if (write(fd, &size, sizeof(size)) != sizeof(size)) break;
+    if (size && write(fd, b[i].data, size) != (ssize_t)size) break;
+  }
+  close(fd);
+}
+
+
+static void load_state(void)
+{
+  struct state_block b[4];
+  char magic[8];
+  int n;
+  int i;
+  FILE *f;
+  unsigned long size;
+
+  f = fopen(state_file, "rb");
+  if (f == NULL) return;
+  n = state_blocks(b);
+  if (fread(magic, 8, 1, f) != 1 || memcmp(magic, STATE_MAGIC, 8) != 0) n = -1;
+  for (i = 0; i < n; i++) {
+    // Check all block sizes first so a file saved by a different build is
+    // not partly loaded
+    if (fread(&size, sizeof(size), 1, f) != 1 || size != b[i].size) break;
+    if (fseek(f, (long)size, SEEK_CUR) != 0) break;
+  }
+  if (i == n) {
+    rewind(f);
+    if (fread(magic, 8, 1, f) != 1) n = 0;
+    for (i = 0; i < n; i++) {
+      if (fread(&size, sizeof(size), 1, f) != 1) break;
+      if (size && fread(b[i].data, size, 1, f) != 1) break;
+    }
+  }
+  else {
+    fprintf(stderr, "nmsim: %s is not from this build, starting as a new module\n", state_file);
+  }
+  fclose(f);
+}
+
+
+void sim_reset(unsigned char rst_sr)
+{
+  // Async-signal-safe. The RST_SR flags are passed to the restarted
+  // program in NMSIM_RST_SR. The interval timer is kept by exec, so it is
+  // stopped until the restarted program has its handler in place.
+  static const char msg_wwdg[] = "nmsim: WWDG reset\n";
+  static const char msg_iwdg[] = "nmsim: IWDG reset\n";
+  struct itimerval it;
+
+  if (rst_sr & 0x02) (void)!write(2, msg_iwdg, sizeof(msg_iwdg) - 1);
+  else (void)!write(2, msg_wwdg, sizeof(msg_wwdg) - 1);
+  save_state();
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_REAL, &it, NULL);
+  rst_env[sizeof(rst_env) - 2] = (char)('0' + (rst_sr & 0x07));
+  execve("/proc/self/exe", sim_argv, sim_envp);
+  _exit(1);
+}
+
+
+static void tick(int sig)
+{
+  unsigned int timeout;
+
+  (void)sig;
+
+  // WWDG: The firmware only enables the WWDG to reset the module (reboot()
+  // and the Reset button). The counter is not simulated, the reset is
+  // immediate.
+  if (WWDG_CR & 0x80) sim_reset(0x01);       // WWDGF
+
+  // IWDG: The key writes of iwdg_init() are too close together to be seen
+  // here, so the IWDG counts as started once IWDG_PR / IWDG_RLR are set up
+  // (both are 0 at power on in the simulation). Every 0xaa key write
+  // restarts the count, so IWDG_KR is cleared here to see the next one. The
+  // timeout is (RLR + 1) * 2 * (4 << PR) LSI clocks (128KHz).
+  if (IWDG_KR == 0xaa) {
+    IWDG_KR = 0;
+    iwdg_count = 0;
+  }
+  else if (IWDG_PR != 0 || IWDG_RLR != 0) {
+    iwdg_count += TICK_MS;
+    timeout = ((unsigned int)IWDG_RLR + 1) * (8u << (IWDG_PR & 0x07)) / 128;
+    if (iwdg_count > timeout) sim_reset(0x02); // IWDGF
+  }
+}
+
+
+static void stop(int sig)
+{
+  (void)sig;
+  save_state();
+  _exit(0);
+}
+
+
+int main(int argc, char *argv[])
+{
+  extern char **environ;
+  struct sigaction sa;
+  struct itimerval it;
+  sigset_t mask;
+  const char *rst;
+  int c;
+  int n;
+
+  sim_argv = argv;
+  for (n = 0; environ[n] != NULL; n++) ;
+  sim_envp = calloc((size_t)n + 2, sizeof(char *));
+  if (sim_envp == NULL) return 1;
+  for (c = 0, n = 0; environ[c] != NULL; c++) {
+    if (strncmp(environ[c], "NMSIM_RST_SR=", 13) != 0) sim_envp[n++] = environ[c];
+  }
+  sim_envp[n] = rst_env;
+
+  while ((c = getopt(argc, argv, "e:i:s:")) != -1) {
+    switch (c) {
+      case 'e': strings_file = optarg; break;
+      case 'i': sim_ifname = optarg; break;
+      case 's': state_file = optarg; break;
+      default:
+        fprintf(stderr, "usage: %s [-e strings] [-i tap] [-s statefile]\n", argv[0]);
+        return 2;
+    }
+  }
+
+  sim_power_on();
+  load_state();
+  if (strings_file != NULL && sim_load_strings(strings_file) != 0) return 1;
+
+  rst = getenv("NMSIM_RST_SR");
+  if (rst != NULL) RST_SR = (unsigned char)(rst[0] - '0');
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_flags = SA_RESTART;
+  sa.sa_handler = stop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sa.sa_handler = tick;
+  sigaction(SIGALRM, &sa, NULL);
+  // A watchdog reset execs from the SIGALRM handler, which leaves SIGALRM
+  // blocked
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGALRM);
+  sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+  it.it_interval.tv_sec = 0;
+  it.it_interval.tv_usec = TICK_MS * 1000;
+  it.it_value = it.it_interval;
+  setitimer(ITIMER_REAL, &it, NULL);
+
+  return nm_main();
+}
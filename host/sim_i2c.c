@@ -0,0 +1,189 @@
+// sim_i2c.c
+//
+// Host simulation build replacement for I2C.c. The I2C bus is simulated at
+// the byte level of the I2C.h interface with a 128KB I2C EEPROM (two 64KB
+// blocks at control bytes 0xa0 and 0xa8, as the upgradeable builds use). A
+// write is stored at once, so the EEPROM is never busy. Any other device
+// does not acknowledge its control byte, so the BME280, INA226 and PCF8574
+// are not found.
+//
+// eeprom_copy_to_flash() copies the image from the I2C EEPROM to the
+// simulated program memory and restarts the module. The code that runs
+// stays the same, only the contents of sim_flash[] change.
+
+#include "main.h"
+#include "sim.h"
+
+#define EEPROM_PAGE	128	// Write page size
+
+uint8_t I2C_failcode;
+char * flash_ptr;
+char * ram_ptr;
+uint8_t eeprom_num_write;
+uint8_t eeprom_num_read;
+uint16_t eeprom_base;
+#if FLASH_COPY_STAGING == 1
+uint8_t flash_stage_map[32]; // One bit per 128 byte Flash block. Set if the
+                             // I2C EEPROM image block differs from Flash.
+uint8_t flash_stage_block;   // Next block to be staged
+#endif // FLASH_COPY_STAGING == 1
+
+unsigned char sim_i2c_eeprom[2][SIM_I2C_EEPROM_SIZE];
+
+static unsigned char *bus_device;      // Addressed EEPROM, NULL if none
+static uint8_t bus_read;               // 1 = read transfer
+static uint8_t bus_addr_bytes;         // Byte address bytes received
+static uint16_t bus_addr;              // EEPROM address pointer
+
+
+void sim_i2c_init(void)
+{
+  memset(sim_i2c_eeprom, 0xff, sizeof(sim_i2c_eeprom));
+  bus_device = NULL;
+}
+
+
+uint8_t I2C_control(uint8_t control_byte)
+{
+  // A start condition followed by the control byte. A repeated start for a
+  // read keeps the address pointer set by a preceding write.
+  I2C_failcode = 0;
+  switch (control_byte & 0xfe) {
+    case 0xa0: bus_device = sim_i2c_eeprom[0]; break;
+    case 0xa8: bus_device = sim_i2c_eeprom[1]; break;
+    default:
+      bus_device = NULL;
+      I2C_failcode = I2C_FAIL_NACK_CONTROL_BYTE;
+      return I2C_failcode;
+  }
+  bus_read = (uint8_t)(control_byte & 0x01);
+  bus_addr_bytes = 0;
+  return I2C_failcode;
+}
+
+
+void I2C_byte_address(uint16_t byte_address, uint8_t addr_size)
+{
+  if (bus_device == NULL) {
+    I2C_failcode = I2C_FAIL_NACK_BYTE_ADDRESS2;
+    return;
+  }
+  bus_addr = byte_address;
+  bus_addr_bytes = addr_size;
+}
+
+
+void I2C_write_byte(uint8_t I2C_write_data)
+{
+  // Sequential writes wrap within the EEPROM page as in the device
+  if (bus_device == NULL || bus_read || bus_addr_bytes != 2) {
+    I2C_failcode = I2C_FAIL_NACK_WRITE_BYTE;
+    return;
+  }
+  bus_device[bus_addr] = I2C_write_data;
+  bus_addr = (uint16_t)((bus_addr & ~(EEPROM_PAGE - 1)) | ((bus_addr + 1) & (EEPROM_PAGE - 1)));
+}
+
+
+uint8_t I2C_read_byte(uint8_t I2C_last_flag)
+{
+  uint8_t data;
+
+  data = 0xff;
+  if (bus_device != NULL && bus_read) {
+    data = bus_device[bus_addr];
+    bus_addr++;
+  }
+  if (I2C_last_flag) I2C_stop();
+  return data;
+}
+
+
+void I2C_stop(void)
+{
+  bus_device = NULL;
+}
+
+
+void I2C_reset(void)
+{
+  bus_device = NULL;
+}
+
+
+#if I2C_EEPROM_FAST_COPY == 1 || SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+void eeprom_write_wait(uint8_t control_write)
+{
+  // The simulated EEPROM has no write cycle
+  I2C_stop();
+}
+#endif // I2C_EEPROM_FAST_COPY == 1 || SREC_UPLOAD_PIPELINE == 1 || BINARY_UPLOAD_SUPPORT == 1
+
+
+#if OB_EEPROM_SUPPORT == 1
+void eeprom_copy_to_flash(void)
+{
+  // Copies the main code area and the flash_update segment (253 blocks of
+  // 128 bytes) from the I2C EEPROM at eeprom_base to flash_ptr, then resets
+  // the module as the WWDG reset does.
+  uint16_t i;
+
+  I2C_control(eeprom_num_write);
+  I2C_byte_address(eeprom_base, 2);
+  I2C_control(eeprom_num_read);
+  for (i = 0; i < 253 * 128; i++) *flash_ptr++ = (char)I2C_read_byte(0);
+  I2C_stop();
+
+  sim_reset(0x01);
+}
+
+
+void copy_ram_to_flash(void)
+{
+  // This function copies 128 byte blocks of data from RAM to Flash as part of
+  // the Flash update process.
+  uint8_t i;
+
+  for (i=0; i<128; i++) {
+    *flash_ptr = *ram_ptr;
+    flash_ptr++;
+    ram_ptr++;
+  }
+}
+#endif // OB_EEPROM_SUPPORT == 1
+
+
+#if FLASH_COPY_STAGING == 1
+uint8_t eeprom_stage_block(void)
+{
+  // See eeprom_stage_block() in I2C.c
+  uint8_t i;
+  uint8_t differ;
+  uint16_t offset;
+  char *flash_block;
+
+  if (flash_stage_block == 0) memset(flash_stage_map, 0, sizeof(flash_stage_map));
+
+  offset = (uint16_t)((uint16_t)flash_stage_block << 7);
+  flash_block = (char *)SIM_FLASH(FLASH_START_PROGRAM_MEMORY + offset);
+
+  I2C_control(eeprom_num_write);
+  I2C_byte_address((uint16_t)(eeprom_base + offset), 2);
+  if (I2C_control(eeprom_num_read)) {
+    I2C_stop();
+    return 2;
+  }
+
+  differ = 0;
+  for (i=0; i<127; i++) {
+    if ((char)I2C_read_byte(0) != flash_block[i]) differ = 1;
+  }
+  if ((char)I2C_read_byte(1) != flash_block[127]) differ = 1;
+
+  if (differ) flash_stage_map[flash_stage_block >> 3] |= (uint8_t)(1 << (flash_stage_block & 0x07));
+
+  flash_stage_block++;
+  if (flash_stage_block == 253) return 1;
+  return 0;
+}
+#endif // FLASH_COPY_STAGING == 1
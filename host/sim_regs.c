@@ -0,0 +1,61 @@
+// sim_regs.c
+//
+// Host simulation build: the STM8 registers (see include/iostm8s005.h) and
+// the program memory. Shared by nmsim (sim_hw.c) and pagecheck.
+
+#include <stdio.h>
+#include <string.h>
+
+#define SIM_REG(name) volatile unsigned char name;
+#include "iostm8s005.h"
+#include "sim.h"
+
+volatile unsigned char sim_ports[35];   // Also io_reg[] (see iostm8s005.h)
+
+char sim_flash[0x8000];
+
+static volatile unsigned char flash_iapsr;
+
+
+volatile unsigned char *sim_flash_iapsr(void)
+{
+  // EOP, DUL, PUL and HVOFF: the EEPROM and Flash are always unlocked and
+  // every write completes at once.
+  flash_iapsr = 0x4e;
+  return &flash_iapsr;
+}
+
+
+void sim_power_on(void)
+{
+  // Inputs float high (pull-ups), which also leaves the Reset button (PA1)
+  // released. The EEPROM and Flash variables are all zero, the I2C EEPROM
+  // is erased (0xff).
+  int i;
+
+  memset((void *)sim_ports, 0, sizeof(sim_ports));
+  for (i = 1; i < (int)sizeof(sim_ports); i += 5) sim_ports[i] = 0xff;
+  sim_i2c_init();
+}
+
+
+int sim_load_strings(const char *path)
+{
+  // Loads a Strings image (see mkstrings.py) into the I2C EEPROM Strings
+  // region, as a Strings File upload does. Returns 0 on success.
+  FILE *f;
+  size_t n;
+
+  f = fopen(path, "rb");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  n = fread(sim_i2c_eeprom[1], 1, SIM_I2C_EEPROM_SIZE, f);
+  fclose(f);
+  if (n == 0) {
+    fprintf(stderr, "%s: empty Strings image\n", path);
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,275 @@
+// sim_timer.c
+//
+// Host simulation build replacement for timer.c. The timers of timer.c are
+// kept the same way, with the host monotonic clock in place of TIM1: the
+// time base counts in 10us units like TIM1, and timer_update() adds the
+// whole milliseconds that passed since the last call to the same counters.
+// wait_timer() sleeps instead of polling TIM3, and idle_wait() waits for a
+// frame on the TAP interface for up to 1ms instead of using WFI.
+
+#define _XOPEN_SOURCE 600
+
+#include <time.h>
+
+#include "main.h"
+#include "sim.h"
+
+uint8_t periodic_timer;       // Peroidic_timer counter
+uint8_t mqtt_timer;           // MQTT_timer counter
+uint16_t arp_timer;           // arp_timer counter
+uint8_t t100ms_timer;         // MQTT_timer counter
+
+uint16_t second_toggle;       // MQTT timing: Used in developing a 1 second counter
+uint32_t second_counter;      // MQTT timing: 1 second counter
+
+uint16_t ms_counter;          // Free running ms counter
+
+static uint32_t tb_ms_base;   // Time base count at the last whole ms counted
+                              // by timer_update()
+static uint32_t tb_start;     // Host clock at clock_init() in 10us units
+
+#if FREE_RUNNING_TIMEBASE == 1
+uint32_t ms_time;             // 32 bit free running ms counter
+#endif // FREE_RUNNING_TIMEBASE == 1
+
+#if MAIN_LOOP_SCHEDULER == 1
+static const uint16_t sched_period[SCHED_TASKS] = {
+  1,       // TASK_RUNTIME  check_runtime_changes()
+  1000,    // TASK_DS18B20  DS18B20 read check
+  1000     // TASK_BME280   BME280 read check
+};
+struct sched_task sched_table[SCHED_TASKS]; // Deadline and statistics per task
+uint8_t sched_events;         // Event pending bits, one per task
+#endif // MAIN_LOOP_SCHEDULER == 1
+
+#if IDLE_WAIT_SUPPORT == 1
+uint16_t idle_count;          // Number of WAITs (saturates at 0xffff)
+uint32_t idle_ticks;          // Total time in WAIT in 10us units
+uint16_t idle_max;            // Longest WAIT in 10us units
+uint16_t idle_latency_max;    // Longest time from the wake interrupt to
+                              // the main loop resuming, in 10us units
+#endif // IDLE_WAIT_SUPPORT == 1
+
+
+static uint32_t host_ticks(void)
+{
+  // Host monotonic clock in 10us units
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t)((uint64_t)ts.tv_sec * 100000 + (uint64_t)ts.tv_nsec / 10000);
+}
+
+
+static uint32_t tb_read(void)
+{
+  // Returns the 32 bit time base count (10us per count) since clock_init()
+  return host_ticks() - tb_start;
+}
+
+
+void clock_init(void)
+{
+  tb_start = host_ticks();
+  tb_ms_base = 0;
+#if FREE_RUNNING_TIMEBASE == 1
+  ms_time = 0;
+#endif // FREE_RUNNING_TIMEBASE == 1
+
+  periodic_timer = 0;        // Initialize periodic timer
+  mqtt_timer = 0;            // Initialize mqtt timer
+  t100ms_timer = 0;          // Initialize 100ms timer
+  arp_timer = 0;             // Initialize arp timer
+  second_toggle = 0;         // Initialize toggle for seconds counter
+  second_counter = 0;        // Initialize seconds counter
+  ms_counter = 0;            // Initialize free running ms counter
+
+#if MAIN_LOOP_SCHEDULER == 1
+  {
+    uint8_t i;
+    for (i = 0; i < SCHED_TASKS; i++) {
+      sched_table[i].due = sched_period[i];
+      sched_table[i].max_late = 0;
+      sched_table[i].overruns = 0;
+    }
+    sched_events = 0;
+  }
+#endif // MAIN_LOOP_SCHEDULER == 1
+}
+
+
+#if FREE_RUNNING_TIMEBASE == 1
+uint32_t now_us(void)
+{
+  return tb_read() * 10;
+}
+
+
+uint32_t now_ms(void)
+{
+  return ms_time + (tb_read() - tb_ms_base) / 100;
+}
+#endif // FREE_RUNNING_TIMEBASE == 1
+
+
+void timer_update(void)
+{
+  // See timer_update() in timer.c
+  uint16_t time_ms;
+  uint32_t elapsed;
+
+  elapsed = tb_read() - tb_ms_base;
+  time_ms = (uint16_t)(elapsed / 100);
+  tb_ms_base += (uint32_t)time_ms * 100;
+#if FREE_RUNNING_TIMEBASE == 1
+  ms_time += time_ms;
+#endif // FREE_RUNNING_TIMEBASE == 1
+
+  periodic_timer = (uint8_t)(periodic_timer + time_ms);
+  mqtt_timer = (uint8_t)(mqtt_timer + time_ms);
+  arp_timer = (uint16_t)(arp_timer + time_ms);
+  t100ms_timer = (uint8_t)(t100ms_timer + time_ms);
+  ms_counter = (uint16_t)(ms_counter + time_ms);
+
+  if (second_toggle < 1000) {
+    second_toggle += time_ms;
+  }
+  else {
+    second_toggle = second_toggle - 1000;
+    second_counter ++;
+  }
+}
+
+
+uint8_t periodic_timer_expired(void)
+{
+  if (periodic_timer > 19) {
+    periodic_timer = 0;
+    return(1);
+  }
+  else return(0);
+}
+
+
+uint8_t mqtt_timer_expired(void)
+{
+  if (mqtt_timer > 49) {
+    mqtt_timer = 0;
+    return(1);
+  }
+  else return(0);
+}
+
+
+uint8_t t100ms_timer_expired(void)
+{
+  if (t100ms_timer > 99) {
+    t100ms_timer = 0;
+    return(1);
+  }
+  else return(0);
+}
+
+
+uint8_t arp_timer_expired(void)
+{
+  if (arp_timer > 9999) {
+    arp_timer = 0;       // Reset arp_timer
+    return(1);
+  }
+  else return(0);
+}
+
+
+#if LOOP_PROFILER == 1
+uint16_t profile_timestamp(void)
+{
+  // Free running count with a 10us period
+  return (uint16_t)tb_read();
+}
+#endif // LOOP_PROFILER == 1
+
+
+#if INPUT_EDGE_CAPTURE == 1
+uint16_t ms_timestamp(void)
+{
+  return (uint16_t)(ms_counter + (tb_read() - tb_ms_base) / 100);
+}
+#endif // INPUT_EDGE_CAPTURE == 1
+
+
+#if IDLE_WAIT_SUPPORT == 1
+void idle_wake_mark(void)
+{
+}
+
+
+void idle_init(void)
+{
+  idle_count = 0;
+  idle_ticks = 0;
+  idle_max = 0;
+  idle_latency_max = 0;
+}
+
+
+void idle_wait(void)
+{
+  // A received frame ends the wait at once (as the ENC28J60 -INT interrupt
+  // does), otherwise it ends after 1ms (as the TIM4 interrupt does). The
+  // wake latency is not simulated.
+  uint16_t start;
+  uint16_t end;
+
+  start = (uint16_t)tb_read();
+  sim_tap_wait(1);
+  end = (uint16_t)tb_read();
+
+  if (idle_count != 0xffff) idle_count++;
+  idle_ticks += (uint16_t)(end - start);
+  if ((uint16_t)(end - start) > idle_max) idle_max = (uint16_t)(end - start);
+}
+#endif // IDLE_WAIT_SUPPORT == 1
+
+
+#if MAIN_LOOP_SCHEDULER == 1
+uint8_t sched_due(uint8_t task)
+{
+  // See sched_due() in timer.c
+  uint16_t late;
+  uint8_t mask;
+
+  mask = (uint8_t)(1 << task);
+  late = (uint16_t)(ms_counter - sched_table[task].due);
+
+  if (late & 0x8000) {
+    if (sched_events & mask) {
+      sched_events &= (uint8_t)(~mask);
+      return 1;
+    }
+    return 0;
+  }
+
+  sched_events &= (uint8_t)(~mask);
+  if (late > sched_table[task].max_late) sched_table[task].max_late = late;
+  if (late >= sched_period[task]) {
+    if (sched_table[task].overruns != 0xffff) sched_table[task].overruns++;
+    sched_table[task].due = (uint16_t)(ms_counter + sched_period[task]);
+  }
+  else {
+    sched_table[task].due = (uint16_t)(sched_table[task].due + sched_period[task]);
+  }
+  return 1;
+}
+#endif // MAIN_LOOP_SCHEDULER == 1
+
+
+void wait_timer(uint16_t wait)
+{
+  // Waits for the given number of microseconds
+  struct timespec ts;
+
+  ts.tv_sec = 0;
+  ts.tv_nsec = (long)wait * 1000;
+  while (nanosleep(&ts, &ts) != 0) ;
+}
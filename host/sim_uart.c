@@ -0,0 +1,21 @@
+// sim_uart.c
+//
+// Host simulation build replacement for UART.c. With DEBUG_SUPPORT == 15
+// the UART output is written to stderr.
+
+#include "main.h"
+
+#if DEBUG_SUPPORT == 15
+void InitializeUART(void)
+{
+}
+
+
+void UARTPrintf(char *message)
+{
+  // The firmware ends lines with "\r\n"
+  for (; *message != '\0'; message++) {
+    if (*message != '\r') fputc(*message, stderr);
+  }
+}
+#endif // DEBUG_SUPPORT == 15
@@ -0,0 +1,455 @@
+#!/usr/bin/env python3
+"""Benchmark a NetworkModule over the network and save the results as JSON.
+
+Measures, against a module on the LAN:
+
+    pages       Time to first and last byte of each web page (median of
+                --repeat fetches)
+    state_rps   Requests per second on the Very Short Form state page (/98)
+                over --duration seconds, one request at a time
+    relay_http  Time from sending an Output 1 ON/OFF URL command to the end
+                of the reply
+    relay_mqtt  Time from publishing output/01/set to receiving the module's
+                output/01 state PUBLISH (needs --broker)
+    burst_mqtt  Time for the module to publish the state of every output
+                after output/all/set (needs --broker)
+    reboot      With --reboot: time from the /91 Reboot command to the
+                availability "online" message (reconnect time), and to the
+                last Home Assistant discovery message (discovery time)
+
+Output 1 is switched during the relay tests and is left OFF. Pages that
+the build does not have (a 404 or the IO Control page in its place) are
+reported as null. The module only serves a few connections at a time, so
+run one benchmark at a time and keep Browsers off the module.
+
+With --baseline the results are compared with an earlier results file and
+any timing that is more than --threshold percent worse is listed. The exit
+status is 1 if there are any.
+
+Usage: nmbench.py [options] IP[:port]
+
+    --broker HOST[:port]  MQTT broker the module is connected to
+    --user USER           MQTT username
+    --password PASSWORD   MQTT password
+    --device NAME         Device name (the MQTT topic is NetworkModule/NAME)
+    --repeat N            Fetches per page (default 5)
+    --duration S          Seconds for state_rps (default 10)
+    --reboot              Also measure reboot, reconnect and discovery
+    --output FILE         Results file (default nmbench.json)
+    --baseline FILE       Earlier results file to compare with
+    --threshold PCT       Allowed slowdown in percent (default 20)
+"""
+
+import json
+import socket
+import statistics
+import struct
+import sys
+import time
+
+PAGES = {
+    "60": "IO Control",
+    "61": "Configuration",
+    "66": "Link Error Statistics",
+    "68": "Network Statistics",
+    "98": "Very Short Form IO States",
+    "99": "Short Form IO States",
+    "b0": "Style sheet",
+    "b1": "JSON state",
+    "b2": "JSON pins",
+}
+
+
+def parse_address(text, default_port):
+    if ":" in text:
+        host, port = text.rsplit(":", 1)
+        return host, int(port)
+    return text, default_port
+
+
+def content_complete(data):
+    """Returns True once the reply holds Content-Length bytes of body."""
+    head, sep, body = data.partition(b"\r\n\r\n")
+    if not sep:
+        return False
+    for line in head.split(b"\r\n"):
+        if line.lower().startswith(b"content-length:"):
+            return len(body) >= int(line.split(b":")[1])
+    return False
+
+
+def http_get(address, path, timeout=10):
+    """Returns (status, body, time to first byte, time to last byte)."""
+    start = time.perf_counter()
+    s = socket.create_connection(address, timeout=timeout)
+    s.sendall(("GET /%s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n"
+               % (path, address[0])).encode())
+    data = b""
+    first = None
+    # The module closes the connection after the reply, but stop at
+    # Content-Length in case the close is slow.
+    while not content_complete(data):
+        chunk = s.recv(2048)
+        if not chunk:
+            break
+        if first is None:
+            first = time.perf_counter()
+        data += chunk
+    last = time.perf_counter()
+    s.close()
+    head, _, body = data.partition(b"\r\n\r\n")
+    status = int(head.split(b" ")[1]) if head.startswith(b"HTTP/") else 0
+    if first is None:
+        first = last
+    return status, body, first - start, last - start
+
+
+class Mqtt:
+    """Just enough of a MQTT 3.1.1 client for the benchmarks (QoS 0)."""
+
+    def __init__(self, address, user=None, password=None):
+        self.sock = socket.create_connection(address, timeout=10)
+        self.buffer = b""
+        flags = 0x02
+        payload = self._string("nmbench-%d" % (int(time.time()) % 100000))
+        if user:
+            flags |= 0x80
+            payload += self._string(user)
+        if password:
+            flags |= 0x40
+            payload += self._string(password)
+        self._send(0x10, self._string("MQTT") + bytes([4, flags]) +
+                   struct.pack(">H", 60) + payload)
+        packet_type, body = self.receive(10)
+        if packet_type != 0x20 or body[1] != 0:
+            sys.exit("MQTT broker refused the connection")
+
+    @staticmethod
+    def _string(text):
+        data = text.encode()
+        return struct.pack(">H", len(data)) + data
+
+    def _send(self, header, body):
+        length = bytearray()
+        n = len(body)
+        while True:
+            b = n & 0x7F
+            n >>= 7
+            length.append(b | (0x80 if n else 0))
+            if not n:
+                break
+        self.sock.sendall(bytes([header]) + bytes(length) + body)
+
+    def subscribe(self, topic):
+        self._send(0x82, struct.pack(">H", 1) + self._string(topic) + b"\x00")
+        while self.receive(10)[0] != 0x90:
+            pass
+
+    def publish(self, topic, payload):
+        self._send(0x30, self._string(topic) + payload.encode())
+
+    def receive(self, timeout):
+        """Returns (packet type, body), or (None, None) on timeout."""
+        deadline = time.perf_counter() + timeout
+        while True:
+            if len(self.buffer) >= 2:
+                n = 0
+                shift = 0
+                i = 1
+                while i < len(self.buffer):
+                    n |= (self.buffer[i] & 0x7F) << shift
+                    shift += 7
+                    i += 1
+                    if not self.buffer[i - 1] & 0x80:
+                        break
+                else:
+                    i = None
+                if i is not None and len(self.buffer) >= i + n:
+                    header = self.buffer[0]
+                    body = self.buffer[i:i + n]
+                    self.buffer = self.buffer[i + n:]
+                    return header & 0xF0, body
+            remaining = deadline - time.perf_counter()
+            if remaining <= 0:
+                return None, None
+            self.sock.settimeout(remaining)
+            try:
+                chunk = self.sock.recv(4096)
+            except socket.timeout:
+                return None, None
+            if not chunk:
+                sys.exit("MQTT broker closed the connection")
+            self.buffer += chunk
+
+    def message(self, timeout):
+        """Returns (topic, payload) of the next PUBLISH, or (None, None)."""
+        deadline = time.perf_counter() + timeout
+        while True:
+            packet_type, body = self.receive(deadline - time.perf_counter())
+            if packet_type is None:
+                return None, None
+            if packet_type == 0x30:
+                n = struct.unpack(">H", body[:2])[0]
+                return body[2:2 + n].decode(), body[2 + n:].decode(errors="replace")
+
+
+def bench_pages(address, repeat):
+    results = {}
+    io_control = None
+    for path, name in PAGES.items():
+        ttfb = []
+        ttlb = []
+        body = None
+        for _ in range(repeat):
+            status, body, first, last = http_get(address, path)
+            if status != 200:
+                break
+            ttfb.append(first)
+            ttlb.append(last)
+        if path == "60":
+            io_control = body
+        elif body == io_control:
+            # Builds without the page return the IO Control page instead
+            ttlb = []
+        if not ttlb:
+            results[path] = None
+            continue
+        results[path] = {
+            "name": name,
+            "bytes": len(body),
+            "ttfb_ms": round(statistics.median(ttfb) * 1000, 1),
+            "ttlb_ms": round(statistics.median(ttlb) * 1000, 1),
+            "ttlb_max_ms": round(max(ttlb) * 1000, 1),
+        }
+        print("  /%s %-26s %6d bytes %8.1f ms" %
+              (path, name, len(body), results[path]["ttlb_ms"]))
+    return results
+
+
+def bench_state_rps(address, duration):
+    count = 0
+    errors = 0
+    start = time.perf_counter()
+    while time.perf_counter() - start < duration:
+        try:
+            if http_get(address, "98")[0] == 200:
+                count += 1
+            else:
+                errors += 1
+        except OSError:
+            errors += 1
+    elapsed = time.perf_counter() - start
+    print("  /98 %.1f requests/s, %d errors" % (count / elapsed, errors))
+    return {"requests_per_s": round(count / elapsed, 2), "errors": errors}
+
+
+def bench_relay_http(address, repeat):
+    times = []
+    for i in range(repeat * 2):
+        # /01 is Output 1 ON, /00 is Output 1 OFF. End with OFF.
+        times.append(http_get(address, "01" if i % 2 == 0 else "00")[3])
+    print("  Output 1 via HTTP %.1f ms" % (statistics.median(times) * 1000))
+    return {"median_ms": round(statistics.median(times) * 1000, 1),
+            "max_ms": round(max(times) * 1000, 1)}
+
+
+def wait_for(mqtt, topic, payload, timeout):
+    deadline = time.perf_counter() + timeout
+    while time.perf_counter() < deadline:
+        t, p = mqtt.message(deadline - time.perf_counter())
+        if t == topic and (payload is None or p == payload):
+            return time.perf_counter()
+    return None
+
+
+def bench_relay_mqtt(mqtt, base, repeat):
+    times = []
+    lost = 0
+    for i in range(repeat * 2):
+        payload = "ON" if i % 2 == 0 else "OFF"
+        start = time.perf_counter()
+        mqtt.publish(base + "/output/01/set", payload)
+        end = wait_for(mqtt, base + "/output/01", payload, 5)
+        if end is None:
+            lost += 1
+        else:
+            times.append(end - start)
+    if not times:
+        print("  Output 1 via MQTT: no state messages received")
+        return None
+    print("  Output 1 via MQTT %.1f ms" % (statistics.median(times) * 1000))
+    return {"median_ms": round(statistics.median(times) * 1000, 1),
+            "max_ms": round(max(times) * 1000, 1), "lost": lost}
+
+
+def bench_burst_mqtt(mqtt, base):
+    results = {}
+    for payload in ("ON", "OFF"):
+        seen = set()
+        start = time.perf_counter()
+        last = None
+        mqtt.publish(base + "/output/all/set", payload)
+        # The burst is over when no output state arrives for two seconds
+        while True:
+            t, p = mqtt.message(2)
+            if t is None:
+                break
+            if t.startswith(base + "/output/") and p == payload:
+                seen.add(t)
+                last = time.perf_counter()
+        if last is None:
+            results[payload] = None
+            continue
+        results[payload] = {
+            "messages": len(seen),
+            "duration_ms": round((last - start) * 1000, 1),
+            "per_s": round(len(seen) / (last - start), 1),
+        }
+        print("  All outputs %-3s %d messages in %.1f ms" %
+              (payload, len(seen), results[payload]["duration_ms"]))
+    return results
+
+
+def bench_reboot(address, mqtt, base):
+    results = {"reconnect_ms": None, "discovery_ms": None,
+               "discovery_messages": 0}
+    start = time.perf_counter()
+    try:
+        http_get(address, "91", timeout=5)
+    except OSError:
+        pass
+    if mqtt is None:
+        # Without a broker the reboot is timed by polling the state page
+        while time.perf_counter() - start < 120:
+            try:
+                if http_get(address, "98", timeout=1)[0] == 200:
+                    results["reconnect_ms"] = round(
+                        (time.perf_counter() - start) * 1000)
+                    break
+            except OSError:
+                time.sleep(0.2)
+        print("  Reboot to first /98 reply %s ms" % results["reconnect_ms"])
+        return results
+    # Ignore messages from before the reboot, including the retained
+    # availability message and the Last Will "offline".
+    deadline = start + 120
+    while time.perf_counter() < deadline:
+        t, p = mqtt.message(deadline - time.perf_counter())
+        if t == base + "/availability" and p == "online" and \
+                time.perf_counter() - start > 1:
+            results["reconnect_ms"] = round((time.perf_counter() - start) * 1000)
+            break
+    if results["reconnect_ms"] is None:
+        print("  Reboot: no availability message")
+        return results
+    # Discovery is complete when no config message arrives for five seconds
+    last = None
+    while True:
+        t, p = mqtt.message(5)
+        if t is None:
+            break
+        if t.startswith("homeassistant/") and t.endswith("/config"):
+            results["discovery_messages"] += 1
+            last = time.perf_counter()
+    if last is not None:
+        results["discovery_ms"] = round((last - start) * 1000)
+    print("  Reboot to online %d ms, %d discovery messages done at %s ms" %
+          (results["reconnect_ms"], results["discovery_messages"],
+           results["discovery_ms"]))
+    return results
+
+
+def timings(results, prefix=""):
+    """Yields (name, value) for every timing in the results (larger is
+    worse), and for the rates as negative values."""
+    for key, value in results.items():
+        name = prefix + key
+        if isinstance(value, dict):
+            for item in timings(value, name + "."):
+                yield item
+        elif isinstance(value, (int, float)) and not isinstance(value, bool):
+            if key.endswith("_ms"):
+                yield name, value
+            elif key in ("requests_per_s", "per_s"):
+                yield name, -value
+
+
+def compare(results, baseline, threshold):
+    old = dict(timings(baseline["results"]))
+    worse = []
+    for name, value in timings(results):
+        if name in old and old[name] != 0:
+            change = (value - old[name]) * 100.0 / abs(old[name])
+            if change > threshold:
+                worse.append((name, abs(old[name]), abs(value), change))
+    for name, before, after, change in worse:
+        print("  WORSE %-40s %10.1f -> %10.1f (%+.0f%%)" %
+              (name, before, after, change))
+    if not worse:
+        print("  No timing more than %d%% worse than the baseline" % threshold)
+    return worse
+
+
+def main():
+    args = sys.argv[1:]
+    options = {"--broker": None, "--user": None, "--password": None,
+               "--device": None, "--repeat": "5", "--duration": "10",
+               "--output": "nmbench.json", "--baseline": None,
+               "--threshold": "20"}
+    reboot = "--reboot" in args
+    if reboot:
+        args.remove("--reboot")
+    while len(args) > 1 and args[0] in options:
+        options[args[0]] = args[1]
+        args = args[2:]
+    if len(args) != 1 or args[0].startswith("--"):
+        sys.exit(__doc__[__doc__.index("Usage:"):].splitlines()[0])
+    address = parse_address(args[0], 80)
+    repeat = int(options["--repeat"])
+
+    results = {}
+    print("Pages")
+    results["pages"] = bench_pages(address, repeat)
+    print("State page")
+    results["state_rps"] = bench_state_rps(address, float(options["--duration"]))
+    print("Relay commands")
+    results["relay_http"] = bench_relay_http(address, repeat)
+
+    mqtt = None
+    if options["--broker"]:
+        if not options["--device"]:
+            sys.exit("--broker needs --device")
+        base = "NetworkModule/" + options["--device"]
+        mqtt = Mqtt(parse_address(options["--broker"], 1883),
+                    options["--user"], options["--password"])
+        mqtt.subscribe(base + "/#")
+        mqtt.subscribe("homeassistant/#")
+        # Let the retained messages arrive before timing anything
+        while mqtt.message(1)[0] is not None:
+            pass
+        results["relay_mqtt"] = bench_relay_mqtt(mqtt, base, repeat)
+        results["burst_mqtt"] = bench_burst_mqtt(mqtt, base)
+    if reboot:
+        print("Reboot")
+        results["reboot"] = bench_reboot(address, mqtt,
+                                         "NetworkModule/%s" % options["--device"])
+
+    report = {"module": args[0], "time": time.strftime("%Y-%m-%d %H:%M:%S"),
+              "repeat": repeat, "results": results}
+    with open(options["--output"], "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    print("Results written to %s" % options["--output"])
+
+    if options["--baseline"]:
+        with open(options["--baseline"]) as f:
+            baseline = json.load(f)
+        print("Compared with %s (%s)" % (options["--baseline"], baseline["time"]))
+        if compare(results, baseline, float(options["--threshold"])):
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    try:
+        main()
+    except OSError as e:
+        sys.exit("nmbench.py: %s" % e)
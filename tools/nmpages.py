@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Check the web pages of a running NetworkModule over HTTP.
+
+This is an HTTP client: it checks the one module (one build, one
+configuration) it is pointed at, which can be a flashed module or the host
+simulation (host/nmsim). To check the page templates of every build without
+hardware, and to measure their expansion cost, use the host page check
+instead (make -C host pagecheck-all, see host/pagecheck.c).
+
+Fetches every page and reports for each:
+
+    length      The Content-Length the module predicted (adjust_template_size)
+                and the number of body bytes it actually sent. Any difference
+                is a bug in the size accounting and is listed as an error.
+    us/byte     Time from connect to last byte divided by the body size. This
+                is mostly network time: the TCP handshake, the wait for the
+                acknowledgement of each segment and the ENC28J60 transfers.
+                It shows the page delivery time the user sees, not the CPU
+                cost of the template expansion.
+
+With --golden DIR the bodies are compared with the files saved in DIR by an
+earlier run with --update. Digits are masked before the compare so that live
+values (temperatures, counters, timers) do not show as differences, while
+any change in the page structure or in the width of a field does. Use one
+DIR per build and configuration, for example golden/mqtt_home_upgradeable.
+
+The exit status is 1 if any page has a length error or differs from its
+golden file.
+
+Usage: nmpages.py [--golden DIR] [--update] [--repeat N] IP[:port]
+"""
+
+import os
+import re
+import socket
+import statistics
+import sys
+import time
+
+PAGES = {
+    "60": "IO Control",
+    "61": "Configuration",
+    "62": "PCF8574 IO Control",
+    "63": "PCF8574 Configuration",
+    "66": "Link Error Statistics",
+    "68": "Network Statistics",
+    "98": "Very Short Form IO States",
+    "99": "Short Form IO States",
+    "b0": "Style sheet",
+    "b1": "JSON state",
+    "b2": "JSON pins",
+}
+
+
+def parse_address(text, default_port):
+    if ":" in text:
+        host, port = text.rsplit(":", 1)
+        return host, int(port)
+    return text, default_port
+
+
+def http_get(address, path, timeout=10):
+    """Returns (status, Content-Length, body, time to last byte).
+
+    The reply is read until the module closes the connection so that a
+    body longer than its Content-Length is seen."""
+    start = time.perf_counter()
+    s = socket.create_connection(address, timeout=timeout)
+    s.sendall(("GET /%s HTTP/1.1\r\nHost: %s\r\nConnection: close\r\n\r\n"
+               % (path, address[0])).encode())
+    data = b""
+    try:
+        while True:
+            chunk = s.recv(2048)
+            if not chunk:
+                break
+            data += chunk
+    except socket.timeout:
+        pass
+    last = time.perf_counter()
+    s.close()
+    head, _, body = data.partition(b"\r\n\r\n")
+    status = int(head.split(b" ")[1]) if head.startswith(b"HTTP/") else 0
+    length = None
+    for line in head.split(b"\r\n"):
+        if line.lower().startswith(b"content-length:"):
+            length = int(line.split(b":")[1])
+    return status, length, body, last - start
+
+
+def mask(body):
+    return re.sub(rb"[0-9]", b"0", body)
+
+
+def first_difference(a, b):
+    for i in range(min(len(a), len(b))):
+        if a[i] != b[i]:
+            return i
+    return min(len(a), len(b))
+
+
+def main():
+    args = sys.argv[1:]
+    options = {"--golden": None, "--repeat": "3"}
+    update = "--update" in args
+    if update:
+        args.remove("--update")
+    while len(args) > 1 and args[0] in options:
+        options[args[0]] = args[1]
+        args = args[2:]
+    if len(args) != 1 or args[0].startswith("--") or (update and not options["--golden"]):
+        sys.exit(__doc__.strip().splitlines()[-1])
+    address = parse_address(args[0], 80)
+    golden = options["--golden"]
+    if golden and update:
+        os.makedirs(golden, exist_ok=True)
+
+    errors = 0
+    io_control = None
+    print("  Page                            Length   Sent   us/byte")
+    for path, name in PAGES.items():
+        times = []
+        for _ in range(int(options["--repeat"])):
+            status, length, body, last = http_get(address, path)
+            if status != 200:
+                break
+            times.append(last)
+        if not times or (path != "60" and body == io_control):
+            # Builds without the page return the IO Control page instead
+            continue
+        if path == "60":
+            io_control = body
+        line = "  /%s %-28s %6s %6d %9.1f" % (
+            path, name, length, len(body),
+            statistics.median(times) * 1e6 / max(len(body), 1))
+        if length != len(body):
+            line += "  LENGTH ERROR"
+            errors += 1
+        if golden:
+            golden_file = os.path.join(golden, path + ".golden")
+            if update:
+                with open(golden_file, "wb") as f:
+                    f.write(body)
+            elif os.path.exists(golden_file):
+                with open(golden_file, "rb") as f:
+                    expected = f.read()
+                if mask(expected) != mask(body):
+                    line += "  DIFFERS at byte %d" % first_difference(
+                        mask(expected), mask(body))
+                    errors += 1
+            else:
+                line += "  (no golden file)"
+        print(line)
+
+    if golden and update:
+        print("Golden files written to %s" % golden)
+    if errors:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,126 @@
+#!/usr/bin/env python3
+"""List the shared strings of the NetworkModule web page templates.
+
+The page templates in httpd.c insert commonly repeated HTML with the %yNN
+markers (the ps[] string table in httpd.c). This script reads httpd.c and
+reports:
+
+    markers     For each template, its size and the number of each %yNN
+                marker it uses. adjust_template_size() must add
+                ps[NN].size_less4 once for each of them.
+    fragments   Text that is repeated in two or more templates and is not
+                yet a %yNN string, longest first, with the number of flash
+                bytes an additional ps[] entry would save. A ps[] entry
+                costs the string itself plus 4 bytes.
+
+httpd.c holds the templates of all builds, so a fragment found in two
+variants of the same page (for example the Home Assistant and the Browser
+IO Control pages) is never in one build and saves nothing. Pass the output
+of the preprocessor for one build (for example "gcc -E" with the build
+defines) to see only the templates of that build. Check the page sizes
+with nmpages.py after moving text into the table.
+
+Usage: nmstrings.py [--min N] [--count N] httpd.c
+"""
+
+import re
+import sys
+from difflib import SequenceMatcher
+
+TEMPLATE = re.compile(r"static const char (g_Html\w+)\[\]\s*=")
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+MARKER = re.compile(r"%[a-zA-Z][0-9]{2}")
+ENTRY_COST = 4
+
+
+def strip_comments(text):
+    # Block comments hold old copies of some templates. Keep the line count
+    # so that the reported line numbers match the file.
+    return re.sub(r"/\*.*?\*/", lambda m: "\n" * m.group(0).count("\n"),
+                  text, flags=re.S)
+
+
+def read_templates(path):
+    """Returns a list of (name, line, text)."""
+    with open(path, encoding="latin-1") as f:
+        lines = strip_comments(f.read()).splitlines()
+    templates = []
+    i = 0
+    while i < len(lines):
+        m = TEMPLATE.search(lines[i])
+        if not m:
+            i += 1
+            continue
+        name, line, text = m.group(1), i + 1, ""
+        rest = lines[i][m.end():]
+        while True:
+            if not rest.lstrip().startswith(("#", "//")):
+                text += "".join(LITERAL.findall(rest))
+            if rest.rstrip().endswith(";") or i + 1 >= len(lines):
+                break
+            i += 1
+            rest = lines[i]
+        i += 1
+        # Builds with the I2C EEPROM declare the page as " "
+        if len(text) > 1:
+            templates.append((name, line, text))
+    return templates
+
+
+def atomic(text, markers):
+    # Replace each marker with one private character so that a fragment
+    # never splits a marker.
+    def one(m):
+        return markers.setdefault(m.group(0), chr(0xe000 + len(markers)))
+    return MARKER.sub(one, text)
+
+
+def fragments(templates, minimum, count):
+    markers = {}
+    texts = [atomic(text, markers) for _, _, text in templates]
+    readable = {v: k for k, v in markers.items()}
+    found = []
+    while len(found) < count:
+        best = ""
+        for a in range(len(texts)):
+            for b in range(a + 1, len(texts)):
+                sm = SequenceMatcher(None, texts[a], texts[b], autojunk=False)
+                m = sm.find_longest_match(0, len(texts[a]), 0, len(texts[b]))
+                if m.size > len(best):
+                    best = texts[a][m.a:m.a + m.size]
+        best = best.strip("\0")
+        if len(best) < minimum:
+            break
+        uses = sum(t.count(best) for t in texts)
+        text = "".join(readable.get(c, c) for c in best)
+        found.append((uses * (len(text) - 4) - len(text) - ENTRY_COST, uses, text))
+        # Take the fragment out so that the next search finds another one
+        texts = [t.replace(best, "\0") for t in texts]
+    return found
+
+
+def main():
+    args = sys.argv[1:]
+    options = {"--min": "20", "--count": "10"}
+    while len(args) > 1 and args[0] in options:
+        options[args[0]] = args[1]
+        args = args[2:]
+    if len(args) != 1 or args[0].startswith("--"):
+        sys.exit(__doc__.strip().splitlines()[-1])
+    templates = read_templates(args[0])
+
+    used = sorted({m for _, _, t in templates for m in re.findall(r"%y[0-9]{2}", t)})
+    print("  %-30s %5s %6s  %s" % ("Template", "Line", "Bytes", " ".join(used)))
+    for name, line, text in templates:
+        print("  %-30s %5d %6d  %s" % (name, line, len(text), " ".join(
+            "%4d" % text.count(m) for m in used)))
+
+    print()
+    print("  Saved  Uses  Fragment")
+    for saved, uses, text in fragments(templates, int(options["--min"]),
+                                       int(options["--count"])):
+        print("  %5d  %4d  %s" % (saved, uses, text))
+
+
+if __name__ == "__main__":
+    main()
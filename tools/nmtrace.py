@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+"""Decode the NetworkModule event trace.
+
+The trace is kept in I2C EEPROM3 by firmware built with TRACE_RING_SUPPORT
+and is read out with GET /b5. It is a ring of 512 chunks of 64 bytes:
+
+    0-1    Sequence number, big endian (the chunk is in slot seq % 512)
+    2      Number of entries, bit 7 set if events were dropped while the
+           chunk was full
+    3      0x54 marker
+    4-7    second_counter at the first entry, big endian
+    8-9    ms_counter at the first entry, big endian
+    10-63  9 entries of 6 bytes:
+             0-1  ms since the first entry, big endian
+             2    Event
+             3    Event argument
+             4-5  Event value, big endian
+
+Events are listed oldest first. Times are seconds since the boot they
+belong to; each boot starts with a "boot" line giving the reset cause.
+
+Usage: nmtrace.py trace.bin | IP[:port]
+"""
+
+import os
+import struct
+import sys
+import urllib.request
+
+SLOTS = 512
+CHUNK_SIZE = 64
+HEADER_SIZE = 10
+ENTRY_SIZE = 6
+MARKER = 0x54
+
+TCP_STATES = ("CLOSED", "SYN_RCVD", "SYN_SENT", "ESTABLISHED", "FIN_WAIT_1",
+              "FIN_WAIT_2", "CLOSING", "TIME_WAIT", "LAST_ACK")
+TCP_FLAGS = ((0x02, "SYN"), (0x10, "ACK"), (0x08, "PSH"), (0x01, "FIN"),
+             (0x04, "RST"), (0x20, "URG"))
+RESET_FLAGS = ((0x10, "EMC"), (0x08, "SWIM"), (0x04, "ILLOP"),
+               (0x02, "IWDG"), (0x01, "WWDG"))
+PROTOCOLS = {0: "ARP", 1: "ICMP", 17: "UDP"}
+
+
+def flag_names(value, names):
+    found = [name for bit, name in names if value & bit]
+    return ",".join(found) if found else "-"
+
+
+def frame(arg, value):
+    if arg & 0x80:
+        return "TCP %-11s len %d" % (flag_names(arg & 0x3f, TCP_FLAGS), value)
+    return "%-15s len %d" % (PROTOCOLS.get(arg, "proto %d" % arg), value)
+
+
+def describe(event, arg, value):
+    if event == 1:
+        return "boot    reset %s" % flag_names(arg, RESET_FLAGS)
+    if event == 2:
+        return "rx      " + frame(arg, value)
+    if event == 3:
+        return "tx      " + frame(arg, value)
+    if event == 4:
+        state = arg & 0x0f
+        name = TCP_STATES[state] if state < len(TCP_STATES) else str(state)
+        return "tcp     conn %d %-11s port %d" % (arg >> 4, name, value)
+    if event == 5:
+        return "rexmit  nrtx %d port %d" % (arg, value)
+    if event == 6:
+        return "rxerif  count %d" % value
+    if event == 7:
+        return "mqtt    start step %d status 0x%02x" % (arg, value)
+    if event == 8:
+        return "mqtt    restart step %d" % arg
+    if event == 9:
+        return "sync"
+    return "event %d arg %d value %d" % (event, arg, value)
+
+
+def read_trace(source):
+    if os.path.exists(source):
+        with open(source, "rb") as f:
+            return f.read()
+    with urllib.request.urlopen("http://%s/b5" % source, timeout=30) as r:
+        return r.read()
+
+
+def chunks_in_order(data):
+    if len(data) != SLOTS * CHUNK_SIZE:
+        sys.exit("trace is %d bytes, expected %d" % (len(data), SLOTS * CHUNK_SIZE))
+    slots = [data[i * CHUNK_SIZE:(i + 1) * CHUNK_SIZE] for i in range(SLOTS)]
+
+    def seq(slot):
+        if slots[slot][3] != MARKER:
+            return None
+        return struct.unpack(">H", slots[slot][0:2])[0]
+
+    seq0 = seq(0)
+    if seq0 is None or seq0 % SLOTS != 0:
+        return []
+    # Slot n holds sequence n modulo 512. The slots written since slot 0
+    # hold seq0 + n, the older ones seq0 + n - 512.
+    last = 0
+    while last + 1 < SLOTS and seq(last + 1) == (seq0 + last + 1) & 0xffff:
+        last += 1
+    order = list(range(last + 1, SLOTS)) + list(range(0, last + 1))
+    chunks = []
+    for slot in order:
+        expected = (seq0 + slot - (SLOTS if slot > last else 0)) & 0xffff
+        if seq(slot) == expected:
+            chunks.append(slots[slot])
+    return chunks
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__.strip().splitlines()[-1])
+    data = read_trace(sys.argv[1])
+    for chunk in chunks_in_order(data):
+        count = chunk[2] & 0x7f
+        base = struct.unpack(">I", chunk[4:8])[0]
+        for i in range(min(count, 9)):
+            p = HEADER_SIZE + i * ENTRY_SIZE
+            offset, event, arg, value = struct.unpack(">HBBH", chunk[p:p + ENTRY_SIZE])
+            print("%10.3f  %s" % (base + offset / 1000.0, describe(event, arg, value)))
+        if chunk[2] & 0x80:
+            print("            (events dropped)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Convert a NetworkModule .sx (SREC) file into a binary .nmb upload image.
+
+The .nmb image is accepted by the Code Uploader when the firmware is built
+with BINARY_UPLOAD_SUPPORT. It is a 16 byte header followed by the memory
+image starting at Flash address 0x8000:
+
+    0-3    "NMBI"
+    4      File type: 'N' = Program, 'S' = Strings (from the S0 record)
+    5      Format version (1, or 2 with --delta)
+    6-7    Reserved (0)
+    8-11   Image length, big endian
+    12-15  Image CRC32 (IEEE 802.3 / zlib), big endian
+
+A version 2 (--delta) image is for firmware built with BLOCK_DELTA_UPLOAD.
+The image is padded to a multiple of 128 bytes (a Program image to all of
+Flash) and each 128 byte block is preceded by its own CRC32, big endian, so
+the module can skip the blocks it already holds. The image length and CRC
+in the header cover only the image bytes.
+
+Addresses not covered by the SREC file are filled with zero, matching the
+erased I2C EEPROM content the SREC uploader leaves in gaps. Data at or above
+the Flash user reserve (0xFE80) is not part of the image.
+
+Usage: sx2nmb.py [--delta] NetworkModule.sx [NetworkModule.nmb]
+"""
+
+import struct
+import sys
+import zlib
+
+FLASH_START_PROGRAM_MEMORY = 0x8000
+FLASH_START_USER_RESERVE = 0xFE80
+BLOCK_SIZE = 128
+
+
+def read_srec(path):
+    file_type = None
+    data = {}
+    with open(path, "r") as f:
+        for line_number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line:
+                continue
+            if line[0] != "S":
+                sys.exit("%s:%d: not an SREC record" % (path, line_number))
+            record = bytes.fromhex(line[2:])
+            if (sum(record) & 0xFF) != 0xFF:
+                sys.exit("%s:%d: checksum error" % (path, line_number))
+            if line[1] == "0":
+                # The first S0 data byte identifies the file type
+                file_type = chr(record[3])
+            elif line[1] == "3":
+                address = struct.unpack(">I", record[1:5])[0]
+                for i, b in enumerate(record[5:-1]):
+                    data[address + i] = b
+    if file_type not in ("N", "S"):
+        sys.exit("%s: S0 record does not give a valid file type" % path)
+    return file_type, data
+
+
+def build_image(data):
+    addresses = [a for a in data
+                 if FLASH_START_PROGRAM_MEMORY <= a < FLASH_START_USER_RESERVE]
+    if not addresses:
+        sys.exit("no data in the program memory range")
+    image = bytearray(max(addresses) + 1 - FLASH_START_PROGRAM_MEMORY)
+    for a in addresses:
+        image[a - FLASH_START_PROGRAM_MEMORY] = data[a]
+    return bytes(image)
+
+
+def add_block_crcs(image):
+    blocks = []
+    for i in range(0, len(image), BLOCK_SIZE):
+        block = image[i:i + BLOCK_SIZE]
+        blocks.append(struct.pack(">I", zlib.crc32(block) & 0xFFFFFFFF))
+        blocks.append(block)
+    return b"".join(blocks)
+
+
+def main():
+    args = sys.argv[1:]
+    delta = "--delta" in args
+    if delta:
+        args.remove("--delta")
+    if len(args) not in (1, 2):
+        sys.exit(__doc__.strip().splitlines()[-1])
+    source = args[0]
+    if len(args) == 2:
+        destination = args[1]
+    else:
+        destination = source.rsplit(".", 1)[0] + ".nmb"
+
+    file_type, data = read_srec(source)
+    image = build_image(data)
+    if delta:
+        if file_type == "N":
+            length = FLASH_START_USER_RESERVE - FLASH_START_PROGRAM_MEMORY
+        else:
+            length = -(-len(image) // BLOCK_SIZE) * BLOCK_SIZE
+        image += bytes(length - len(image))
+    header = b"NMBI" + file_type.encode() + bytes([2 if delta else 1, 0, 0])
+    header += struct.pack(">II", len(image), zlib.crc32(image) & 0xFFFFFFFF)
+
+    with open(destination, "wb") as f:
+        if delta:
+            f.write(header + add_block_crcs(image))
+        else:
+            f.write(header + image)
+    print("%s: %d bytes, type %s" % (destination, len(image), file_type))
+
+
+if __name__ == "__main__":
+    main()